@@ -28,11 +28,17 @@
 #include <bayes_tracking/multitracker.h>
 #include <bayes_tracking/models.h>
 #include <bayes_tracking/ekfilter.h>
+#include <bayes_tracking/ifilter.h>
+#include <bayes_tracking/immfilter.h>
 #include <bayes_tracking/ukfilter.h>
 #include <bayes_tracking/pfilter.h>
 
 #include <boost/thread.hpp>
 
+#include "people_tracker/track_checkpoint.h"
+#include "people_tracker/track_history.h"
+#include "people_tracker/tracker_stats.h"
+
 #define __APP_NAME__ "bayes_people_tracker"
 
 using namespace std;
@@ -49,6 +55,32 @@ bool MTRK::isLost(const FilterType* filter, double stdLimit) {
   return false;
 }
 
+// the filter of a new track set up for it
+template<class FilterType>
+void setupFilter(FilterType* filter) {}
+
+// the particles of a PFilter as many as its posterior needs, KLD-sampling
+// over bins of 0.2 m and 0.5 m/s, down to 100
+inline void setupFilter(PFilter* filter) {
+  FM::Vec bins(filter->x.size());
+  for(size_t i = 0; i < bins.size(); i++) {
+    bins[i] = i % 2 ? 0.5 : 0.2; // [.., p, v_p, ..]
+  }
+  filter->setAdaptiveSamples(bins, 100);
+}
+
+// x and X of every filter up to date with its observations, only deferred by
+// an IFilter, whose observations add up until then
+template<class FilterType, int xSize>
+void refreshStates(MultiTracker<FilterType, xSize> &mtrk) {}
+
+template<int xSize>
+void refreshStates(MultiTracker<IFilter, xSize> &mtrk) {
+  for(int i = 0; i < mtrk.size(); i++) {
+    mtrk[i].filter->update();
+  }
+}
+
 // rule to create new track
 template<class FilterType>
 bool MTRK::initialize(FilterType* &filter, sequence_t& obsvSeq, observ_model_t om_flag) {
@@ -60,21 +92,24 @@ bool MTRK::initialize(FilterType* &filter, sequence_t& obsvSeq, observ_model_t o
       return false;
     }
     
+    // [x, y] detections for the state [x, v_x, y, v_y], [x, y, z] ones for [x, v_x, y, v_y, z, v_z]
+    const size_t axes = obsvSeq.back().vec.size();
     FM::Vec v((obsvSeq.back().vec - obsvSeq.front().vec) / dt);
-    FM::Vec x(4);
-    FM::SymMatrix X(4,4);
+    FM::Vec x(2 * axes);
+    FM::SymMatrix X(2 * axes, 2 * axes);
     
-    x[0] = obsvSeq.back().vec[0];
-    x[1] = v[0];
-    x[2] = obsvSeq.back().vec[1];
-    x[3] = v[1];
     X.clear();
-    X(0,0) = sqr(0.2);
-    X(1,1) = sqr(1.0);
-    X(2,2) = sqr(0.2);
-    X(3,3) = sqr(1.0);
+    for(size_t a = 0; a < axes; a++) {
+      x[2 * a] = obsvSeq.back().vec[a];
+      x[2 * a + 1] = v[a];
+      X(2 * a, 2 * a) = sqr(0.2);
+      X(2 * a + 1, 2 * a + 1) = sqr(1.0);
+    }
     
-    filter = new FilterType(4);
+    if(filter == NULL) { // else the filter of a lost track
+      filter = new FilterType(2 * axes);
+      setupFilter(filter);
+    }
     filter->init(x, X);
   }
   else if(om_flag == POLAR) {    
@@ -101,7 +136,10 @@ bool MTRK::initialize(FilterType* &filter, sequence_t& obsvSeq, observ_model_t o
     X(2,2) = sqr(0.5);
     X(3,3) = sqr(1.5);
     
-    filter = new FilterType(4);
+    if(filter == NULL) { // else the filter of a lost track
+      filter = new FilterType(4);
+      setupFilter(filter);
+    }
     filter->init(x, X);
   }
 
@@ -111,28 +149,170 @@ bool MTRK::initialize(FilterType* &filter, sequence_t& obsvSeq, observ_model_t o
   return true;
 }
 
-template<typename FilterType>
-class SimpleTracking {
+/* Cartesian observation of a state older than the filter by lag seconds: the
+ * position is retrodicted with the constant velocity model, h(x) = H F(-lag) x,
+ * and the process noise over the lag adds to the observation noise. A late
+ * detection is thus fused where the person was when it was taken, directly
+ * into the current state, without rewinding the filters. */
+class RetrodictedCartesianModel : public CartesianModel {
+ public:
+  RetrodictedCartesianModel(Float xSD, Float ySD) : CartesianModel(xSD, ySD), xSD(xSD), ySD(ySD) {}
+  
+  /* q: the noise of the prediction model, as accelerations. */
+  void setLag(double lag, const FM::Vec &q) {
+    Hx(0,1) = -lag;
+    Hx(1,3) = -lag;
+    Z(0,0) = sqr(xSD) + q[0] * sqr(0.5 * sqr(lag));
+    Z(1,1) = sqr(ySD) + q[1] * sqr(0.5 * sqr(lag));
+    this->lag = lag;
+  }
+  
+  const FM::Vec& h(const FM::Vec& x) const {
+    z_pred[0] = x[0] - lag * x[1];
+    z_pred[1] = x[2] - lag * x[3];
+    return z_pred;
+  }
+  
+ private:
+  const Float xSD, ySD;
+  double lag = 0.0;
+};
+
+/* RetrodictedCartesianModel of the state [x, v_x, y, v_y, z, v_z]. */
+class RetrodictedCartesianModel3D : public CartesianModel3D {
  public:
-  SimpleTracking(double sLimit = 1.0) {
+  RetrodictedCartesianModel3D(Float xSD, Float ySD, Float zSD) : CartesianModel3D(xSD, ySD, zSD), xSD(xSD), ySD(ySD), zSD(zSD) {}
+  
+  /* q: the noise of the prediction model, as accelerations. */
+  void setLag(double lag, const FM::Vec &q) {
+    Hx(0,1) = -lag;
+    Hx(1,3) = -lag;
+    Hx(2,5) = -lag;
+    Z(0,0) = sqr(xSD) + q[0] * sqr(0.5 * sqr(lag));
+    Z(1,1) = sqr(ySD) + q[1] * sqr(0.5 * sqr(lag));
+    Z(2,2) = sqr(zSD) + q[2] * sqr(0.5 * sqr(lag));
+    this->lag = lag;
+  }
+  
+  const FM::Vec& h(const FM::Vec& x) const {
+    z_pred[0] = x[0] - lag * x[1];
+    z_pred[1] = x[2] - lag * x[3];
+    z_pred[2] = x[4] - lag * x[5];
+    return z_pred;
+  }
+  
+ private:
+  const Float xSD, ySD, zSD;
+  double lag = 0.0;
+};
+
+/* The models and sizes of the tracks of SimpleTracking: on the plane of the
+ * target frame, the state [x, v_x, y, v_y] of [x, y] detections, or in
+ * space, [x, v_x, y, v_y, z, v_z] of [x, y, z] detections, for people on
+ * stairs or on several floors. The z noise is ignored on the plane. */
+struct TrackingPlane {
+  typedef CVModel PredictionModel;
+  typedef CartesianModel ObservationModel;
+  typedef RetrodictedCartesianModel RetrodictedModel;
+  static const int x_size = 4;
+  static const int z_size = 2;
+  
+  static PredictionModel *predictionModel(double x, double y, double z) { return new CVModel(x, y); }
+  static ObservationModel *observationModel(double x, double y, double z) { return new CartesianModel(x, y); }
+  static RetrodictedModel *retrodictedModel(double x, double y, double z) { return new RetrodictedCartesianModel(x, y); }
+};
+
+struct TrackingSpace {
+  typedef CVModel3D PredictionModel;
+  typedef CartesianModel3D ObservationModel;
+  typedef RetrodictedCartesianModel3D RetrodictedModel;
+  static const int x_size = 6;
+  static const int z_size = 3;
+  
+  static PredictionModel *predictionModel(double x, double y, double z) { return new CVModel3D(x, y, z); }
+  static ObservationModel *observationModel(double x, double y, double z) { return new CartesianModel3D(x, y, z); }
+  static RetrodictedModel *retrodictedModel(double x, double y, double z) { return new RetrodictedCartesianModel3D(x, y, z); }
+};
+
+/* The tracks of one tick, entry i of every array being the same track,
+ * filled in place by SimpleTracking and reused from tick to tick: nothing is
+ * allocated once the arrays have grown, and no message is built here. */
+struct TrackSnapshot {
+  std::vector<long> ids;
+  std::vector<TrackPose> poses;        // state [x, v_x, y, v_y(, z, v_z)] and position variance
+  std::vector<double> reliability;
+  std::vector<std::string> sample_ids;
+  
+  size_t size() const { return ids.size(); }
+  void resize(size_t n) {
+    ids.resize(n);
+    poses.resize(n);
+    reliability.resize(n);
+    sample_ids.resize(n);
+  }
+};
+
+/* What PeopleTracker needs of SimpleTracking, whatever its filter: one
+ * virtual call per detection message or tracking cycle, the filter type being
+ * a template parameter below it, down to MultiTracker and the filters. */
+class Tracker {
+ public:
+  virtual ~Tracker() {}
+  /* The z noises are those of a tracker in space only, c.f. TrackingSpace. */
+  virtual void createConstantVelocityModel(double vel_noise_x, double vel_noise_y, double vel_noise_z) = 0;
+  virtual void addDetectorModel(std::string name, association_t alg, observ_model_t om_flag, double pos_noise_x, double pos_noise_y, double pos_noise_z,
+				unsigned int seqSize = 5, double seqTime = 0.2) = 0;
+  virtual void track(TrackSnapshot &tracks, double* track_time = NULL) = 0;
+  /* The filters of the tracker on threads, c.f. MultiTracker::setParallel. */
+  virtual void setParallel(size_t threads, size_t minTracks) = 0;
+  /* The size of the gates of the detections, c.f. MultiTracker::setGate. */
+  virtual void setGate(gate_t confidence) = 0;
+  virtual void addObservation(const std::string &detector, people_msgs::PositionMeasurementArray &obsv, double obsv_time,
+			      TrackSnapshot *estimates_after = NULL) = 0;
+  /* The tracks and candidate sequences, for a checkpoint, c.f. track_checkpoint.h. */
+  virtual void saveState(TrackerState &state) = 0;
+  /* Those of a checkpoint, into a tracker without tracks yet: the next
+   * prediction takes them from the time of the checkpoint to now. */
+  virtual void restoreState(const TrackerState &state) = 0;
+#ifdef PEOPLE_TRACKER_INSTRUMENTATION
+  /* Adds the counters of the tracker to counters, from any thread. */
+  virtual void addCounters(TrackerCounters &counters) = 0;
+#endif
+};
+
+template<typename FilterType, class SpaceType = TrackingPlane>
+class SimpleTracking : public Tracker {
+ public:
+  typedef typename SpaceType::PredictionModel PredictionModel;
+  
+  SimpleTracking(double sLimit = 1.0, double mLag = 0.0, double fWindow = 0.0) {
     time = ros::Time::now().toSec();
-    observation = new FM::Vec(2);
+    windowStart = time - fWindow;
+    observation = new FM::Vec(SpaceType::z_size);
     stdLimit = sLimit;
+    maxLag = mLag;
+    fusionWindow = fWindow;
   }
   
-  void createConstantVelocityModel(double vel_noise_x, double vel_noise_y) {
-    cvm = new CVModel(vel_noise_x, vel_noise_y);
+  void createConstantVelocityModel(double vel_noise_x, double vel_noise_y, double vel_noise_z) override {
+    cvm = SpaceType::predictionModel(vel_noise_x, vel_noise_y, vel_noise_z);
   }
   
-  void addDetectorModel(std::string name, association_t alg, observ_model_t om_flag, double pos_noise_x, double pos_noise_y, unsigned int seqSize = 5, double seqTime = 0.2) {
+  void addDetectorModel(std::string name, association_t alg, observ_model_t om_flag, double pos_noise_x, double pos_noise_y, double pos_noise_z,
+			unsigned int seqSize = 5, double seqTime = 0.2) override {
     ROS_INFO("[%s] Adding detector model for: %s", __APP_NAME__, name.c_str());
+    if(SpaceType::z_size == 3 && om_flag != CARTESIAN) {
+      ROS_ERROR("[%s] Detector %s not added: only CARTESIAN detectors are tracked in 3D.", __APP_NAME__, name.c_str());
+      return;
+    }
 
     detector_model det;
     det.om_flag = om_flag;
     det.alg = alg;
 
     if(om_flag == CARTESIAN) {
-      det.ctm = new CartesianModel(pos_noise_x, pos_noise_y);
+      det.ctm = SpaceType::observationModel(pos_noise_x, pos_noise_y, pos_noise_z);
+      det.rtm = SpaceType::retrodictedModel(pos_noise_x, pos_noise_y, pos_noise_z);
     }
     else if(om_flag == POLAR) {
       det.plm = new PolarModel(pos_noise_x, pos_noise_y);
@@ -148,9 +328,18 @@ class SimpleTracking {
 
   }
   
-  std::map<long, std::vector<people_msgs::Person> > track(double* track_time = NULL) {
+  void setParallel(size_t threads, size_t minTracks) override {
+    boost::mutex::scoped_lock lock(mutex);
+    mtrk.setParallel(threads, minTracks);
+  }
+  
+  void setGate(gate_t confidence) override {
+    boost::mutex::scoped_lock lock(mutex);
+    mtrk.setGate(confidence);
+  }
+  
+  void track(TrackSnapshot &tracks, double* track_time = NULL) override {
     boost::mutex::scoped_lock lock(mutex);
-    std::map<long, std::vector<people_msgs::Person> > result;
     dt = ros::Time::now().toSec() - time;
     time += dt;
     if(track_time) {
@@ -158,35 +347,160 @@ class SimpleTracking {
     }
     
     // prediction
-    cvm->update(dt);
-    mtrk.template predict<CVModel>(*cvm);
-    
-    for(int i = 0; i < mtrk.size(); i++) {
-      people_msgs::Person person, variance; // position, velocity, variance
-      
-      person.name = mtrk[i].detector;
-      person.tags.push_back(mtrk[i].sampleID);
-      person.reliability = mtrk[i].probability;
-      
-      person.position.x = mtrk[i].filter->x[0];
-      person.position.y = mtrk[i].filter->x[2];
-      
-      person.velocity.x = mtrk[i].filter->x[1];
-      person.velocity.y = mtrk[i].filter->x[3];
-
-      result[mtrk[i].id].push_back(person);
-
-      variance.position.x = mtrk[i].filter->X(0,0);
-      variance.position.y = mtrk[i].filter->X(2,2);
-      
-      result[mtrk[i].id].push_back(variance);
+    {
+      TRACKER_SCOPED_TIMER(predict_latency);
+      cvm->update(dt);
+      mtrk.template predict<PredictionModel>(*cvm);
     }
+    windowStart = time;
     
-    return result;
+    estimates(tracks);
   }
 
-  void addObservation(std::string detector, people_msgs::PositionMeasurementArray &obsv, double obsv_time) {
+  /* With estimates_after, the tracks right after the update as track() would
+   * return them, already predicted to now: no other prediction is needed to
+   * publish them. */
+  void addObservation(const std::string &detector, people_msgs::PositionMeasurementArray &obsv, double obsv_time,
+		      TrackSnapshot *estimates_after = NULL) override {
     boost::mutex::scoped_lock lock(mutex);
+    update(detector, obsv, obsv_time);
+    if(estimates_after) {
+      estimates(*estimates_after);
+    }
+  }
+  
+  void saveState(TrackerState &state) override {
+    boost::mutex::scoped_lock lock(mutex);
+    refreshStates(mtrk);
+    state.time = time;
+    state.next_id = mtrk.nextId();
+    state.tracks.resize(mtrk.size());
+    for(int i = 0; i < mtrk.size(); i++) {
+      TrackState &track = state.tracks[i];
+      const FilterType *filter = mtrk[i].filter;
+      const size_t n = filter->x.size();
+      track.id = mtrk[i].id;
+      track.x.assign(filter->x.begin(), filter->x.end());
+      track.X.resize(n * n);
+      for(size_t r = 0; r < n; r++) {
+	for(size_t c = 0; c < n; c++) {
+	  track.X[r * n + c] = filter->X(r, c);
+	}
+      }
+      track.detector = mtrk.name(mtrk[i].detector);
+      track.sample_id = mtrk.name(mtrk[i].sampleID);
+      track.probability = mtrk[i].probability;
+    }
+    mtrk.getSequences(sequences);
+    state.sequences.resize(sequences.size());
+    for(size_t q = 0; q < sequences.size(); q++) {
+      state.sequences[q].resize(sequences[q].size());
+      for(size_t k = 0; k < sequences[q].size(); k++) {
+	const observation_t &o = sequences[q][k];
+	SequenceObservation &saved = state.sequences[q][k];
+	saved.z.assign(o.vec.begin(), o.vec.end());
+	saved.time = o.time;
+	saved.prob = o.prob;
+	saved.name = mtrk.name(o.name);
+	saved.flag = mtrk.name(o.flag);
+      }
+    }
+  }
+  
+  /* The tracks of another space (tracking_3d) are left out. */
+  void restoreState(const TrackerState &state) override {
+    boost::mutex::scoped_lock lock(mutex);
+    const size_t n = SpaceType::x_size;
+    FM::Vec x(n);
+    FM::SymMatrix X(n, n);
+    for(size_t i = 0; i < state.tracks.size(); i++) {
+      const TrackState &track = state.tracks[i];
+      if(track.x.size() != n || track.id < 0) {
+	continue;
+      }
+      for(size_t r = 0; r < n; r++) {
+	x[r] = track.x[r];
+	for(size_t c = r; c < n; c++) {
+	  X(r, c) = track.X[r * n + c];
+	}
+      }
+      FilterType *filter = new FilterType(n);
+      setupFilter(filter);
+      filter->init(x, X);
+      mtrk.restoreTrack(track.id, filter, mtrk.nameId(track.detector), mtrk.nameId(track.sample_id), track.probability);
+    }
+    mtrk.setNextId(std::max(state.next_id, 0L));
+    for(size_t q = 0; q < state.sequences.size(); q++) {
+      const std::vector<SequenceObservation> &saved = state.sequences[q];
+      sequence_t sequence;
+      sequence.reserve(saved.size());
+      bool valid = true;
+      for(size_t k = 0; k < saved.size(); k++) {
+	valid = valid && saved[k].z.size() == (size_t)SpaceType::z_size;
+	if(!valid) {
+	  break;
+	}
+	FM::Vec z(saved[k].z.size());
+	std::copy(saved[k].z.begin(), saved[k].z.end(), z.begin());
+	sequence.push_back(observation_t(z, saved[k].time, mtrk.nameId(saved[k].name), mtrk.nameId(saved[k].flag), saved[k].prob));
+      }
+      if(valid) {
+	mtrk.restoreSequence(sequence);
+      }
+    }
+    time = state.time;
+    windowStart = time - fusionWindow;
+  }
+  
+#ifdef PEOPLE_TRACKER_INSTRUMENTATION
+  void addCounters(TrackerCounters &counters) override {
+    predict_latency.counts(counters.predict);
+    associate_latency.counts(counters.associate);
+    update_latency.counts(counters.update);
+    boost::mutex::scoped_lock lock(mutex);
+    counters.filters += mtrk.size();
+    counters.sequences += mtrk.sequences();
+    counters.gated += mtrk.gated();
+  }
+#endif
+  
+ private:
+  typedef struct {
+    typename SpaceType::ObservationModel *ctm; // Cartesian observation model
+    typename SpaceType::RetrodictedModel *rtm; // the same, for detections older than the state
+    PolarModel *plm;        // Polar observation model
+    BearingModel *brm;
+    observ_model_t om_flag; // Observation model flag
+    association_t alg;      // Data association algorithm
+    unsigned int seqSize;   // Minimum number of observations for new track creation
+    double seqTime;         // Minimum interval between observations for new track creation
+  } detector_model;
+  
+  void estimates(TrackSnapshot &tracks) {
+    refreshStates(mtrk);
+    tracks.resize(mtrk.size());
+    for(int i = 0; i < mtrk.size(); i++) {
+      TrackPose &pose = tracks.poses[i];
+      pose.x = mtrk[i].filter->x[0];
+      pose.vx = mtrk[i].filter->x[1];
+      pose.y = mtrk[i].filter->x[2];
+      pose.vy = mtrk[i].filter->x[3];
+      pose.var_x = mtrk[i].filter->X(0,0);
+      pose.var_y = mtrk[i].filter->X(2,2);
+      if(SpaceType::x_size == 6) {
+	pose.z = mtrk[i].filter->x[4];
+	pose.vz = mtrk[i].filter->x[5];
+	pose.var_z = mtrk[i].filter->X(4,4);
+      } else {
+	pose.z = pose.vz = pose.var_z = 0.0;
+      }
+      tracks.ids[i] = mtrk[i].id;
+      tracks.reliability[i] = mtrk[i].probability;
+      tracks.sample_ids[i] = mtrk.name(mtrk[i].sampleID); // keeps its capacity
+    }
+  }
+
+  void update(const std::string &detector, people_msgs::PositionMeasurementArray &obsv, double obsv_time) {
     ROS_DEBUG("[%s] Adding new observations for detector: %s", __APP_NAME__, detector.c_str());
     
     // add last observation/s to tracker
@@ -198,52 +512,111 @@ class SimpleTracking {
       return;
     }
     
-    dt = ros::Time::now().toSec() - time;
-    time += dt;
+    // prediction, once for all the detections of a fusion window
+    double now = ros::Time::now().toSec();
+    if(now - windowStart >= fusionWindow) {
+      TRACKER_SCOPED_TIMER(predict_latency);
+      dt = now - time;
+      time += dt;
+      windowStart = time;
+      cvm->update(dt);
+      mtrk.template predict<PredictionModel>(*cvm);
+    }
     
-    // prediction
-    cvm->update(dt);
-    mtrk.template predict<CVModel>(*cvm);
+    // out of sequence, the detections are older than the state they update
+    double lag = time - obsv_time;
+    bool retrodict = maxLag > 0.0 && det.om_flag == CARTESIAN && lag > 0.0;
+    if(retrodict && lag > maxLag) {
+      ROS_WARN_THROTTLE(5.0, "[%s] Detections of %s are %f s late, more than %f s, dropped.", __APP_NAME__, detector.c_str(), lag, maxLag);
+      return;
+    }
 
     for(size_t i = 0; i < obsv.people.size(); i++) {
       if(det.om_flag == CARTESIAN) {
 	(*observation)[0] = obsv.people[i].pos.x;
 	(*observation)[1] = obsv.people[i].pos.y;
+	if(SpaceType::z_size == 3) {
+	  (*observation)[2] = obsv.people[i].pos.z;
+	}
       }
       else if(det.om_flag == POLAR) {
 	(*observation)[0] = atan2(obsv.people[i].pos.y, obsv.people[i].pos.x); // bearing
 	(*observation)[1] = sqrt(pow(obsv.people[i].pos.x, 2) + pow(obsv.people[i].pos.y, 2)); // range
       }
       
-      mtrk.addObservation(*observation, obsv_time, obsv.people[i].name, obsv.people[i].object_id, obsv.people[i].reliability);
+      mtrk.addObservation(*observation, obsv_time, mtrk.nameId(obsv.people[i].name), mtrk.nameId(obsv.people[i].object_id), obsv.people[i].reliability);
     }
     
-    if(det.om_flag == CARTESIAN) {
-      mtrk.process(*(det.ctm), det.om_flag, det.alg, det.seqSize, det.seqTime, stdLimit);
+    if(retrodict) {
+      det.rtm->setLag(lag, cvm->q);
+      process(*(det.rtm), det);
+    }
+    else if(det.om_flag == CARTESIAN) {
+      process(*(det.ctm), det);
     }
     else if(det.om_flag == POLAR) {
-      mtrk.process(*(det.plm), det.om_flag, det.alg, det.seqSize, det.seqTime, stdLimit);
+      process(*(det.plm), det);
     }
   }
   
- private:
-  FM::Vec *observation; // observation [x, y]
+  /* MultiTracker::process, its two halves timed apart. */
+  template<class ObservationModelType>
+  void process(ObservationModelType &om, const detector_model &det) {
+    bool associated;
+    {
+      TRACKER_SCOPED_TIMER(associate_latency);
+      associated = mtrk.associate(om, det.alg);
+    }
+    TRACKER_SCOPED_TIMER(update_latency);
+    mtrk.update(om, associated, det.om_flag, det.seqSize, det.seqTime, stdLimit);
+  }
+  
+  FM::Vec *observation; // observation [x, y(, z)]
   double dt, time;
   boost::mutex mutex;
-  CVModel *cvm; // Constant Velocity model
-  MultiTracker<FilterType, 4> mtrk; // state [x, v_x, y, v_y]
+  PredictionModel *cvm; // Constant Velocity model
+  MultiTracker<FilterType, SpaceType::x_size> mtrk; // state [x, v_x, y, v_y(, z, v_z)]
   double stdLimit; // upper limit for the variance of estimation position
+  double maxLag;   // latest detections retrodicted, in seconds; 0 to fuse all of them as current
+  double fusionWindow; // detections fused at the same prediction, in seconds; 0 to predict for each message
+  double windowStart;  // time of the last prediction
+#ifdef PEOPLE_TRACKER_INSTRUMENTATION
+  LatencyHistogram predict_latency;
+  LatencyHistogram associate_latency;
+  LatencyHistogram update_latency;
+#endif
   
-  typedef struct {
-    CartesianModel *ctm;    // Cartesian observation model
-    PolarModel *plm;        // Polar observation model
-    BearingModel *brm;
-    observ_model_t om_flag; // Observation model flag
-    association_t alg;      // Data association algorithm
-    unsigned int seqSize;   // Minimum number of observations for new track creation
-    double seqTime;         // Minimum interval between observations for new track creation
-  } detector_model;
-
   std::map<std::string, detector_model> detectors;
+  std::vector<sequence_t> sequences; // of saveState, kept for their storage
 };
+
+/* The tracker of a filter_type parameter (EKF, UKF, PF, IF or IMM), NULL for
+ * others; in space, c.f. TrackingSpace, with any of them but IMM, whose
+ * models are those of the plane. */
+inline Tracker *createTracker(const std::string &filter, double stdLimit, double maxLag = 0.0, double fusionWindow = 0.0, bool space = false) {
+  if(space) {
+    if(filter == "EKF") {
+      return new SimpleTracking<EKFilter, TrackingSpace>(stdLimit, maxLag, fusionWindow);
+    } else if(filter == "UKF") {
+      return new SimpleTracking<UKFilter, TrackingSpace>(stdLimit, maxLag, fusionWindow);
+    } else if(filter == "PF") {
+      return new SimpleTracking<PFilter, TrackingSpace>(stdLimit, maxLag, fusionWindow);
+    } else if(filter == "IF") {
+      return new SimpleTracking<IFilter, TrackingSpace>(stdLimit, maxLag, fusionWindow);
+    }
+    return NULL;
+  }
+  if(filter == "EKF") {
+    return new SimpleTracking<EKFilter>(stdLimit, maxLag, fusionWindow);
+  } else if(filter == "UKF") {
+    return new SimpleTracking<UKFilter>(stdLimit, maxLag, fusionWindow);
+  } else if(filter == "PF") {
+    return new SimpleTracking<PFilter>(stdLimit, maxLag, fusionWindow);
+  } else if(filter == "IF") {
+    return new SimpleTracking<IFilter>(stdLimit, maxLag, fusionWindow);
+  } else if(filter == "IMM") {
+    return new SimpleTracking<IMMFilter>(stdLimit, maxLag, fusionWindow);
+  }
+  return NULL;
+}
 #endif //FLOBOT_TRACKING_H
@@ -0,0 +1,56 @@
+#ifndef OBSERVATION_QUEUE_H
+#define OBSERVATION_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+/* Unbounded lock-free multi-producer single-consumer queue (D. Vyukov's
+ * intrusive MPSC node queue). Any thread may push(), a push is one atomic
+ * exchange; only one thread may pop(). The consumer always owns a stub node,
+ * the value of a popped node is moved out and the node becomes the stub. */
+template <typename T>
+class ObservationQueue
+{
+ public:
+  ObservationQueue() : head_(new Node()), tail_(head_.load()) {}
+  ~ObservationQueue() {
+    T value;
+    while(pop(value)) {}
+    delete tail_;
+  }
+  ObservationQueue(const ObservationQueue &) = delete;
+  ObservationQueue &operator=(const ObservationQueue &) = delete;
+  
+  void push(T value) {
+    Node *node = new Node();
+    node->value = std::move(value);
+    Node *prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release); // consumers see the node from here on
+  }
+  
+  /* Consumer side, false when empty (or a push is halfway through). */
+  bool pop(T &value) {
+    Node *tail = tail_;
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if(next == NULL) {
+      return false;
+    }
+    value = std::move(next->value);
+    tail_ = next;
+    delete tail;
+    return true;
+  }
+  
+ private:
+  struct Node {
+    Node() : next(NULL) {}
+    T value;
+    std::atomic<Node*> next;
+  };
+  
+  std::atomic<Node*> head_; // the last pushed node, written by the producers
+  Node *tail_;              // the stub, written by the consumer only
+};
+
+#endif // OBSERVATION_QUEUE_H
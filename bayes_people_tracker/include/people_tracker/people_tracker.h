@@ -7,22 +7,97 @@
 #include <geometry_msgs/PoseArray.h>
 #include <people_msgs/People.h>
 #include <people_msgs/PositionMeasurementArray.h>
+#include <std_msgs/UInt8.h>
 
+#include <boost/thread/shared_mutex.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
 #include "bayes_people_tracker/PeopleTracker.h"
+#include "bayes_people_tracker/TrackStates.h"
 
 #include "people_tracker/flobot_tracking.h"
+#include "people_tracker/sharded_tracking.h"
 #include "people_tracker/asso_exception.h"
+#include "people_tracker/track_history.h"
+#include "people_tracker/observation_queue.h"
+#include "people_tracker/trajectory_logger.h"
+#include "people_tracker/track_checkpoint.h"
+#include "people_tracker/tracker_stats.h"
+
+#include <thread_config/thread_config.h>
+
+#ifdef PEOPLE_TRACKER_INSTRUMENTATION
+#include <diagnostic_updater/diagnostic_updater.h>
+#endif
+
+#include <atomic>
+#include <set>
+#include <unordered_map>
+
+/* The detections of one message, in the target frame. */
+struct ObservationBatch
+{
+  std::string detector;
+  double time;
+  double max_age; // latency budget of the detector, c.f. DetectorSubscription
+  std::vector<people_msgs::PositionMeasurement> people;
+};
+
+/* One detector of the detectors parameter. It is subscribed while the tracks
+ * have subscribers, with a small queue: roscpp drops the oldest message of
+ * a full queue, so a burst never leaves a backlog of stale detections. */
+struct DetectorSubscription
+{
+  std::string name;
+  std::string topic;
+  int queue_size;
+  double max_age; // in seconds, older detections are dropped; 0 for no limit
+  ros::Subscriber subscriber;
+};
+
+/* The models of the tracker, from the parameters, kept to build it again
+ * of another filter, c.f. PeopleTracker::switchFilter. */
+struct TrackerParams
+{
+  double std_limit = 1.0;
+  double max_lag;
+  double fusion_window;
+  int shards;
+  double shard_tile_size;
+  double shard_margin;
+  bool tracking_3d;
+  int parallel_threads;
+  int parallel_min_tracks;
+  double association_gate;
+  XmlRpc::XmlRpcValue cv_noise;
+  XmlRpc::XmlRpcValue detectors;
+};
+
+/* The markers of one live track, built at its birth. */
+struct TrackMarkers
+{
+  visualization_msgs::Marker id;
+  visualization_msgs::Marker trail;
+};
 
 class PeopleTracker
 {
  public:
-  PeopleTracker();
+  // Subscribes to the detectors of the parameters of private_node_handle and starts the
+  // tracking thread, handled by the callback queue of n (of the node or of a nodelet).
+  PeopleTracker(ros::NodeHandle n = ros::NodeHandle(), ros::NodeHandle private_node_handle = ros::NodeHandle("~"));
+  ~PeopleTracker();
   
  private:
   void trackingThread();
+  void extrapolationThread();
+  void publishTracks(const TrackSnapshot &tracks);
+  void addObservation(const std::string &detector, people_msgs::PositionMeasurementArray &obsv, double obsv_time,
+		      TrackSnapshot *estimates);
+  void drainObservations();
+  const std::string &trackUUID(long id);
+  bool lookupTransform(const std::string &frame, const ros::Time &stamp, tf::Transform &transform);
   void publishDetections(bayes_people_tracker::PeopleTracker msg);
   void publishDetections(geometry_msgs::PoseArray msg);
   void publishDetections(people_msgs::People msg);
@@ -34,20 +109,27 @@ class PeopleTracker
 			 std::vector<double> angles,
 			 double min_dist,
 			 double angle);
-  void publishTrajectory(std::vector<people_msgs::Person> people,
-			 std::vector<people_msgs::Person> variances,
-			 std::vector<long> pids,
-			 ros::Publisher& pub);
-  void PN_experts(geometry_msgs::PoseArray &variance,
-		  geometry_msgs::PoseArray &velocity,
-		  geometry_msgs::PoseArray &trajectory);
-  void track_probability(geometry_msgs::PoseArray &trajectory);
-  void createVisualisation(std::vector<people_msgs::Person> people,
-			   std::vector<long> pids,
-			   ros::Publisher& pub);
-  void detectorCallback(const people_msgs::PositionMeasurementArray::ConstPtr& pma, std::string detector);
+  void publishTrajectory(const TrackSnapshot &tracks, ros::Publisher& pub);
+  void PN_experts(const TrackStats &stats, std::string &label);
+  void track_probability(const TrackStats &stats, long id, std::string &label);
+  void publishGates(const TrackSnapshot &tracks, ros::Publisher& pub);
+  void publishTrackStates(const TrackSnapshot &tracks, ros::Publisher& pub);
+  void initTrackMarkers(long pid, TrackMarkers &markers);
+  void createVisualisation(const TrackSnapshot &tracks, ros::Publisher& pub);
+  void detectorCallback(const people_msgs::PositionMeasurementArray::ConstPtr& pma, size_t detector);
+  bool isStale(const std::string &detector, double time, double max_age);
   void connectCallback(ros::NodeHandle &n);
   void parseParams(ros::NodeHandle);
+  Tracker *buildTracker(const std::string &filter);
+  void degradationCallback(const std_msgs::UInt8::ConstPtr &level);
+  void switchFilter();
+  void offsetIds(TrackSnapshot &tracks) const;
+  void saveCheckpoint();
+  void restoreCheckpoint();
+#ifdef PEOPLE_TRACKER_INSTRUMENTATION
+  void trackerDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void threadDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+#endif
   
   std::string generateUUID(std::string time, long id) {
     boost::uuids::name_generator gen(dns_namespace_uuid);
@@ -195,16 +277,42 @@ class PeopleTracker
     return ss.str();
   }
   
+  ros::NodeHandle node_handle; // of the detector subscriptions
   ros::Publisher pub_detect;
   ros::Publisher pub_pose_array;
   ros::Publisher pub_people;
   ros::Publisher pub_trajectory;
   ros::Publisher pub_trajectory_acc;
   ros::Publisher pub_marker;
+  ros::Publisher pub_gates;
+  ros::Publisher pub_track_states;
+  ros::Publisher pub_track_states_extrapolated;
+  bayes_people_tracker::TrackStates::ConstPtr latest_states; // of the last update, atomic, for the extrapolation
+  double extrapolation_rate;    // of track_states_extrapolated, 0 for none
+  double extrapolation_horizon; // s after the last update, not extrapolated further
   tf::TransformListener* listener;
+  double transform_tolerance;
+  std::vector<std::pair<std::pair<std::string, ros::Time>, tf::Transform> > transform_cache; // the last lookups, a ring
+  size_t transform_cache_next;
   std::string target_frame;
   std::string base_frame;
   double tracker_frequency;
+  bool event_driven;
+  std::atomic<double> last_observation; // ros::Time of the last update, in seconds
+  boost::mutex publish_mutex;
+  bool queued_ingestion;
+  int detector_queue_size;
+  double detector_max_age;
+  ObservationQueue<ObservationBatch> observations; // pushed by the detector callbacks, drained by trackingThread
+  std::vector<ObservationBatch> drained;
+  TrackSnapshot tick_tracks;  // filled by the tracking thread
+  TrackSnapshot event_tracks; // filled by detectorCallback
+  std::vector<const std::string*> uuids; // of the tracks of the tick, into uuid_cache
+  std::unordered_map<long, std::string> uuid_cache; // by track ID, of the live tracks
+  std::unordered_map<long, TrackMarkers> track_markers; // by track ID, while the markers have subscribers
+  visualization_msgs::MarkerArray marker_array;
+  double gate_lookahead;
+  double gate_sigma;
   double human_path_min;
   double human_velo_min;
   double human_velo_max;
@@ -214,7 +322,15 @@ class PeopleTracker
   double static_vari_max;
   double human_track_proba;
   int repeated_poses_max;
+  int max_trajectory_poses;
   bool log_trajectories;
+  TrajectoryLogger trajectory_logger;
+  std::string checkpoint_file; // empty for no checkpoints
+  double checkpoint_period;
+  double checkpoint_max_age;
+  int checkpoint_trajectory_poses;
+  double last_checkpoint;
+  CheckpointWriter checkpoint_writer;
   bool publish_detections;
   unsigned long detect_seq;
   unsigned long marker_seq;
@@ -222,11 +338,34 @@ class PeopleTracker
   
   boost::uuids::uuid dns_namespace_uuid;
   
-  SimpleTracking<EKFilter> *ekf = NULL;
-  SimpleTracking<UKFilter> *ukf = NULL;
-  SimpleTracking<PFilter> *pf = NULL;
-  std::map<std::pair<std::string, std::string>, ros::Subscriber> subscribers;
-  std::vector<boost::tuple<long, people_msgs::Person, people_msgs::Person> > previous_poses;
+  Tracker *tracker = NULL; // a SimpleTracking of the filter_type
+  boost::shared_mutex tracker_mutex; // of the tracker pointer, unique to switch it
+  TrackerParams tracker_params;
+  std::string filter_type;
+  std::string degraded_filter_type;
+  std::string current_filter; // of the tracking thread
+  std::string failed_filter;
+  static const int FILTER_DEGRADATION_LEVEL = 4;
+  ros::Subscriber degradation_sub;
+  std::atomic<int> degradation_level;
+  long id_offset;    // of the track IDs of the tracker, those before it published
+  long max_track_id; // published, under publish_mutex
+  std::vector<DetectorSubscription> subscribers; // in the order of the detectors parameter
+  std::unordered_map<long, TrackHistory> previous_poses; // by track ID
+  boost::thread tracking_thread;
+  boost::thread extrapolation_thread; // if extrapolation_rate
+  std::string node_name; // the threads are recorded for, c.f. thread_config
+  thread_config::Settings tracking_thread_settings;
+  thread_config::Settings extrapolation_thread_settings;
+  std::atomic<bool> running; // until the tracker is destroyed
+#ifdef PEOPLE_TRACKER_INSTRUMENTATION
+  diagnostic_updater::Updater *diagnostics;
+  LatencyHistogram observation_latency; // of a detection message, whatever the thread
+  LatencyHistogram tick_latency;        // of a prediction of the tracking thread
+  TrackerCounters last_counters;        // at the last report, for the counts of its period
+  HistogramCounts last_observations;
+  HistogramCounts last_ticks;
+#endif
 };
 
 #endif // BAYES_PEOPLE_TRACKER_H
@@ -0,0 +1,430 @@
+#ifndef SHARDED_TRACKING_H
+#define SHARDED_TRACKING_H
+
+#include <cmath>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/thread.hpp>
+
+#include "people_tracker/flobot_tracking.h"
+
+/* Several trackers, each on its own thread, sharing the plane of the target
+ * frame: the plane is cut into square tiles, every tile belongs to one shard
+ * (tiles are spread over the shards by a hash of their indices), and a shard
+ * only associates the detections of its tiles with its own tracks, so the
+ * cost of association is split along with the crowd.
+ *
+ * The detections within margin of a tile border go to the shards of both
+ * sides, so the shard a person walks into already tracks them. A track is
+ * published only by the shard owning the tile it is in, and a shard taking
+ * a person over takes the published ID of the track just released next to
+ * it by the other shard: the ID survives the border. Until then, a new track
+ * next to a track still owned by another shard is the same person twice,
+ * and is not published. */
+class ShardedTracking : public Tracker {
+ public:
+  ShardedTracking(const std::string &filter, double stdLimit, double maxLag, int shards, double tileSize, double margin,
+                  double fusionWindow = 0.0, bool space = false)
+    : tileSize(tileSize), margin(margin), time(0.0), job(JOB_NONE), generation(0), pending(0), stopping(false), nextId(0) {
+    this->shards.resize(std::min(std::max(shards, 1), 64));
+    for(size_t s = 0; s < this->shards.size(); s++) {
+      this->shards[s].tracker = createTracker(filter, stdLimit, maxLag, fusionWindow, space);
+    }
+  }
+
+  ~ShardedTracking() {
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      stopping = true;
+      started.notify_all();
+    }
+    workers.join_all();
+    for(size_t s = 0; s < shards.size(); s++) {
+      delete shards[s].tracker;
+    }
+  }
+
+  /* False if the filter is not one of createTracker. */
+  bool valid() const { return shards[0].tracker != NULL; }
+
+  void createConstantVelocityModel(double vel_noise_x, double vel_noise_y, double vel_noise_z) override {
+    for(size_t s = 0; s < shards.size(); s++) {
+      shards[s].tracker->createConstantVelocityModel(vel_noise_x, vel_noise_y, vel_noise_z);
+    }
+  }
+
+  void addDetectorModel(std::string name, association_t alg, observ_model_t om_flag, double pos_noise_x, double pos_noise_y, double pos_noise_z,
+                        unsigned int seqSize = 5, double seqTime = 0.2) override {
+    for(size_t s = 0; s < shards.size(); s++) {
+      shards[s].tracker->addDetectorModel(name, alg, om_flag, pos_noise_x, pos_noise_y, pos_noise_z, seqSize, seqTime);
+    }
+  }
+
+  void setParallel(size_t threads, size_t minTracks) override {
+    for(size_t s = 0; s < shards.size(); s++) {
+      shards[s].tracker->setParallel(threads, minTracks);
+    }
+  }
+  
+  void setGate(gate_t confidence) override {
+    for(size_t s = 0; s < shards.size(); s++) {
+      shards[s].tracker->setGate(confidence);
+    }
+  }
+  
+  void track(TrackSnapshot &tracks, double* track_time = NULL) override {
+    boost::mutex::scoped_lock lock(callMutex);
+    run(JOB_TRACK);
+    if(track_time) {
+      *track_time = time;
+    }
+    merge(tracks);
+  }
+
+  void addObservation(const std::string &detector, people_msgs::PositionMeasurementArray &obsv, double obsv_time,
+		      TrackSnapshot *estimates_after = NULL) override {
+    boost::mutex::scoped_lock lock(callMutex);
+    for(size_t s = 0; s < shards.size(); s++) {
+      shards[s].obsv.people.clear();
+    }
+    for(size_t i = 0; i < obsv.people.size(); i++) {
+      const geometry_msgs::Point &p = obsv.people[i].pos;
+      unsigned long long mask = shardsNear(p.x, p.y);
+      for(size_t s = 0; s < shards.size(); s++) {
+	if(mask & (1ULL << s)) {
+	  shards[s].obsv.people.push_back(obsv.people[i]);
+	}
+      }
+    }
+    this->detector = detector;
+    this->obsv_time = obsv_time;
+    estimates = estimates_after != NULL;
+    run(JOB_OBSERVE);
+    if(estimates_after) {
+      merge(*estimates_after);
+    }
+  }
+
+  /* The tracks published, each from the shard owning it, with its published
+   * ID, and the sequences of every shard in the tiles it owns. */
+  void saveState(TrackerState &state) override {
+    boost::mutex::scoped_lock lock(callMutex);
+    shardStates.resize(shards.size());
+    size_t tracks = 0, sequences = 0;
+    for(size_t s = 0; s < shards.size(); s++) {
+      TrackerState &shard = shardStates[s];
+      shards[s].tracker->saveState(shard);
+      if(s == 0) {
+	state.time = shard.time;
+      }
+      for(size_t i = 0; i < shard.tracks.size(); i++) {
+	std::unordered_map<long, Owned>::const_iterator it = shards[s].owned.find(shard.tracks[i].id);
+	if(it == shards[s].owned.end()) {
+	  continue;
+	}
+	if(state.tracks.size() <= tracks) {
+	  state.tracks.resize(tracks + 1);
+	}
+	std::swap(state.tracks[tracks], shard.tracks[i]);
+	state.tracks[tracks++].id = it->second.id;
+      }
+      for(size_t q = 0; q < shard.sequences.size(); q++) {
+	const std::vector<double> &z = shard.sequences[q].back().z;
+	if(shardOf(tileIndex(z[0]), tileIndex(z[1])) != s) {
+	  continue;
+	}
+	if(state.sequences.size() <= sequences) {
+	  state.sequences.resize(sequences + 1);
+	}
+	std::swap(state.sequences[sequences++], shard.sequences[q]);
+      }
+    }
+    state.tracks.resize(tracks);
+    state.sequences.resize(sequences);
+    state.next_id = nextId;
+  }
+  
+  /* Every track and sequence to the shards within margin of it, as its
+   * detections would go, the tracks owned under their IDs of the checkpoint
+   * by the shard of their tile. */
+  void restoreState(const TrackerState &state) override {
+    boost::mutex::scoped_lock lock(callMutex);
+    shardStates.resize(shards.size());
+    for(size_t s = 0; s < shards.size(); s++) {
+      shardStates[s].time = state.time;
+      shardStates[s].next_id = 0;
+      shardStates[s].tracks.clear();
+      shardStates[s].sequences.clear();
+    }
+    for(size_t i = 0; i < state.tracks.size(); i++) {
+      const TrackState &track = state.tracks[i];
+      if(track.x.size() < 4) {
+	continue;
+      }
+      unsigned long long mask = shardsNear(track.x[0], track.x[2]);
+      for(size_t s = 0; s < shards.size(); s++) {
+	if(mask & (1ULL << s)) {
+	  shardStates[s].tracks.push_back(track);
+	}
+      }
+      Owned o = {track.id, track.x[0], track.x[2], true};
+      shards[shardOf(tileIndex(track.x[0]), tileIndex(track.x[2]))].owned[track.id] = o;
+    }
+    for(size_t q = 0; q < state.sequences.size(); q++) {
+      if(state.sequences[q].empty() || state.sequences[q].back().z.size() < 2) {
+	continue;
+      }
+      const std::vector<double> &z = state.sequences[q].back().z;
+      unsigned long long mask = shardsNear(z[0], z[1]);
+      for(size_t s = 0; s < shards.size(); s++) {
+	if(mask & (1ULL << s)) {
+	  shardStates[s].sequences.push_back(state.sequences[q]);
+	}
+      }
+    }
+    for(size_t s = 0; s < shards.size(); s++) {
+      shards[s].tracker->restoreState(shardStates[s]);
+    }
+    time = state.time;
+    nextId = std::max(nextId, state.next_id);
+  }
+  
+#ifdef PEOPLE_TRACKER_INSTRUMENTATION
+  void addCounters(TrackerCounters &counters) override {
+    for(size_t s = 0; s < shards.size(); s++) {
+      shards[s].tracker->addCounters(counters);
+    }
+  }
+#endif
+
+ private:
+  enum Job { JOB_NONE, JOB_TRACK, JOB_OBSERVE };
+
+  struct Owned {
+    long id;       // the published ID
+    double x, y;
+    bool seen;
+  };
+
+  struct Released {
+    long id;
+    double x, y;
+    double time;
+  };
+
+  struct Candidate {
+    size_t shard, track;
+  };
+
+  struct Shard {
+    Tracker *tracker;
+    people_msgs::PositionMeasurementArray obsv; // of the current addObservation
+    TrackSnapshot tracks;                       // after the current job
+    std::unordered_map<long, Owned> owned;      // by track ID of this shard
+  };
+
+  long tileIndex(double v) const { return (long)std::floor(v / tileSize); }
+
+  size_t shardOf(long i, long j) const {
+    unsigned long h = (unsigned long)i * 73856093UL ^ (unsigned long)j * 19349663UL;
+    return h % shards.size();
+  }
+
+  /* The shards of the tiles within margin of (x, y), at most four, as a bit mask. */
+  unsigned long long shardsNear(double x, double y) const {
+    long i0 = tileIndex(x - margin), i1 = tileIndex(x + margin);
+    long j0 = tileIndex(y - margin), j1 = tileIndex(y + margin);
+    unsigned long long mask = 0;
+    for(long ti = i0; ti <= i1; ti++) {
+      for(long tj = j0; tj <= j1; tj++) {
+	mask |= 1ULL << shardOf(ti, tj);
+      }
+    }
+    return mask;
+  }
+
+  bool owns(size_t s, const TrackPose &pose) const {
+    return shardOf(tileIndex(pose.x), tileIndex(pose.y)) == s;
+  }
+
+  /* Runs job on every shard, the first one on this thread, and waits for all. */
+  void run(Job job) {
+    if(workers.size() + 1 < shards.size()) {
+      for(size_t s = workers.size() + 1; s < shards.size(); s++) {
+	workers.create_thread(boost::bind(&ShardedTracking::worker, this, s));
+      }
+    }
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      this->job = job;
+      pending = shards.size() - 1;
+      generation++;
+      started.notify_all();
+    }
+    runShard(0, job);
+    boost::mutex::scoped_lock lock(mutex);
+    while(pending) {
+      finished.wait(lock);
+    }
+  }
+
+  void worker(size_t s) {
+    unsigned long done = 0;
+    boost::mutex::scoped_lock lock(mutex);
+    while(true) {
+      while(!stopping && generation == done) {
+	started.wait(lock);
+      }
+      if(stopping) {
+	return;
+      }
+      done = generation;
+      Job job = this->job;
+      lock.unlock();
+      runShard(s, job);
+      lock.lock();
+      if(--pending == 0) {
+	finished.notify_one();
+      }
+    }
+  }
+
+  void runShard(size_t s, Job job) {
+    Shard &shard = shards[s];
+    if(job == JOB_TRACK) {
+      shard.tracker->track(shard.tracks, s == 0 ? &time : NULL);
+    } else if(job == JOB_OBSERVE && !shard.obsv.people.empty()) {
+      shard.tracker->addObservation(detector, shard.obsv, obsv_time, estimates ? &shard.tracks : NULL);
+    } else if(job == JOB_OBSERVE && estimates) {
+      shard.tracker->track(shard.tracks);
+    }
+  }
+
+  /* The tracks of all shards, each from the shard owning it, with their
+   * published IDs. */
+  void merge(TrackSnapshot &tracks) {
+    tracks.resize(0);
+    candidates.clear();
+    for(size_t s = 0; s < shards.size(); s++) {
+      Shard &shard = shards[s];
+      for(std::unordered_map<long, Owned>::iterator it = shard.owned.begin(); it != shard.owned.end(); ++it) {
+	it->second.seen = false;
+      }
+      for(size_t i = 0; i < shard.tracks.size(); i++) {
+	const TrackPose &pose = shard.tracks.poses[i];
+	if(!owns(s, pose)) {
+	  continue;
+	}
+	std::unordered_map<long, Owned>::iterator it = shard.owned.find(shard.tracks.ids[i]);
+	if(it == shard.owned.end()) {
+	  Candidate candidate = {s, i};
+	  candidates.push_back(candidate);
+	  continue;
+	}
+	it->second.x = pose.x;
+	it->second.y = pose.y;
+	it->second.seen = true;
+	append(tracks, shard.tracks, i, it->second.id);
+      }
+    }
+
+    // the tracks gone from their shard, dead or over a border
+    double now = ros::Time::now().toSec();
+    for(size_t s = 0; s < shards.size(); s++) {
+      std::unordered_map<long, Owned> &owned = shards[s].owned;
+      for(std::unordered_map<long, Owned>::iterator it = owned.begin(); it != owned.end();) {
+	if(it->second.seen) {
+	  ++it;
+	  continue;
+	}
+	Released r = {it->second.id, it->second.x, it->second.y, now};
+	released.push_back(r);
+	it = owned.erase(it);
+      }
+    }
+    for(size_t k = 0; k < released.size();) {
+      if(now - released[k].time > 1.0) {
+	released[k] = released.back();
+	released.pop_back();
+      } else {
+	k++;
+      }
+    }
+
+    size_t published = tracks.size();
+    for(size_t c = 0; c < candidates.size(); c++) {
+      Shard &shard = shards[candidates[c].shard];
+      size_t i = candidates[c].track;
+      const TrackPose &pose = shard.tracks.poses[i];
+      long id = -1;
+      for(size_t k = 0; k < released.size(); k++) {
+	if(std::hypot(released[k].x - pose.x, released[k].y - pose.y) <= margin) {
+	  id = released[k].id;
+	  released[k] = released.back();
+	  released.pop_back();
+	  break;
+	}
+      }
+      if(id < 0) {
+	bool duplicate = false;
+	for(size_t k = 0; k < published && !duplicate; k++) {
+	  duplicate = std::hypot(tracks.poses[k].x - pose.x, tracks.poses[k].y - pose.y) <= margin;
+	}
+	if(duplicate) {
+	  continue;
+	}
+	id = nextId++;
+      }
+      Owned o = {id, pose.x, pose.y, true};
+      shard.owned[shard.tracks.ids[i]] = o;
+      append(tracks, shard.tracks, i, id);
+    }
+  }
+
+  static void append(TrackSnapshot &to, const TrackSnapshot &from, size_t i, long id) {
+    size_t n = to.size();
+    to.resize(n + 1);
+    to.ids[n] = id;
+    to.poses[n] = from.poses[i];
+    to.reliability[n] = from.reliability[i];
+    to.sample_ids[n] = from.sample_ids[i];
+  }
+
+  std::vector<Shard> shards;
+  double tileSize;
+  double margin;
+  double time;
+
+  // the current job, for the workers
+  boost::mutex callMutex; // one call at a time
+  boost::mutex mutex;
+  boost::condition_variable started;
+  boost::condition_variable finished;
+  boost::thread_group workers;
+  Job job;
+  unsigned long generation;
+  size_t pending;
+  bool stopping;
+  std::string detector;
+  double obsv_time;
+  bool estimates;
+
+  std::vector<Candidate> candidates;
+  std::vector<Released> released;
+  long nextId;
+  std::vector<TrackerState> shardStates; // of saveState and restoreState, kept for their storage
+};
+
+/* The tracker of createTracker, split into shards, NULL for an unknown filter. */
+inline Tracker *createShardedTracker(const std::string &filter, double stdLimit, double maxLag, int shards, double tileSize, double margin,
+                                     double fusionWindow = 0.0, bool space = false) {
+  ShardedTracking *tracker = new ShardedTracking(filter, stdLimit, maxLag, shards, tileSize, margin, fusionWindow, space);
+  if(!tracker->valid()) {
+    delete tracker;
+    return NULL;
+  }
+  return tracker;
+}
+
+#endif // SHARDED_TRACKING_H
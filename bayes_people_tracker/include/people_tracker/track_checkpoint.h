@@ -0,0 +1,350 @@
+#ifndef TRACK_CHECKPOINT_H
+#define TRACK_CHECKPOINT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <unistd.h>
+#include <boost/thread.hpp>
+
+#include "people_tracker/track_history.h"
+
+/* A track as its filter has it: the state [x, v_x, y, v_y(, z, v_z)], its
+ * covariance row by row, and the names of its last detection. */
+struct TrackState
+{
+  long id;
+  std::vector<double> x;
+  std::vector<double> X;
+  std::string detector;
+  std::string sample_id;
+  double probability;
+};
+
+/* An observation of a candidate sequence, c.f. MultiTracker::getSequences. */
+struct SequenceObservation
+{
+  std::vector<double> z;
+  double time;
+  double prob;
+  std::string name;
+  std::string flag;
+};
+
+/* The trajectory of a live track so far, its last poses only but the
+ * statistics of all of them. */
+struct TrajectoryState
+{
+  long id;
+  TrackStats stats;
+  std::vector<TrackPose> poses;
+};
+
+/* What the tracker needs to carry on after a restart: its tracks, candidate
+ * sequences and trajectories at time, their published IDs. Filled in place
+ * from checkpoint to checkpoint, the vectors keep their storage. */
+struct TrackerState
+{
+  double time;         // of the states, ros::Time in seconds
+  long next_id;        // of the next new track
+  std::string session; // the start-up time of the UUIDs, c.f. PeopleTracker::generateUUID
+  std::vector<TrackState> tracks;
+  std::vector<std::vector<SequenceObservation> > sequences;
+  std::vector<TrajectoryState> trajectories;
+};
+
+/* Binary checkpoint file: a CheckpointFileHeader, the session as a string,
+ * then the tracks, the sequences and the trajectories back to back, every
+ * string and array prefixed with its uint32 length. The byte order is the
+ * one of the writing host. */
+struct CheckpointFileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  double time;
+  int64_t next_id;
+  uint32_t tracks;
+  uint32_t sequences;
+  uint32_t trajectories;
+  uint32_t reserved2;
+};
+
+static const char CHECKPOINT_FILE_MAGIC[8] = {'P', 'T', 'C', 'H', 'K', 'P', 'T', '\n'};
+static const uint32_t CHECKPOINT_FILE_VERSION = 1;
+
+namespace checkpoint_detail {
+
+inline void put(std::vector<char> &out, const void *data, size_t bytes) {
+  out.insert(out.end(), static_cast<const char *>(data), static_cast<const char *>(data) + bytes);
+}
+
+template<typename T>
+void put(std::vector<char> &out, T value) {
+  put(out, &value, sizeof(value));
+}
+
+inline void putString(std::vector<char> &out, const std::string &s) {
+  put<uint32_t>(out, s.size());
+  put(out, s.data(), s.size());
+}
+
+inline void putArray(std::vector<char> &out, const std::vector<double> &v) {
+  put<uint32_t>(out, v.size());
+  put(out, v.data(), sizeof(double) * v.size());
+}
+
+/* The bytes of a file, read in order, every read checked against its end. */
+struct Reader
+{
+  const char *p, *end;
+  bool ok;
+
+  bool get(void *data, size_t bytes) {
+    ok = ok && (size_t)(end - p) >= bytes;
+    if(ok) {
+      memcpy(data, p, bytes);
+      p += bytes;
+    }
+    return ok;
+  }
+  template<typename T> T get() {
+    T value = T();
+    get(&value, sizeof(value));
+    return value;
+  }
+  /* A length, which can not be more than the bytes left of size each. */
+  uint32_t length(size_t size) {
+    uint32_t n = get<uint32_t>();
+    ok = ok && n <= (size_t)(end - p) / size;
+    return ok ? n : 0;
+  }
+  void getString(std::string &s) {
+    uint32_t n = length(1);
+    s.assign(p, n);
+    p += n;
+  }
+  void getArray(std::vector<double> &v) {
+    v.resize(length(sizeof(double)));
+    get(v.data(), sizeof(double) * v.size());
+  }
+};
+
+} // namespace checkpoint_detail
+
+inline void serializeCheckpoint(const TrackerState &state, std::vector<char> &out) {
+  using namespace checkpoint_detail;
+  out.clear();
+  CheckpointFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CHECKPOINT_FILE_MAGIC, sizeof(header.magic));
+  header.version = CHECKPOINT_FILE_VERSION;
+  header.time = state.time;
+  header.next_id = state.next_id;
+  header.tracks = state.tracks.size();
+  header.sequences = state.sequences.size();
+  header.trajectories = state.trajectories.size();
+  put(out, &header, sizeof(header));
+  putString(out, state.session);
+  for(size_t i = 0; i < state.tracks.size(); i++) {
+    const TrackState &t = state.tracks[i];
+    put<int64_t>(out, t.id);
+    putArray(out, t.x);
+    putArray(out, t.X);
+    put<double>(out, t.probability);
+    putString(out, t.detector);
+    putString(out, t.sample_id);
+  }
+  for(size_t i = 0; i < state.sequences.size(); i++) {
+    put<uint32_t>(out, state.sequences[i].size());
+    for(size_t k = 0; k < state.sequences[i].size(); k++) {
+      const SequenceObservation &o = state.sequences[i][k];
+      putArray(out, o.z);
+      put<double>(out, o.time);
+      put<double>(out, o.prob);
+      putString(out, o.name);
+      putString(out, o.flag);
+    }
+  }
+  for(size_t i = 0; i < state.trajectories.size(); i++) {
+    const TrajectoryState &t = state.trajectories[i];
+    put<int64_t>(out, t.id);
+    put<uint64_t>(out, t.stats.count);
+    const double stats[6] = {t.stats.path_length, t.stats.velocity_sum, t.stats.variance_sum, t.stats.log_odds, t.stats.last_x, t.stats.last_y};
+    put(out, stats, sizeof(stats));
+    put<uint32_t>(out, t.poses.size());
+    put(out, t.poses.data(), sizeof(TrackPose) * t.poses.size());
+  }
+}
+
+/* False, state unspecified, for a file missing, cut short or of another version. */
+inline bool readCheckpoint(const std::string &file_name, TrackerState &state) {
+  using namespace checkpoint_detail;
+  FILE *file = fopen(file_name.c_str(), "rb");
+  if(file == NULL) {
+    return false;
+  }
+  std::vector<char> bytes;
+  char chunk[65536];
+  size_t n;
+  while((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    bytes.insert(bytes.end(), chunk, chunk + n);
+  }
+  fclose(file);
+
+  Reader in = {bytes.data(), bytes.data() + bytes.size(), true};
+  CheckpointFileHeader header;
+  if(!in.get(&header, sizeof(header)) || memcmp(header.magic, CHECKPOINT_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+     header.version != CHECKPOINT_FILE_VERSION) {
+    return false;
+  }
+  state.time = header.time;
+  state.next_id = header.next_id;
+  in.getString(state.session);
+  // every record takes a few bytes at least, the counts are checked as they are read
+  state.tracks.resize(std::min<size_t>(header.tracks, bytes.size()));
+  for(size_t i = 0; i < state.tracks.size() && in.ok; i++) {
+    TrackState &t = state.tracks[i];
+    t.id = in.get<int64_t>();
+    in.getArray(t.x);
+    in.getArray(t.X);
+    t.probability = in.get<double>();
+    in.getString(t.detector);
+    in.getString(t.sample_id);
+    in.ok = in.ok && t.X.size() == t.x.size() * t.x.size();
+  }
+  state.sequences.resize(std::min<size_t>(header.sequences, bytes.size()));
+  for(size_t i = 0; i < state.sequences.size() && in.ok; i++) {
+    state.sequences[i].resize(in.length(sizeof(uint32_t)));
+    for(size_t k = 0; k < state.sequences[i].size() && in.ok; k++) {
+      SequenceObservation &o = state.sequences[i][k];
+      in.getArray(o.z);
+      o.time = in.get<double>();
+      o.prob = in.get<double>();
+      in.getString(o.name);
+      in.getString(o.flag);
+    }
+  }
+  state.trajectories.resize(std::min<size_t>(header.trajectories, bytes.size()));
+  for(size_t i = 0; i < state.trajectories.size() && in.ok; i++) {
+    TrajectoryState &t = state.trajectories[i];
+    t.id = in.get<int64_t>();
+    t.stats.count = in.get<uint64_t>();
+    double stats[6];
+    in.get(stats, sizeof(stats));
+    t.stats.path_length = stats[0];
+    t.stats.velocity_sum = stats[1];
+    t.stats.variance_sum = stats[2];
+    t.stats.log_odds = stats[3];
+    t.stats.last_x = stats[4];
+    t.stats.last_y = stats[5];
+    t.poses.resize(in.length(sizeof(TrackPose)));
+    in.get(t.poses.data(), sizeof(TrackPose) * t.poses.size());
+  }
+  return in.ok && in.p == in.end;
+}
+
+/* Writes checkpoints off the tracking thread, each replacing the last one
+ * whole: it is written to a temporary file first, then renamed over it, so
+ * a crash leaves the previous checkpoint or the new one, never a mix.
+ * The tracking thread fills back() and commit()s it, which only swaps it
+ * with the buffer handed over to the writer thread; a checkpoint committed
+ * before the writer took the previous one replaces it. back() and commit()
+ * must be called by one thread at a time. */
+class CheckpointWriter
+{
+ public:
+  CheckpointWriter() : pending_(false), running_(false), written_(0), failures_(0) {}
+  ~CheckpointWriter() { close(); }
+  CheckpointWriter(const CheckpointWriter &) = delete;
+  CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+  void open(const std::string &file_name) {
+    close();
+    file_name_ = file_name;
+    running_ = true;
+    writer_ = boost::thread(&CheckpointWriter::writerThread, this);
+  }
+
+  /* Writes the checkpoint committed last, if the writer had not yet. */
+  void close() {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if(!running_) {
+	return;
+      }
+      running_ = false;
+    }
+    cond_.notify_one();
+    writer_.join();
+  }
+
+  bool isOpen() const { return writer_.joinable(); }
+  TrackerState &back() { return back_; }
+
+  void commit() {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      std::swap(back_, front_);
+      pending_ = true;
+    }
+    cond_.notify_one();
+  }
+
+  unsigned long written() const { return written_.load(std::memory_order_relaxed); }
+  unsigned long failures() const { return failures_.load(std::memory_order_relaxed); }
+
+ private:
+  void writerThread() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while(true) {
+      while(running_ && !pending_) {
+	cond_.wait(lock);
+      }
+      if(!pending_) {
+	return;
+      }
+      std::swap(front_, writing_);
+      pending_ = false;
+      lock.unlock();
+      if(write(writing_)) {
+	written_.fetch_add(1, std::memory_order_relaxed);
+      } else {
+	failures_.fetch_add(1, std::memory_order_relaxed);
+      }
+      lock.lock();
+    }
+  }
+
+  bool write(const TrackerState &state) {
+    serializeCheckpoint(state, bytes_);
+    std::string temporary = file_name_ + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if(file == NULL) {
+      return false;
+    }
+    bool ok = fwrite(bytes_.data(), 1, bytes_.size(), file) == bytes_.size() && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    return ok && rename(temporary.c_str(), file_name_.c_str()) == 0;
+  }
+
+  std::string file_name_;
+  TrackerState back_;    // filled by the tracking thread
+  TrackerState front_;   // committed, for the writer
+  TrackerState writing_; // by the writer thread only
+  std::vector<char> bytes_;
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  bool pending_;
+  bool running_;
+  std::atomic<unsigned long> written_;
+  std::atomic<unsigned long> failures_;
+  boost::thread writer_;
+};
+
+#endif // TRACK_CHECKPOINT_H
@@ -0,0 +1,93 @@
+#ifndef TRACK_HISTORY_H
+#define TRACK_HISTORY_H
+
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+/* One pose of a track: its state and its position variance. */
+struct TrackPose
+{
+  double x, y, vx, vy;
+  double var_x, var_y;
+  double z, vz, var_z; // 0 on the plane, c.f. TrackingSpace
+};
+
+/* Running statistics of a whole trajectory, O(1) per pose, for the P-N
+ * experts and the human probability of a track while it is alive. The
+ * probabilities are summed as log-odds, which cannot under- or overflow as
+ * the product of the odds did. */
+struct TrackStats
+{
+  TrackStats() : count(0), path_length(0.0), velocity_sum(0.0), variance_sum(0.0), log_odds(0.0), last_x(0.0), last_y(0.0) {}
+  
+  void add(const TrackPose &pose, double probability) {
+    if(count) {
+      path_length += hypot(pose.x - last_x, pose.y - last_y);
+    }
+    last_x = pose.x;
+    last_y = pose.y;
+    velocity_sum += fabs(pose.vx + pose.vy);
+    variance_sum += pose.var_x + pose.var_y;
+    if(probability > 0) {
+      log_odds += fabs(1.0 - probability) < DBL_EPSILON ? log(100.0) : log(probability / (1.0 - probability));
+    }
+    count++;
+  }
+  
+  double averageVelocity() const { return count ? velocity_sum / count : 0.0; }
+  double averageVariance() const { return count ? variance_sum / count : 0.0; }
+  /* A tracklet's human probability always starts with P(H) = 0.5. */
+  double probability() const { return log_odds >= 0 ? 1.0 / (1.0 + exp(-log_odds)) : exp(log_odds) / (1.0 + exp(log_odds)); }
+  
+  size_t count;
+  double path_length;
+  double velocity_sum;
+  double variance_sum;
+  double log_odds;
+  double last_x, last_y;
+};
+
+/* The poses of one live track, oldest first, in one
+ * contiguous buffer. With a capacity, only the last capacity poses are kept
+ * (a ring), otherwise the whole trajectory. */
+class TrackHistory
+{
+ public:
+  explicit TrackHistory(size_t capacity = 0) : capacity_(capacity), head_(0) {}
+  
+  void push(const TrackPose &pose, double probability) {
+    stats_.add(pose, probability);
+    if(capacity_ == 0 || poses_.size() < capacity_) {
+      poses_.push_back(pose);
+    } else {
+      poses_[head_] = pose;
+      head_ = (head_ + 1) % capacity_;
+    }
+  }
+  
+  /* The history of a checkpoint, c.f. track_checkpoint.h: its poses, oldest
+   * first, and the statistics of those before them too. */
+  void restore(const std::vector<TrackPose> &poses, const TrackStats &stats) {
+    size_t first = capacity_ && poses.size() > capacity_ ? poses.size() - capacity_ : 0;
+    poses_.assign(poses.begin() + first, poses.end());
+    head_ = 0;
+    stats_ = stats;
+  }
+  
+  size_t size() const { return poses_.size(); }
+  const TrackPose &pose(size_t i) const { return poses_[index(i)]; }
+  /* Of every pose so far, the ones out of the ring too. */
+  const TrackStats &stats() const { return stats_; }
+  
+ private:
+  size_t index(size_t i) const { return head_ == 0 ? i : (head_ + i) % poses_.size(); }
+  
+  std::vector<TrackPose> poses_;
+  size_t capacity_;
+  size_t head_; // the oldest pose once the ring is full
+  TrackStats stats_;
+};
+
+#endif // TRACK_HISTORY_H
@@ -0,0 +1,137 @@
+#ifndef TRACKER_STATS_H
+#define TRACKER_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+
+/* Self-instrumentation of the tracker, published on /diagnostics. Built with
+ * PEOPLE_TRACKER_INSTRUMENTATION only (the INSTRUMENTATION option of
+ * CMakeLists.txt); without it, TRACKER_SCOPED_TIMER expands to nothing and
+ * the tracker has no counters at all. */
+
+/* Counts per bucket of a LatencyHistogram, summed over several of them or
+ * taken apart to get the samples of a period. */
+struct HistogramCounts
+{
+  // 4 buckets per power of two microseconds, from 1 us to about 70 minutes
+  static const int SUB_BUCKETS = 4;
+  static const int BUCKETS = 32 * SUB_BUCKETS;
+  unsigned long counts[BUCKETS];
+
+  HistogramCounts() { clear(); }
+  void clear() {
+    for(int i = 0; i < BUCKETS; i++) {
+      counts[i] = 0;
+    }
+  }
+  void add(const HistogramCounts &other) {
+    for(int i = 0; i < BUCKETS; i++) {
+      counts[i] += other.counts[i];
+    }
+  }
+  void subtract(const HistogramCounts &other) {
+    for(int i = 0; i < BUCKETS; i++) {
+      counts[i] -= other.counts[i];
+    }
+  }
+  unsigned long total() const {
+    unsigned long n = 0;
+    for(int i = 0; i < BUCKETS; i++) {
+      n += counts[i];
+    }
+    return n;
+  }
+
+  /* The upper bound of the bucket of percentile p (0 to 1), in milliseconds,
+   * 25% over the samples at most; 0 without samples. */
+  double percentile(double p) const {
+    unsigned long n = total(), rank = (unsigned long)std::ceil(p * n), seen = 0;
+    for(int i = 0; i < BUCKETS && n; i++) {
+      seen += counts[i];
+      if(seen >= rank && seen) {
+	return upperBound(i) * 1e-3;
+      }
+    }
+    return 0.0;
+  }
+
+  static int bucket(double us) {
+    if(us < 1.0) {
+      return 0;
+    }
+    int exponent;
+    double mantissa = std::frexp(us, &exponent); // us = mantissa * 2^exponent, mantissa in [0.5, 1)
+    int i = (exponent - 1) * SUB_BUCKETS + (int)((mantissa - 0.5) * 2 * SUB_BUCKETS);
+    return i < BUCKETS ? i : BUCKETS - 1;
+  }
+  static double upperBound(int i) {
+    return std::ldexp(1.0 + (double)(i % SUB_BUCKETS + 1) / SUB_BUCKETS, i / SUB_BUCKETS);
+  }
+};
+
+/* Durations of one stage, added by any thread with one relaxed atomic
+ * increment, read by any other through counts(). */
+class LatencyHistogram
+{
+ public:
+  LatencyHistogram() {
+    for(int i = 0; i < HistogramCounts::BUCKETS; i++) {
+      counts_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+  LatencyHistogram(const LatencyHistogram &) = delete;
+  LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+  void add(double us) {
+    counts_[HistogramCounts::bucket(us)].fetch_add(1, std::memory_order_relaxed);
+  }
+  /* Adds the counts so far to counts. */
+  void counts(HistogramCounts &counts) const {
+    for(int i = 0; i < HistogramCounts::BUCKETS; i++) {
+      counts.counts[i] += counts_[i].load(std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  std::atomic<unsigned long> counts_[HistogramCounts::BUCKETS];
+};
+
+/* Adds the lifetime of the timer to a histogram. */
+class ScopedTimer
+{
+ public:
+  explicit ScopedTimer(LatencyHistogram &histogram) : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer() {
+    histogram_.add(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_).count());
+  }
+
+ private:
+  LatencyHistogram &histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+/* The stages of SimpleTracking, and what it tracks, summed over all its
+ * shards if any. */
+struct TrackerCounters
+{
+  HistogramCounts predict;   // prediction of all the filters
+  HistogramCounts associate; // gating and data association of a detection message
+  HistogramCounts update;    // update, pruning and creation of the filters
+  unsigned long filters;     // right now
+  unsigned long sequences;   // candidate sequences of unmatched detections, right now
+  unsigned long gated;       // detection-filter pairs rejected by the gates, so far
+
+  TrackerCounters() : filters(0), sequences(0), gated(0) {}
+};
+
+#ifdef PEOPLE_TRACKER_INSTRUMENTATION
+#define TRACKER_TIMER_NAME_(line) tracker_scoped_timer_##line
+#define TRACKER_TIMER_NAME(line) TRACKER_TIMER_NAME_(line)
+#define TRACKER_SCOPED_TIMER(histogram) ScopedTimer TRACKER_TIMER_NAME(__LINE__)(histogram)
+#else
+#define TRACKER_SCOPED_TIMER(histogram)
+#endif
+
+#endif // TRACKER_STATS_H
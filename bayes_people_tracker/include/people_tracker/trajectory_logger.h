@@ -0,0 +1,157 @@
+#ifndef TRAJECTORY_LOGGER_H
+#define TRAJECTORY_LOGGER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/thread.hpp>
+
+#include "people_tracker/track_history.h"
+
+/* Binary trajectory file: this header once, then one record per finished
+ * trajectory, a TrajectoryRecord followed by its poses, x and y each. Every
+ * field has a fixed width and the records are packed back to back, so a
+ * file can be memory-mapped and walked record by record, c.f.
+ * trajectory_convert.cpp. The byte order is the one of the writing host. */
+struct TrajectoryFileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct TrajectoryRecord
+{
+  int64_t id;     // tracking ID
+  double stamp;   // ros::Time when the track ended, in seconds
+  uint32_t poses;
+  uint32_t reserved;
+};
+
+static const char TRAJECTORY_FILE_MAGIC[8] = {'P', 'T', 'T', 'R', 'A', 'J', 'B', '\n'};
+static const uint32_t TRAJECTORY_FILE_VERSION = 1;
+
+/* Writes finished trajectories to a binary file off the tracking thread.
+ * log() only copies the record into a lock-free single-producer
+ * single-consumer byte ring, a background thread appends whatever the ring
+ * holds to the file. A trajectory is dropped, not waited for, when the ring
+ * is full. log() must be called by one thread at a time. */
+class TrajectoryLogger
+{
+ public:
+  TrajectoryLogger() : file_(NULL), head_(0), tail_(0), dropped_(0), running_(false) {}
+  ~TrajectoryLogger() { close(); }
+  TrajectoryLogger(const TrajectoryLogger &) = delete;
+  TrajectoryLogger &operator=(const TrajectoryLogger &) = delete;
+
+  /* The ring is rounded up to a power of two bytes. */
+  bool open(const std::string &file_name, size_t buffer_bytes) {
+    close();
+    file_ = fopen(file_name.c_str(), "wb");
+    if(file_ == NULL) {
+      return false;
+    }
+    TrajectoryFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRAJECTORY_FILE_MAGIC, sizeof(header.magic));
+    header.version = TRAJECTORY_FILE_VERSION;
+    fwrite(&header, sizeof(header), 1, file_);
+
+    size_t capacity = 4096;
+    while(capacity < buffer_bytes) {
+      capacity <<= 1;
+    }
+    ring_.assign(capacity, 0);
+    head_.store(0);
+    tail_.store(0);
+    dropped_.store(0);
+    running_.store(true);
+    writer_ = boost::thread(&TrajectoryLogger::writerThread, this);
+    return true;
+  }
+
+  /* Flushes whatever was logged and closes the file. */
+  void close() {
+    if(file_ == NULL) {
+      return;
+    }
+    running_.store(false);
+    writer_.join();
+    fclose(file_);
+    file_ = NULL;
+  }
+
+  bool isOpen() const { return file_ != NULL; }
+  unsigned long dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  /* Producer side: false if the trajectory was dropped. */
+  bool log(long id, double stamp, const TrackHistory &history) {
+    TrajectoryRecord record;
+    record.id = id;
+    record.stamp = stamp;
+    record.poses = history.size();
+    record.reserved = 0;
+    size_t bytes = sizeof(record) + 2 * sizeof(double) * history.size();
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if(bytes > ring_.size() - (tail - head_.load(std::memory_order_acquire))) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    tail = copyIn(tail, &record, sizeof(record));
+    for(size_t j = 0; j < history.size(); j++) {
+      const TrackPose &pose = history.pose(j);
+      double xy[2] = {pose.x, pose.y};
+      tail = copyIn(tail, xy, sizeof(xy));
+    }
+    tail_.store(tail, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  size_t copyIn(size_t at, const void *data, size_t bytes) {
+    size_t mask = ring_.size() - 1, first = std::min(bytes, ring_.size() - (at & mask));
+    memcpy(&ring_[at & mask], data, first);
+    memcpy(&ring_[0], static_cast<const char *>(data) + first, bytes - first);
+    return at + bytes;
+  }
+
+  /* Consumer side: the ring only ever holds whole records, as the producer
+   * publishes them at once, so it is written out as plain bytes. */
+  bool drain() {
+    size_t head = head_.load(std::memory_order_relaxed), tail = tail_.load(std::memory_order_acquire);
+    if(head == tail) {
+      return false;
+    }
+    size_t mask = ring_.size() - 1, first = std::min(tail - head, ring_.size() - (head & mask));
+    fwrite(&ring_[head & mask], 1, first, file_);
+    fwrite(&ring_[0], 1, tail - head - first, file_);
+    head_.store(tail, std::memory_order_release);
+    return true;
+  }
+
+  void writerThread() {
+    while(running_.load()) {
+      if(drain()) {
+	fflush(file_);
+      } else {
+	boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+      }
+    }
+    drain();
+  }
+
+  FILE *file_;
+  std::vector<char> ring_;
+  std::atomic<size_t> head_;  // bytes written out, by the writer thread only
+  std::atomic<size_t> tail_;  // bytes logged, by the producer only
+  std::atomic<unsigned long> dropped_;
+  std::atomic<bool> running_;
+  boost::thread writer_;
+};
+
+#endif // TRAJECTORY_LOGGER_H
@@ -1,13 +1,17 @@
 #include "people_tracker/people_tracker.h"
 
+#include <perception_trace/trace.h>
+
+#include <algorithm>
+
 #define UNKNOWN -1
 #define INVALID_ID -1
 
 //#define DEBUG
 
-PeopleTracker::PeopleTracker() : detect_seq(0), marker_seq(0) {
-  ros::NodeHandle n;
-  
+PeopleTracker::PeopleTracker(ros::NodeHandle n, ros::NodeHandle private_node_handle) :
+  node_handle(n), last_checkpoint(0.0), detect_seq(0), marker_seq(0), last_observation(0.0), transform_cache_next(0), running(true),
+  extrapolation_rate(0.0), extrapolation_horizon(0.5), degradation_level(0), id_offset(0), max_track_id(-1) {
   listener = new tf::TransformListener();
   startup_time_str = num_to_str<double>(ros::Time::now().toSec());
   
@@ -18,19 +22,71 @@ PeopleTracker::PeopleTracker() : detect_seq(0), marker_seq(0) {
   std::string pub_topic_trajectory;
   std::string pub_topic_trajectory_acc;
   std::string pub_topic_marker;
+  std::string pub_topic_gates;
+  std::string pub_topic_track_states;
+  std::string pub_topic_track_states_extrapolated;
   
   // Initialize node parameters from launch file or command line.
   // Use a private node handle so that multiple instances of the node can be run simultaneously
   // while using different parameters.
-  ros::NodeHandle private_node_handle("~");
   private_node_handle.param("base_frame", base_frame, std::string("base_link"));
   private_node_handle.param("target_frame", target_frame, std::string("map"));
   private_node_handle.param("tracker_frequency", tracker_frequency, double(30.0));
+  // Tracks published right after every detection instead of at tracker_frequency,
+  // which is then only the rate at which they are predicted while no detection comes.
+  private_node_handle.param("event_driven", event_driven, false);
+  // Detections queued without a lock by the callbacks, and fed to the filters by the tracking thread.
+  private_node_handle.param("queued_ingestion", queued_ingestion, false);
+  // Age in seconds of the latest transform still used for detections newer than it.
+  private_node_handle.param("transform_tolerance", transform_tolerance, double(0.1));
+  // Finished trajectories written to a binary file by a background thread, c.f. trajectory_convert.
   private_node_handle.param("log_trajectories", log_trajectories, false);
+  if(log_trajectories) {
+    std::string log_file;
+    int log_buffer;
+    private_node_handle.param("trajectory_log_file", log_file, std::string("trajectories.bin"));
+    private_node_handle.param("trajectory_log_buffer", log_buffer, 1 << 20);
+    if(!trajectory_logger.open(log_file, log_buffer)) {
+      ROS_ERROR("[%s] Can not open the trajectory log '%s', trajectories are not logged.", __APP_NAME__, log_file.c_str());
+      log_trajectories = false;
+    }
+  }
+  // Poses kept per track for its trajectory, the last ones only; 0 for all of them.
+  private_node_handle.param("max_trajectory_poses", max_trajectory_poses, 0);
+  // P-N experts and track probability of the online learning version, c.f. the label of a trajectory.
+  private_node_handle.param("human_path_min", human_path_min, double(1.0));
+  private_node_handle.param("human_velo_min", human_velo_min, double(0.1));
+  private_node_handle.param("human_velo_max", human_velo_max, double(2.0));
+  private_node_handle.param("static_path_max", static_path_max, double(0.5));
+  private_node_handle.param("static_velo_max", static_velo_max, double(0.1));
+  private_node_handle.param("static_vari_max", static_vari_max, double(0.1));
+  private_node_handle.param("human_track_proba", human_track_proba, double(0.8));
+  // Predicted track gates, fed back to the detectors to restrict their search.
+  private_node_handle.param("gate_lookahead", gate_lookahead, double(0.1));
+  private_node_handle.param("gate_sigma", gate_sigma, double(3.0));
+  // Message queue and latency budget of every detector, unless the detector sets its own.
+  private_node_handle.param("detector_queue_size", detector_queue_size, 2);
+  private_node_handle.param("detector_max_age", detector_max_age, double(0.0));
   parseParams(private_node_handle);
+  // The tracks, candidate sequences and trajectories written to a binary file every checkpoint_period
+  // seconds by a background thread, and carried on from it at start-up unless older than checkpoint_max_age.
+  private_node_handle.param("checkpoint_file", checkpoint_file, std::string(""));
+  private_node_handle.param("checkpoint_period", checkpoint_period, double(1.0));
+  private_node_handle.param("checkpoint_max_age", checkpoint_max_age, double(5.0));
+  private_node_handle.param("checkpoint_trajectory_poses", checkpoint_trajectory_poses, 100);
+  if(!checkpoint_file.empty() && tracker != NULL) {
+    restoreCheckpoint();
+    checkpoint_writer.open(checkpoint_file);
+  }
+  // The degradation level of the perception stack, c.f. degraded_filter_type.
+  std::string degradation_topic;
+  private_node_handle.param("degradation_level", degradation_topic, std::string("/perception/degradation_level"));
+  if(!degradation_topic.empty()) {
+    degradation_sub = n.subscribe(degradation_topic, 1, &PeopleTracker::degradationCallback, this);
+  }
   
   // Create a status callback.
-  ros::SubscriberStatusCallback con_cb = boost::bind(&PeopleTracker::connectCallback, this, boost::ref(n));
+  ros::SubscriberStatusCallback con_cb = boost::bind(&PeopleTracker::connectCallback, this, boost::ref(node_handle));
   
   private_node_handle.param("positions", pub_topic, std::string("/people_tracker/positions"));
   pub_detect = n.advertise<bayes_people_tracker::PeopleTracker>(pub_topic.c_str(), 100, con_cb, con_cb);
@@ -44,117 +100,141 @@ PeopleTracker::PeopleTracker() : detect_seq(0), marker_seq(0) {
   pub_trajectory_acc = n.advertise<people_msgs::People>(pub_topic_trajectory_acc.c_str(), 100, con_cb, con_cb);
   private_node_handle.param("marker", pub_topic_marker, std::string("/people_tracker/marker_array"));
   pub_marker = n.advertise<visualization_msgs::MarkerArray>(pub_topic_marker.c_str(), 100, con_cb, con_cb);
+  private_node_handle.param("gates", pub_topic_gates, std::string("/people_tracker/gates"));
+  pub_gates = n.advertise<people_msgs::PositionMeasurementArray>(pub_topic_gates.c_str(), 10, con_cb, con_cb);
+  private_node_handle.param("track_states", pub_topic_track_states, std::string("/people_tracker/track_states"));
+  pub_track_states = n.advertise<bayes_people_tracker::TrackStates>(pub_topic_track_states.c_str(), 10, con_cb, con_cb);
+  // The track states predicted at constant velocity to the time they are published, at the rate of a controller.
+  private_node_handle.param("extrapolation_rate", extrapolation_rate, double(0.0));
+  private_node_handle.param("extrapolation_horizon", extrapolation_horizon, double(0.5));
+  if(extrapolation_rate > 0.0) {
+    private_node_handle.param("track_states_extrapolated", pub_topic_track_states_extrapolated, std::string("/people_tracker/track_states_extrapolated"));
+    pub_track_states_extrapolated = n.advertise<bayes_people_tracker::TrackStates>(pub_topic_track_states_extrapolated.c_str(), 10, con_cb, con_cb);
+  }
   
-  boost::thread tracking_thread(boost::bind(&PeopleTracker::trackingThread, this));
+#ifdef PEOPLE_TRACKER_INSTRUMENTATION
+  diagnostics = new diagnostic_updater::Updater(n, private_node_handle, private_node_handle.getNamespace());
+  diagnostics->setHardwareID("bayes_people_tracker");
+  diagnostics->add("tracker", this, &PeopleTracker::trackerDiagnostics);
+  diagnostics->add("threads", this, &PeopleTracker::threadDiagnostics);
+#endif
   
-  ros::spin();
+  // CPUs and priority of scheduling/tracking/, applied by the thread itself
+  node_name = private_node_handle.getNamespace();
+  tracking_thread_settings = thread_config::read(private_node_handle, "tracking");
+  tracking_thread = boost::thread(boost::bind(&PeopleTracker::trackingThread, this));
+  if(extrapolation_rate > 0.0) {
+    extrapolation_thread_settings = thread_config::read(private_node_handle, "extrapolation");
+    extrapolation_thread = boost::thread(boost::bind(&PeopleTracker::extrapolationThread, this));
+  }
+}
+
+PeopleTracker::~PeopleTracker() {
+  running = false;
+  tracking_thread.join();
+  if(checkpoint_writer.isOpen()) {
+    saveCheckpoint(); // for a relaunch right away
+    checkpoint_writer.close();
+  }
+  if(extrapolation_thread.joinable()) {
+    extrapolation_thread.join();
+  }
+#ifdef PEOPLE_TRACKER_INSTRUMENTATION
+  delete diagnostics;
+#endif
+  delete tracker;
+  delete listener;
 }
 
 void PeopleTracker::parseParams(ros::NodeHandle n) {
-  std::string filter;
-  n.getParam("filter_type", filter);
-  ROS_INFO("[%s] Found filter type: %s", __APP_NAME__, filter.c_str());
-  
-  if(filter == "EKF") {
-    if(n.hasParam("std_limit")) {
-      double stdLimit;
-      n.getParam("std_limit", stdLimit);
-      ROS_INFO("[%s] std_limit: %f", __APP_NAME__, stdLimit);
-      ekf = new SimpleTracking<EKFilter>(stdLimit);
-    } else {
-      ekf = new SimpleTracking<EKFilter>();
-    }
-  } else if(filter == "UKF") {
-    if(n.hasParam("std_limit")) {
-      double stdLimit;
-      n.getParam("std_limit", stdLimit);
-      ROS_INFO("[%s] std_limit: %f", __APP_NAME__, stdLimit);
-      ukf = new SimpleTracking<UKFilter>(stdLimit);
-    } else {
-      ukf = new SimpleTracking<UKFilter>();
-    }
-  } else if(filter == "PF") {
-    if(n.hasParam("std_limit")) {
-      double stdLimit;
-      n.getParam("std_limit", stdLimit);
-      ROS_INFO("[%s] std_limit: %f", __APP_NAME__, stdLimit);
-      pf = new SimpleTracking<PFilter>(stdLimit);
-    } else {
-      pf = new SimpleTracking<PFilter>();
-    }
-  } else {
-    ROS_FATAL("[%s] Filter type %s is not specified. Unable to create the tracker. Please use either EKF, UKF or PF.", __APP_NAME__, filter.c_str());
+  n.getParam("filter_type", filter_type);
+  ROS_INFO("[%s] Found filter type: %s", __APP_NAME__, filter_type.c_str());
+  
+  if(n.hasParam("std_limit")) {
+    n.getParam("std_limit", tracker_params.std_limit);
+    ROS_INFO("[%s] std_limit: %f", __APP_NAME__, tracker_params.std_limit);
+  }
+  // Detections this many seconds older than the tracks at most are fused at their stamp, c.f. RetrodictedCartesianModel.
+  n.param("retrodiction_max_lag", tracker_params.max_lag, double(0.0));
+  // Detections of all the detectors within this many seconds are fused after one prediction, c.f. IFilter.
+  n.param("fusion_window", tracker_params.fusion_window, double(0.0));
+  // Trackers on their own threads, each for its tiles of the target frame, c.f. ShardedTracking.
+  n.param("shards", tracker_params.shards, 1);
+  n.param("shard_tile_size", tracker_params.shard_tile_size, double(10.0));
+  n.param("shard_margin", tracker_params.shard_margin, double(1.0));
+  // Tracks in space, [x, v_x, y, v_y, z, v_z], of the z of the detections too, c.f. TrackingSpace.
+  n.param("tracking_3d", tracker_params.tracking_3d, false);
+  // The filters of a tracker predicted and updated on this many threads, when it has at least parallel_min_tracks, c.f. MultiTracker::setParallel.
+  n.param("parallel_threads", tracker_params.parallel_threads, 1);
+  n.param("parallel_min_tracks", tracker_params.parallel_min_tracks, 32);
+  // The probability that the gate of a track holds its detection: 0.9, 0.95, 0.99 or 0.999, c.f. MultiTracker::setGate.
+  n.param("association_gate", tracker_params.association_gate, double(0.99));
+  n.getParam("cv_noise_params", tracker_params.cv_noise);
+  ROS_ASSERT(tracker_params.cv_noise.getType() == XmlRpc::XmlRpcValue::TypeStruct);
+  ROS_INFO_STREAM("Constant Velocity Model noise: " << tracker_params.cv_noise);
+  n.getParam("detectors", tracker_params.detectors);
+  ROS_ASSERT(tracker_params.detectors.getType() == XmlRpc::XmlRpcValue::TypeStruct);
+  // The filter of the tracks from the last degradation level of the perception stack on, c.f. switchFilter.
+  n.param("degraded_filter_type", degraded_filter_type, std::string("EKF"));
+  
+  tracker = buildTracker(filter_type);
+  if(tracker == NULL) {
     return;
   }
+  current_filter = filter_type;
   
-  XmlRpc::XmlRpcValue cv_noise;
-  n.getParam("cv_noise_params", cv_noise);
-  ROS_ASSERT(cv_noise.getType() == XmlRpc::XmlRpcValue::TypeStruct);
-  ROS_INFO_STREAM("Constant Velocity Model noise: " << cv_noise);
-  if(ekf == NULL) {
-    if(ukf == NULL) {
-      pf->createConstantVelocityModel(cv_noise["x"], cv_noise["y"]);
-    } else {
-      ukf->createConstantVelocityModel(cv_noise["x"], cv_noise["y"]);
-    }
+  XmlRpc::XmlRpcValue &detectors = tracker_params.detectors;
+  for(XmlRpc::XmlRpcValue::ValueStruct::const_iterator it = detectors.begin(); it != detectors.end(); ++it) {
+    DetectorSubscription subscription;
+    subscription.name = it->first;
+    subscription.topic = (std::string)detectors[it->first]["topic"];
+    subscription.queue_size = detectors[it->first].hasMember("queue_size") ? (int)detectors[it->first]["queue_size"] : detector_queue_size;
+    subscription.max_age = detectors[it->first].hasMember("max_age") ? (double)detectors[it->first]["max_age"] : detector_max_age;
+    subscribers.push_back(subscription);
+  }
+}
+
+/* A tracker of the filter with the models of tracker_params, NULL if the
+ * filter or one of the detectors is not valid. */
+Tracker *PeopleTracker::buildTracker(const std::string &filter) {
+  const TrackerParams &p = tracker_params;
+  Tracker *built;
+  if(p.shards > 1) {
+    built = createShardedTracker(filter, p.std_limit, p.max_lag, p.shards, p.shard_tile_size, p.shard_margin, p.fusion_window, p.tracking_3d);
   } else {
-    ekf->createConstantVelocityModel(cv_noise["x"], cv_noise["y"]);
+    built = createTracker(filter, p.std_limit, p.max_lag, p.fusion_window, p.tracking_3d);
+  }
+  if(built == NULL) {
+    ROS_FATAL("[%s] Filter type %s is not specified. Unable to create the tracker. Please use either EKF, UKF, PF, IF or IMM (not in 3D).", __APP_NAME__, filter.c_str());
+    return NULL;
   }
+  
+  if(p.parallel_threads != 1) {
+    built->setParallel(std::max(p.parallel_threads, 0), std::max(p.parallel_min_tracks, 0));
+  }
+  built->setGate(p.association_gate < 0.925 ? GATE_90 : p.association_gate < 0.97 ? GATE_95 : p.association_gate < 0.995 ? GATE_99 : GATE_999);
+  
+  // the z noises, of tracking_3d only, are those of y unless given
+  XmlRpc::XmlRpcValue cv_noise = p.cv_noise;
+  built->createConstantVelocityModel(cv_noise["x"], cv_noise["y"], cv_noise.hasMember("z") ? cv_noise["z"] : cv_noise["y"]);
   ROS_INFO_STREAM("Created " << filter << " based tracker using constant velocity prediction model.");
   
-  XmlRpc::XmlRpcValue detectors;
-  n.getParam("detectors", detectors);
-  ROS_ASSERT(detectors.getType() == XmlRpc::XmlRpcValue::TypeStruct);
+  XmlRpc::XmlRpcValue detectors = p.detectors;
   for(XmlRpc::XmlRpcValue::ValueStruct::const_iterator it = detectors.begin(); it != detectors.end(); ++it) {
     ROS_INFO_STREAM("Found detector: " << (std::string)(it->first) << " ==> " << detectors[it->first]);
     try {
-      if(ekf == NULL) {
-	if(ukf == NULL) {
-	  if(detectors[it->first].hasMember("seq_size") && detectors[it->first].hasMember("seq_time")) {
-	    int seq_size = detectors[it->first]["seq_size"];
-	    pf->addDetectorModel(it->first,
-				 detectors[it->first]["matching_algorithm"] == "NN" ? NN : detectors[it->first]["matching_algorithm"] == "NNJPDA" ? NNJPDA : throw(asso_exception()),
-				 detectors[it->first]["observation_model"] == "CARTESIAN" ? CARTESIAN : detectors[it->first]["observation_model"] == "POLAR" ? POLAR: detectors[it->first]["observation_model"] == "BEARING"? BEARING  : throw(observ_exception()),
-				 detectors[it->first]["noise_params"]["x"],
-				 detectors[it->first]["noise_params"]["y"],(unsigned int) seq_size, detectors[it->first]["seq_time"]);
-	  } else {
-	    pf->addDetectorModel(it->first,
-				 detectors[it->first]["matching_algorithm"] == "NN" ? NN : detectors[it->first]["matching_algorithm"] == "NNJPDA" ? NNJPDA : throw(asso_exception()),
-				 detectors[it->first]["observation_model"] == "CARTESIAN" ? CARTESIAN : detectors[it->first]["observation_model"] == "POLAR" ? POLAR: detectors[it->first]["observation_model"] == "BEARING"? BEARING  : throw(observ_exception()),
-				 detectors[it->first]["noise_params"]["x"],
-				 detectors[it->first]["noise_params"]["y"]);
-	  }
-	} else {
-	  if(detectors[it->first].hasMember("seq_size") && detectors[it->first].hasMember("seq_time")) {
-	    int seq_size = detectors[it->first]["seq_size"];
-	    ukf->addDetectorModel(it->first,
-				  detectors[it->first]["matching_algorithm"] == "NN" ? NN : detectors[it->first]["matching_algorithm"] == "NNJPDA" ? NNJPDA : throw(asso_exception()),
-				  detectors[it->first]["observation_model"] == "CARTESIAN" ? CARTESIAN : detectors[it->first]["observation_model"] == "POLAR" ? POLAR: detectors[it->first]["observation_model"] == "BEARING"? BEARING  : throw(observ_exception()),
-				  detectors[it->first]["noise_params"]["x"],
-				  detectors[it->first]["noise_params"]["y"],(unsigned int) seq_size,detectors[it->first]["seq_time"]);
-	  } else {
-	    ukf->addDetectorModel(it->first,
-				  detectors[it->first]["matching_algorithm"] == "NN" ? NN : detectors[it->first]["matching_algorithm"] == "NNJPDA" ? NNJPDA : throw(asso_exception()),
-				  detectors[it->first]["observation_model"] == "CARTESIAN" ? CARTESIAN : detectors[it->first]["observation_model"] == "POLAR" ? POLAR: detectors[it->first]["observation_model"] == "BEARING"? BEARING  : throw(observ_exception()),
-				  detectors[it->first]["noise_params"]["x"],
-				  detectors[it->first]["noise_params"]["y"]);
-	  }
-	}
+      association_t alg = detectors[it->first]["matching_algorithm"] == "NN" ? NN : detectors[it->first]["matching_algorithm"] == "NNJPDA" ? NNJPDA :
+	detectors[it->first]["matching_algorithm"] == "HUNGARIAN" ? HUNGARIAN : detectors[it->first]["matching_algorithm"] == "AUCTION" ? AUCTION : throw(asso_exception());
+      observ_model_t om_flag = detectors[it->first]["observation_model"] == "CARTESIAN" ? CARTESIAN : detectors[it->first]["observation_model"] == "POLAR" ? POLAR :
+	detectors[it->first]["observation_model"] == "BEARING" && filter != "EKF" ? BEARING : throw(observ_exception());
+      XmlRpc::XmlRpcValue &noise = detectors[it->first]["noise_params"];
+      double noise_z = noise.hasMember("z") ? noise["z"] : noise["y"];
+      if(detectors[it->first].hasMember("seq_size") && detectors[it->first].hasMember("seq_time")) {
+	int seq_size = detectors[it->first]["seq_size"];
+	built->addDetectorModel(it->first, alg, om_flag, noise["x"], noise["y"], noise_z,
+				(unsigned int) seq_size, detectors[it->first]["seq_time"]);
       } else {
-	if(detectors[it->first].hasMember("seq_size") && detectors[it->first].hasMember("seq_time")) {
-	  int seq_size = detectors[it->first]["seq_size"];
-	  ekf->addDetectorModel(it->first,
-				detectors[it->first]["matching_algorithm"] == "NN" ? NN : detectors[it->first]["matching_algorithm"] == "NNJPDA" ? NNJPDA : throw(asso_exception()),
-				detectors[it->first]["observation_model"] == "CARTESIAN" ? CARTESIAN : detectors[it->first]["observation_model"] == "POLAR" ? POLAR : throw(observ_exception()),
-				detectors[it->first]["noise_params"]["x"],
-				detectors[it->first]["noise_params"]["y"],(unsigned int) seq_size,detectors[it->first]["seq_time"]);
-	} else {
-	  ekf->addDetectorModel(it->first,
-				detectors[it->first]["matching_algorithm"] == "NN" ? NN : detectors[it->first]["matching_algorithm"] == "NNJPDA" ? NNJPDA : throw(asso_exception()),
-				detectors[it->first]["observation_model"] == "CARTESIAN" ? CARTESIAN : detectors[it->first]["observation_model"] == "POLAR" ? POLAR : throw(observ_exception()),
-				detectors[it->first]["noise_params"]["x"],
-				detectors[it->first]["noise_params"]["y"]);
-	}
+	built->addDetectorModel(it->first, alg, om_flag, noise["x"], noise["y"], noise_z);
       }
     } catch (asso_exception& e) {
       ROS_FATAL_STREAM(""
@@ -163,9 +243,10 @@ void PeopleTracker::parseParams(ros::NodeHandle n) {
 		       << detectors[it->first]["matching_algorithm"]
 		       << " is not specified. Unable to add "
 		       << (std::string)(it->first)
-		       << " to the tracker. Please use either NN or NNJPDA as association algorithms."
+		       << " to the tracker. Please use NN, NNJPDA, HUNGARIAN or AUCTION as association algorithms."
 		       );
-      return;
+      delete built;
+      return NULL;
     } catch (observ_exception& e) {
       ROS_FATAL_STREAM(""
 		       << e.what()
@@ -175,65 +256,235 @@ void PeopleTracker::parseParams(ros::NodeHandle n) {
 		       << (std::string)(it->first)
 		       << " to the tracker. Please use either CARTESIAN or POLAR as observation models."
 		       );
-      return;
+      delete built;
+      return NULL;
+    }
+  }
+  return built;
+}
+
+void PeopleTracker::degradationCallback(const std_msgs::UInt8::ConstPtr &level) {
+  degradation_level = level->data;
+}
+
+/* The filter of the degradation level, from the tracking thread: the last
+ * step of the perception stack under load, PF tracks given up for EKF ones
+ * and back. The tracks of the new tracker start anew, their IDs after those
+ * published, so no UUID nor trajectory is reused. A filter that can not be
+ * built, e.g. EKF of a BEARING detector, is not tried again. */
+void PeopleTracker::switchFilter() {
+  const std::string &filter = degradation_level >= FILTER_DEGRADATION_LEVEL && !degraded_filter_type.empty() ? degraded_filter_type : filter_type;
+  if(filter == current_filter || filter == failed_filter) {
+    return;
+  }
+  Tracker *built = buildTracker(filter);
+  if(built == NULL) {
+    ROS_ERROR("[%s] Can not switch the tracker to %s, kept at %s.", __APP_NAME__, filter.c_str(), current_filter.c_str());
+    failed_filter = filter;
+    return;
+  }
+  Tracker *previous;
+  {
+    boost::unique_lock<boost::shared_mutex> lock(tracker_mutex);
+    boost::mutex::scoped_lock publish_lock(publish_mutex);
+    previous = tracker;
+    tracker = built;
+    id_offset = max_track_id + 1;
+  }
+  delete previous;
+  ROS_WARN("[%s] Degradation level %d, tracker switched from %s to %s.", __APP_NAME__, (int)degradation_level, current_filter.c_str(), filter.c_str());
+  current_filter = filter;
+}
+
+/* The state of now to the writer thread of the checkpoints, from the
+ * tracking thread, which only copies it: with the published IDs, and the
+ * last checkpoint_trajectory_poses poses of every trajectory. */
+void PeopleTracker::saveCheckpoint() {
+  TrackerState &state = checkpoint_writer.back();
+  {
+    boost::shared_lock<boost::shared_mutex> lock(tracker_mutex);
+    tracker->saveState(state);
+    for(size_t i = 0; i < state.tracks.size(); i++) {
+      state.tracks[i].id += id_offset;
+    }
+    state.next_id += id_offset;
+  }
+  state.session = startup_time_str;
+  {
+    boost::mutex::scoped_lock lock(publish_mutex);
+    state.next_id = std::max(state.next_id, max_track_id + 1);
+    state.trajectories.resize(previous_poses.size());
+    size_t k = 0;
+    for(std::unordered_map<long, TrackHistory>::const_iterator it = previous_poses.begin(); it != previous_poses.end(); ++it, k++) {
+      const TrackHistory &history = it->second;
+      TrajectoryState &trajectory = state.trajectories[k];
+      size_t first = checkpoint_trajectory_poses > 0 && history.size() > (size_t)checkpoint_trajectory_poses ? history.size() - checkpoint_trajectory_poses : 0;
+      trajectory.id = it->first;
+      trajectory.stats = history.stats();
+      trajectory.poses.resize(history.size() - first);
+      for(size_t j = first; j < history.size(); j++) {
+	trajectory.poses[j - first] = history.pose(j);
+      }
+    }
+  }
+  checkpoint_writer.commit();
+}
+
+/* The tracks of the last checkpoint carry on with their IDs, UUIDs and
+ * trajectories, predicted from its time to now by the first prediction; the
+ * tracks too uncertain by then are lost at the first update, as any other. */
+void PeopleTracker::restoreCheckpoint() {
+  TrackerState state;
+  if(!readCheckpoint(checkpoint_file, state)) {
+    ROS_INFO("[%s] No checkpoint in '%s', tracking from scratch.", __APP_NAME__, checkpoint_file.c_str());
+    return;
+  }
+  double age = ros::Time::now().toSec() - state.time;
+  if(age < 0.0 || age > checkpoint_max_age) {
+    ROS_WARN("[%s] The checkpoint is %f s old, over %f s, tracking from scratch.", __APP_NAME__, age, checkpoint_max_age);
+    return;
+  }
+  tracker->restoreState(state);
+  if(!state.session.empty()) {
+    startup_time_str = state.session;
+  }
+  for(size_t i = 0; i < state.trajectories.size(); i++) {
+    const TrajectoryState &trajectory = state.trajectories[i];
+    previous_poses.emplace(trajectory.id, TrackHistory(max_trajectory_poses)).first->second.restore(trajectory.poses, trajectory.stats);
+  }
+  max_track_id = state.next_id - 1;
+  ROS_WARN("[%s] Restored %lu tracks and %lu candidate sequences of a checkpoint %f s old.", __APP_NAME__,
+	   state.tracks.size(), state.sequences.size(), age);
+}
+
+/* The IDs of a snapshot of the current tracker, under tracker_mutex. */
+void PeopleTracker::offsetIds(TrackSnapshot &tracks) const {
+  if(id_offset) {
+    for(size_t i = 0; i < tracks.size(); i++) {
+      tracks.ids[i] += id_offset;
     }
-    ros::Subscriber sub;
-    subscribers[std::pair<std::string, std::string>(it->first, detectors[it->first]["topic"])] = sub;
   }
 }
 
 void PeopleTracker::trackingThread() {
+  thread_config::apply(node_name, "tracking", tracking_thread_settings);
   ros::Rate fps(tracker_frequency);
   double time_sec = 0.0;
   
-  while(ros::ok()) {
-    std::map<long, std::vector<people_msgs::Person> > ppl;
-    if(ekf == NULL) {
-      if(ukf == NULL) {
-	ppl = pf->track(&time_sec);
-      } else {
-	ppl = ukf->track(&time_sec);
-      }
-    } else {
-      ppl = ekf->track(&time_sec);
+  while(running && ros::ok()) {
+    switchFilter();
+    if(queued_ingestion) {
+      drainObservations();
+    }
+#ifdef PEOPLE_TRACKER_INSTRUMENTATION
+    diagnostics->update(); // at its own period, 1 s by default
+#endif
+    if(checkpoint_writer.isOpen() && ros::Time::now().toSec() - last_checkpoint >= checkpoint_period) {
+      saveCheckpoint();
+      last_checkpoint = ros::Time::now().toSec();
     }
     
-    if(ppl.size()) {
-      std::vector<people_msgs::Person> people;
-      std::vector<people_msgs::Person> variances;
-      std::vector<std::string> uuids;
-      std::vector<long> pids;
-      
-      for(std::map<long, std::vector<people_msgs::Person> >::const_iterator it = ppl.begin(); it != ppl.end(); ++it) {
-	people.push_back(it->second[0]);
-	variances.push_back(it->second[1]);
-	uuids.push_back(generateUUID(startup_time_str, it->first));
-	pids.push_back(it->first);
-      }
-      
-      if(pub_marker.getNumSubscribers()) {
-	createVisualisation(people, pids, pub_marker);
+    // event driven, the tracks are published with the observations: only
+    // predicted here while no detector has been heard for a period
+    if(event_driven && ros::Time::now().toSec() - last_observation < 1.0 / tracker_frequency) {
+      fps.sleep();
+      continue;
+    }
+    
+    {
+      TRACKER_SCOPED_TIMER(tick_latency);
+      boost::shared_lock<boost::shared_mutex> lock(tracker_mutex);
+      tracker->track(tick_tracks, &time_sec);
+      offsetIds(tick_tracks);
+    }
+    publishTracks(tick_tracks);
+    
+    fps.sleep();
+  }
+}
+
+/* The last track states moved on at their velocity to now, at
+ * extrapolation_rate: the tracker is not locked, its states only loaded
+ * atomically, and the filters not predicted. */
+void PeopleTracker::extrapolationThread() {
+  thread_config::apply(node_name, "extrapolation", extrapolation_thread_settings);
+  ros::Rate rate(extrapolation_rate);
+  
+  while(running && ros::ok()) {
+    bayes_people_tracker::TrackStates::ConstPtr states = boost::atomic_load(&latest_states);
+    ros::Time now = ros::Time::now();
+    double dt = states ? (now - states->header.stamp).toSec() : 0.0;
+    if(states && dt <= extrapolation_horizon && pub_track_states_extrapolated.getNumSubscribers()) {
+      bayes_people_tracker::TrackStates::Ptr extrapolated(new bayes_people_tracker::TrackStates(*states));
+      extrapolated->header.stamp = now;
+      for(size_t i = 0; i < extrapolated->positions.size(); i++) {
+	extrapolated->positions[i] += extrapolated->velocities[i] * dt;
       }
-      
-      if(pub_trajectory_acc.getNumSubscribers()) {
-	people_msgs::People trajectory_acc;
-      	trajectory_acc.header.stamp = ros::Time::now();
-      	trajectory_acc.header.frame_id = target_frame;
-      	trajectory_acc.people = people;
+      pub_track_states_extrapolated.publish(extrapolated);
+    }
+    rate.sleep();
+  }
+}
 
-	/*** For LOST-CoRoNa, compare with MIT's work ***/
-	for(int i = 0; i < trajectory_acc.people.size(); i++) {
-	  trajectory_acc.people[i].name = boost::to_string(pids[i]);
+/* Messages are built for the topics with subscribers only, the trajectories
+ * are always kept. */
+void PeopleTracker::publishTracks(const TrackSnapshot &tracks) {
+  boost::mutex::scoped_lock lock(publish_mutex);
+  if(tracks.size()) {
+    uuids.resize(tracks.size());
+    for(size_t i = 0; i < tracks.size(); i++) {
+      uuids[i] = &trackUUID(tracks.ids[i]);
+      max_track_id = std::max(max_track_id, tracks.ids[i]);
+    }
+    
+    if(pub_marker.getNumSubscribers()) {
+      createVisualisation(tracks, pub_marker);
+    } else {
+      track_markers.clear(); // rebuilt from the trajectories for the next subscriber
+    }
+    
+    if(pub_trajectory_acc.getNumSubscribers()) {
+      people_msgs::People trajectory_acc;
+      trajectory_acc.header.stamp = ros::Time::now();
+      trajectory_acc.header.frame_id = target_frame;
+      trajectory_acc.people.resize(tracks.size());
+      for(size_t i = 0; i < tracks.size(); i++) {
+	people_msgs::Person &person = trajectory_acc.people[i];
+	person.position.x = tracks.poses[i].x;
+	person.position.y = tracks.poses[i].y;
+	person.position.z = tracks.poses[i].z;
+	person.velocity.x = tracks.poses[i].vx;
+	person.velocity.y = tracks.poses[i].vy;
+	person.velocity.z = tracks.poses[i].vz;
+	person.reliability = tracks.reliability[i];
+	person.tags.push_back(tracks.sample_ids[i]);
+#ifdef ONLINE_LEARNING
+	// the label so far, while the track is alive
+	std::string label = "unknown_trajectory";
+	std::unordered_map<long, TrackHistory>::const_iterator history = previous_poses.find(tracks.ids[i]);
+	if(history != previous_poses.end()) {
+	  PN_experts(history->second.stats(), label);
+	  track_probability(history->second.stats(), tracks.ids[i], label);
 	}
+	person.tags.push_back(label);
+#endif
 	/*** For LOST-CoRoNa, compare with MIT's work ***/
-	
-      	pub_trajectory_acc.publish(trajectory_acc);
+	person.name = boost::to_string(tracks.ids[i]);
       }
-      
-      publishTrajectory(people, variances, pids, pub_trajectory);
+      pub_trajectory_acc.publish(trajectory_acc);
     }
     
-    fps.sleep();
+    publishTrajectory(tracks, pub_trajectory);
+  }
+  
+  if(pub_gates.getNumSubscribers()) {
+    // published even without tracks: an empty gate list is information too
+    publishGates(tracks, pub_gates);
+  }
+  
+  if(pub_track_states.getNumSubscribers() || pub_track_states_extrapolated.getNumSubscribers()) {
+    // also without tracks, the people gone
+    publishTrackStates(tracks, pub_track_states);
   }
 }
 
@@ -277,6 +528,75 @@ void PeopleTracker::publishDetections(double time_sec,
   publishDetections(people);
 }
 
+/* The UUID of a track, generated at its birth only: the ID never changes,
+ * and the cache entry leaves with the track in publishTrajectory. */
+const std::string &PeopleTracker::trackUUID(long id) {
+  std::unordered_map<long, std::string>::iterator it = uuid_cache.find(id);
+  if(it == uuid_cache.end()) {
+    it = uuid_cache.insert(std::make_pair(id, generateUUID(startup_time_str, id))).first;
+  }
+  return it->second;
+}
+
+/* One gate per track: its position predicted gate_lookahead seconds ahead with
+ * the constant velocity model, and its position variance inflated by
+ * gate_sigma^2, so a detector can keep the points within gate_sigma standard
+ * deviations of every track. */
+void PeopleTracker::publishGates(const TrackSnapshot &tracks, ros::Publisher& pub) {
+  people_msgs::PositionMeasurementArray gates;
+  gates.header.stamp = ros::Time::now();
+  gates.header.frame_id = target_frame;
+  for(size_t i = 0; i < tracks.size(); i++) {
+    const TrackPose &pose = tracks.poses[i];
+    people_msgs::PositionMeasurement gate;
+    gate.header = gates.header;
+    gate.name = "gate";
+    gate.pos.x = pose.x + pose.vx * gate_lookahead;
+    gate.pos.y = pose.y + pose.vy * gate_lookahead;
+    gate.pos.z = pose.z + pose.vz * gate_lookahead;
+    gate.reliability = 1.0;
+    gate.covariance[0] = pose.var_x * gate_sigma * gate_sigma;
+    gate.covariance[4] = pose.var_y * gate_sigma * gate_sigma;
+    gate.covariance[8] = pose.var_z * gate_sigma * gate_sigma;
+    gates.people.push_back(gate);
+  }
+  pub.publish(gates);
+}
+
+/* The planar state of every track, a few floats each: what a costmap or a
+ * planner needs of the tracks, at the rate of the tracker. Also kept for the
+ * extrapolation, which only reads it: a message is never changed once
+ * published. */
+void PeopleTracker::publishTrackStates(const TrackSnapshot &tracks, ros::Publisher& pub) {
+  bayes_people_tracker::TrackStates::Ptr states(new bayes_people_tracker::TrackStates);
+  states->header.stamp = ros::Time::now();
+  states->header.frame_id = target_frame;
+  states->ids.resize(tracks.size());
+  states->positions.resize(2 * tracks.size());
+  states->velocities.resize(2 * tracks.size());
+  states->variances.resize(2 * tracks.size());
+  states->probabilities.resize(tracks.size());
+  for(size_t i = 0; i < tracks.size(); i++) {
+    const TrackPose &pose = tracks.poses[i];
+    states->ids[i] = tracks.ids[i];
+    states->positions[2 * i] = pose.x;
+    states->positions[2 * i + 1] = pose.y;
+    states->velocities[2 * i] = pose.vx;
+    states->velocities[2 * i + 1] = pose.vy;
+    states->variances[2 * i] = pose.var_x;
+    states->variances[2 * i + 1] = pose.var_y;
+    // the trajectories already have the poses of the update
+    std::unordered_map<long, TrackHistory>::const_iterator history = previous_poses.find(tracks.ids[i]);
+    states->probabilities[i] = history != previous_poses.end() ? history->second.stats().probability() : 0.5;
+  }
+  if(pub.getNumSubscribers()) {
+    pub.publish(states);
+  }
+  if(extrapolation_rate > 0.0) {
+    boost::atomic_store(&latest_states, bayes_people_tracker::TrackStates::ConstPtr(states));
+  }
+}
+
 void PeopleTracker::publishDetections(bayes_people_tracker::PeopleTracker msg) {
   pub_detect.publish(msg);
 }
@@ -289,182 +609,185 @@ void PeopleTracker::publishDetections(people_msgs::People msg) {
   pub_people.publish(msg);
 }
 
-void PeopleTracker::PN_experts(geometry_msgs::PoseArray &variance, geometry_msgs::PoseArray &velocity, geometry_msgs::PoseArray &trajectory) {
-  float path_length = 0.0;
-  for(int i = 1; i < trajectory.poses.size(); i++) {
-    path_length += hypot(trajectory.poses[i].position.x-trajectory.poses[i-1].position.x, trajectory.poses[i].position.y-trajectory.poses[i-1].position.y);
-  }
-  float sum_velocity = 0.0;
-  for(int i = 0; i < velocity.poses.size(); i++) {
-    sum_velocity += fabs(velocity.poses[i].position.x+velocity.poses[i].position.y);
-  }
-  float avg_velocity = sum_velocity / velocity.poses.size();
-  float sum_variance = 0.0;
-  for(int i = 0; i < variance.poses.size(); i++) {
-    sum_variance += variance.poses[i].position.x+variance.poses[i].position.y;
-  }
-  float avg_variance = sum_variance / variance.poses.size();
-  if(path_length >= human_path_min && avg_velocity >= human_velo_min && avg_velocity <= human_velo_max) {
-    trajectory.header.frame_id = "human_trajectory";
+/* The label of a trajectory from its running statistics, label left as it is when neither expert decides. */
+void PeopleTracker::PN_experts(const TrackStats &stats, std::string &label) {
+  if(stats.path_length >= human_path_min && stats.averageVelocity() >= human_velo_min && stats.averageVelocity() <= human_velo_max) {
+    label = "human_trajectory";
   }
-  if(path_length <= static_path_max && avg_velocity <= static_velo_max && avg_variance <= static_vari_max) {
-    trajectory.header.frame_id = "non_human_trajectory";
+  if(stats.path_length <= static_path_max && stats.averageVelocity() <= static_velo_max && stats.averageVariance() <= static_vari_max) {
+    label = "non_human_trajectory";
   }
-  //std::cerr << "path_length = " << path_length << ", avg_velocity = " << avg_velocity << ", avg_variance = " << avg_variance << std::endl;
+  //std::cerr << "path_length = " << stats.path_length << ", avg_velocity = " << stats.averageVelocity() << ", avg_variance = " << stats.averageVariance() << std::endl;
 }
 
-void PeopleTracker::track_probability(geometry_msgs::PoseArray &trajectory) {
-  std::vector<double> odds;
-  for(int i = 0; i < trajectory.poses.size(); i++) {
-    double p = trajectory.poses[i].orientation.x;
-    if(p > 0) {
-      if(std::fabs(1.0 - p) < DBL_EPSILON) {
-	odds.push_back(100.0);
-      } else {
-	odds.push_back(p / (1.0 - p));
-      }
-    }
-  }
-  
-  double product_odds = 1.0; // A tracklet's human probability should always start with P(H) = 0.5.
-  for(int i = 0; i < odds.size(); i++) {
-    product_odds *= odds[i];
-  }
-  
-  double track_probability = (product_odds / (1.0 + product_odds));
-  ROS_INFO("[%s] The probability that trajectory ID %d belongs to a human is %f", __APP_NAME__, trajectory.header.seq, track_probability);
+void PeopleTracker::track_probability(const TrackStats &stats, long id, std::string &label) {
+  double track_probability = stats.probability();
+  ROS_DEBUG("[%s] The probability that trajectory ID %ld belongs to a human is %f", __APP_NAME__, id, track_probability);
   
   if(track_probability > human_track_proba) {
-    trajectory.header.frame_id = "human_trajectory";
+    label = "human_trajectory";
   }
   if(track_probability < 1.0 - human_track_proba) {
-    trajectory.header.frame_id = "non_human_trajectory";
-  }
-}
-
-void PeopleTracker::publishTrajectory(std::vector<people_msgs::Person> people,
-				      std::vector<people_msgs::Person> variances,
-				      std::vector<long> pids,
-				      ros::Publisher& pub) {
-  /*** find trajectories ***/ 
-  for(int i = 0; i < previous_poses.size(); i++) {
-    if(boost::get<0>(previous_poses[i]) != INVALID_ID) {
-      bool last_pose = true;
-      for(int j = 0; j < pids.size(); j++) {
-  	if(pids[j] == boost::get<0>(previous_poses[i])) {
-  	  last_pose = false;
-  	  break;
-  	}
-      }
-      if(last_pose) {
-  	geometry_msgs::PoseArray trajectory;
-  	geometry_msgs::PoseArray velocity;
-  	geometry_msgs::PoseArray variance;
-	geometry_msgs::Pose p;
-	
-  	trajectory.header.seq = boost::get<0>(previous_poses[i]); // tracking ID
-  	trajectory.header.stamp = ros::Time::now();
-  	trajectory.header.frame_id = target_frame; // will be replaced by P-N experts
-  	for(int j = 0; j < previous_poses.size(); j++) {
-  	  if(boost::get<0>(previous_poses[j]) == trajectory.header.seq) {
-	    p.position = boost::get<1>(previous_poses[j]).position;
-	    trajectory.poses.push_back(p);
-	    p.position = boost::get<1>(previous_poses[j]).velocity;
-	    velocity.poses.push_back(p);
-	    p.position = boost::get<2>(previous_poses[j]).position;
-	    variance.poses.push_back(p);
-	    boost::get<0>(previous_poses[j]) = INVALID_ID;
-  	  }
-  	}
-  	pub.publish(trajectory);
-  	//std::cerr << "[people_tracker] trajectory ID = " << trajectory.header.seq << ", timestamp = " << trajectory.header.stamp << ", poses size = " << trajectory.poses.size() << std::endl;
-	if(log_trajectories) {
-	  std::cerr << "trajectory: ";
-	  for(int k = 0; k < trajectory.poses.size(); k++) {
-	    std::cerr << trajectory.poses[k].position.x << " " << trajectory.poses[k].position.y << " ";
-	  }
-	  std::cerr << std::endl;
-	}
-      }
+    label = "non_human_trajectory";
+  }
+}
+
+void PeopleTracker::publishTrajectory(const TrackSnapshot &tracks, ros::Publisher& pub) {
+  /*** find trajectories, the tracks gone since the last call ***/
+  std::set<long> live(tracks.ids.begin(), tracks.ids.end());
+  for(std::unordered_map<long, TrackHistory>::iterator it = previous_poses.begin(); it != previous_poses.end();) {
+    if(live.count(it->first)) {
+      ++it;
+      continue;
+    }
+    const TrackHistory &history = it->second;
+    geometry_msgs::PoseArray trajectory;
+    geometry_msgs::PoseArray velocity;
+    geometry_msgs::PoseArray variance;
+    geometry_msgs::Pose p;
+    
+    trajectory.header.seq = it->first; // tracking ID
+    trajectory.header.stamp = ros::Time::now();
+    trajectory.header.frame_id = target_frame; // will be replaced by P-N experts
+    trajectory.poses.reserve(history.size());
+    velocity.poses.reserve(history.size());
+    variance.poses.reserve(history.size());
+    for(size_t j = 0; j < history.size(); j++) {
+      const TrackPose &pose = history.pose(j);
+      p.position.x = pose.x;
+      p.position.y = pose.y;
+      p.position.z = pose.z;
+      trajectory.poses.push_back(p);
+      p.position.x = pose.vx;
+      p.position.y = pose.vy;
+      p.position.z = pose.vz;
+      velocity.poses.push_back(p);
+      p.position.x = pose.var_x;
+      p.position.y = pose.var_y;
+      p.position.z = pose.var_z;
+      variance.poses.push_back(p);
     }
+#ifdef ONLINE_LEARNING
+    PN_experts(history.stats(), trajectory.header.frame_id);
+    track_probability(history.stats(), it->first, trajectory.header.frame_id);
+#endif
+    pub.publish(trajectory);
+    //std::cerr << "[people_tracker] trajectory ID = " << trajectory.header.seq << ", timestamp = " << trajectory.header.stamp << ", poses size = " << trajectory.poses.size() << std::endl;
+    if(log_trajectories && !trajectory_logger.log(it->first, trajectory.header.stamp.toSec(), history)) {
+      ROS_WARN_THROTTLE(5.0, "[%s] Trajectory log full, %lu trajectories dropped so far.", __APP_NAME__, trajectory_logger.dropped());
+    }
+    uuid_cache.erase(it->first);
+    it = previous_poses.erase(it);
   }
   
-  /*** clean up ***/
-  for(int i = 0; i < previous_poses.size(); i++) {
-    if(boost::get<0>(previous_poses[i]) == INVALID_ID) {
-      previous_poses.erase(previous_poses.begin()+i);
-    }
+  /*** add new coming poses to the trajectories of their tracks ***/
+  for(size_t i = 0; i < tracks.size(); i++) {
+    //if(vars[i].position.x+vars[i].position.y <= human_vari_max) // only use this for learning!
+    previous_poses.emplace(tracks.ids[i], TrackHistory(max_trajectory_poses)).first->second.push(tracks.poses[i], tracks.reliability[i]);
   }
+}
+
+/* The markers of a track as of its birth, the trail from its trajectory so far. */
+void PeopleTracker::initTrackMarkers(long pid, TrackMarkers &markers) {
+  /*** for FLOBOT - track ID ***/
+  double human_height = 1.7; //meter
+  visualization_msgs::Marker &track_id = markers.id;
+  track_id.header.frame_id = target_frame;
+  track_id.ns = "people_id";
+  track_id.id = pid;
+  track_id.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
+  track_id.pose.position.z = human_height;
+  track_id.pose.orientation.w = 1.0;
+  track_id.scale.z = 0.7;
+  track_id.color.a = 1.0;
+  track_id.color.r = 1.0;
+  track_id.color.g = 0.2;
+  track_id.color.b = 0.0;
+  track_id.text = boost::to_string(pid);
+  track_id.lifetime = ros::Duration(0.1);
   
-  /*** add new coming poses to the previous_poses list ***/  
-  for(int i = 0; i < people.size(); i++) {
-    bool new_pose = true;
-    if(new_pose) {
-      //if(vars[i].position.x+vars[i].position.y <= human_vari_max) // only use this for learning!
-      previous_poses.push_back(boost::make_tuple(pids[i], people[i], variances[i]));
-    }
+  /*** for FLOBOT - track ***/
+  visualization_msgs::Marker &track = markers.trail;
+  track.header.frame_id = target_frame;
+  track.ns = "people_trajectory";
+  track.id = pid;
+  track.type = visualization_msgs::Marker::LINE_STRIP;
+  track.pose.orientation.w = 1.0;
+  track.scale.x = 0.1;
+  track.color.a = 1.0;
+  track.color.r = std::max(0.3,(double)(pid%3)/3.0);
+  track.color.g = std::max(0.3,(double)(pid%6)/6.0);
+  track.color.b = std::max(0.3,(double)(pid%9)/9.0);
+  track.lifetime = ros::Duration(1.0);
+  std::unordered_map<long, TrackHistory>::const_iterator history = previous_poses.find(pid);
+  geometry_msgs::Point p;
+  for(size_t j = 0; history != previous_poses.end() && j < history->second.size(); j++) {
+    p.x = history->second.pose(j).x;
+    p.y = history->second.pose(j).y;
+    track.points.push_back(p);
   }
 }
 
-void PeopleTracker::createVisualisation(std::vector<people_msgs::Person> people, std::vector<long> pids, ros::Publisher& pub) {
+/* Every track keeps its markers from tick to tick, only their poses, stamps
+ * and trail tips are updated, and the markers of the tracks gone are deleted
+ * once. */
+void PeopleTracker::createVisualisation(const TrackSnapshot &tracks, ros::Publisher& pub) {
   ROS_DEBUG("[%s] Creating markers.", __APP_NAME__);
 
-  visualization_msgs::MarkerArray marker_array;
+  ros::Time now = ros::Time::now();
+  marker_array.markers.clear();
+  
+  std::set<long> live(tracks.ids.begin(), tracks.ids.end());
+  for(std::unordered_map<long, TrackMarkers>::iterator it = track_markers.begin(); it != track_markers.end();) {
+    if(live.count(it->first)) {
+      ++it;
+      continue;
+    }
+    it->second.id.action = visualization_msgs::Marker::DELETE;
+    it->second.id.header.stamp = now;
+    it->second.trail.action = visualization_msgs::Marker::DELETE;
+    it->second.trail.header.stamp = now;
+    it->second.trail.points.clear();
+    marker_array.markers.push_back(it->second.id);
+    marker_array.markers.push_back(it->second.trail);
+    it = track_markers.erase(it);
+  }
   
-  for(int i = 0; i < people.size(); i++) {
+  for(size_t i = 0; i < tracks.size(); i++) {
     /*** for STRANDS ***/
     // std::vector<visualization_msgs::Marker> human = createHuman(i*10, poses[i]);
     // marker_array.markers.insert(marker_array.markers.begin(), human.begin(), human.end());
     
-    /*** for FLOBOT - track ID ***/
-    double human_height = 1.7; //meter
-    visualization_msgs::Marker track_id;
-    track_id.header.stamp = ros::Time::now();
-    track_id.header.frame_id = target_frame;
-    track_id.ns = "people_id";
-    track_id.id = pids[i];
-    track_id.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
-    track_id.pose.position.x = people[i].position.x;
-    track_id.pose.position.y = people[i].position.y;
-    track_id.pose.position.z = human_height;
-    track_id.scale.z = 0.7;
-    track_id.color.a = 1.0;
-    track_id.color.r = 1.0;
-    track_id.color.g = 0.2;
-    track_id.color.b = 0.0;
-    track_id.text = boost::to_string(pids[i]);
-    track_id.lifetime = ros::Duration(0.1);
-    marker_array.markers.push_back(track_id);
+    std::pair<std::unordered_map<long, TrackMarkers>::iterator, bool> entry = track_markers.emplace(tracks.ids[i], TrackMarkers());
+    TrackMarkers &markers = entry.first->second;
+    if(entry.second) {
+      initTrackMarkers(tracks.ids[i], markers);
+    }
+    markers.id.header.stamp = now;
+    markers.id.pose.position.x = tracks.poses[i].x;
+    markers.id.pose.position.y = tracks.poses[i].y;
     
-    /*** for FLOBOT - track ***/
-    visualization_msgs::Marker track;
-    track.header.stamp = ros::Time::now();
-    track.header.frame_id = target_frame;
-    track.ns = "people_trajectory";
-    track.id = pids[i];
-    track.type = visualization_msgs::Marker::LINE_STRIP;
+    markers.trail.header.stamp = now;
     geometry_msgs::Point p;
-    for(int j = 0; j < previous_poses.size(); j++) {
-      if(boost::get<0>(previous_poses[j]) == pids[i]) {
-	p.x = boost::get<1>(previous_poses[j]).position.x;
-	p.y = boost::get<1>(previous_poses[j]).position.y;
-	track.points.push_back(p);
-      }
+    p.x = tracks.poses[i].x;
+    p.y = tracks.poses[i].y;
+    p.z = tracks.poses[i].z;
+    markers.trail.points.push_back(p);
+    if(max_trajectory_poses > 0 && markers.trail.points.size() > (size_t)max_trajectory_poses) {
+      markers.trail.points.erase(markers.trail.points.begin());
     }
-    track.scale.x = 0.1;
-    track.color.a = 1.0;
-    track.color.r = std::max(0.3,(double)(pids[i]%3)/3.0);
-    track.color.g = std::max(0.3,(double)(pids[i]%6)/6.0);
-    track.color.b = std::max(0.3,(double)(pids[i]%9)/9.0);
-    track.lifetime = ros::Duration(1.0);
-    marker_array.markers.push_back(track);
+    
+    marker_array.markers.push_back(markers.id);
+    marker_array.markers.push_back(markers.trail);
   }
   
   pub.publish(marker_array);
 }
 
 // detector == pma->people[i].name
-void PeopleTracker::detectorCallback(const people_msgs::PositionMeasurementArray::ConstPtr& pma, std::string detector) {
+void PeopleTracker::detectorCallback(const people_msgs::PositionMeasurementArray::ConstPtr& pma, size_t index) {
+  perception_trace::ScopedHop hop("bayes_people_tracker", perception_trace::origin(pma->header.stamp));
+  const std::string &detector = subscribers[index].name;
   /* DEBUG print */
   // std::cout << "[" << __APP_NAME__ << "] Received [" << pma->people.size() << "] samples from [" << detector << "], and the sample IDs are:";
   // for(size_t i = 0; i < pma->people.size(); i++) {
@@ -483,60 +806,201 @@ void PeopleTracker::detectorCallback(const people_msgs::PositionMeasurementArray
     return;
   }
   
-  geometry_msgs::PointStamped person_in_cam_coords;
-  geometry_msgs::PointStamped person_in_target_coords;
-  people_msgs::PositionMeasurementArray people_in_target_coords;
+  if(isStale(detector, pma->header.stamp.toSec(), subscribers[index].max_age)) {
+    return;
+  }
   
-  person_in_cam_coords.header = pma->header;
-  if(person_in_cam_coords.header.frame_id.empty()) {
+  std::string frame_id = pma->header.frame_id;
+  if(frame_id.empty()) {
     for(int i = 0; i < pma->people.size(); i++) {
       if(!pma->people[i].header.frame_id.empty()) {
-	person_in_cam_coords.header.frame_id = pma->people[i].header.frame_id;
+	frame_id = pma->people[i].header.frame_id;
 	break;
       }
     }
   }
   
+  // one transform for the whole message, at its stamp
+  tf::Transform transform;
+  if(!lookupTransform(frame_id, pma->header.stamp, transform)) {
+    return;
+  }
+  const tf::Matrix3x3 &r = transform.getBasis();
+  const tf::Vector3 &t = transform.getOrigin();
+  
+  people_msgs::PositionMeasurementArray people_in_target_coords;
+  people_in_target_coords.people.resize(pma->people.size());
   for(int i = 0; i < pma->people.size(); i++) {
-    try {
-      ROS_DEBUG("[%s] Transforming received position into %s coordinate system.",  __APP_NAME__, target_frame.c_str());
-      
-      person_in_cam_coords.point = pma->people[i].pos;
-      
-      listener->waitForTransform(person_in_cam_coords.header.frame_id, target_frame, person_in_cam_coords.header.stamp, ros::Duration(1.0));
-      listener->transformPoint(target_frame, ros::Time(0), person_in_cam_coords, person_in_cam_coords.header.frame_id, person_in_target_coords);
-      
-      people_msgs::PositionMeasurement pm;
-      
-      if(pma->people[i].name.empty()) {
-	pm.name = detector;
-      } else {
-	pm.name = pma->people[i].name;
-      }
-      pm.object_id = pma->people[i].object_id;
-      pm.pos = person_in_target_coords.point;
-      pm.reliability = pma->people[i].reliability;
-      people_in_target_coords.people.push_back(pm);
-    } catch(tf::TransformException ex) {
-      ROS_WARN("[%s] Failed transform: %s", __APP_NAME__, ex.what());
+    const geometry_msgs::Point &p = pma->people[i].pos;
+    people_msgs::PositionMeasurement &pm = people_in_target_coords.people[i];
+    pm.name = pma->people[i].name.empty() ? detector : pma->people[i].name;
+    pm.object_id = pma->people[i].object_id;
+    pm.pos.x = r[0].x() * p.x + r[0].y() * p.y + r[0].z() * p.z + t.x();
+    pm.pos.y = r[1].x() * p.x + r[1].y() * p.y + r[1].z() * p.z + t.y();
+    pm.pos.z = r[2].x() * p.x + r[2].y() * p.y + r[2].z() * p.z + t.z();
+    pm.reliability = pma->people[i].reliability;
+  }
+  
+  if(people_in_target_coords.people.size()) {
+    if(queued_ingestion) {
+      ObservationBatch batch;
+      batch.detector = detector;
+      batch.time = pma->header.stamp.toSec();
+      batch.max_age = subscribers[index].max_age;
+      batch.people.swap(people_in_target_coords.people);
+      observations.push(std::move(batch));
       return;
     }
+    addObservation(detector, people_in_target_coords, pma->header.stamp.toSec(), event_driven ? &event_tracks : NULL);
+    if(event_driven) {
+      last_observation = ros::Time::now().toSec();
+      publishTracks(event_tracks);
+    }
+  }
+}
+
+/* The transform from frame to target_frame at stamp, never waiting for it: if
+ * tf has not received it yet, the latest one, as long as it is no older than
+ * transform_tolerance. The last lookups are cached, messages of several
+ * detectors often share their frame and stamp. */
+bool PeopleTracker::lookupTransform(const std::string &frame, const ros::Time &stamp, tf::Transform &transform) {
+  std::pair<std::string, ros::Time> key(frame, stamp);
+  for(size_t i = 0; i < transform_cache.size(); i++) {
+    if(transform_cache[i].first == key) {
+      transform = transform_cache[i].second;
+      return true;
+    }
   }
   
-  if(people_in_target_coords.people.size()) {
-    if(ekf == NULL) {
-      if(ukf == NULL) {
-  	pf->addObservation(detector, people_in_target_coords, pma->header.stamp.toSec());
-      } else {
-  	ukf->addObservation(detector, people_in_target_coords, pma->header.stamp.toSec());
-      }
+  tf::StampedTransform stamped;
+  try {
+    if(listener->canTransform(target_frame, frame, stamp)) {
+      listener->lookupTransform(target_frame, frame, stamp, stamped);
     } else {
-      ekf->addObservation(detector, people_in_target_coords, pma->header.stamp.toSec());
+      listener->lookupTransform(target_frame, frame, ros::Time(0), stamped);
+      if(stamp - stamped.stamp_ > ros::Duration(transform_tolerance)) {
+	ROS_WARN_THROTTLE(5.0, "[%s] No transform from %s to %s at %f yet, detections dropped.", __APP_NAME__, frame.c_str(), target_frame.c_str(), stamp.toSec());
+	return false;
+      }
     }
+  } catch(tf::TransformException &ex) {
+    ROS_WARN_THROTTLE(5.0, "[%s] Failed transform: %s", __APP_NAME__, ex.what());
+    return false;
+  }
+  transform = stamped;
+  
+  if(transform_cache.size() < 8) {
+    transform_cache.push_back(std::make_pair(key, transform));
+  } else {
+    transform_cache[transform_cache_next] = std::make_pair(key, transform);
+    transform_cache_next = (transform_cache_next + 1) % transform_cache.size();
+  }
+  return true;
+}
+
+void PeopleTracker::addObservation(const std::string &detector, people_msgs::PositionMeasurementArray &obsv, double obsv_time,
+				   TrackSnapshot *estimates) {
+  TRACKER_SCOPED_TIMER(observation_latency);
+  boost::shared_lock<boost::shared_mutex> lock(tracker_mutex);
+  tracker->addObservation(detector, obsv, obsv_time, estimates);
+  if(estimates) {
+    offsetIds(*estimates);
   }
 }
 
-// Connection callback that unsubscribes from the tracker if no one is subscribed.
+#ifdef PEOPLE_TRACKER_INSTRUMENTATION
+static std::string percentiles(const HistogramCounts &counts) {
+  char value[64];
+  snprintf(value, sizeof(value), "p50 %.3f, p99 %.3f, n %lu", counts.percentile(0.5), counts.percentile(0.99), counts.total());
+  return value;
+}
+
+/* The filters right now, the rest over the period since the last report,
+ * durations in ms. */
+void PeopleTracker::trackerDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  TrackerCounters counters;
+  HistogramCounts observations, ticks;
+  tracker->addCounters(counters);
+  observation_latency.counts(observations);
+  tick_latency.counts(ticks);
+
+  TrackerCounters period = counters;
+  period.predict.subtract(last_counters.predict);
+  period.associate.subtract(last_counters.associate);
+  period.update.subtract(last_counters.update);
+  HistogramCounts period_observations = observations, period_ticks = ticks;
+  period_observations.subtract(last_observations);
+  period_ticks.subtract(last_ticks);
+
+  stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Tracker stages, in ms");
+  stat.add("filter type", current_filter);
+  stat.add("filters", counters.filters);
+  stat.add("candidate sequences", counters.sequences);
+  stat.add("gating rejections", counters.gated - last_counters.gated);
+  stat.add("predict", percentiles(period.predict));
+  stat.add("associate", percentiles(period.associate));
+  stat.add("update", percentiles(period.update));
+  stat.add("observation", percentiles(period_observations));
+  stat.add("tick", percentiles(period_ticks));
+  if(checkpoint_writer.isOpen()) {
+    stat.add("checkpoints written", checkpoint_writer.written());
+    stat.add("checkpoint failures", checkpoint_writer.failures());
+  }
+
+  last_counters = counters;
+  last_observations = observations;
+  last_ticks = ticks;
+}
+
+void PeopleTracker::threadDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  thread_config::diagnostics(stat, node_name);
+}
+#endif
+
+bool observationBefore(const ObservationBatch &a, const ObservationBatch &b) {
+  return a.time < b.time;
+}
+
+/* The batches queued since the last call, in the order of their stamps
+ * whatever detector they come from, all on the tracking thread: the detector
+ * callbacks never wait for the tracker. */
+void PeopleTracker::drainObservations() {
+  drained.clear();
+  ObservationBatch batch;
+  while(observations.pop(batch)) {
+    if(!isStale(batch.detector, batch.time, batch.max_age)) {
+      drained.push_back(std::move(batch));
+    }
+  }
+  if(drained.empty()) {
+    return;
+  }
+  std::stable_sort(drained.begin(), drained.end(), observationBefore);
+  
+  people_msgs::PositionMeasurementArray obsv;
+  for(size_t i = 0; i < drained.size(); i++) {
+    obsv.people.swap(drained[i].people);
+    addObservation(drained[i].detector, obsv, drained[i].time, event_driven && i + 1 == drained.size() ? &tick_tracks : NULL);
+  }
+  if(event_driven) {
+    last_observation = ros::Time::now().toSec();
+    publishTracks(tick_tracks);
+  }
+}
+
+/* Whether detections stamped at time came too late for the latency budget of
+ * their detector: the filters are always predicted to now, so a stale
+ * detection would only drag the tracks back in time. */
+bool PeopleTracker::isStale(const std::string &detector, double time, double max_age) {
+  double age = ros::Time::now().toSec() - time;
+  if(max_age > 0.0 && age > max_age) {
+    ROS_WARN_THROTTLE(5.0, "[%s] Detections of %s are %f s old, over the %f s budget, dropped.", __APP_NAME__, detector.c_str(), age, max_age);
+    return true;
+  }
+  return false;
+}
+
+// Connection callback that subscribes to the detectors while the tracks have subscribers, and unsubscribes otherwise.
 void PeopleTracker::connectCallback(ros::NodeHandle &n) {
   bool loc = pub_detect.getNumSubscribers();
   bool pose_array = pub_pose_array.getNumSubscribers();
@@ -544,23 +1008,19 @@ void PeopleTracker::connectCallback(ros::NodeHandle &n) {
   bool trajectory = pub_trajectory.getNumSubscribers();
   bool trajectory_acc = pub_trajectory_acc.getNumSubscribers();
   bool markers = pub_marker.getNumSubscribers();
-  std::map<std::pair<std::string, std::string>, ros::Subscriber>::const_iterator it;
+  bool gates = pub_gates.getNumSubscribers();
+  bool states = pub_track_states.getNumSubscribers() || pub_track_states_extrapolated.getNumSubscribers();
+  bool subscribed = loc || pose_array || people || trajectory || trajectory_acc || markers || gates || states;
   
-  if(!loc && !pose_array && !people && !trajectory && !trajectory_acc && !markers) {
-    ROS_WARN("[%s] No subscribers. Unsubscribing.", __APP_NAME__);
-    for(it = subscribers.begin(); it != subscribers.end(); ++it) {
-      const_cast<ros::Subscriber&>(it->second).shutdown();
-    }
-  } else {
-    ROS_INFO("[%s] New subscribers. Subscribing.", __APP_NAME__);
-    for(it = subscribers.begin(); it != subscribers.end(); ++it) {
-      subscribers[it->first] = n.subscribe<people_msgs::PositionMeasurementArray>(it->first.second.c_str(), 100, boost::bind(&PeopleTracker::detectorCallback, this, _1, it->first.first));
+  // only the detectors whose state changes, the others keep their connection
+  for(size_t i = 0; i < subscribers.size(); i++) {
+    DetectorSubscription &detector = subscribers[i];
+    if(!subscribed && detector.subscriber) {
+      ROS_WARN("[%s] No subscribers. Unsubscribing from %s.", __APP_NAME__, detector.topic.c_str());
+      detector.subscriber.shutdown();
+    } else if(subscribed && !detector.subscriber) {
+      ROS_INFO("[%s] New subscribers. Subscribing to %s.", __APP_NAME__, detector.topic.c_str());
+      detector.subscriber = n.subscribe<people_msgs::PositionMeasurementArray>(detector.topic, detector.queue_size, boost::bind(&PeopleTracker::detectorCallback, this, _1, i));
     }
   }
 }
-
-int main(int argc, char **argv) {
-  ros::init(argc, argv, "bayes_people_tracker");
-  PeopleTracker* t = new PeopleTracker();
-  return 0;
-}
@@ -0,0 +1,10 @@
+#include "people_tracker/people_tracker.h"
+
+int main(int argc, char **argv) {
+  ros::init(argc, argv, "bayes_people_tracker");
+  PeopleTracker t;
+  // the detector callbacks
+  thread_config::configure(ros::NodeHandle("~"), "spinner");
+  ros::spin();
+  return 0;
+}
@@ -0,0 +1,24 @@
+/* PeopleTracker as a nodelet: loaded into the manager of the detectors, their
+ * measurements arrive as the ConstPtr they published, without being
+ * serialized. Parameters are the same as for the node. */
+
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+
+#include "people_tracker/people_tracker.h"
+
+namespace bayes_people_tracker {
+
+class PeopleTrackerNodelet : public nodelet::Nodelet {
+private:
+  virtual void onInit() {
+    // the tracking thread is the tracker's own, the detector callbacks stay on the single-threaded queue
+    tracker_.reset(new ::PeopleTracker(getNodeHandle(), getPrivateNodeHandle()));
+  }
+  
+  boost::shared_ptr< ::PeopleTracker> tracker_; // not the message of this namespace
+};
+
+} // namespace bayes_people_tracker
+
+PLUGINLIB_EXPORT_CLASS(bayes_people_tracker::PeopleTrackerNodelet, nodelet::Nodelet)
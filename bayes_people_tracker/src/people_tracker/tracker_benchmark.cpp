@@ -0,0 +1,417 @@
+/* Offline benchmark of the filters and data associations behind the tracker,
+ * without a roscore: a MultiTracker is driven exactly as SimpleTracking does,
+ * one prediction, association and update per detection message, and every
+ * stage is timed on its own. The messages come from a synthetic crowd, with
+ * its ground truth for CLEAR MOT accuracy, or from people_msgs/PositionMeasurementArray
+ * topics of a bag, read as they are (record them in one fixed frame).
+ *   rosrun bayes_people_tracker tracker_benchmark --people=50 --clutter=10
+ *   rosrun bayes_people_tracker tracker_benchmark --bag=detections.bag --filter=UKF
+ *
+ * --filter=EKF|UKF|PF|IF|IMM|all  (all)
+ * --association=NN|NNJPDA|HUNGARIAN|AUCTION|all  (all)
+ * --people=20 --area=20 --clutter=5 --miss=0.1 --noise=0.1 --rate=10 --frames=1000 --seed=1
+ *   the synthetic crowd: people walking in an area x area square, mean clutter
+ *   detections per message, miss probability and detection noise in meters
+ * --standing=0                 fraction of the time a person stands still, in
+ *   stops of 5 s on average
+ * --bag=file [--topics=/a,/b]  replay instead, every PositionMeasurementArray topic by default
+ * --gate=1.0                   distance in meters matching a track with a person, for MOTA
+ * --threads=1 --parallel_min=32  MultiTracker::setParallel, 1 thread for the serial phases
+ * --floors=0                   0 to track on the plane, else in space (TrackingSpace, all
+ *   filters but IMM), the synthetic crowd on that many floors 3 m apart
+ */
+
+#include "people_tracker/flobot_tracking.h"
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <sys/time.h>
+
+/*** every allocation of the process, for the allocations of each stage ***/
+static std::atomic<unsigned long> allocations(0); // also those of the threads of --threads
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size);
+  if(p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+/* One detection message, with the people actually there if known. */
+struct Frame {
+  double time;
+  std::vector<double> x, y, z;                   // detections
+  std::vector<double> truth_x, truth_y, truth_z; // ground truth
+  std::vector<int> truth_ids;
+};
+
+struct Options {
+  std::string filter = "all";
+  std::string association = "all";
+  int people = 20;
+  double area = 20.0;
+  double clutter = 5.0;
+  double miss = 0.1;
+  double noise = 0.1;
+  double rate = 10.0;
+  int frames = 1000;
+  int seed = 1;
+  double standing = 0.0;
+  std::string bag;
+  std::string topics;
+  double gate = 1.0;
+  int threads = 1;
+  int parallelMin = 32;
+  int floors = 0;
+};
+
+static double now() {
+  timeval t;
+  gettimeofday(&t, NULL);
+  return (double)t.tv_sec + (double)t.tv_usec / 1e6;
+}
+
+/* Per-call durations and allocations of a stage. */
+struct StageStats {
+  std::vector<double> us;
+  unsigned long allocations = 0;
+
+  double percentile(double p) {
+    if(us.empty()) {
+      return 0.0;
+    }
+    size_t k = std::min(us.size() - 1, (size_t)(p * us.size()));
+    std::nth_element(us.begin(), us.begin() + k, us.end());
+    return us[k];
+  }
+};
+
+/* CLEAR MOT: a person stays matched with its track while they are within
+ * the gate, the others are matched greedily by distance. */
+struct MotAccuracy {
+  unsigned long truth = 0, misses = 0, false_positives = 0, switches = 0, matches = 0;
+  double distance = 0.0;
+  std::map<int, long> last; // track of every person, from their last match
+
+  void add(const Frame &frame, const std::vector<long> &ids, const std::vector<double> &x, const std::vector<double> &y,
+	   const std::vector<double> &z, double gate) {
+    size_t m = frame.truth_ids.size(), n = ids.size();
+    std::vector<bool> truth_matched(m, false), track_matched(n, false);
+    std::vector<std::pair<double, std::pair<size_t, size_t> > > pairs;
+    for(size_t t = 0; t < m; t++) {
+      std::map<int, long>::const_iterator it = last.find(frame.truth_ids[t]);
+      for(size_t h = 0; h < n; h++) {
+	double d = sqrt(sqr(frame.truth_x[t] - x[h]) + sqr(frame.truth_y[t] - y[h]) + sqr(frame.truth_z[t] - z[h]));
+	if(d > gate) {
+	  continue;
+	}
+	if(it != last.end() && it->second == ids[h] && !track_matched[h] && !truth_matched[t]) {
+	  match(t, h, d, truth_matched, track_matched);
+	} else {
+	  pairs.push_back(std::make_pair(d, std::make_pair(t, h)));
+	}
+      }
+    }
+    std::sort(pairs.begin(), pairs.end());
+    for(size_t k = 0; k < pairs.size(); k++) {
+      size_t t = pairs[k].second.first, h = pairs[k].second.second;
+      if(truth_matched[t] || track_matched[h]) {
+	continue;
+      }
+      std::map<int, long>::iterator it = last.find(frame.truth_ids[t]);
+      if(it != last.end() && it->second != ids[h]) {
+	switches++;
+      }
+      last[frame.truth_ids[t]] = ids[h];
+      match(t, h, pairs[k].first, truth_matched, track_matched);
+    }
+    truth += m;
+    misses += std::count(truth_matched.begin(), truth_matched.end(), false);
+    false_positives += std::count(track_matched.begin(), track_matched.end(), false);
+  }
+
+  void match(size_t t, size_t h, double d, std::vector<bool> &truth_matched, std::vector<bool> &track_matched) {
+    truth_matched[t] = track_matched[h] = true;
+    distance += d;
+    matches++;
+  }
+
+  double mota() const { return truth ? 1.0 - (double)(misses + false_positives + switches) / truth : 0.0; }
+  double motp() const { return matches ? distance / matches : 0.0; }
+};
+
+static void synthesize(const Options &o, std::vector<Frame> &frames) {
+  std::mt19937 rng(o.seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::normal_distribution<double> normal(0.0, 1.0);
+  std::poisson_distribution<int> clutter(std::max(o.clutter, 1e-9));
+  std::vector<double> px(o.people), py(o.people), pz(o.people, 0.0), heading(o.people), speed(o.people);
+  std::vector<bool> standing(o.people, false);
+  for(int i = 0; i < o.people; i++) {
+    px[i] = uniform(rng) * o.area;
+    py[i] = uniform(rng) * o.area;
+    heading[i] = uniform(rng) * 2.0 * M_PI;
+    speed[i] = 0.5 + uniform(rng);
+    if(o.floors > 1) {
+      pz[i] = 3.0 * (i % o.floors);
+    }
+  }
+  double dt = 1.0 / o.rate;
+  frames.resize(o.frames);
+  for(int f = 0; f < o.frames; f++) {
+    Frame &frame = frames[f];
+    frame.time = 1.0 + f * dt;
+    for(int i = 0; i < o.people; i++) {
+      if(o.standing > 0.0) { // stops of 5 s, o.standing of the time
+	double rate = standing[i] ? 0.2 : 0.2 * o.standing / std::max(1.0 - o.standing, 1e-9);
+	if(uniform(rng) < rate * dt) {
+	  standing[i] = !standing[i];
+	}
+      }
+      heading[i] += 0.1 * normal(rng);
+      if(!standing[i]) {
+	px[i] += speed[i] * cos(heading[i]) * dt;
+	py[i] += speed[i] * sin(heading[i]) * dt;
+      }
+      if(px[i] < 0.0 || px[i] > o.area) { // walk back into the area
+	heading[i] = M_PI - heading[i];
+	px[i] = std::min(std::max(px[i], 0.0), o.area);
+      }
+      if(py[i] < 0.0 || py[i] > o.area) {
+	heading[i] = -heading[i];
+	py[i] = std::min(std::max(py[i], 0.0), o.area);
+      }
+      frame.truth_x.push_back(px[i]);
+      frame.truth_y.push_back(py[i]);
+      frame.truth_z.push_back(pz[i]);
+      frame.truth_ids.push_back(i);
+      if(uniform(rng) >= o.miss) {
+	frame.x.push_back(px[i] + o.noise * normal(rng));
+	frame.y.push_back(py[i] + o.noise * normal(rng));
+	frame.z.push_back(o.floors ? pz[i] + o.noise * normal(rng) : 0.0);
+      }
+    }
+    for(int c = o.clutter > 0.0 ? clutter(rng) : 0; c > 0; c--) {
+      frame.x.push_back(uniform(rng) * o.area);
+      frame.y.push_back(uniform(rng) * o.area);
+      frame.z.push_back(o.floors ? 3.0 * (int)(uniform(rng) * o.floors) : 0.0);
+    }
+  }
+}
+
+static void replay(const Options &o, std::vector<Frame> &frames) {
+  std::vector<std::string> topics;
+  std::stringstream ss(o.topics);
+  for(std::string topic; std::getline(ss, topic, ',');) {
+    if(!topic.empty()) {
+      topics.push_back(topic);
+    }
+  }
+  rosbag::Bag bag(o.bag, rosbag::bagmode::Read);
+  rosbag::View view;
+  if(topics.empty()) {
+    view.addQuery(bag);
+  } else {
+    view.addQuery(bag, rosbag::TopicQuery(topics));
+  }
+  for(rosbag::View::iterator it = view.begin(); it != view.end(); ++it) {
+    people_msgs::PositionMeasurementArray::ConstPtr pma = it->instantiate<people_msgs::PositionMeasurementArray>();
+    if(!pma) {
+      continue;
+    }
+    Frame frame;
+    frame.time = pma->header.stamp.isZero() ? it->getTime().toSec() : pma->header.stamp.toSec();
+    for(size_t i = 0; i < pma->people.size(); i++) {
+      frame.x.push_back(pma->people[i].pos.x);
+      frame.y.push_back(pma->people[i].pos.y);
+      frame.z.push_back(pma->people[i].pos.z);
+    }
+    frames.push_back(frame);
+  }
+  bag.close();
+}
+
+/* by association_t */
+static const char *ASSOCIATIONS[] = {"NN", "NNJPDA", "HUNGARIAN", "AUCTION"};
+
+template<typename FilterType, class SpaceType>
+static void run(const char *filter, association_t alg, const Options &o, const std::vector<Frame> &frames, bool truth) {
+  typedef typename SpaceType::PredictionModel PredictionModel;
+  MultiTracker<FilterType, SpaceType::x_size> mtrk;
+  if(o.threads != 1) {
+    mtrk.setParallel(o.threads, o.parallelMin);
+  }
+  std::unique_ptr<PredictionModel> pm(SpaceType::predictionModel(1.4, 1.4, 1.4));
+  std::unique_ptr<typename SpaceType::ObservationModel> om(SpaceType::observationModel(o.noise, o.noise, o.noise));
+  PredictionModel &cvm = *pm;
+  typename SpaceType::ObservationModel &ctm = *om;
+  FM::Vec z(SpaceType::z_size);
+  StageStats predict, associate, update;
+  MotAccuracy accuracy;
+  std::vector<long> ids;
+  std::vector<double> x, y, h;
+  unsigned long tracks = 0;
+
+  double time = frames[0].time;
+  for(size_t f = 0; f < frames.size(); f++) {
+    const Frame &frame = frames[f];
+    double dt = frame.time - time;
+    time = frame.time;
+
+    unsigned long a0 = allocations;
+    double t0 = now();
+    cvm.update(dt);
+    mtrk.template predict<PredictionModel>(cvm);
+    double t1 = now();
+    unsigned long a1 = allocations;
+    for(size_t i = 0; i < frame.x.size(); i++) {
+      z[0] = frame.x[i];
+      z[1] = frame.y[i];
+      if(SpaceType::z_size == 3) {
+	z[2] = frame.z[i];
+      }
+      mtrk.addObservation(z, time);
+    }
+    unsigned long a2 = allocations;
+    double t2 = now();
+    bool associated = mtrk.associate(ctm, alg);
+    double t3 = now();
+    unsigned long a3 = allocations;
+    mtrk.update(ctm, associated, CARTESIAN, 4, 0.3, 1.0);
+    refreshStates(mtrk);
+    double t4 = now();
+    unsigned long a4 = allocations;
+
+    predict.us.push_back((t1 - t0) * 1e6);
+    associate.us.push_back((t3 - t2) * 1e6);
+    update.us.push_back((t4 - t3) * 1e6);
+    predict.allocations += a1 - a0;
+    associate.allocations += a3 - a2;
+    update.allocations += a4 - a3;
+    tracks += mtrk.size();
+
+    if(truth) {
+      ids.resize(mtrk.size());
+      x.resize(mtrk.size());
+      y.resize(mtrk.size());
+      h.resize(mtrk.size());
+      for(int i = 0; i < mtrk.size(); i++) {
+	ids[i] = mtrk[i].id;
+	x[i] = mtrk[i].filter->x[0];
+	y[i] = mtrk[i].filter->x[2];
+	h[i] = SpaceType::x_size == 6 ? mtrk[i].filter->x[4] : 0.0;
+      }
+      accuracy.add(frame, ids, x, y, h, o.gate);
+    }
+  }
+
+  double n = frames.size();
+  printf("%-4s %-9s %7.1f | %8.1f %8.1f %6.0f | %8.1f %8.1f %6.0f | %8.1f %8.1f %6.0f",
+	 filter, ASSOCIATIONS[alg], tracks / n,
+	 predict.percentile(0.5), predict.percentile(0.99), predict.allocations / n,
+	 associate.percentile(0.5), associate.percentile(0.99), associate.allocations / n,
+	 update.percentile(0.5), update.percentile(0.99), update.allocations / n);
+  if(truth) {
+    printf(" | %6.3f %5.3f %6lu", accuracy.mota(), accuracy.motp(), accuracy.switches);
+  }
+  printf("\n");
+}
+
+static bool option(const char *arg, const char *name, std::string &value) {
+  size_t n = strlen(name);
+  if(strncmp(arg, name, n) != 0 || arg[n] != '=') {
+    return false;
+  }
+  value = arg + n + 1;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  Options o;
+  for(int i = 1; i < argc; i++) {
+    std::string v;
+    if(option(argv[i], "--filter", v)) o.filter = v;
+    else if(option(argv[i], "--association", v)) o.association = v;
+    else if(option(argv[i], "--people", v)) o.people = atoi(v.c_str());
+    else if(option(argv[i], "--area", v)) o.area = atof(v.c_str());
+    else if(option(argv[i], "--clutter", v)) o.clutter = atof(v.c_str());
+    else if(option(argv[i], "--miss", v)) o.miss = atof(v.c_str());
+    else if(option(argv[i], "--noise", v)) o.noise = atof(v.c_str());
+    else if(option(argv[i], "--rate", v)) o.rate = atof(v.c_str());
+    else if(option(argv[i], "--frames", v)) o.frames = atoi(v.c_str());
+    else if(option(argv[i], "--seed", v)) o.seed = atoi(v.c_str());
+    else if(option(argv[i], "--standing", v)) o.standing = atof(v.c_str());
+    else if(option(argv[i], "--bag", v)) o.bag = v;
+    else if(option(argv[i], "--topics", v)) o.topics = v;
+    else if(option(argv[i], "--gate", v)) o.gate = atof(v.c_str());
+    else if(option(argv[i], "--threads", v)) o.threads = atoi(v.c_str());
+    else if(option(argv[i], "--parallel_min", v)) o.parallelMin = atoi(v.c_str());
+    else if(option(argv[i], "--floors", v)) o.floors = atoi(v.c_str());
+    else {
+      fprintf(stderr, "unknown option %s, c.f. the head of tracker_benchmark.cpp\n", argv[i]);
+      return 1;
+    }
+  }
+
+  std::vector<Frame> frames;
+  bool truth = o.bag.empty();
+  if(truth) {
+    synthesize(o, frames);
+  } else {
+    replay(o, frames);
+  }
+  if(frames.empty()) {
+    fprintf(stderr, "no detections to track\n");
+    return 1;
+  }
+
+  printf("[tracker_benchmark] %zu messages%s%s\n", frames.size(), truth ? ", synthetic crowd" : "", o.floors ? ", in space" : "");
+  printf("%-4s %-9s %7s | %8s %8s %6s | %8s %8s %6s | %8s %8s %6s", "", "", "tracks",
+	 "pred p50", "p99 us", "allocs", "asso p50", "p99 us", "allocs", "upd p50", "p99 us", "allocs");
+  if(truth) {
+    printf(" | %6s %5s %6s", "MOTA", "MOTP", "IDSW");
+  }
+  printf("\n");
+  for(int a = NN; a <= AUCTION; a++) {
+    association_t alg = (association_t)a;
+    if(o.association != "all" && o.association != ASSOCIATIONS[alg]) {
+      continue;
+    }
+    if(o.filter == "all" || o.filter == "EKF") {
+      o.floors ? run<EKFilter, TrackingSpace>("EKF", alg, o, frames, truth) : run<EKFilter, TrackingPlane>("EKF", alg, o, frames, truth);
+    }
+    if(o.filter == "all" || o.filter == "UKF") {
+      o.floors ? run<UKFilter, TrackingSpace>("UKF", alg, o, frames, truth) : run<UKFilter, TrackingPlane>("UKF", alg, o, frames, truth);
+    }
+    if(o.filter == "all" || o.filter == "PF") {
+      o.floors ? run<PFilter, TrackingSpace>("PF", alg, o, frames, truth) : run<PFilter, TrackingPlane>("PF", alg, o, frames, truth);
+    }
+    if(o.filter == "all" || o.filter == "IF") {
+      o.floors ? run<IFilter, TrackingSpace>("IF", alg, o, frames, truth) : run<IFilter, TrackingPlane>("IF", alg, o, frames, truth);
+    }
+    if((o.filter == "all" || o.filter == "IMM") && !o.floors) { // on the plane only
+      run<IMMFilter, TrackingPlane>("IMM", alg, o, frames, truth);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,82 @@
+/* Offline converter of a binary trajectory log (log_trajectories) to text.
+ * The file is memory-mapped and walked record by record, c.f.
+ * trajectory_logger.h for the format. Prints one line per trajectory,
+ *   trajectory: x0 y0 x1 y1 ...
+ * as the tracker used to log them, or with --csv one line per pose,
+ *   id,stamp,index,x,y
+ * Usage: trajectory_convert [--csv] trajectories.bin > trajectories.txt
+ */
+
+#include "people_tracker/trajectory_logger.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+int main(int argc, char **argv) {
+  bool csv = argc == 3 && strcmp(argv[1], "--csv") == 0;
+  if(argc != 2 && !csv) {
+    fprintf(stderr, "usage: %s [--csv] <trajectory log>\n", argv[0]);
+    return 1;
+  }
+  const char *file_name = argv[argc - 1];
+  int fd = open(file_name, O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TrajectoryFileHeader)) {
+    fprintf(stderr, "can not read '%s'\n", file_name);
+    return 1;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) {
+    fprintf(stderr, "can not map '%s'\n", file_name);
+    return 1;
+  }
+
+  const char *base = static_cast<const char *>(data), *end = base + st.st_size;
+  TrajectoryFileHeader header;
+  memcpy(&header, base, sizeof(header));
+  if(memcmp(header.magic, TRAJECTORY_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRAJECTORY_FILE_VERSION) {
+    fprintf(stderr, "'%s' is not a trajectory log of this version\n", file_name);
+    munmap(data, st.st_size);
+    return 1;
+  }
+  if(csv) {
+    printf("id,stamp,index,x,y\n");
+  }
+
+  unsigned long trajectories = 0;
+  const char *p = base + sizeof(header);
+  while((size_t)(end - p) >= sizeof(TrajectoryRecord)) {
+    TrajectoryRecord record;
+    memcpy(&record, p, sizeof(record));
+    size_t bytes = 2 * sizeof(double) * record.poses;
+    p += sizeof(record);
+    if((size_t)(end - p) < bytes) {
+      break; // cut short while the tracker was writing it
+    }
+    if(!csv) {
+      printf("trajectory: ");
+    }
+    for(uint32_t k = 0; k < record.poses; k++, p += 2 * sizeof(double)) {
+      double xy[2];
+      memcpy(xy, p, sizeof(xy));
+      if(csv) {
+	printf("%lld,%.9f,%u,%g,%g\n", (long long)record.id, record.stamp, k, xy[0], xy[1]);
+      } else {
+	printf("%g %g ", xy[0], xy[1]);
+      }
+    }
+    if(!csv) {
+      printf("\n");
+    }
+    trajectories++;
+  }
+  if(p != end) {
+    fprintf(stderr, "'%s' ends with an incomplete trajectory, ignored\n", file_name);
+  }
+  fprintf(stderr, "%lu trajectories\n", trajectories);
+  munmap(data, st.st_size);
+  return 0;
+}
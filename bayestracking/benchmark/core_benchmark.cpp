@@ -0,0 +1,460 @@
+/* Microbenchmarks of the library, with Google Benchmark: the predict and
+ * observe steps of the filters, the data associations and the
+ * factorisations behind them, over state sizes, track counts and problem
+ * sizes, each case fixed by its seed so that two builds time the same work.
+ *   cmake -DBAYESTRACKING_BUILD_BENCHMARK=ON .. && make bayes_tracking_benchmark
+ *   ./bayes_tracking_benchmark --benchmark_filter='UKFilter' --benchmark_repetitions=5
+ *   ./bayes_tracking_benchmark --benchmark_format=json > baseline.json
+ * compare two json outputs with tools/compare.py of Google Benchmark.
+ *
+ * Filters (per track, items/s, tracks of 4 or 6 elements):
+ *   Predict/<Filter>/<Plane|Space>/tracks[/samples]
+ *   Observe/<Filter>/<Plane|Space>/tracks[/samples]  the tracks predicted beforehand
+ * Association (M observations for N tracks on a plane, 20 % of them clutter):
+ *   Mahalanobis, CorrelationLog, Mahalanobis2Factored/<z size>
+ *   ComputeNN, ComputeHungarian, ComputeAuction/N
+ *   JPDA/N  gating, clustered probabilities and NNJPDA
+ * Factorisations of SPD matrices:
+ *   UdUfactor, UCfactor, UdUinversePD/<size>
+ *   UdUfactorBatch, UCfactorBatch, UCinverseBatch/<size>/<matrices>  per matrix
+ *     (items/s), the batch copied from the same matrices at every iteration
+ */
+
+#include "bayes_tracking/associationmatrix.h"
+#include "bayes_tracking/jpda.h"
+#include "bayes_tracking/models.h"
+#include "bayes_tracking/ekfilter.h"
+#include "bayes_tracking/ukfilter.h"
+#include "bayes_tracking/pfilter.h"
+#include "bayes_tracking/BayesFilter/matSup.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cfloat>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace Bayesian_filter;
+using namespace Bayesian_filter_matrix;
+
+/*** the tracks: the same person walking, in the plane or in space ***/
+
+/* People on the ground, [x, v_x, y, v_y] observed at [x, y]. */
+struct Plane {
+  typedef Models::CVModel PredictModel;
+  typedef Models::CartesianModel ObserveModel;
+  static const size_t x_size = 4, z_size = 2;
+  static PredictModel *predictModel() { return new Models::CVModel(1.4, 1.4); }
+  static ObserveModel *observeModel() { return new Models::CartesianModel(0.1, 0.1); }
+};
+
+/* Objects in space, [x, v_x, y, v_y, z, v_z] observed at [x, y, z]. */
+struct Space {
+  typedef Models::CVModel3D PredictModel;
+  typedef Models::CartesianModel3D ObserveModel;
+  static const size_t x_size = 6, z_size = 3;
+  static PredictModel *predictModel() { return new Models::CVModel3D(1.4, 1.4, 0.1); }
+  static ObserveModel *observeModel() { return new Models::CartesianModel3D(0.1, 0.1, 0.1); }
+};
+
+/* A filter of a track, of as many samples as the second argument for a PFilter. */
+template<class FilterType>
+static FilterType *newFilter(size_t x_size, const benchmark::State &) {
+  return new FilterType(x_size);
+}
+
+template<>
+PFilter *newFilter<PFilter>(size_t x_size, const benchmark::State &state) {
+  PFilter *filter = new PFilter(x_size, state.range(1));
+  filter->seed(1, 0);
+  return filter;
+}
+
+/* The tracks of a benchmark, starting again from their first state every
+ * so many steps, outside of the timing, so the covariances stay those of a
+ * tracker. */
+template<class FilterType, class Space>
+struct Tracks {
+  static const int STEPS = 32;
+  std::vector<FilterType *> filters;
+  typename Space::PredictModel *pm;
+  typename Space::ObserveModel *om;
+  FM::Vec x0, z;
+  FM::SymMatrix X0;
+  std::mt19937 rng;
+  std::normal_distribution<double> noise;
+  int steps;
+
+  Tracks(const benchmark::State &state) : x0(Space::x_size), z(Space::z_size), X0(Space::x_size, Space::x_size), rng(1), noise(0.0, 0.1), steps(0) {
+    pm = Space::predictModel();
+    om = Space::observeModel();
+    pm->update(0.1);
+    pm->seed(1, 0);
+    X0.clear();
+    for(size_t i = 0; i < Space::x_size; i += 2) {
+      x0[i] = 0.0;
+      x0[i + 1] = 1.0;
+      X0(i, i) = 0.2 * 0.2;
+      X0(i + 1, i + 1) = 1.0;
+    }
+    for(int t = 0; t < state.range(0); t++) {
+      filters.push_back(newFilter<FilterType>(Space::x_size, state));
+    }
+    restart();
+  }
+
+  ~Tracks() {
+    for(size_t t = 0; t < filters.size(); t++) {
+      delete filters[t];
+    }
+    delete pm;
+    delete om;
+  }
+
+  void restart() {
+    for(size_t t = 0; t < filters.size(); t++) {
+      filters[t]->init(x0, X0);
+    }
+    steps = 0;
+  }
+
+  /* True every STEPS steps, to restart() */
+  bool due() {
+    return ++steps >= STEPS;
+  }
+
+  void predict() {
+    for(size_t t = 0; t < filters.size(); t++) {
+      filters[t]->predict(*pm);
+    }
+  }
+
+  /* An observation of every track, around the position it predicts. */
+  void observe() {
+    for(size_t t = 0; t < filters.size(); t++) {
+      for(size_t k = 0; k < Space::z_size; k++) {
+	z[k] = filters[t]->x[2 * k] + noise(rng);
+      }
+      filters[t]->observe(*om, z);
+    }
+  }
+};
+
+/* A numeric failure of a step restarts the tracks, as for a lost track. */
+template<class FilterType, class Space>
+static void Predict(benchmark::State &state) {
+  Tracks<FilterType, Space> tracks(state);
+  for(auto _ : state) {
+    try {
+      tracks.predict();
+    }
+    catch(const Numeric_exception &) {
+      tracks.steps = tracks.STEPS;
+    }
+    if(tracks.due()) {
+      state.PauseTiming();
+      tracks.restart();
+      state.ResumeTiming();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * tracks.filters.size());
+}
+
+template<class FilterType, class Space>
+static void Observe(benchmark::State &state) {
+  Tracks<FilterType, Space> tracks(state);
+  for(auto _ : state) {
+    state.PauseTiming();
+    if(tracks.due()) {
+      tracks.restart();
+    }
+    try {
+      tracks.predict();
+    }
+    catch(const Numeric_exception &) {
+      tracks.restart();
+    }
+    state.ResumeTiming();
+    try {
+      tracks.observe();
+    }
+    catch(const Numeric_exception &) {
+      tracks.steps = tracks.STEPS;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * tracks.filters.size());
+}
+
+#define FILTER_BENCHMARKS(FilterType, Space)				\
+  BENCHMARK_TEMPLATE(Predict, FilterType, Space)->Name("Predict/" #FilterType "/" #Space)->ArgName("tracks")->Arg(16)->Arg(256); \
+  BENCHMARK_TEMPLATE(Observe, FilterType, Space)->Name("Observe/" #FilterType "/" #Space)->ArgName("tracks")->Arg(16)->Arg(256)
+
+#define PARTICLE_BENCHMARKS(Space)					\
+  BENCHMARK_TEMPLATE(Predict, PFilter, Space)->Name("Predict/PFilter/" #Space)->ArgNames({"tracks", "samples"})->Args({16, 250})->Args({16, 1000}); \
+  BENCHMARK_TEMPLATE(Observe, PFilter, Space)->Name("Observe/PFilter/" #Space)->ArgNames({"tracks", "samples"})->Args({16, 250})->Args({16, 1000})
+
+FILTER_BENCHMARKS(EKFilter, Plane);
+FILTER_BENCHMARKS(EKFilter, Space);
+FILTER_BENCHMARKS(UKFilter, Plane);
+FILTER_BENCHMARKS(UKFilter, Space);
+PARTICLE_BENCHMARKS(Plane);
+PARTICLE_BENCHMARKS(Space);
+
+/*** the measures of the association ***/
+
+/* Innovations of size n and their covariance, an SPD matrix. */
+struct Innovations {
+  static const size_t COUNT = 256;
+  std::vector<FM::Vec> s;
+  FM::SymMatrix S;
+
+  Innovations(size_t n) : S(n, n) {
+    std::mt19937 rng(1);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    for(size_t k = 0; k < COUNT; k++) {
+      s.push_back(FM::Vec(n));
+      for(size_t i = 0; i < n; i++) {
+	s.back()[i] = normal(rng);
+      }
+    }
+    for(size_t i = 0; i < n; i++) {
+      for(size_t j = i; j < n; j++) {
+	S(i, j) = i == j ? 1.0 + 0.1 * i : 0.1;
+      }
+    }
+  }
+};
+
+static void Mahalanobis(benchmark::State &state) {
+  Innovations v(state.range(0));
+  size_t k = 0;
+  for(auto _ : state) {
+    benchmark::DoNotOptimize(AM::mahalanobis(v.s[k++ % v.COUNT], v.S));
+  }
+}
+BENCHMARK(Mahalanobis)->ArgName("z")->DenseRange(1, 3);
+
+static void CorrelationLog(benchmark::State &state) {
+  Innovations v(state.range(0));
+  size_t k = 0;
+  for(auto _ : state) {
+    benchmark::DoNotOptimize(AM::correlation_log(v.s[k++ % v.COUNT], v.S));
+  }
+}
+BENCHMARK(CorrelationLog)->ArgName("z")->DenseRange(1, 3);
+
+/* The innovations of a track with all the observations, S factorised once. */
+static void Mahalanobis2Factored(benchmark::State &state) {
+  Innovations v(state.range(0));
+  AssociationMatrix amat;
+  amat.setInnovationCovariance(v.S);
+  size_t k = 0;
+  for(auto _ : state) {
+    benchmark::DoNotOptimize(amat.mahalanobis2(v.s[k++ % v.COUNT]));
+  }
+}
+BENCHMARK(Mahalanobis2Factored)->ArgName("z")->DenseRange(1, 3);
+
+/* N people in a square of 1 person per 4 m^2, each detected once with noise,
+ * and N/4 clutter detections: the squared distances of their gates. */
+struct Crowd {
+  size_t M, N;
+  std::vector<double> d2;               // M x N, DBL_MAX out of the gate
+  std::vector<double> logDetS;          // of every track
+
+  Crowd(size_t N) : M(N + N / 4), N(N), d2(M * N, DBL_MAX), logDetS(N) {
+    std::mt19937 rng(1);
+    const double side = 2.0 * std::sqrt((double)N);
+    std::uniform_real_distribution<double> area(0.0, side);
+    std::normal_distribution<double> noise(0.0, 0.1);
+    std::vector<double> tx(N), ty(N), zx(M), zy(M);
+    for(size_t j = 0; j < N; j++) {
+      tx[j] = area(rng);
+      ty[j] = area(rng);
+      zx[j] = tx[j] + noise(rng);
+      zy[j] = ty[j] + noise(rng);
+    }
+    for(size_t i = N; i < M; i++) {
+      zx[i] = area(rng);
+      zy[i] = area(rng);
+    }
+    const double var = 0.3 * 0.3, gate = AM::gate(2);
+    for(size_t j = 0; j < N; j++) {
+      logDetS[j] = 2.0 * std::log(var);
+      for(size_t i = 0; i < M; i++) {
+	double d = ((zx[i] - tx[j]) * (zx[i] - tx[j]) + (zy[i] - ty[j]) * (zy[i] - ty[j])) / var;
+	if(d <= gate * gate) {
+	  d2[i * N + j] = d;
+	}
+      }
+    }
+  }
+
+  /* The association matrix of MultiTracker, correlation_log. */
+  void fill(AssociationMatrix &amat) const {
+    amat.setSize(M, N);
+    for(size_t i = 0; i < M; i++) {
+      for(size_t j = 0; j < N; j++) {
+	const double d = d2[i * N + j];
+	amat[i][j] = d == DBL_MAX ? DBL_MAX : d + logDetS[j];
+      }
+    }
+  }
+};
+
+static void ComputeNN(benchmark::State &state) {
+  Crowd crowd(state.range(0));
+  AssociationMatrix amat;
+  for(auto _ : state) {
+    crowd.fill(amat);
+    amat.computeNN(CORRELATION_LOG);
+    benchmark::DoNotOptimize(amat.NN.size());
+  }
+}
+BENCHMARK(ComputeNN)->ArgName("tracks")->Arg(10)->Arg(50)->Arg(200);
+
+static void ComputeHungarian(benchmark::State &state) {
+  Crowd crowd(state.range(0));
+  AssociationMatrix amat;
+  for(auto _ : state) {
+    crowd.fill(amat);
+    amat.computeHungarian(CORRELATION_LOG);
+    benchmark::DoNotOptimize(amat.NN.size());
+  }
+}
+BENCHMARK(ComputeHungarian)->ArgName("tracks")->Arg(10)->Arg(50)->Arg(200);
+
+static void ComputeAuction(benchmark::State &state) {
+  Crowd crowd(state.range(0));
+  AssociationMatrix amat;
+  for(auto _ : state) {
+    crowd.fill(amat);
+    amat.computeAuction(CORRELATION_LOG);
+    benchmark::DoNotOptimize(amat.NN.size());
+  }
+}
+BENCHMARK(ComputeAuction)->ArgName("tracks")->Arg(10)->Arg(50)->Arg(200);
+
+/* The NNJPDA of MultiTracker, one sensor. */
+static void JPDA(benchmark::State &state) {
+  Crowd crowd(state.range(0));
+  std::vector<size_t> znum(1, crowd.M);
+  jpda::JPDA jpda(znum, crowd.N);
+  std::vector<jpda::Association> associations;
+  for(auto _ : state) {
+    jpda.init(znum, crowd.N);
+    for(size_t i = 0; i < crowd.M; i++) {
+      for(size_t j = 0; j < crowd.N; j++) {
+	const double d = crowd.d2[i * crowd.N + j];
+	if(d != DBL_MAX) {
+	  jpda.addPair(0, i, j + 1, -0.5 * (d + crowd.logDetS[j] + 2.0 * std::log(2 * M_PI)));
+	}
+      }
+    }
+    jpda.getClusteredProbabilities();
+    associations.resize(1);
+    associations[0].clear();
+    jpda.getMultiNNJPDA(associations);
+    benchmark::DoNotOptimize(associations[0].size());
+  }
+}
+BENCHMARK(JPDA)->ArgName("tracks")->Arg(5)->Arg(20)->Arg(50);
+
+/*** the factorisations of the filters ***/
+
+/* An SPD matrix of size n, as the covariances of the filters. */
+static FM::SymMatrix spd(size_t n) {
+  FM::SymMatrix M(n, n);
+  for(size_t i = 0; i < n; i++) {
+    for(size_t j = i; j < n; j++) {
+      M(i, j) = i == j ? 1.0 + i : 0.5 / (1.0 + j - i);
+    }
+  }
+  return M;
+}
+
+static void UdUfactor(benchmark::State &state) {
+  const size_t n = state.range(0);
+  const FM::SymMatrix M = spd(n);
+  FM::RowMatrix UD(n, n);
+  for(auto _ : state) {
+    benchmark::DoNotOptimize(FM::UdUfactor(UD, M));
+  }
+}
+BENCHMARK(UdUfactor)->ArgName("n")->Arg(2)->Arg(4)->Arg(6)->Arg(8);
+
+static void UCfactor(benchmark::State &state) {
+  const size_t n = state.range(0);
+  const FM::SymMatrix M = spd(n);
+  FM::UTriMatrix UC(n, n);
+  for(auto _ : state) {
+    benchmark::DoNotOptimize(FM::UCfactor(UC, M));
+  }
+}
+BENCHMARK(UCfactor)->ArgName("n")->Arg(2)->Arg(4)->Arg(6)->Arg(8);
+
+static void UdUinversePD(benchmark::State &state) {
+  const size_t n = state.range(0);
+  const FM::SymMatrix M = spd(n);
+  FM::SymMatrix MI(n, n);
+  for(auto _ : state) {
+    benchmark::DoNotOptimize(FM::UdUinversePD(MI, M));
+  }
+}
+BENCHMARK(UdUinversePD)->ArgName("n")->Arg(2)->Arg(4)->Arg(6)->Arg(8);
+
+/* The batch of a batched factorisation, copies of spd(n) element by element. */
+static std::vector<double> spdBatch(size_t n, size_t B) {
+  const FM::SymMatrix M = spd(n);
+  std::vector<double> S(n * n * B);
+  for(size_t i = 0; i < n; i++) {
+    for(size_t j = 0; j < n; j++) {
+      std::fill(S.begin() + (i * n + j) * B, S.begin() + (i * n + j + 1) * B, M(i, j));
+    }
+  }
+  return S;
+}
+
+static void UdUfactorBatch(benchmark::State &state) {
+  const size_t n = state.range(0), B = state.range(1);
+  const std::vector<double> S = spdBatch(n, B);
+  std::vector<double> UD(S.size()), rcond(B);
+  for(auto _ : state) {
+    std::copy(S.begin(), S.end(), UD.begin());
+    FM::UdUfactor_batch(&UD[0], n, B, &rcond[0]);
+    benchmark::DoNotOptimize(rcond[0]);
+  }
+  state.SetItemsProcessed(state.iterations() * B);
+}
+BENCHMARK(UdUfactorBatch)->ArgNames({"n", "matrices"})->ArgsProduct({{2, 4, 6}, {16, 256}});
+
+static void UCfactorBatch(benchmark::State &state) {
+  const size_t n = state.range(0), B = state.range(1);
+  const std::vector<double> S = spdBatch(n, B);
+  std::vector<double> UC(S.size()), rcond(B);
+  for(auto _ : state) {
+    std::copy(S.begin(), S.end(), UC.begin());
+    FM::UCfactor_batch(&UC[0], n, B, &rcond[0]);
+    benchmark::DoNotOptimize(rcond[0]);
+  }
+  state.SetItemsProcessed(state.iterations() * B);
+}
+BENCHMARK(UCfactorBatch)->ArgNames({"n", "matrices"})->ArgsProduct({{2, 4, 6}, {16, 256}});
+
+/* The factorisation of the innovation covariances in MultiTracker gating. */
+static void UCinverseBatch(benchmark::State &state) {
+  const size_t n = state.range(0), B = state.range(1);
+  const std::vector<double> S = spdBatch(n, B);
+  std::vector<double> UC(S.size()), rcond(B);
+  for(auto _ : state) {
+    std::copy(S.begin(), S.end(), UC.begin());
+    FM::UCfactor_batch(&UC[0], n, B, &rcond[0]);
+    FM::UTinverse_batch(&UC[0], n, B);
+    benchmark::DoNotOptimize(UC[0]);
+  }
+  state.SetItemsProcessed(state.iterations() * B);
+}
+BENCHMARK(UCinverseBatch)->ArgNames({"n", "matrices"})->ArgsProduct({{2, 4, 6}, {16, 256}});
+
+BENCHMARK_MAIN();
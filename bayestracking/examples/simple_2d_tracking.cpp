@@ -77,7 +77,8 @@ bool MTRK::initialize(FilterType* &filter, sequence_t& obsvSeq, observ_model_t o
     X(2,2) = sqr(0.5);
     X(3,3) = sqr(1.5);
     
-    filter = new FilterType(4);
+    if (filter == NULL) // else the filter of a lost track
+      filter = new FilterType(4);
     filter->init(x, X);
   }
   
@@ -102,7 +103,8 @@ bool MTRK::initialize(FilterType* &filter, sequence_t& obsvSeq, observ_model_t o
     X(2,2) = sqr(0.5);
     X(3,3) = sqr(1.5);
     
-    filter = new FilterType(4);
+    if (filter == NULL) // else the filter of a lost track
+      filter = new FilterType(4);
     filter->init(x, X);
   }
   return true;
@@ -111,6 +113,7 @@ bool MTRK::initialize(FilterType* &filter, sequence_t& obsvSeq, observ_model_t o
 // command line option
 bool textDebug = false;
 bool winDebug = false;
+bool winAsync = false;
 bool sendPredictions = false;
 
 int main(int argc, char *argv[]) {
@@ -126,8 +129,12 @@ int main(int argc, char *argv[]) {
       winDebug = true;
       continue;
     }
+    if (strcmp(argv[c], "-a") == 0 ) {
+      winDebug = winAsync = true;
+      continue;
+    }
     cerr << "Unknown option " << argv[c] << endl;
-    cerr << "Valid options are '-g' (text debug) and '-w' (visual debug)" << endl;
+    cerr << "Valid options are '-g' (text debug), '-w' (visual debug) and '-a' (visual debug on its own thread)" << endl;
     exit(EXIT_FAILURE);
   }
   
@@ -142,7 +149,7 @@ int main(int argc, char *argv[]) {
   
   TrackWin* trkwin = 0;
   if (winDebug) {
-    trkwin = new TrackWin(__FILE__, 800, 600, 30.);
+    trkwin = new TrackWin(__FILE__, 800, 600, 30., winAsync);
     trkwin->setOrigin(0., 0., 0.);
     trkwin->create();
   }
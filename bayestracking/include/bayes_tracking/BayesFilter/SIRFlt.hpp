@@ -25,6 +25,8 @@
  *   systematic_resample: A Simple stratified resampler from [2]
  *  A virtual 'weighted_resample' provides an standard interface to these and defaults
  *  to the standard_resample.
+ *  Both resample to any number of samples, so the sample size S.size2() may
+ *  change at every resampling, c.f. SIR_scheme::resample_size
  *
  * NOTES:
  *  SIR algorithm is sensitive to random generator
@@ -85,20 +87,32 @@ public:
 	 * Preconditions
 	 *  wresample,w must have same size
 	 */
+
+	virtual Float resample (Resamples_t& presamples, std::size_t& uresamples, FM::DenseVec& w, SIR_random& r, std::size_t nResamples) const;
+	/*
+	 * The resampling function to nResamples samples in total, the sum of presamples
+	 *  Default: only nResamples == w.size(), Logic_exception otherwise
+	 */
 };
 
 class Standard_resampler : public Importance_resampler
 // Standard resample algorithm from [1]
 {
 public:
-	Float resample (Resamples_t& presamples, std::size_t& uresamples, FM::DenseVec& w, SIR_random& r) const;
+	Float resample (Resamples_t& presamples, std::size_t& uresamples, FM::DenseVec& w, SIR_random& r) const
+	{	return resample (presamples, uresamples, w, r, w.size());
+	}
+	Float resample (Resamples_t& presamples, std::size_t& uresamples, FM::DenseVec& w, SIR_random& r, std::size_t nResamples) const;
 };
 
 class Systematic_resampler : public Importance_resampler
 // Systematic resample algorithm from [2]
 {
 public:
-	Float resample (Resamples_t& presamples, std::size_t& uresamples, FM::DenseVec& w, SIR_random& r) const;
+	Float resample (Resamples_t& presamples, std::size_t& uresamples, FM::DenseVec& w, SIR_random& r) const
+	{	return resample (presamples, uresamples, w, r, w.size());
+	}
+	Float resample (Resamples_t& presamples, std::size_t& uresamples, FM::DenseVec& w, SIR_random& r, std::size_t nResamples) const;
 };
 
 
@@ -198,6 +212,16 @@ public:
 	 *  Return: lcond
 	 */
 
+	Float resampleThreshold;	// Resample only while the effective sample size of the weights is below this fraction of the samples (1 always resamples)
+	// Otherwise the weights are normalised and kept, and fused with the next observation
+
+	virtual std::size_t resample_size ()
+	/* Number of samples after the resampling, S.size2() by default
+	 *  An adaptive size changes S, the resampler must support it
+	 */
+	{	return S.size2();
+	}
+
 	void predict (Functional_predict_model& f)
 	// Predict samples without noise
 	{	Sample_filter::predict (f);
@@ -221,6 +245,8 @@ public:
 
 	static void copy_resamples (FM::ColMatrix& P, const Importance_resampler::Resamples_t& presamples);
 	// Update P by selectively copying based on presamples 
+	static void gather_resamples (FM::ColMatrix& P, FM::ColMatrix& buffer, const Importance_resampler::Resamples_t& presamples);
+	// As copy_resamples, gathering into buffer which is then swapped with P, to the sum of presamples
 
 	SIR_random& random;			// Reference random number generator helper
 
@@ -229,6 +255,7 @@ protected:
 	Importance_resampler::Resamples_t resamples;		// resampling counts
 	FM::DenseVec wir;			// resamping weights
 	bool wir_update;			// weights have been updated requring a resampling on update
+	FM::ColMatrix resampled;	// gathered resamples, swapped with S
 private:
 	static const Float rougheningKinit;
 	std::size_t x_size;
@@ -263,7 +290,7 @@ public:
 	// Modified SIR_filter update implementation: update mean and covariance of sampled distribution
 
 	void update_statistics ();
-	// Update Kalman statistics without resampling
+	// Update Kalman statistics without resampling, weighted by wir while they are kept
 
 	void roughen()
 	{	// Specialised correlated roughening
@@ -277,6 +304,7 @@ protected:
 private:
 	static Float scaled_vector_square(const FM::Vec& v, const FM::SymMatrix& S);
 	void mean();
+	Float sum_weights() const;
 };
 
 
@@ -0,0 +1,396 @@
+#ifndef _BAYES_FILTER_FIXED_MATRIX
+#define _BAYES_FILTER_FIXED_MATRIX
+
+/*
+ * Fixed size matrix support for filter classes
+ *  Vectors and matrices whose sizes are template parameters, held by value.
+ *  They live on the stack and every loop over them has constant bounds, so
+ *  a filter step computed on them does no heap allocation and the compiler
+ *  unrolls it completely.
+ *  Only the operations of the fixed size EKFilter and UKFilter steps are
+ *  provided, with the square root updates of the UKFilter covariance, and
+ *  copies from and to the uBLAS types that hold the filter state between
+ *  steps.
+ *  Selected with BAYES_FILTER_FIXED_SIZE, c.f. matSup.hpp
+ */
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+/* Filter Matrix Namespace */
+namespace Bayesian_filter_matrix
+{
+namespace fixed
+{
+
+template <std::size_t N>
+struct Vec
+{
+	Float e[N];
+
+	Float& operator[] (std::size_t i) { return e[i]; }
+	const Float& operator[] (std::size_t i) const { return e[i]; }
+};
+
+template <std::size_t R, std::size_t C>
+struct Matrix
+{
+	Float e[R][C];
+
+	Float& operator() (std::size_t i, std::size_t j) { return e[i][j]; }
+	const Float& operator() (std::size_t i, std::size_t j) const { return e[i][j]; }
+};
+
+
+/*
+ * Copies from and to uBLAS vectors, matrices and proxies of the same size
+ */
+template <std::size_t N, class V>
+inline void assign (Vec<N>& to, const V& from)
+{
+	for (std::size_t i = 0; i < N; ++i)
+		to[i] = from[i];
+}
+
+template <std::size_t N, class V>
+inline void assign_to (V& to, const Vec<N>& from)
+{
+	for (std::size_t i = 0; i < N; ++i)
+		to[i] = from[i];
+}
+
+template <std::size_t R, std::size_t C, class M>
+inline void assign (Matrix<R,C>& to, const M& from)
+{
+	for (std::size_t i = 0; i < R; ++i)
+		for (std::size_t j = 0; j < C; ++j)
+			to(i,j) = from(i,j);
+}
+
+template <std::size_t R, std::size_t C, class M>
+inline void assign_to (M& to, const Matrix<R,C>& from)
+{
+	for (std::size_t i = 0; i < R; ++i)
+		for (std::size_t j = 0; j < C; ++j)
+			to(i,j) = from(i,j);
+}
+
+template <std::size_t N, class M>
+inline void assign_to_sym (M& to, const Matrix<N,N>& from)
+/* Upper triangle of from, to a SymMatrix
+ */
+{
+	for (std::size_t i = 0; i < N; ++i)
+		for (std::size_t j = i; j < N; ++j)
+			to(i,j) = from(i,j);
+}
+
+
+/*
+ * Algebra
+ */
+template <std::size_t R, std::size_t K, std::size_t C>
+inline Matrix<R,C> prod (const Matrix<R,K>& A, const Matrix<K,C>& B)
+{
+	Matrix<R,C> P;
+	for (std::size_t i = 0; i < R; ++i)
+		for (std::size_t j = 0; j < C; ++j) {
+			Float p = 0;
+			for (std::size_t k = 0; k < K; ++k)
+				p += A(i,k) * B(k,j);
+			P(i,j) = p;
+		}
+	return P;
+}
+
+template <std::size_t R, std::size_t C>
+inline Vec<R> prod (const Matrix<R,C>& A, const Vec<C>& v)
+{
+	Vec<R> p;
+	for (std::size_t i = 0; i < R; ++i) {
+		Float pi = 0;
+		for (std::size_t k = 0; k < C; ++k)
+			pi += A(i,k) * v[k];
+		p[i] = pi;
+	}
+	return p;
+}
+
+template <std::size_t R, std::size_t K, std::size_t C>
+inline Matrix<R,C> prod_trans (const Matrix<R,K>& A, const Matrix<C,K>& B)
+/* A*B'
+ */
+{
+	Matrix<R,C> P;
+	for (std::size_t i = 0; i < R; ++i)
+		for (std::size_t j = 0; j < C; ++j) {
+			Float p = 0;
+			for (std::size_t k = 0; k < K; ++k)
+				p += A(i,k) * B(j,k);
+			P(i,j) = p;
+		}
+	return P;
+}
+
+template <std::size_t R, std::size_t K>
+inline Matrix<R,R> prod_SPD (const Matrix<R,K>& A, const Matrix<K,K>& S)
+/* A*S*A' of a symmetric S, symmetric by construction
+ */
+{
+	const Matrix<R,K> AS = prod(A, S);
+	Matrix<R,R> P;
+	for (std::size_t i = 0; i < R; ++i)
+		for (std::size_t j = i; j < R; ++j) {
+			Float p = 0;
+			for (std::size_t k = 0; k < K; ++k)
+				p += AS(i,k) * A(j,k);
+			P(i,j) = P(j,i) = p;
+		}
+	return P;
+}
+
+template <std::size_t R, std::size_t K>
+inline Matrix<R,R> prod_SPD (const Matrix<R,K>& A, const Vec<K>& d)
+/* A*diag(d)*A'
+ */
+{
+	Matrix<R,R> P;
+	for (std::size_t i = 0; i < R; ++i)
+		for (std::size_t j = i; j < R; ++j) {
+			Float p = 0;
+			for (std::size_t k = 0; k < K; ++k)
+				p += A(i,k) * d[k] * A(j,k);
+			P(i,j) = P(j,i) = p;
+		}
+	return P;
+}
+
+template <std::size_t R, std::size_t C>
+inline void add_outer_prod (Matrix<R,C>& M, const Vec<R>& a, const Vec<C>& b, Float scale = 1)
+/* M += scale * a*b'
+ */
+{
+	for (std::size_t i = 0; i < R; ++i)
+		for (std::size_t j = 0; j < C; ++j)
+			M(i,j) += scale * a[i] * b[j];
+}
+
+template <std::size_t R, std::size_t C>
+inline void plus_assign (Matrix<R,C>& A, const Matrix<R,C>& B)
+{
+	for (std::size_t i = 0; i < R; ++i)
+		for (std::size_t j = 0; j < C; ++j)
+			A(i,j) += B(i,j);
+}
+
+template <std::size_t R, std::size_t C>
+inline void minus_assign (Matrix<R,C>& A, const Matrix<R,C>& B)
+{
+	for (std::size_t i = 0; i < R; ++i)
+		for (std::size_t j = 0; j < C; ++j)
+			A(i,j) -= B(i,j);
+}
+
+template <std::size_t R, std::size_t C>
+inline void scale (Matrix<R,C>& M, Float s)
+{
+	for (std::size_t i = 0; i < R; ++i)
+		for (std::size_t j = 0; j < C; ++j)
+			M(i,j) *= s;
+}
+
+template <std::size_t R, std::size_t C>
+inline void zero (Matrix<R,C>& M)
+{
+	for (std::size_t i = 0; i < R; ++i)
+		for (std::size_t j = 0; j < C; ++j)
+			M(i,j) = 0;
+}
+
+
+/*
+ * Cholesky factorisation and inverse of Positive Definite matrices
+ *
+ * Return values are reciprocal condition numbers as the uBLAS UCfactor and
+ * UdUinversePD: -1 if negative, 0 if semi-definite (including zero)
+ */
+template <std::size_t N>
+inline Float UCrcond (const Matrix<N,N>& UC)
+/* rcond of the original matrix, the square of the rcond of diagonal(UC)
+ */
+{
+	Float mind = UC(0,0), maxd = 0;
+	for (std::size_t i = 0; i < N; ++i) {
+		Float d = UC(i,i);
+		if (d != d)				// NaN
+			return -1;
+		if (d < mind) mind = d;
+		if (d > maxd) maxd = d;
+	}
+	if (mind < 0)				// matrix is negative
+		return -1;
+	Float rcond = mind / maxd;
+	if (rcond != rcond)			// NaN, singular due to (mind == maxd) == (zero or infinity)
+		return 0;
+	return rcond * rcond;
+}
+
+template <std::size_t N>
+inline Float UCfactor (Matrix<N,N>& UC, const Matrix<N,N>& M)
+/* Upper triangular Cholesky factor of a Positive definite or semi-definite M
+ *  UC*UC' = M, the strict lower triangle of UC is zero
+ *  As the uBLAS UCfactor, in the same order of operations
+ */
+{
+	UC = M;
+	std::size_t j = N-1;
+	do {
+		Float d = UC(j,j);
+		if (d > 0) {
+			d = std::sqrt(d);
+			UC(j,j) = d;
+			d = 1 / d;
+			for (std::size_t i = 0; i < j; ++i) {
+				Float e = d * UC(i,j);
+				UC(i,j) = e;
+				for (std::size_t k = 0; k <= i; ++k)
+					UC(k,i) -= e * UC(k,j);
+			}
+		}
+		else if (d == 0) {
+			for (std::size_t i = 0; i < j; ++i)
+				if (UC(i,j) != 0)
+					return -1;
+		}
+		else
+			return -1;
+	} while (j-- > 0);
+
+	for (std::size_t i = 1; i < N; ++i)
+		for (std::size_t k = 0; k < i; ++k)
+			UC(i,k) = 0;
+	return UCrcond(UC);
+}
+
+template <std::size_t N>
+inline Float UdUinversePD (Matrix<N,N>& MI, const Matrix<N,N>& M)
+/* Inverse of Positive Definite matrix M
+ *  MI is only valid if return value >0, else it is NaN
+ */
+{
+	Matrix<N,N> UC;
+	Float rcond = UCfactor(UC, M);
+	if (!(rcond > 0)) {
+		for (std::size_t i = 0; i < N; ++i)
+			for (std::size_t j = 0; j < N; ++j)
+				MI(i,j) = std::numeric_limits<Float>::quiet_NaN();
+		return rcond;
+	}
+
+	// inv(M) = inv(UC)' * inv(UC), with inv(UC) upper triangular, in place
+	for (std::size_t j = N; j-- > 0;) {
+		UC(j,j) = 1 / UC(j,j);
+		for (std::size_t i = j; i-- > 0;) {
+			Float p = 0;
+			for (std::size_t k = i+1; k <= j; ++k)
+				p += UC(i,k) * UC(k,j);
+			UC(i,j) = -p / UC(i,i);
+		}
+	}
+	for (std::size_t i = 0; i < N; ++i)
+		for (std::size_t j = i; j < N; ++j) {
+			Float p = 0;
+			for (std::size_t k = 0; k <= i; ++k)
+				p += UC(k,i) * UC(k,j);
+			MI(i,j) = MI(j,i) = p;
+		}
+	return rcond;
+}
+
+
+/*
+ * Square root updates of Positive Definite matrices, in the UC*UC' form of UCfactor
+ */
+template <std::size_t N, std::size_t K>
+inline void UCtriangle (Matrix<N,N>& UC, Matrix<N,K>& A)
+/* Upper triangular UC with UC*UC' = A*A', by Householder reflections of the
+ *  columns of A: A*Q = [UC 0] with Q orthogonal. K >= N, A is destroyed
+ *  The diagonal of UC is positive, or zero for a semi-definite A*A'
+ */
+{
+	for (std::size_t r = N; r-- > 0;) {
+		// Reflect the columns 0..r and N..K-1 of row r into column r
+		Float sigma = 0;
+		for (std::size_t c = 0; c <= r; ++c)
+			sigma += A(r,c) * A(r,c);
+		for (std::size_t c = N; c < K; ++c)
+			sigma += A(r,c) * A(r,c);
+		sigma = std::sqrt(sigma);
+		if (sigma == 0)
+			continue;
+		const Float alpha = A(r,r);
+		const Float vr = alpha < 0 ? alpha - sigma : alpha + sigma;
+		const Float beta = 1 / (sigma * (sigma + std::fabs(alpha)));	// 2/(v'*v)
+		for (std::size_t i = 0; i < r; ++i) {
+			Float p = A(i,r) * vr;
+			for (std::size_t c = 0; c < r; ++c)
+				p += A(i,c) * A(r,c);
+			for (std::size_t c = N; c < K; ++c)
+				p += A(i,c) * A(r,c);
+			p *= beta;
+			A(i,r) -= p * vr;
+			for (std::size_t c = 0; c < r; ++c)
+				A(i,c) -= p * A(r,c);
+			for (std::size_t c = N; c < K; ++c)
+				A(i,c) -= p * A(r,c);
+		}
+		// Row r reflects to -sign(alpha)*sigma in column r, the sign of the column is free
+		const Float sign = alpha < 0 ? 1 : -1;
+		for (std::size_t i = 0; i < r; ++i)
+			A(i,r) *= sign;
+		A(r,r) = sigma;
+	}
+	for (std::size_t i = 0; i < N; ++i)
+		for (std::size_t j = 0; j < N; ++j)
+			UC(i,j) = j < i ? 0 : A(i,j);
+}
+
+template <std::size_t N>
+inline bool UCupdate (Matrix<N,N>& UC, Vec<N> v, Float s)
+/* UC*UC' + s*v*v' in place, a downdate if s < 0
+ *  false if the result is not Positive Definite, UC is then invalid
+ */
+{
+	const Float sign = s < 0 ? -1 : 1;
+	const Float scale = std::sqrt(std::fabs(s));
+	for (std::size_t i = 0; i < N; ++i)
+		v[i] *= scale;
+
+	// The diagonal is only changed at its own column, its inverse is off the dependency chain of v
+	Float dI[N];
+	for (std::size_t k = 0; k < N; ++k) {
+		if (!(UC(k,k) > 0))			// also NaN
+			return false;
+		dI[k] = 1 / UC(k,k);
+	}
+	for (std::size_t k = N; k-- > 0;) {
+		const Float d = UC(k,k);
+		const Float r2 = d*d + sign * v[k]*v[k];
+		if (!(r2 > 0))				// also NaN
+			return false;
+		const Float r = std::sqrt(r2);
+		const Float c = r * dI[k], sn = v[k] * dI[k], rc = d / r;
+		UC(k,k) = r;
+		for (std::size_t i = 0; i < k; ++i) {
+			UC(i,k) = (UC(i,k) + sign * sn * v[i]) * rc;
+			v[i] = c * v[i] - sn * UC(i,k);
+		}
+	}
+	return true;
+}
+
+}//namespace fixed
+}//namespace
+
+#endif
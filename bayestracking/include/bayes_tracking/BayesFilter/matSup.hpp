@@ -88,7 +88,33 @@ SymMatrix::value_type UdUinversePD (SymMatrix& M, SymMatrix::value_type& detM);
 SymMatrix::value_type UdUinversePD (SymMatrix& MI, const SymMatrix& M);
 SymMatrix::value_type UdUinversePD (SymMatrix& MI, SymMatrix::value_type& detM, const SymMatrix& M);
 
+/*
+ * Batched factorisations of many small matrices of the same size n
+ *  Element (i,j) of matrix b of a batch of B is M[(i*n + j)*B + b], so every
+ *  step of a factorisation is a loop over the batch on contiguous elements,
+ *  which the compiler vectorises. Each matrix has the operations of the
+ *  factorisation of one matrix in the same order, with the same results.
+ *  Only the upper triangles are factorised, the strict lower triangles are
+ *  workspace and left undefined.
+ *
+ * Return values:
+ *  rcond[b] as the factorisation of one matrix if matrix b is PD, not > 0
+ *  otherwise, for a semi-definite matrix too, its factor is then invalid
+ */
+void UdUfactor_batch (Float* M, std::size_t n, std::size_t B, Float* rcond);
+void UCfactor_batch (Float* M, std::size_t n, std::size_t B, Float* rcond);
+void UTinverse_batch (Float* U, std::size_t n, std::size_t B);
+
 
 }//namespace
 
+/*
+ * Fixed size matrix support
+ *  With BAYES_FILTER_FIXED_SIZE the EKFilter and UKFilter steps of the sizes they
+ *  were built for are computed on fixed size stack matrices instead of uBLAS
+ */
+#ifdef BAYES_FILTER_FIXED_SIZE
+#include "bayes_tracking/BayesFilter/fixedMatrix.hpp"
+#endif
+
 #endif
@@ -30,13 +30,79 @@ using namespace Bayesian_filter_matrix;
 
 typedef enum{CORRELATION, MAHALANOBIS, CORRELATION_LOG} measure_t;
 
+/** Size of a gate, by the probability that it holds the observation of its track (0.9 to 0.999) */
+typedef enum{GATE_90, GATE_95, GATE_99, GATE_999} gate_t;
+
+
+/**
+ * Gates from the Chi-square distribution of dof degrees of freedom, for
+ * observations of dof elements: value(confidence) is the square root of its
+ * quantile, the largest Mahalanobis distance of an observation in the gate.
+ * The tables of dof 1 to 6 only are defined, a gate of another size does
+ * not compile; with dof and the confidence known, value() is a constant.
+ */
+template<int dof>
+struct ChiSquareGate;
+
+template<>
+struct ChiSquareGate<1> {
+   static double value(gate_t confidence) {
+      static const double v[] = {1.645, 1.960, 2.576, 3.291};
+      return v[confidence];
+   }
+};
+
+template<>
+struct ChiSquareGate<2> {
+   static double value(gate_t confidence) {
+      static const double v[] = {2.146, 2.448, 3.035, 3.717};
+      return v[confidence];
+   }
+};
+
+template<>
+struct ChiSquareGate<3> {
+   static double value(gate_t confidence) {
+      static const double v[] = {2.500, 2.795, 3.368, 4.033};
+      return v[confidence];
+   }
+};
+
+template<>
+struct ChiSquareGate<4> {
+   static double value(gate_t confidence) {
+      static const double v[] = {2.789, 3.080, 3.644, 4.297};
+      return v[confidence];
+   }
+};
+
+template<>
+struct ChiSquareGate<5> {
+   static double value(gate_t confidence) {
+      static const double v[] = {3.039, 3.327, 3.884, 4.529};
+      return v[confidence];
+   }
+};
+
+template<>
+struct ChiSquareGate<6> {
+   static double value(gate_t confidence) {
+      static const double v[] = {3.263, 3.548, 4.100, 4.739};
+      return v[confidence];
+   }
+};
+
 
 /**
 Association matrix
 
+Row-major elements in a single buffer, which only grows: a matrix reused for
+every association, with setSize(), does not allocate once it had the largest
+size.
+
 @author Nicola Bellotto
 */
-class AssociationMatrix : public std::vector< std::vector<double> >
+class AssociationMatrix
 {
 public:
     /**
@@ -64,6 +130,41 @@ public:
      */
     void setSize(size_t row, size_t col);
 
+    /**
+     * Set matrix size, with all the elements gated but those of set(...).
+     * computeNN(...), computeHungarian(...) and computeAuction(...) then take
+     * the time of these elements only, operator[] and print() are not valid
+     * @param row Number of rows
+     * @param col Number of columns
+     */
+    void setSparse(size_t row, size_t col);
+
+    /**
+     * Set an element of a sparse matrix, once at most
+     * @param row Row index
+     * @param col Column index
+     * @param value Similarity measure
+     */
+    inline void set(size_t row, size_t col, double value)
+    {
+        entry_t e = {row, col, value};
+        m_entries.push_back(e);
+    }
+
+    /**
+     * Get the number of elements of a sparse matrix
+     * @return Number of elements set
+     */
+    inline size_t getEntries() { return m_entries.size(); }
+
+   /**
+    * Row of the matrix, its elements are (*this)[row][col]
+    * @param row Row index
+    * @return Pointer to the first element of the row
+    */
+   inline double* operator[](size_t row) { return &m_data[row * ColSize]; }
+   inline const double* operator[](size_t row) const { return &m_data[row * ColSize]; }
+
    /**
     * Print matrix elements on standard output
     */
@@ -127,11 +228,82 @@ public:
    static double correlation_log(const FM::Vec& s, const FM::SymMatrix& S);
 
    /**
-    * Return value of gate from Chi-square distribution
-    * @param dof Degree of freedom (size of the vector to be gated)
-    * @return Gate value (square root of relative value in table of Chi-square distribution for P = 0.01)
+    * Set the innovation covariance of mahalanobis(s), correlation_log(s) and
+    * mahalanobis2(...), factorised once for all the innovations with the same
+    * covariance, as those of the observations with one filter: the inverse W
+    * of its Cholesky factor, with s' * inv(S) * s = |W * s|^2, and ln|S| are
+    * kept in this matrix, without allocation once it had the size of S
+    * @param S Innovation covariance matrix
+    * @throw Bayesian_filter::Numeric_exception if S is not PD
     */
-   static double gate(int dof);
+   void setInnovationCovariance(const FM::SymMatrix& S);
+
+   /**
+    * Factorise the innovation covariances of many filters at once, as
+    * setInnovationCovariance(S) for each of them with the same results, by
+    * the batched factorisations of Bayes++ vectorised across the filters:
+    * selectInnovationCovariance(j) then sets the one of filter j
+    * @param S Covariances, element (k,l) of covariance j at S[(k * dim + l) * n + j],
+    * only their upper triangles are used
+    * @param dim Size of the covariances
+    * @param n Number of covariances
+    */
+   void setInnovationCovariances(const double* S, size_t dim, size_t n);
+
+   /**
+    * Set the innovation covariance of mahalanobis(s), correlation_log(s) and
+    * mahalanobis2(...) to one of setInnovationCovariances(...)
+    * @param j Index of the covariance
+    * @throw Bayesian_filter::Numeric_exception if it is not PD
+    */
+   void selectInnovationCovariance(size_t j);
+
+   /**
+    * Squared Mahalanobis distances s' * inv(S) * s of the innovations
+    * s = zp - z of many observations, with S of setInnovationCovariance(S),
+    * in a few loops over contiguous arrays
+    * @param zp Predicted observation
+    * @param z Observations, element k of observation i at z[k * stride + i]
+    * @param stride Distance between the elements of an observation
+    * @param n Number of observations
+    * @param d2 Distances, n of them
+    */
+   void mahalanobis2(const FM::Vec& zp, const double* z, size_t stride, size_t n, double* d2);
+
+   /**
+    * Squared Mahalanobis distance s' * inv(S) * s, with S of
+    * setInnovationCovariance(S)
+    * @param s Innovation vector
+    * @return Squared distance
+    */
+   double mahalanobis2(const FM::Vec& s) const;
+
+   /**
+    * ln|S|, of setInnovationCovariance(S)
+    */
+   inline double logDetS() const { return m_logDetS; }
+
+   /**
+    * As mahalanobis(s, S), with S of setInnovationCovariance(S)
+    * @param s Innovation vector
+    * @return Mahalanobis distance
+    */
+   double mahalanobis(const FM::Vec& s) const;
+
+   /**
+    * As correlation_log(s, S), with S of setInnovationCovariance(S)
+    * @param s Innovation vector
+    * @return Distance
+    */
+   double correlation_log(const FM::Vec& s) const;
+
+   /**
+    * Return value of gate from Chi-square distribution, c.f. ChiSquareGate for a dof known at compile time
+    * @param dof Degree of freedom (size of the vector to be gated, 1 to 6)
+    * @param confidence Size of the gate (default GATE_99, P = 0.01)
+    * @return Gate value (square root of relative value in table of Chi-square distribution)
+    */
+   static double gate(int dof, gate_t confidence = GATE_99);
    
    /**
     * Compute Nearest Neighbour (NN) assignment on the association matrix.
@@ -141,8 +313,32 @@ public:
     */
    void computeNN(measure_t measure);
 
+   /**
+    * Compute the optimal assignment on the association matrix with the
+    * shortest augmenting paths of Jonker-Volgenant (Hungarian method): the
+    * most (row,col) pairs, then the best sum of their similarity measures.
+    * Only the gated elements are considered, i.e. below DBL_MAX for
+    * 'CORRELATION_LOG' and 'MAHALANOBIS', above 0 for 'CORRELATION', so the
+    * cost is O(n^3) in the worst case, much less once gated.
+    * The result is stored in @p NN, @p URow and @p UCol as computeNN(...)
+    * @param measure Association measure: 'CORRELATION_LOG' (default), 'CORRELATION' or 'MAHALANOBIS'
+    */
+   void computeHungarian(measure_t measure);
+
+   /**
+    * Compute the same assignment as computeHungarian(...), approximately,
+    * with the forward auction algorithm of Bertsekas on the gated elements.
+    * The sum of the similarity measures is within rows * @p epsilon of the
+    * optimal one, a smaller @p epsilon takes more bids.
+    * The result is stored in @p NN, @p URow and @p UCol as computeNN(...)
+    * @param measure Association measure: 'CORRELATION_LOG' (default), 'CORRELATION' or 'MAHALANOBIS'
+    * @param epsilon Minimum bid increment, in units of the measure
+    */
+   void computeAuction(measure_t measure, double epsilon = 1e-3);
+
 public:
    typedef struct { size_t row; size_t col; double match; } match_t;
+   typedef struct { size_t row; size_t col; double value; } entry_t;
    /**
     * Vector of pairs (row,col) and relative similarity match value
     * computed with @p computeNN(...)
@@ -160,9 +356,47 @@ public:
    std::vector< size_t > UCol;
 
 private:
+   /**
+    * Gated elements of the matrix, by row, as costs to minimise
+    */
+   void sparse(measure_t measure);
+
+   /**
+    * Fill @p NN, @p URow and @p UCol from m_rowMate, best match first
+    */
+   void matches(measure_t measure);
+
+   /**
+    * computeNN(...) of a sparse matrix, the elements in order of their measure
+    */
+   void computeSparseNN(measure_t measure);
+
    size_t RowSize;   // matrix row size
    size_t ColSize;   // matrix column size
-   static Float detS;
+   bool m_sparse;    // elements in m_entries, not m_data
+   std::vector<entry_t> m_entries;
+   std::vector<double> m_data;  // elements, RowSize * ColSize of them used
+   FM::UTriMatrix m_UC;         // Cholesky factor of the innovation covariance
+   std::vector<double> m_W;     // its inverse, row-major
+   Float m_logDetS;             // and the log of its determinant
+   std::vector<double> m_y;     // workspace of mahalanobis2(...)
+   // factorised innovation covariances of setInnovationCovariances(...)
+   size_t m_dims;                   // their size
+   std::vector<double> m_Ws;        // inverses of their Cholesky factors, as the covariances
+   std::vector<double> m_rconds;    // reciprocal condition numbers
+   std::vector<double> m_logDetSs;  // and logs of determinants
+   // workspace of computeHungarian(...) and computeAuction(...)
+   std::vector<size_t> m_rowStart;  // gated elements of each row, m_rowStart[i] to m_rowStart[i+1]
+   std::vector<size_t> m_col;       // their columns
+   std::vector<double> m_cost;      // and costs
+   std::vector<long> m_rowMate;     // assigned column of each row, -1 if none
+   std::vector<long> m_colMate;     // assigned row of each column, -1 if none
+   std::vector<double> m_u, m_v;    // dual variables of rows and columns (auction prices)
+   std::vector<double> m_dist;      // shortest path to each column
+   std::vector<long> m_pred;        // and its previous row
+   std::vector<char> m_done;        // and if it is final
+   std::vector<size_t> m_scanned;   // columns of the final shortest paths
+   std::vector<size_t> m_queue;     // rows to assign, or to fill of each row
 };
 
 // short name version
@@ -0,0 +1,430 @@
+//
+// C++ Interface: candidatestore
+//
+// Description: Sequences of unmatched observations, candidates to new tracks
+// of MultiTracker, by cell of a spatial hash and by time
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+#ifndef CANDIDATESTORE_H
+#define CANDIDATESTORE_H
+
+#include <vector>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+
+namespace MTRK {
+
+  /**
+   * The sequences of unmatched observations which may become tracks, each a
+   * chain of small records of the same size: the time, probability, name and
+   * flag ids of an observation, and its elements in an array of all of them.
+   * Every sequence is in two lists:
+   * - the chain of its cell in a hash table of the square cells of the plane
+   *   of the first two elements of its last observation, the sequences whose
+   *   last observation is close to another one are then found in the cells
+   *   around it only;
+   * - a ring of all the sequences in the order of the time of their last
+   *   observation, the old ones are then removed from its head, one at a time.
+   * Records and sequences removed are reused, the storage only grows: the
+   * store does not allocate once it had the largest number of sequences.
+   */
+  class CandidateStore {
+
+  public:
+    enum { NONE = -1 };                   // no record, no sequence
+
+    /** Observation of a sequence, its elements at values(r) */
+    struct record_t {
+      double time, prob;
+      int name, flag;                     // ids, c.f. NameRegistry
+      int next;                           // next record of the sequence, or free one
+    };
+
+    CandidateStore() : m_dim(0), m_cell(1.), m_size(0), m_serial(0), m_oldest(NONE),
+		       m_freeSequence(NONE), m_freeRecord(NONE) {}
+
+    /**
+     * Set the size of the observations and the side of the cells, for the
+     * observations of a model: the sequences are kept if their observations
+     * have the same size, and hashed again if the cells change
+     * @param dim Size of the observations
+     * @param cell Side of the cells, the largest half width of a gate
+     */
+    void reset(int dim, double cell)
+    {
+      if (dim != m_dim) {
+	clear();
+	m_dim = dim;
+      }
+      if (!(cell > 0.)) // also NaN
+	cell = 1.;
+      if (cell != m_cell) {
+	m_cell = cell;
+	for (size_t q = 0; q < m_sequences.size(); q++) {
+	  if (m_sequences[q].length)
+	    setCell(q);
+	}
+	rehash(m_buckets.size());
+      }
+    }
+
+    /**
+     * Remove all the sequences
+     */
+    void clear()
+    {
+      m_sequences.clear();
+      m_records.clear();
+      m_values.clear();
+      m_buckets.assign(m_buckets.size(), NONE);
+      m_size = 0;
+      m_oldest = m_freeSequence = m_freeRecord = NONE;
+    }
+
+    /**
+     * Number of sequences
+     */
+    size_t size() const
+    {
+      return m_size;
+    }
+
+    /**
+     * Add a sequence of one observation
+     * @param z Observation, of the size of reset()
+     * @param time Timestamp
+     * @param prob Probability
+     * @param name Id of the detector name
+     * @param flag Id of the flags
+     * @return The sequence, valid until it is removed
+     */
+    template<class V>
+      int add(const V& z, double time, double prob, int name, int flag)
+      {
+	if (2 * (m_size + 1) > m_buckets.size())
+	  rehash(std::max((size_t)16, 2 * m_buckets.size()));
+	int q = m_freeSequence;
+	if (q == NONE) {
+	  q = (int)m_sequences.size();
+	  m_sequences.push_back(candidate_t());
+	}
+	else
+	  m_freeSequence = m_sequences[q].newer;
+	candidate_t& c = m_sequences[q];
+	c.first = c.last = newRecord(z, time, prob, name, flag);
+	c.length = 1;
+	c.serial = m_serial++;
+	setCell(q);
+	linkCell(q);
+	linkTime(q);
+	m_size++;
+	return q;
+      }
+
+    /**
+     * Add an observation at the end of a sequence
+     * @param q Sequence
+     * @param z Observation, of the size of reset()
+     * @param time Timestamp
+     * @param prob Probability
+     * @param name Id of the detector name
+     * @param flag Id of the flags
+     */
+    template<class V>
+      void extend(int q, const V& z, double time, double prob, int name, int flag)
+      {
+	const int r = newRecord(z, time, prob, name, flag);
+	candidate_t& c = m_sequences[q];
+	m_records[c.last].next = r;
+	c.last = r;
+	c.length++;
+	unlinkCell(q);
+	setCell(q);
+	linkCell(q);
+	unlinkTime(q);
+	linkTime(q);
+      }
+
+    /**
+     * Remove a sequence
+     */
+    void remove(int q)
+    {
+      candidate_t& c = m_sequences[q];
+      unlinkCell(q);
+      unlinkTime(q);
+      m_records[c.last].next = m_freeRecord;
+      m_freeRecord = c.first;
+      c.length = 0;
+      c.newer = m_freeSequence;
+      m_freeSequence = q;
+      m_size--;
+    }
+
+    /**
+     * Remove the sequences whose last observation is more than an interval
+     * before a time, from the oldest
+     * @param time Time
+     * @param interval Interval
+     */
+    void expire(double time, double interval)
+    {
+      while (m_oldest != NONE && time - m_records[m_sequences[m_oldest].last].time > interval)
+	remove(m_oldest);
+    }
+
+    /**
+     * The sequences whose last observation is in the cells overlapping a
+     * box, i.e. a superset of those in the box, in the order they were added
+     * @param x Center of the box, first element of an observation
+     * @param y Second element, 0 for observations of one element
+     * @param hx Half width of the box along x, at most the side of the cells
+     * @param hy Half width along y
+     * @param found The sequences, cleared first
+     */
+    void near(double x, double y, double hx, double hy, std::vector<int>& found) const
+    {
+      found.clear();
+      if (m_size == 0)
+	return;
+      const long cx0 = cellOf(x - hx), cx1 = cellOf(x + hx);
+      const long cy0 = cellOf(y - hy), cy1 = cellOf(y + hy);
+      for (long cy = cy0; cy <= cy1; cy++) {
+	for (long cx = cx0; cx <= cx1; cx++) {
+	  for (int q = m_buckets[bucket(cx, cy)]; q != NONE; q = m_sequences[q].cellNext) {
+	    if (m_sequences[q].cx == cx && m_sequences[q].cy == cy)
+	      found.push_back(q);
+	  }
+	}
+      }
+      std::sort(found.begin(), found.end(), BySerial(m_sequences));
+    }
+
+    /**
+     * Replace the name and flag ids of every observation
+     * @param map The new id of an id, map(id)
+     */
+    template<class Map>
+      void remapNames(Map& map)
+      {
+	for (size_t q = 0; q < m_sequences.size(); q++) {
+	  if (m_sequences[q].length == 0)
+	    continue;
+	  for (int r = m_sequences[q].first; r != NONE; r = m_records[r].next) {
+	    m_records[r].name = map(m_records[r].name);
+	    m_records[r].flag = map(m_records[r].flag);
+	  }
+	}
+      }
+
+    /**
+     * Size of the observations, c.f. reset()
+     */
+    int dim() const
+    {
+      return m_dim;
+    }
+
+    /**
+     * Every sequence, in the order they were added
+     * @param found The sequences, cleared first
+     */
+    void sequences(std::vector<int>& found) const
+    {
+      found.clear();
+      for (size_t q = 0; q < m_sequences.size(); q++) {
+	if (m_sequences[q].length)
+	  found.push_back(q);
+      }
+      std::sort(found.begin(), found.end(), BySerial(m_sequences));
+    }
+
+    /**
+     * Number of observations of a sequence
+     */
+    size_t length(int q) const
+    {
+      return m_sequences[q].length;
+    }
+
+    /**
+     * First record of a sequence, the others follow by record_t::next
+     */
+    int first(int q) const
+    {
+      return m_sequences[q].first;
+    }
+
+    /**
+     * Last record of a sequence
+     */
+    int last(int q) const
+    {
+      return m_sequences[q].last;
+    }
+
+    const record_t& record(int r) const
+    {
+      return m_records[r];
+    }
+
+    /**
+     * Elements of the observation of a record
+     */
+    const double* values(int r) const
+    {
+      return &m_values[r * m_dim];
+    }
+
+  private:
+    struct candidate_t {
+      int first, last;                    // records
+      size_t length;                      // 0 for a free one
+      unsigned long serial;               // order of the additions
+      long cx, cy;                        // cell of the last observation
+      int cellPrev, cellNext;             // chain of the cell
+      int older, newer;                   // ring by time, newer is the next free one of a free one
+    };
+
+    struct BySerial {
+      const std::vector<candidate_t>& sequences;
+      BySerial(const std::vector<candidate_t>& sequences) : sequences(sequences) {}
+      bool operator()(int a, int b) const
+      {
+	return sequences[a].serial < sequences[b].serial;
+      }
+    };
+
+    template<class V>
+      int newRecord(const V& z, double time, double prob, int name, int flag)
+      {
+	int r = m_freeRecord;
+	if (r == NONE) {
+	  r = (int)m_records.size();
+	  m_records.push_back(record_t());
+	  m_values.resize(m_values.size() + m_dim);
+	}
+	else
+	  m_freeRecord = m_records[r].next;
+	record_t& o = m_records[r];
+	o.time = time;
+	o.prob = prob;
+	o.name = name;
+	o.flag = flag;
+	o.next = NONE;
+	for (int k = 0; k < m_dim; k++)
+	  m_values[r * m_dim + k] = z[k];
+	return r;
+      }
+
+    /** Cell coordinate of v, clamped */
+    long cellOf(double v) const
+    {
+      double c = std::floor(v / m_cell);
+      if (!(c > -1e9)) // also NaN
+	return -1000000000L;
+      return c < 1e9 ? (long)c : 1000000000L;
+    }
+
+    size_t bucket(long cx, long cy) const
+    {
+      return ((unsigned long)cx * 73856093UL ^ (unsigned long)cy * 19349663UL) & (m_buckets.size() - 1);
+    }
+
+    void setCell(int q)
+    {
+      const double* z = values(m_sequences[q].last);
+      m_sequences[q].cx = cellOf(z[0]);
+      m_sequences[q].cy = m_dim > 1 ? cellOf(z[1]) : 0;
+    }
+
+    void linkCell(int q)
+    {
+      candidate_t& c = m_sequences[q];
+      int& head = m_buckets[bucket(c.cx, c.cy)];
+      c.cellPrev = NONE;
+      c.cellNext = head;
+      if (head != NONE)
+	m_sequences[head].cellPrev = q;
+      head = q;
+    }
+
+    void unlinkCell(int q)
+    {
+      const candidate_t& c = m_sequences[q];
+      if (c.cellPrev != NONE)
+	m_sequences[c.cellPrev].cellNext = c.cellNext;
+      else
+	m_buckets[bucket(c.cx, c.cy)] = c.cellNext;
+      if (c.cellNext != NONE)
+	m_sequences[c.cellNext].cellPrev = c.cellPrev;
+    }
+
+    /** Hash table of n buckets, a power of 2 */
+    void rehash(size_t n)
+    {
+      if (n == 0)
+	return;
+      m_buckets.assign(n, NONE);
+      for (size_t q = 0; q < m_sequences.size(); q++) {
+	if (m_sequences[q].length)
+	  linkCell(q);
+      }
+    }
+
+    /**
+     * Into the ring after the newest sequence not newer than it, which is
+     * the newest one but for observations out of order
+     */
+    void linkTime(int q)
+    {
+      candidate_t& c = m_sequences[q];
+      const double time = m_records[c.last].time;
+      if (m_oldest == NONE) {
+	c.older = c.newer = q;
+	m_oldest = q;
+	return;
+      }
+      int older = m_sequences[m_oldest].older; // the newest
+      while (m_records[m_sequences[older].last].time > time && older != m_oldest)
+	older = m_sequences[older].older;
+      if (m_records[m_sequences[older].last].time > time) { // older than them all
+	older = m_sequences[m_oldest].older;
+	m_oldest = q;
+      }
+      c.older = older;
+      c.newer = m_sequences[older].newer;
+      m_sequences[c.newer].older = q;
+      m_sequences[older].newer = q;
+    }
+
+    void unlinkTime(int q)
+    {
+      const candidate_t& c = m_sequences[q];
+      if (c.newer == q) {
+	m_oldest = NONE;
+	return;
+      }
+      m_sequences[c.older].newer = c.newer;
+      m_sequences[c.newer].older = c.older;
+      if (m_oldest == q)
+	m_oldest = c.newer;
+    }
+
+    int m_dim;                            // size of the observations
+    double m_cell;                        // side of the cells
+    size_t m_size;
+    unsigned long m_serial;               // of the next sequence added
+    int m_oldest;                         // head of the ring
+    int m_freeSequence, m_freeRecord;     // lists of those removed
+    std::vector<candidate_t> m_sequences;
+    std::vector<record_t> m_records;
+    std::vector<double> m_values;         // elements of record r from r * m_dim
+    std::vector<int> m_buckets;           // first sequence of the chains of the cells
+  };
+
+} // namespace MTRK
+
+#endif
@@ -0,0 +1,145 @@
+//
+// C++ Interface: gridindex
+//
+// Description: Uniform grid over points of the plane, for the gating of
+// MultiTracker by neighbourhood
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+#ifndef GRIDINDEX_H
+#define GRIDINDEX_H
+
+#include <vector>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+
+namespace MTRK {
+
+  /**
+   * Points of the plane sorted by the square cell of a uniform grid they are
+   * in, row of cells after row. The points within a box are then those of a
+   * few contiguous ranges of the sorted order, one per row of cells the box
+   * overlaps, and finding them takes the time of these cells only.
+   * The storage only grows, a grid rebuilt for every association does not
+   * allocate once it had the largest size.
+   */
+  class GridIndex {
+
+  public:
+    typedef std::pair<size_t, size_t> range_t;  // [first, second) of the sorted order
+
+    GridIndex() : m_size(0), m_x0(0.), m_y0(0.), m_cell(1.), m_nx(0), m_ny(0) {}
+
+    /**
+     * Index n points, the coordinates of point i being position(i, 0) and position(i, 1)
+     * @param n Number of points
+     * @param position Coordinates of the points
+     * @param cell Side of the cells, larger if there would be more than a few cells per point
+     */
+    template<class Position>
+      void build(size_t n, const Position& position, double cell)
+      {
+	m_size = n;
+	m_order.resize(n);
+	m_cellOf.resize(n);
+	if (n == 0) {
+	  m_nx = m_ny = 0;
+	  return;
+	}
+	double x1 = position(0, 0), y1 = position(0, 1);
+	m_x0 = x1;
+	m_y0 = y1;
+	for (size_t i = 1; i < n; i++) {
+	  m_x0 = std::min(m_x0, position(i, 0));
+	  x1 = std::max(x1, position(i, 0));
+	  m_y0 = std::min(m_y0, position(i, 1));
+	  y1 = std::max(y1, position(i, 1));
+	}
+	// at most about 4 cells per point
+	const double maxCells = 4. * n + 16.;
+	m_cell = std::max(cell, 1e-6 * std::max(x1 - m_x0, y1 - m_y0) + 1e-9);
+	double cells = (std::floor((x1 - m_x0) / m_cell) + 1.) * (std::floor((y1 - m_y0) / m_cell) + 1.);
+	if (cells > maxCells)
+	  m_cell *= std::sqrt(cells / maxCells) + 1e-3;
+	m_nx = (size_t)std::floor((x1 - m_x0) / m_cell) + 1;
+	m_ny = (size_t)std::floor((y1 - m_y0) / m_cell) + 1;
+	// counting sort of the points by cell
+	m_start.assign(m_nx * m_ny + 1, 0);
+	for (size_t i = 0; i < n; i++) {
+	  m_cellOf[i] = cellIndex(index(position(i, 0), m_x0, m_nx), index(position(i, 1), m_y0, m_ny));
+	  m_start[m_cellOf[i] + 1]++;
+	}
+	for (size_t c = 0; c < m_nx * m_ny; c++)
+	  m_start[c + 1] += m_start[c];
+	m_fill.assign(m_start.begin(), m_start.end() - 1);
+	for (size_t i = 0; i < n; i++)
+	  m_order[m_fill[m_cellOf[i]]++] = i;
+      }
+
+    /**
+     * Number of points
+     */
+    size_t size() const
+    {
+      return m_size;
+    }
+
+    /**
+     * Point at a position of the sorted order
+     */
+    size_t operator[](size_t p) const
+    {
+      return m_order[p];
+    }
+
+    /**
+     * The ranges of the sorted order with the points of the cells overlapping
+     * a box, i.e. a superset of the points in the box
+     * @param x0 Box, from x0 to x1 and from y0 to y1
+     * @param ranges The ranges, cleared first
+     */
+    void query(double x0, double x1, double y0, double y1, std::vector<range_t>& ranges) const
+    {
+      ranges.clear();
+      if (m_size == 0 || x1 < m_x0 || y1 < m_y0 ||
+	  x0 > m_x0 + m_nx * m_cell || y0 > m_y0 + m_ny * m_cell || !(x0 <= x1 && y0 <= y1))
+	return;
+      const size_t cx0 = index(x0, m_x0, m_nx), cx1 = index(x1, m_x0, m_nx);
+      const size_t cy0 = index(y0, m_y0, m_ny), cy1 = index(y1, m_y0, m_ny);
+      for (size_t cy = cy0; cy <= cy1; cy++) {
+	const size_t first = m_start[cellIndex(cx0, cy)], last = m_start[cellIndex(cx1, cy) + 1];
+	if (first < last)
+	  ranges.push_back(range_t(first, last));
+      }
+    }
+
+  private:
+    /** Cell coordinate of v, clamped to the grid */
+    size_t index(double v, double v0, size_t cells) const
+    {
+      double c = std::floor((v - v0) / m_cell);
+      if (!(c > 0.))  // also NaN
+	return 0;
+      return std::min((size_t)c, cells - 1);
+    }
+
+    size_t cellIndex(size_t cx, size_t cy) const
+    {
+      return cy * m_nx + cx;
+    }
+
+    size_t m_size;
+    double m_x0, m_y0;             // corner of the grid
+    double m_cell;                 // side of the cells
+    size_t m_nx, m_ny;             // cells along x and y
+    std::vector<size_t> m_start;   // first position of each cell in m_order, and the end
+    std::vector<size_t> m_fill;    // workspace of build()
+    std::vector<size_t> m_order;   // points, sorted by cell
+    std::vector<size_t> m_cellOf;  // cell of each point
+  };
+
+} // namespace MTRK
+
+#endif
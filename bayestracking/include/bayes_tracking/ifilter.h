@@ -0,0 +1,94 @@
+//
+// C++ Interface: ifilter
+//
+// Description: Extended information filter, whose observations add up
+// before the state is recomputed
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+#ifndef IFILTER_H
+#define IFILTER_H
+
+#include "bayes_tracking/BayesFilter/infFlt.hpp"
+
+
+using namespace Bayesian_filter;
+using namespace Bayesian_filter_matrix;
+
+/**
+ * Extended information filter: the information y = inv(X)*x and Y = inv(X)
+ * of the state. An observation only adds its information H'*inv(Z)*z and
+ * H'*inv(Z)*H to y and Y, linearized at x, with its innovation computed
+ * from x and X as they are: the observations of several detectors before
+ * update() are fused in one sum, whatever their order, and x and X are
+ * recomputed once. Until then they stay the prediction. predict() calls
+ * update() first.
+ */
+class IFilter : public Information_scheme
+{
+public:
+   /**
+    * Constructor - include initialization with null state and unit covariance
+    */
+   IFilter(std::size_t x_size);
+
+   /**
+    * Constructor
+    * @param x0 State vector
+    * @param P0 Covariance matrix
+    */
+   IFilter(const FM::Vec& x0, const FM::SymMatrix& P0);
+
+   /**
+    * Destructor
+    */
+   ~IFilter();
+
+   /**
+    * Initialize state and covariance
+    * @param x0 State vector
+    * @param P0 Covariance matrix, positive definite
+    */
+   void init(const FM::Vec& x0, const FM::SymMatrix& P0);
+
+   /**
+    * Prediction (include Jacobian update), after update()
+    * @param f Linearized model
+    */
+   Bayes_base::Float predict (Linrz_predict_model& f);
+
+   /**
+    * Predict the observation from x and the covariance R_p of the predicted observation
+    * @param observe_model Observation model
+    * @param z_pred Predicted observation (return)
+    * @param R_pred Predicted observation covariance (return)
+    */
+   void predict_observation(Linrz_correlated_observe_model& observe_model,
+                            FM::Vec& z_pred, FM::SymMatrix& R_pred);
+
+   /**
+    * Add the information of an observation, x and X unchanged until update()
+    * @param h Observation model
+    * @param z Observation
+    */
+   Bayes_base::Float observe (Linrz_correlated_observe_model& h, const FM::Vec& z);
+   /** Override method */
+   Bayes_base::Float observe (Linrz_uncorrelated_observe_model& h, const FM::Vec& z);
+
+   /**
+    * Return the logarithm of the (normalized) likelihhod of the last observation
+    * @return Logarithm of the likelihood
+    */
+   double logLikelihood();
+
+public:
+   /** Innovation */
+   FM::Vec s;
+   /** Innovation covariance */
+   FM::SymMatrix S;
+
+private:
+   std::size_t x_size;
+};
+
+#endif
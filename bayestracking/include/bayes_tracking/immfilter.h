@@ -0,0 +1,133 @@
+//
+// C++ Interface: immfilter
+//
+// Description: Interacting Multiple Model filter of a walking and a standing
+// person, on fixed size matrices
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+#ifndef IMMFILTER_H
+#define IMMFILTER_H
+
+#include "bayes_tracking/BayesFilter/bayesFlt.hpp"
+#include "bayes_tracking/BayesFilter/fixedMatrix.hpp"
+
+
+using namespace Bayesian_filter;
+using namespace Bayesian_filter_matrix;
+
+/**
+ * Interacting Multiple Model filter of the state [x, v_x, y, v_y] of a
+ * person, with two modes: walking, predicted by the constant velocity model
+ * of predict(), and standing, whose velocity is zero up to a small noise and
+ * whose position only drifts. Each mode is an extended Kalman filter; the
+ * modes mix before every prediction with the probabilities of switching
+ * between them, and an observation updates their probabilities by their
+ * likelihoods.
+ * x and X are the moments of the mixture, written by every step, so the
+ * gate of a standing person is not widened by the noise of walking. Set
+ * them with init(), which starts both modes there.
+ * Every step is computed on fixed size stack matrices, without allocation.
+ */
+class IMMFilter : public Kalman_state_filter
+{
+public:
+   /** The modes */
+   enum { WALKING, STANDING, MODES };
+
+   /**
+    * Constructor - include initialization with null state and null covariance
+    * @param x_size State size, 4
+    */
+   IMMFilter(std::size_t x_size);
+
+   /**
+    * Constructor
+    * @param x0 State vector
+    * @param P0 Covariance matrix
+    */
+   IMMFilter(const FM::Vec& x0, const FM::SymMatrix& P0);
+
+   /**
+    * Destructor
+    */
+   ~IMMFilter();
+
+   /**
+    * Initialize state and covariance, of both modes
+    * @param x0 State vector
+    * @param P0 Covariance matrix
+    */
+   void init(const FM::Vec& x0, const FM::SymMatrix& P0);
+
+   /**
+    * Set the standing mode and the switching between the modes
+    * @param positionSD Standard deviation of the drift of a standing person, in m/sqrt(s) (0.3)
+    * @param velocitySD Standard deviation of the velocity of a standing person, in m/s (0.3)
+    * @param switchRate Rate of the switches from a mode to the other, per second (0.5)
+    */
+   void setModes(Float positionSD, Float velocitySD, Float switchRate);
+
+   /**
+    * Mix the modes, then predict them
+    * @param f Constant velocity model (Models::CVModel), of the walking mode
+    */
+   Bayes_base::Float predict(Linrz_predict_model& f);
+
+   /**
+    * Predict the observation from the mixture and the covariance R_p of the predicted observation
+    * @param observe_model Observation model
+    * @param z_pred Predicted observation (return)
+    * @param R_pred Predicted observation covariance (return)
+    */
+   void predict_observation(Linrz_correlated_observe_model& observe_model,
+                            FM::Vec& z_pred, FM::SymMatrix& R_pred);
+
+   /**
+    * Update every mode with an observation of 1 or 2 elements, and the probabilities of the modes
+    * @param h Observation model
+    * @param z Observation
+    */
+   Bayes_base::Float observe(Linrz_correlated_observe_model& h, const FM::Vec& z);
+
+   /**
+    * Return the logarithm of the (normalized) likelihhod of the last observation, of the mixture
+    * @return Logarithm of the likelihood
+    */
+   double logLikelihood();
+
+   /**
+    * Probability of a mode
+    * @param mode WALKING or STANDING
+    */
+   Float probability(std::size_t mode) const
+   {
+      return mu[mode];
+   }
+
+   /** Both modes from x and X, equally probable */
+   void init();
+   /** Nothing, x and X are always those of the mixture */
+   void update()
+   {}
+
+private:
+   /** x, X of the mixture from those of the modes */
+   void combine();
+
+   template <std::size_t M>
+   Float observe_modes(Linrz_correlated_observe_model& h, const FM::Vec& z);
+
+   typedef fixed::Vec<4> State;
+   typedef fixed::Matrix<4,4> Covariance;
+
+   State mx[MODES];        // states of the modes
+   Covariance mX[MODES];   // covariances of the modes
+   Float mu[MODES];        // probabilities of the modes
+   Float positionVar, velocityVar, switchRate;
+   Float m_logLikelihood;
+   // Permanently allocated temps to call the models with
+   FM::Vec xi, zi, si;
+};
+
+#endif
@@ -23,6 +23,9 @@
 
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <climits>
+#include <cassert>
 #include "bayes_tracking/BayesFilter/bayesFlt.hpp"
 #include "bayes_tracking/BayesFilter/matSup.hpp"
 #include <float.h>
@@ -58,12 +61,13 @@ double logGauss(const Vec& s, const SymMatrix& S) {
 
 enum EmptyTag {Empty};  // Tag type used for empty matrix constructor
 
-/** Matrix class */
+/** Matrix class, row-major in one array */
 template < typename Element >
-class Matrix : public vector< vector< Element > > {
+class Matrix {
 private:
    size_t m_rows;
    size_t m_cols;
+   vector< Element > m_data;
 public:
    Matrix(EmptyTag) {
       m_rows = 0;
@@ -74,31 +78,159 @@ public:
       resize(rows, cols);
    }
 
+   /** The storage only grows, the elements are unspecified until set() */
    void resize(size_t rows, size_t cols) {
-      vector< vector< Element > >::resize(rows);
-      for (size_t i = 0; i < rows; i++){
-         (*this)[i].resize(cols);
-      }
       m_rows = rows;
       m_cols = cols;
+      if (m_data.size() < rows * cols) {
+         m_data.resize(rows * cols);
+      }
    }
 
    void set(Element e) {
+      std::fill(m_data.begin(), m_data.begin() + m_rows * m_cols, e);
+   }
+
+   /** Row i, as an array of getCols() elements */
+   Element* operator[](size_t i) { return &m_data[i * m_cols]; }
+
+   const Element* operator[](size_t i) const { return &m_data[i * m_cols]; }
+
+   size_t size() const { return m_rows; }
+
+   size_t getRows() const { return m_rows; }
+   
+   size_t getCols() const { return m_cols; }
+
+   void print() {
       for (size_t i = 0; i < m_rows; i++) {
          for (size_t j = 0; j < m_cols; j++) {
-            (*this)[i][j] = e;
+            cout << (*this)[i][j] << " ";
+         }
+         cout << endl;
+      }
+   }
+};
+
+
+/** Matrix of bools, every row a bitset of whole words */
+template <>
+class Matrix< bool > {
+public:
+   typedef unsigned long word_t;
+   static const size_t WORD_BITS = sizeof(word_t) * CHAR_BIT;
+
+   /** Element (i,j), as a bool */
+   class Reference {
+   private:
+      word_t* m_word;
+      word_t m_mask;
+   public:
+      Reference(word_t* word, word_t mask) : m_word(word), m_mask(mask) {}
+      operator bool() const { return (*m_word & m_mask) != 0; }
+      Reference& operator=(bool b) {
+         if (b) *m_word |= m_mask;
+         else *m_word &= ~m_mask;
+         return *this;
+      }
+   };
+
+   /** Row i */
+   class Row {
+   private:
+      word_t* m_words;
+   public:
+      Row(word_t* words) : m_words(words) {}
+      Reference operator[](size_t j) const {
+         return Reference(m_words + j / WORD_BITS, word_t(1) << (j % WORD_BITS));
+      }
+   };
+
+private:
+   size_t m_rows;
+   size_t m_cols;
+   size_t m_words;  // per row
+   vector< word_t > m_data;
+
+   static size_t lowestBit(word_t w) {
+#ifdef __GNUC__
+      return __builtin_ctzl(w);
+#else
+      size_t b = 0;
+      while (!(w & 1)) {
+         w >>= 1;
+         b++;
+      }
+      return b;
+#endif
+   }
+
+public:
+   Matrix(EmptyTag) {
+      m_rows = 0;
+      m_cols = 0;
+      m_words = 0;
+   }
+
+   Matrix(size_t rows, size_t cols) {
+      resize(rows, cols);
+   }
+
+   /** The storage only grows, the elements are unspecified until set() */
+   void resize(size_t rows, size_t cols) {
+      m_rows = rows;
+      m_cols = cols;
+      m_words = (cols + WORD_BITS - 1) / WORD_BITS;
+      if (m_data.size() < rows * m_words) {
+         m_data.resize(rows * m_words);
+      }
+   }
+
+   void set(bool e) {
+      std::fill(m_data.begin(), m_data.begin() + m_rows * m_words, e ? ~word_t(0) : word_t(0));
+      if (e && m_cols % WORD_BITS) {  // no bit after the last column
+         for (size_t i = 0; i < m_rows; i++) {
+            m_data[(i + 1) * m_words - 1] = (word_t(1) << (m_cols % WORD_BITS)) - 1;
+         }
+      }
+   }
+
+   Row operator[](size_t i) { return Row(&m_data[i * m_words]); }
+
+   bool operator()(size_t i, size_t j) const {
+      return (m_data[i * m_words + j / WORD_BITS] >> (j % WORD_BITS)) & 1;
+   }
+
+   /**
+    * The first true column of row i from column j on, getCols() if none,
+    * e.g. for (j = next(i, 0); j < getCols(); j = next(i, j+1))
+    */
+   size_t next(size_t i, size_t j) const {
+      if (j >= m_cols) {
+         return m_cols;
+      }
+      const word_t* w = &m_data[i * m_words];
+      size_t k = j / WORD_BITS;
+      word_t bits = w[k] & (~word_t(0) << (j % WORD_BITS));
+      while (!bits) {
+         if (++k == m_words) {
+            return m_cols;
          }
+         bits = w[k];
       }
+      return k * WORD_BITS + lowestBit(bits);
    }
 
-   size_t getRows() { return m_rows; }
+   size_t size() const { return m_rows; }
+
+   size_t getRows() const { return m_rows; }
    
-   size_t getCols() { return m_cols; }
+   size_t getCols() const { return m_cols; }
 
    void print() {
       for (size_t i = 0; i < m_rows; i++) {
          for (size_t j = 0; j < m_cols; j++) {
-            cout << (*this)[i][j] << " ";
+            cout << (*this)(i, j) << " ";
          }
          cout << endl;
       }
@@ -107,30 +239,17 @@ public:
 
 
 
-/** MultiMatrix class */
+/** MultiMatrix class, row-major in one array */
 template < typename Element >
-class MultiMatrix : public vector< MultiMatrix< Element > > {
+class MultiMatrix {
 private:
-   size_t m_dim;
+   vector< size_t > m_sizes;
+   vector< size_t > m_strides;
+   vector< Element > m_data;
 public:
-   Element val;
-   
    MultiMatrix(EmptyTag) {
-      m_dim = 0;
-      val = Element();
    }
 
-   MultiMatrix(const MultiMatrix& mm) {
-      m_dim = mm.m_dim;
-      val = mm.val;
-      if (m_dim) {
-         size_t s = mm.size();
-         for (size_t i = 0; i < s; i++) {
-            (*this).push_back(mm[i]);
-         }
-      }
-   }
-   
    MultiMatrix(const vector< size_t >& sizes) {
       init(sizes);
    }
@@ -138,68 +257,54 @@ public:
    void init(const vector< size_t >& sizes) {
       size_t s = sizes.size();
       assert(s);
-      m_dim = s;
-      val = Element();
-      
-      (*this).clear();
-      size_t extent = sizes[0];
-      assert(extent);
-      
-      if (s > 1) {
-         vector< size_t > sub(sizes.begin()+1, sizes.end());
-         MultiMatrix< Element > m(sub);
-         for (size_t i = 0; i < extent; i++) {
-            this->push_back(m);
-         }
+      m_sizes = sizes;
+      m_strides.resize(s);
+      size_t stride = 1;
+      for (size_t i = s; i-- > 0;) {
+         assert(sizes[i]);
+         m_strides[i] = stride;
+         stride *= sizes[i];
       }
-      else {
-         MultiMatrix< Element > m(Empty);
-         for (size_t i = 0; i < extent; i++) {
-            this->push_back(m);
-         }
+      m_data.assign(stride, Element());
+   }
+
+   /** Offset of an element in the array */
+   size_t offset(const vector< size_t >& pos) const {
+      assert(pos.size() == m_sizes.size());  // check valid number of coordinates
+      size_t o = 0;
+      for (size_t i = 0; i < pos.size(); i++) {
+         assert(pos[i] < m_sizes[i]);         // check coordinate within max range
+         o += pos[i] * m_strides[i];
       }
+      return o;
    }
 
-    Element& operator()(const vector< size_t >& pos) {
-    size_t s = pos.size();
-    assert(s == m_dim);              // check valid number of coordinates
-    if (s > 0) {
-      assert(pos[0] < (*this).size()); // check coordinate within max range
-        vector< size_t > sub(pos.begin() + 1, pos.end());
-        return (*this)[pos[0]](sub);
-    }
-    return /*(*this)[pos[0]].*/val;
-    }
+   Element& operator()(const vector< size_t >& pos) {
+      return m_data[offset(pos)];
+   }
+
+   /** Element at an offset of the array */
+   Element& operator[](size_t o) {
+      return m_data[o];
+   }
 
    void getSize(vector< size_t >& sizes) {
-      if ((*this).size()) {
-         sizes.push_back((*this).size());
-         (*this)[0].getSize(sizes);
-      }
+      sizes.insert(sizes.end(), m_sizes.begin(), m_sizes.end());
    }
 
    vector< size_t > getSize() {
-      vector< size_t > s;
-      getSize(s);
-      return s;
+      return m_sizes;
    }
 
    void print() {
-      string str;
-      print(str);
-   }
-
-   void print(const string& str) {
-      if ((*this).size()) {
-         size_t length = (*this).size();
-         for (size_t i = 0; i < length; i++) {
-            ostringstream os;
-            os << "[" << i << "]";
-            (*this)[i].print(string(str + os.str()));
+      vector< size_t > pos(m_sizes.size());
+      for (size_t o = 0; o < m_data.size(); o++) {
+         for (size_t i = 0, r = o; i < m_sizes.size(); i++) {
+            pos[i] = r / m_strides[i];
+            r %= m_strides[i];
+            cout << "[" << pos[i] << "]";
          }
-      }
-      else {
-         cout << str << " = " << val << endl;
+         cout << " = " << m_data[o] << endl;
       }
    }
 };
@@ -211,6 +316,13 @@ typedef struct {
    size_t t;
 } association_t;
 
+/** Gated pair of an observation z and a target t (1...tNum), with its log likelihood */
+typedef struct {
+   size_t z;
+   size_t t;
+   double logLambda;
+} gated_pair_t;
+
 /** Association vector class */
 class Association : public vector< association_t > {
 public:
@@ -223,6 +335,9 @@ public:
    }
 };
 
+/** Cost of a forbidden assignment in Murty's algorithm */
+const double MURTY_BIG = 1e12;
+
 /**
  *	@author Nicola Bellotto <nbello@essex.ac.uk>
  */
@@ -254,12 +369,12 @@ public:
       m_tNum = tNum;
       m_mNum = zNum.size();
 
-      Matrix< bool > omega(Empty);
-      Matrix< double > mat(Empty);
-      Omega.clear();
-      Lambda.clear();
-      Beta.clear();
+      // the matrices and pairs of the previous association are reused
+      Omega.resize(m_mNum, Matrix< bool >(Empty));
+      m_gating.resize(m_mNum);
+      Beta.resize(m_mNum, Matrix< double >(Empty));
       logP.resize(m_mNum);
+      m_xsi.clear();
       
       vector< size_t > betaSizes;
       betaSizes.push_back(m_tNum+1);   // include clutter t0
@@ -271,36 +386,56 @@ public:
       
       for (size_t m = 0; m < m_mNum; m++) {
          assert(zNum[m]);
-         omega.resize(zNum[m], tNum+1);
+         Omega[m].resize(zNum[m], tNum+1);
+         Omega[m].set(false);
          // insert 1 on the first column
          for (size_t i = 0; i < zNum[m]; i++) {
-            omega[i][0] = true;
+            Omega[m][i][0] = true;
          }
-         Omega.push_back(omega);
-         mat.resize(zNum[m], tNum+1);  // include clutter y0 column
-         Lambda.push_back(mat);
-         mat.resize(zNum[m]+1, tNum+1);   // include no measure z0 row
-         Beta.push_back(mat);
+         m_gating[m].pairs.clear();
+         Beta[m].resize(zNum[m]+1, tNum+1);   // include no measure z0 row
+         Beta[m].set(0.);
       }
       m_bestXsi = 0;
    }
 
+   /**
+    * Gate observation z of sensor m with target t, once at most per pair,
+    * after init() and before the probabilities: Omega and the likelihoods
+    * of the associations are those of the pairs added
+    * @param m Sensor
+    * @param z Observation (0...zNum-1)
+    * @param t Target (1...tNum)
+    * @param logLambda Log likelihood of z for t, e.g. logGauss(s, S)
+    */
+   void addPair(size_t m, size_t z, size_t t, double logLambda) {
+      assert(z < Omega[m].getRows() && t >= 1 && t <= m_tNum);
+      gated_pair_t p = {z, t, logLambda};
+      m_gating[m].pairs.push_back(p);
+   }
+
+   /**
+    * Get the number of gated pairs of a sensor
+    * @param m Sensor
+    * @return Number of pairs added
+    */
+   size_t getPairs(size_t m) const {
+      return m_gating[m].pairs.size();
+   }
+
    /**
     * Calculate all the feasible associations
     * @return Number of associations
     */
    int getAssociations() {
-      vector< size_t> colVec;
-      for (size_t j = 0; j < m_tNum+1; j++) {
-         colVec.push_back(j);
-      }
-
       Association assoc;
 
       for (size_t m = 0; m < m_mNum; m++) {
+         sortPairs(m);
          m_assocVec.clear();
          assoc.clear();
-         getAssociation(0, colVec, assoc, m);
+         m_targetUsed.assign(m_tNum+1, false);
+         getAssociation(0, assoc, m);
          m_xsi.push_back(m_assocVec);
       }
 
@@ -333,7 +468,7 @@ public:
             Association::iterator ai, aiEnd = (*vi)[m].end();
             for (ai = (*vi)[m].begin(); ai != aiEnd; ai++) { // for each association <z,t>
                 if (ai->t) {   // avoid t=0 (clutter case)
-                  logp += Lambda[m][ai->z][ai->t];
+                  logp += logLambda(m, ai->z, ai->t);
                   detected++;
                 }
                 else {
@@ -361,39 +496,70 @@ public:
                Beta[m][ai->z+1][ai->t] += exp(logP[m][j]);
             }
          }
-         // compute beta0
-         for (size_t t = 1; t <= m_tNum; t++) {
-            size_t rows = Beta[m].getRows();
-            double betaSum = 0;
-            for (size_t j = 1; j < rows; j++) {
-               betaSum += Beta[m][j][t];
-            }
-            Beta[m][0][t] = 1.0 - betaSum;
-         }
+         computeBeta0(m);
       }
-      // calculate multisensor association probabilities
-      for (size_t t = 1; t <= m_tNum; t++) {
-         vector< size_t > l(m_beta[t].getSize());
-         vector< size_t > pos(m_mNum);
-         size_t last = pos.size()-1;
-         while (pos[last] < l[last]) {    // scan all the m_beta[t] elements
-            m_beta[t](pos) = 1.0;
-            for (size_t m = 0; m < m_mNum; m++) {
-               m_beta[t](pos) *= Beta[m][pos[m]][t];
-            }  // current element update finished
-            // update position vector
-            pos[0]++;
-            for (size_t i = 0; i < last; i++) {
-               if (pos[i] == l[i]) {   // max coordinated reached
-                  pos[i] = 0;
-                  pos[i+1]++;
-               }
-               else {   // no need to go further
-                  break;
+      computeMultiBeta();
+   }
+
+   /**
+    * The association probabilities of getAssociations() and getProbabilities(),
+    * without the feasible associations Xsi: the observations and targets of a
+    * sensor are split into the clusters of its gating graph (connected by
+    * Omega), and the feasible associations of every cluster are enumerated
+    * on their own, since the probabilities of independent clusters factorise.
+    * The cost is then exponential in the size of the largest cluster only.
+    * A cluster with more than maxHypotheses feasible associations (bound)
+    * only takes the kBest most likely ones, by Murty's algorithm.
+    * @param Pd Target detection probability (default 0.8)
+    * @param C Density of false measurements (default 0.2)
+    * @param maxHypotheses Feasible associations enumerated per cluster (default 10000)
+    * @param kBest Associations of a larger cluster (default 100)
+    */
+   void getClusteredProbabilities(double Pd = 0.8, double C = 0.2, size_t maxHypotheses = 10000, size_t kBest = 100) {
+      m_logC = log(C);
+      m_logPd_1_Pd = log(Pd) - log(1-Pd); // the (1-Pd) of every target cancels out
+      for (size_t m = 0; m < m_mNum; m++) {  // for each sensor
+         sortPairs(m);
+         getClusters(m);
+         for (size_t c = 0; c + 1 < m_clusterRowStart.size(); c++) {
+            m_cRows.assign(m_clusterRows.begin() + m_clusterRowStart[c], m_clusterRows.begin() + m_clusterRowStart[c+1]);
+            m_cTargets.assign(m_clusterTargets.begin() + m_clusterTargetStart[c], m_clusterTargets.begin() + m_clusterTargetStart[c+1]);
+            m_hypTargets.clear();
+            m_hypLogP.clear();
+            // upper bound of the feasible associations, ignoring that a target takes one observation only
+            const Gating& g = m_gating[m];
+            double bound = 1;
+            for (size_t r = 0; r < m_cRows.size() && bound <= maxHypotheses; r++) {
+               bound *= g.rowStart[m_cRows[r]+1] - g.rowStart[m_cRows[r]] + 1;  // clutter included
+            }
+            if (bound <= maxHypotheses) {
+               m_cAssign.resize(m_cRows.size());
+               m_targetUsed.assign(m_tNum+1, false);
+               enumerate(m, 0, 0.);
+            }
+            else {
+               getKBest(m, kBest);
+            }
+            // association probabilities of the cluster
+            double maxLogP = -DBL_MAX, sum = 0;
+            for (size_t h = 0; h < m_hypLogP.size(); h++) {
+               maxLogP = std::max(maxLogP, m_hypLogP[h]);
+            }
+            for (size_t h = 0; h < m_hypLogP.size(); h++) {
+               m_hypLogP[h] = exp(m_hypLogP[h] - maxLogP);
+               sum += m_hypLogP[h];
+            }
+            const size_t rows = m_cRows.size();
+            for (size_t h = 0; h < m_hypLogP.size(); h++) {
+               double p = m_hypLogP[h] / sum;
+               for (size_t r = 0; r < rows; r++) {
+                  Beta[m][m_cRows[r]+1][m_hypTargets[h * rows + r]] += p;
                }
             }
          }
+         computeBeta0(m);
       }
+      computeMultiBeta();
    }
 
    /**
@@ -549,26 +715,65 @@ public:
    }
 
 private:
-   void getAssociation(size_t row, vector< size_t> colVec, Association& assoc, size_t m) {
-      vector< size_t>::iterator ci;
-      for (ci = colVec.begin(); ci != colVec.end(); ci++) {
-         if (Omega[m][row][*ci]) {
-            association_t a = {row, *ci};
-            assoc.push_back(a);
-            if (row >= (Omega[m].getRows() - 1)) {
-               m_assocVec.push_back(assoc);
-               assoc.pop_back();
-            }
-            else {
-               vector< size_t > nextColVec = colVec;
-               if (*ci != 0) {
-                  nextColVec.erase(nextColVec.begin() + (ci - colVec.begin()));
-               }
-               getAssociation(row + 1, nextColVec, assoc, m);
-            }
+   /**
+    * The pairs of sensor m by observation, their targets in increasing
+    * order, by a counting sort, and Omega from them
+    */
+   void sortPairs(size_t m) {
+      Gating& g = m_gating[m];
+      const size_t zNum = Omega[m].getRows(), n = g.pairs.size();
+      g.rowStart.assign(zNum+1, 0);
+      for (size_t p = 0; p < n; p++) {
+         g.rowStart[g.pairs[p].z+1]++;
+      }
+      for (size_t z = 0; z < zNum; z++) {
+         g.rowStart[z+1] += g.rowStart[z];
+      }
+      g.t.resize(n);
+      g.logLambda.resize(n);
+      m_fill.assign(g.rowStart.begin(), g.rowStart.end() - 1);
+      for (size_t p = 0; p < n; p++) {
+         const gated_pair_t& pair = g.pairs[p];
+         size_t q = m_fill[pair.z]++;
+         // insertion into the few pairs of the row, none if added by target
+         for (; q > g.rowStart[pair.z] && g.t[q-1] > pair.t; q--) {
+            g.t[q] = g.t[q-1];
+            g.logLambda[q] = g.logLambda[q-1];
+         }
+         g.t[q] = pair.t;
+         g.logLambda[q] = pair.logLambda;
+         Omega[m][pair.z][pair.t] = true;
+      }
+   }
+
+   /** Log likelihood of a gated pair, of sortPairs(m) */
+   double logLambda(size_t m, size_t z, size_t t) const {
+      const Gating& g = m_gating[m];
+      const size_t* first = &g.t[0] + g.rowStart[z];
+      const size_t* last = &g.t[0] + g.rowStart[z+1];
+      const size_t* p = std::lower_bound(first, last, t);
+      assert(p != last && *p == t);
+      return g.logLambda[p - &g.t[0]];
+   }
+
+   void getAssociation(size_t row, Association& assoc, size_t m) {
+      const size_t cols = Omega[m].getCols();
+      for (size_t t = Omega[m].next(row, 0); t < cols; t = Omega[m].next(row, t+1)) {
+         if (t && m_targetUsed[t]) {
+            continue;
          }
+         association_t a = {row, t};
+         assoc.push_back(a);
+         if (row >= (Omega[m].getRows() - 1)) {
+            m_assocVec.push_back(assoc);
+         }
+         else {
+            m_targetUsed[t] = t != 0;
+            getAssociation(row + 1, assoc, m);
+            m_targetUsed[t] = false;
+         }
+         assoc.pop_back();
       }
-      assoc.pop_back();
    }
    
    void fill(size_t start, size_t end) {
@@ -581,20 +786,302 @@ private:
          }
       }
       else {
-         vector< Matrix< bool > > av;
-         vector< Association >::iterator vi, viEnd = m_assocVec.end();
-         for (vi = m_assocVec.begin(); vi != viEnd; vi++) {
-            Matrix< bool > a(vi->size(), m_tNum);
-            Association::iterator ai, aiEnd = vi->end();
-            for (ai = vi->begin(); ai != aiEnd; ai++) {
-               a[ai->z][ai->t] = true;
+         Xsi.push_back(m_assocVec);
+      }
+   }
+
+   /** Probability of no measure of each target, Beta[m][0] */
+   void computeBeta0(size_t m) {
+      for (size_t t = 1; t <= m_tNum; t++) {
+         size_t rows = Beta[m].getRows();
+         double betaSum = 0;
+         for (size_t j = 1; j < rows; j++) {
+            betaSum += Beta[m][j][t];
+         }
+         Beta[m][0][t] = 1.0 - betaSum;
+      }
+   }
+
+   /** Multisensor association probabilities, from Beta */
+   void computeMultiBeta() {
+      // calculate multisensor association probabilities
+      vector< size_t > l(m_beta.getSize());
+      vector< size_t > pos(m_mNum+1);
+      size_t last = m_mNum;
+      for (size_t t = 1; t <= m_tNum; t++) {
+         std::fill(pos.begin(), pos.end(), 0);
+         pos[0] = t;
+         while (pos[last] < l[last]) {    // scan all the m_beta[t] elements
+            double& beta = m_beta(pos);
+            beta = 1.0;
+            for (size_t m = 0; m < m_mNum; m++) {
+               beta *= Beta[m][pos[m+1]][t];
+            }  // current element update finished
+            // update position vector
+            pos[1]++;
+            for (size_t i = 1; i < last; i++) {
+               if (pos[i] == l[i]) {   // max coordinated reached
+                  pos[i] = 0;
+                  pos[i+1]++;
+               }
+               else {   // no need to go further
+                  break;
+               }
             }
-            av.push_back(a);
          }
-         Xsi.push_back(m_assocVec);
       }
    }
 
+   /**
+    * Clusters of the gating graph of sensor m, by union-find of the
+    * observations (0...zNum-1) and targets (zNum+t-1) of a gated pair;
+    * the clusters with one observation at least are listed, their
+    * observations and targets in increasing order
+    */
+   void getClusters(size_t m) {
+      const size_t zNum = Omega[m].getRows();
+      m_parent.resize(zNum + m_tNum);
+      for (size_t n = 0; n < m_parent.size(); n++) {
+         m_parent[n] = n;
+      }
+      const Gating& g = m_gating[m];
+      for (size_t i = 0; i < zNum; i++) {
+         for (size_t p = g.rowStart[i]; p < g.rowStart[i+1]; p++) {
+            size_t a = findRoot(i), b = findRoot(zNum + g.t[p]-1);
+            if (a != b) {
+               m_parent[std::max(a, b)] = std::min(a, b);
+            }
+         }
+      }
+      // the label of each root, then counting sort by label
+      const size_t none = (size_t)-1;
+      m_label.assign(m_parent.size(), none);
+      size_t clusters = 0;
+      for (size_t i = 0; i < zNum; i++) {
+         size_t r = findRoot(i);
+         if (m_label[r] == none) {
+            m_label[r] = clusters++;
+         }
+      }
+      m_clusterRowStart.assign(clusters+1, 0);
+      m_clusterTargetStart.assign(clusters+1, 0);
+      for (size_t i = 0; i < zNum; i++) {
+         m_clusterRowStart[m_label[findRoot(i)]+1]++;
+      }
+      for (size_t t = 1; t <= m_tNum; t++) {
+         size_t l = m_label[findRoot(zNum + t-1)];
+         if (l != none) {
+            m_clusterTargetStart[l+1]++;
+         }
+      }
+      for (size_t c = 0; c < clusters; c++) {
+         m_clusterRowStart[c+1] += m_clusterRowStart[c];
+         m_clusterTargetStart[c+1] += m_clusterTargetStart[c];
+      }
+      m_clusterRows.resize(zNum);
+      m_clusterTargets.resize(m_clusterTargetStart[clusters]);
+      m_fill.assign(m_clusterRowStart.begin(), m_clusterRowStart.end() - 1);
+      for (size_t i = 0; i < zNum; i++) {
+         m_clusterRows[m_fill[m_label[findRoot(i)]]++] = i;
+      }
+      m_fill.assign(m_clusterTargetStart.begin(), m_clusterTargetStart.end() - 1);
+      for (size_t t = 1; t <= m_tNum; t++) {
+         size_t l = m_label[findRoot(zNum + t-1)];
+         if (l != none) {
+            m_clusterTargets[m_fill[l]++] = t;
+         }
+      }
+   }
+
+   size_t findRoot(size_t n) {
+      while (m_parent[n] != n) {
+         n = m_parent[n] = m_parent[m_parent[n]];  // path halving
+      }
+      return n;
+   }
+
+
+   /** All the feasible associations of the current cluster, from its observation r on */
+   void enumerate(size_t m, size_t r, double logp) {
+      if (r == m_cRows.size()) {
+         m_hypTargets.insert(m_hypTargets.end(), m_cAssign.begin(), m_cAssign.end());
+         m_hypLogP.push_back(logp);
+         return;
+      }
+      const Gating& g = m_gating[m];
+      const size_t z = m_cRows[r];
+      m_cAssign[r] = 0;  // clutter
+      enumerate(m, r+1, logp + m_logC);
+      // observation z with target t, up to a constant of the cluster
+      for (size_t p = g.rowStart[z]; p < g.rowStart[z+1]; p++) {
+         const size_t t = g.t[p];
+         if (!m_targetUsed[t]) {
+            m_targetUsed[t] = true;
+            m_cAssign[r] = t;
+            enumerate(m, r+1, logp + g.logLambda[p] + m_logPd_1_Pd);
+            m_targetUsed[t] = false;
+         }
+      }
+   }
+
+   /** A subproblem of Murty's algorithm and its best assignment */
+   struct MurtyNode {
+      double cost;
+      vector< size_t > assign;                     // column of each row
+      vector< size_t > forced;                     // column of each row, or none
+      vector< pair< size_t, size_t > > forbidden;  // (row, column)
+   };
+
+   /**
+    * The kBest most likely feasible associations of the current cluster, by
+    * Murty's algorithm: its observations are the rows of an assignment
+    * problem, its targets the first columns, and a clutter column per row
+    */
+   void getKBest(size_t m, size_t kBest) {
+      const size_t rows = m_cRows.size(), targets = m_cTargets.size(), cols = targets + rows;
+      const Gating& g = m_gating[m];
+      m_murtyBase.assign(rows * cols, MURTY_BIG);
+      for (size_t r = 0; r < rows; r++) {
+         // the targets of the cluster are in increasing order, as those of a row
+         for (size_t p = g.rowStart[m_cRows[r]], k = 0; p < g.rowStart[m_cRows[r]+1]; p++) {
+            k = std::lower_bound(m_cTargets.begin() + k, m_cTargets.end(), g.t[p]) - m_cTargets.begin();
+            m_murtyBase[r * cols + k] = -(g.logLambda[p] + m_logPd_1_Pd);
+         }
+         m_murtyBase[r * cols + targets + r] = -m_logC;
+      }
+      const size_t none = (size_t)-1;
+      vector< MurtyNode > queue(1);
+      queue[0].forced.assign(rows, none);
+      solveMurty(queue[0], rows, cols);
+      while (!queue.empty() && m_hypLogP.size() < kBest) {
+         size_t best = 0;
+         for (size_t q = 1; q < queue.size(); q++) {
+            if (queue[q].cost < queue[best].cost) {
+               best = q;
+            }
+         }
+         MurtyNode node = queue[best];
+         queue[best] = queue.back();
+         queue.pop_back();
+         if (node.cost >= MURTY_BIG / 2) {  // infeasible
+            continue;
+         }
+         for (size_t r = 0; r < rows; r++) {
+            size_t c = node.assign[r];
+            m_hypTargets.push_back(c < targets ? m_cTargets[c] : 0);
+         }
+         m_hypLogP.push_back(-node.cost);
+         // the partition of the rest of the subproblem, one row at a time
+         MurtyNode child;
+         child.forced = node.forced;
+         child.forbidden = node.forbidden;
+         for (size_t r = 0; r < rows; r++) {
+            if (node.forced[r] != none) {
+               continue;
+            }
+            child.forbidden.push_back(make_pair(r, node.assign[r]));
+            solveMurty(child, rows, cols);
+            if (child.cost < MURTY_BIG / 2) {
+               queue.push_back(child);
+            }
+            child.forbidden.pop_back();
+            child.forced[r] = node.assign[r];
+         }
+      }
+   }
+
+   /** Best assignment of a subproblem of Murty's algorithm */
+   void solveMurty(MurtyNode& node, size_t rows, size_t cols) {
+      const size_t none = (size_t)-1;
+      m_murtyCost = m_murtyBase;
+      for (size_t r = 0; r < rows; r++) {
+         size_t c = node.forced[r];
+         if (c == none) {
+            continue;
+         }
+         for (size_t k = 0; k < cols; k++) {
+            if (k != c) {
+               m_murtyCost[r * cols + k] = MURTY_BIG;
+            }
+         }
+         for (size_t i = 0; i < rows; i++) {
+            if (i != r) {
+               m_murtyCost[i * cols + c] = MURTY_BIG;
+            }
+         }
+      }
+      for (size_t f = 0; f < node.forbidden.size(); f++) {
+         m_murtyCost[node.forbidden[f].first * cols + node.forbidden[f].second] = MURTY_BIG;
+      }
+      node.cost = assign(m_murtyCost, rows, cols, node.assign);
+   }
+
+   /**
+    * Minimum cost assignment of every row to its own column, rows <= cols,
+    * by shortest augmenting paths (Hungarian method)
+    * @return The cost, MURTY_BIG or more if there is no assignment without
+    * an entry of MURTY_BIG
+    */
+   double assign(const vector< double >& cost, size_t rows, size_t cols, vector< size_t >& colOf) {
+      // 1-based, row 0 and column 0 are the virtual start of the paths
+      m_u.assign(rows+1, 0.);
+      m_v.assign(cols+1, 0.);
+      m_p.assign(cols+1, 0);
+      m_way.assign(cols+1, 0);
+      for (size_t i = 1; i <= rows; i++) {
+         m_p[0] = i;
+         size_t j0 = 0;
+         m_minv.assign(cols+1, DBL_MAX);
+         m_colUsed.assign(cols+1, false);
+         do {
+            m_colUsed[j0] = true;
+            size_t i0 = m_p[j0], j1 = 0;
+            double delta = DBL_MAX;
+            for (size_t j = 1; j <= cols; j++) {
+               if (!m_colUsed[j]) {
+                  double cur = cost[(i0-1) * cols + j-1] - m_u[i0] - m_v[j];
+                  if (cur < m_minv[j]) {
+                     m_minv[j] = cur;
+                     m_way[j] = j0;
+                  }
+                  if (m_minv[j] < delta) {
+                     delta = m_minv[j];
+                     j1 = j;
+                  }
+               }
+            }
+            for (size_t j = 0; j <= cols; j++) {
+               if (m_colUsed[j]) {
+                  m_u[m_p[j]] += delta;
+                  m_v[j] -= delta;
+               }
+               else {
+                  m_minv[j] -= delta;
+               }
+            }
+            j0 = j1;
+         } while (m_p[j0] != 0);
+         do {
+            size_t j1 = m_way[j0];
+            m_p[j0] = m_p[j1];
+            j0 = j1;
+         } while (j0);
+      }
+      colOf.resize(rows);
+      double total = 0;
+      for (size_t j = 1; j <= cols; j++) {
+         if (m_p[j]) {
+            colOf[m_p[j]-1] = j-1;
+            double c = cost[(m_p[j]-1) * cols + j-1];
+            if (c >= MURTY_BIG) {
+               return MURTY_BIG;
+            }
+            total += c;
+         }
+      }
+      return total;
+   }
+
    size_t getTargetAssociations(Association& assoc, size_t target) {
       size_t num = 0;
       Association::iterator ai, aiEnd = assoc.end();
@@ -607,10 +1094,8 @@ private:
    }
 
 public:
-   /** Vector of validation matrices, one for each sensor */
+   /** Vector of validation matrices, one for each sensor, of the pairs added */
    vector< Matrix< bool > > Omega;
-   /** Vector of validation matrices, one for each sensor */
-   vector< Matrix< double > > Lambda;
    /** Vector of association matrices, one for each sensor */
    vector< Matrix< double > > Beta;
    /** Vector of feasible matrices, one for each sensor */
@@ -625,6 +1110,27 @@ private:
    vector< vector< Association > > m_xsi;
    size_t m_bestXsi;
    MultiMatrix< double > m_beta;
+   /** Gated pairs of a sensor, and by observation */
+   struct Gating {
+      vector< gated_pair_t > pairs;  // as added
+      vector< size_t > rowStart;     // pairs of observation z at rowStart[z] to rowStart[z+1]
+      vector< size_t > t;            // their targets, increasing
+      vector< double > logLambda;    // and log likelihoods
+   };
+   vector< Gating > m_gating;
+   // workspace of getClusteredProbabilities()
+   double m_logC, m_logPd_1_Pd;
+   vector< size_t > m_parent, m_label, m_fill;
+   vector< size_t > m_clusterRows, m_clusterRowStart;        // observations of each cluster
+   vector< size_t > m_clusterTargets, m_clusterTargetStart;  // and targets
+   vector< size_t > m_cRows, m_cTargets, m_cAssign;         // of the current cluster
+   vector< char > m_targetUsed;
+   vector< size_t > m_hypTargets;                 // target of each observation of each association
+   vector< double > m_hypLogP;                    // and its log probability, then the probability
+   vector< double > m_murtyBase, m_murtyCost;
+   vector< double > m_u, m_v, m_minv;
+   vector< size_t > m_p, m_way;
+   vector< char > m_colUsed;
 };
 
 }  // namespace jpda
@@ -66,6 +66,24 @@ public:
    }
 };
 
+/**
+ * Fast deterministic random numbers for SIR, c.f. Bayesian_filter_test::Xoshiro_random
+ */
+class Xoshiro_random : public SIR_random, public Bayesian_filter_test::Xoshiro_random
+{
+public:
+   using Bayesian_filter_test::Xoshiro_random::normal;
+   void normal (DenseVec& v)
+   {
+      Bayesian_filter_test::Xoshiro_random::normal (v);
+   }
+   using Bayesian_filter_test::Xoshiro_random::uniform_01;
+   void uniform_01 (DenseVec& v)
+   {
+      Bayesian_filter_test::Xoshiro_random::uniform_01 (v);
+   }
+};
+
     //==========================================================================
     //============================== 2D CVModel ================================
     //==========================================================================
@@ -94,6 +112,12 @@ public:
   */
   CVModel(Float wxSD, Float wySD);
 
+  /**
+  * Copy, drawing the noise of fw() from a stream of its own: the copies of
+  * a model, one per thread, do not draw the same numbers
+  */
+  CVModel(const CVModel& m);
+
   /**
   * Definition of sampler for additive noise model given state x
   *  Generate Gaussian correlated samples
@@ -101,6 +125,13 @@ public:
   */
   virtual const FM::Vec& fw(const FM::Vec& x) const;
 
+  /**
+  * fw() of every column of S, in place: the same samples from the same
+  * random numbers, drawn at once
+  * @param S Samples of a particle filter (x_size, samples)
+  */
+  void fw(FM::ColMatrix& S) const;
+
   /** initialise predict given a change to q,G
   *  Implementation: Update rootq
   */
@@ -125,15 +156,27 @@ public:
   */
   void updateJacobian(const FM::Vec& x);
 
+  /**
+  * Seed the noise of fw(), c.f. Xoshiro_random::seed
+  * @param s Seed
+  * @param stream Stream of the seed
+  */
+  void seed(unsigned long long s, unsigned long long stream = 0)
+  {
+    rnd.seed(s, stream);
+  }
+
 private:
   void init();
-  Boost_random rnd;
+  Xoshiro_random rnd;
   SIR_random& genn;
   mutable FM::Vec xp;
   mutable FM::DenseVec n;
+  mutable FM::DenseVec ns;   // noise of all the samples of fw(S)
   mutable FM::Vec rootq;     // Optimisation of sqrt(q) calculation, automatic on first use
   const Float m_wxSD, m_wySD;
   mutable bool first_init;
+  mutable unsigned long long m_copies; // streams of the copies
 };
 
     //==========================================================================
@@ -173,6 +216,13 @@ public:
     li.Lz(*this);
   }
 
+  /**
+  * L() of every column of S, multiplied into w, after Lz()
+  * @param S Samples of a particle filter (x_size, samples)
+  * @param w Their weights
+  */
+  void weight(const FM::ColMatrix& S, FM::DenseVec& w) const;
+
 
   /**
   * Non-linear observation model
@@ -417,6 +467,11 @@ private:
          */
         CVModel3D(Float wxSD, Float wySD, Float wzSD);
 
+        /**
+         * Copy, drawing the noise of fw() from a stream of its own, c.f. CVModel
+         */
+        CVModel3D(const CVModel3D& m);
+
         /**
          * Definition of sampler for additive noise model given state x
          *  Generate Gaussian correlated samples
@@ -448,15 +503,26 @@ private:
          */
         void updateJacobian(const FM::Vec& x);
 
+        /**
+         * Seed the noise of fw(), c.f. Xoshiro_random::seed
+         * @param s Seed
+         * @param stream Stream of the seed
+         */
+        void seed(unsigned long long s, unsigned long long stream = 0)
+        {
+            rnd.seed(s, stream);
+        }
+
     private:
         void init();
-        Boost_random rnd;
+        Xoshiro_random rnd;
         SIR_random& genn;
         mutable FM::Vec xp;
         mutable FM::DenseVec n;
         mutable FM::Vec rootq; // Optimisation of sqrt(q) calculation, automatic on first use
         const Float m_wxSD, m_wySD, m_wzSD;
         mutable bool first_init;
+        mutable unsigned long long m_copies; // streams of the copies
     };
 
 
@@ -537,6 +603,27 @@ private:
     };
 
 
+    //==========================================================================
+    //=================== Sequential Cartesian observation =====================
+    //==========================================================================
+
+/**
+ * Update with an observation of a CartesianModel or CartesianModel3D of
+ * diagonal noise Z, one coordinate after the other: each is a scalar update
+ * of the position it observes, in place, without any matrix inverse or
+ * temporary, and gives the same x and X as the update with the whole z
+ * @param x State of the filter, updated
+ * @param X Its covariance, updated
+ * @param h Observation model
+ * @param z Observation
+ * @param s Innovation of the whole z, about the state before (return)
+ * @param S Its covariance (return, sized as z)
+ * @return False, nothing updated, for another model or a Z not diagonal
+ */
+bool sequential_observe(FM::Vec& x, FM::SymMatrix& X, const Linrz_correlated_observe_model& h,
+                        const FM::Vec& z, FM::Vec& s, FM::SymMatrix& S);
+
+
 } //namespace
 
 
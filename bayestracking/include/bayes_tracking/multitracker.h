@@ -13,43 +13,88 @@
 #include <vector>
 #include <map>
 #include <string>
+#include <utility>
+#include <algorithm>
 #include <iostream>
 #include <boost/numeric/ublas/io.hpp>
 #include <float.h>
+#include <boost/type_traits/integral_constant.hpp>
 
 #include "bayes_tracking/associationmatrix.h"
 #include "bayes_tracking/jpda.h"
+#include "bayes_tracking/trackstore.h"
+#include "bayes_tracking/gridindex.h"
+#include "bayes_tracking/candidatestore.h"
+#include "bayes_tracking/nameregistry.h"
+#include "bayes_tracking/taskpool.h"
 #include "bayes_tracking/BayesFilter/bayesFlt.hpp"
 
 #define OL // online learning (@yz17iros)
 
 using namespace Bayesian_filter;
 
+class EKFilter;
+namespace Models {
+  class CVModel;
+  class CVModel3D;
+  class CartesianModel;
+  class CartesianModel3D;
+}
+
 namespace MTRK {
   
   struct observation_t {
     FM::Vec vec;
     double time;
-    string name;
-    string flag;
+    int name;                             // ids of the detector name and of the flags,
+    int flag;                             // c.f. MultiTracker::name()
     double prob;
     // constructors
-  observation_t() : vec(Empty), time(0.) {}
-  observation_t(FM::Vec v) : vec(v) {}
-  observation_t(FM::Vec v, double t) : vec(v), time(t) {}
-  observation_t(FM::Vec v, double t, string n) : vec(v), time(t), name(n) {}
-  observation_t(FM::Vec v, double t, string n, string f) : vec(v), time(t), name(n), flag(f) {}
-  observation_t(FM::Vec v, double t, string n, string f, double p) : vec(v), time(t), name(n), flag(f), prob(p) {}
+  observation_t() : vec(Empty), time(0.), name(0), flag(0), prob(0.) {}
+  observation_t(FM::Vec v) : vec(v), time(0.), name(0), flag(0), prob(0.) {}
+  observation_t(FM::Vec v, double t) : vec(v), time(t), name(0), flag(0), prob(0.) {}
+  observation_t(FM::Vec v, double t, int n) : vec(v), time(t), name(n), flag(0), prob(0.) {}
+  observation_t(FM::Vec v, double t, int n, int f) : vec(v), time(t), name(n), flag(f), prob(0.) {}
+  observation_t(FM::Vec v, double t, int n, int f, double p) : vec(v), time(t), name(n), flag(f), prob(p) {}
   };
   
   typedef std::vector<observation_t> sequence_t;
-  typedef enum {NN, /*JPDA,*/ NNJPDA} association_t;
+  typedef enum {NN, /*JPDA,*/ NNJPDA, HUNGARIAN, AUCTION} association_t;
   typedef enum {CARTESIAN, POLAR, BEARING} observ_model_t;
   
+  /**
+   * Filters whose prediction with a model is the same linear one for all,
+   * x = Fx*x and X = Fx*X*Fx' + G*q*G': MultiTracker predicts them all at
+   * once, c.f. TrackStore
+   */
+  template<class FilterType, class PredictionModelType>
+    struct linear_prediction : boost::false_type {};
+  
+  template<>
+    struct linear_prediction<EKFilter, Models::CVModel> : boost::true_type {};
+  
+  template<>
+    struct linear_prediction<EKFilter, Models::CVModel3D> : boost::true_type {};
+  
+  /**
+   * Observation models whose normalise() does nothing: the innovations of
+   * all the observations with a filter are then computed at once, from
+   * arrays, c.f. AssociationMatrix::mahalanobis2
+   */
+  template<class ObservationModelType>
+    struct additive_innovation : boost::false_type {};
+  
+  template<>
+    struct additive_innovation<Models::CartesianModel> : boost::true_type {};
+  
+  template<>
+    struct additive_innovation<Models::CartesianModel3D> : boost::true_type {};
+  
   // to be defined by user
   template<class FilterType>
     extern bool isLost(const FilterType* filter, double stdLimit = 1.0);
   
+  // filter is a filter of a lost track to initialize again, or NULL for a new one
   template<class FilterType>
     extern bool initialize(FilterType* &filter, sequence_t& obsvSeq, observ_model_t om_flag);
   
@@ -63,26 +108,77 @@ namespace MTRK {
     typedef struct {
       unsigned long id;
       FilterType* filter;
-      string detector;
-      string sampleID;
+      int detector;                       // ids of the detector name and of the flags
+      int sampleID;                       // of its last observation, c.f. name()
       double probability;
     } filter_t;
     
   private:
     std::vector<filter_t> m_filters;
+    std::vector<FilterType*> m_pool;      // filters of lost tracks, reused by new ones
     long unsigned int m_filterNum;
-    sequence_t m_observations;            // observations
+    sequence_t m_observations;            // observations, the first m_observationNum, the others kept for their storage
+    size_t m_observationNum;
     std::vector<size_t> m_unmatched;      // unmatched observations
-    std::map<int, int> m_assignments;     // assignment < observation, target >
-    std::vector<sequence_t> m_sequences;  // vector of unmatched observation sequences
+    std::vector<std::pair<int, int> > m_assignments; // assignment < observation, target >, by observation
+    CandidateStore m_candidates;          // sequences of unmatched observations
+    NameRegistry m_names;                 // detector names and flags of all of them
+    size_t m_namesLimit;                  // size of m_names compacted beyond
+    gate_t m_gate;                        // of the association and of the sequences
+#ifdef MTRK_STATS
+    unsigned long m_gated;                // observation-filter pairs rejected by the gates
+#endif
+    TrackStore<xSize> m_store;            // states and covariances of a batched prediction
+    FM::SymMatrix m_Q;                    // its noise covariance
+    // workspace of the data association, reused by every one
+    AssociationMatrix m_amat;             // measures of the observation-filter pairs
+    jpda::JPDA* m_jpda;                   // NNJPDA, created by the first one
+    std::vector<size_t> m_znum;           // its number of observations of each sensor
+    std::vector<jpda::Association> m_jpdaAssociations; // and its result
+    FM::Vec m_zp, m_s;                    // predicted observation and innovation
+    FM::SymMatrix m_Zp, m_S;              // their covariances
+    std::vector<double> m_z;              // observations, element k of observation i at [k * M + i]
+    std::vector<double> m_d2;             // and their squared Mahalanobis distances with a filter
+    std::vector<double> m_zps, m_Ss;      // predicted observations and their covariances, of all the filters, the covariances element by element
+    std::vector<double> m_halfWidth;      // half widths of their gates
+    GridIndex m_grid;                     // observations by cell
+    std::vector<GridIndex::range_t> m_ranges; // those near a gate
+    // workspace of the creation of tracks
+    std::vector<int> m_near;              // sequences near an unmatched observation
+    sequence_t m_sequence;                // and one of them creating a track
+    // parallel phases, c.f. setParallel()
+    TaskPool* m_tasks;                    // NULL when serial
+    size_t m_parallelMin;                 // fewest filters of a parallel phase
+    std::vector<std::pair<int, int> > m_byFilter; // < target, assignment >, by target
+    std::vector<size_t> m_groups;         // first of every target in m_byFilter, and the end
+    std::vector<char> m_lost;             // isLost() of every filter
+    
+    /**
+     * Position in the plane of the observations, for GridIndex
+     */
+    struct ObservationPosition {
+      const sequence_t& observations;
+      ObservationPosition(const sequence_t& observations) : observations(observations) {}
+      double operator()(size_t i, int k) const
+      {
+	return observations[i].vec[k];
+      }
+    };
     
   public:
     /**
      * Constructor
      */
-    MultiTracker()
+    MultiTracker() : m_Q(xSize, xSize), m_jpda(NULL), m_zp(Empty), m_s(Empty), m_Zp(Empty), m_S(Empty), m_tasks(NULL)
       {
 	m_filterNum = 0;
+	m_observationNum = 0;
+	m_namesLimit = 1024;
+	m_gate = GATE_99;
+	m_parallelMin = 32;
+#ifdef MTRK_STATS
+	m_gated = 0;
+#endif
       }
     
     /**
@@ -93,19 +189,102 @@ namespace MTRK {
 	typename std::vector<filter_t>::iterator fi, fiEnd = m_filters.end();
 	for (fi = m_filters.begin(); fi != fiEnd; fi++)
 	  delete fi->filter;
+	for (size_t i = 0; i < m_pool.size(); i++)
+	  delete m_pool[i];
+	delete m_jpda;
+	delete m_tasks;
       }
     
     /**
-     * Add a new observation
+     * Set the size of the gates, those of the data association and those
+     * extending the sequences of unmatched observations alike
+     * @param confidence Probability that the gate of a track holds its observation (default GATE_99)
+     */
+    void setGate(gate_t confidence)
+    {
+      m_gate = confidence;
+    }
+    
+    /**
+     * Run the prediction, the update and the removal of the filters on a
+     * pool of threads, which share the filters out, whenever there are
+     * enough filters to make up for handing them out, and one after the
+     * other otherwise. The filters then must not share anything but the
+     * models, of which every thread has its own copy, made by its copy
+     * constructor as the type of the argument; isLost() must only read its
+     * filter. The batched prediction of linear_prediction stays serial, as
+     * the data association and the creation of tracks.
+     * The results are those of the serial steps, but for the random numbers
+     * of the particle filters, which then depend on the thread.
+     * @param threads Number of threads, the calling one included, 0 for one per hardware thread, 1 to be serial
+     * @param minFilters Fewest filters for a phase to run in parallel
+     */
+    void setParallel(size_t threads = 0, size_t minFilters = 32)
+    {
+      delete m_tasks;
+      m_tasks = NULL;
+      if (threads != 1) {
+	m_tasks = new TaskPool(threads);
+	if (m_tasks->size() == 1) {
+	  delete m_tasks;
+	  m_tasks = NULL;
+	}
+      }
+      m_parallelMin = std::max(minFilters, (size_t)2);
+    }
+    
+    /**
+     * Add a new observation, into the storage of a previous one: it does not
+     * allocate once there were as many observations of the same size
      * @param z    Observation vector
      * @param time Timestamp
-     * @param name Detector name
-     * @param flag Additional flags
+     * @param name Id of the detector name, c.f. nameId()
+     * @param flag Id of the additional flags
      * @param prob Observation probability
      */
-    void addObservation(const FM::Vec& z, double time, string name = "", string flag = "", double prob = 0)
+    void addObservation(const FM::Vec& z, double time, int name = 0, int flag = 0, double prob = 0)
     {
-      m_observations.push_back(observation_t(z, time, name, flag, prob));
+      if (m_observationNum == m_observations.size())
+	m_observations.push_back(observation_t());
+      observation_t& o = m_observations[m_observationNum++];
+      if (o.vec.size() != z.size())
+	o.vec.resize(z.size(), false);
+      o.vec = z;
+      o.time = time;
+      o.name = name;
+      o.flag = flag;
+      o.prob = prob;
+    }
+    
+    /**
+     * As addObservation(z, time, nameId(name), nameId(flag), prob)
+     */
+    void addObservation(const FM::Vec& z, double time, const string& name, const string& flag = "", double prob = 0)
+    {
+      addObservation(z, time, nameId(name), nameId(flag), prob);
+    }
+    
+    /**
+     * Id of a detector name or of flags, for addObservation(): it is the
+     * same for the same string until the next update() at least, which may
+     * renumber those no longer used
+     * @param name Detector name or flags
+     * @return The id, 0 for an empty string
+     */
+    int nameId(const string& name)
+    {
+      return m_names.id(name);
+    }
+    
+    /**
+     * Detector name or flags of an id, as those of filter_t, a string
+     * resolved only when it is shown
+     * @param id Id of an observation or a filter
+     * @return The string, valid until the next update()
+     */
+    const string& name(int id) const
+    {
+      return m_names.name(id);
     }
     
     /**
@@ -114,7 +293,7 @@ namespace MTRK {
     void cleanup()
     {
       // clean current vectors
-      m_observations.clear();
+      m_observationNum = 0;
       m_assignments.clear();
     }
     
@@ -144,17 +323,14 @@ namespace MTRK {
     template<class PredictionModelType>
       void predict(PredictionModelType& pm)
       {
-	typename std::vector<filter_t>::iterator fi, fiEnd = m_filters.end();
-	for (fi = m_filters.begin(); fi != fiEnd; fi++) {
-	  fi->filter->predict(pm);
-	}
+	predict(pm, linear_prediction<FilterType, PredictionModelType>());
       }
     
     /**
      * Perform data association and update step for all the current filters, create new ones and remove those which are no more necessary
      * @param om Observation model
      * @param om_flag Observation model flag (CARTESIAN or POLAR)
-     * @param alg Data association algorithm (NN or NNJPDA)
+     * @param alg Data association algorithm (NN, NNJPDA, HUNGARIAN or AUCTION)
      * @param seqSize Minimum number of observations necessary for new track creation
      * @param seqTime Minimum interval between observations for new track creation
      * @param stdLimit Upper limit for the standard deviation of the estimated position
@@ -162,16 +338,44 @@ namespace MTRK {
     template<class ObservationModelType>
       void process(ObservationModelType& om, observ_model_t om_flag = CARTESIAN, association_t alg = NN, unsigned int seqSize = 5, double seqTime = 0.2, double stdLimit = 1.0)
       {
-	// data association
-	if (dataAssociation(om, alg)) {
-	  // update
+	bool associated = associate(om, alg);
+	update(om, associated, om_flag, seqSize, seqTime, stdLimit);
+      }
+    
+    /**
+     * First half of process(): data association of the current observations with the current filters
+     * @param om Observation model
+     * @param alg Data association algorithm (NN, NNJPDA, HUNGARIAN or AUCTION)
+     * @return True if there are assignments to update the filters with
+     */
+    template<class ObservationModelType>
+      bool associate(ObservationModelType& om, association_t alg = NN)
+      {
+	return dataAssociation(om, alg);
+      }
+    
+    /**
+     * Second half of process(): update step, removal of lost filters and creation of new ones
+     * @param om Observation model
+     * @param associated Result of associate()
+     * @param om_flag Observation model flag (CARTESIAN or POLAR)
+     * @param seqSize Minimum number of observations necessary for new track creation
+     * @param seqTime Minimum interval between observations for new track creation
+     * @param stdLimit Upper limit for the standard deviation of the estimated position
+     */
+    template<class ObservationModelType>
+      void update(ObservationModelType& om, bool associated, observ_model_t om_flag = CARTESIAN, unsigned int seqSize = 5, double seqTime = 0.2, double stdLimit = 1.0)
+      {
+	if (associated) {
 	  observe(om);
 	}
 	pruneTracks(stdLimit);
-	if (m_observations.size())
+	if (m_observationNum)
 	  createTracks(om, om_flag, seqSize, seqTime);
 	// finished
 	cleanup();
+	if (m_names.size() > m_namesLimit)
+	  compactNames();
       }
     
     /**
@@ -182,6 +386,86 @@ namespace MTRK {
       return &m_unmatched;
     }
     
+    /**
+     * Number of candidate sequences of unmatched observations
+     */
+    size_t sequences() const
+    {
+      return m_candidates.size();
+    }
+    
+    /**
+     * Id of the next new track
+     */
+    unsigned long nextId() const
+    {
+      return m_filterNum;
+    }
+    
+    /**
+     * Make the new tracks get this id at least, e.g. those after a checkpoint
+     * @param id Lowest id of the next new track
+     */
+    void setNextId(unsigned long id)
+    {
+      m_filterNum = std::max(m_filterNum, id);
+    }
+    
+    /**
+     * Add a track as it was, e.g. from a checkpoint: the filter, already
+     * initialized, then belongs to the tracker
+     * @param id Id of the track, the new tracks get higher ones
+     * @param filter Its filter
+     * @param detector Id of the detector name of its last observation, c.f. nameId()
+     * @param sampleID Id of its flags
+     * @param probability Its probability
+     */
+    void restoreTrack(unsigned long id, FilterType* filter, int detector = 0, int sampleID = 0, double probability = 0)
+    {
+      filter_t f = {id, filter, detector, sampleID, probability};
+      m_filters.push_back(f);
+      m_filterNum = std::max(m_filterNum, id + 1);
+    }
+    
+    /**
+     * Copy the candidate sequences of unmatched observations, in the order
+     * they were started, e.g. for a checkpoint
+     * @param seqs The sequences, resized: the observations keep their storage
+     */
+    void getSequences(std::vector<sequence_t>& seqs)
+    {
+      m_candidates.sequences(m_near);
+      seqs.resize(m_near.size());
+      for (size_t k = 0; k < m_near.size(); k++)
+	copySequence(m_near[k], seqs[k]);
+    }
+    
+    /**
+     * Add a candidate sequence as it was, e.g. from a checkpoint
+     * @param seq Its observations, oldest first, with ids of nameId()
+     */
+    void restoreSequence(const sequence_t& seq)
+    {
+      if (seq.empty())
+	return;
+      const int dim = seq[0].vec.size();
+      if (m_candidates.dim() != dim)
+	m_candidates.reset(dim, 1.); // hashed again for the gates by the next extendSequences()
+      const int q = m_candidates.add(seq[0].vec, seq[0].time, seq[0].prob, seq[0].name, seq[0].flag);
+      for (size_t i = 1; i < seq.size(); i++)
+	m_candidates.extend(q, seq[i].vec, seq[i].time, seq[i].prob, seq[i].name, seq[i].flag);
+    }
+    
+#ifdef MTRK_STATS
+    /**
+     * Number of observation-filter pairs rejected by the gates so far (built with MTRK_STATS only)
+     */
+    unsigned long gated() const
+    {
+      return m_gated;
+    }
+#endif
+    
     /**
      * Print state and covariance of all the current filters
      */
@@ -195,10 +479,102 @@ namespace MTRK {
     }
     
   private:
+    /** Enough filters for a phase to run in parallel */
+    bool parallel(size_t n) const
+    {
+      return m_tasks && n >= m_parallelMin;
+    }
+    
+    template<class PredictionModelType>
+      struct PredictTask : TaskPool::Task {
+	std::vector<filter_t>& filters;
+	WorkerCopies<PredictionModelType> models;
+	PredictTask(std::vector<filter_t>& filters, PredictionModelType& pm, size_t workers) :
+	  filters(filters), models(pm, workers) {}
+	void operator()(size_t i, size_t worker)
+	{
+	  filters[i].filter->predict(models[worker]);
+	}
+      };
+    
+    /**
+     * The assignments of a filter, in the order of the observations, then
+     * those of the next filter
+     */
+    template<class ObservationModelType>
+      struct ObserveTask : TaskPool::Task {
+	MultiTracker& mtrk;
+	WorkerCopies<ObservationModelType> models;
+	ObserveTask(MultiTracker& mtrk, ObservationModelType& om, size_t workers) :
+	  mtrk(mtrk), models(om, workers) {}
+	void operator()(size_t g, size_t worker)
+	{
+	  for (size_t k = mtrk.m_groups[g]; k < mtrk.m_groups[g + 1]; k++)
+	    mtrk.observe(models[worker], mtrk.m_assignments[mtrk.m_byFilter[k].second]);
+	}
+      };
+    
+    struct LostTask : TaskPool::Task {
+      MultiTracker& mtrk;
+      double stdLimit;
+      LostTask(MultiTracker& mtrk, double stdLimit) : mtrk(mtrk), stdLimit(stdLimit) {}
+      void operator()(size_t i, size_t)
+      {
+	mtrk.m_lost[i] = isLost(mtrk.m_filters[i].filter, stdLimit);
+      }
+    };
+    
+    template<class PredictionModelType>
+      void predict(PredictionModelType& pm, boost::false_type)
+      {
+	if (parallel(m_filters.size())) {
+	  PredictTask<PredictionModelType> task(m_filters, pm, m_tasks->size());
+	  m_tasks->run(task, m_filters.size());
+	  return;
+	}
+	typename std::vector<filter_t>::iterator fi, fiEnd = m_filters.end();
+	for (fi = m_filters.begin(); fi != fiEnd; fi++) {
+	  fi->filter->predict(pm);
+	}
+      }
+    
+    /**
+     * The prediction of filter->predict(pm), for all the filters at once
+     */
+    template<class PredictionModelType>
+      void predict(PredictionModelType& pm, boost::true_type)
+      {
+	const size_t n = m_filters.size();
+	if (n == 0)
+	  return;
+	pm.updateJacobian(m_filters[0].filter->x); // the same for all filters
+	for (int i = 0; i < xSize; i++) {
+	  for (int j = i; j < xSize; j++) {
+	    double q = 0.;
+	    for (size_t k = 0; k < pm.q.size(); k++)
+	      q += pm.G(i,k) * pm.q[k] * pm.G(j,k);
+	    m_Q(i,j) = q;
+	  }
+	}
+	m_store.resize(n);
+	for (size_t t = 0; t < n; t++)
+	  m_store.load(t, m_filters[t].filter->x, m_filters[t].filter->X);
+	m_store.predict(pm.Fx, m_Q);
+	for (size_t t = 0; t < n; t++)
+	  m_store.store(t, m_filters[t].filter->x, m_filters[t].filter->X);
+      }
+    
     void addFilter(const FM::Vec& initState, const FM::SymMatrix& initCov)
     {
-      FilterType* filter = new FilterType(xSize);
-      filter.init(initState, initCov);
+      FilterType* filter;
+      if (m_pool.empty()) {
+	filter = new FilterType(xSize);
+      }
+      else {
+	filter = m_pool.back();
+	m_pool.pop_back();
+      }
+      filter->init(initState, initCov);
       addFilter(filter);
     }
     
@@ -211,80 +587,67 @@ namespace MTRK {
     template<class ObservationModelType>
       bool dataAssociation(ObservationModelType& om, association_t alg = NN)
       {
-	const size_t M = m_observations.size(), N = m_filters.size();
+	const size_t M = m_observationNum, N = m_filters.size();
 	
 	if (M == 0) // no observation, do nothing
 	  return false;
 	
 	if (N != 0) { // observations and tracks, associate
-	  jpda::JPDA* jpda;
-	  vector< size_t > znum; // this would contain the number of observations for each sensor
+	  jpda::JPDA* jpda = NULL;
 	  if (alg == NNJPDA) { /// NNJPDA data association (one sensor)
-	    znum.push_back(M); // only one in this case
-	    jpda = new jpda::JPDA(znum, N);
+	    m_znum.assign(1, M); // only one in this case
+	    if (m_jpda == NULL)
+	      m_jpda = new jpda::JPDA(m_znum, N);
+	    else
+	      m_jpda->init(m_znum, N);
+	    jpda = m_jpda;
 	  }
 	  
-	  AssociationMatrix amat(M, N);
+	  AssociationMatrix& amat = m_amat;
 	  int dim = om.z_size;
-	  Vec zp(dim), s(dim);
-	  SymMatrix Zp(dim, dim), S(dim, dim);
-	  for (int j = 0; j < N; j++) {
-	    m_filters[j].filter->predict_observation(om, zp, Zp);
-	    S = Zp + om.Z; // H*P*H' + R
-	    for (int i = 0; i < M; i++) {
-	      s = zp - m_observations[i].vec;
-	      om.normalise(s, zp);
-	      try {
-		if (AM::mahalanobis(s, S) > AM::gate(s.size())) {
-		  amat[i][j] = DBL_MAX; // gating
-		}
-		else {
-		  amat[i][j] = AM::correlation_log(s, S);
-		  if (alg == NNJPDA) {
-		    jpda->Omega[0][i][j+1] = true;
-		    jpda->Lambda[0][i][j+1] = jpda::logGauss(s, S);
-		  }
-		}
-	      } catch (Bayesian_filter::Filter_exception& e) {
-		cerr << "###### Exception in AssociationMatrix #####\n";
-		cerr << "Message: " << e.what() << endl;
-		amat[i][j] = DBL_MAX;  // set to maximum
-	      }
-	    }
-	  }
+	  resizeWorkspace(dim);
+	  if (additive_innovation<ObservationModelType>::value && dim >= 2)
+	    gateNearby(om, jpda);
+	  else
+	    gateAll(om, jpda);
 	  
-	  if (alg == NN) { /// NN data association
-	    amat.computeNN(CORRELATION_LOG);
+	  if (alg == NN || alg == HUNGARIAN || alg == AUCTION) { /// NN or optimal data association
+	    if (alg == NN)
+	      amat.computeNN(CORRELATION_LOG);
+	    else if (alg == HUNGARIAN)
+	      amat.computeHungarian(CORRELATION_LOG);
+	    else
+	      amat.computeAuction(CORRELATION_LOG);
 	    // record unmatched observations for possible candidates creation
 	    m_unmatched = amat.URow;
 	    // data assignment
 	    for (size_t n = 0; n < amat.NN.size(); n++) {
-	      m_assignments.insert(std::make_pair(amat.NN[n].row, amat.NN[n].col));
+	      m_assignments.push_back(std::make_pair(amat.NN[n].row, amat.NN[n].col));
 	    }
 	  }
 	  else if (alg == NNJPDA) { /// NNJPDA data association (one sensor)
 	    // compute associations
-	    jpda->getAssociations();
-	    jpda->getProbabilities();
-	    vector< jpda::Association > association(znum.size());
-	    jpda->getMultiNNJPDA(association);
-	    // jpda->getMonoNNJPDA(association);
+	    jpda->getClusteredProbabilities();
+	    m_jpdaAssociations.resize(m_znum.size());
+	    m_jpdaAssociations[0].clear();
+	    jpda->getMultiNNJPDA(m_jpdaAssociations);
+	    // jpda->getMonoNNJPDA(m_jpdaAssociations);
 	    // data assignment
-	    jpda::Association::iterator ai, aiEnd = association[0].end();
-	    for (ai = association[0].begin(); ai != aiEnd; ai++) {
+	    jpda::Association::iterator ai, aiEnd = m_jpdaAssociations[0].end();
+	    for (ai = m_jpdaAssociations[0].begin(); ai != aiEnd; ai++) {
 	      if (ai->t) { // not a clutter
-		m_assignments.insert(std::make_pair(ai->z, ai->t - 1));
+		m_assignments.push_back(std::make_pair(ai->z, ai->t - 1));
 	      }
 	      else { // add clutter to unmatched list
 		m_unmatched.push_back(ai->z);
 	      }
 	    }
-	    delete jpda;
 	  }
 	  else {
 	    cerr << "###### Unknown association algorithm: " << alg << " #####\n";
 	    return false;
 	  }
+	  std::sort(m_assignments.begin(), m_assignments.end()); // update in the order of the observations
 	  
 	  return true;
 	}
@@ -295,20 +658,179 @@ namespace MTRK {
 	return false;
       }
     
+    void resizeWorkspace(int dim)
+    {
+      if (m_zp.size() != dim) {
+	m_zp.resize(dim, false);
+	m_s.resize(dim, false);
+	m_Zp.resize(dim, dim, false);
+	m_S.resize(dim, dim, false);
+      }
+    }
+    
+    /**
+     * Fill the association matrix with the measures of all the
+     * observation-filter pairs, and the JPDA if any
+     */
+    template<class ObservationModelType>
+      void gateAll(ObservationModelType& om, jpda::JPDA* jpda)
+      {
+	const size_t M = m_observationNum, N = m_filters.size();
+	const int dim = om.z_size;
+	const double gate = ChiSquareGate<ObservationModelType::z_size>::value(m_gate), gate2 = gate * gate;
+	const double logNorm = (double)dim * log(2*M_PI);
+	AssociationMatrix& amat = m_amat;
+	amat.setSize(M, N);
+	for (int j = 0; j < N; j++) {
+	  m_filters[j].filter->predict_observation(om, m_zp, m_Zp);
+	  FM::noalias(m_S) = m_Zp + om.Z; // H*P*H' + R
+	  try {
+	    amat.setInnovationCovariance(m_S); // once for all the observations
+	  } catch (Bayesian_filter::Filter_exception& e) {
+	    cerr << "###### Exception in AssociationMatrix #####\n";
+	    cerr << "Message: " << e.what() << endl;
+	    for (int i = 0; i < M; i++)
+	      amat[i][j] = DBL_MAX;  // set to maximum
+	    continue;
+	  }
+	  for (int i = 0; i < M; i++) {
+	    FM::noalias(m_s) = m_zp - m_observations[i].vec;
+	    om.normalise(m_s, m_zp);
+	    const double d2 = amat.mahalanobis2(m_s);
+	    if (d2 > gate2) {
+	      amat[i][j] = DBL_MAX; // gating
+#ifdef MTRK_STATS
+	      m_gated++;
+#endif
+	    }
+	    else {
+	      amat[i][j] = d2 + amat.logDetS(); // correlation_log
+	      if (jpda) // jpda::logGauss(s, S) from the same distance
+		jpda->addPair(0, i, j+1, -0.5 * (amat[i][j] + logNorm));
+	    }
+	  }
+	}
+      }
+    
+    /**
+     * As gateAll(), for an observation model whose first two elements are a
+     * position in the plane: only the observations in the cells of a grid
+     * around the gate of a filter are measured, and the association matrix is
+     * sparse, so the time depends on the observations per filter, not on all.
+     * With the JPDA, the gated pairs go to its list only, which it sorts by
+     * observation for its clusters, the matrix is not consumed
+     */
+    template<class ObservationModelType>
+      void gateNearby(ObservationModelType& om, jpda::JPDA* jpda)
+      {
+	const size_t M = m_observationNum, N = m_filters.size();
+	const int dim = om.z_size;
+	const double gate = ChiSquareGate<ObservationModelType::z_size>::value(m_gate), gate2 = gate * gate;
+	const double logNorm = (double)dim * log(2*M_PI);
+	AssociationMatrix& amat = m_amat;
+	// the predicted observations first, for the size of the cells
+	m_zps.resize(dim * N);
+	m_Ss.resize(dim * dim * N);
+	m_halfWidth.resize(N);
+	for (size_t j = 0; j < N; j++) {
+	  m_filters[j].filter->predict_observation(om, m_zp, m_Zp);
+	  FM::noalias(m_S) = m_Zp + om.Z; // H*P*H' + R
+	  for (int k = 0; k < dim; k++) {
+	    m_zps[j * dim + k] = m_zp[k];
+	    for (int l = k; l < dim; l++)
+	      m_Ss[(k * dim + l) * N + j] = m_S(k,l);
+	  }
+	  m_halfWidth[j] = gate * std::sqrt(std::max(m_S(0,0), m_S(1,1)));
+	}
+	std::nth_element(m_halfWidth.begin(), m_halfWidth.begin() + N / 2, m_halfWidth.end());
+	m_grid.build(M, ObservationPosition(m_observations), 2. * m_halfWidth[N / 2]);
+	// the observations as arrays, in the order of the grid
+	m_z.resize(dim * M);
+	for (size_t p = 0; p < M; p++)
+	  for (int k = 0; k < dim; k++)
+	    m_z[k * M + p] = m_observations[m_grid[p]].vec[k];
+	m_d2.resize(M);
+	
+	amat.setSparse(M, N);
+	amat.setInnovationCovariances(&m_Ss[0], dim, N); // all the filters at once
+#ifdef MTRK_STATS
+	size_t failed = 0;
+#endif
+	for (size_t j = 0; j < N; j++) {
+	  for (int k = 0; k < dim; k++)
+	    m_zp[k] = m_zps[j * dim + k];
+	  try {
+	    amat.selectInnovationCovariance(j);
+	  } catch (Bayesian_filter::Filter_exception& e) {
+	    cerr << "###### Exception in AssociationMatrix #####\n";
+	    cerr << "Message: " << e.what() << endl;
+#ifdef MTRK_STATS
+	    failed++;
+#endif
+	    continue;
+	  }
+	  // the bounding box of the gate
+	  const double hx = gate * std::sqrt(m_Ss[j]), hy = gate * std::sqrt(m_Ss[(dim + 1) * N + j]);
+	  m_grid.query(m_zp[0] - hx, m_zp[0] + hx, m_zp[1] - hy, m_zp[1] + hy, m_ranges);
+	  for (size_t r = 0; r < m_ranges.size(); r++) {
+	    const size_t first = m_ranges[r].first, n = m_ranges[r].second - first;
+	    amat.mahalanobis2(m_zp, &m_z[first], M, n, &m_d2[first]);
+	    for (size_t p = first; p < first + n; p++) {
+	      if (m_d2[p] > gate2) // gating
+		continue;
+	      const size_t i = m_grid[p];
+	      const double c = m_d2[p] + amat.logDetS(); // correlation_log
+	      if (jpda) // jpda::logGauss(s, S) from the same distance, the matrix left empty
+		jpda->addPair(0, i, j+1, -0.5 * (c + logNorm));
+	      else
+		amat.set(i, j, c);
+	    }
+	  }
+	}
+#ifdef MTRK_STATS
+	m_gated += (M * N - (jpda ? jpda->getPairs(0) : amat.getEntries())) - M * failed;
+#endif
+      }
+    
     void pruneTracks(double stdLimit = 1.0)
     {
-      // remove lost tracks
-      typename std::vector<filter_t>::iterator fi = m_filters.begin(), fiEnd = m_filters.end();
-      while (fi != fiEnd) {
-	if (isLost(fi->filter, stdLimit)) {
-	  delete fi->filter;
-	  fi = m_filters.erase(fi);
-	  fiEnd = m_filters.end();
+      // remove lost tracks, their filters kept for new ones
+      const bool par = parallel(m_filters.size());
+      if (par) {
+	m_lost.resize(m_filters.size());
+	LostTask task(*this, stdLimit);
+	m_tasks->run(task, m_filters.size());
+      }
+      size_t kept = 0;
+      for (size_t i = 0; i < m_filters.size(); i++) {
+	if (par ? m_lost[i] != 0 : isLost(m_filters[i].filter, stdLimit)) {
+	  m_pool.push_back(m_filters[i].filter);
 	}
 	else {
-	  fi++;
+	  if (kept != i)
+	    m_filters[kept] = m_filters[i];
+	  kept++;
 	}
       }
+      m_filters.resize(kept);
+    }
+    
+    /**
+     * initialize() a filter for a sequence of observations, a filter of a
+     * lost track if there is one
+     */
+    bool createFilter(FilterType* &filter, sequence_t& obsvSeq, observ_model_t om_flag)
+    {
+      FilterType* recycled = m_pool.empty() ? NULL : m_pool.back();
+      filter = recycled;
+      if (!initialize(filter, obsvSeq, om_flag))
+	return false;
+      if (recycled) {
+	m_pool.pop_back();
+	if (filter != recycled) // initialize() made a new one anyway
+	  delete recycled;
+      }
+      return true;
     }
     
     // seqSize = Minimum number of unmatched observations to create new track hypothesis
@@ -317,68 +839,176 @@ namespace MTRK {
       void createTracks(ObservationModelType& om, observ_model_t om_flag, unsigned int seqSize, double seqTime)
       {
 	// create new tracks from unmatched observations
-	std::vector<size_t>::iterator ui = m_unmatched.begin();
-	while (ui != m_unmatched.end()) {
-	  std::vector<sequence_t>::iterator si = m_sequences.begin();
+	extendSequences(om, om_flag, seqSize, seqTime);
+	// memorize remaining unmatched observations
+	std::vector<size_t>::iterator ui, uiEnd = m_unmatched.end();
+	for (ui = m_unmatched.begin() ; ui != uiEnd; ui++) {
+	  const observation_t& o = m_observations[*ui];
+	  m_candidates.add(o.vec, o.time, o.prob, o.name, o.flag);
+	}
+	// reset vector of (indexes of) unmatched observations
+	m_unmatched.clear();
+      }
+    
+    /**
+     * Extend the sequences with the unmatched observations close to their
+     * last ones, create the tracks of those long enough and remove them and
+     * the old ones; the unmatched observations creating a track are removed.
+     * Every observation, in their order, first removes the sequences too old
+     * for it, then extends those close to it, found in the cells of the
+     * candidate store around it: the observations and the sequences compared
+     * are those of the comparison of every pair, in the same order, and so
+     * are the tracks created.
+     */
+    template<class ObservationModelType>
+      void extendSequences(ObservationModelType& om, observ_model_t om_flag, unsigned int seqSize, double seqTime)
+      {
+	const size_t U = m_unmatched.size();
+	if (U == 0)
+	  return;
+	const int dim = om.z_size;
+	const double gate = ChiSquareGate<ObservationModelType::z_size>::value(m_gate), gate2 = gate * gate;
+	resizeWorkspace(dim);
+	FM::noalias(m_S) = om.Z + om.Z;
+	m_amat.setInnovationCovariance(m_S); // the same for every pair
+	// the box of the gate, in the elements of the observations as they are (without normalise())
+	const double hx = gate * std::sqrt(m_S(0,0)), hy = dim > 1 ? gate * std::sqrt(m_S(1,1)) : 0.;
+	m_candidates.reset(dim, std::max(hx, hy));
+	
+	size_t kept = 0;
+	for (size_t k = 0; k < U; k++) {
+	  const observation_t& o = m_observations[m_unmatched[k]];
+	  m_candidates.expire(o.time, seqTime); // erase old unmatched observations
+	  m_candidates.near(o.vec[0], dim > 1 ? o.vec[1] : 0., hx, hy, m_near);
 	  bool matched = false;
-	  while (si != m_sequences.end()) {
-	    if (m_observations[*ui].time - si->back().time > seqTime) { // erase old unmatched observations
-	      si = m_sequences.erase(si);
-	    }
-	    else if (AM::mahalanobis(m_observations[*ui].vec, om.Z, si->back().vec, om.Z) <= AM::gate(om.z_size)) { // observation close to a previous one
-	      // add new track
-	      si->push_back(m_observations[*ui]);
-	      FilterType* filter;
-	      if (si->size() >= seqSize && initialize(filter, *si, om_flag)) {  // there's a minimum number of sequential observations
-		addFilter(filter);
+	  for (size_t n = 0; n < m_near.size(); n++) {
+	    const int q = m_near[n];
+	    const double* last = m_candidates.values(m_candidates.last(q));
+	    for (int i = 0; i < dim; i++)
+	      m_s[i] = o.vec[i] - last[i];
+	    if (m_amat.mahalanobis2(m_s) > gate2)
+	      continue;
+	    // observation close to a previous one
+	    m_candidates.extend(q, o.vec, o.time, o.prob, o.name, o.flag);
+	    if (m_candidates.length(q) < seqSize)
+	      continue;
+	    // there's a minimum number of sequential observations, add new track
+	    copySequence(q, m_sequence);
+	    FilterType* filter;
+	    if (createFilter(filter, m_sequence, om_flag)) {
+	      addFilter(filter);
 #ifdef OL
-		m_filters.back().detector = si->back().name;
-		m_filters.back().sampleID = si->back().flag;
-		m_filters.back().probability = si->back().prob;
+	      m_filters.back().detector = o.name;
+	      m_filters.back().sampleID = o.flag;
+	      m_filters.back().probability = o.prob;
 #endif
-		// remove sequence
-		si = m_sequences.erase(si);
-		matched = true;
-	      }
-	      else {
-		si++;
-	      }
-	    }
-	    else {
-	      si++;
+	      m_candidates.remove(q);
+	      matched = true;
 	    }
 	  }
-	  if (matched) {
-	    // remove from unmatched list
-	    ui = m_unmatched.erase(ui);
-	  }
-	  else {
-	    ui++;
-	  }
+	  if (!matched) // keep in unmatched list
+	    m_unmatched[kept++] = m_unmatched[k];
 	}
-	// memorize remaining unmatched observations
-	std::vector<size_t>::iterator uiEnd = m_unmatched.end();
-	for (ui = m_unmatched.begin() ; ui != uiEnd; ui++) {
-	  sequence_t s;
-	  s.push_back(m_observations[*ui]);
-	  m_sequences.push_back(s);
-	}
-	// reset vector of (indexes of) unmatched observations
-	m_unmatched.clear();
+	m_unmatched.resize(kept);
       }
     
+    /**
+     * Register again only the names of the filters and of the candidate
+     * sequences, once the registry has twice as many as the last time:
+     * flags unique to every detection do not make it grow without bound
+     */
+    void compactNames()
+    {
+      NameRegistry names;
+      NameMap map(m_names, names);
+      typename std::vector<filter_t>::iterator fi, fiEnd = m_filters.end();
+      for (fi = m_filters.begin(); fi != fiEnd; fi++) {
+	fi->detector = map(fi->detector);
+	fi->sampleID = map(fi->sampleID);
+      }
+      m_candidates.remapNames(map);
+      m_names.swap(names);
+      m_namesLimit = std::max((size_t)1024, 2 * m_names.size());
+    }
+    
+    /**
+     * Id of a registry to that of the same string in another one
+     */
+    struct NameMap {
+      const NameRegistry& from;
+      NameRegistry& to;
+      std::vector<int> ids;               // in to of the ids of from, -1 if not yet
+      NameMap(const NameRegistry& from, NameRegistry& to) : from(from), to(to), ids(from.size(), -1) {}
+      int operator()(int id)
+      {
+	if (id <= 0 || (size_t)id >= ids.size())
+	  return 0;
+	if (ids[id] < 0)
+	  ids[id] = to.id(from.name(id));
+	return ids[id];
+      }
+    };
+    
+    /**
+     * The observations of a sequence of the candidate store, for initialize()
+     */
+    void copySequence(int q, sequence_t& seq)
+    {
+      seq.resize(m_candidates.length(q));
+      int r = m_candidates.first(q);
+      for (size_t i = 0; i < seq.size(); i++, r = m_candidates.record(r).next) {
+	observation_t& o = seq[i];
+	const CandidateStore::record_t& c = m_candidates.record(r);
+	const double* z = m_candidates.values(r);
+	if (o.vec.size() != (size_t)m_candidates.dim())
+	  o.vec.resize(m_candidates.dim(), false);
+	for (size_t k = 0; k < o.vec.size(); k++)
+	  o.vec[k] = z[k];
+	o.time = c.time;
+	o.name = c.name;
+	o.flag = c.flag;
+	o.prob = c.prob;
+      }
+    }
+    
     template<class ObservationModelType>
       void observe(ObservationModelType& om)
       {
-	typename std::map<int, int>::iterator ai, aiEnd = m_assignments.end();
-	for (ai = m_assignments.begin(); ai != aiEnd; ai++) {
-	  m_filters[ai->second].filter->observe(om, m_observations[ai->first].vec);
+	if (parallel(m_assignments.size())) {
+	  // every filter by one thread, with its observations in their order
+	  m_byFilter.resize(m_assignments.size());
+	  for (size_t a = 0; a < m_assignments.size(); a++)
+	    m_byFilter[a] = std::make_pair(m_assignments[a].second, (int)a);
+	  std::sort(m_byFilter.begin(), m_byFilter.end());
+	  m_groups.clear();
+	  for (size_t k = 0; k < m_byFilter.size(); k++) {
+	    if (k == 0 || m_byFilter[k].first != m_byFilter[k - 1].first)
+	      m_groups.push_back(k);
+	  }
+	  m_groups.push_back(m_byFilter.size());
+	  ObserveTask<ObservationModelType> task(*this, om, m_tasks->size());
+	  m_tasks->run(task, m_groups.size() - 1);
+	  return;
+	}
+	std::vector<std::pair<int, int> >::iterator ai, aiEnd = m_assignments.end();
+	for (ai = m_assignments.begin(); ai != aiEnd; ai++)
+	  observe(om, *ai);
+      }
+    
+    /**
+     * Update the filter of an assignment < observation, target >
+     */
+    template<class ObservationModelType>
+      void observe(ObservationModelType& om, const std::pair<int, int>& assignment)
+      {
+	filter_t& f = m_filters[assignment.second];
+	const observation_t& o = m_observations[assignment.first];
+	f.filter->observe(om, o.vec);
 #ifdef OL
-	  m_filters[ai->second].detector = m_observations[ai->first].name;
-	  m_filters[ai->second].sampleID = m_observations[ai->first].flag;
-	  m_filters[ai->second].probability = m_observations[ai->first].prob;
+	f.detector = o.name;
+	f.sampleID = o.flag;
+	f.probability = o.prob;
 #endif
-	}
       }
   };
 } // namespace MTRK
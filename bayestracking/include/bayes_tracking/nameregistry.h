@@ -0,0 +1,81 @@
+//
+// C++ Interface: nameregistry
+//
+// Description: Strings interned as small integers, for the detector names
+// and flags of MultiTracker
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+#ifndef NAMEREGISTRY_H
+#define NAMEREGISTRY_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <cstddef>
+
+namespace MTRK {
+
+  /**
+   * Every string registered once and kept with an id, 0 for the empty one:
+   * copying and comparing names is then copying and comparing integers, and
+   * a string is only looked up again to be shown. The ids of a registry never
+   * change, nor the strings they refer to.
+   */
+  class NameRegistry {
+
+  public:
+    NameRegistry()
+    {
+      m_names.push_back(std::string());
+      m_ids[m_names[0]] = 0;
+    }
+
+    /**
+     * Id of a string, registered if it is not yet
+     * @param name String
+     * @return Its id
+     */
+    int id(const std::string& name)
+    {
+      std::map<std::string, int>::const_iterator it = m_ids.find(name);
+      if (it != m_ids.end())
+	return it->second;
+      const int i = (int)m_names.size();
+      m_names.push_back(name);
+      m_ids[name] = i;
+      return i;
+    }
+
+    /**
+     * String of an id
+     * @param id Id of id(...)
+     * @return The string, empty for an unknown id
+     */
+    const std::string& name(int id) const
+    {
+      return id > 0 && (size_t)id < m_names.size() ? m_names[id] : m_names[0];
+    }
+
+    void swap(NameRegistry& registry)
+    {
+      m_names.swap(registry.m_names);
+      m_ids.swap(registry.m_ids);
+    }
+
+    /**
+     * Number of strings, the empty one included
+     */
+    size_t size() const
+    {
+      return m_names.size();
+    }
+
+  private:
+    std::vector<std::string> m_names;     // string of each id
+    std::map<std::string, int> m_ids;     // and the id of each string
+  };
+
+} // namespace MTRK
+
+#endif
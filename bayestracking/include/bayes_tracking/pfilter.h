@@ -22,6 +22,7 @@
 
 #include "bayes_tracking/BayesFilter/SIRFlt.hpp"
 #include "bayes_tracking/BayesFilter/random.hpp"
+#include <vector>
 
 
 using namespace Bayesian_filter;
@@ -48,6 +49,24 @@ public:
    }
 };
 
+class Xoshiro_random : public SIR_random, public Bayesian_filter_test::Xoshiro_random
+/*
+* Fast deterministic random numbers for SIR, the default ones of PFilter
+*/
+{
+public:
+   using Bayesian_filter_test::Xoshiro_random::normal;
+   void normal (DenseVec& v)
+   {
+      Bayesian_filter_test::Xoshiro_random::normal (v);
+   }
+   using Bayesian_filter_test::Xoshiro_random::uniform_01;
+   void uniform_01 (DenseVec& v)
+   {
+      Bayesian_filter_test::Xoshiro_random::uniform_01 (v);
+   }
+};
+
 }  // namespace
 
 
@@ -135,12 +154,36 @@ public:
                            
   /**
     * Perform correction of the predicted state according to the observation.
+    * The particles are resampled only once their effective sample size is below
+    * resampleThreshold (default 0.5) of them, their weights are kept until then.
     * @param observe_model Observation model
     * @param z Current observation
     */
    void observe(Likelihood_observe_model& observe_model,
                 const FM::Vec& z);
 
+   /**
+    * Adapt the number of samples to the posterior at every resampling (KLD-sampling):
+    * as many as bound the Kullback-Leibler divergence of the sample distribution to
+    * the posterior on a histogram over the state, from the bins the samples occupy.
+    * Between minSamples and the number of samples of the constructor, which init()
+    * restores.
+    * @param bins Side of the bins along every state element, 0 to ignore an element
+    * @param minSamples Fewest samples
+    * @param epsilon Bound of the Kullback-Leibler divergence
+    * @param z Upper 1-delta quantile of the standard normal distribution, the bound holding with probability 1-delta
+    */
+   void setAdaptiveSamples(const FM::Vec& bins,
+                           std::size_t minSamples = 50,
+                           double epsilon = 0.05,
+                           double z = 2.326);
+
+   /**
+    * Number of samples after the resampling, KLD-sampling if set
+    * @return Number of samples
+    */
+   std::size_t resample_size();
+
 //    void roughen()
 //    // Generalised roughening:  Default to roughen_minmax
 //    {
@@ -148,6 +191,19 @@ public:
 //          roughen_minmax (S, rougheningK);
 //    }
    
+   /**
+    * Seed the random numbers of the resampling and the roughening, those of
+    * the constructors without random_helper: the same seed and stream drawing
+    * the same numbers, independent ones for different streams, e.g. one per
+    * filter for results reproducible whatever thread runs which filter
+    * @param s Seed
+    * @param stream Stream of the seed
+    */
+   void seed(unsigned long long s, unsigned long long stream = 0)
+   {
+      rnd.seed(s, stream);
+   }
+
    /**
     * Return the logarithm of the likelihhod for the last observation
     * @return Logarithm of the likelihood
@@ -160,8 +216,13 @@ public:
 
 private:
    std::size_t x_size;
-   PF::Boost_random rnd;
+   PF::Xoshiro_random rnd;
    double m_likelihood;
+   std::size_t m_maxSamples;           // samples of the constructor
+   std::size_t m_minSamples;
+   std::vector<Float> m_bins;          // KLD-sampling bins, none if not adaptive
+   double m_epsilon, m_z;
+   std::vector<std::size_t> m_binTable; // hash set of the occupied bins
 };
 
 #endif
@@ -20,347 +20,401 @@
 #ifndef SYNCHRONIZER_H
 #define SYNCHRONIZER_H
 
-#include <iostream>
 #include <vector>
-#include <deque>
-#include <cstdlib>
-#include <string>
-#include <fstream>
-
-using namespace std;
-
-/**
-*	@author Nicola Bellotto <nbello@essex.ac.uk>
-*  Class to synchronize data from odometry, sonar, laser and camera
-*/
-template <class odometry_t, class sonar_t, class laser_t, class camera_t >
-class Synchronizer {
-
-   typedef pair< odometry_t, double > odometry_pair;
-   typedef pair< sonar_t, double > sonar_pair;
-   typedef pair< laser_t, double > laser_pair;
-   typedef pair< camera_t, double > camera_pair;
-
-private:
-   deque< odometry_pair > m_odometryQueue;
-   deque< sonar_pair > m_sonarQueue;
-   deque< laser_pair > m_laserQueue;
-   deque< camera_pair > m_cameraQueue;
-   
-   double m_odometryTimeStamp;
-   double m_sonarTimeStamp;
-   double m_laserTimeStamp;
-   double m_cameraTimeStamp;
-   
-   double m_maxTimeGap;
-   double m_syncTime;
-   
-   odometry_pair m_syncOdometry;
-   sonar_pair m_syncSonar;
-   laser_pair m_syncLaser;
-   camera_pair m_syncCamera;
-
-public:
-
-   /**
-    * Constructor
-    */
-   Synchronizer(double maxTimeGap) {
-      m_maxTimeGap = maxTimeGap;
-      reset();
-   }
-
-   /**
-    * Destructor
-    */
-   ~Synchronizer() {}
-   
-   /**
-    * Return current synchronization time
-    * @return Synchronization time
-    */
-   double getSyncTime() { return m_syncTime; }
-    
-   /**
-    * Get synchronized odometry data
-    * @return Data
-    */
-   odometry_t getOdometryData() { return m_syncOdometry.first; }
-   
-   /**
-    * Get timestamp of synchronized odometry data
-    * @return Timestamp
-    */
-   double getOdometryTime() { return m_syncOdometry.second; }
-   
-   /**
-    * Get synchronized sonar data
-    * @return Data
-    */
-   sonar_t getSonarData() { return m_syncSonar.first; }
-   
-   /**
-    * Get timestamp of synchronized sonar data
-    * @return Timestamp
-    */
-   double getSonarTime() { return m_syncSonar.second; }
-   
-   /**
-    * Get synchronized laser data
-    * @return Data
-    */
-   laser_t getLaserData() { return m_syncLaser.first; }
-   
-   /**
-    * Get timestamp of synchronized laser data
-    * @return Timestamp
-    */
-   double getLaserTime() { return m_syncLaser.second; }
-   
-   /**
-    * Get synchronized camera data
-    * @return Data
-    */
-   camera_t getCameraData() { return m_syncCamera.first; }
-   
-   /**
-    * Get timestamp of synchronized camera data
-    * @return Timestamp
-    */
-   double getCameraTime() { return m_syncCamera.second; }
-
-   /**
-    * Add new odometry data to the queue
-    * @param data Data
-    * @param timeStamp Timestamp
-    * @return False if new timestamp <= current timestamp
-    */
-   bool addOdometry(odometry_t data, double timeStamp) {
-      if (timeStamp > m_odometryTimeStamp)
-      {  // queue new odometry with timestamp
-         m_odometryQueue.push_front(make_pair(data, timeStamp));
-         m_odometryTimeStamp = timeStamp;
-         return true;
-      }
-      return false;
-   }
-
-   /**
-    * Add new sonar data to the queue
-    * @param data Data
-    * @param timeStamp Timestamp
-    * @return False if new timestamp <= current timestamp
-    */
-   bool addSonar(sonar_t data, double timeStamp) {
-      if (timeStamp > m_sonarTimeStamp)
-      {  // queue new frames with timestamp
-         m_sonarQueue.push_front(make_pair(data, timeStamp));
-         m_sonarTimeStamp = timeStamp;
-         return true;
-      }
-      return false;
-   }
-
-   /**
-    * Add new laser data to the queue
-    * @param data Data
-    * @param timeStamp Timestamp
-    * @return False if new timestamp <= current timestamp
-    */
-   bool addLaser(laser_t data, double timeStamp) {
-      if (timeStamp > m_laserTimeStamp)
-      {  // queue new laser data with timestamp
-         m_laserQueue.push_front(make_pair(data, timeStamp));
-         m_laserTimeStamp = timeStamp;
-         return true;
-      }
-      return false;
-   }
-
-   /**
-    * Add new camera data to the queue
-    * @param data Data
-    * @param timeStamp Timestamp
-    * @return False if new timestamp <= current timestamp
-    */
-   bool addCamera(camera_t data, double timeStamp) {
-      if (timeStamp > m_cameraTimeStamp)
-      {  // queue new frames with timestamp
-         m_cameraQueue.push_front(make_pair(data, timeStamp));
-         m_cameraTimeStamp = timeStamp;
-         return true;
-      }
-      return false;
-   }
-   
-   /**
-    * Synchronize data
-    * @return False if one or more empty queues, or if timestamps \
-    * are too different to synchronize data
-    */
-   bool synchronize() {
-      // get the minimum timestamp as reference
-      double ref_timestamp =
-         std::min(std::min(m_odometryTimeStamp, m_sonarTimeStamp),
-                  std::min(m_laserTimeStamp, m_cameraTimeStamp));
-      if (ref_timestamp == m_syncTime) {
-         return false;
+#include <algorithm>
+#include <cstddef>
+#include <cmath>
+#include <boost/atomic.hpp>
+
+namespace MTRK {
+
+  /**
+   * Data of a sensor at a stamp between those of two readings, a + (b - a) * w,
+   * for StampRing::interpolate(...); specialise it for data that does not
+   * change linearly, as pose2d_t
+   */
+  template<class T>
+    struct Interpolation {
+      static T between(const T& a, const T& b, double w)
+      {
+	return a + (b - a) * w;
       }
-      else {
-         m_syncTime = ref_timestamp;
+    };
+
+  /**
+   * Odometry pose in the plane
+   */
+  struct pose2d_t {
+    double x, y, theta;
+    pose2d_t(double x = 0., double y = 0., double theta = 0.) : x(x), y(y), theta(theta) {}
+  };
+
+  template<>
+    struct Interpolation<pose2d_t> {
+      static pose2d_t between(const pose2d_t& a, const pose2d_t& b, double w)
+      {
+	// the shortest turn from a to b
+	const double dtheta = std::atan2(std::sin(b.theta - a.theta), std::cos(b.theta - a.theta));
+	return pose2d_t(a.x + (b.x - a.x) * w, a.y + (b.y - a.y) * w,
+			std::atan2(std::sin(a.theta + dtheta * w), std::cos(a.theta + dtheta * w)));
       }
-      
-      if (m_odometryQueue.empty() ||
-          m_sonarQueue.empty() ||
-          m_laserQueue.empty() ||
-          m_cameraQueue.empty()) {
-         return false;   // not enough data, go back to get new
+    };
+
+  /**
+   * The readings of a sensor of a Synchronizer, whatever their type
+   */
+  class StampRingBase {
+
+  public:
+    virtual ~StampRingBase() {}
+
+    /**
+     * Stamp of the newest reading, -1 if none
+     */
+    virtual double newest() const = 0;
+
+    /**
+     * Select the reading of a synchronisation and drop those it no longer needs
+     * @param stamp Synchronisation time
+     * @param maxTimeGap Largest distance of the reading from stamp
+     * @return False if none is close enough
+     */
+    virtual bool select(double stamp, double maxTimeGap) = 0;
+
+    /**
+     * Drop every reading, with the producer stopped
+     */
+    virtual void clear() = 0;
+  };
+
+  /**
+   * The last readings of a sensor and their stamps, in a ring of fixed
+   * capacity without lock for one producer, the thread of the sensor, which
+   * push()es readings, and one consumer, the thread using them, which calls
+   * every other method. The readings are in the order of their stamps, so a
+   * stamp is looked up by bisection. A reading pushed into a full ring is
+   * dropped, not the oldest one, which the consumer may be reading: the
+   * capacity should hold the readings of the largest delay of the consumer.
+   */
+  template<class T>
+    class StampRing : public StampRingBase {
+
+  public:
+    /**
+     * Constructor
+     * @param capacity Largest number of readings
+     */
+    explicit StampRing(size_t capacity) :
+      m_syncStamp(-1.), m_data(capacity + 1), m_stamps(capacity + 1),
+      m_head(0), m_tail(0), m_last(-1.), m_dropped(0) {}
+
+    /**
+     * Add a reading, producer side
+     * @param data Reading
+     * @param stamp Its stamp
+     * @return False if stamp is not newer than that of the last reading, or
+     * if the ring is full
+     */
+    bool push(const T& data, double stamp)
+    {
+      if (!(stamp > m_last))
+	return false;
+      const size_t head = m_head.load(boost::memory_order_relaxed), next = (head + 1) % m_stamps.size();
+      if (next == m_tail.load(boost::memory_order_acquire)) {
+	m_dropped.fetch_add(1, boost::memory_order_relaxed);
+	return false;
       }
-         
-      bool noReading = false;
-      // retrieve odometry with timestamp similar to reference
-      typename deque< odometry_pair >::iterator
-         oi = m_odometryQueue.begin(), prev_oi = oi;
-      while ((oi != m_odometryQueue.end()) && (oi->second > ref_timestamp))
-         prev_oi = oi++;
-      {
-         double dt2 = prev_oi->second - ref_timestamp;
-         if (oi != m_odometryQueue.end()) {
-            double dt1 = ref_timestamp - oi->second;
-            if ((dt1 < dt2) && (dt1 <= m_maxTimeGap)) {
-               m_syncOdometry = *oi;
-               m_odometryQueue.erase(oi, m_odometryQueue.end());
-            }
-            else if (dt2 <= m_maxTimeGap) {
-               m_syncOdometry = *prev_oi;
-               m_odometryQueue.erase(prev_oi, m_odometryQueue.end());
-            }
-            else {
-               noReading = true;
-               m_odometryQueue.erase(oi, m_odometryQueue.end());
-            }
-         }
-         else if (dt2 <= m_maxTimeGap) {
-            m_syncOdometry = *prev_oi;
-//             m_odometryQueue.erase(prev_oi, m_odometryQueue.end());
-         }
-         else {
-            noReading = true;
-         }
+      m_data[head] = data;
+      m_stamps[head] = stamp;
+      m_head.store(next, boost::memory_order_release); // the consumer sees the reading from here on
+      m_last = stamp;
+      return true;
+    }
+
+    /**
+     * Number of readings
+     */
+    size_t size() const
+    {
+      return (m_head.load(boost::memory_order_acquire) + m_stamps.size() - m_tail.load(boost::memory_order_relaxed)) % m_stamps.size();
+    }
+
+    /**
+     * Number of readings dropped by push(...) with the ring full
+     */
+    unsigned long dropped() const
+    {
+      return m_dropped.load(boost::memory_order_relaxed);
+    }
+
+    virtual double newest() const
+    {
+      const size_t n = size();
+      return n ? stampAt(n - 1) : -1.;
+    }
+
+    /**
+     * Reading nearest to a stamp, the newer one of two as near
+     * @param stamp Stamp
+     * @param maxTimeGap Largest distance from stamp
+     * @param data Reading
+     * @param at Its stamp
+     * @return False if none is close enough
+     */
+    bool nearest(double stamp, double maxTimeGap, T& data, double& at) const
+    {
+      const size_t n = size();
+      if (n == 0)
+	return false;
+      const size_t i = lowerBound(stamp, n); // the first one not older than stamp
+      size_t k;
+      if (i == n)
+	k = n - 1;
+      else if (i == 0)
+	k = 0;
+      else
+	k = stamp - stampAt(i - 1) < stampAt(i) - stamp ? i - 1 : i;
+      if (std::fabs(stampAt(k) - stamp) > maxTimeGap)
+	return false;
+      data = dataAt(k);
+      at = stampAt(k);
+      return true;
+    }
+
+    /**
+     * Reading at a stamp, interpolated by Interpolation<T> between the
+     * readings around it if they are at most 2 * maxTimeGap apart, otherwise
+     * the nearest one
+     * @param stamp Stamp
+     * @param maxTimeGap Largest distance of the nearest reading from stamp
+     * @param data Reading
+     * @param at Its stamp, stamp itself if interpolated
+     * @return False if none is close enough
+     */
+    bool interpolate(double stamp, double maxTimeGap, T& data, double& at) const
+    {
+      const size_t n = size();
+      const size_t i = lowerBound(stamp, n);
+      if (i > 0 && i < n && stampAt(i) > stamp && stampAt(i) - stampAt(i - 1) <= 2. * maxTimeGap) {
+	const double w = (stamp - stampAt(i - 1)) / (stampAt(i) - stampAt(i - 1));
+	data = Interpolation<T>::between(dataAt(i - 1), dataAt(i), w);
+	at = stamp;
+	return true;
       }
-      // retrieve sonar with timestamp similar to reference
-      typename deque< sonar_pair >::iterator
-         si = m_sonarQueue.begin(), prev_si = si;
-      while ((si != m_sonarQueue.end()) && (si->second > ref_timestamp))
-         prev_si = si++;
-      {
-         double dt2 = prev_si->second - ref_timestamp;
-         if (si != m_sonarQueue.end()) {
-            double dt1 = ref_timestamp - si->second;
-            if ((dt1 < dt2) && (dt1 <= m_maxTimeGap)) {
-               m_syncSonar = *si;
-               m_sonarQueue.erase(si, m_sonarQueue.end());
-            }
-            else if (dt2 <= m_maxTimeGap) {
-               m_syncSonar = *prev_si;
-               m_sonarQueue.erase(prev_si, m_sonarQueue.end());
-            }
-            else {
-               noReading = true;
-               m_sonarQueue.erase(si, m_sonarQueue.end());
-            }
-         }
-         else if (dt2 <= m_maxTimeGap) {
-            m_syncSonar = *prev_si;
-//             m_sonarQueue.erase(prev_si, m_sonarQueue.end());
-         }
-         else {
-            noReading = true;
-         }
+      return nearest(stamp, maxTimeGap, data, at);
+    }
+
+    /**
+     * Drop the readings older than a stamp but the newest of them, still
+     * needed to interpolate at a later stamp
+     * @param stamp Stamp
+     */
+    void discard(double stamp)
+    {
+      const size_t i = lowerBound(stamp, size());
+      if (i > 1)
+	m_tail.store((m_tail.load(boost::memory_order_relaxed) + i - 1) % m_stamps.size(), boost::memory_order_release);
+    }
+
+    virtual bool select(double stamp, double maxTimeGap)
+    {
+      const bool found = nearest(stamp, maxTimeGap, m_sync, m_syncStamp);
+      discard(stamp);
+      return found;
+    }
+
+    virtual void clear()
+    {
+      m_tail.store(m_head.load(boost::memory_order_acquire), boost::memory_order_release);
+      m_last = m_syncStamp = -1.;
+    }
+
+    /**
+     * Reading of the last synchronisation, Synchronizer::synchronize()
+     */
+    const T& synced() const
+    {
+      return m_sync;
+    }
+
+    /**
+     * Its stamp, -1 if none yet
+     */
+    double syncedStamp() const
+    {
+      return m_syncStamp;
+    }
+
+  protected:
+    const T& dataAt(size_t i) const
+    {
+      return m_data[(m_tail.load(boost::memory_order_relaxed) + i) % m_data.size()];
+    }
+
+    double stampAt(size_t i) const
+    {
+      return m_stamps[(m_tail.load(boost::memory_order_relaxed) + i) % m_stamps.size()];
+    }
+
+    /**
+     * First of the n oldest readings not older than stamp, n if none
+     */
+    size_t lowerBound(double stamp, size_t n) const
+    {
+      size_t first = 0;
+      while (n > 0) {
+	const size_t half = n / 2;
+	if (stampAt(first + half) < stamp) {
+	  first += half + 1;
+	  n -= half + 1;
+	}
+	else
+	  n = half;
       }
-      // retrieve laser with timestamp similar to reference
-      typename deque< laser_pair >::iterator
-         li = m_laserQueue.begin(), prev_li = li;
-      while ((li != m_laserQueue.end()) && (li->second > ref_timestamp))
-         prev_li = li++;
+      return first;
+    }
+
+    T m_sync;                             // reading of the last synchronisation
+    double m_syncStamp;                   // and its stamp
+
+  private:
+    StampRing(const StampRing&);
+    StampRing& operator=(const StampRing&);
+
+    std::vector<T> m_data;                // readings, one slot more than the capacity
+    std::vector<double> m_stamps;         // and their stamps, apart for the bisection
+    boost::atomic<size_t> m_head;         // next slot, written by the producer
+    boost::atomic<size_t> m_tail;         // oldest reading, written by the consumer
+    double m_last;                        // stamp of the last reading, of the producer
+    boost::atomic<unsigned long> m_dropped;
+  };
+
+  /**
+   * A StampRing whose reading of a synchronisation is interpolated at its
+   * time, as odometry between two poses
+   */
+  template<class T>
+    class InterpolatedStampRing : public StampRing<T> {
+
+  public:
+    explicit InterpolatedStampRing(size_t capacity) : StampRing<T>(capacity) {}
+
+    virtual bool select(double stamp, double maxTimeGap)
+    {
+      const bool found = this->interpolate(stamp, maxTimeGap, this->m_sync, this->m_syncStamp);
+      this->discard(stamp);
+      return found;
+    }
+  };
+
+  /**
+   * Readings of any number of sensors aligned in time: each sensor has a
+   * StampRing its thread pushes its readings into, and synchronize() selects
+   * the reading of every sensor nearest to the newest time all of them
+   * reached, or interpolated at that time for an InterpolatedStampRing
+   */
+  class Synchronizer {
+
+  public:
+    /**
+     * Constructor
+     * @param maxTimeGap Largest distance of a selected reading from the
+     * synchronisation time, in the unit of the stamps
+     */
+    explicit Synchronizer(double maxTimeGap) : m_maxTimeGap(maxTimeGap), m_syncTime(-1.) {}
+
+    /**
+     * Destructor, deleting the rings
+     */
+    ~Synchronizer()
+    {
+      for (size_t s = 0; s < m_rings.size(); s++)
+	delete m_rings[s];
+    }
+
+    /**
+     * Add a sensor, before its readings are pushed
+     * @param capacity Largest number of readings waiting
+     * @return The ring of its readings, owned by the synchronizer
+     */
+    template<class T>
+      StampRing<T>& addSensor(size_t capacity)
       {
-         double dt2 = prev_li->second - ref_timestamp;
-         if (li != m_laserQueue.end()) {
-            double dt1 = ref_timestamp - li->second;
-            if ((dt1 < dt2) && (dt1 <= m_maxTimeGap)) {
-               m_syncLaser = *li;
-               m_laserQueue.erase(li, m_laserQueue.end());
-            }
-            else if (dt2 <= m_maxTimeGap) {
-               m_syncLaser = *prev_li;
-               m_laserQueue.erase(prev_li, m_laserQueue.end());
-            }
-            else {
-               noReading = true;
-               m_laserQueue.erase(li, m_laserQueue.end());
-            }
-         }
-         else if (dt2 <= m_maxTimeGap) {
-            m_syncLaser = *prev_li;
-//             m_laserQueue.erase(prev_li, m_laserQueue.end());
-         }
-         else {
-            noReading = true;
-         }
+	StampRing<T>* ring = new StampRing<T>(capacity);
+	m_rings.push_back(ring);
+	return *ring;
       }
-      // retrieve frame with timestamp similar to reference
-      typename deque< camera_pair >::iterator
-         ci = m_cameraQueue.begin(), prev_ci = ci;
-      while ((ci != m_cameraQueue.end()) && (ci->second > ref_timestamp))
-         prev_ci = ci++;
+
+    /**
+     * As addSensor(capacity), the readings interpolated at the synchronisation time
+     */
+    template<class T>
+      StampRing<T>& addInterpolatedSensor(size_t capacity)
       {
-         double dt2 = prev_ci->second - ref_timestamp;
-         if (ci != m_cameraQueue.end()) {
-            double dt1 = ref_timestamp - ci->second;
-            if ((dt1 < dt2) && (dt1 <= m_maxTimeGap)) {
-               m_syncCamera = *ci;
-               m_cameraQueue.erase(ci, m_cameraQueue.end());
-            }
-            else if (dt2 <= m_maxTimeGap) {
-               m_syncCamera = *prev_ci;
-               m_cameraQueue.erase(prev_ci, m_cameraQueue.end());
-            }
-            else {
-               noReading = true;
-               m_cameraQueue.erase(ci, m_cameraQueue.end());
-            }
-         }
-         else if (dt2 <= m_maxTimeGap) {
-            m_syncCamera = *prev_ci;
-//             m_cameraQueue.erase(prev_ci, m_cameraQueue.end());
-         }
-         else {
-            noReading = true;
-         }
+	StampRing<T>* ring = new InterpolatedStampRing<T>(capacity);
+	m_rings.push_back(ring);
+	return *ring;
       }
-      
-      if (noReading)
-         return false;
-         
-      return true;
-   }
-   
-   /**
-    * Reset data queues
-    */
-   void reset() {
-      // clear queues
-      m_odometryQueue.clear();
-      m_sonarQueue.clear();
-      m_laserQueue.clear();
-      m_cameraQueue.clear();
-      // reset timestamps
-      m_odometryTimeStamp = -1.;
-      m_sonarTimeStamp = -1.;
-      m_laserTimeStamp = -1.;
-      m_cameraTimeStamp = -1.;
+
+    /**
+     * Number of sensors
+     */
+    size_t size() const
+    {
+      return m_rings.size();
+    }
+
+    /**
+     * Return current synchronization time
+     * @return Synchronization time
+     */
+    double getSyncTime() const
+    {
+      return m_syncTime;
+    }
+
+    /**
+     * Synchronize data, the readings selected then being StampRing::synced()
+     * @return False if a sensor has no reading yet, if no sensor has a newer
+     * one since the last synchronisation, or if the readings of a sensor are
+     * too far from the synchronisation time
+     */
+    bool synchronize()
+    {
+      if (m_rings.empty())
+	return false;
+      // the oldest of the newest readings as reference
+      double ref = m_rings[0]->newest();
+      for (size_t s = 1; s < m_rings.size(); s++)
+	ref = std::min(ref, m_rings[s]->newest());
+      if (ref < 0. || ref == m_syncTime)
+	return false;
+      m_syncTime = ref;
+      bool all = true;
+      for (size_t s = 0; s < m_rings.size(); s++)
+	all = m_rings[s]->select(ref, m_maxTimeGap) && all;
+      return all;
+    }
+
+    /**
+     * Drop the readings of every sensor, with their producers stopped
+     */
+    void reset()
+    {
+      for (size_t s = 0; s < m_rings.size(); s++)
+	m_rings[s]->clear();
       m_syncTime = -1.;
-   }
-};
+    }
+
+  private:
+    Synchronizer(const Synchronizer&);
+    Synchronizer& operator=(const Synchronizer&);
+
+    std::vector<StampRingBase*> m_rings;  // of every sensor, in the order they were added
+    double m_maxTimeGap;
+    double m_syncTime;
+  };
+
+} // namespace MTRK
 
 #endif
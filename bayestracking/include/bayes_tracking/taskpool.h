@@ -0,0 +1,137 @@
+//
+// C++ Interface: taskpool
+//
+// Description: Pool of threads running the items of a task, which they
+// steal from each other, for the phases of MultiTracker
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace MTRK {
+
+  /**
+   * Threads running the items 0 to n-1 of a task, the calling thread being
+   * one of them: every thread starts with an even share of the items, takes
+   * them one at a time from its front, and when it has none left steals the
+   * back half of the items of another one, so a few long items do not hold
+   * the others. run() returns when all the items ran; the first exception of
+   * an item drops the items not started yet and is thrown again by run(),
+   * a Bayes++ exception as itself, another one as a std::runtime_error.
+   */
+  class TaskPool {
+
+  public:
+    /** Items of a run() */
+    struct Task {
+      virtual ~Task() {}
+      /**
+       * Run an item
+       * @param i Item, from 0
+       * @param worker Thread running it, from 0 (the caller of run()) to size() - 1
+       */
+      virtual void operator()(size_t i, size_t worker) = 0;
+    };
+
+    /**
+     * Constructor, starting the threads
+     * @param threads Number of threads, the caller of run() included, 0 for
+     * one per hardware thread
+     */
+    explicit TaskPool(size_t threads = 0);
+
+    /**
+     * Destructor, joining the threads
+     */
+    ~TaskPool();
+
+    /**
+     * Number of threads, the caller of run() included
+     */
+    size_t size() const
+    {
+      return m_ranges.size();
+    }
+
+    /**
+     * Run the items of a task on all the threads, one run() at a time
+     * @param task Task
+     * @param n Number of items
+     */
+    void run(Task& task, size_t n);
+
+  private:
+    enum failure_t { NO_FAILURE, NUMERIC_FAILURE, LOGIC_FAILURE, OTHER_FAILURE };
+
+    /** Items of a thread not started yet */
+    struct range_t {
+      boost::mutex mutex;
+      size_t begin, end;
+    };
+
+    TaskPool(const TaskPool&);
+    TaskPool& operator=(const TaskPool&);
+
+    void work(size_t worker);
+    void execute(size_t worker);
+    bool take(size_t worker, size_t& i);
+    void fail(failure_t failure, const char* what);
+
+    std::vector<range_t*> m_ranges;       // of every thread, the caller's first
+    std::vector<boost::thread*> m_threads;
+    boost::mutex m_mutex;                 // of the members below
+    boost::condition_variable m_started, m_finished;
+    Task* m_task;                         // of the current run()
+    unsigned long m_generation;           // number of run()
+    size_t m_running;                     // threads not done with it
+    bool m_stop;
+    failure_t m_failure;                  // first exception of the current run()
+    const char* m_what;                   // its description, a Bayes++ one
+    std::string m_message;                // or another one
+  };
+
+  /**
+   * A model for every thread of a TaskPool: the model itself for the caller
+   * of run(), copies of it made up front for the others, since the models
+   * keep temporaries of their computations
+   */
+  template<class Model>
+    class WorkerCopies {
+
+  public:
+    WorkerCopies(Model& model, size_t workers) : m_model(model), m_copies(workers, (Model*)NULL)
+    {
+      for (size_t w = 1; w < workers; w++)
+	m_copies[w] = new Model(model);
+    }
+
+    ~WorkerCopies()
+    {
+      for (size_t w = 1; w < m_copies.size(); w++)
+	delete m_copies[w];
+    }
+
+    Model& operator[](size_t worker)
+    {
+      return worker ? *m_copies[worker] : m_model;
+    }
+
+  private:
+    WorkerCopies(const WorkerCopies&);
+    WorkerCopies& operator=(const WorkerCopies&);
+
+    Model& m_model;
+    std::vector<Model*> m_copies;
+  };
+
+} // namespace MTRK
+
+#endif
@@ -0,0 +1,130 @@
+//
+// C++ Interface: trackstore
+//
+// Description: States and covariances of many tracks as structure of arrays,
+// for the batched prediction of MultiTracker
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+#ifndef TRACKSTORE_H
+#define TRACKSTORE_H
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+namespace MTRK {
+
+  /**
+   * The states x and covariances P of n tracks of the same size, one array
+   * of n values per state element and per element of the upper triangle of
+   * the covariance. The same linear prediction of every track is then a few
+   * loops over contiguous arrays, which the compiler vectorises.
+   */
+  template<int xSize>
+    class TrackStore {
+
+  public:
+    /** Elements of the upper triangle of a covariance */
+    static const int pSize = xSize * (xSize + 1) / 2;
+
+    TrackStore() : m_size(0) {}
+
+    /**
+     * Number of tracks, the previous values are lost
+     */
+    void resize(size_t n)
+    {
+      m_size = n;
+      m_data.resize((xSize + pSize) * n);
+      m_temp.resize(m_data.size());
+    }
+
+    size_t size() const
+    {
+      return m_size;
+    }
+
+    /**
+     * Copy the state and covariance of track t in and out of the store
+     */
+    template<class V, class M>
+      void load(size_t t, const V& x, const M& X)
+      {
+	for (int i = 0; i < xSize; i++) {
+	  m_data[i * m_size + t] = x[i];
+	  for (int j = i; j < xSize; j++)
+	    m_data[pIndex(i, j) * m_size + t] = X(i, j);
+	}
+      }
+
+    template<class V, class M>
+      void store(size_t t, V& x, M& X) const
+      {
+	for (int i = 0; i < xSize; i++) {
+	  x[i] = m_data[i * m_size + t];
+	  for (int j = i; j < xSize; j++)
+	    X(i, j) = m_data[pIndex(i, j) * m_size + t];
+	}
+      }
+
+    /**
+     * Linear prediction of every track with the same model,
+     * x = F*x and P = F*P*F' + Q
+     * @param F State transition matrix
+     * @param Q Noise covariance
+     */
+    template<class M, class S>
+      void predict(const M& F, const S& Q)
+      {
+	const size_t n = m_size;
+	// state, the non-zero elements of F only
+	for (int i = 0; i < xSize; i++) {
+	  double* y = &m_temp[i * n];
+	  std::fill(y, y + n, 0.);
+	  for (int k = 0; k < xSize; k++) {
+	    const double c = F(i, k);
+	    if (c == 0.)
+	      continue;
+	    const double* xk = &m_data[k * n];
+	    for (size_t t = 0; t < n; t++)
+	      y[t] += c * xk[t];
+	  }
+	}
+	// covariance, sum of F(i,k)*F(j,l)*P(k,l) over the non-zero products
+	for (int i = 0; i < xSize; i++) {
+	  for (int j = i; j < xSize; j++) {
+	    double* y = &m_temp[pIndex(i, j) * n];
+	    std::fill(y, y + n, double(Q(i, j)));
+	    for (int k = 0; k < xSize; k++) {
+	      if (F(i, k) == 0.)
+		continue;
+	      for (int l = 0; l < xSize; l++) {
+		const double c = F(i, k) * F(j, l);
+		if (c == 0.)
+		  continue;
+		const double* p = &m_data[(k <= l ? pIndex(k, l) : pIndex(l, k)) * n];
+		for (size_t t = 0; t < n; t++)
+		  y[t] += c * p[t];
+	      }
+	    }
+	  }
+	}
+	m_data.swap(m_temp);
+      }
+
+  private:
+    /** Array of P(i,j), i <= j, after the state arrays */
+    static int pIndex(int i, int j)
+    {
+      return xSize + i * xSize - i * (i - 1) / 2 + (j - i);
+    }
+
+    size_t m_size;
+    std::vector<double> m_data;
+    std::vector<double> m_temp;  // the prediction, swapped with m_data
+  };
+
+} // namespace MTRK
+
+#endif
@@ -23,9 +23,16 @@
 
 #include "bayes_tracking/BayesFilter/bayesFlt.hpp"
 #include "bayes_tracking/BayesFilter/matSup.hpp"
-#include <opencv/highgui.h>
 #include <vector>
 #include <string>
+#include <float.h>
+
+#ifndef BAYES_TRACKING_HEADLESS
+#include <opencv/highgui.h>
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#endif
 
 #define WINDOW_WIDTH 640
 #define WINDOW_HEIGHT 480
@@ -38,10 +45,17 @@
 
 using namespace std;
 using namespace Bayesian_filter_matrix;
+#ifndef BAYES_TRACKING_HEADLESS
 using namespace cv;
+#endif
 
 
-class TrackWin {
+/**
+ * Types and constants of TrackWin, the same with BAYES_TRACKING_HEADLESS,
+ * a template only for NO_ORIENTATION to be defined in this header
+ */
+template<class Win>
+class TrackWinTypes {
 public:
   typedef enum {BLACK, WHITE, GREY, BLUE, GREEN, DARK_GREEN, RED, PURPLE, YELLOW, ORANGE, DARK_ORANGE} color_t;
 
@@ -58,17 +72,57 @@ public:
     const ColMatrix* s;  // samples
   } t_object;
 
+  static const double NO_ORIENTATION;
+};
+
+template<class Win>
+const double TrackWinTypes<Win>::NO_ORIENTATION = DBL_MAX;
+
+
+#ifdef BAYES_TRACKING_HEADLESS
+
+/**
+ * TrackWin compiled out: the same interface, without OpenCV, every method
+ * doing nothing inline, so the calls of a production build cost nothing
+ */
+class TrackWin : public TrackWinTypes<void> {
+public:
+  TrackWin(const char* /*name*/,
+          int /*width*/ = WINDOW_WIDTH,
+          int /*height*/ = WINDOW_HEIGHT,
+          double /*scale*/ = SCALE_FACTOR,
+          bool /*asynchronous*/ = false) {}
+  void create() {}
+  void destroy() {}
+  void setObject(const char* /*label*/, double /*xpos*/, double /*ypos*/, double /*orientation*/ = NO_ORIENTATION,
+                color_t /*color*/ = BLACK, double /*varx*/ = 0, double /*vary*/ = 0, double /*covxy*/ = 0,
+                const ColMatrix* /*samples*/ = NULL) {}
+  void setOrigin(double /*x0*/, double /*y0*/, double /*th0*/) {}
+  void setText(const char* /*text*/, color_t /*color*/ = BLACK) {}
+  void update(int /*delay*/ = 5, double /*cameraView*/ = -1, double /*cx*/ = 0, double /*cy*/ = 0) {}
+  void saveSnapshot(const char* /*filename*/) {}
+  unsigned long dropped() const { return 0; }
+};
+
+#else
+
+class TrackWin : public TrackWinTypes<void> {
+public:
   /**
   * Constructor
   * @param name Name of the window
   * @param width width of the window
   * @param height height of the window
   * @param scale scale of the window
+  * @param asynchronous Render on a thread of the window: update() only
+  * queues a snapshot of the objects, without waiting for OpenCV, and the
+  * snapshots the thread has no time for are dropped
   */
   TrackWin(const char* name,
           int width = WINDOW_WIDTH,
           int height = WINDOW_HEIGHT,
-          double scale = SCALE_FACTOR);
+          double scale = SCALE_FACTOR,
+          bool asynchronous = false);
 
   /**
   * Destructor
@@ -76,12 +130,12 @@ public:
   ~TrackWin();
 
   /**
-  * Create and visualize the window
+  * Create and visualize the window, and start its thread if asynchronous
   */
   void create();
 
   /**
-  * Destroy the window
+  * Destroy the window, after its thread if asynchronous
   */
   void destroy();
 
@@ -95,7 +149,7 @@ public:
   * @param varx X variance
   * @param vary Y variance
   * @param covxy XY covariance
-  * @param samples sample from particle filter
+  * @param samples sample from particle filter, copied
   */
   void setObject(const char* label, double xpos, double ypos, double orientation = NO_ORIENTATION,
                 color_t color = BLACK, double varx = 0, double vary = 0, double covxy = 0, const ColMatrix* samples = NULL);
@@ -116,8 +170,9 @@ public:
   void setText(const char* text, color_t color = BLACK);
 
   /**
-  * Update the window's content
-  * @param delay Time delay in [ms] for OpenCV' signal handling (default 5ms)
+  * Update the window's content, or queue it if asynchronous
+  * @param delay Time delay in [ms] for OpenCV' signal handling (default 5ms),
+  * on the thread of the window if asynchronous
   * @param cameraView Angle of view of the camera
   * @param cx CX
   * @param cy CY
@@ -125,14 +180,35 @@ public:
   void update(int delay = 5, double cameraView = -1, double cx = 0, double cy = 0);
 
   /**
-  * Save a snapshot of the current window
+  * Save a snapshot of the current window, of the next update() if asynchronous
   * @param filename Name of the image file
   */
   void saveSnapshot(const char* filename);
 
-public:
-  static const double NO_ORIENTATION;
-  
+  /**
+  * Number of updates dropped while the thread of the window was drawing
+  */
+  unsigned long dropped() const { return m_dropped.load(boost::memory_order_relaxed); }
+
+private:
+  /** Content of an update */
+  struct snapshot_t {
+    std::vector<t_object> objects;       // their samples in samples, not s
+    std::vector<double> samples;         // x and y of every sample
+    std::vector<size_t> samplesEnd;      // end of the samples of every object
+    double x0, y0, th0;                  // origin
+    std::string text;
+    color_t textColor;
+    int delay;
+    double cameraView, cx, cy;
+    std::string save;                    // file of the snapshot, if any
+  };
+  enum { SNAPSHOTS = 3 };                // being filled, queued and drawn
+
+  void draw(const snapshot_t& snapshot);
+  void render();
+  void clear(snapshot_t& snapshot);
+
 private:
   int m_winWidth;
   int m_winHeight;
@@ -142,16 +218,19 @@ private:
   char* _name;
   bool _created;
   IplImage* _canvas;
-  std::vector<t_object> _objVector;
   double _x0;
   double _y0;
   double _th0;
-  double _cosTh0;
-  double _sinTh0;
-  char* _text;
-  color_t _textColor;
   CvPoint _textPos;
   CvFont _font;
+  snapshot_t m_snapshots[SNAPSHOTS];
+  snapshot_t* m_current;                 // being filled by the caller
+  bool m_asynchronous;
+  // snapshots passed to the thread of the window without lock, and back
+  boost::lockfree::spsc_queue<snapshot_t*, boost::lockfree::capacity<SNAPSHOTS> > m_ready, m_free;
+  boost::thread* m_thread;
+  boost::atomic<bool> m_stop;
+  boost::atomic<unsigned long> m_dropped;
 
 private:
   CvScalar getColor(color_t color);
@@ -159,3 +238,5 @@ private:
 };
 
 #endif
+
+#endif
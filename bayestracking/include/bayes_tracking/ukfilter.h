@@ -59,6 +59,22 @@ public:
     */
    void init(const FM::Vec& x0, const FM::SymMatrix& P0);
 
+   using Unscented_scheme::predict;
+   using Unscented_scheme::observe;
+
+   /**
+    * Prediction, as the Unscented_scheme one
+    * @param f Linearized model, used as an additive model
+    */
+   Bayes_base::Float predict(Linrz_predict_model& f);
+
+   /**
+    * Observation, as the Unscented_scheme one
+    * @param h Linearized model, used as an additive model
+    * @param z Observation
+    */
+   Bayes_base::Float observe(Linrz_correlated_observe_model& h, const FM::Vec& z);
+
    /**
     * Perform prediction and correction to update the state
     * @param predict_model
@@ -97,6 +113,19 @@ public:
    /** Predicted observation */
    FM::Vec z_p;
 
+   /**
+    * Weights of the unscented points of a Kappa, computed once for the
+    * fixed size steps, c.f. BAYES_FILTER_FIXED_SIZE
+    */
+   struct Unscented_weights
+   {
+      Float kappa;       // of the weights, NaN until computed
+      Float sqrt_scale;  // sqrt(x_size+kappa), of the points about x
+      Float center;      // kappa/(x_size+kappa), of the center point
+      Float point;       // 1/(2*(x_size+kappa)), of each other point
+      Float sqrt_point;  // sqrt(point)
+   };
+
 private:
    void unscented(FM::ColMatrix& XX,
                   const FM::Vec& x,
@@ -106,6 +135,14 @@ private:
 private:
    std::size_t x_size;
    std::size_t XX_size;
+   // Permanently allocated temps of the fixed size steps, c.f. BAYES_FILTER_FIXED_SIZE
+   FM::Vec xi, zi, z0;
+   // The fixed size steps update the square root UC of X, UC*UC' = X, upper
+   // triangular, instead of factorizing X at every step. It is only used
+   // while X is still UC_X, the X it was stored with
+   FM::Matrix UC;
+   FM::SymMatrix UC_X;
+   Unscented_weights predict_weights, observe_weights;
 };
 
 #endif
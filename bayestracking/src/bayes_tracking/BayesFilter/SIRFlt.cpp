@@ -15,6 +15,7 @@
 #include "bayes_tracking/BayesFilter/matSup.hpp"
 #include "bayes_tracking/BayesFilter/models.hpp"
 #include <algorithm>
+#include <cmath>
 #include <iterator>
 #include <vector>
 
@@ -36,8 +37,19 @@ namespace Bayesian_filter
 
 
 
+Importance_resampler::Float
+ Importance_resampler::resample (Resamples_t& presamples, std::size_t& uresamples, FM::DenseVec& w, SIR_random& r, std::size_t nResamples) const
+/* Resampler without a choice of the number of resamples
+ */
+{
+	if (nResamples != w.size())
+		error (Logic_exception("resampler cannot change the number of samples"));
+	return resample (presamples, uresamples, w, r);
+}
+
+
 Standard_resampler::Float
- Standard_resampler::resample (Resamples_t& presamples, std::size_t& uresamples, FM::DenseVec& w, SIR_random& r) const
+ Standard_resampler::resample (Resamples_t& presamples, std::size_t& uresamples, FM::DenseVec& w, SIR_random& r, std::size_t nResamples) const
 /* Standard resampler from [1]
  * Algorithm:
  *	A particle is chosen once for each time its cumulative weight intersects with a uniform random draw.
@@ -45,11 +57,11 @@ Standard_resampler::Float
  *  This complexity is required to sort the uniform random draws made,
  *	this allows comparing of the two ordered lists w(cumulative) and ur (the sort random draws).
  * Output:
- *  presamples number of times this particle should be resampled
+ *  presamples number of times this particle should be resampled, nResamples in total
  *  uresamples number of unqiue particles (number of non zeros in Presamples)
  *  w becomes a normalised cumulative sum
  * Side effects:
- *  A draw is made from 'r' for each particle
+ *  A draw is made from 'r' for each resample
  */
 {
 	assert (presamples.size() == w.size());
@@ -78,7 +90,7 @@ Standard_resampler::Float
 		error (Numeric_exception("NaN cumulative weight sum"));
 
 						// Sorted uniform random distribution [0..1) for each resample
-	DenseVec ur(w.size());
+	DenseVec ur(nResamples);
 	r.uniform_01(ur);
 	std::sort  (ur.begin(), ur.end());
 	assert (ur[0] >= 0 && ur[ur.size()-1] < 1);	// very bad if random is incorrect
@@ -116,14 +128,14 @@ Standard_resampler::Float
 
 
 Systematic_resampler::Float
- Systematic_resampler::resample (Resamples_t& presamples, std::size_t& uresamples, FM::DenseVec& w, SIR_random& r) const
+ Systematic_resampler::resample (Resamples_t& presamples, std::size_t& uresamples, FM::DenseVec& w, SIR_random& r, std::size_t nResamples) const
 /* Systematic resample algorithm from [2]
  * Algorithm:
  *	A particle is chosen once for each time its cumulative weight intersects with an equidistant grid.
  *	A uniform random draw is chosen to position the grid within the cumulative weights
  *	Complexity O(n)
  * Output:
- *  presamples number of times this particle should be resampled
+ *  presamples number of times this particle should be resampled, nResamples in total
  *  uresamples number of unqiue particles (number of non zeros in Presamples)
  *  w becomes a normalised cumulative sum
  * Sideeffects:
@@ -157,31 +169,30 @@ Systematic_resampler::Float
 		error (Numeric_exception("total likelihood numerical error"));
 
 						// Stratified step
-	Float wstep = wcum / Float(nParticles);
+	Float wstep = wcum / Float(nResamples);
 						
 	DenseVec ur(1);				// single uniform for initialisation
 	r.uniform_01(ur);
 	assert (ur[0] >= 0 && ur[0] < 1);		// bery bad if random is incorrect
 
 						// Resamples based on cumulative weights
+	/* The grid points s_k = (ur+k)*wstep below the cumulative weight w_i
+	 * number ceil(w_i/wstep - ur), so a particle is resampled the
+	 * difference of this count with the previous particle's. Each count
+	 * depends on w_i alone, without the data dependent walk of the grid
+	 * and without a branch. The last count is the number of resamples.
+	 */
 	Importance_resampler::Resamples_t::iterator pri = presamples.begin();
 	wi = w.begin();
 	std::size_t unique = 0;
-	Float s = ur[0] * wstep;		// random initialisation
-
-	while (wi != wi_end)
+	std::size_t below = 0;			// grid points below the previous cumulative weight
+	for (std::size_t i = 1; wi != wi_end; ++wi, ++i)
 	{
-		std::size_t Pres = 0;			// assume P not resampled until find out otherwise
-		if (s < *wi)
-		{
-			++unique;
-			do							// count resamples
-			{
-				++Pres;
-				s += wstep;
-			} while (s < *wi);
-		}
-		++wi;
+		Float c = std::ceil(*wi / wstep - ur[0]);
+		std::size_t upto = i == nParticles ? nResamples : std::min (std::size_t(std::max (c, Float(0))), nResamples);
+		std::size_t Pres = upto - below;
+		unique += Pres > 0;
+		below = upto;
 		*pri++ = Pres;
 	}
 	assert (pri==presamples.end());	// must traverse all of P
@@ -201,12 +212,13 @@ SIR_scheme::SIR_scheme (std::size_t x_size, std::size_t s_size, SIR_random& rand
 		Sample_state_filter (x_size, s_size),
 		Sample_filter (x_size, s_size),
 		random (random_helper),
-		resamples (s_size), wir (s_size)
+		resamples (s_size), wir (s_size), resampled (x_size, s_size)
 /* Initialise filter and set the size of things we know about
  */
 {
 	SIR_scheme::x_size = x_size;
 	rougheningK = rougheningKinit;
+	resampleThreshold = 1;
 }
 
 SIR_scheme& SIR_scheme::operator= (const SIR_scheme& a)
@@ -252,18 +264,36 @@ SIR_scheme::Float
 	Float lcond = 1;
 	if (wir_update)		// Resampling only required if weights have been updated
 	{
+		if (resampleThreshold < 1)
+		{	// Effective sample size of the weights, resampling deferred while enough remain
+			const std::size_t nSamples = wir.size();
+			Float wsum = 0, w2sum = 0;
+			for (std::size_t i = 0; i != nSamples; ++i) {
+				wsum += wir[i];
+				w2sum += wir[i] * wir[i];
+			}
+			if (wsum * wsum >= resampleThreshold * Float(nSamples) * w2sum && wsum > 0)
+			{	// weights normalised to a mean of 1, and kept
+				wir *= Float(nSamples) / wsum;
+				return lcond;
+			}
+		}
 		// Resample based on likelihood weights
 		std::size_t R_unique;
-		lcond = resampler.resample (resamples, R_unique, wir, random);
+		const std::size_t nResamples = resample_size ();
+		resamples.resize (wir.size());
+		lcond = resampler.resample (resamples, R_unique, wir, random, nResamples);
 
 							// No resampling exceptions: update S
-		copy_resamples (S, resamples);
+		gather_resamples (S, resampled, resamples);
 		stochastic_samples = R_unique;
 
-		roughen ();			// Roughen samples
-
+		if (wir.size() != S.size2())
+			wir.resize (S.size2(), false);
 		std::fill (wir.begin(), wir.end(), Float(1));		// Resampling results in uniform weights
 		wir_update = false;
+
+		roughen ();			// Roughen samples
 	}
 	return lcond;
 }
@@ -356,6 +386,42 @@ void SIR_scheme::copy_resamples (ColMatrix& P, const Importance_resampler::Resam
 }
 
 
+void SIR_scheme::gather_resamples (ColMatrix& P, ColMatrix& buffer, const Importance_resampler::Resamples_t& presamples)
+/* Update P by gathering presamples into buffer, then swapping P and buffer
+ * The same samples in the same order as copy_resamples
+ * The sum of presamples is the number of samples of the result
+ * Algorithm: Index gathering
+ *  The copies of a sample start at the prefix sum of the presamples before it,
+ *  every column of buffer is written once from a column of P, in any order
+ */
+{
+	const std::size_t n = P.size1();
+	std::size_t nSamples = 0;
+	Importance_resampler::Resamples_t::const_iterator pi, pi_end = presamples.end();
+	for (pi = presamples.begin(); pi != pi_end; ++pi)
+		nSamples += *pi;
+	if (buffer.size1() != n || buffer.size2() != nSamples)
+		buffer.resize (n, nSamples, false);
+	std::size_t si = 0;
+#ifndef BAYES_FILTER_GAPPY
+	if (nSamples && P.size2()) {	// columns contiguous, on arrays
+		const Float* p = &P(0,0);
+		Float* b = &buffer(0,0);
+		for (pi = presamples.begin(); pi != pi_end; ++pi, p += n)
+			for (std::size_t res = *pi; res > 0; --res, ++si)
+				std::copy (p, p + n, b + si * n);
+	}
+#else
+	std::size_t source = 0;
+	for (pi = presamples.begin(); pi != pi_end; ++pi, ++source)
+		for (std::size_t res = *pi; res > 0; --res, ++si)
+			noalias(FM::column(buffer,si)) = FM::column(P,source);
+#endif
+	assert (si == nSamples);
+	P.swap (buffer);
+}
+
+
 void SIR_scheme::roughen_minmax (ColMatrix& P, Float K) const
 /* Roughening
  *  Uses algorithm from Ref[1] using max-min in each state of P
@@ -453,18 +519,41 @@ void SIR_kalman_scheme::init ()
 
 void SIR_kalman_scheme::mean ()
 /* Update state mean
- *  Pre : S
+ *  Pre : S, wir if resampling was deferred (wir_update)
  *  Post: x,S
  */
 {
-						// Mean of distribution: mean of particles
+						// Mean of distribution: mean of particles, weighted while not resampled
 	x.clear();
 	const std::size_t nSamples = S.size2();
+	const Float wsum = wir_update ? sum_weights() : Float(nSamples);
+#ifndef BAYES_FILTER_GAPPY
+	if (nSamples && x.size() == S.size1()) {	// columns of S contiguous, on arrays
+		const std::size_t n = S.size1();
+		Float* xa = &x[0];
+		const Float* si = &S(0,0);
+		if (wir_update) {
+			for (std::size_t i = 0; i != nSamples; ++i, si += n)
+				for (std::size_t k = 0; k != n; ++k)
+					xa[k] += wir[i] * si[k];
+		}
+		else {
+			for (std::size_t i = 0; i != nSamples; ++i, si += n)
+				for (std::size_t k = 0; k != n; ++k)
+					xa[k] += si[k];
+		}
+		x /= wsum;
+		return;
+	}
+#endif
 	for (std::size_t i = 0; i != nSamples; ++i) {
 		FM::ColMatrix::Column Si(S,i);
-		x.plus_assign (Si);
+		if (wir_update)
+			x.plus_assign (wir[i] * Si);
+		else
+			x.plus_assign (Si);
 	}
-	x /= Float(S.size2());
+	x /= wsum;
 }
 
 
@@ -490,6 +579,7 @@ void SIR_kalman_scheme::update_statistics ()
  *  Post: x,X,S	(X may be non PSD)
  *
  * Sample Covariance := Sum_i [transpose(S[i]-mean)*(S[i]-mean)] / (s_size)
+ *  or, while resampling is deferred, weighted by wir over the sum of wir
  *  The definition is the Maximum Likelihood (biased) estimate of covariance given samples with unknown (estimated) mean
  * Numerics
  *  No check is made for the conditioning of samples with regard to mean and covariance
@@ -501,11 +591,53 @@ void SIR_kalman_scheme::update_statistics ()
     X.clear();              // Covariance
 
 	const std::size_t nSamples = S.size2();
+	const Float wsum = wir_update ? sum_weights() : Float(nSamples);
+#ifndef BAYES_FILTER_GAPPY
+	const std::size_t n = S.size1();
+	if (nSamples && n <= 8) {	// upper triangle on arrays, then mirrored
+		Float d[8], P[8][8] = {{0}};
+		const Float* si = &S(0,0);
+		for (std::size_t i = 0; i != nSamples; ++i, si += n) {
+			for (std::size_t k = 0; k != n; ++k)
+				d[k] = si[k] - x[k];
+			if (wir_update) {
+				const Float wi = wir[i];
+				for (std::size_t r = 0; r != n; ++r)
+					for (std::size_t c = r; c != n; ++c)
+						P[r][c] += wi * d[r] * d[c];
+			}
+			else {
+				for (std::size_t r = 0; r != n; ++r)
+					for (std::size_t c = r; c != n; ++c)
+						P[r][c] += d[r] * d[c];
+			}
+		}
+		for (std::size_t r = 0; r != n; ++r)
+			for (std::size_t c = r; c != n; ++c)
+				X(r,c) = P[r][c] / wsum;
+		return;
+	}
+#endif
 	for (std::size_t i = 0; i != nSamples; ++i) {
 		FM::ColMatrix::Column Si(S,i);
-		X.plus_assign (FM::outer_prod(Si-x, Si-x));
+		if (wir_update)
+			X.plus_assign (wir[i] * FM::outer_prod(Si-x, Si-x));
+		else
+			X.plus_assign (FM::outer_prod(Si-x, Si-x));
 	}
-	X /= Float(nSamples);
+	X /= wsum;
+}
+
+
+SIR_kalman_scheme::Float SIR_kalman_scheme::sum_weights () const
+/* Sum of the likelihood weights wir
+ */
+{
+	Float wsum = 0;
+	const std::size_t nSamples = wir.size();
+	for (std::size_t i = 0; i != nSamples; ++i)
+		wsum += wir[i];
+	return wsum;
 }
 
 
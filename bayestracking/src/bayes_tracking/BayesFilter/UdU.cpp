@@ -901,4 +901,254 @@ SymMatrix::value_type UdUinversePD (SymMatrix& MI, SymMatrix::value_type& detM,
 	return rcond;
 }
 
+
+/*
+ * Batched factorisations
+ *  Each one is a template of the size of its matrices, instantiated with the
+ *  sizes 1 to 6 as constants, so its loops over elements have constant bounds,
+ *  and with a runtime size for the others. Its loops over the batch are
+ *  innermost and without branches, a non PD matrix is only marked in rcond.
+ */
+template <std::size_t N>
+struct Batch_fixed_size
+{
+	operator std::size_t () const
+	{	return N;
+	}
+};
+
+template <class Size>
+static void UdUfactor_batch_n (Float* M, const Size n, std::size_t B, Float* rcond)
+/* UdUfactor_variant2 of every matrix
+ */
+{
+	std::size_t b;
+	for (b = 0; b < B; ++b)
+		rcond[b] = 1;
+	if (n == 0)
+	{
+		for (b = 0; b < B; ++b)
+			rcond[b] = 0;
+		return;
+	}
+	std::size_t i,j,k;
+	j = n-1;
+	do {
+		Float* Mjj = M + (j*n + j)*B;
+		for (b = 0; b < B; ++b)
+			rcond[b] = Mjj[b] > 0 ? rcond[b] : -1;
+		i = j;
+		do
+		{
+			Float* Mij = M + (i*n + j)*B;
+			for (k = j+1; k < n; ++k)
+			{
+				const Float* Mik = M + (i*n + k)*B;
+				const Float* Mkk = M + (k*n + k)*B;
+				const Float* Mjk = M + (j*n + k)*B;
+				for (b = 0; b < B; ++b)
+					Mij[b] -= Mik[b]*Mkk[b]*Mjk[b];
+			}
+			if (i != j) {
+				for (b = 0; b < B; ++b)
+					Mij[b] = Mij[b] / Mjj[b];
+			}
+		} while (i-- > 0);
+	} while (j-- > 0);
+
+	// As UdUrcond of the diagonal
+	for (b = 0; b < B; ++b)
+	{
+		Float mind = M[b], maxd = 0;
+		bool negative = false;
+		for (k = 0; k < n; ++k)
+		{
+			const Float d = M[(k*n + k)*B + b];
+			negative |= (d != d);
+			mind = d < mind ? d : mind;
+			maxd = d > maxd ? d : maxd;
+		}
+		negative |= (mind < 0);
+		Float r = mind / maxd;
+		r = (r != r) ? 0 : r;
+		rcond[b] = (negative || rcond[b] < 0) ? -1 : r;
+	}
+}
+
+template <class Size>
+static void UCfactor_batch_n (Float* M, const Size n, std::size_t B, Float* rcond)
+/* UCfactor of every matrix
+ *  The reciprocal of diagonal element j is kept in element (j,0) of the
+ *  strict lower triangle
+ */
+{
+	std::size_t b;
+	for (b = 0; b < B; ++b)
+		rcond[b] = 1;
+	if (n == 0)
+	{
+		for (b = 0; b < B; ++b)
+			rcond[b] = 0;
+		return;
+	}
+	std::size_t i,j,k;
+	j = n-1;
+	do {
+		Float* Mjj = M + (j*n + j)*B;
+		Float* dI = M + (j*n)*B;
+		for (b = 0; b < B; ++b)
+		{
+			const Float d = Mjj[b];
+			rcond[b] = d > 0 ? rcond[b] : -1;
+			Mjj[b] = std::sqrt(d);
+		}
+		if (j > 0) {
+			for (b = 0; b < B; ++b)
+				dI[b] = 1 / Mjj[b];
+		}
+		for (i = 0; i < j; ++i)
+		{
+			Float* Mij = M + (i*n + j)*B;
+			for (b = 0; b < B; ++b)
+				Mij[b] = dI[b]*Mij[b];
+			for (k = 0; k <= i; ++k)
+			{
+				Float* Mki = M + (k*n + i)*B;
+				const Float* Mkj = M + (k*n + j)*B;
+				for (b = 0; b < B; ++b)
+					Mki[b] -= Mij[b]*Mkj[b];
+			}
+		}
+	} while (j-- > 0);
+
+	// As UCrcond of the diagonal
+	for (b = 0; b < B; ++b)
+	{
+		Float mind = M[b], maxd = 0;
+		bool negative = false;
+		for (k = 0; k < n; ++k)
+		{
+			const Float d = M[(k*n + k)*B + b];
+			negative |= (d != d);
+			mind = d < mind ? d : mind;
+			maxd = d > maxd ? d : maxd;
+		}
+		negative |= (mind < 0);
+		Float r = mind / maxd;
+		r = (r != r) ? 0 : r*r;
+		rcond[b] = (negative || rcond[b] < 0) ? -1 : r;
+	}
+}
+
+template <class Size>
+static void UTinverse_batch_n (Float* U, const Size n, std::size_t B)
+/* UTinverse of every matrix
+ *  The sums of element (i,j) are accumulated in element (j,i) of the strict
+ *  lower triangle, as element (i,j) itself is one of their terms
+ */
+{
+	if (n == 0)
+		return;
+	std::size_t b;
+	std::size_t i = n-1;
+	do {
+		Float* Uii = U + (i*n + i)*B;
+		for (b = 0; b < B; ++b)
+			Uii[b] = 1 / Uii[b];
+
+		for (std::size_t j = n-1; j > i; --j)
+		{
+			Float* e = U + (j*n + i)*B;
+			for (b = 0; b < B; ++b)
+				e[b] = 0.;
+			for (std::size_t k = i+1; k <= j; ++k)
+			{
+				const Float* Uik = U + (i*n + k)*B;
+				const Float* Ukj = U + (k*n + j)*B;
+				for (b = 0; b < B; ++b)
+					e[b] -= Uik[b] * Ukj[b];
+			}
+			Float* Uij = U + (i*n + j)*B;
+			for (b = 0; b < B; ++b)
+				Uij[b] = e[b] * Uii[b];
+		}
+	} while (i-- > 0);
+}
+
+template <class Op>
+static void batch_dispatch (const Op& op, std::size_t n)
+/* op(n) with a constant size for the sizes instantiated
+ */
+{
+	switch (n) {
+	case 1: op (Batch_fixed_size<1>()); break;
+	case 2: op (Batch_fixed_size<2>()); break;
+	case 3: op (Batch_fixed_size<3>()); break;
+	case 4: op (Batch_fixed_size<4>()); break;
+	case 5: op (Batch_fixed_size<5>()); break;
+	case 6: op (Batch_fixed_size<6>()); break;
+	default: op (n);
+	}
+}
+
+struct UdUfactor_batch_op
+{
+	Float* M; std::size_t B; Float* rcond;
+	template <class Size>
+	void operator() (const Size n) const
+	{	UdUfactor_batch_n (M, n, B, rcond);
+	}
+};
+
+struct UCfactor_batch_op
+{
+	Float* M; std::size_t B; Float* rcond;
+	template <class Size>
+	void operator() (const Size n) const
+	{	UCfactor_batch_n (M, n, B, rcond);
+	}
+};
+
+struct UTinverse_batch_op
+{
+	Float* U; std::size_t B;
+	template <class Size>
+	void operator() (const Size n) const
+	{	UTinverse_batch_n (U, n, B);
+	}
+};
+
+void UdUfactor_batch (Float* M, std::size_t n, std::size_t B, Float* rcond)
+/* UdUfactor of B matrices of size n, c.f. matSup.hpp for their layout
+ * Output:
+ *    upper_triangle(M) of each matrix as its UdU' factor
+ *    rcond[b] of matrix b as UdUfactor, not > 0 if not PD
+ */
+{
+	const UdUfactor_batch_op op = {M, B, rcond};
+	batch_dispatch (op, n);
+}
+
+void UCfactor_batch (Float* M, std::size_t n, std::size_t B, Float* rcond)
+/* UCfactor of B matrices of size n, c.f. matSup.hpp for their layout
+ * Output:
+ *    upper_triangle(M) of each matrix as its UC*UC' factor
+ *    rcond[b] of matrix b as UCfactor, not > 0 if not PD
+ */
+{
+	const UCfactor_batch_op op = {M, B, rcond};
+	batch_dispatch (op, n);
+}
+
+void UTinverse_batch (Float* U, std::size_t n, std::size_t B)
+/* UTinverse of B upper triangular matrices of size n, c.f. matSup.hpp for their layout
+ *  A zero on a diagonal is not checked and gives non finite elements
+ * Output:
+ *    upper_triangle(U) of each matrix as its inverse
+ */
+{
+	const UTinverse_batch_op op = {U, B};
+	batch_dispatch (op, n);
+}
+
 }//namespace
@@ -22,15 +22,16 @@
 #include "bayes_tracking/BayesFilter/matSup.hpp"
 #include <iostream>
 #include <float.h>
+#include <algorithm>
 
 
-AssociationMatrix::AssociationMatrix()
+AssociationMatrix::AssociationMatrix() : m_sparse(false), m_UC(Empty), m_logDetS(0.), m_dims(0)
 {
     RowSize = ColSize = 0;
 }
 
 
-AssociationMatrix::AssociationMatrix(size_t row, size_t col)
+AssociationMatrix::AssociationMatrix(size_t row, size_t col) : m_sparse(false), m_UC(Empty), m_logDetS(0.), m_dims(0)
 {
     setSize(row, col);
 }
@@ -44,8 +45,13 @@ void AssociationMatrix::setSize(size_t row, size_t col)
 {
     if ((row > 0) && (col >= 0))
     {
-        resize(RowSize = row);
-        for (size_t i = 0; i < RowSize; i++) (*this)[i].resize(ColSize = col);
+        RowSize = row;
+        ColSize = col;
+        m_sparse = false;
+        // grow only, at least one element for operator[] of an empty row
+        size_t n = std::max(RowSize * ColSize, size_t(1));
+        if (m_data.size() < n)
+            m_data.resize(n);
     }
     else
     {
@@ -56,6 +62,15 @@ void AssociationMatrix::setSize(size_t row, size_t col)
 }
 
 
+void AssociationMatrix::setSparse(size_t row, size_t col)
+{
+    RowSize = row;
+    ColSize = col;
+    m_sparse = true;
+    m_entries.clear();
+}
+
+
 void AssociationMatrix::print()
 {
     for (size_t i = 0; i < RowSize; i++)
@@ -75,12 +90,11 @@ double AssociationMatrix::mahalanobis(const FM::Vec& v1,
     return mahalanobis(Vec(v1-v2), SymMatrix(R1+R2));
 }
 
-Float AssociationMatrix::detS = 0.;
-
 double AssociationMatrix::mahalanobis(const FM::Vec& s,
                                       const FM::SymMatrix& S)
 {
     SymMatrix Si(S.size1(), S.size2());
+    Float detS;
     Float rcond = UdUinversePD(Si, detS, S);  // Si = inv(S)
     Numerical_rcond rclimit;
     rclimit.check_PD(rcond, "S not PD in AssociationMatrix::mahalanobis(...)");
@@ -91,6 +105,7 @@ double AssociationMatrix::mahalanobis(const FM::Vec& s,
 double AssociationMatrix::correlation(const FM::Vec& s, const FM::SymMatrix& S)
 {
     SymMatrix Si(S.size1(), S.size2());
+    Float detS;
     Float rcond = UdUinversePD(Si, detS, S);  // Si = inv(S)
     Numerical_rcond rclimit;
     rclimit.check_PD(rcond, "S not PD in AssociationMatrix::correlation(...)");
@@ -101,6 +116,7 @@ double AssociationMatrix::correlation(const FM::Vec& s, const FM::SymMatrix& S)
 double AssociationMatrix::correlation_log(const FM::Vec& s, const FM::SymMatrix& S)
 {
     SymMatrix Si(S.size1(), S.size2());
+    Float detS;
     Float rcond = UdUinversePD(Si, detS, S);  // Si = inv(S)
     Numerical_rcond rclimit;
     rclimit.check_PD(rcond, "S not PD in AssociationMatrix::correlation_log(...)");
@@ -109,29 +125,134 @@ double AssociationMatrix::correlation_log(const FM::Vec& s, const FM::SymMatrix&
 }
 
 
-double AssociationMatrix::gate(int dof) {
+void AssociationMatrix::setInnovationCovariance(const FM::SymMatrix& S)
+{
+    const size_t n = S.size1();
+    if (m_UC.size1() != n)
+        m_UC.resize(n, n, false);
+    Float rcond = UCfactor(m_UC, S);  // UC * UC' = S
+    Numerical_rcond rclimit;
+    rclimit.check_PD(rcond, "S not PD in AssociationMatrix::setInnovationCovariance(...)");
+    m_logDetS = 0.;
+    for (size_t k = 0; k < n; k++)
+        m_logDetS += 2. * log(m_UC(k,k));
+    UTinverse(m_UC);  // W = inv(UC), inv(S) = W' * W
+    m_W.resize(n * n);
+    for (size_t k = 0; k < n; k++)
+        for (size_t l = 0; l < n; l++)
+            m_W[k * n + l] = l < k ? 0. : m_UC(k,l);
+}
+
+
+void AssociationMatrix::setInnovationCovariances(const double* S, size_t dim, size_t n)
+{
+    m_dims = dim;
+    m_Ws.assign(S, S + dim * dim * n);
+    m_rconds.resize(n);
+    m_logDetSs.assign(n, 0.);
+    if (n == 0)
+        return;
+    double* UC = &m_Ws[0];
+    UCfactor_batch(UC, dim, n, &m_rconds[0]);  // UC * UC' = S
+    for (size_t k = 0; k < dim; k++) {
+        const double* UCkk = UC + (k * dim + k) * n;
+        for (size_t j = 0; j < n; j++)
+            m_logDetSs[j] += 2. * log(UCkk[j]);
+    }
+    UTinverse_batch(UC, dim, n);  // W = inv(UC), inv(S) = W' * W
+}
+
+
+void AssociationMatrix::selectInnovationCovariance(size_t j)
+{
+    Numerical_rcond rclimit;
+    rclimit.check_PD(m_rconds[j], "S not PD in AssociationMatrix::setInnovationCovariances(...)");
+    const size_t dim = m_dims, n = m_rconds.size();
+    m_W.resize(dim * dim);
+    for (size_t k = 0; k < dim; k++)
+        for (size_t l = 0; l < dim; l++)
+            m_W[k * dim + l] = l < k ? 0. : m_Ws[(k * dim + l) * n + j];
+    m_logDetS = m_logDetSs[j];
+}
+
+
+void AssociationMatrix::mahalanobis2(const FM::Vec& zp, const double* z, size_t stride, size_t n, double* d2)
+{
+    const size_t dim = zp.size();
+    if (n == 0)
+        return;
+    if (m_y.size() < n)
+        m_y.resize(n);
+    double* y = &m_y[0];
+    std::fill(d2, d2 + n, 0.);
+    // one element of W * s at a time, for all the observations
+    for (size_t k = 0; k < dim; k++) {
+        std::fill(y, y + n, 0.);
+        for (size_t l = k; l < dim; l++) {
+            const double w = m_W[k * dim + l], zpl = zp[l];
+            const double* zl = z + l * stride;
+            for (size_t i = 0; i < n; i++)
+                y[i] += w * (zpl - zl[i]);
+        }
+        for (size_t i = 0; i < n; i++)
+            d2[i] += y[i] * y[i];
+    }
+}
+
+
+double AssociationMatrix::mahalanobis(const FM::Vec& s) const
+{
+    return sqrt(mahalanobis2(s));  // sqrt(s' * Si * s)
+}
+
+
+double AssociationMatrix::correlation_log(const FM::Vec& s) const
+{
+    return mahalanobis2(s) + m_logDetS;  // s' * Si * s + ln|S|
+}
+
+
+double AssociationMatrix::mahalanobis2(const FM::Vec& s) const
+{
+    const size_t dim = s.size();
+    double d2 = 0.;
+    for (size_t k = 0; k < dim; k++) {  // |W * s|^2
+        double y = 0.;
+        for (size_t l = k; l < dim; l++)
+            y += m_W[k * dim + l] * s[l];
+        d2 += y * y;
+    }
+    return d2;
+}
+
+
+double AssociationMatrix::gate(int dof, gate_t confidence) {
     switch (dof) {
-    case 1: // 1 dof @ P=0.01
-        return 2.576;
-        break;
-    case 2: // 2 dof @ P=0.01
-        return 3.035;
-        break;
-    case 3: // 3 dof @ P=0.01
-        return 3.368;
-        break;
-    case 4: // 4 dof @ P=0.01
-        return 3.644;
-        break;
+    case 1:
+        return ChiSquareGate<1>::value(confidence);
+    case 2:
+        return ChiSquareGate<2>::value(confidence);
+    case 3:
+        return ChiSquareGate<3>::value(confidence);
+    case 4:
+        return ChiSquareGate<4>::value(confidence);
+    case 5:
+        return ChiSquareGate<5>::value(confidence);
+    case 6:
+        return ChiSquareGate<6>::value(confidence);
     default:
-        cerr << "ERROR - undefined value for gate(" << dof << ")\n";
-        exit(EXIT_FAILURE);
+        Bayes_base::error(Logic_exception("AssociationMatrix::gate of 1 to 6 degrees of freedom only"));
+        return 0;
     }
 }
 
 
 void AssociationMatrix::computeNN(measure_t measure)
 {
+    if (m_sparse) {
+        computeSparseNN(measure);
+        return;
+    }
     NN.clear();
     URow.clear();
     UCol.clear();
@@ -200,3 +321,277 @@ void AssociationMatrix::computeNN(measure_t measure)
         }
     }
 }
+
+
+static bool candidate(measure_t measure, double value)
+{
+    return measure == CORRELATION ? value > 0. : value < DBL_MAX;
+}
+
+static bool lessEntry(const AssociationMatrix::entry_t& a, const AssociationMatrix::entry_t& b)
+{
+    return a.value < b.value || (a.value == b.value && (a.row < b.row || (a.row == b.row && a.col < b.col)));
+}
+
+static bool greaterEntry(const AssociationMatrix::entry_t& a, const AssociationMatrix::entry_t& b)
+{
+    return a.value > b.value || (a.value == b.value && (a.row < b.row || (a.row == b.row && a.col < b.col)));
+}
+
+static bool lessMatch(const AssociationMatrix::match_t& a, const AssociationMatrix::match_t& b)
+{
+    return a.match < b.match;
+}
+
+static bool greaterMatch(const AssociationMatrix::match_t& a, const AssociationMatrix::match_t& b)
+{
+    return a.match > b.match;
+}
+
+
+void AssociationMatrix::sparse(measure_t measure)
+{
+    m_rowStart.resize(RowSize + 1);
+    m_col.clear();
+    m_cost.clear();
+    if (m_sparse) {  // counting sort of the elements by row
+        std::fill(m_rowStart.begin(), m_rowStart.end(), 0);
+        for (size_t e = 0; e < m_entries.size(); e++)
+            if (candidate(measure, m_entries[e].value))
+                m_rowStart[m_entries[e].row + 1]++;
+        for (size_t i = 0; i < RowSize; i++)
+            m_rowStart[i + 1] += m_rowStart[i];
+        m_col.resize(m_rowStart[RowSize]);
+        m_cost.resize(m_rowStart[RowSize]);
+        m_queue.assign(m_rowStart.begin(), m_rowStart.end() - 1);
+        for (size_t e = 0; e < m_entries.size(); e++) {
+            const entry_t& en = m_entries[e];
+            if (candidate(measure, en.value)) {
+                size_t k = m_queue[en.row]++;
+                m_col[k] = en.col;
+                m_cost[k] = measure == CORRELATION ? -en.value : en.value;
+            }
+        }
+        m_rowMate.assign(RowSize, -1);
+        m_colMate.assign(ColSize, -1);
+        return;
+    }
+    for (size_t i = 0; i < RowSize; i++) {
+        m_rowStart[i] = m_col.size();
+        const double* row = (*this)[i];
+        for (size_t j = 0; j < ColSize; j++) {
+            if (measure == CORRELATION) {  // maximum probability, minimum cost
+                if (row[j] > 0.) {
+                    m_col.push_back(j);
+                    m_cost.push_back(-row[j]);
+                }
+            }
+            else if (row[j] < DBL_MAX) {
+                m_col.push_back(j);
+                m_cost.push_back(row[j]);
+            }
+        }
+    }
+    m_rowStart[RowSize] = m_col.size();
+    m_rowMate.assign(RowSize, -1);
+    m_colMate.assign(ColSize, -1);
+}
+
+
+void AssociationMatrix::matches(measure_t measure)
+{
+    NN.clear();
+    URow.clear();
+    UCol.clear();
+    for (size_t i = 0; i < RowSize; i++) {
+        if (m_rowMate[i] < 0)
+            URow.push_back(i);
+        else {
+            size_t e = m_rowStart[i];
+            while (m_col[e] != (size_t)m_rowMate[i])
+                e++;
+            match_t p = {i, (size_t)m_rowMate[i], measure == CORRELATION ? -m_cost[e] : m_cost[e]};
+            NN.push_back(p);
+        }
+    }
+    for (size_t j = 0; j < ColSize; j++)
+        if (m_colMate[j] < 0)
+            UCol.push_back(j);
+    std::sort(NN.begin(), NN.end(), measure == CORRELATION ? greaterMatch : lessMatch);
+}
+
+
+void AssociationMatrix::computeHungarian(measure_t measure)
+{
+    sparse(measure);
+    if (m_cost.empty()) {
+        matches(measure);
+        return;
+    }
+    // every row i can also be assigned to its own column ColSize + i, i.e.
+    // unassigned, at a cost larger than any difference between two
+    // assignments, so the most rows are assigned and all the rows are
+    double cmin = *std::min_element(m_cost.begin(), m_cost.end());
+    double cmax = *std::max_element(m_cost.begin(), m_cost.end());
+    double miss = cmax + (cmax - cmin + 1.) * (std::min(RowSize, ColSize) + 1);
+    size_t cols = ColSize + RowSize;
+    m_colMate.assign(cols, -1);
+    // dual variables of rows and columns, reduced costs m_cost - m_u - m_v
+    // always >= 0, and 0 for the assigned pairs
+    m_u.assign(RowSize, miss);
+    for (size_t i = 0; i < RowSize; i++)
+        for (size_t e = m_rowStart[i]; e < m_rowStart[i+1]; e++)
+            m_u[i] = std::min(m_u[i], m_cost[e]);
+    m_v.assign(cols, 0.);
+    m_dist.assign(cols, DBL_MAX);
+    m_pred.assign(cols, -1);
+    m_done.assign(cols, 0);
+    for (size_t r = 0; r < RowSize; r++) {
+        // Dijkstra from row r, over the reduced costs, to the nearest unassigned column
+        m_scanned.clear();
+        m_queue.clear();  // columns reached, not final yet
+        size_t i = r, end;
+        double di = 0.;
+        while (true) {
+            for (size_t e = m_rowStart[i]; e <= m_rowStart[i+1]; e++) {  // gated columns of row i, then its own
+                size_t j = e < m_rowStart[i+1] ? m_col[e] : ColSize + i;
+                if (m_done[j])
+                    continue;
+                double d = di + (e < m_rowStart[i+1] ? m_cost[e] : miss) - m_u[i] - m_v[j];
+                if (d < m_dist[j]) {
+                    if (m_dist[j] == DBL_MAX)
+                        m_queue.push_back(j);
+                    m_dist[j] = d;
+                    m_pred[j] = i;
+                }
+            }
+            size_t k = 0;  // the column of r at least is reached
+            for (size_t q = 1; q < m_queue.size(); q++)
+                if (m_dist[m_queue[q]] < m_dist[m_queue[k]])
+                    k = q;
+            size_t j = m_queue[k];
+            m_queue[k] = m_queue.back();
+            m_queue.pop_back();
+            m_done[j] = 1;
+            m_scanned.push_back(j);
+            if (m_colMate[j] < 0) {  // shortest augmenting path found
+                end = j;
+                break;
+            }
+            i = m_colMate[j];
+            di = m_dist[j];
+        }
+        // update the dual variables, then assign along the path
+        double D = m_dist[end];
+        m_u[r] += D;
+        for (size_t q = 0; q < m_scanned.size(); q++) {
+            size_t j = m_scanned[q];
+            if (j == end)
+                continue;
+            m_v[j] -= D - m_dist[j];
+            m_u[m_colMate[j]] += D - m_dist[j];
+        }
+        size_t j = end;
+        while (true) {
+            size_t pi = m_pred[j];
+            long next = m_rowMate[pi];
+            m_colMate[j] = pi;
+            m_rowMate[pi] = j;
+            if (pi == r)
+                break;
+            j = next;
+        }
+        // reset the columns reached
+        for (size_t q = 0; q < m_scanned.size(); q++) {
+            m_dist[m_scanned[q]] = DBL_MAX;
+            m_done[m_scanned[q]] = 0;
+        }
+        for (size_t q = 0; q < m_queue.size(); q++)
+            m_dist[m_queue[q]] = DBL_MAX;
+    }
+    for (size_t i = 0; i < RowSize; i++)
+        if (m_rowMate[i] >= (long)ColSize)
+            m_rowMate[i] = -1;
+    matches(measure);
+}
+
+
+void AssociationMatrix::computeAuction(measure_t measure, double epsilon)
+{
+    sparse(measure);
+    if (m_cost.empty()) {
+        matches(measure);
+        return;
+    }
+    // the rows bid for the columns, the benefit of a column is cmin - cost;
+    // a row can also stay unassigned, at a loss larger than any difference
+    // between two assignments, so the most rows are assigned as with
+    // computeHungarian(...). The prices start at 0 and a column once bid
+    // for stays assigned, so the columns left unassigned have a price of 0,
+    // which makes the result optimal within an increment per row
+    double cmin = *std::min_element(m_cost.begin(), m_cost.end());
+    double range = *std::max_element(m_cost.begin(), m_cost.end()) - cmin + 1.;
+    double miss = range * (std::min(RowSize, ColSize) + 1);
+    m_v.assign(ColSize, 0.);  // prices
+    m_queue.clear();
+    for (size_t i = RowSize; i-- > 0;)
+        m_queue.push_back(i);
+    while (!m_queue.empty()) {
+        size_t i = m_queue.back();
+        m_queue.pop_back();
+        // best and second best value, benefit - price
+        long best = -1;  // unassigned
+        double w1 = -miss, w2 = -DBL_MAX;
+        for (size_t e = m_rowStart[i]; e < m_rowStart[i+1]; e++) {
+            double w = cmin - m_cost[e] - m_v[m_col[e]];
+            if (w > w1) {
+                w2 = w1;
+                w1 = w;
+                best = m_col[e];
+            }
+            else if (w > w2)
+                w2 = w;
+        }
+        if (best < 0)  // row i stays unassigned
+            continue;
+        m_v[best] += w1 - w2 + epsilon;
+        long previous = m_colMate[best];
+        if (previous >= 0) {
+            m_rowMate[previous] = -1;
+            m_queue.push_back(previous);
+        }
+        m_colMate[best] = i;
+        m_rowMate[i] = best;
+    }
+    matches(measure);
+}
+
+
+void AssociationMatrix::computeSparseNN(measure_t measure)
+{
+    // the same pairs as scanning the whole matrix for the best element,
+    // in the same order (row-major between equal measures)
+    std::sort(m_entries.begin(), m_entries.end(), measure == CORRELATION ? greaterEntry : lessEntry);
+    m_rowMate.assign(RowSize, -1);
+    m_colMate.assign(ColSize, -1);
+    NN.clear();
+    URow.clear();
+    UCol.clear();
+    for (size_t e = 0; e < m_entries.size() && NN.size() < std::min(RowSize, ColSize); e++) {
+        const entry_t& en = m_entries[e];
+        if (!candidate(measure, en.value))
+            break;
+        if (m_rowMate[en.row] >= 0 || m_colMate[en.col] >= 0)
+            continue;
+        m_rowMate[en.row] = en.col;
+        m_colMate[en.col] = en.row;
+        match_t p = {en.row, en.col, en.value};
+        NN.push_back(p);
+    }
+    for (size_t i = 0; i < RowSize; i++)
+        if (m_rowMate[i] < 0)
+            URow.push_back(i);
+    for (size_t j = 0; j < ColSize; j++)
+        if (m_colMate[j] < 0)
+            UCol.push_back(j);
+}
@@ -22,6 +22,7 @@
 #include <float.h>
 // #include "utility.h"
 #include "bayes_tracking/jacobianmodel.h"
+#include "bayes_tracking/models.h"
 
 #include "bayes_tracking/BayesFilter/matSup.hpp"
 #include "bayes_tracking/BayesFilter/bayesFlt.hpp"
@@ -30,6 +31,137 @@ using namespace Bayesian_filter;
 using namespace Bayesian_filter_matrix;
 
 
+#ifdef BAYES_FILTER_FIXED_SIZE
+/*
+ * Fixed size steps, the same algebra as the uBLAS one of Covariance_scheme
+ * on stack matrices: N state, Q noise and M observation sizes
+ */
+namespace
+{
+
+template <std::size_t N, std::size_t Q>
+Bayes_base::Float fixed_predict(EKFilter& filter, Linrz_predict_model& f)
+{
+    filter.x = f.f(filter.x);
+    fixed::Matrix<N,N> Fx, X;
+    fixed::Matrix<N,Q> G;
+    fixed::Vec<Q> q;
+    fixed::assign(Fx, f.Fx);
+    fixed::assign(X, filter.X);
+    fixed::assign(G, f.G);
+    fixed::assign(q, f.q);
+    // X = Fx*X*Fx' + G*q*G'
+    fixed::Matrix<N,N> XP = fixed::prod_SPD(Fx, X);
+    fixed::plus_assign(XP, fixed::prod_SPD(G, q));
+    fixed::assign_to_sym(filter.X, XP);
+    return 1;
+}
+
+
+template <std::size_t N, std::size_t M>
+void fixed_predict_observation(const EKFilter& filter, const Linrz_correlated_observe_model& h, FM::SymMatrix& R_pred)
+{
+    fixed::Matrix<N,N> X;
+    fixed::Matrix<M,N> Hx;
+    fixed::assign(X, filter.X);
+    fixed::assign(Hx, h.Hx);
+    fixed::assign_to_sym(R_pred, fixed::prod_SPD(Hx, X));
+}
+
+
+/*
+ * Update with innovation s, the covariance of the state updated with the
+ * modified innovation covariance Si, or with S if NULL
+ */
+template <std::size_t N, std::size_t M>
+Bayes_base::Float fixed_observe_innovation(EKFilter& filter, const Linrz_correlated_observe_model& h,
+                                           const FM::Vec& s, const FM::SymMatrix* Si, const char* error_description)
+{
+    fixed::Matrix<N,N> X;
+    fixed::Matrix<M,N> Hx;
+    fixed::Matrix<M,M> Z;
+    fixed::Vec<N> x;
+    fixed::Vec<M> sf;
+    fixed::assign(X, filter.X);
+    fixed::assign(Hx, h.Hx);
+    fixed::assign(Z, h.Z);
+    fixed::assign(x, filter.x);
+    fixed::assign(sf, s);
+
+    // Innovation covariance
+    const fixed::Matrix<N,M> temp_XZ = fixed::prod_trans(X, Hx);
+    fixed::Matrix<M,M> S = fixed::prod(Hx, temp_XZ);
+    fixed::plus_assign(S, Z);
+    fixed::assign_to_sym(filter.S, S);
+
+    // Inverse innovation covariance
+    fixed::Matrix<M,M> SI;
+    Bayes_base::Float rcond = fixed::UdUinversePD(SI, S);
+    filter.rclimit.check_PD(rcond, error_description);
+    fixed::assign_to_sym(filter.SI, SI);
+
+    // Kalman gain, X*Hx'*SI
+    const fixed::Matrix<N,M> W = fixed::prod(temp_XZ, SI);
+    fixed::assign_to(filter.W, W);
+
+    // State update
+    const fixed::Vec<N> dx = fixed::prod(W, sf);
+    for (std::size_t i = 0; i < N; ++i)
+        x[i] += dx[i];
+    fixed::assign_to(filter.x, x);
+    if (Si) {
+        fixed::assign(S, *Si);
+    }
+    fixed::minus_assign(X, fixed::prod_SPD(W, S));
+    fixed::assign_to_sym(filter.X, X);
+
+    return rcond;
+}
+
+}//namespace
+#endif
+
+
+/*
+ * Prediction with the constant velocity models in closed form: Fx is the same
+ * [1 dt; 0 1] block on [x, vx], [y, vy] (and [z, vz] in 3D), and G*q*G' is
+ * zero across them, so X = Fx*X*Fx' + G*q*G' is a few multiply-adds per
+ * element of its upper triangle, in place
+ */
+namespace
+{
+
+template <class CV>
+Bayes_base::Float cv_predict(EKFilter& filter, const CV& f)
+{
+    const std::size_t axes = CV::q_size;
+    const Float dt = f.dt, dt2 = dt * dt;
+    FM::Vec& x = filter.x;
+    FM::SymMatrix& X = filter.X;
+    for (std::size_t a = 0; a < axes; ++a)
+        x[2*a] += x[2*a+1] * dt;
+    // the [p, vp] blocks of every axis, with their noise
+    for (std::size_t a = 0; a < axes; ++a) {
+        const std::size_t p = 2*a, v = 2*a+1;
+        const Float g0 = f.G(p,a), g1 = f.G(v,a), q = f.q[a];
+        X(p,p) += 2 * dt * X(p,v) + dt2 * X(v,v) + g0 * g0 * q;
+        X(p,v) += dt * X(v,v) + g0 * g1 * q;
+        X(v,v) += g1 * g1 * q;
+    }
+    // the cross blocks, X(va,vb) unchanged
+    for (std::size_t a = 0; a < axes; ++a)
+        for (std::size_t b = a + 1; b < axes; ++b) {
+            const std::size_t pa = 2*a, va = 2*a+1, pb = 2*b, vb = 2*b+1;
+            X(pa,pb) += dt * (X(pa,vb) + X(va,pb)) + dt2 * X(va,vb);
+            X(pa,vb) += dt * X(va,vb);
+            X(va,pb) += dt * X(va,vb);
+        }
+    return 1;
+}
+
+}//namespace
+
+
 EKFilter::EKFilter(std::size_t x_size) :
         Kalman_state_filter(x_size),
         Covariance_scheme(x_size),
@@ -67,6 +199,18 @@ void EKFilter::init(const FM::Vec& x0, const FM::SymMatrix& P0)
 
 Bayes_base::Float EKFilter::predict (Linrz_predict_model& f) {
     dynamic_cast<JacobianModel&>(f).updateJacobian(x); // update model linearization
+    const Models::CVModel* cvm = dynamic_cast<const Models::CVModel*>(&f);
+    if (cvm && x_size == 4)
+        return cv_predict(*this, *cvm);
+    const Models::CVModel3D* cvm3 = dynamic_cast<const Models::CVModel3D*>(&f);
+    if (cvm3 && x_size == 6)
+        return cv_predict(*this, *cvm3);
+#ifdef BAYES_FILTER_FIXED_SIZE
+    if (x_size == 4 && f.q.size() == 2)
+        return fixed_predict<4,2>(*this, f);
+    if (x_size == 6 && f.q.size() == 3)
+        return fixed_predict<6,3>(*this, f);
+#endif
     return Covariance_scheme::predict(f);
 }
 
@@ -94,6 +238,20 @@ void EKFilter::predict_observation(Linrz_correlated_observe_model& observe_model
     dynamic_cast<JacobianModel&>(observe_model).updateJacobian(x); // update model linearization
     z_pred = observe_model.h(x);  // predicted observation
     // covariance of predicted observation
+#ifdef BAYES_FILTER_FIXED_SIZE
+    if (x_size == 4 && observe_model.Hx.size1() == 2) {
+        fixed_predict_observation<4,2>(*this, observe_model, R_pred);
+        return;
+    }
+    if (x_size == 4 && observe_model.Hx.size1() == 1) {
+        fixed_predict_observation<4,1>(*this, observe_model, R_pred);
+        return;
+    }
+    if (x_size == 6 && observe_model.Hx.size1() == 3) {
+        fixed_predict_observation<6,3>(*this, observe_model, R_pred);
+        return;
+    }
+#endif
     Bayesian_filter_matrix::Matrix dum(prod(X, trans(observe_model.Hx)));
     noalias(R_pred) = prod(observe_model.Hx, dum);
 }
@@ -115,6 +273,14 @@ Bayes_base::Float EKFilter::observeInnovation(Linrz_correlated_observe_model& h,
     if (s.size() != h.Z.size1())
         error (Logic_exception("observation and model size inconsistent in observeInnovation"));
     observe_size (s.size());// Dynamic sizing
+#ifdef BAYES_FILTER_FIXED_SIZE
+    if (x_size == 4 && s.size() == 2)
+        return fixed_observe_innovation<4,2>(*this, h, s, &Si, "S not PD in observeInnovation");
+    if (x_size == 4 && s.size() == 1)
+        return fixed_observe_innovation<4,1>(*this, h, s, &Si, "S not PD in observeInnovation");
+    if (x_size == 6 && s.size() == 3)
+        return fixed_observe_innovation<6,3>(*this, h, s, &Si, "S not PD in observeInnovation");
+#endif
 
     // Innovation covariance
     Bayesian_filter_matrix::Matrix temp_XZ (prod(X, trans(h.Hx)));
@@ -145,15 +311,33 @@ EKFilter::observe (Linrz_correlated_observe_model& h, const FM::Vec& z)
     dynamic_cast<JacobianModel&>(h).updateJacobian(x); // update model linearization
 
     Covariance_scheme::update ();
-    const FM::Vec& zp = h.h(x);      // Observation model, zp is predicted observation
-
     if (last_z_size != z.size()) {
         s.resize(z.size());
     }
+
+    // Cartesian observations of diagonal noise, one coordinate at a time;
+    // W and SI are not computed by this path
+    observe_size (z.size());// Dynamic sizing
+    if (Models::sequential_observe(x, X, h, z, s, S))
+        return 1;
+
+    const FM::Vec& zp = h.h(x);      // Observation model, zp is predicted observation
     s = z;
     h.normalise(s, zp);
     FM::noalias(s) -= zp;
 
+#ifdef BAYES_FILTER_FIXED_SIZE
+    if (x_size == 4 && (s.size() == 2 || s.size() == 1) && s.size() == h.Z.size1()) {
+        observe_size (s.size());// Dynamic sizing
+        if (s.size() == 2)
+            return fixed_observe_innovation<4,2>(*this, h, s, NULL, "S not PD in observe");
+        return fixed_observe_innovation<4,1>(*this, h, s, NULL, "S not PD in observe");
+    }
+    if (x_size == 6 && s.size() == 3 && s.size() == h.Z.size1()) {
+        observe_size (s.size());// Dynamic sizing
+        return fixed_observe_innovation<6,3>(*this, h, s, NULL, "S not PD in observe");
+    }
+#endif
     return observe_innovation (h, s);
 }
 
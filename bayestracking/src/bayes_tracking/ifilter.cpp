@@ -0,0 +1,128 @@
+//
+// C++ Implementation: ifilter
+//
+// Description: Extended information filter, whose observations add up
+// before the state is recomputed
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+#include "bayes_tracking/ifilter.h"
+#include "bayes_tracking/jacobianmodel.h"
+
+#include "bayes_tracking/BayesFilter/matSup.hpp"
+
+using namespace Bayesian_filter;
+using namespace Bayesian_filter_matrix;
+
+
+IFilter::IFilter(std::size_t x_size) :
+        Kalman_state_filter(x_size),
+        Information_state_filter(x_size),
+        Information_scheme(x_size),
+        s(Empty), S(Empty)
+{
+    IFilter::x_size = x_size;
+    FM::Vec x0(x_size);
+    x0.clear();
+    FM::SymMatrix P0(x_size, x_size);
+    FM::identity(P0);
+    init(x0, P0);
+}
+
+
+IFilter::IFilter(const FM::Vec& x0, const FM::SymMatrix& P0) :
+        Kalman_state_filter(x0.size()),
+        Information_state_filter(x0.size()),
+        Information_scheme(x0.size()),
+        s(Empty), S(Empty)
+{
+    IFilter::x_size = x0.size();
+    init(x0, P0);
+}
+
+
+IFilter::~IFilter()
+{
+}
+
+
+void IFilter::init(const FM::Vec& x0, const FM::SymMatrix& P0)
+{
+    init_kalman(x0, P0);
+}
+
+
+Bayes_base::Float IFilter::predict (Linrz_predict_model& f) {
+    update();   // x, X of the observations so far
+    dynamic_cast<JacobianModel&>(f).updateJacobian(x); // update model linearization
+    return Information_scheme::predict(f);
+}
+
+
+void IFilter::predict_observation(Linrz_correlated_observe_model& observe_model, FM::Vec& z_pred, FM::SymMatrix& R_pred)
+{
+    dynamic_cast<JacobianModel&>(observe_model).updateJacobian(x); // update model linearization
+    z_pred = observe_model.h(x);  // predicted observation
+    // covariance of predicted observation
+    Bayesian_filter_matrix::Matrix dum(prod(X, trans(observe_model.Hx)));
+    noalias(R_pred) = prod(observe_model.Hx, dum);
+}
+
+
+Bayes_base::Float
+IFilter::observe (Linrz_correlated_observe_model& h, const FM::Vec& z)
+/*
+ * Extended linrz correlated observe, innovation from x, information added to y, Y
+ */
+{
+    dynamic_cast<JacobianModel&>(h).updateJacobian(x); // update model linearization
+    const FM::Vec& zp = h.h(x);      // Observation model, zp is predicted observation
+
+    if (s.size() != z.size()) {
+        s.resize(z.size());
+        S.resize(z.size(), z.size());
+    }
+    s = z;
+    h.normalise(s, zp);
+    FM::noalias(s) -= zp;
+    // innovation covariance, for logLikelihood()
+    Bayesian_filter_matrix::Matrix temp_XZ (prod(X, trans(h.Hx)));
+    noalias(S) = prod(h.Hx, temp_XZ) + h.Z;
+    return observe_innovation (h, s);
+}
+
+
+Bayes_base::Float
+IFilter::observe (Linrz_uncorrelated_observe_model& h, const FM::Vec& z)
+/*
+ * Extended linrz uncorrelated observe, innovation from x, information added to y, Y
+ */
+{
+    dynamic_cast<JacobianModel&>(h).updateJacobian(x); // update model linearization
+    const FM::Vec& zp = h.h(x);      // Observation model, zp is predicted observation
+
+    if (s.size() != z.size()) {
+        s.resize(z.size());
+        S.resize(z.size(), z.size());
+    }
+    s = z;
+    h.normalise(s, zp);
+    FM::noalias(s) -= zp;
+    // innovation covariance, for logLikelihood()
+    Bayesian_filter_matrix::Matrix temp_XZ (prod(X, trans(h.Hx)));
+    noalias(S) = prod(h.Hx, temp_XZ);
+    for (std::size_t i = 0; i < h.Zv.size(); ++i)
+        S(i,i) += h.Zv[i];
+    return observe_innovation (h, s);
+}
+
+
+double IFilter::logLikelihood() {
+    SymMatrix Si(S.size1(), S.size2());
+    Float detS;
+    Float rcond = UdUinversePD(Si, detS, S);  // Si = inv(S)
+    Numerical_rcond rclimit;
+    rclimit.check_PD(rcond, "S not PD in IFilter::logLikelihood");
+    // exp(-0.5 * (s' * Si * s)) / sqrt(2pi^ns * |S|)
+    return -0.5*(inner_prod(trans(s),prod(Si, s))) - 0.5*((double)s.size()*log(2*M_PI)+log(detS));
+}
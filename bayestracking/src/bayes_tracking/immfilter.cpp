@@ -0,0 +1,278 @@
+//
+// C++ Implementation: immfilter
+//
+// Description: Interacting Multiple Model filter of a walking and a standing
+// person, on fixed size matrices
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+#include "bayes_tracking/immfilter.h"
+#include "bayes_tracking/jacobianmodel.h"
+#include "bayes_tracking/models.h"
+
+#include <cmath>
+
+using namespace Bayesian_filter;
+using namespace Bayesian_filter_matrix;
+
+
+IMMFilter::IMMFilter(std::size_t x_size) :
+        Kalman_state_filter(x_size),
+        xi(x_size), zi(Empty), si(Empty)
+{
+    if (x_size != 4)
+        error(Logic_exception("IMMFilter of a state of 4 elements only"));
+    setModes(0.3, 0.3, 0.5);
+    FM::Vec x0(x_size);
+    x0.clear();
+    FM::SymMatrix P0(x_size, x_size);
+    P0.clear();
+    init(x0, P0);
+}
+
+
+IMMFilter::IMMFilter(const FM::Vec& x0, const FM::SymMatrix& P0) :
+        Kalman_state_filter(x0.size()),
+        xi(x0.size()), zi(Empty), si(Empty)
+{
+    if (x0.size() != 4)
+        error(Logic_exception("IMMFilter of a state of 4 elements only"));
+    setModes(0.3, 0.3, 0.5);
+    init(x0, P0);
+}
+
+
+IMMFilter::~IMMFilter()
+{
+}
+
+
+void IMMFilter::init(const FM::Vec& x0, const FM::SymMatrix& P0)
+{
+    init_kalman(x0, P0);
+}
+
+
+void IMMFilter::init()
+{
+    for (std::size_t j = 0; j < MODES; ++j) {
+        fixed::assign(mx[j], x);
+        fixed::assign(mX[j], X);
+        mu[j] = Float(1) / MODES;
+    }
+    m_logLikelihood = 0;
+}
+
+
+void IMMFilter::setModes(Float positionSD, Float velocitySD, Float switchRate)
+{
+    positionVar = positionSD * positionSD;
+    velocityVar = velocitySD * velocitySD;
+    IMMFilter::switchRate = switchRate;
+}
+
+
+void IMMFilter::combine()
+{
+    State xm;
+    for (std::size_t i = 0; i < 4; ++i) {
+        xm[i] = 0;
+        for (std::size_t j = 0; j < MODES; ++j)
+            xm[i] += mu[j] * mx[j][i];
+    }
+    Covariance Xm;
+    fixed::zero(Xm);
+    for (std::size_t j = 0; j < MODES; ++j) {
+        State d;
+        for (std::size_t i = 0; i < 4; ++i)
+            d[i] = mx[j][i] - xm[i];
+        for (std::size_t r = 0; r < 4; ++r)
+            for (std::size_t c = 0; c < 4; ++c)
+                Xm(r,c) += mu[j] * (mX[j](r,c) + d[r] * d[c]);
+    }
+    fixed::assign_to(x, xm);
+    fixed::assign_to_sym(X, Xm);
+}
+
+
+Bayes_base::Float IMMFilter::predict(Linrz_predict_model& f)
+{
+    const Models::CVModel* cvm = dynamic_cast<const Models::CVModel*>(&f);
+    if (cvm == NULL)
+        error(Logic_exception("IMMFilter predicts with a CVModel only"));
+    const Float dt = cvm->dt;
+
+    // Mixing: the probabilities c of the modes after switching, and the mixed
+    // state of each mode from the modes it may come from
+    const Float p = 1 - std::exp(-switchRate * std::fabs(dt));
+    Float c[MODES];
+    for (std::size_t j = 0; j < MODES; ++j) {
+        c[j] = 0;
+        for (std::size_t i = 0; i < MODES; ++i)
+            c[j] += (i == j ? 1 - p : p) * mu[i];
+    }
+    State x0[MODES];
+    Covariance X0[MODES];
+    for (std::size_t j = 0; j < MODES; ++j) {
+        Float w[MODES];
+        for (std::size_t i = 0; i < MODES; ++i)
+            w[i] = c[j] > 0 ? (i == j ? 1 - p : p) * mu[i] / c[j] : (i == j);
+        for (std::size_t r = 0; r < 4; ++r) {
+            x0[j][r] = 0;
+            for (std::size_t i = 0; i < MODES; ++i)
+                x0[j][r] += w[i] * mx[i][r];
+        }
+        fixed::zero(X0[j]);
+        for (std::size_t i = 0; i < MODES; ++i) {
+            State d;
+            for (std::size_t r = 0; r < 4; ++r)
+                d[r] = mx[i][r] - x0[j][r];
+            for (std::size_t r = 0; r < 4; ++r)
+                for (std::size_t s = 0; s < 4; ++s)
+                    X0[j](r,s) += w[i] * (mX[i](r,s) + d[r] * d[s]);
+        }
+    }
+
+    // Walking, the constant velocity model: x = f(x), X = Fx*X*Fx' + G*q*G'
+    fixed::assign_to(xi, x0[WALKING]);
+    dynamic_cast<JacobianModel&>(f).updateJacobian(xi); // update model linearization
+    fixed::assign(mx[WALKING], f.f(xi));
+    fixed::Matrix<4,4> Fx;
+    fixed::Matrix<4,2> G;
+    fixed::Vec<2> q;
+    fixed::assign(Fx, f.Fx);
+    fixed::assign(G, f.G);
+    fixed::assign(q, f.q);
+    mX[WALKING] = fixed::prod_SPD(Fx, X0[WALKING]);
+    fixed::plus_assign(mX[WALKING], fixed::prod_SPD(G, q));
+
+    // Standing: the position drifts, the velocity is only noise
+    const std::size_t position[2] = {0, 2}, velocity[2] = {1, 3};
+    mx[STANDING] = x0[STANDING];
+    mX[STANDING] = X0[STANDING];
+    for (std::size_t a = 0; a < 2; ++a) {
+        const std::size_t v = velocity[a];
+        mx[STANDING][v] = 0;
+        for (std::size_t r = 0; r < 4; ++r)
+            mX[STANDING](r,v) = mX[STANDING](v,r) = 0;
+        mX[STANDING](v,v) = velocityVar;
+        mX[STANDING](position[a],position[a]) += positionVar * std::fabs(dt);
+    }
+
+    for (std::size_t j = 0; j < MODES; ++j)
+        mu[j] = c[j];
+    combine();
+    return 1.;
+}
+
+
+void IMMFilter::predict_observation(Linrz_correlated_observe_model& observe_model, FM::Vec& z_pred, FM::SymMatrix& R_pred)
+{
+    dynamic_cast<JacobianModel&>(observe_model).updateJacobian(x); // update model linearization
+    z_pred = observe_model.h(x);  // predicted observation
+    // covariance of predicted observation
+    if (z_pred.size() == 2) {
+        fixed::Matrix<2,4> Hx;
+        fixed::Matrix<4,4> Xm;
+        fixed::assign(Hx, observe_model.Hx);
+        fixed::assign(Xm, X);
+        fixed::assign_to_sym(R_pred, fixed::prod_SPD(Hx, Xm));
+    }
+    else if (z_pred.size() == 1) {
+        fixed::Matrix<1,4> Hx;
+        fixed::Matrix<4,4> Xm;
+        fixed::assign(Hx, observe_model.Hx);
+        fixed::assign(Xm, X);
+        fixed::assign_to_sym(R_pred, fixed::prod_SPD(Hx, Xm));
+    }
+    else
+        error(Logic_exception("IMMFilter observations of 1 or 2 elements only"));
+}
+
+
+Bayes_base::Float IMMFilter::observe(Linrz_correlated_observe_model& h, const FM::Vec& z)
+{
+    if (zi.size() != z.size()) {
+        zi.resize(z.size());
+        si.resize(z.size());
+    }
+    if (z.size() == 2)
+        return observe_modes<2>(h, z);
+    if (z.size() == 1)
+        return observe_modes<1>(h, z);
+    error(Logic_exception("IMMFilter observations of 1 or 2 elements only"));
+    return 0;
+}
+
+
+template <std::size_t M>
+Bayes_base::Float IMMFilter::observe_modes(Linrz_correlated_observe_model& h, const FM::Vec& z)
+{
+    fixed::Matrix<M,M> Z;
+    fixed::assign(Z, h.Z);
+    Float logL[MODES], rcond = 1;
+    for (std::size_t j = 0; j < MODES; ++j) {
+        fixed::assign_to(xi, mx[j]);
+        dynamic_cast<JacobianModel&>(h).updateJacobian(xi); // update model linearization
+        zi = h.h(xi);
+        h.normalise(si = z, zi);
+        FM::noalias(si) -= zi;
+        fixed::Vec<M> s;
+        fixed::assign(s, si);
+        fixed::Matrix<M,4> Hx;
+        fixed::assign(Hx, h.Hx);
+
+        // Innovation covariance and its inverse, with its determinant
+        fixed::Matrix<M,M> S = fixed::prod_SPD(Hx, mX[j]);
+        fixed::plus_assign(S, Z);
+        fixed::Matrix<M,M> SI, UC;
+        Float r = fixed::UdUinversePD(SI, S);
+        rclimit.check_PD(r, "S not PD in IMMFilter::observe");
+        if (r < rcond)
+            rcond = r;
+        fixed::UCfactor(UC, S);
+        Float logDetS = 0;
+        for (std::size_t i = 0; i < M; ++i)
+            logDetS += 2 * std::log(UC(i,i));
+
+        // Kalman gain and update
+        const fixed::Matrix<4,M> W = fixed::prod(fixed::prod_trans(mX[j], Hx), SI);
+        const fixed::Vec<4> dx = fixed::prod(W, s);
+        for (std::size_t i = 0; i < 4; ++i)
+            mx[j][i] += dx[i];
+        fixed::minus_assign(mX[j], fixed::prod_SPD(W, S));
+
+        const fixed::Vec<M> SIs = fixed::prod(SI, s);
+        Float d2 = 0;
+        for (std::size_t i = 0; i < M; ++i)
+            d2 += s[i] * SIs[i];
+        logL[j] = -0.5 * (d2 + logDetS + Float(M) * std::log(2 * M_PI));
+    }
+
+    // Probabilities of the modes by their likelihoods, relative to the largest
+    Float maxLogL = logL[0];
+    for (std::size_t j = 1; j < MODES; ++j)
+        if (logL[j] > maxLogL)
+            maxLogL = logL[j];
+    Float sum = 0;
+    for (std::size_t j = 0; j < MODES; ++j) {
+        mu[j] *= std::exp(logL[j] - maxLogL);
+        sum += mu[j];
+    }
+    if (!(sum > 0)) {   // the likely mode was impossible, also NaN
+        for (std::size_t j = 0; j < MODES; ++j)
+            mu[j] = 1;
+        sum = MODES;
+    }
+    for (std::size_t j = 0; j < MODES; ++j)
+        mu[j] /= sum;
+    m_logLikelihood = maxLogL + std::log(sum);
+
+    combine();
+    return rcond;
+}
+
+
+double IMMFilter::logLikelihood() {
+    return m_logLikelihood;
+}
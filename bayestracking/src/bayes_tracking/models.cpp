@@ -39,14 +39,29 @@ CVModel::CVModel(Float wxSD, Float wySD) :
    fx(x_size),
    genn(rnd),
    xp(x_size),
-   n(q_size), rootq(q_size),
-   m_wxSD(wxSD), m_wySD(wySD)
+   n(q_size), ns(q_size), rootq(q_size),
+   m_wxSD(wxSD), m_wySD(wySD), m_copies(0)
 {
    first_init = true;
    init();
 }
 
 
+CVModel::CVModel(const CVModel& m) :
+   JacobianModel(m),
+   Linrz_predict_model(m),
+   Sampled_predict_model(m),
+   fx(m.fx), dt(m.dt),
+   rnd(m.rnd), genn(rnd),
+   xp(m.xp),
+   n(m.n), ns(m.ns), rootq(m.rootq),
+   m_wxSD(m.m_wxSD), m_wySD(m.m_wySD),
+   first_init(m.first_init), m_copies(0)
+{
+   rnd.seed(rnd.next(), ++m.m_copies);
+}
+
+
 void CVModel::init()
 {
   Fx.clear();
@@ -139,6 +154,39 @@ const Vec& CVModel::fw(const FM::Vec& x) const
 }
 
 
+void CVModel::fw(FM::ColMatrix& S) const
+{
+   if (first_init)
+      init_GqG();
+   const std::size_t nSamples = S.size2();
+#ifndef BAYES_FILTER_GAPPY
+   if (S.size1() == x_size) {
+      ns.resize(q_size * nSamples, false);
+      genn.normal(ns);                  // in the order of fw(x) sample after sample
+      const Float g00 = G(0,0), g01 = G(0,1), g10 = G(1,0), g11 = G(1,1);
+      const Float g20 = G(2,0), g21 = G(2,1), g30 = G(3,0), g31 = G(3,1);
+      const Float rq0 = rootq[0], rq1 = rootq[1];
+      const Float* nsi = &ns[0];
+      Float* si = &S(0,0);              // the samples are contiguous columns
+      for (std::size_t i = 0; i != nSamples; ++i, si += x_size, nsi += q_size) {
+         const Float n0 = nsi[0] * rq0, n1 = nsi[1] * rq1;
+         const Float x0 = si[0] + si[1] * dt, x2 = si[2] + si[3] * dt;
+         const Float x1 = si[1], x3 = si[3];
+         si[0] = x0 + (g00 * n0 + g01 * n1);
+         si[1] = x1 + (g10 * n0 + g11 * n1);
+         si[2] = x2 + (g20 * n0 + g21 * n1);
+         si[3] = x3 + (g30 * n0 + g31 * n1);
+      }
+      return;
+   }
+#endif
+   for (std::size_t i = 0; i != nSamples; ++i) {
+      FM::ColMatrix::Column Si(S,i);
+      noalias(Si) = fw(Si);
+   }
+}
+
+
 void CVModel::init_GqG() const
 /* initialise predict given a change to q,G
    *  Implementation: Update rootq
@@ -223,6 +271,31 @@ Bayes_base::Float
 }
 
 
+void CartesianModel::weight(const FM::ColMatrix& S, FM::DenseVec& w) const
+{
+   if (!li.zset)
+      Bayes_base::error (Logic_exception ("BGSubModel used without Lz set"));
+   const std::size_t nSamples = S.size2();
+#ifndef BAYES_FILTER_GAPPY
+   if (S.size1() == x_size) {
+      // L(x) of the samples, innovation z - h(x) of each
+      const Float z0 = z[0], z1 = z[1];
+      const Float i00 = li.Z_inv(0,0), i01 = li.Z_inv(0,1), i10 = li.Z_inv(1,0), i11 = li.Z_inv(1,1);
+      const Float logNorm = Float(z_size) * std::log(2*M_PI);
+      const Float* si = &S(0,0);
+      for (std::size_t i = 0; i != nSamples; ++i, si += x_size) {
+         const Float v0 = z0 - si[0], v1 = z1 - si[2];
+         const Float logL = v0 * (i00 * v0 + i01 * v1) + v1 * (i10 * v0 + i11 * v1);
+         w[i] *= std::exp(Float(-0.5) * (logL + logNorm + li.logdetZ));
+      }
+      return;
+   }
+#endif
+   for (std::size_t i = 0; i != nSamples; ++i)
+      w[i] *= L(FM::column(S,i));
+}
+
+
 const FM::Vec& CartesianModel::h(const FM::Vec& x) const
 {
   z_pred[0] = x[0];
@@ -354,13 +427,28 @@ void PolarModel::normalise(FM::Vec& z_denorm, const FM::Vec& z_from) const
    genn(rnd),
    xp(x_size),
    n(q_size), rootq(q_size),
-    m_wxSD(wxSD), m_wySD(wySD),m_wzSD(wzSD)
+    m_wxSD(wxSD), m_wySD(wySD),m_wzSD(wzSD), m_copies(0)
 {
    first_init = true;
    init();
 }
 
 
+CVModel3D::CVModel3D(const CVModel3D& m) :
+   JacobianModel(m),
+   Linrz_predict_model(m),
+   Sampled_predict_model(m),
+   fx(m.fx), dt(m.dt),
+   rnd(m.rnd), genn(rnd),
+   xp(m.xp),
+   n(m.n), rootq(m.rootq),
+   m_wxSD(m.m_wxSD), m_wySD(m.m_wySD), m_wzSD(m.m_wzSD),
+   first_init(m.first_init), m_copies(0)
+{
+   rnd.seed(rnd.next(), ++m.m_copies);
+}
+
+
 void CVModel3D::init()
 {
   Fx.clear();
@@ -681,3 +769,53 @@ void CartesianModel3D::updateJacobian(const FM::Vec& x) {
 
 void CartesianModel3D::normalise(FM::Vec& z_denorm, const FM::Vec& z_from) const {
 }
+
+
+//*************************************************************************
+//                  SEQUENTIAL CARTESIAN OBSERVATION
+//*************************************************************************
+
+bool Models::sequential_observe(FM::Vec& x, FM::SymMatrix& X, const Linrz_correlated_observe_model& h,
+                                const FM::Vec& z, FM::Vec& s, FM::SymMatrix& S)
+{
+  const std::size_t m = z.size(), n = x.size();
+  if (!dynamic_cast<const CartesianModel*>(&h) && !dynamic_cast<const CartesianModel3D*>(&h))
+    return false;
+  if (m != h.Z.size1() || 2*m > n)
+    return false;
+  for (std::size_t i = 0; i < m; ++i)
+    for (std::size_t j = i + 1; j < m; ++j)
+      if (h.Z(i,j) != 0.)
+        return false;
+
+  // the whole innovation and its covariance, for the likelihood of z
+  for (std::size_t i = 0; i < m; ++i) {
+    s[i] = z[i] - x[2*i];
+    for (std::size_t j = i; j < m; ++j)
+      S(i,j) = X(2*i,2*j) + h.Z(i,j);
+  }
+
+  // coordinate i observes the position p = 2i, of gain X(:,p)/Sp
+  for (std::size_t i = 0; i < m; ++i) {
+    const std::size_t p = 2*i;
+    const Float r = h.Z(i,i), Sp = X(p,p) + r;
+    if (!(Sp > 0.))   // also NaN
+      Bayes_base::error (Numeric_exception("S not PD in sequential_observe"));
+    const Float innovation = (z[i] - x[p]) / Sp;
+    for (std::size_t a = 0; a < n; ++a)
+      x[a] += X(a,p) * innovation;
+    // X -= X(:,p)*X(p,:)/Sp, the row and column p last as the others use them
+    for (std::size_t a = 0; a < n; ++a) {
+      if (a == p)
+        continue;
+      const Float Xap = X(a,p) / Sp;
+      for (std::size_t b = a; b < n; ++b)
+        if (b != p)
+          X(a,b) -= Xap * X(b,p);
+    }
+    const Float scale = r / Sp;
+    for (std::size_t a = 0; a < n; ++a)
+      X(a,p) *= scale;
+  }
+  return true;
+}
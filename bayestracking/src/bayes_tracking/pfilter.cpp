@@ -18,6 +18,9 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 #include "bayes_tracking/pfilter.h"
+#include "bayes_tracking/models.h"
+#include <algorithm>
+#include <cmath>
 
 PFilter::PFilter(std::size_t x_size, std::size_t s_size, SIR_random& random_helper) :
         Sample_state_filter (x_size, s_size),
@@ -26,6 +29,8 @@ PFilter::PFilter(std::size_t x_size, std::size_t s_size, SIR_random& random_help
         w(wir)
 {
     PFilter::x_size = x_size;
+    resampleThreshold = 0.5;
+    m_maxSamples = m_minSamples = s_size;
     FM::Vec x0(x_size);
     x0.clear();
     FM::SymMatrix P0(x_size, x_size);
@@ -41,6 +46,8 @@ PFilter::PFilter(std::size_t x_size, std::size_t s_size) :
         w(wir)
 {
     PFilter::x_size = x_size;
+    resampleThreshold = 0.5;
+    m_maxSamples = m_minSamples = s_size;
     FM::Vec x0(x_size);
     x0.clear();
     FM::SymMatrix P0(x_size, x_size);
@@ -59,6 +66,8 @@ PFilter::PFilter(const FM::Vec& x0,
         w(wir)
 {
     PFilter::x_size = x0.size();
+    resampleThreshold = 0.5;
+    m_maxSamples = m_minSamples = s_size;
     init(x0, P0);
 }
 
@@ -72,6 +81,8 @@ PFilter::PFilter(const FM::Vec& x0,
         w(wir)
 {
     PFilter::x_size = x0.size();
+    resampleThreshold = 0.5;
+    m_maxSamples = m_minSamples = s_size;
     init(x0, P0);
 }
 
@@ -83,6 +94,10 @@ PFilter::~PFilter()
 
 void PFilter::init(const FM::Vec& x0, const FM::SymMatrix& P0)
 {
+    if (S.size2() != m_maxSamples) {    // fewer after an adaptive resampling
+        S.resize(x_size, m_maxSamples, false);
+        wir.resize(m_maxSamples, false);
+    }
     SIR_kalman_scheme::init_kalman(x0, P0);
     m_likelihood = 0.;
 }
@@ -90,44 +105,149 @@ void PFilter::init(const FM::Vec& x0, const FM::SymMatrix& P0)
 
 void PFilter::predict(Sampled_predict_model& predict_model)
 {
-    SIR_kalman_scheme::predict(predict_model);
+    // the samples at once with the CV model
+    const Models::CVModel* cvm = dynamic_cast<const Models::CVModel*>(&predict_model);
+    if (cvm) {
+        cvm->fw(S);
+        stochastic_samples = S.size2();
+    }
+    else
+        SIR_kalman_scheme::predict(predict_model);
     update_statistics();
 }
 
 
 void PFilter::predict_observation(Correlated_additive_observe_model& observe_model, FM::Vec& z_pred, FM::SymMatrix& R_pred)
 {
-    z_pred.clear();   // mean
+    // weighted by w while the resampling is deferred, c.f. resampleThreshold
     const std::size_t nSamples = S.size2();
+    Float wsum = Float(nSamples);
+    if (wir_update) {
+        wsum = 0;
+        for (std::size_t i = 0; i != nSamples; ++i)
+            wsum += wir[i];
+    }
+#ifndef BAYES_FILTER_GAPPY
+    if (dynamic_cast<const Models::CartesianModel*>(&observe_model) && S.size1() == 4) {
+        // h(x) is the position of the state
+        const Float* si = &S(0,0);
+        Float z0 = 0, z1 = 0;
+        for (std::size_t i = 0; i != nSamples; ++i, si += 4) {
+            const Float wi = wir_update ? wir[i] : Float(1);
+            z0 += wi * si[0];
+            z1 += wi * si[2];
+        }
+        z0 /= wsum;
+        z1 /= wsum;
+        Float r00 = 0, r01 = 0, r11 = 0;
+        si = &S(0,0);
+        for (std::size_t i = 0; i != nSamples; ++i, si += 4) {
+            const Float wi = wir_update ? wir[i] : Float(1);
+            const Float d0 = si[0] - z0, d1 = si[2] - z1;
+            r00 += wi * d0 * d0;
+            r01 += wi * d0 * d1;
+            r11 += wi * d1 * d1;
+        }
+        z_pred[0] = z0;
+        z_pred[1] = z1;
+        R_pred(0,0) = r00 / wsum;
+        R_pred(0,1) = r01 / wsum;
+        R_pred(1,1) = r11 / wsum;
+        return;
+    }
+#endif
+    z_pred.clear();   // mean
     for (std::size_t i = 0; i != nSamples; ++i) {
         FM::ColMatrix::Column Si(S,i);
-        z_pred.plus_assign (observe_model.h(Si));
+        const Float wi = wir_update ? wir[i] : Float(1);
+        z_pred.plus_assign (wi * observe_model.h(Si));
     }
-    z_pred /= Float(S.size2());
+    z_pred /= wsum;
 
     R_pred.clear();   // Covariance
     for (std::size_t i = 0; i != nSamples; ++i) {
         FM::ColMatrix::Column Si(S,i);
-        R_pred.plus_assign (FM::outer_prod(observe_model.h(Si)-z_pred, observe_model.h(Si)-z_pred));
+        const Float wi = wir_update ? wir[i] : Float(1);
+        R_pred.plus_assign (wi * FM::outer_prod(observe_model.h(Si)-z_pred, observe_model.h(Si)-z_pred));
     }
-    R_pred /= Float(nSamples);
+    R_pred /= wsum;
 }
 
 
 void PFilter::observe(Likelihood_observe_model& observe_model, const FM::Vec& z)
 {
-    SIR_kalman_scheme::observe(observe_model, z);
-    // keep note of the weight sum (non-normalized likelihood)
+    // the samples at once with the Cartesian model
+    Models::CartesianModel* cm = dynamic_cast<Models::CartesianModel*>(&observe_model);
+    if (cm) {
+        cm->Lz(z);
+        cm->weight(S, wir);
+        wir_update = true;
+    }
+    else
+        SIR_kalman_scheme::observe(observe_model, z);
+    // keep note of the weight mean (normalized likelihood), the resampling may change the samples
     const std::size_t nSamples = S.size2();
     m_likelihood = 0;
     for (std::size_t i = 0; i != nSamples; ++i) {
         m_likelihood += wir[i];
     }
+    m_likelihood /= nSamples;
     // resample
     SIR_kalman_scheme::update_resample(/*Systematic_resampler()*/);
 }
 
 
 double PFilter::logLikelihood() {
-    return log(m_likelihood) - log(S.size2());   // normalized likelihood (S are samples, not covariance)
+    return log(m_likelihood);
+}
+
+
+void PFilter::setAdaptiveSamples(const FM::Vec& bins, std::size_t minSamples, double epsilon, double z)
+{
+    m_bins.assign(bins.begin(), bins.end());
+    m_minSamples = std::max(std::min(minSamples, m_maxSamples), std::size_t(1));
+    m_epsilon = epsilon;
+    m_z = z;
+}
+
+
+std::size_t PFilter::resample_size()
+{
+    const std::size_t nSamples = S.size2(), n = S.size1();
+    if (m_bins.size() != n)
+        return m_maxSamples;
+    // k bins occupied by the samples of non-zero weight, open addressing on their coordinates
+    std::size_t tableSize = 16;
+    while (tableSize < 2 * nSamples)
+        tableSize *= 2;
+    m_binTable.assign(tableSize, 0);
+    std::size_t k = 0;
+    for (std::size_t i = 0; i != nSamples; ++i) {
+        if (!(wir[i] > 0))
+            continue;
+        std::size_t key = 0;
+        for (std::size_t j = 0; j != n; ++j) {
+            if (m_bins[j] > 0)
+                key = key * 1000003u + std::size_t(long(std::floor(S(j,i) / m_bins[j])));
+        }
+        key += key == 0;                // 0 marks an empty slot
+        std::size_t h = (key ^ (key >> 15)) * 2654435761u;
+        for (h = (h ^ (h >> 13)) & (tableSize - 1); m_binTable[h] != 0 && m_binTable[h] != key; h = (h + 1) & (tableSize - 1))
+            ;
+        if (m_binTable[h] == 0) {
+            m_binTable[h] = key;
+            k++;
+        }
+    }
+    // samples for a KL divergence below epsilon with probability 1-delta, Wilson-Hilferty
+    // approximation of the chi-square quantile with k-1 degrees of freedom [Fox 2003]
+    double samples = 0;
+    if (k > 1) {
+        const double a = 2. / (9. * (k - 1));
+        const double b = 1. - a + std::sqrt(a) * m_z;
+        samples = std::ceil((k - 1) / (2. * m_epsilon) * b * b * b);
+    }
+    if (!(samples < double(m_maxSamples)))  // also NaN
+        return m_maxSamples;
+    return std::max(std::size_t(samples), m_minSamples);
 }
@@ -0,0 +1,181 @@
+//
+// C++ Implementation: taskpool
+//
+// Description: Pool of threads running the items of a task, which they
+// steal from each other, for the phases of MultiTracker
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+#include "bayes_tracking/taskpool.h"
+#include "bayes_tracking/BayesFilter/bayesException.hpp"
+
+#include <stdexcept>
+#include <boost/bind/bind.hpp>
+
+using namespace MTRK;
+
+
+TaskPool::TaskPool(size_t threads) :
+        m_task(NULL), m_generation(0), m_running(0), m_stop(false),
+        m_failure(NO_FAILURE), m_what(NULL)
+{
+    if (threads == 0)
+        threads = boost::thread::hardware_concurrency();
+    if (threads == 0) // unknown
+        threads = 1;
+    for (size_t w = 0; w < threads; ++w) {
+        m_ranges.push_back(new range_t);
+        m_ranges[w]->begin = m_ranges[w]->end = 0;
+    }
+    for (size_t w = 1; w < threads; ++w)
+        m_threads.push_back(new boost::thread(boost::bind(&TaskPool::work, this, w)));
+}
+
+
+TaskPool::~TaskPool()
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_stop = true;
+    }
+    m_started.notify_all();
+    for (size_t t = 0; t < m_threads.size(); ++t) {
+        m_threads[t]->join();
+        delete m_threads[t];
+    }
+    for (size_t w = 0; w < m_ranges.size(); ++w)
+        delete m_ranges[w];
+}
+
+
+void TaskPool::run(Task& task, size_t n)
+{
+    const size_t workers = m_ranges.size();
+    if (workers == 1 || n < 2) {
+        for (size_t i = 0; i < n; ++i)
+            task(i, 0);
+        return;
+    }
+    for (size_t w = 0; w < workers; ++w) {
+        boost::mutex::scoped_lock lock(m_ranges[w]->mutex);
+        m_ranges[w]->begin = n * w / workers;
+        m_ranges[w]->end = n * (w + 1) / workers;
+    }
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_task = &task;
+        m_running = workers - 1;
+        m_failure = NO_FAILURE;
+        ++m_generation;
+    }
+    m_started.notify_all();
+    execute(0);
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (m_running)
+        m_finished.wait(lock);
+    m_task = NULL;
+    switch (m_failure) {
+    case NO_FAILURE:
+        break;
+    case NUMERIC_FAILURE:
+        throw Bayesian_filter::Numeric_exception(m_what);
+    case LOGIC_FAILURE:
+        throw Bayesian_filter::Logic_exception(m_what);
+    case OTHER_FAILURE:
+        throw std::runtime_error(m_message);
+    }
+}
+
+
+void TaskPool::work(size_t worker)
+{
+    unsigned long generation = 0;
+    for (;;) {
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            while (m_generation == generation && !m_stop)
+                m_started.wait(lock);
+            if (m_stop)
+                return;
+            generation = m_generation;
+        }
+        execute(worker);
+        boost::mutex::scoped_lock lock(m_mutex);
+        if (--m_running == 0)
+            m_finished.notify_one();
+    }
+}
+
+
+void TaskPool::execute(size_t worker)
+{
+    try {
+        size_t i;
+        while (take(worker, i))
+            (*m_task)(i, worker);
+    }
+    catch (const Bayesian_filter::Numeric_exception& e) {
+        fail(NUMERIC_FAILURE, e.what());
+    }
+    catch (const Bayesian_filter::Logic_exception& e) {
+        fail(LOGIC_FAILURE, e.what());
+    }
+    catch (const std::exception& e) {
+        fail(OTHER_FAILURE, e.what());
+    }
+    catch (...) {
+        fail(OTHER_FAILURE, "unknown exception in a TaskPool task");
+    }
+}
+
+
+bool TaskPool::take(size_t worker, size_t& i)
+{
+    range_t& own = *m_ranges[worker];
+    {
+        boost::mutex::scoped_lock lock(own.mutex);
+        if (own.begin < own.end) {
+            i = own.begin++;
+            return true;
+        }
+    }
+    // steal the back half of the items of the next thread having some
+    const size_t workers = m_ranges.size();
+    for (size_t k = 1; k < workers; ++k) {
+        range_t& other = *m_ranges[(worker + k) % workers];
+        size_t begin, end;
+        {
+            boost::mutex::scoped_lock lock(other.mutex);
+            if (other.begin >= other.end)
+                continue;
+            end = other.end;
+            begin = other.end = other.end - (other.end - other.begin + 1) / 2;
+        }
+        i = begin;
+        boost::mutex::scoped_lock lock(own.mutex);
+        own.begin = begin + 1;
+        own.end = end;
+        return true;
+    }
+    return false;
+}
+
+
+void TaskPool::fail(failure_t failure, const char* what)
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        if (m_failure == NO_FAILURE) {
+            m_failure = failure;
+            m_what = what;
+            if (failure == OTHER_FAILURE)
+                m_message = what;
+        }
+    }
+    // the items not started yet are dropped
+    for (size_t w = 0; w < m_ranges.size(); ++w) {
+        boost::mutex::scoped_lock lock(m_ranges[w]->mutex);
+        m_ranges[w]->begin = m_ranges[w]->end;
+    }
+}
@@ -19,10 +19,9 @@
  ***************************************************************************/
 #include "bayes_tracking/trackwin.h"
 #include <iostream>
+#include <boost/bind/bind.hpp>
 
-const double TrackWin::NO_ORIENTATION=DBL_MAX;
-
-TrackWin::TrackWin(const char* name, int width, int height, double scale)
+TrackWin::TrackWin(const char* name, int width, int height, double scale, bool asynchronous)
 {
     _name = new char[strlen(name)+1];
     strcpy(_name, name);
@@ -37,13 +36,16 @@ TrackWin::TrackWin(const char* name, int width, int height, double scale)
     _x0 = 0;
     _y0 = 0;
     _th0 = 0;
-    _cosTh0 = 1;
-    _sinTh0 = 0;
-    _text = new char[TEXT_LENGTH + 1];
-    _text[TEXT_LENGTH] = _text[0] = '\0';
-    _textColor = BLACK;
     _textPos = cvPoint((int)(20 * scale/SCALE_FACTOR), (int)(m_winHeight - 20 * scale/SCALE_FACTOR));
     cvInitFont(&_font, CV_FONT_HERSHEY_PLAIN, 0.5 * scale/SCALE_FACTOR, 0.5 * scale/SCALE_FACTOR, 0, 1, CV_AA);
+
+    for (int i = 0; i < SNAPSHOTS; i++)
+        clear(m_snapshots[i]);
+    m_current = &m_snapshots[0];
+    m_asynchronous = asynchronous;
+    m_thread = NULL;
+    m_stop = false;
+    m_dropped = 0;
 }
 
 void TrackWin::create()
@@ -53,6 +55,16 @@ void TrackWin::create()
         // create image
         _canvas = cvCreateImage(cvSize(m_winWidth, m_winHeight), IPL_DEPTH_8U, 3);
         cvSet(_canvas, cvScalar(255, 255, 255));
+        _created = true;
+        if (m_asynchronous) {
+            // the window is created, shown and destroyed by its thread
+            for (int i = 0; i < SNAPSHOTS; i++)
+                if (&m_snapshots[i] != m_current)
+                    m_free.push(&m_snapshots[i]);
+            m_stop = false;
+            m_thread = new boost::thread(boost::bind(&TrackWin::render, this));
+            return;
+        }
         // create window
         cvNamedWindow(_name, CV_WINDOW_AUTOSIZE);
         cvShowImage(_name, _canvas);
@@ -67,16 +79,27 @@ void TrackWin::destroy()
 {
     if (_created)
     {
-        cvDestroyWindow(_name);
+        if (m_thread) {
+            m_stop = true;
+            m_thread->join();
+            delete m_thread;
+            m_thread = NULL;
+            // every snapshot back to the caller
+            snapshot_t* snapshot;
+            while (m_ready.pop(snapshot) || m_free.pop(snapshot))
+                clear(*snapshot);
+        }
+        else
+            cvDestroyWindow(_name);
         cvReleaseImage(&_canvas);
+        _created = false;
     }
 }
 
 TrackWin::~TrackWin()
 {
     destroy();
-    delete _text;
-    delete _name;
+    delete[] _name;
 }
 
 void TrackWin::setObject(const char* label,
@@ -89,8 +112,16 @@ void TrackWin::setObject(const char* label,
                          double covxy,
                          const ColMatrix* samples)
 {
-    t_object obj = {label, xpos, ypos, orientation, color, varx, vary, covxy, samples};
-    _objVector.push_back(obj);
+    t_object obj = {label, xpos, ypos, orientation, color, varx, vary, covxy, NULL};
+    m_current->objects.push_back(obj);
+    // the samples are copied, the filter may change them before they are drawn
+    if (samples != NULL) {
+        for (size_t n = 0; n < samples->size2(); n++) {
+            m_current->samples.push_back((*samples)(0, n));
+            m_current->samples.push_back((*samples)(1, n));
+        }
+    }
+    m_current->samplesEnd.push_back(m_current->samples.size());
 }
 
 
@@ -99,31 +130,94 @@ void TrackWin::setOrigin(double x0, double y0, double th0)
     _x0 = x0;
     _y0 = y0;
     _th0 = th0;
-    _cosTh0 = cos(_th0);
-    _sinTh0 = sin(_th0);
 }
 
 
 void TrackWin::setText(const char* text, color_t color)
 {
-    strncpy(_text, text, TEXT_LENGTH);
-    _textColor = color;
+    m_current->text.assign(text, strnlen(text, TEXT_LENGTH));
+    m_current->textColor = color;
 }
 
 
-const double maxRange = 10.;
+void TrackWin::clear(snapshot_t& snapshot)
+{
+    // the vectors keep their memory for the next updates
+    snapshot.objects.clear();
+    snapshot.samples.clear();
+    snapshot.samplesEnd.clear();
+    snapshot.text.clear();
+    snapshot.textColor = BLACK;
+    snapshot.save.clear();
+}
+
 
 void TrackWin::update(int delay, double cameraView, double cx, double cy)
 {
+    snapshot_t& snapshot = *m_current;
+    snapshot.x0 = _x0;
+    snapshot.y0 = _y0;
+    snapshot.th0 = _th0;
+    snapshot.delay = delay;
+    snapshot.cameraView = cameraView;
+    snapshot.cx = cx;
+    snapshot.cy = cy;
+    if (!m_thread) {
+        draw(snapshot);
+        cvShowImage(_name, _canvas);
+        clear(snapshot);
+        // process graphic events
+        cvWaitKey(delay);
+        return;
+    }
+    // queue it if the thread has a free snapshot to fill next, drop it otherwise
+    snapshot_t* next;
+    if (m_free.pop(next)) {
+        m_ready.push(m_current);
+        m_current = next;
+    }
+    else
+        m_dropped.fetch_add(1, boost::memory_order_relaxed);
+    clear(*m_current);
+}
+
+
+void TrackWin::render()
+{
+    cvNamedWindow(_name, CV_WINDOW_AUTOSIZE);
+    cvShowImage(_name, _canvas);
+    int delay = 100;
+    while (!m_stop.load(boost::memory_order_relaxed)) {
+        snapshot_t* snapshot;
+        if (m_ready.pop(snapshot)) {
+            draw(*snapshot);
+            cvShowImage(_name, _canvas);
+            if (!snapshot->save.empty())
+                cvSaveImage(snapshot->save.c_str(), _canvas);
+            delay = snapshot->delay > 0 ? snapshot->delay : 1;
+            m_free.push(snapshot);
+        }
+        // process graphic events, and wait for the next snapshot
+        cvWaitKey(delay);
+    }
+    cvDestroyWindow(_name);
+}
+
+
+const double maxRange = 10.;
+
+void TrackWin::draw(const snapshot_t& snapshot)
+{
+    const double cosTh0 = cos(snapshot.th0), sinTh0 = sin(snapshot.th0);
     // clear the canvas
     cvSet(_canvas, cvScalar(235, 235, 235));
     // camera field of view
-    if (cameraView > 0) {
+    if (snapshot.cameraView > 0) {
         int npts = 3;
         CvPoint* pts = new CvPoint[3];
-        int delta = (int)((maxRange * sin(cameraView/2.)) * m_scale);
-        pts[0].x = m_xoffset - (int)(cy*m_scale);
-        pts[0].y = m_yoffset - (int)(cx*m_scale);
+        int delta = (int)((maxRange * sin(snapshot.cameraView/2.)) * m_scale);
+        pts[0].x = m_xoffset - (int)(snapshot.cy*m_scale);
+        pts[0].y = m_yoffset - (int)(snapshot.cx*m_scale);
         pts[1].x = delta + pts[0].x;
         pts[1].y = pts[0].y - (int)(maxRange * m_scale);
         pts[2].x = pts[0].x - delta;
@@ -141,36 +235,35 @@ void TrackWin::update(int delay, double cameraView, double cx, double cy)
            cvPoint(m_xoffset, -m_scale + m_yoffset),
            CV_RGB(192,192,192), 1);
     // draw all the objects
-    for (uint i = 0; i < _objVector.size(); i++) {
-        double dx = _objVector[i].x - _x0;
-        double dy = _objVector[i].y - _y0;
-        int x0 = (int)((dx * _cosTh0 + dy * _sinTh0) * m_scale + m_xoffset);
-        int y0 = (int)(-(-dx * _sinTh0 + dy * _cosTh0) * m_scale + m_yoffset);
-        CvScalar color = getColor(_objVector[i].color);
+    const std::vector<t_object>& objects = snapshot.objects;
+    for (uint i = 0; i < objects.size(); i++) {
+        double dx = objects[i].x - snapshot.x0;
+        double dy = objects[i].y - snapshot.y0;
+        int x0 = (int)((dx * cosTh0 + dy * sinTh0) * m_scale + m_xoffset);
+        int y0 = (int)(-(-dx * sinTh0 + dy * cosTh0) * m_scale + m_yoffset);
+        CvScalar color = getColor(objects[i].color);
         // samples
-        if (_objVector[i].s != NULL) {
-            for (size_t n = 0; n < (_objVector[i].s)->size2(); n++) {
-                double dx = (*_objVector[i].s)(0, n) - _x0;
-                double dy = (*_objVector[i].s)(1, n) - _y0;
-                int x = (int)((dx * _cosTh0 + dy * _sinTh0) * m_scale + m_xoffset);
-                int y = (int)(-(-dx * _sinTh0 + dy * _cosTh0) * m_scale + m_yoffset);
-                cvCircle(_canvas, cvPoint(x, y), 0, color, 1);
-            }
+        for (size_t n = i ? snapshot.samplesEnd[i-1] : 0; n < snapshot.samplesEnd[i]; n += 2) {
+            double dx = snapshot.samples[n] - snapshot.x0;
+            double dy = snapshot.samples[n+1] - snapshot.y0;
+            int x = (int)((dx * cosTh0 + dy * sinTh0) * m_scale + m_xoffset);
+            int y = (int)(-(-dx * sinTh0 + dy * cosTh0) * m_scale + m_yoffset);
+            cvCircle(_canvas, cvPoint(x, y), 0, color, 1);
         }
         // circle
         int r = (int)(0.25 * m_scale);
         cvCircle(_canvas, cvPoint(x0, y0), r, color, 1, CV_AA);
         // orientation
-        if (_objVector[i].th != NO_ORIENTATION) {
-            int x1 = x0 + (int)(r * cos(_objVector[i].th - _th0));
-            int y1 = y0 - (int)(r * sin(_objVector[i].th - _th0));
+        if (objects[i].th != NO_ORIENTATION) {
+            int x1 = x0 + (int)(r * cos(objects[i].th - snapshot.th0));
+            int y1 = y0 - (int)(r * sin(objects[i].th - snapshot.th0));
             cvLine(_canvas, cvPoint(x0, y0), cvPoint(x1, y1), color, 1, CV_AA);
         }
         // variance
-        if ((_objVector[i].varx > 0) && (_objVector[i].vary > 0)) {
+        if ((objects[i].varx > 0) && (objects[i].vary > 0)) {
 	  //Covariance matrix of our data
 	  double scale2 = m_scale*m_scale;
-	  Mat covmat = (Mat_<double>(2,2) << _objVector[i].varx*scale2, _objVector[i].covxy*scale2, _objVector[i].covxy*scale2, _objVector[i].vary*scale2);	
+	  Mat covmat = (Mat_<double>(2,2) << objects[i].varx*scale2, objects[i].covxy*scale2, objects[i].covxy*scale2, objects[i].vary*scale2);	
 
 	  //The mean of our data
 	  Point2f mean(x0,y0);
@@ -183,18 +276,12 @@ void TrackWin::update(int delay, double cameraView, double cx, double cy)
         }
 
         // label
-        if (strlen(_objVector[i].label.c_str()) > 0)
-            cvPutText(_canvas, _objVector[i].label.c_str(), cvPoint(x0, y0-r-5), &_font, color);
+        if (objects[i].label.size() > 0)
+            cvPutText(_canvas, objects[i].label.c_str(), cvPoint(x0, y0-r-5), &_font, color);
     }
-    _objVector.clear();
     // draw the text
-    if (strlen(_text) > 0)
-        cvPutText(_canvas, _text, _textPos, &_font, getColor(_textColor));
-    cvShowImage(_name, _canvas);
-    // delete text buffer
-    _text[0] = '\0';
-    // process graphic events
-    cvWaitKey(delay);
+    if (snapshot.text.size() > 0)
+        cvPutText(_canvas, snapshot.text.c_str(), _textPos, &_font, getColor(snapshot.textColor));
 }
 
 
@@ -273,5 +360,8 @@ CvScalar TrackWin::getColor(color_t color)
 
 void TrackWin::saveSnapshot(const char* filename)
 {
-    cvSaveImage(filename, _canvas);
+    if (m_thread)
+        m_current->save = filename;  // saved by the thread once drawn
+    else
+        cvSaveImage(filename, _canvas);
 }
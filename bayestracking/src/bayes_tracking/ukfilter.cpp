@@ -20,7 +20,9 @@
 #include "bayes_tracking/ukfilter.h"
 #include <boost/numeric/ublas/io.hpp>
 #include <float.h>
+#include <limits>
 // #include "utility.h"
+#include "bayes_tracking/models.h"
 
 #include "bayes_tracking/BayesFilter/matSup.hpp"
 #include "bayes_tracking/BayesFilter/bayesFlt.hpp"
@@ -29,13 +31,358 @@ using namespace Bayesian_filter;
 using namespace Bayesian_filter_matrix;
 
 
+#ifdef BAYES_FILTER_FIXED_SIZE
+/*
+ * Fixed size steps, the same algebra as the uBLAS one of Unscented_scheme
+ * and UKFilter on stack matrices: N state, Q noise and M observation sizes.
+ * The models are still called with uBLAS vectors, the preallocated xi, zi
+ * and z0 of the filter.
+ * The steps are those of the square root UKF: the covariance is carried by
+ * its square root UC, UC*UC' = X, which gives the unscented points
+ * directly. A prediction triangularizes the weighted points and the noise
+ * and an observation downdates UC by the gain, so X is only factorized
+ * again once it has been changed by anything else.
+ */
+namespace
+{
+
+const Float NaN = std::numeric_limits<Float>::quiet_NaN();
+
+
+/*
+ * The weights of the unscented points of N states and a kappa, cached in w
+ */
+const UKFilter::Unscented_weights& unscented_weights(UKFilter::Unscented_weights& w, std::size_t N, Float kappa)
+{
+    if (w.kappa != kappa) {     // also NaN
+        Float x_kappa = Float(N) + kappa;
+        w.kappa = kappa;
+        w.sqrt_scale = std::sqrt(x_kappa);
+        w.center = kappa / x_kappa;
+        w.point = 1 / (2*x_kappa);
+        w.sqrt_point = std::sqrt(w.point);
+    }
+    return w;
+}
+
+
+/*
+ * Square root UC of the covariance X of the filter: the stored one while X is
+ * still UC_X, else UC is factorized and stored
+ */
+template <std::size_t N>
+void fixed_root(const UKFilter& filter, fixed::Matrix<N,N>& UC, FM::Matrix& UC_store, FM::SymMatrix& UC_X,
+                const char* error_description)
+{
+    bool stored = true;
+    for (std::size_t i = 0; i < N && stored; ++i)
+        for (std::size_t j = i; j < N; ++j)
+            if (filter.X(i,j) != UC_X(i,j)) {   // also NaN
+                stored = false;
+                break;
+            }
+    if (stored) {
+        fixed::assign(UC, UC_store);
+        return;
+    }
+
+    // Get a upper Cholesky factoriation
+    fixed::Matrix<N,N> X;
+    fixed::assign(X, filter.X);
+    Float rcond = fixed::UCfactor(UC, X);
+    filter.rclimit.check_PSD(rcond, error_description);
+    fixed::assign_to(UC_store, UC);
+    fixed::assign_to_sym(UC_X, X);
+}
+
+
+/*
+ * x, and X = UC*UC' with its square root UC, to the filter
+ */
+template <std::size_t N>
+void fixed_store(UKFilter& filter, const fixed::Vec<N>& x, const fixed::Matrix<N,N>& UC,
+                 FM::Matrix& UC_store, FM::SymMatrix& UC_X)
+{
+    const fixed::Matrix<N,N> X = fixed::prod_trans(UC, UC);
+    fixed::assign_to(filter.x, x);
+    fixed::assign_to_sym(filter.X, X);
+    fixed::assign_to(UC_store, UC);
+    fixed::assign_to_sym(UC_X, X);
+}
+
+
+template <std::size_t N>
+void fixed_unscented(fixed::Vec<N>* XX, const fixed::Vec<N>& x, const fixed::Matrix<N,N>& UC,
+                     const UKFilter::Unscented_weights& w)
+{
+    // Generate XX with the same sample Mean and Covar as before
+    XX[0] = x;
+    for (std::size_t c = 0; c < N; ++c) {
+        for (std::size_t i = 0; i < N; ++i) {
+            Float sigma = w.sqrt_scale * UC(i,c);
+            XX[c+1][i] = x[i] + sigma;
+            XX[N+c+1][i] = x[i] - sigma;
+        }
+    }
+}
+
+
+/*
+ * Mean of the unscented points YY, in place of their deviations from the
+ * mean: YY0 stays the center point
+ */
+template <std::size_t N, std::size_t M>
+void fixed_unscented_mean(fixed::Vec<M>* YY, fixed::Vec<M>& mean, const UKFilter::Unscented_weights& w)
+{
+    const std::size_t XX_size = 2*N+1;
+
+    for (std::size_t j = 0; j < M; ++j) {
+        Float m = 0;
+        for (std::size_t i = 1; i < XX_size; ++i)
+            m += YY[i][j];
+        mean[j] = YY[0][j] * w.center + m * w.point;
+    }
+    for (std::size_t i = 0; i < XX_size; ++i)
+        for (std::size_t j = 0; j < M; ++j)
+            YY[i][j] -= mean[j];
+}
+
+
+template <std::size_t N, std::size_t Q>
+void fixed_predict(UKFilter& filter, Additive_predict_model& f, const UKFilter::Unscented_weights& w, FM::Vec& xi,
+                   FM::Matrix& UC_store, FM::SymMatrix& UC_X)
+{
+    const std::size_t XX_size = 2*N+1;
+    fixed::Vec<N> x, XX[XX_size];
+    fixed::Matrix<N,N> UC;
+    fixed::assign(x, filter.x);
+    fixed_root(filter, UC, UC_store, UC_X, "X not PSD");
+
+    // Create Unscented distribution
+    fixed_unscented(XX, x, UC, w);
+
+    // Predict points of XX using supplied predict model
+    for (std::size_t i = 0; i < XX_size; ++i) {
+        fixed::assign_to(xi, XX[i]);
+        fixed::assign(XX[i], f.f(xi));
+    }
+    fixed_unscented_mean<N,N>(XX, x, w);
+
+    // Square root of the covariance of the points but the center one, plus the additive noise Q = G*q*G'
+    fixed::Matrix<N,2*N+Q> A;
+    for (std::size_t i = 1; i < XX_size; ++i)
+        for (std::size_t j = 0; j < N; ++j)
+            A(j,i-1) = w.sqrt_point * XX[i][j];
+    for (std::size_t k = 0; k < Q; ++k) {
+        if (f.q[k] < 0)
+            Bayes_base::error(Numeric_exception("Predict q Not PSD"));
+        Float sqrt_q = std::sqrt(f.q[k]);
+        for (std::size_t j = 0; j < N; ++j)
+            A(j,2*N+k) = f.G(j,k) * sqrt_q;
+    }
+    fixed::UCtriangle(UC, A);
+
+    // Center point, a downdate for a negative kappa
+    const fixed::Matrix<N,N> UCpoints = UC;
+    if (!fixed::UCupdate(UC, XX[0], w.center)) {
+        // Not Positive Definite: X as it is, factorized (and checked) by the next step
+        fixed::Matrix<N,N> X = fixed::prod_trans(UCpoints, UCpoints);
+        fixed::add_outer_prod(X, XX[0], XX[0], w.center);
+        fixed::assign_to(filter.x, x);
+        fixed::assign_to_sym(filter.X, X);
+        UC_X(0,0) = NaN;
+        return;
+    }
+    fixed_store(filter, x, UC, UC_store, UC_X);
+}
+
+
+/*
+ * The predicted observation zp of the unscented state of the square root UC,
+ * its covariance Xzz, with the fix for a non-positive semidefinite Xzz if
+ * psd_fix, and its correlation with the state Xxz
+ */
+template <std::size_t N, std::size_t M>
+void fixed_observe_moments(const UKFilter& filter, const Correlated_additive_observe_model& h,
+                           const UKFilter::Unscented_weights& w, const fixed::Matrix<N,N>& UC,
+                           FM::Vec& xi, FM::Vec& zi, FM::Vec& z0, bool psd_fix,
+                           fixed::Vec<M>& zp, fixed::Matrix<M,M>& Xzz, fixed::Matrix<N,M>& Xxz)
+{
+    const std::size_t XX_size = 2*N+1;
+    fixed::Vec<N> x, XX[XX_size];
+    fixed::Vec<M> zXX[XX_size];
+    fixed::assign(x, filter.x);
+
+    // Create unscented distribution
+    fixed_unscented(XX, x, UC, w);
+
+    // Predict points of XX using supplied observation model
+    fixed::assign_to(xi, XX[0]);
+    z0 = h.h(xi);
+    fixed::assign(zXX[0], z0);
+    for (std::size_t i = 1; i < XX_size; ++i) {
+        fixed::assign_to(xi, XX[i]);
+        zi = h.h(xi);
+        // Normalise relative to zXX0
+        h.normalise(zi, z0);
+        fixed::assign(zXX[i], zi);
+    }
+    fixed_unscented_mean<N,M>(zXX, zp, w);
+
+    // Covariance of observation predict, with the fix for non-positive semidefinite covariance
+    fixed::zero(Xzz);
+    for (std::size_t i = 1; i < XX_size; ++i)
+        fixed::add_outer_prod(Xzz, zXX[i], zXX[i]);
+    fixed::scale(Xzz, w.point);
+    fixed::add_outer_prod(Xzz, zXX[0], zXX[0], psd_fix ? w.center + 1 : w.center);
+
+    // Correlation of state with observation: Xxz, the center point adding nothing
+    for (std::size_t i = 1; i < XX_size; ++i)
+        for (std::size_t j = 0; j < N; ++j)
+            XX[i][j] -= x[j];
+    fixed::zero(Xxz);
+    for (std::size_t i = 1; i < XX_size; ++i)
+        fixed::add_outer_prod(Xxz, XX[i], zXX[i]);
+    fixed::scale(Xxz, w.point);
+}
+
+
+/*
+ * Filter update with innovation s, the covariance of the state of square
+ * root UC updated with the modified innovation covariance Si, or with S if
+ * NULL
+ */
+template <std::size_t N, std::size_t M>
+Float fixed_update(UKFilter& filter, const Correlated_additive_observe_model& h,
+                   const fixed::Matrix<M,M>& Xzz, const fixed::Matrix<N,M>& Xxz,
+                   const fixed::Vec<M>& s, const FM::SymMatrix* Si, const char* error_description,
+                   const fixed::Matrix<N,N>& UC, FM::Matrix& UC_store, FM::SymMatrix& UC_X)
+{
+    // Innovation covariance
+    fixed::Matrix<M,M> S, Z;
+    fixed::assign(Z, h.Z);
+    S = Xzz;
+    fixed::plus_assign(S, Z);
+    fixed::assign_to_sym(filter.S, S);
+
+    // Inverse innovation covariance
+    fixed::Matrix<M,M> SI;
+    Float rcond = fixed::UdUinversePD(SI, S);
+    filter.rclimit.check_PD(rcond, error_description);
+    fixed::assign_to_sym(filter.SI, SI);
+
+    // Kalman gain
+    const fixed::Matrix<N,M> W = fixed::prod(Xxz, SI);
+
+    // Filter update
+    fixed::Vec<N> x;
+    fixed::assign(x, filter.x);
+    const fixed::Vec<N> dx = fixed::prod(W, s);
+    for (std::size_t i = 0; i < N; ++i)
+        x[i] += dx[i];
+    if (Si) {
+        fixed::assign(S, *Si);
+    }
+
+    // X - W*S*W', as the downdates of UC by the columns of W*US, US*US' = S
+    fixed::Matrix<M,M> US;
+    bool pd = fixed::UCfactor(US, S) >= 0;
+    fixed::Matrix<N,N> UCx = UC;
+    if (pd) {
+        const fixed::Matrix<N,M> WUS = fixed::prod(W, US);
+        for (std::size_t k = 0; k < M && pd; ++k) {
+            fixed::Vec<N> v;
+            for (std::size_t i = 0; i < N; ++i)
+                v[i] = WUS(i,k);
+            pd = fixed::UCupdate(UCx, v, -1);
+        }
+    }
+    if (!pd) {
+        // Not Positive Definite: X as it is, factorized (and checked) by the next step
+        fixed::Matrix<N,N> X;
+        fixed::assign(X, filter.X);
+        fixed::minus_assign(X, fixed::prod_SPD(W, S));
+        fixed::assign_to(filter.x, x);
+        fixed::assign_to_sym(filter.X, X);
+        UC_X(0,0) = NaN;
+        return rcond;
+    }
+    fixed_store(filter, x, UCx, UC_store, UC_X);
+
+    return rcond;
+}
+
+
+template <std::size_t N, std::size_t M>
+Float fixed_observe(UKFilter& filter, const Correlated_additive_observe_model& h, const FM::Vec& z,
+                    const UKFilter::Unscented_weights& w, FM::Vec& xi, FM::Vec& zi, FM::Vec& z0,
+                    FM::Matrix& UC_store, FM::SymMatrix& UC_X)
+{
+    fixed::Matrix<N,N> UC;
+    fixed_root(filter, UC, UC_store, UC_X, "X not PSD");
+    fixed::Vec<M> zp;
+    fixed::Matrix<M,M> Xzz;
+    fixed::Matrix<N,M> Xxz;
+    fixed_observe_moments<N,M>(filter, h, w, UC, xi, zi, z0, false, zp, Xzz, Xxz);
+
+    // Normalised innovation
+    fixed::assign_to(z0, zp);
+    h.normalise(filter.s = z, z0);
+    FM::noalias(filter.s) -= z0;
+    fixed::Vec<M> s;
+    fixed::assign(s, filter.s);
+
+    return fixed_update<N,M>(filter, h, Xzz, Xxz, s, NULL, "S not PD in observe", UC, UC_store, UC_X);
+}
+
+
+template <std::size_t N, std::size_t M>
+void fixed_predict_observation(const UKFilter& filter, const Correlated_additive_observe_model& h,
+                               const UKFilter::Unscented_weights& w, FM::Vec& xi, FM::Vec& zi, FM::Vec& z0,
+                               FM::Matrix& UC_store, FM::SymMatrix& UC_X, FM::Vec& z_p, FM::SymMatrix& R_pred)
+{
+    fixed::Matrix<N,N> UC;
+    fixed_root(filter, UC, UC_store, UC_X, "X not PSD in UKFilter::unscented(...)");
+    fixed::Vec<M> zp;
+    fixed::Matrix<M,M> Xzz;
+    fixed::Matrix<N,M> Xxz;
+    fixed_observe_moments<N,M>(filter, h, w, UC, xi, zi, z0, true, zp, Xzz, Xxz);
+    fixed::assign_to(z_p, zp);
+    fixed::assign_to_sym(R_pred, Xzz);
+}
+
+
+template <std::size_t N, std::size_t M>
+Float fixed_observe_innovation(UKFilter& filter, const Correlated_additive_observe_model& h, const FM::SymMatrix& Si,
+                               const UKFilter::Unscented_weights& w, FM::Vec& xi, FM::Vec& zi, FM::Vec& z0,
+                               FM::Matrix& UC_store, FM::SymMatrix& UC_X)
+{
+    fixed::Matrix<N,N> UC;
+    fixed_root(filter, UC, UC_store, UC_X, "X not PSD in UKFilter::unscented(...)");
+    fixed::Vec<M> zp;
+    fixed::Matrix<M,M> Xzz;
+    fixed::Matrix<N,M> Xxz;
+    fixed_observe_moments<N,M>(filter, h, w, UC, xi, zi, z0, true, zp, Xzz, Xxz);
+    fixed::Vec<M> s;
+    fixed::assign(s, filter.s);
+
+    return fixed_update<N,M>(filter, h, Xzz, Xxz, s, &Si, "S not PD in observeInnovation", UC, UC_store, UC_X);
+}
+
+}//namespace
+#endif
+
+
 UKFilter::UKFilter(std::size_t x_size) :
         Kalman_state_filter(x_size),
         Unscented_scheme(x_size),
-        z_p(Empty)
+        z_p(Empty), xi(x_size), zi(Empty), z0(Empty),
+        UC(x_size, x_size), UC_X(x_size, x_size)
 {
     UKFilter::x_size = x_size;
     UKFilter::XX_size = 2*x_size+1;
+    UC_X(0,0) = std::numeric_limits<Float>::quiet_NaN();    // no square root stored
+    predict_weights.kappa = observe_weights.kappa = std::numeric_limits<Float>::quiet_NaN();
     FM::Vec x0(x_size);
     x0.clear();
     FM::SymMatrix P0(x_size, x_size);
@@ -47,10 +394,13 @@ UKFilter::UKFilter(std::size_t x_size) :
 UKFilter::UKFilter(const FM::Vec& x0, const FM::SymMatrix& P0) :
         Kalman_state_filter(x0.size()),
         Unscented_scheme(x0.size()),
-        z_p(Empty)
+        z_p(Empty), xi(x0.size()), zi(Empty), z0(Empty),
+        UC(x0.size(), x0.size()), UC_X(x0.size(), x0.size())
 {
     UKFilter::x_size = x0.size();
     UKFilter::XX_size = 2*x0.size()+1;
+    UC_X(0,0) = std::numeric_limits<Float>::quiet_NaN();    // no square root stored
+    predict_weights.kappa = observe_weights.kappa = std::numeric_limits<Float>::quiet_NaN();
     init(x0, P0);
 }
 
@@ -66,6 +416,54 @@ void UKFilter::init(const FM::Vec& x0, const FM::SymMatrix& P0)
 }
 
 
+Bayes_base::Float UKFilter::predict(Linrz_predict_model& f)
+{
+#ifdef BAYES_FILTER_FIXED_SIZE
+    if (x_size == 4 && f.q.size() == 2) {
+        kappa = predict_Kappa(x_size);
+        fixed_predict<4,2>(*this, f, unscented_weights(predict_weights, x_size, kappa), xi, UC, UC_X);
+        return 1.;
+    }
+    if (x_size == 6 && f.q.size() == 3) {
+        kappa = predict_Kappa(x_size);
+        fixed_predict<6,3>(*this, f, unscented_weights(predict_weights, x_size, kappa), xi, UC, UC_X);
+        return 1.;
+    }
+#endif
+    return Unscented_scheme::predict(f);
+}
+
+
+Bayes_base::Float UKFilter::observe(Linrz_correlated_observe_model& h, const FM::Vec& z)
+{
+    // Cartesian observations of diagonal noise, linear: the unscented update
+    // is the Kalman one, done one coordinate at a time
+    observe_size (z.size());  // Dynamic sizing
+    if (Models::sequential_observe(x, X, h, z, s, S)) {
+        UC_X(0,0) = std::numeric_limits<Float>::quiet_NaN();    // X changed, UC too old
+        return 1.;
+    }
+#ifdef BAYES_FILTER_FIXED_SIZE
+    std::size_t z_size = z.size();
+    if ((x_size == 4 && (z_size == 2 || z_size == 1)) || (x_size == 6 && z_size == 3)) {
+        observe_size (z_size);  // Dynamic sizing
+        if (zi.size() != z_size) {
+            zi.resize(z_size);
+            z0.resize(z_size);
+        }
+        kappa = observe_Kappa(x_size);
+        const Unscented_weights& w = unscented_weights(observe_weights, x_size, kappa);
+        if (x_size == 6)
+            return fixed_observe<6,3>(*this, h, z, w, xi, zi, z0, UC, UC_X);
+        if (z_size == 2)
+            return fixed_observe<4,2>(*this, h, z, w, xi, zi, z0, UC, UC_X);
+        return fixed_observe<4,1>(*this, h, z, w, xi, zi, z0, UC, UC_X);
+    }
+#endif
+    return Unscented_scheme::observe(h, z);
+}
+
+
 void UKFilter::update(Additive_predict_model& predict_model,
                       Correlated_additive_observe_model& observe_model,
                       const FM::Vec& z)
@@ -78,6 +476,26 @@ void UKFilter::update(Additive_predict_model& predict_model,
 void UKFilter::predict_observation(Correlated_additive_observe_model& observe_model, FM::Vec& z_pred, FM::SymMatrix& R_pred)
 {
     std::size_t z_size = z_pred.size();
+#ifdef BAYES_FILTER_FIXED_SIZE
+    if ((x_size == 4 && (z_size == 2 || z_size == 1)) || (x_size == 6 && z_size == 3)) {
+        z_p.resize(z_size);
+        observe_size (z_size);  // Dynamic sizing
+        if (zi.size() != z_size) {
+            zi.resize(z_size);
+            z0.resize(z_size);
+        }
+        kappa = observe_Kappa(x_size);
+        const Unscented_weights& w = unscented_weights(observe_weights, x_size, kappa);
+        if (x_size == 6)
+            fixed_predict_observation<6,3>(*this, observe_model, w, xi, zi, z0, UC, UC_X, z_p, R_pred);
+        else if (z_size == 2)
+            fixed_predict_observation<4,2>(*this, observe_model, w, xi, zi, z0, UC, UC_X, z_p, R_pred);
+        else
+            fixed_predict_observation<4,1>(*this, observe_model, w, xi, zi, z0, UC, UC_X, z_p, R_pred);
+        z_pred = z_p;
+        return;
+    }
+#endif
     ColMatrix zXX(z_size, 2*x_size+1);
     SymMatrix Xzz(z_size,z_size);
     Matrix Xxz(x_size,z_size);
@@ -160,6 +578,23 @@ Bayes_base::Float UKFilter::observeInnovation(Correlated_additive_observe_model&
  */
 {
     std::size_t z_size = si.size();
+#ifdef BAYES_FILTER_FIXED_SIZE
+    if ((x_size == 4 && (z_size == 2 || z_size == 1)) || (x_size == 6 && z_size == 3)) {
+        observe_size (z_size);   // Dynamic sizing
+        if (zi.size() != z_size) {
+            zi.resize(z_size);
+            z0.resize(z_size);
+        }
+        kappa = observe_Kappa(x_size);
+        noalias(s) = si;         // Store innovation
+        const Unscented_weights& w = unscented_weights(observe_weights, x_size, kappa);
+        if (x_size == 6)
+            return fixed_observe_innovation<6,3>(*this, h, Si, w, xi, zi, z0, UC, UC_X);
+        if (z_size == 2)
+            return fixed_observe_innovation<4,2>(*this, h, Si, w, xi, zi, z0, UC, UC_X);
+        return fixed_observe_innovation<4,1>(*this, h, Si, w, xi, zi, z0, UC, UC_X);
+    }
+#endif
     ColMatrix zXX (z_size, 2*x_size+1);
     Vec zp(z_size);
     SymMatrix Xzz(z_size,z_size);
@@ -0,0 +1,130 @@
+/* Brute-force check of the assignments of AssociationMatrix: on random small
+ * matrices, dense and sparse, gated at random and of all three measures,
+ * computeHungarian(...) must find the most pairs with the best sum of their
+ * measures, computeAuction(...) the most pairs within rows * epsilon of that
+ * sum. Every feasible assignment is enumerated, a few thousand at most.
+ *   cmake .. && make bayes_tracking_check && ctest
+ */
+
+#include "bayes_tracking/associationmatrix.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+const double EPSILON = 1e-3;
+
+bool gated(measure_t measure, double value)
+{
+   return measure == CORRELATION ? value > 0. : value < DBL_MAX;
+}
+
+/* The most pairs, then the best sum, of the assignments of rows i and below. */
+void best(const std::vector<double>& m, size_t rows, size_t cols, measure_t measure,
+          size_t i, std::vector<char>& used, size_t pairs, double sum,
+          size_t& bestPairs, double& bestSum)
+{
+   if (i == rows) {
+      bool better = measure == CORRELATION ? sum > bestSum : sum < bestSum;
+      if (pairs > bestPairs || (pairs == bestPairs && better)) {
+         bestPairs = pairs;
+         bestSum = sum;
+      }
+      return;
+   }
+   best(m, rows, cols, measure, i + 1, used, pairs, sum, bestPairs, bestSum);
+   for (size_t j = 0; j < cols; j++) {
+      if (used[j] || !gated(measure, m[i * cols + j]))
+         continue;
+      used[j] = 1;
+      best(m, rows, cols, measure, i + 1, used, pairs + 1, sum + m[i * cols + j], bestPairs, bestSum);
+      used[j] = 0;
+   }
+}
+
+/* The pairs of the result, -1 if not an assignment of gated elements. */
+long pairsOf(const AssociationMatrix& amat, const std::vector<double>& m, size_t rows, size_t cols,
+             measure_t measure, double& sum)
+{
+   std::vector<char> row(rows, 0), col(cols, 0);
+   sum = 0.;
+   for (size_t k = 0; k < amat.NN.size(); k++) {
+      size_t i = amat.NN[k].row, j = amat.NN[k].col;
+      if (i >= rows || j >= cols || row[i] || col[j] || !gated(measure, m[i * cols + j]))
+         return -1;
+      row[i] = col[j] = 1;
+      sum += m[i * cols + j];
+   }
+   if (amat.NN.size() + amat.URow.size() != rows || amat.NN.size() + amat.UCol.size() != cols)
+      return -1;
+   return amat.NN.size();
+}
+
+} // namespace
+
+int main()
+{
+   const measure_t measures[] = {CORRELATION, MAHALANOBIS, CORRELATION_LOG};
+   const char* names[] = {"CORRELATION", "MAHALANOBIS", "CORRELATION_LOG"};
+   std::mt19937 rng(1);
+   std::uniform_int_distribution<int> size(1, 6);
+   std::uniform_real_distribution<double> uniform(0., 1.);
+   AssociationMatrix amat;
+   int failures = 0, cases = 0;
+   for (int c = 0; c < 20000; c++) {
+      const measure_t measure = measures[c % 3];
+      const bool sparse = (c / 3) % 2;
+      const size_t rows = size(rng), cols = size(rng);
+      const double density = uniform(rng);
+      std::vector<double> m(rows * cols, measure == CORRELATION ? 0. : DBL_MAX);
+      for (size_t e = 0; e < m.size(); e++) {
+         if (uniform(rng) >= density)
+            continue;
+         // a few distinct values, for ties between assignments
+         double d2 = std::floor(uniform(rng) * 20.) / 2.;
+         m[e] = measure == CORRELATION ? std::exp(-0.5 * d2) : measure == MAHALANOBIS ? std::sqrt(d2) : d2 - 1.;
+      }
+      std::vector<char> used(cols, 0);
+      size_t bestPairs = 0;
+      double bestSum = 0.;
+      best(m, rows, cols, measure, 0, used, 0, 0., bestPairs, bestSum);
+
+      for (int solver = 0; solver < 2; solver++) {
+         if (sparse) {
+            amat.setSparse(rows, cols);
+            for (size_t i = 0; i < rows; i++)
+               for (size_t j = 0; j < cols; j++)
+                  if (gated(measure, m[i * cols + j]))
+                     amat.set(i, j, m[i * cols + j]);
+         }
+         else {
+            amat.setSize(rows, cols);
+            for (size_t i = 0; i < rows; i++)
+               for (size_t j = 0; j < cols; j++)
+                  amat[i][j] = m[i * cols + j];
+         }
+         if (solver == 0)
+            amat.computeHungarian(measure);
+         else
+            amat.computeAuction(measure, EPSILON);
+         double sum;
+         long pairs = pairsOf(amat, m, rows, cols, measure, sum);
+         double loss = measure == CORRELATION ? bestSum - sum : sum - bestSum;
+         double tolerance = solver == 0 ? 1e-9 : rows * EPSILON + 1e-9;
+         if (pairs != (long)bestPairs || loss > tolerance) {
+            if (failures < 10)
+               std::printf("%s %s %s %zux%zu: %ld pairs of sum %g, best %zu of sum %g\n",
+                           solver == 0 ? "computeHungarian" : "computeAuction", names[c % 3],
+                           sparse ? "sparse" : "dense", rows, cols, pairs, sum, bestPairs, bestSum);
+            failures++;
+         }
+         cases++;
+      }
+   }
+   std::printf("%d of %d assignments not optimal\n", failures, cases);
+   return failures ? 1 : 0;
+}
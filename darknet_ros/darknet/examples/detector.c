@@ -568,6 +568,8 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
     image **alphabet = load_alphabet();
     network *net = load_network(cfgfile, weightfile, 0);
     set_batch_network(net, 1);
+    fuse_batchnorm_network(net);
+    share_network_outputs(net);
     srand(2222222);
     double time;
     char buff[256];
@@ -206,6 +206,8 @@ struct layer{
     float temperature;
     float probability;
     float scale;
+    float input_scale;
+    float input_range;
 
     char  * cweights;
     int   * indexes;
@@ -229,6 +231,9 @@ struct layer{
 
     float * binary_weights;
 
+    signed char * weights_int8;
+    float * output_scales;
+
     float * biases;
     float * bias_updates;
 
@@ -475,6 +480,10 @@ typedef struct network{
     int random;
 
     int gpu_index;
+    int gpu_outputs_only;
+    /* Called after every layer of forward_network_gpu if set, e.g. to hand the GPU over. */
+    void (*layer_hook)(void *);
+    void *layer_hook_arg;
     tree *hierarchy;
 
     float *input;
@@ -482,15 +491,23 @@ typedef struct network{
     float *delta;
     float *workspace;
     int train;
+    /* The layers of quantize_int8_network forward in INT8 while set. */
+    int int8;
     int index;
     float *cost;
     float clip;
 
+    int nshared;
+    float **shared;
+    /* The outputs of the YOLO and REGION layers if mapped to the device, read in place. */
+    float *mapped;
+
 #ifdef GPU
     float *input_gpu;
     float *truth_gpu;
     float *delta_gpu;
     float *output_gpu;
+    float **shared_gpu;
 #endif
 
 } network;
@@ -585,6 +602,7 @@ typedef struct{
 
 
 network *load_network(char *cfg, char *weights, int clear);
+network *load_network_cached(char *cfg, char *weights, char *cache);
 load_args get_base_args(network *net);
 
 void free_data(data d);
@@ -637,6 +655,7 @@ float cuda_mag_array(float *x_gpu, size_t n);
 void cuda_push_array(float *x_gpu, float *x, size_t n);
 
 void forward_network_gpu(network *net);
+float *network_predict_gpu(network *net, float *input_gpu);
 void backward_network_gpu(network *net);
 void update_network_gpu(network *net);
 
@@ -690,6 +709,16 @@ void get_region_detections(layer l, int w, int h, int netw, int neth, float thre
 int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets);
 void free_network(network *net);
 void set_batch_network(network *net, int b);
+void fuse_batchnorm_network(network *net);
+void calibrate_int8_network(network *net, float *input);
+int quantize_int8_network(network *net);
+void save_int8_calibration(network *net, char *filename);
+int load_int8_calibration(network *net, char *filename);
+void share_network_outputs(network *net);
+int map_network_outputs(network *net);
+void point_network_outputs(network *net, float *x, float *x_gpu);
+network *resized_network_copy(network *net, int w, int h);
+void free_resized_network(network *net);
 void set_temp_network(network *net, float t);
 image load_image(char *filename, int w, int h, int c);
 image load_image_color(char *filename, int w, int h);
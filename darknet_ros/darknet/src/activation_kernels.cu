@@ -199,6 +199,19 @@ extern "C" void activate_array_gpu(float *x, int n, ACTIVATION a)
     check_error(cudaPeekAtLastError());
 }
 
+__global__ void activate_bias_array_kernel(float *x, float *biases, int n, int size, int total, ACTIVATION a)
+{
+    int i = (blockIdx.x + blockIdx.y*gridDim.x) * blockDim.x + threadIdx.x;
+    if(i < total) x[i] = activate_kernel(x[i] + biases[(i/size)%n], a);
+}
+
+extern "C" void activate_bias_array_gpu(float *x, float *biases, int batch, int n, int size, ACTIVATION a)
+{
+    int total = batch*n*size;
+    activate_bias_array_kernel<<<cuda_gridsize(total), BLOCK>>>(x, biases, n, size, total, a);
+    check_error(cudaPeekAtLastError());
+}
+
 extern "C" void gradient_array_gpu(float *x, int n, ACTIVATION a, float *delta) 
 {
     gradient_array_kernel<<<cuda_gridsize(n), BLOCK>>>(x, n, a, delta);
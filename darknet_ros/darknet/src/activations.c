@@ -105,6 +105,22 @@ void activate_array(float *x, const int n, const ACTIVATION a)
     }
 }
 
+/* add_bias and activate_array in one pass */
+void activate_bias_array(float *x, float *biases, int batch, int n, int size, ACTIVATION a)
+{
+    int b, i, j;
+    for(b = 0; b < batch; ++b){
+        for(i = 0; i < n; ++i){
+            float *out = x + (b*n + i)*size;
+            if(a == LEAKY){
+                for(j = 0; j < size; ++j) out[j] = leaky_activate(out[j] + biases[i]);
+            } else {
+                for(j = 0; j < size; ++j) out[j] = activate(out[j] + biases[i], a);
+            }
+        }
+    }
+}
+
 float gradient(float x, ACTIVATION a)
 {
     switch(a){
@@ -125,11 +125,10 @@ void forward_convolutional_layer_gpu(convolutional_layer l, network net)
 
     if (l.batch_normalize) {
         forward_batchnorm_layer_gpu(l, net);
+        activate_array_gpu(l.output_gpu, l.outputs*l.batch, l.activation);
     } else {
-        add_bias_gpu(l.output_gpu, l.biases_gpu, l.batch, l.n, l.out_w*l.out_h);
+        activate_bias_array_gpu(l.output_gpu, l.biases_gpu, l.batch, l.n, l.out_w*l.out_h, l.activation);
     }
-
-    activate_array_gpu(l.output_gpu, l.outputs*l.batch, l.activation);
     //if(l.dot > 0) dot_error_gpu(l);
     if(l.binary || l.xnor) swap_binary(&l);
 }
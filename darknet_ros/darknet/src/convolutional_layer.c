@@ -6,12 +6,16 @@
 #include "blas.h"
 #include "gemm.h"
 #include <stdio.h>
+#include <math.h>
 #include <time.h>
 
 #ifdef AI2
 #include "xnor_layer.h"
 #endif
 
+/* Cleared while parsing a network whose weights are all copied in after. */
+int random_init_weights = 1;
+
 void swap_binary(convolutional_layer *l)
 {
     float *swap = l->weights;
@@ -206,7 +210,7 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     //printf("convscale %f\n", scale);
     //scale = .02;
     //for(i = 0; i < c*n*size*size; ++i) l.weights[i] = scale*rand_uniform(-1, 1);
-    for(i = 0; i < l.nweights; ++i) l.weights[i] = scale*rand_normal();
+    if(random_init_weights) for(i = 0; i < l.nweights; ++i) l.weights[i] = scale*rand_normal();
     int out_w = convolutional_out_width(l);
     int out_h = convolutional_out_height(l);
     l.out_h = out_h;
@@ -442,11 +446,245 @@ void backward_bias(float *bias_updates, float *delta, int batch, int n, int size
     }
 }
 
+/*
+ * 3x3 stride 1 layers convolve by Winograd F(2x2,3x3) instead of im2col:
+ * each 2x2 tile of the output from a 4x4 tile of the input in 16 products
+ * instead of 36. The weights, tiles of the input and tiles of the output
+ * are transformed into 16 planes, the planes multiplied by 16 gemms.
+ */
+#define WINOGRAD_TILES 256
+/* Floats between two planes beyond their matrix, their rows not all in the same cache set. */
+#define WINOGRAD_PAD 16
+
+/* Tiles convolved at a time, 0 if the layer convolves by im2col: the
+ * transformed weights and a chunk of tiles must fit its im2col workspace. */
+static int winograd_tiles(layer l)
+{
+    if(l.size != 3 || l.stride != 1 || l.pad != 1 || l.groups != 1) return 0;
+    int tiles = ((l.out_h + 1)/2)*((l.out_w + 1)/2);
+    if(tiles > WINOGRAD_TILES) tiles = WINOGRAD_TILES;
+    size_t need = 16*((size_t)l.n*l.c + (size_t)tiles*(l.c + l.n) + 2*WINOGRAD_PAD);
+    size_t im2col = (size_t)l.out_h*l.out_w*l.size*l.size*l.c;
+    return need <= im2col ? tiles : 0;
+}
+
+/* U = G g G', plane e of the transform an n x c matrix at u + e*n*c. */
+static void winograd_weights(layer l, float *u)
+{
+    int i;
+    int k = l.n*l.c;
+    #pragma omp parallel for
+    for(i = 0; i < k; ++i){
+        float *g = l.weights + i*9;
+        float t[12];
+        int j;
+        for(j = 0; j < 3; ++j){
+            t[j] = g[j];
+            t[3 + j] = .5f*(g[j] + g[3 + j] + g[6 + j]);
+            t[6 + j] = .5f*(g[j] - g[3 + j] + g[6 + j]);
+            t[9 + j] = g[6 + j];
+        }
+        for(j = 0; j < 4; ++j){
+            u[(j*4 + 0)*k + i] = t[j*3];
+            u[(j*4 + 1)*k + i] = .5f*(t[j*3] + t[j*3 + 1] + t[j*3 + 2]);
+            u[(j*4 + 2)*k + i] = .5f*(t[j*3] - t[j*3 + 1] + t[j*3 + 2]);
+            u[(j*4 + 3)*k + i] = t[j*3 + 2];
+        }
+    }
+}
+
+/* V = B' d B of the tiles t0..t0+tiles of an image, plane e a c x tiles
+ * matrix at v + e*stride. */
+static void winograd_input(layer l, float *im, int t0, int tiles, float *v, int stride)
+{
+    int ch;
+    int tw = (l.out_w + 1)/2;
+    #pragma omp parallel for
+    for(ch = 0; ch < l.c; ++ch){
+        float *plane = im + ch*l.h*l.w;
+        float *out = v + ch*tiles;
+        int tx = t0%tw;
+        int ty = t0/tw;
+        int t, r, s;
+        for(t = 0; t < tiles; ++t){
+            int y0 = 2*ty - 1;
+            int x0 = 2*tx - 1;
+            float d[16], b[16];
+            if(y0 >= 0 && x0 >= 0 && y0 + 4 <= l.h && x0 + 4 <= l.w){
+                for(r = 0; r < 4; ++r){
+                    for(s = 0; s < 4; ++s) d[r*4 + s] = plane[(y0 + r)*l.w + x0 + s];
+                }
+            } else {
+                for(r = 0; r < 4; ++r){
+                    int y = y0 + r;
+                    for(s = 0; s < 4; ++s){
+                        int x = x0 + s;
+                        d[r*4 + s] = (y >= 0 && y < l.h && x >= 0 && x < l.w) ? plane[y*l.w + x] : 0;
+                    }
+                }
+            }
+            for(s = 0; s < 4; ++s){
+                b[s] = d[s] - d[8 + s];
+                b[4 + s] = d[4 + s] + d[8 + s];
+                b[8 + s] = d[8 + s] - d[4 + s];
+                b[12 + s] = d[4 + s] - d[12 + s];
+            }
+            for(r = 0; r < 4; ++r){
+                out[(r*4 + 0)*stride + t] = b[r*4] - b[r*4 + 2];
+                out[(r*4 + 1)*stride + t] = b[r*4 + 1] + b[r*4 + 2];
+                out[(r*4 + 2)*stride + t] = b[r*4 + 2] - b[r*4 + 1];
+                out[(r*4 + 3)*stride + t] = b[r*4 + 1] - b[r*4 + 3];
+            }
+            if(++tx == tw){
+                tx = 0;
+                ++ty;
+            }
+        }
+    }
+}
+
+/* Y = A' m A of the tiles t0..t0+tiles into an output, y*scales + biases
+ * activated if fused, plane e of m an n x tiles matrix at m + e*stride. */
+static void winograd_output(layer l, float *m, int t0, int tiles, int stride, int fused, float *output)
+{
+    int f;
+    int tw = (l.out_w + 1)/2;
+    #pragma omp parallel for
+    for(f = 0; f < l.n; ++f){
+        float scale = 1;
+        float bias = 0;
+        if(fused){
+            bias = l.biases[f];
+            if(l.batch_normalize){
+                scale = l.scales[f]/(sqrt(l.rolling_variance[f]) + .000001f);
+                bias -= l.rolling_mean[f]*scale;
+            }
+        }
+        float *in = m + f*tiles;
+        float *plane = output + f*l.out_h*l.out_w;
+        int tx = t0%tw;
+        int ty = t0/tw;
+        int t, r, s;
+        for(t = 0; t < tiles; ++t){
+            float a[8], y[4];
+            for(s = 0; s < 4; ++s){
+                float m0 = in[(0*4 + s)*stride + t];
+                float m1 = in[(1*4 + s)*stride + t];
+                float m2 = in[(2*4 + s)*stride + t];
+                float m3 = in[(3*4 + s)*stride + t];
+                a[s] = m0 + m1 + m2;
+                a[4 + s] = m1 - m2 - m3;
+            }
+            for(r = 0; r < 2; ++r){
+                y[r*2] = a[r*4] + a[r*4 + 1] + a[r*4 + 2];
+                y[r*2 + 1] = a[r*4 + 1] - a[r*4 + 2] - a[r*4 + 3];
+            }
+            if(fused){
+                for(r = 0; r < 4; ++r){
+                    y[r] = y[r]*scale + bias;
+                    y[r] = l.activation == LEAKY ? leaky_activate(y[r]) : activate(y[r], l.activation);
+                }
+            }
+            int y0 = 2*ty;
+            int x0 = 2*tx;
+            for(r = 0; r < 2 && y0 + r < l.out_h; ++r){
+                for(s = 0; s < 2 && x0 + s < l.out_w; ++s){
+                    plane[(y0 + r)*l.out_w + x0 + s] = y[r*2 + s];
+                }
+            }
+            if(++tx == tw){
+                tx = 0;
+                ++ty;
+            }
+        }
+    }
+}
+
+static void forward_winograd_convolutional_layer(convolutional_layer l, network net, int tiles, int fused)
+{
+    int i, t0;
+    int total = ((l.out_h + 1)/2)*((l.out_w + 1)/2);
+    float *u = net.workspace;
+    float *v = u + 16*l.n*l.c;
+    float *m = v + 16*(l.c*tiles + WINOGRAD_PAD);
+
+    winograd_weights(l, u);
+    for(i = 0; i < l.batch; ++i){
+        float *im = net.input + i*l.inputs;
+        float *output = l.output + i*l.outputs;
+        for(t0 = 0; t0 < total; t0 += tiles){
+            int count = total - t0 < tiles ? total - t0 : tiles;
+            int vs = l.c*count + WINOGRAD_PAD;
+            int ms = l.n*count + WINOGRAD_PAD;
+            int e;
+            winograd_input(l, im, t0, count, v, vs);
+            for(e = 0; e < 16; ++e){
+                gemm(0,0,l.n,count,l.c,1,u + e*l.n*l.c,l.c,v + e*vs,count,0,m + e*ms,count);
+            }
+            winograd_output(l, m, t0, count, ms, fused, output);
+        }
+    }
+}
+
+/* Per output channel, the weights in [-127, 127] by the scale of their largest
+ * magnitude, and the input by that of the largest seen in calibration,
+ * input_range: output_scales[i] takes an int8 product back to the float one. */
+void quantize_convolutional_layer(convolutional_layer *l)
+{
+    int i, j;
+    int size = l->nweights/l->n;
+    if(!l->weights_int8) l->weights_int8 = calloc(l->nweights, sizeof(signed char));
+    if(!l->output_scales) l->output_scales = calloc(l->n, sizeof(float));
+    l->input_scale = l->input_range/127;
+    for(i = 0; i < l->n; ++i){
+        float *w = l->weights + i*size;
+        float max = 0;
+        for(j = 0; j < size; ++j) max = fmaxf(max, fabsf(w[j]));
+        float scale = max > 0 ? max/127 : 1;
+        for(j = 0; j < size; ++j) l->weights_int8[i*size + j] = (signed char)roundf(w[j]/scale);
+        l->output_scales[i] = scale*l->input_scale;
+    }
+}
+
+static void quantize_int8_array(const float *x, int n, float scale, signed char *q)
+{
+    int i;
+    float inv = 1/scale;
+    for(i = 0; i < n; ++i){
+        float v = roundf(x[i]*inv);
+        q[i] = (signed char)(v > 127 ? 127 : (v < -127 ? -127 : v));
+    }
+}
+
+/* The input quantized into the workspace, then im2col'd after it as bytes. */
+static void forward_int8_convolutional_layer(convolutional_layer l, network net)
+{
+    int i;
+    int m = l.n;
+    int k = l.size*l.size*l.c;
+    int n = l.out_w*l.out_h;
+    signed char *im = (signed char *)net.workspace;
+    signed char *b = (l.size == 1) ? im : im + l.inputs;
+    for(i = 0; i < l.batch; ++i){
+        quantize_int8_array(net.input + i*l.inputs, l.inputs, l.input_scale, im);
+        if(l.size != 1) im2col_int8(im, l.c, l.h, l.w, l.size, l.stride, l.pad, b);
+        gemm_int8(m, n, k, l.weights_int8, k, b, n, l.output_scales, l.output + i*l.outputs, n);
+    }
+    activate_bias_array(l.output, l.biases, l.batch, l.n, l.out_h*l.out_w, l.activation);
+}
+
 void forward_convolutional_layer(convolutional_layer l, network net)
 {
     int i, j;
+    if(l.weights_int8 && net.int8 && !net.train){
+        forward_int8_convolutional_layer(l, net);
+        return;
+    }
+    int tiles = winograd_tiles(l);
+    /* Inference folds the batchnorm, biases and activation into the output transform. */
+    int fused = tiles && !net.train;
 
-    fill_cpu(l.outputs*l.batch, 0, l.output, 1);
+    if(!tiles) fill_cpu(l.outputs*l.batch, 0, l.output, 1);
 
     if(l.xnor){
         binarize_weights(l.weights, l.n, l.c/l.groups*l.size*l.size, l.binary_weights);
@@ -458,29 +696,34 @@ void forward_convolutional_layer(convolutional_layer l, network net)
     int m = l.n/l.groups;
     int k = l.size*l.size*l.c/l.groups;
     int n = l.out_w*l.out_h;
-    for(i = 0; i < l.batch; ++i){
-        for(j = 0; j < l.groups; ++j){
-            float *a = l.weights + j*l.nweights/l.groups;
-            float *b = net.workspace;
-            float *c = l.output + (i*l.groups + j)*n*m;
-            float *im =  net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
+    if(tiles){
+        forward_winograd_convolutional_layer(l, net, tiles, fused);
+    } else {
+        for(i = 0; i < l.batch; ++i){
+            for(j = 0; j < l.groups; ++j){
+                float *a = l.weights + j*l.nweights/l.groups;
+                float *b = net.workspace;
+                float *c = l.output + (i*l.groups + j)*n*m;
+                float *im =  net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
 
-            if (l.size == 1) {
-                b = im;
-            } else {
-                im2col_cpu(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
+                if (l.size == 1) {
+                    b = im;
+                } else {
+                    im2col_cpu(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
+                }
+                gemm(0,0,m,n,k,1,a,k,b,n,1,c,n);
             }
-            gemm(0,0,m,n,k,1,a,k,b,n,1,c,n);
         }
     }
 
-    if(l.batch_normalize){
-        forward_batchnorm_layer(l, net);
-    } else {
-        add_bias(l.output, l.biases, l.batch, l.n, l.out_h*l.out_w);
+    if(!fused){
+        if(l.batch_normalize){
+            forward_batchnorm_layer(l, net);
+            activate_array(l.output, l.outputs*l.batch, l.activation);
+        } else {
+            activate_bias_array(l.output, l.biases, l.batch, l.n, l.out_h*l.out_w, l.activation);
+        }
     }
-
-    activate_array(l.output, l.outputs*l.batch, l.activation);
     if(l.binary || l.xnor) swap_binary(&l);
 }
 
@@ -7,6 +7,7 @@ int gpu_index = 0;
 #include "blas.h"
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 void cuda_set_device(int n)
@@ -69,6 +70,7 @@ cudnnHandle_t cudnn_handle()
     int i = cuda_get_device();
     if(!init[i]) {
         cudnnCreate(&handle[i]);
+        cudnnSetStream(handle[i], cudaStreamPerThread);
         init[i] = 1;
     }
     return handle[i];
@@ -82,6 +84,7 @@ cublasHandle_t blas_handle()
     int i = cuda_get_device();
     if(!init[i]) {
         cublasCreate(&handle[i]);
+        cublasSetStream(handle[i], cudaStreamPerThread);
         init[i] = 1;
     }
     return handle[i];
@@ -164,6 +167,51 @@ void cuda_pull_array(float *x_gpu, float *x, size_t n)
     check_error(status);
 }
 
+/* queued on the stream of the thread, overlapping the work after it if x is pinned */
+void cuda_pull_array_async(float *x_gpu, float *x, size_t n)
+{
+    size_t size = sizeof(float)*n;
+    cudaError_t status = cudaMemcpyAsync(x, x_gpu, size, cudaMemcpyDeviceToHost, cudaStreamPerThread);
+    check_error(status);
+}
+
+float *cuda_make_host_array(size_t n)
+{
+    float *x;
+    cudaError_t status = cudaHostAlloc((void **)&x, sizeof(float)*n, cudaHostAllocDefault);
+    check_error(status);
+    memset(x, 0, sizeof(float)*n);
+    return x;
+}
+
+/* Pinned and mapped to the device, *x_gpu its address there: on a device
+ * sharing the host memory the kernels write it in place, without copy. */
+float *cuda_make_mapped_array(size_t n, float **x_gpu)
+{
+    float *x;
+    cudaError_t status = cudaHostAlloc((void **)&x, sizeof(float)*n, cudaHostAllocMapped);
+    check_error(status);
+    memset(x, 0, sizeof(float)*n);
+    status = cudaHostGetDevicePointer((void **)x_gpu, x, 0);
+    check_error(status);
+    return x;
+}
+
+/* Whether the current device shares the host memory, as those of the Jetsons. */
+int cuda_integrated()
+{
+    int integrated = 0;
+    cudaError_t status = cudaDeviceGetAttribute(&integrated, cudaDevAttrIntegrated, cuda_get_device());
+    check_error(status);
+    return integrated;
+}
+
+void cuda_free_host(float *x)
+{
+    cudaError_t status = cudaFreeHost(x);
+    check_error(status);
+}
+
 float cuda_mag_array(float *x_gpu, size_t n)
 {
     float *temp = calloc(n, sizeof(float));
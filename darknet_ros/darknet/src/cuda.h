@@ -10,6 +10,11 @@ cublasHandle_t blas_handle();
 int *cuda_make_int_array(int *x, size_t n);
 void cuda_random(float *x_gpu, size_t n);
 float cuda_compare(float *x_gpu, float *x, size_t n, char *s);
+void cuda_pull_array_async(float *x_gpu, float *x, size_t n);
+float *cuda_make_host_array(size_t n);
+float *cuda_make_mapped_array(size_t n, float **x_gpu);
+int cuda_integrated();
+void cuda_free_host(float *x);
 dim3 cuda_gridsize(size_t n);
 
 #ifdef CUDNN
@@ -3,6 +3,7 @@
 #include "cuda.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 void gemm_bin(int M, int N, int K, float ALPHA, 
@@ -71,21 +72,185 @@ void gemm(int TA, int TB, int M, int N, int K, float ALPHA,
     gemm_cpu( TA,  TB,  M, N, K, ALPHA,A,lda, B, ldb,BETA,C,ldc);
 }
 
+/*
+ * gemm_nn is packed and blocked: B is copied kc x nc at a time into slivers
+ * of GEMM_NR columns, A kc columns at a time into slivers of GEMM_MR rows
+ * scaled by ALPHA, both zero-padded, and a micro-kernel keeps a
+ * GEMM_MR x GEMM_NR tile of C in registers over the kc products of a pair of
+ * slivers. The micro-kernel is chosen at build time: AVX2 and FMA on x86
+ * (-mavx2 -mfma), NEON on aarch64, plain C the compiler vectorizes otherwise.
+ */
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define GEMM_MR 6
+#define GEMM_NR 16
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GEMM_MR 8
+#define GEMM_NR 8
+#else
+#define GEMM_MR 4
+#define GEMM_NR 8
+#endif
+#define GEMM_MC (GEMM_MR*16)
+#define GEMM_KC 256
+#define GEMM_NC 4096
+
+static void gemm_pack_a(int mc, int kc, float ALPHA, float *A, int lda, float *packed)
+{
+    int i, k, r;
+    for(i = 0; i < mc; i += GEMM_MR){
+        for(k = 0; k < kc; ++k){
+            for(r = 0; r < GEMM_MR; ++r){
+                *packed++ = (i+r < mc) ? ALPHA*A[(i+r)*lda + k] : 0;
+            }
+        }
+    }
+}
+
+static void gemm_pack_b(int kc, int nc, float *B, int ldb, float *packed)
+{
+    int j, k, c;
+    for(j = 0; j < nc; j += GEMM_NR){
+        int n = (nc - j < GEMM_NR) ? nc - j : GEMM_NR;
+        for(k = 0; k < kc; ++k){
+            float *b = B + k*ldb + j;
+            for(c = 0; c < n; ++c) packed[c] = b[c];
+            for(; c < GEMM_NR; ++c) packed[c] = 0;
+            packed += GEMM_NR;
+        }
+    }
+}
+
+/* C[m x n] += the products of a sliver of A and of B, m and n up to the tile. */
+static void gemm_micro_kernel(int kc, const float *a, const float *b, float *C, int ldc, int m, int n)
+{
+    float tile[GEMM_MR*GEMM_NR];
+    int i, j, k;
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    for(k = 0; k < kc; ++k){
+        __m256 b0 = _mm256_loadu_ps(b);
+        __m256 b1 = _mm256_loadu_ps(b + 8);
+        __m256 ai;
+        ai = _mm256_broadcast_ss(a + 0); c00 = _mm256_fmadd_ps(ai, b0, c00); c01 = _mm256_fmadd_ps(ai, b1, c01);
+        ai = _mm256_broadcast_ss(a + 1); c10 = _mm256_fmadd_ps(ai, b0, c10); c11 = _mm256_fmadd_ps(ai, b1, c11);
+        ai = _mm256_broadcast_ss(a + 2); c20 = _mm256_fmadd_ps(ai, b0, c20); c21 = _mm256_fmadd_ps(ai, b1, c21);
+        ai = _mm256_broadcast_ss(a + 3); c30 = _mm256_fmadd_ps(ai, b0, c30); c31 = _mm256_fmadd_ps(ai, b1, c31);
+        ai = _mm256_broadcast_ss(a + 4); c40 = _mm256_fmadd_ps(ai, b0, c40); c41 = _mm256_fmadd_ps(ai, b1, c41);
+        ai = _mm256_broadcast_ss(a + 5); c50 = _mm256_fmadd_ps(ai, b0, c50); c51 = _mm256_fmadd_ps(ai, b1, c51);
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+    if(m == GEMM_MR && n == GEMM_NR){
+        __m256 rows[12] = {c00, c01, c10, c11, c20, c21, c30, c31, c40, c41, c50, c51};
+        for(i = 0; i < GEMM_MR; ++i){
+            float *c = C + i*ldc;
+            _mm256_storeu_ps(c, _mm256_add_ps(_mm256_loadu_ps(c), rows[2*i]));
+            _mm256_storeu_ps(c + 8, _mm256_add_ps(_mm256_loadu_ps(c + 8), rows[2*i+1]));
+        }
+        return;
+    }
+    _mm256_storeu_ps(tile +  0, c00); _mm256_storeu_ps(tile +  8, c01);
+    _mm256_storeu_ps(tile + 16, c10); _mm256_storeu_ps(tile + 24, c11);
+    _mm256_storeu_ps(tile + 32, c20); _mm256_storeu_ps(tile + 40, c21);
+    _mm256_storeu_ps(tile + 48, c30); _mm256_storeu_ps(tile + 56, c31);
+    _mm256_storeu_ps(tile + 64, c40); _mm256_storeu_ps(tile + 72, c41);
+    _mm256_storeu_ps(tile + 80, c50); _mm256_storeu_ps(tile + 88, c51);
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    float32x4_t c[GEMM_MR][2];
+    for(i = 0; i < GEMM_MR; ++i){
+        c[i][0] = vdupq_n_f32(0);
+        c[i][1] = vdupq_n_f32(0);
+    }
+    for(k = 0; k < kc; ++k){
+        float32x4_t b0 = vld1q_f32(b);
+        float32x4_t b1 = vld1q_f32(b + 4);
+        float32x4_t a0 = vld1q_f32(a);
+        float32x4_t a1 = vld1q_f32(a + 4);
+        c[0][0] = vfmaq_laneq_f32(c[0][0], b0, a0, 0); c[0][1] = vfmaq_laneq_f32(c[0][1], b1, a0, 0);
+        c[1][0] = vfmaq_laneq_f32(c[1][0], b0, a0, 1); c[1][1] = vfmaq_laneq_f32(c[1][1], b1, a0, 1);
+        c[2][0] = vfmaq_laneq_f32(c[2][0], b0, a0, 2); c[2][1] = vfmaq_laneq_f32(c[2][1], b1, a0, 2);
+        c[3][0] = vfmaq_laneq_f32(c[3][0], b0, a0, 3); c[3][1] = vfmaq_laneq_f32(c[3][1], b1, a0, 3);
+        c[4][0] = vfmaq_laneq_f32(c[4][0], b0, a1, 0); c[4][1] = vfmaq_laneq_f32(c[4][1], b1, a1, 0);
+        c[5][0] = vfmaq_laneq_f32(c[5][0], b0, a1, 1); c[5][1] = vfmaq_laneq_f32(c[5][1], b1, a1, 1);
+        c[6][0] = vfmaq_laneq_f32(c[6][0], b0, a1, 2); c[6][1] = vfmaq_laneq_f32(c[6][1], b1, a1, 2);
+        c[7][0] = vfmaq_laneq_f32(c[7][0], b0, a1, 3); c[7][1] = vfmaq_laneq_f32(c[7][1], b1, a1, 3);
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+    if(m == GEMM_MR && n == GEMM_NR){
+        for(i = 0; i < GEMM_MR; ++i){
+            float *ci = C + i*ldc;
+            vst1q_f32(ci, vaddq_f32(vld1q_f32(ci), c[i][0]));
+            vst1q_f32(ci + 4, vaddq_f32(vld1q_f32(ci + 4), c[i][1]));
+        }
+        return;
+    }
+    for(i = 0; i < GEMM_MR; ++i){
+        vst1q_f32(tile + i*GEMM_NR, c[i][0]);
+        vst1q_f32(tile + i*GEMM_NR + 4, c[i][1]);
+    }
+#else
+    for(i = 0; i < GEMM_MR*GEMM_NR; ++i) tile[i] = 0;
+    for(k = 0; k < kc; ++k){
+        for(i = 0; i < GEMM_MR; ++i){
+            float ai = a[i];
+            for(j = 0; j < GEMM_NR; ++j){
+                tile[i*GEMM_NR + j] += ai*b[j];
+            }
+        }
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+#endif
+    for(i = 0; i < m; ++i){
+        for(j = 0; j < n; ++j){
+            C[i*ldc + j] += tile[i*GEMM_NR + j];
+        }
+    }
+}
+
 void gemm_nn(int M, int N, int K, float ALPHA, 
         float *A, int lda, 
         float *B, int ldb,
         float *C, int ldc)
 {
-    int i,j,k;
-    #pragma omp parallel for
-    for(i = 0; i < M; ++i){
-        for(k = 0; k < K; ++k){
-            register float A_PART = ALPHA*A[i*lda+k];
-            for(j = 0; j < N; ++j){
-                C[i*ldc+j] += A_PART*B[k*ldb+j];
+    int ic, jc, pc;
+    int nc_max = (N < GEMM_NC) ? N : GEMM_NC;
+    int kc_max = (K < GEMM_KC) ? K : GEMM_KC;
+    float *packed_b = malloc((size_t)kc_max*((nc_max + GEMM_NR - 1)/GEMM_NR*GEMM_NR)*sizeof(float));
+    float *packed_a = malloc((size_t)kc_max*((M + GEMM_MR - 1)/GEMM_MR*GEMM_MR)*sizeof(float));
+    for(jc = 0; jc < N; jc += GEMM_NC){
+        int nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+        for(pc = 0; pc < K; pc += GEMM_KC){
+            int kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+            gemm_pack_b(kc, nc, B + pc*ldb + jc, ldb, packed_b);
+            gemm_pack_a(M, kc, ALPHA, A + pc, lda, packed_a);
+            for(ic = 0; ic < M; ic += GEMM_MC){
+                int mc = (M - ic < GEMM_MC) ? M - ic : GEMM_MC;
+                int jr;
+                /* A sliver of B in L1 against a block of A in L2. */
+                #pragma omp parallel for
+                for(jr = 0; jr < nc; jr += GEMM_NR){
+                    int ir;
+                    int n = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+                    for(ir = 0; ir < mc; ir += GEMM_MR){
+                        int m = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+                        gemm_micro_kernel(kc, packed_a + (size_t)(ic + ir)*kc, packed_b + (size_t)jr*kc,
+                                C + (ic + ir)*ldc + jc + jr, ldc, m, n);
+                    }
+                }
             }
         }
     }
+    free(packed_a);
+    free(packed_b);
 }
 
 void gemm_nt(int M, int N, int K, float ALPHA, 
@@ -150,9 +315,12 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
 {
     //printf("cpu: %d %d %d %d %d %f %d %d %f %d\n",TA, TB, M, N, K, ALPHA, lda, ldb, BETA, ldc);
     int i, j;
-    for(i = 0; i < M; ++i){
-        for(j = 0; j < N; ++j){
-            C[i*ldc + j] *= BETA;
+    /* C of a BETA of 0 left uninitialized, as in BLAS. */
+    if(BETA != 1){
+        for(i = 0; i < M; ++i){
+            for(j = 0; j < N; ++j){
+                C[i*ldc + j] = BETA ? C[i*ldc + j]*BETA : 0;
+            }
         }
     }
     if(!TA && !TB)
@@ -165,6 +333,274 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         gemm_tt(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
 }
 
+/*
+ * gemm_int8 is blocked as gemm_nn, on 8 bit A and B: they are packed 4
+ * values of k at a time, so that each 32 bit lane of the micro-kernel adds
+ * the 4 products of an 8 bit dot product (vpdpbusd of AVX-VNNI, sdot of
+ * NEON), and the 32 bit sums of a tile are scaled per row into C at the end
+ * of each block of k. The micro-kernel is chosen at build time: AVX-VNNI
+ * (-mavxvnni, or AVX-512 VNNI and VL), 6x16; AVX2, 4x16, by vpmaddubsw on
+ * the absolute values of A and the signs of A applied to B, which stays
+ * exact for values within [-127, 127]; NEON sdot (armv8.2-a+dotprod), 8x8;
+ * SSE2 otherwise on x86-64, 4x8, by pmaddwd on B widened to 16 bits; plain C
+ * elsewhere.
+ */
+#if defined(__AVXVNNI__) || (defined(__AVX512VNNI__) && defined(__AVX512VL__))
+#include <immintrin.h>
+#define GEMM8_VNNI
+#define GEMM8_MR 6
+#define GEMM8_NR 16
+#ifdef __AVXVNNI__
+#define GEMM8_DPBUSD(c, u, s) _mm256_dpbusd_avx_epi32(c, u, s)
+#else
+#define GEMM8_DPBUSD(c, u, s) _mm256_dpbusd_epi32(c, u, s)
+#endif
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define GEMM8_MR 4
+#define GEMM8_NR 16
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_DOTPROD)
+#include <arm_neon.h>
+#define GEMM8_MR 8
+#define GEMM8_NR 8
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define GEMM8_SSE2
+#define GEMM8_MR 4
+#define GEMM8_NR 8
+#else
+#define GEMM8_PLAIN
+#define GEMM8_MR 4
+#define GEMM8_NR 8
+#endif
+#ifdef GEMM8_SSE2
+typedef short gemm8_b;
+#else
+typedef signed char gemm8_b;
+#endif
+#define GEMM8_MC (GEMM8_MR*16)
+#define GEMM8_KC 1024
+#define GEMM8_NC 4096
+
+/* Slivers of GEMM8_MR rows of A, the 4 values of k of each row in turn. VNNI
+ * multiplies unsigned bytes, those of B offset by 128, so sums gets 128 times
+ * the sum of each row of A, taken off its products. */
+static void gemm8_pack_a(int M, int kc, const signed char *A, int lda, signed char *packed, int *sums)
+{
+    int i, k, r, q;
+    int kc4 = (kc + 3) & ~3;
+    for(i = 0; i < M; i += GEMM8_MR){
+        for(k = 0; k < kc4; k += 4){
+            for(r = 0; r < GEMM8_MR; ++r){
+                for(q = 0; q < 4; ++q){
+                    *packed++ = (i + r < M && k + q < kc) ? A[(i + r)*lda + k + q] : 0;
+                }
+            }
+        }
+    }
+    for(i = 0; i < M; ++i){
+        int sum = 0;
+#ifdef GEMM8_VNNI
+        for(k = 0; k < kc; ++k) sum += A[i*lda + k];
+#endif
+        sums[i] = 128*sum;
+    }
+}
+
+/* Slivers of GEMM8_NR columns of B, the 4 values of k of each column in turn;
+ * for SSE2, each pair of them, for plain C, the columns of each value of k to
+ * vectorize over. */
+static void gemm8_pack_b(int kc, int nc, const signed char *B, int ldb, gemm8_b *packed)
+{
+    int j, k, c, q;
+    int kc4 = (kc + 3) & ~3;
+    for(j = 0; j < nc; j += GEMM8_NR){
+        int n = (nc - j < GEMM8_NR) ? nc - j : GEMM8_NR;
+        for(k = 0; k < kc4; k += 4){
+            for(c = 0; c < GEMM8_NR; ++c){
+                for(q = 0; q < 4; ++q){
+                    signed char v = (c < n && k + q < kc) ? B[(k + q)*ldb + j + c] : 0;
+#ifdef GEMM8_VNNI
+                    v = (signed char)(v ^ 0x80);
+#endif
+#if defined(GEMM8_SSE2)
+                    packed[(q/2)*2*GEMM8_NR + 2*c + q%2] = v;
+#elif defined(GEMM8_PLAIN)
+                    packed[q*GEMM8_NR + c] = v;
+#else
+                    packed[4*c + q] = v;
+#endif
+                }
+            }
+            packed += 4*GEMM8_NR;
+        }
+    }
+}
+
+/* C[m x n] = (or += unless first) scales[i] times the products of kg groups
+ * of 4 of a sliver of A and of B, m and n up to the tile. */
+static void gemm8_micro_kernel(int kg, const signed char *a, const gemm8_b *b, const int *sums,
+        const float *scales, int first, float *C, int ldc, int m, int n)
+{
+    int tile[GEMM8_MR*GEMM8_NR];
+    int i, j, g;
+#if defined(GEMM8_VNNI) || defined(__AVX2__)
+    __m256i c[GEMM8_MR][2];
+    for(i = 0; i < GEMM8_MR; ++i){
+        c[i][0] = _mm256_setzero_si256();
+        c[i][1] = _mm256_setzero_si256();
+    }
+#ifndef GEMM8_VNNI
+    const __m256i ones = _mm256_set1_epi16(1);
+#endif
+    for(g = 0; g < kg; ++g){
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)b);
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(b + 32));
+        for(i = 0; i < GEMM8_MR; ++i){
+            int ai;
+            memcpy(&ai, a + 4*i, sizeof(ai));
+            __m256i w = _mm256_set1_epi32(ai);
+#ifdef GEMM8_VNNI
+            c[i][0] = GEMM8_DPBUSD(c[i][0], b0, w);
+            c[i][1] = GEMM8_DPBUSD(c[i][1], b1, w);
+#else
+            __m256i aw = _mm256_abs_epi8(w);
+            c[i][0] = _mm256_add_epi32(c[i][0], _mm256_madd_epi16(_mm256_maddubs_epi16(aw, _mm256_sign_epi8(b0, w)), ones));
+            c[i][1] = _mm256_add_epi32(c[i][1], _mm256_madd_epi16(_mm256_maddubs_epi16(aw, _mm256_sign_epi8(b1, w)), ones));
+#endif
+        }
+        a += 4*GEMM8_MR;
+        b += 4*GEMM8_NR;
+    }
+    for(i = 0; i < GEMM8_MR; ++i){
+        _mm256_storeu_si256((__m256i *)(tile + i*GEMM8_NR), c[i][0]);
+        _mm256_storeu_si256((__m256i *)(tile + i*GEMM8_NR + 8), c[i][1]);
+    }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_DOTPROD)
+    int32x4_t c[GEMM8_MR][2];
+    for(i = 0; i < GEMM8_MR; ++i){
+        c[i][0] = vdupq_n_s32(0);
+        c[i][1] = vdupq_n_s32(0);
+    }
+    for(g = 0; g < kg; ++g){
+        int8x16_t b0 = vld1q_s8(b);
+        int8x16_t b1 = vld1q_s8(b + 16);
+        int8x16_t a0 = vld1q_s8(a);
+        int8x16_t a1 = vld1q_s8(a + 16);
+        c[0][0] = vdotq_laneq_s32(c[0][0], b0, a0, 0); c[0][1] = vdotq_laneq_s32(c[0][1], b1, a0, 0);
+        c[1][0] = vdotq_laneq_s32(c[1][0], b0, a0, 1); c[1][1] = vdotq_laneq_s32(c[1][1], b1, a0, 1);
+        c[2][0] = vdotq_laneq_s32(c[2][0], b0, a0, 2); c[2][1] = vdotq_laneq_s32(c[2][1], b1, a0, 2);
+        c[3][0] = vdotq_laneq_s32(c[3][0], b0, a0, 3); c[3][1] = vdotq_laneq_s32(c[3][1], b1, a0, 3);
+        c[4][0] = vdotq_laneq_s32(c[4][0], b0, a1, 0); c[4][1] = vdotq_laneq_s32(c[4][1], b1, a1, 0);
+        c[5][0] = vdotq_laneq_s32(c[5][0], b0, a1, 1); c[5][1] = vdotq_laneq_s32(c[5][1], b1, a1, 1);
+        c[6][0] = vdotq_laneq_s32(c[6][0], b0, a1, 2); c[6][1] = vdotq_laneq_s32(c[6][1], b1, a1, 2);
+        c[7][0] = vdotq_laneq_s32(c[7][0], b0, a1, 3); c[7][1] = vdotq_laneq_s32(c[7][1], b1, a1, 3);
+        a += 4*GEMM8_MR;
+        b += 4*GEMM8_NR;
+    }
+    for(i = 0; i < GEMM8_MR; ++i){
+        vst1q_s32(tile + i*GEMM8_NR, c[i][0]);
+        vst1q_s32(tile + i*GEMM8_NR + 4, c[i][1]);
+    }
+#elif defined(GEMM8_SSE2)
+    __m128i c[GEMM8_MR][2];
+    for(i = 0; i < GEMM8_MR; ++i){
+        c[i][0] = _mm_setzero_si128();
+        c[i][1] = _mm_setzero_si128();
+    }
+    for(g = 0; g < kg*2; ++g){
+        __m128i b0 = _mm_loadu_si128((const __m128i *)b);
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(b + 8));
+        for(i = 0; i < GEMM8_MR; ++i){
+            const signed char *ai = a + 4*i + 2*(g%2);
+            __m128i w = _mm_set1_epi32((ai[0] & 0xffff) | (ai[1] << 16));
+            c[i][0] = _mm_add_epi32(c[i][0], _mm_madd_epi16(b0, w));
+            c[i][1] = _mm_add_epi32(c[i][1], _mm_madd_epi16(b1, w));
+        }
+        if(g%2) a += 4*GEMM8_MR;
+        b += 2*GEMM8_NR;
+    }
+    for(i = 0; i < GEMM8_MR; ++i){
+        _mm_storeu_si128((__m128i *)(tile + i*GEMM8_NR), c[i][0]);
+        _mm_storeu_si128((__m128i *)(tile + i*GEMM8_NR + 4), c[i][1]);
+    }
+#else
+    /* Two products of [-127, 127] add up within 16 bits, for the compiler
+     * to vectorize. */
+    int q;
+    for(i = 0; i < GEMM8_MR*GEMM8_NR; ++i) tile[i] = 0;
+    for(g = 0; g < kg; ++g){
+        for(q = 0; q < 4; q += 2){
+            const signed char *b0 = b + q*GEMM8_NR;
+            const signed char *b1 = b0 + GEMM8_NR;
+            for(i = 0; i < GEMM8_MR; ++i){
+                short a0 = a[4*i + q];
+                short a1 = a[4*i + q + 1];
+                for(j = 0; j < GEMM8_NR; ++j){
+                    tile[i*GEMM8_NR + j] += (short)(a0*b0[j] + a1*b1[j]);
+                }
+            }
+        }
+        a += 4*GEMM8_MR;
+        b += 4*GEMM8_NR;
+    }
+#endif
+    for(i = 0; i < m; ++i){
+        float *ci = C + i*ldc;
+        const int *ti = tile + i*GEMM8_NR;
+        float scale = scales[i];
+        int offset = sums[i];
+        if(first){
+            for(j = 0; j < n; ++j) ci[j] = scale*(ti[j] - offset);
+        } else {
+            for(j = 0; j < n; ++j) ci[j] += scale*(ti[j] - offset);
+        }
+    }
+}
+
+/* C = scales[i]*A*B, row i of C by scales[i]: A is M x K, B is K x N, both
+ * within [-127, 127]. */
+void gemm_int8(int M, int N, int K,
+        const signed char *A, int lda,
+        const signed char *B, int ldb,
+        const float *scales,
+        float *C, int ldc)
+{
+    int ic, jc, pc;
+    int nc_max = (N < GEMM8_NC) ? N : GEMM8_NC;
+    int kc_max = (K < GEMM8_KC) ? K : GEMM8_KC;
+    int kc4_max = (kc_max + 3) & ~3;
+    gemm8_b *packed_b = malloc(sizeof(gemm8_b)*kc4_max*((nc_max + GEMM8_NR - 1)/GEMM8_NR*GEMM8_NR));
+    signed char *packed_a = malloc((size_t)kc4_max*((M + GEMM8_MR - 1)/GEMM8_MR*GEMM8_MR));
+    int *sums = malloc(M*sizeof(int));
+    for(jc = 0; jc < N; jc += GEMM8_NC){
+        int nc = (N - jc < GEMM8_NC) ? N - jc : GEMM8_NC;
+        for(pc = 0; pc < K; pc += GEMM8_KC){
+            int kc = (K - pc < GEMM8_KC) ? K - pc : GEMM8_KC;
+            int kc4 = (kc + 3) & ~3;
+            gemm8_pack_b(kc, nc, B + (size_t)pc*ldb + jc, ldb, packed_b);
+            gemm8_pack_a(M, kc, A + pc, lda, packed_a, sums);
+            for(ic = 0; ic < M; ic += GEMM8_MC){
+                int mc = (M - ic < GEMM8_MC) ? M - ic : GEMM8_MC;
+                int jr;
+                #pragma omp parallel for
+                for(jr = 0; jr < nc; jr += GEMM8_NR){
+                    int ir;
+                    int n = (nc - jr < GEMM8_NR) ? nc - jr : GEMM8_NR;
+                    for(ir = 0; ir < mc; ir += GEMM8_MR){
+                        int m = (mc - ir < GEMM8_MR) ? mc - ir : GEMM8_MR;
+                        gemm8_micro_kernel(kc4/4, packed_a + (size_t)(ic + ir)*kc4, packed_b + (size_t)jr*kc4,
+                                sums + ic + ir, scales + ic + ir, pc == 0, C + (ic + ir)*ldc + jc + jr, ldc, m, n);
+                    }
+                }
+            }
+        }
+    }
+    free(sums);
+    free(packed_a);
+    free(packed_b);
+}
+
 #ifdef GPU
 
 #include <math.h>
@@ -18,6 +18,12 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float BETA,
         float *C, int ldc);
 
+void gemm_int8(int M, int N, int K,
+        const signed char *A, int lda,
+        const signed char *B, int ldb,
+        const float *scales,
+        float *C, int ldc);
+
 #ifdef GPU
 void gemm_gpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A_gpu, int lda, 
@@ -1,5 +1,6 @@
 #include "im2col.h"
 #include <stdio.h>
+#include <string.h>
 float im2col_get_pixel(float *im, int height, int width, int channels,
                         int row, int col, int channel, int pad)
 {
@@ -38,3 +39,32 @@ void im2col_cpu(float* data_im,
     }
 }
 
+/* im2col_cpu of quantized images, a row of data_col at a time. */
+void im2col_int8(const signed char *data_im,
+     int channels, int height, int width,
+     int ksize, int stride, int pad, signed char *data_col)
+{
+    int c,h,w;
+    int height_col = (height + 2*pad - ksize) / stride + 1;
+    int width_col = (width + 2*pad - ksize) / stride + 1;
+
+    int channels_col = channels * ksize * ksize;
+    for (c = 0; c < channels_col; ++c) {
+        int w_offset = c % ksize;
+        int h_offset = (c / ksize) % ksize;
+        int c_im = c / ksize / ksize;
+        for (h = 0; h < height_col; ++h) {
+            int im_row = h_offset + h * stride - pad;
+            signed char *col = data_col + (c * height_col + h) * width_col;
+            if (im_row < 0 || im_row >= height) {
+                memset(col, 0, width_col);
+                continue;
+            }
+            const signed char *row = data_im + (c_im * height + im_row) * width;
+            for (w = 0; w < width_col; ++w) {
+                int im_col = w_offset + w * stride - pad;
+                col[w] = (im_col >= 0 && im_col < width) ? row[im_col] : 0;
+            }
+        }
+    }
+}
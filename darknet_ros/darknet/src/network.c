@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <time.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "network.h"
 #include "image.h"
 #include "data.h"
@@ -355,8 +359,486 @@ void set_batch_network(network *net, int b)
     }
 }
 
+/* Layers whose forward writes their delta even at inference, or whose
+ * output is read after it. */
+static int is_network_output(LAYER_TYPE type)
+{
+    return type == YOLO || type == REGION || type == DETECTION || type == SOFTMAX;
+}
+
+/* The batchnorm state of a convolutional layer of fused weights freed, the
+ * weights pushed. */
+static void fused_convolutional_layer(layer *l)
+{
+    if(l->batch_normalize){
+        l->batch_normalize = 0;
+        free(l->x);
+        free(l->x_norm);
+        l->x = l->x_norm = 0;
+#ifdef GPU
+        if(gpu_index >= 0){
+            cuda_free(l->x_gpu);
+            cuda_free(l->x_norm_gpu);
+            l->x_gpu = l->x_norm_gpu = 0;
+        }
+#endif
+    }
+#ifdef GPU
+    if(gpu_index >= 0) push_convolutional_layer(*l);
+#endif
+}
+
+/* Folds the batchnorm of the convolutional layers into their weights and
+ * biases, for inference only: the weights saved after it do not match
+ * their cfg any more. */
+void fuse_batchnorm_network(network *net)
+{
+    int i, j, k;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->type != CONVOLUTIONAL || !l->batch_normalize) continue;
+        int size = l->nweights/l->n;
+        for(j = 0; j < l->n; ++j){
+            float scale = l->scales[j]/(sqrt(l->rolling_variance[j]) + .000001f);
+            for(k = 0; k < size; ++k){
+                l->weights[j*size + k] *= scale;
+            }
+            l->biases[j] -= l->rolling_mean[j]*scale;
+        }
+        fused_convolutional_layer(l);
+    }
+}
+
+/* Records in input_range the largest magnitude each convolutional layer has
+ * seen in its input, over all the inputs calibrated so far: forwards input
+ * in FP32, on the CPU. */
+void calibrate_int8_network(network *net, float *input)
+{
+    network orig = *net;
+    int i, j;
+    net->input = input;
+    net->truth = 0;
+    net->train = 0;
+    net->delta = 0;
+    net->int8 = 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        net->index = i;
+        if(l->type == CONVOLUTIONAL){
+            for(j = 0; j < l->inputs*l->batch; ++j){
+                l->input_range = fmaxf(l->input_range, fabsf(net->input[j]));
+            }
+        }
+        l->forward(*l, *net);
+        net->input = l->output;
+    }
+    *net = orig;
+}
+
+/* Quantizes the calibrated convolutional layers that the int8 forward
+ * covers: those without batchnorm left (c.f. fuse_batchnorm_network), groups,
+ * nor binary weights, whose input and im2col fit as bytes in the workspace.
+ * The first layer, fed the image, and the linear layers, feeding the
+ * detection layers, stay in FP32. Returns the number quantized. */
+int quantize_int8_network(network *net)
+{
+    int i, count = 0;
+    size_t workspace_size = 0;
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].workspace_size > workspace_size) workspace_size = net->layers[i].workspace_size;
+    }
+    for(i = 1; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->type != CONVOLUTIONAL || l->batch_normalize || l->groups != 1 || l->xnor || l->binary) continue;
+        if(l->activation == LINEAR || l->input_range <= 0) continue;
+        size_t bytes = l->inputs + (l->size == 1 ? 0 : (size_t)l->size*l->size*l->c*l->out_w*l->out_h);
+        if(bytes > workspace_size) continue;
+        quantize_convolutional_layer(l);
+        ++count;
+    }
+    return count;
+}
+
+/* The input ranges of the convolutional layers, as text, with their shapes
+ * to check them against the network loading them. */
+void save_int8_calibration(network *net, char *filename)
+{
+    int i, n = 0;
+    FILE *fp = fopen(filename, "w");
+    if(!fp) return;
+    for(i = 0; i < net->n; ++i) n += net->layers[i].type == CONVOLUTIONAL;
+    fprintf(fp, "int8 calibration %d\n", n);
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->type != CONVOLUTIONAL) continue;
+        fprintf(fp, "%d %d %d %d %d %d %.9g\n", i, l->c, l->h, l->w, l->n, l->size, l->input_range);
+    }
+    fclose(fp);
+}
+
+/* 0, the network unchanged, unless filename calibrates its every convolutional layer. */
+int load_int8_calibration(network *net, char *filename)
+{
+    int i, n = 0, count;
+    FILE *fp = fopen(filename, "r");
+    if(!fp) return 0;
+    for(i = 0; i < net->n; ++i) n += net->layers[i].type == CONVOLUTIONAL;
+    float *ranges = calloc(net->n, sizeof(float));
+    int ok = fscanf(fp, "int8 calibration %d", &count) == 1 && count == n;
+    for(i = 0; ok && i < count; ++i){
+        int index, c, h, w, filters, size;
+        float range;
+        ok = fscanf(fp, "%d %d %d %d %d %d %g", &index, &c, &h, &w, &filters, &size, &range) == 7;
+        ok = ok && index >= 0 && index < net->n;
+        if(!ok) break;
+        layer *l = net->layers + index;
+        ok = l->type == CONVOLUTIONAL && l->c == c && l->h == h && l->w == w && l->n == filters && l->size == size;
+        ranges[index] = range;
+    }
+    fclose(fp);
+    if(ok){
+        for(i = 0; i < net->n; ++i){
+            if(net->layers[i].type == CONVOLUTIONAL) net->layers[i].input_range = ranges[i];
+        }
+    }
+    free(ranges);
+    return ok;
+}
+
+/* The cache of a network holds the fused weights of its convolutional
+ * layers, the biases then the weights of each, after a header keyed on the
+ * sizes and modification times of the cfg and weights files. */
+#define NETWORK_CACHE_MAGIC 0x31434e44
+
+typedef struct{
+    int magic;
+    int n;
+    long long cfg_size, cfg_mtime;
+    long long weights_size, weights_mtime;
+    size_t floats;
+    size_t seen;
+} network_cache_header;
+
+static void file_key(char *filename, long long *size, long long *mtime)
+{
+    struct stat s;
+    *size = *mtime = -1;
+    if(stat(filename, &s) == 0){
+        *size = s.st_size;
+        *mtime = s.st_mtime;
+    }
+}
+
+/* Networks of convolutional layers and layers without weights only. */
+static int is_cacheable_network(network *net)
+{
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        LAYER_TYPE type = l.type;
+        if(l.dontload || l.numload) return 0;
+        if(type != CONVOLUTIONAL && type != MAXPOOL && type != AVGPOOL && type != ROUTE && type != SHORTCUT
+                && type != UPSAMPLE && type != REORG && type != ACTIVE && type != DROPOUT && type != COST
+                && !is_network_output(type)) return 0;
+    }
+    return 1;
+}
+
+static size_t network_cache_floats(network *net)
+{
+    size_t floats = 0;
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == CONVOLUTIONAL) floats += l.n + l.nweights;
+    }
+    return floats;
+}
+
+/* Written aside and renamed, the cache of a node killed meanwhile left whole. */
+static void save_network_cache(network *net, char *filename, network_cache_header header)
+{
+    char *tmp = calloc(strlen(filename) + 5, sizeof(char));
+    sprintf(tmp, "%s.tmp", filename);
+    FILE *fp = fopen(tmp, "wb");
+    if(!fp){
+        fprintf(stderr, "Cannot write the network cache %s\n", filename);
+        free(tmp);
+        return;
+    }
+    header.seen = *net->seen;
+    fwrite(&header, sizeof(header), 1, fp);
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type != CONVOLUTIONAL) continue;
+        fwrite(l.biases, sizeof(float), l.n, fp);
+        fwrite(l.weights, sizeof(float), l.nweights, fp);
+    }
+    int failed = ferror(fp);
+    if(fclose(fp) || failed || rename(tmp, filename)){
+        fprintf(stderr, "Cannot write the network cache %s\n", filename);
+        remove(tmp);
+    } else {
+        fprintf(stderr, "Cached the fused weights in %s\n", filename);
+    }
+    free(tmp);
+}
+
+/* Copies the weights of the cache mapped in, if it is of the header. */
+static int load_network_cache(network *net, char *filename, network_cache_header header)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) return 0;
+    struct stat s;
+    size_t size = sizeof(header) + header.floats*sizeof(float);
+    if(fstat(fd, &s) || (size_t)s.st_size != size){
+        close(fd);
+        return 0;
+    }
+    void *map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return 0;
+    madvise(map, size, MADV_SEQUENTIAL);
+    network_cache_header *cached = map;
+    header.seen = cached->seen;
+    if(memcmp(cached, &header, sizeof(header))){
+        munmap(map, size);
+        return 0;
+    }
+    float *p = (float *)(cached + 1);
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->type != CONVOLUTIONAL) continue;
+        memcpy(l->biases, p, l->n*sizeof(float));
+        p += l->n;
+        memcpy(l->weights, p, l->nweights*sizeof(float));
+        p += l->nweights;
+        fused_convolutional_layer(l);
+    }
+    *net->seen = cached->seen;
+    munmap(map, size);
+    return 1;
+}
+
+network *load_network_cached(char *cfg, char *weights, char *cache)
+{
+    network *net;
+    if(!weights || !weights[0] || !cache || !cache[0]){
+        net = load_network(cfg, weights, 0);
+        fuse_batchnorm_network(net);
+        return net;
+    }
+    network_cache_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = NETWORK_CACHE_MAGIC;
+    file_key(cfg, &header.cfg_size, &header.cfg_mtime);
+    file_key(weights, &header.weights_size, &header.weights_mtime);
+
+    random_init_weights = 0;
+    net = parse_network_cfg(cfg);
+    random_init_weights = 1;
+    int cacheable = is_cacheable_network(net);
+    header.n = net->n;
+    header.floats = network_cache_floats(net);
+    if(cacheable && load_network_cache(net, cache, header)){
+        fprintf(stderr, "Loaded the fused weights from %s\n", cache);
+        return net;
+    }
+    free_network(net);
+
+    net = load_network(cfg, weights, 0);
+    fuse_batchnorm_network(net);
+    if(cacheable) save_network_cache(net, cache, header);
+    return net;
+}
+
+/* Lets the layers of a network for inference only share their outputs: a
+ * buffer holds the output of a layer until the last layer reading it,
+ * the next one or a route or shortcut, then the output of a later layer.
+ * The outputs of the detection layers and of the network stay theirs, the
+ * deltas of the other layers are freed. Once shared, the network can
+ * neither be trained nor resized. */
+void share_network_outputs(network *net)
+{
+    int i, j;
+    for(i = 0; i < net->n; ++i){
+        LAYER_TYPE type = net->layers[i].type;
+        if(type != CONVOLUTIONAL && type != MAXPOOL && type != AVGPOOL && type != ROUTE && type != SHORTCUT
+                && type != UPSAMPLE && type != REORG && type != BATCHNORM && type != ACTIVE && type != CONNECTED
+                && !is_network_output(type)) return;
+    }
+    if(net->nshared || net->n <= 0) return;
+
+    int *last = calloc((size_t)net->n, sizeof(int));
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        last[i] = (i == net->n - 1 || is_network_output(l.type)) ? net->n : i + 1;
+        if(l.type == ROUTE){
+            for(j = 0; j < l.n; ++j){
+                if(last[l.input_layers[j]] < i) last[l.input_layers[j]] = i;
+            }
+        }
+        if(l.type == SHORTCUT && last[l.index] < i) last[l.index] = i;
+    }
+
+    /* The smallest free buffer large enough, else the largest free one grown. */
+    int *buffer = calloc((size_t)net->n, sizeof(int));
+    int *until = calloc((size_t)net->n, sizeof(int));
+    size_t *size = calloc((size_t)net->n, sizeof(size_t));
+    size_t before = 0;
+    size_t after = 0;
+    int n = 0;
+    for(i = 0; i < net->n; ++i){
+        size_t need = (size_t)net->layers[i].outputs*net->layers[i].batch;
+        int best = -1;
+        for(j = 0; j < n; ++j){
+            if(until[j] >= i) continue;
+            if(best < 0) best = j;
+            else if(size[best] < need ? size[j] > size[best] : (size[j] >= need && size[j] < size[best])) best = j;
+        }
+        if(best < 0) best = n++;
+        if(size[best] < need) size[best] = need;
+        until[best] = last[i];
+        buffer[i] = best;
+        before += need;
+    }
+
+    net->nshared = n;
+    net->shared = calloc(n, sizeof(float *));
+    for(j = 0; j < n; ++j){
+#ifdef GPU
+        /* Pinned, for the outputs pulled to overlap the layers after them. */
+        if(gpu_index >= 0) net->shared[j] = cuda_make_host_array(size[j]);
+        else
+#endif
+        net->shared[j] = calloc(size[j], sizeof(float));
+        after += size[j];
+    }
+#ifdef GPU
+    if(gpu_index >= 0){
+        net->shared_gpu = calloc(n, sizeof(float *));
+        for(j = 0; j < n; ++j) net->shared_gpu[j] = cuda_make_array(0, size[j]);
+    }
+#endif
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        free(l->output);
+        l->output = net->shared[buffer[i]];
+        if(!is_network_output(l->type)){
+            free(l->delta);
+            l->delta = 0;
+        }
+#ifdef GPU
+        if(gpu_index >= 0){
+            cuda_free(l->output_gpu);
+            l->output_gpu = net->shared_gpu[buffer[i]];
+            if(!is_network_output(l->type)){
+                cuda_free(l->delta_gpu);
+                l->delta_gpu = 0;
+            }
+        }
+#endif
+    }
+    layer out = get_network_output_layer(net);
+    net->output = out.output;
+#ifdef GPU
+    net->output_gpu = out.output_gpu;
+#endif
+    fprintf(stderr, "Shared the outputs of %d layers in %d buffers: %.1f MB instead of %.1f MB\n",
+            net->n, n, after*sizeof(float)/1000000., before*sizeof(float)/1000000.);
+    free(last);
+    free(buffer);
+    free(until);
+    free(size);
+}
+
+static int is_mapped_output(LAYER_TYPE type)
+{
+    return type == YOLO || type == REGION;
+}
+
+/* Points the outputs of the YOLO and REGION layers at consecutive sections
+ * of x, of l.outputs*l.batch floats each, and of x_gpu unless it is null. */
+void point_network_outputs(network *net, float *x, float *x_gpu)
+{
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(!is_mapped_output(l->type)) continue;
+        l->output = x;
+        x += l->outputs*l->batch;
+#ifdef GPU
+        if(x_gpu){
+            l->output_gpu = x_gpu;
+            x_gpu += l->outputs*l->batch;
+        }
+#endif
+    }
+    layer out = get_network_output_layer(net);
+    net->output = out.output;
+#ifdef GPU
+    net->output_gpu = out.output_gpu;
+#endif
+}
+
+/* Moves the outputs of the YOLO and REGION layers of a network for
+ * inference to pinned host memory mapped to the device, if the device
+ * shares the host memory: the layers write them in place, and they are
+ * read once the stream of the thread is synchronized, never pulled. Off
+ * such a device the kernels would write them across the bus, they stay.
+ * Like shared outputs, mapped ones cannot be resized. Returns 1 if mapped. */
+int map_network_outputs(network *net)
+{
+#ifdef GPU
+    int i;
+    size_t n = 0;
+    if(net->gpu_index < 0 || net->mapped) return 0;
+    cuda_set_device(net->gpu_index);
+    if(!cuda_integrated()) return 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(is_mapped_output(l->type)) n += (size_t)l->outputs*l->batch;
+    }
+    if(!n) return 0;
+    /* Those of shared outputs freed with the network. */
+    for(i = 0; i < net->n && !net->nshared; ++i){
+        layer *l = net->layers + i;
+        if(!is_mapped_output(l->type)) continue;
+        free(l->output);
+        cuda_free(l->output_gpu);
+    }
+    float *x_gpu;
+    net->mapped = cuda_make_mapped_array(n, &x_gpu);
+    point_network_outputs(net, net->mapped, x_gpu);
+    fprintf(stderr, "Mapped the outputs of the detection layers: %.1f MB\n", n*sizeof(float)/1000000.);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* The mapped outputs freed, the layers left without. */
+static void free_mapped_outputs(network *net)
+{
+#ifdef GPU
+    int i;
+    if(!net->mapped) return;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(!is_mapped_output(l->type)) continue;
+        l->output = 0;
+        l->output_gpu = 0;
+    }
+    cuda_free_host(net->mapped);
+    net->mapped = 0;
+#endif
+}
+
 int resize_network(network *net, int w, int h)
 {
+    if(net->nshared || net->mapped) error("Cannot resize a network of shared or mapped outputs");
 #ifdef GPU
     cuda_set_device(net->gpu_index);
     cuda_free(net->workspace);
@@ -437,6 +919,104 @@ int resize_network(network *net, int w, int h)
     return 0;
 }
 
+/* A network of the layers of net at an input of w x h, their weights those
+ * of net but their outputs, the workspace and the inputs its own: several
+ * input sizes of one set of weights, allocated once. Of the layers that
+ * resize_network takes, freed by free_resized_network before net. */
+network *resized_network_copy(network *net, int w, int h)
+{
+    int i;
+    network *copy = calloc(1, sizeof(network));
+    *copy = *net;
+    copy->layers = calloc(net->n, sizeof(layer));
+    memcpy(copy->layers, net->layers, net->n*sizeof(layer));
+    copy->nshared = 0;
+    copy->shared = 0;
+    copy->mapped = 0;
+    copy->input = copy->truth = copy->output = copy->workspace = 0;
+    copy->cost = calloc(1, sizeof(float));
+    copy->gpu_outputs_only = 0;
+#ifdef GPU
+    copy->shared_gpu = 0;
+    copy->input_gpu = copy->truth_gpu = copy->output_gpu = 0;
+#endif
+    for(i = 0; i < copy->n; ++i){
+        layer *l = copy->layers + i;
+        l->output = l->delta = l->x = l->x_norm = 0;
+        l->indexes = 0;
+        if(l->input_layers){
+            l->input_layers = calloc(l->n, sizeof(int));
+            l->input_sizes = calloc(l->n, sizeof(int));
+            memcpy(l->input_layers, net->layers[i].input_layers, l->n*sizeof(int));
+        }
+#ifdef GPU
+        l->output_gpu = l->delta_gpu = l->x_gpu = l->x_norm_gpu = 0;
+        l->indexes_gpu = 0;
+#ifdef CUDNN
+        if(l->type == CONVOLUTIONAL){
+            cudnnCreateTensorDescriptor(&l->normTensorDesc);
+            cudnnCreateTensorDescriptor(&l->srcTensorDesc);
+            cudnnCreateTensorDescriptor(&l->dstTensorDesc);
+            cudnnCreateFilterDescriptor(&l->weightDesc);
+            cudnnCreateTensorDescriptor(&l->dsrcTensorDesc);
+            cudnnCreateTensorDescriptor(&l->ddstTensorDesc);
+            cudnnCreateFilterDescriptor(&l->dweightDesc);
+            cudnnCreateConvolutionDescriptor(&l->convDesc);
+        }
+#endif
+#endif
+    }
+    resize_network(copy, w, h);
+    return copy;
+}
+
+void free_resized_network(network *net)
+{
+    int i;
+    free_mapped_outputs(net);
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(!net->nshared) free(l->output);
+        free(l->delta);
+        free(l->x);
+        free(l->x_norm);
+        free(l->indexes);
+        free(l->input_layers);
+        free(l->input_sizes);
+#ifdef GPU
+        if(!net->nshared && l->output_gpu) cuda_free(l->output_gpu);
+        if(l->delta_gpu) cuda_free(l->delta_gpu);
+        if(l->x_gpu) cuda_free(l->x_gpu);
+        if(l->x_norm_gpu) cuda_free(l->x_norm_gpu);
+        if(l->indexes_gpu) cuda_free((float *)l->indexes_gpu);
+#endif
+    }
+    for(i = 0; i < net->nshared; ++i){
+#ifdef GPU
+        if(net->shared_gpu){
+            cuda_free_host(net->shared[i]);
+            cuda_free(net->shared_gpu[i]);
+            continue;
+        }
+#endif
+        free(net->shared[i]);
+    }
+    free(net->shared);
+    free(net->layers);
+    free(net->input);
+    free(net->truth);
+    free(net->cost);
+#ifdef GPU
+    free(net->shared_gpu);
+    if(net->input_gpu) cuda_free(net->input_gpu);
+    if(net->truth_gpu) cuda_free(net->truth_gpu);
+    if(gpu_index >= 0) cuda_free(net->workspace);
+    else
+#endif
+    free(net->workspace);
+    free(net);
+}
+
 layer get_network_detection_layer(network *net)
 {
     int i;
@@ -716,9 +1296,30 @@ float network_accuracy_multi(network *net, data d, int n)
 void free_network(network *net)
 {
     int i;
+    free_mapped_outputs(net);
     for(i = 0; i < net->n; ++i){
+        if(net->nshared){
+            net->layers[i].output = 0;
+#ifdef GPU
+            net->layers[i].output_gpu = 0;
+#endif
+        }
         free_layer(net->layers[i]);
     }
+    for(i = 0; i < net->nshared; ++i){
+#ifdef GPU
+        if(net->shared_gpu){
+            cuda_free_host(net->shared[i]);
+            cuda_free(net->shared_gpu[i]);
+            continue;
+        }
+#endif
+        free(net->shared[i]);
+    }
+    free(net->shared);
+#ifdef GPU
+    free(net->shared_gpu);
+#endif
     free(net->layers);
     if(net->input) free(net->input);
     if(net->truth) free(net->truth);
@@ -763,7 +1364,9 @@ void forward_network_gpu(network *netp)
 {
     network net = *netp;
     cuda_set_device(net.gpu_index);
-    cuda_push_array(net.input_gpu, net.input, net.inputs*net.batch);
+    if(net.input){
+        cuda_push_array(net.input_gpu, net.input, net.inputs*net.batch);
+    }
     if(net.truth){
         cuda_push_array(net.truth_gpu, net.truth, net.truths*net.batch);
     }
@@ -776,6 +1379,7 @@ void forward_network_gpu(network *netp)
             fill_gpu(l.outputs * l.batch, 0, l.delta_gpu, 1);
         }
         l.forward_gpu(l, net);
+        if(net.layer_hook) net.layer_hook(net.layer_hook_arg);
         net.input_gpu = l.output_gpu;
         net.input = l.output;
         if(l.truth) {
@@ -783,10 +1387,30 @@ void forward_network_gpu(network *netp)
             net.truth = l.output;
         }
     }
-    pull_network_output(netp);
+    /* The outputs pulled by the YOLO and REGION layers are in once this last
+     * pull returns, those mapped once the stream of the thread is done. */
+    LAYER_TYPE type = get_network_output_layer(netp).type;
+    if(net.mapped && is_mapped_output(type)){
+        if(!net.gpu_outputs_only) check_error(cudaStreamSynchronize(cudaStreamPerThread));
+    } else if(!net.gpu_outputs_only || type != YOLO) pull_network_output(netp);
     calc_network_cost(netp);
 }
 
+/* as network_predict, of an input already on the device */
+float *network_predict_gpu(network *net, float *input_gpu)
+{
+    network orig = *net;
+    net->input = 0;
+    net->input_gpu = input_gpu;
+    net->truth = 0;
+    net->train = 0;
+    net->delta = 0;
+    forward_network(net);
+    float *out = net->output;
+    *net = orig;
+    return out;
+}
+
 void backward_network_gpu(network *netp)
 {
     int i;
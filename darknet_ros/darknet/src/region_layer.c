@@ -464,7 +464,7 @@ void forward_region_layer_gpu(const layer l, network net)
         softmax_gpu(net.input_gpu + index, l.classes + l.background, l.batch*l.n, l.inputs/l.n, l.w*l.h, 1, l.w*l.h, 1, l.output_gpu + index);
     }
     if(!net.train || l.onlyforward){
-        cuda_pull_array(l.output_gpu, l.output, l.batch*l.outputs);
+        if(!net.mapped) cuda_pull_array_async(l.output_gpu, l.output, l.batch*l.outputs);
         return;
     }
 
@@ -357,7 +357,8 @@ void forward_yolo_layer_gpu(const layer l, network net)
         }
     }
     if(!net.train || l.onlyforward){
-        cuda_pull_array(l.output_gpu, l.output, l.batch*l.outputs);
+        /* decoded from output_gpu, left there, or read in place if mapped */
+        if(!net.gpu_outputs_only && !net.mapped) cuda_pull_array_async(l.output_gpu, l.output, l.batch*l.outputs);
         return;
     }
 
@@ -0,0 +1,129 @@
+/*
+ * AttentionRegions.hpp
+ *
+ *  The regions of a camera image where the people tracked, or the clusters
+ *  of the lidar, are expected: projected into the image, cropped at their
+ *  native resolution and tiled into a smaller network input, detected in
+ *  place of the whole frame.
+ */
+
+#pragma once
+
+// c++
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// ROS
+#include <geometry_msgs/Point.h>
+#include <people_msgs/People.h>
+#include <people_msgs/PositionMeasurementArray.h>
+#include <ros/ros.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <std_msgs/Header.h>
+#include <tf/transform_listener.h>
+
+extern "C" {
+#include "box.h"
+#include "image.h"
+#include "network.h"
+}
+
+namespace darknet_ros {
+
+//! A region of a camera image, in pixels.
+struct AttentionRoi {
+  int x, y, w, h;
+};
+
+//! A region pasted into the attention input, at its origin there and scaled, down only.
+struct AttentionTile {
+  AttentionRoi roi;
+  int x, y;
+  float scale;
+};
+
+class AttentionRegions {
+ public:
+  /*!
+   * Reads the detection/attention parameters and subscribes to the
+   * targets and to the camera info if enabled.
+   */
+  explicit AttentionRegions(ros::NodeHandle& nodeHandle);
+
+  bool enabled() const { return enabled_; }
+
+  //! Side of the square network input the regions are tiled into.
+  int inputSize() const { return inputSize_; }
+
+  //! Frames detected over the regions between two detected whole.
+  int fullFramePeriod() const { return fullFramePeriod_; }
+
+  /*!
+   * The regions of the targets seen in the camera image of a header, the
+   * targets older than attention/max_age dropped.
+   * @return false if the whole frame is to be detected instead: no camera
+   * info yet, or more targets than attention/max_regions.
+   */
+  bool regions(const std_msgs::Header& header, int width, int height, std::vector<AttentionRoi>& rois);
+
+  /*!
+   * Lays the regions out on a grid of tiles of the input, each centered in
+   * its tile and scaled down to fit it.
+   */
+  static std::vector<AttentionTile> layout(const std::vector<AttentionRoi>& rois, int inputWidth, int inputHeight);
+
+  /*!
+   * Pastes the regions of a camera image into the input, the rest at 0.5.
+   */
+  static void tile(const image& im, const std::vector<AttentionTile>& tiles, image& input);
+
+  /*!
+   * Maps the boxes detected in the input, relative to it, to the camera
+   * image, relative to it: the boxes centered in a tile moved before the
+   * count returned, the others after it.
+   */
+  static int untile(detection* dets, int nboxes, const std::vector<AttentionTile>& tiles, int inputWidth, int inputHeight,
+                    int width, int height);
+
+ private:
+  //! A target in the optical frame of the camera.
+  struct Target {
+    tf::Point point;
+    ros::Time stamp;
+    int source;
+  };
+
+  void tracksCallback(const people_msgs::People::ConstPtr& msg);
+
+  void clustersCallback(const people_msgs::PositionMeasurementArray::ConstPtr& msg);
+
+  void cameraInfoCallback(const sensor_msgs::CameraInfo::ConstPtr& msg);
+
+  /*!
+   * Replaces the targets of a source by the points of a message, in the frame of the camera.
+   */
+  void setTargets(int source, const std_msgs::Header& header, const std::vector<geometry_msgs::Point>& points);
+
+  bool enabled_;
+  int inputSize_;
+  int fullFramePeriod_;
+  int maxRegions_;
+  double maxAge_;
+  double personHeight_;
+  double margin_;
+
+  ros::Subscriber tracksSubscriber_;
+  ros::Subscriber clustersSubscriber_;
+  ros::Subscriber cameraInfoSubscriber_;
+  std::unique_ptr<tf::TransformListener> listener_;
+
+  //! The targets and the intrinsics of the camera, of the callbacks and the fetch stage.
+  std::mutex mutex_;
+  std::vector<Target> targets_;
+  std::string cameraFrame_;
+  double fx_ = 0, fy_ = 0, cx_ = 0, cy_ = 0;
+};
+
+} /* namespace darknet_ros*/
@@ -0,0 +1,78 @@
+/*
+ * BoundedQueue.hpp
+ *
+ *  Bounded FIFO handing items from one thread to another, the pushing and
+ *  the popping thread sleeping on condition variables until there is room,
+ *  an item or the queue is closed.
+ */
+
+#pragma once
+
+// c++
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace darknet_ros {
+
+template <typename T>
+class BoundedQueue {
+ public:
+  /*!
+   * Constructor.
+   * @param[in] capacity items the queue holds before push waits.
+   */
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+  /*!
+   * Appends an item, waiting for room.
+   * @return false if the queue is closed, the item dropped.
+   */
+  bool push(const T& item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    notFull_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+    if (closed_) return false;
+    items_.push_back(item);
+    lock.unlock();
+    notEmpty_.notify_one();
+    return true;
+  }
+
+  /*!
+   * Takes the oldest item, waiting for one.
+   * @return false if the queue is closed.
+   */
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    notEmpty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+    if (closed_) return false;
+    item = items_.front();
+    items_.pop_front();
+    lock.unlock();
+    notFull_.notify_one();
+    return true;
+  }
+
+  /*!
+   * Wakes the threads waiting on the queue, push and pop failing from now on.
+   */
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    notFull_.notify_all();
+    notEmpty_.notify_all();
+  }
+
+ private:
+  const size_t capacity_;
+  std::deque<T> items_;
+  bool closed_ = false;
+  std::mutex mutex_;
+  std::condition_variable notFull_;
+  std::condition_variable notEmpty_;
+};
+
+} /* namespace darknet_ros*/
@@ -0,0 +1,58 @@
+/*
+ * InferenceBackend.hpp
+ *
+ *  The forward pass of the network behind YoloObjectDetector: darknet
+ *  itself, or an engine built from the same cfg and weights, the outputs
+ *  left in the layers of the darknet network for get_network_boxes.
+ */
+
+#pragma once
+
+extern "C" {
+#include "network.h"
+}
+
+namespace darknet_ros {
+
+class InferenceBackend {
+ public:
+  virtual ~InferenceBackend() = default;
+
+  //! Name of the backend, for the log.
+  virtual const char* name() const = 0;
+
+  /*!
+   * Runs the network on an input of net->w x net->h x net->c floats, the
+   * outputs of its YOLO, REGION and DETECTION layers in their output
+   * buffers on the host when it returns.
+   * @param[in] input host input, used if inputGpu is null.
+   * @param[in] inputGpu device input, or null.
+   */
+  virtual void predict(float* input, float* inputGpu) = 0;
+
+  //! Whether the outputs of the YOLO and REGION layers are also in their output_gpu buffers.
+  virtual bool outputsOnGpu() const { return false; }
+};
+
+//! The forward pass of darknet, on the GPU of GPU builds.
+class DarknetBackend : public InferenceBackend {
+ public:
+  explicit DarknetBackend(network* net) : net_(net) {}
+
+  const char* name() const override { return "darknet"; }
+
+  void predict(float* input, float* inputGpu) override;
+
+  bool outputsOnGpu() const override {
+#ifdef GPU
+    return net_->gpu_index >= 0;
+#else
+    return false;
+#endif
+  }
+
+ private:
+  network* net_;
+};
+
+} /* namespace darknet_ros*/
@@ -0,0 +1,75 @@
+/*
+ * InputResolutions.hpp
+ *
+ *  The input sizes the network is run at, chosen frame by frame: the
+ *  smallest one whose people are near enough to keep their recall, the
+ *  nearest person tracked deciding, stepped down further while the
+ *  perception stack is degraded.
+ */
+
+#pragma once
+
+// c++
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// ROS
+#include <people_msgs/People.h>
+#include <ros/ros.h>
+#include <tf/transform_listener.h>
+
+namespace darknet_ros {
+
+//! A square input size, for the people up to a distance from the robot.
+struct InputResolution {
+  int size;
+  double maxDistance;
+};
+
+class InputResolutions {
+ public:
+  /*!
+   * Reads the detection/resolutions parameters and subscribes to the tracks
+   * if enabled, the input size of the cfg added to the sizes if it is not
+   * one of them, chosen without tracks only.
+   */
+  InputResolutions(ros::NodeHandle& nodeHandle, int cfgSize);
+
+  bool enabled() const { return enabled_; }
+
+  //! The sizes, ascending.
+  const std::vector<InputResolution>& resolutions() const { return resolutions_; }
+
+  //! Index of the size of the cfg.
+  int cfgIndex() const { return cfgIndex_; }
+
+  /*!
+   * The size of a frame: the smallest one as far as the nearest person
+   * tracked, the largest beyond, that of the cfg without a person tracked
+   * within resolutions/max_age; from degradation level 2, as many sizes
+   * smaller as the level above 1.
+   * @return index of the size.
+   */
+  int select(const ros::Time& stamp, int degradationLevel);
+
+ private:
+  void tracksCallback(const people_msgs::People::ConstPtr& msg);
+
+  bool enabled_ = false;
+  std::vector<InputResolution> resolutions_;
+  int cfgIndex_ = 0;
+  double maxAge_;
+  std::string robotFrame_;
+
+  ros::Subscriber tracksSubscriber_;
+  std::unique_ptr<tf::TransformListener> listener_;
+
+  //! The distance of the nearest person of the last tracks, of the callback and the fetch stage.
+  std::mutex mutex_;
+  double nearest_ = -1;
+  ros::Time stamp_;
+};
+
+} /* namespace darknet_ros*/
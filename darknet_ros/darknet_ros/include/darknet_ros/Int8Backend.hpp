@@ -0,0 +1,54 @@
+/*
+ * Int8Backend.hpp
+ *
+ *  The forward pass of darknet on the CPU with the convolutional layers in
+ *  INT8: the weights quantized per output channel, the inputs by the
+ *  largest magnitude each layer saw over calibration images or the frames
+ *  of a bag, cached next to the weights. The first layer and the linear
+ *  layers feeding the YOLO layers stay in FP32.
+ */
+
+#pragma once
+
+// c++
+#include <string>
+
+#include "darknet_ros/InferenceBackend.hpp"
+
+namespace darknet_ros {
+
+struct Int8Options {
+  //! Directory of the calibration images, or a bag of camera images.
+  std::string calibration;
+  //! Image topic of the bag, its first one if empty.
+  std::string calibrationTopic;
+  //! Images calibrating at most.
+  int calibrationFrames = 100;
+  //! Input ranges calibrated, next to the weights if empty; calibrated again if older than the weights.
+  std::string calibrationFile;
+  std::string weightsFile;
+};
+
+class Int8Backend : public InferenceBackend {
+ public:
+  /*!
+   * Calibrates the network, or loads its calibration, and quantizes it.
+   * @throw std::runtime_error on the GPU, without calibration, or if no layer can be quantized.
+   */
+  Int8Backend(network* net, const Int8Options& options);
+
+  const char* name() const override { return "int8"; }
+
+  void predict(float* input, float* inputGpu) override;
+
+ private:
+  //! Calibrates on the images of the options, returns their number.
+  int calibrate();
+  int calibrateBag();
+  void calibrate(image im);
+
+  network* net_;
+  Int8Options options_;
+};
+
+} /* namespace darknet_ros*/
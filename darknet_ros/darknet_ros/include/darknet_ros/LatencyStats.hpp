@@ -0,0 +1,40 @@
+/*
+ * LatencyStats.hpp
+ *
+ *  The latencies of a stage of the detection, summarized over a period for
+ *  the diagnostics of the node and the benchmark.
+ */
+
+#pragma once
+
+// c++
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace darknet_ros {
+
+//! Latencies in milliseconds, all 0 of none.
+struct LatencySummary {
+  size_t count = 0;
+  double mean = 0;
+  double p50 = 0;
+  double p90 = 0;
+  double p99 = 0;
+  double max = 0;
+};
+
+class LatencyStats {
+ public:
+  //! Adds a latency in seconds, of any thread.
+  void add(double seconds);
+
+  //! Summarizes the latencies added since the last call and clears them.
+  LatencySummary take();
+
+ private:
+  std::mutex mutex_;
+  std::vector<double> samples_;
+};
+
+} /* namespace darknet_ros*/
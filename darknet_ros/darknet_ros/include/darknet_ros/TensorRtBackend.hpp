@@ -0,0 +1,88 @@
+/*
+ * TensorRtBackend.hpp
+ *
+ *  The forward pass of the network by a TensorRT engine, built from the
+ *  layers of the darknet network loaded from the cfg and the weights, in
+ *  FP32, FP16 or INT8, on the GPU or a DLA core, and serialized to disk
+ *  for the next start. The YOLO and REGION layers are left to darknet,
+ *  the engine computing their inputs, so that the boxes are decoded as
+ *  with the darknet backend.
+ */
+
+#pragma once
+
+#ifdef DARKNET_ROS_TENSORRT
+
+// c++
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "darknet_ros/InferenceBackend.hpp"
+
+namespace nvinfer1 {
+class ICudaEngine;
+class IExecutionContext;
+}
+
+namespace darknet_ros {
+
+struct TensorRtOptions {
+  //! fp32, fp16 or int8.
+  std::string precision = "fp16";
+  //! DLA core of the engine, the layers it has not falling back to the GPU, none if negative.
+  int dlaCore = -1;
+  //! Serialized engine, next to the weights if empty.
+  std::string engineFile;
+  //! Directory of the images calibrating INT8, required for int8 unless the calibration is cached.
+  std::string calibrationImages;
+  //! Workspace of the builder, in MB.
+  int workspaceSize = 256;
+  //! Files of the network, the engine rebuilt when they change.
+  std::string configFile;
+  std::string weightsFile;
+};
+
+class TensorRtBackend : public InferenceBackend {
+ public:
+  /*!
+   * Loads the engine serialized for the network and the options, or builds
+   * and serializes it.
+   * @throw std::runtime_error if the network has a layer the engine lacks
+   * or the engine cannot be built.
+   */
+  TensorRtBackend(network* net, const TensorRtOptions& options);
+  ~TensorRtBackend() override;
+
+  const char* name() const override { return "tensorrt"; }
+
+  void predict(float* input, float* inputGpu) override;
+
+ private:
+  struct Output {
+    int layer;
+    int binding;
+    float* data;
+  };
+
+  //! Identifies the network and the options the engine was built for.
+  std::string engineKey() const;
+  bool loadEngine(const std::string& path);
+  void buildEngine(const std::string& path);
+  void createContext();
+  //! Applies the activations darknet applies in the layer, its CPU forward pass not doing so in GPU builds.
+  void activateOutput(const layer& l) const;
+
+  network* net_;
+  TensorRtOptions options_;
+  nvinfer1::ICudaEngine* engine_ = nullptr;
+  nvinfer1::IExecutionContext* context_ = nullptr;
+  int inputBinding_ = 0;
+  float* input_ = nullptr;
+  std::vector<Output> outputs_;
+  std::vector<void*> bindings_;
+};
+
+} /* namespace darknet_ros*/
+
+#endif
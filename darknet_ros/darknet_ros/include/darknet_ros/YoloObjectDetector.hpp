@@ -10,21 +10,27 @@
 
 // c++
 #include <pthread.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <thread>
 #include <vector>
 
 // ROS
 #include <actionlib/server/simple_action_server.h>
+#include <diagnostic_updater/diagnostic_updater.h>
 #include <geometry_msgs/Point.h>
 #include <image_transport/image_transport.h>
 #include <ros/ros.h>
 #include <sensor_msgs/Image.h>
 #include <sensor_msgs/image_encodings.h>
 #include <std_msgs/Header.h>
+#include <std_msgs/UInt8.h>
 
 // OpenCv
 #include <cv_bridge/cv_bridge.h>
@@ -38,6 +44,12 @@
 #include <darknet_ros_msgs/CheckForObjectsAction.h>
 #include <darknet_ros_msgs/ObjectCount.h>
 
+// The GPU shared with the lidar clustering
+#include <gpu_arbiter/gpu_arbiter.h>
+
+// CPUs and priorities of the stages
+#include <thread_config/thread_config.h>
+
 // Darknet.
 #ifdef GPU
 #include "cublas_v2.h"
@@ -59,8 +71,31 @@ extern "C" {
 // Image interface.
 #include "darknet_ros/image_interface.hpp"
 
+// Stage queues.
+#include "darknet_ros/BoundedQueue.hpp"
+
+// Preprocessing on the GPU.
+#include "darknet_ros/decode_gpu.hpp"
+#include "darknet_ros/preprocess_gpu.hpp"
+
+// Inference backends.
+#include "darknet_ros/InferenceBackend.hpp"
+#include "darknet_ros/Int8Backend.hpp"
+#include "darknet_ros/TensorRtBackend.hpp"
+
+// Latencies of the stages.
+#include "darknet_ros/LatencyStats.hpp"
+
+// Regions of the tracks and lidar clusters.
+#include "darknet_ros/AttentionRegions.hpp"
+
+// Input sizes of the nearest person.
+#include "darknet_ros/InputResolutions.hpp"
+
 extern "C" cv::Mat image_to_mat(image im);
 extern "C" image mat_to_image(cv::Mat m);
+extern "C" void mat_into_image(cv::Mat m, image im);
+extern "C" void letterbox_mat_into(cv::Mat m, int w, int h, image boxed);
 extern "C" int show_image(image p, const char* name, int ms);
 
 namespace darknet_ros {
@@ -76,6 +111,30 @@ typedef struct {
   std_msgs::Header header;
 } CvMatWithHeader_;
 
+//! The boxes detected in an image, kept for its rendering.
+struct StreamDetections {
+  detection* dets = nullptr;
+  //! Boxes drawn, and allocated.
+  int nboxes = 0;
+  int total = 0;
+};
+
+//! A camera of the node, of its slot in the batch of the network.
+struct CameraStream {
+  image_transport::Subscriber subscriber;
+  ros::Publisher objectPublisher;
+  ros::Publisher boundingBoxesPublisher;
+  ros::Publisher detectionImagePublisher;
+
+  //! The last image, shared with its message or converted once if of another encoding, and its sequence, under
+  //! mutexImageCallback_.
+  cv_bridge::CvImageConstPtr image;
+  uint64_t seq = 0;
+
+  //! Sequence of the last image fetched, of the fetch stage.
+  uint64_t fetchedSeq = 0;
+};
+
 class YoloObjectDetector {
  public:
   /*!
@@ -103,8 +162,15 @@ class YoloObjectDetector {
   /*!
    * Callback of camera.
    * @param[in] msg image pointer.
+   * @param[in] stream camera of the image.
+   */
+  void cameraCallback(const sensor_msgs::ImageConstPtr& msg, int stream);
+
+  /*!
+   * Callback of the degradation level of the perception stack.
+   * @param[in] msg level, the detections limited to degradedMaxRate_ from 1, at smaller input sizes from 2.
    */
-  void cameraCallback(const sensor_msgs::ImageConstPtr& msg);
+  void degradationCallback(const std_msgs::UInt8::ConstPtr& msg);
 
   /*!
    * Check for objects action goal callback.
@@ -126,7 +192,27 @@ class YoloObjectDetector {
    * Publishes the detection image.
    * @return true if successful.
    */
-  bool publishDetectionImage(const cv::Mat& detectionImage);
+  bool publishDetectionImage(const cv::Mat& detectionImage, ros::Publisher& publisher);
+
+  /*!
+   * Reports the frames received, detected, skipped and duplicated on the diagnostics.
+   */
+  void frameStatus(diagnostic_updater::DiagnosticStatusWrapper& stat);
+
+  /*!
+   * Reports the latencies of the stages since the last report on the diagnostics, and clears them.
+   */
+  void latencyStatus(diagnostic_updater::DiagnosticStatusWrapper& stat);
+
+  /*!
+   * Reports the waits for the GPU and the hand-overs to the lidar clustering since the last report.
+   */
+  void gpuStatus(diagnostic_updater::DiagnosticStatusWrapper& stat);
+
+  /*!
+   * Reports the threads of the stages, their CPUs and scheduling.
+   */
+  void threadStatus(diagnostic_updater::DiagnosticStatusWrapper& stat);
 
   //! Using.
   using CheckForObjectsActionServer = actionlib::SimpleActionServer<darknet_ros_msgs::CheckForObjectsAction>;
@@ -139,51 +225,126 @@ class YoloObjectDetector {
   int numClasses_;
   std::vector<std::string> classLabels_;
 
+  //! Classes detected, all if empty, the boxes of the others dropped before the suppression.
+  std::vector<int> classWhitelist_;
+
   //! Check for objects action server.
   CheckForObjectsActionServerPtr checkForObjectsActionServer_;
 
   //! Advertise and subscribe to image topics.
   image_transport::ImageTransport imageTransport_;
 
-  //! ROS subscriber and publisher.
-  image_transport::Subscriber imageSubscriber_;
-  ros::Publisher objectPublisher_;
-  ros::Publisher boundingBoxesPublisher_;
-
-  //! Detected objects.
-  std::vector<std::vector<RosBox_> > rosBoxes_;
-  std::vector<int> rosBoxCounter_;
-  darknet_ros_msgs::BoundingBoxes boundingBoxesResults_;
+  //! The cameras, detected in a batch of as many images, the first one also of the action.
+  std::vector<CameraStream> streams_;
 
-  //! Camera related parameters.
-  int frameWidth_;
-  int frameHeight_;
+  //! Seconds the fetch stage waits for the images of the other cameras after the first one, if several.
+  double batchWindow_;
 
-  //! Publisher of the bounding box image.
-  ros::Publisher detectionImagePublisher_;
+  //! Detected objects of an image, ordered by class for the publishing.
+  std::vector<RosBox_> rosBoxes_;
+  darknet_ros_msgs::BoundingBoxes boundingBoxesResults_;
 
   // Yolo running on thread.
   std::thread yoloThread_;
 
+  // Stages of the yolo pipeline, the fetch and the detect threads for the
+  // node, the yolo thread publishing; each of the three buffers is owned by
+  // one stage at a time and handed on by index through the queues. A buffer
+  // holds a batch of images, one per camera, those of the cameras without a
+  // new image inactive.
+  std::thread fetchThread_;
+  std::thread detectThread_;
+  BoundedQueue<int> freeBuffers_{3};
+  BoundedQueue<int> fetchedBuffers_{3};
+  BoundedQueue<int> detectedBuffers_{3};
+
+  // The rendering of the detection images, on a thread of low priority of
+  // its own, of the buffers published while it is idle and that someone
+  // looks at; the others freed as soon as published.
+  std::thread renderThread_;
+  BoundedQueue<int> renderBuffers_{1};
+  std::atomic<bool> rendering_{false};
+  int renderedFrames_ = 0;
+
   // Darknet.
   char** demoNames_;
   image** demoAlphabet_;
   int demoClasses_;
 
   network* net_;
-  std_msgs::Header headerBuff_[3];
-  image buff_[3];
+  //! Forward pass of net_, of detection/backend.
+  std::unique_ptr<InferenceBackend> backend_;
+  //! The forward passes of the GPU, handed over to the HIGH clients of the process after every layer.
+  gpu_arbiter::Client* gpuClient_ = nullptr;
+  std::vector<std_msgs::Header> headerBuff_[3];
+  //! When the frames of the buffer were fetched, the begin of their hop.
+  ros::Time buffFetchStamp_[3];
+  //! The frames of the buffer as darknet images, in the channel order of the network, converted only
+  //! if rendered or tiled into the attention regions.
+  std::vector<image> buff_[3];
+  std::vector<bool> buffConverted_[3];
+  //! The images of the frames of the buffer, held from the fetch under the lock to their conversion.
+  std::vector<cv_bridge::CvImageConstPtr> buffImages_[3];
+  std::vector<bool> buffActive_[3];
+  std::vector<StreamDetections> buffDets_[3];
+
+  //! The regions of the targets detected in place of the whole frame, of a single camera only, by a
+  //! copy of the network of the input of the regions.
+  std::unique_ptr<AttentionRegions> attention_;
+  network* attentionNet_ = nullptr;
+  std::unique_ptr<InferenceBackend> attentionBackend_;
+  image attentionInput_[3];
+  bool buffAttention_[3] = {false, false, false};
+  std::vector<AttentionTile> buffTiles_[3];
+  uint64_t fetchedFrames_ = 0;
+  //! The input sizes of the frames, copies of net_ of the other sizes sharing its weights, net_ and
+  //! backend_ at that of the cfg; the buffers of the largest one.
+  std::unique_ptr<InputResolutions> resolutions_;
+  std::vector<network*> resolutionNets_;
+  std::vector<std::unique_ptr<InferenceBackend>> resolutionBackends_;
+  int buffResolution_[3] = {0, 0, 0};
+  //! The network input of the batch, the letterboxed images one after the other.
   image buffLetter_[3];
   int buffId_[3];
-  int buffIndex_ = 0;
+
+  //! The network inputs letterboxed on the GPU if set.
+  bool gpuPreprocessing_;
+#ifdef GPU
+  float* buffLetterGpu_[3] = {nullptr, nullptr, nullptr};
+  //! Recorded on the stream of the fetch stage once the input of the buffer is.
+  cudaEvent_t buffLetterReady_[3];
+  Bgr8BufferGpu pixelsGpu_;
+#endif
+  //! The boxes of the YOLO layers decoded and suppressed on the GPU if set and possible.
+  bool gpuDecode_;
+#ifdef GPU
+  YoloDecoderGpu decoderGpu_;
+#endif
+  //! The outputs of the YOLO and REGION layers decoded on the CPU mapped to the GPU if set and it shares the host memory.
+  bool mappedOutputs_;
+  //! The window of predictions_ mapped, each frame written there by the network instead of copied.
+  bool mappedWindow_ = false;
   float fps_ = 0;
   float demoThresh_ = 0;
   float demoHier_ = .5;
   int running_ = 0;
-  cv::Mat disp_;
+  std::vector<cv::Mat> disp_;
   int demoDelay_ = 0;
   int demoFrame_ = 3;
   float** predictions_;
+
+  //! How the outputs of the last demoFrame_ frames are averaged, not at all if only one.
+  enum class Averaging { None, Window, Running, Gpu };
+  Averaging averaging_;
+  //! Running sum of the outputs in predictions_, recomputed every sumPeriod_ frames against the rounding.
+  float* sum_ = nullptr;
+  uint64_t summedFrames_ = 0;
+  static const int sumPeriod_ = 1024;
+#ifdef GPU
+  //! The ring on the GPU, or the device addresses of predictions_ if mapped.
+  float** predictionsGpu_ = nullptr;
+  float* sumGpu_ = nullptr;
+#endif
   int demoIndex_ = 0;
   int demoDone_ = 0;
   float* lastAvg2_;
@@ -192,16 +353,49 @@ class YoloObjectDetector {
   int demoTotal_ = 0;
   double demoTime_;
 
-  RosBox_* roiBoxes_;
+  std::vector<RosBox_*> roiBoxes_[3];
   bool viewImage_;
   bool enableConsoleOutput_;
   int waitKeyDelay_;
   int fullScreen_;
   char* demoPrefix_;
 
-  std_msgs::Header imageHeader_;
-  cv::Mat camImageCopy_;
+  //! Guards the images of streams_, the fetch stage waiting on them.
   boost::shared_mutex mutexImageCallback_;
+  std::condition_variable_any newImageCondition_;
+  bool pipelineStopped_ = false;
+
+  std::chrono::steady_clock::time_point lastFetchTime_;
+
+  //! Detections per second at most, none if 0.
+  double maxRate_;
+
+  //! Detections per second at most while the perception stack is degraded.
+  double degradedMaxRate_;
+  std::atomic<bool> degraded_{false};
+  std::atomic<int> degradationLevel_{0};
+  ros::Subscriber degradationSubscriber_;
+
+  //! Frame counters, reported on the diagnostics.
+  std::atomic<uint64_t> receivedFrames_{0};
+  std::atomic<uint64_t> detectedFrames_{0};
+  std::atomic<uint64_t> skippedFrames_{0};
+  std::atomic<uint64_t> attentionFrames_{0};
+  std::atomic<uint64_t> duplicateFrames_{0};
+  std::atomic<int> inputSize_{0};
+
+  //! Latencies of the stages, reported on the diagnostics: the camera stamp
+  //! to the fetch, the preprocessing, the forward pass, the decoding and the
+  //! suppression, the publishing, and the camera stamp to the boxes published.
+  LatencyStats fetchLatency_;
+  LatencyStats preprocessLatency_;
+  LatencyStats forwardLatency_;
+  LatencyStats decodeLatency_;
+  LatencyStats publishLatency_;
+  LatencyStats ageLatency_;
+  std::chrono::steady_clock::time_point lastLatencyReport_ = std::chrono::steady_clock::now();
+  diagnostic_updater::Updater diagnostics_;
+  ros::Timer diagnosticsTimer_;
 
   bool imageStatus_ = false;
   boost::shared_mutex mutexImageStatus_;
@@ -218,30 +412,134 @@ class YoloObjectDetector {
 
   void rememberNetwork(network* net);
 
-  detection* avgPredictions(network* net, int* nboxes);
+  void avgPredictions(network* net);
+
+  /*!
+   * Averages the outputs of the network with those of the last frames, the
+   * oldest subtracted from the running sum and the last one added, in place.
+   */
+  void runningAvgPredictions(network* net);
+
+#ifdef GPU
+  /*!
+   * As runningAvgPredictions, from and on the output_gpu buffers of the layers.
+   */
+  void gpuAvgPredictions(network* net);
+#endif
+
+  /*!
+   * Boxes of the image of a camera, from its slot in the outputs of the network.
+   */
+  detection* streamBoxes(network* net, int stream, const image& im, int* nboxes);
 
-  void* detectInThread();
+  /*!
+   * Moves the boxes of none of the classes of the whitelist past the count
+   * returned, and zeroes the probabilities of the other classes of those kept.
+   */
+  int whitelistBoxes(detection* dets, int nboxes);
 
-  void* fetchInThread();
+  /*!
+   * Number of the cameras with an image not fetched yet, under mutexImageCallback_.
+   */
+  size_t newImages() const;
 
-  void* displayInThread(void* ptr);
+  void* detectInThread(int buffer);
+
+  /*!
+   * Detects the regions of the targets of the first camera of a buffer, none if there are none.
+   */
+  void detectRegions(int buffer, float nms);
+
+  /*!
+   * Collects the boxes detected in an image for the publishing.
+   */
+  void extractBoxes(detection* dets, int nboxes, RosBox_* roiBoxes);
+
+  /*!
+   * Fetches the next images not detected yet into a buffer, waiting for one
+   * and then for batchWindow_ at most for those of the other cameras.
+   * @return false if the pipeline is stopped.
+   */
+  bool fetchInThread(int buffer);
+
+  void* displayInThread(int buffer);
 
   void* displayLoop(void* ptr);
 
+  /*!
+   * Fetches the camera image into the buffers freed by the publishing.
+   */
+  void* fetchLoop(void* ptr);
+
+  /*!
+   * Detects the objects in the buffers fetched, for the publishing.
+   */
   void* detectLoop(void* ptr);
 
+  /*!
+   * Whether the detection image of a camera is shown, saved, printed or subscribed to.
+   */
+  bool renderStream(int stream);
+
+  /*!
+   * Draws the detections of a buffer and shows, saves and publishes its detection images.
+   */
+  void renderInThread(int buffer);
+
+  /*!
+   * Renders the buffers published, at a low priority, and frees them for the next images.
+   */
+  void* renderLoop(void* ptr);
+
+  /*!
+   * Wakes the stages of the pipeline and closes their queues, for the yolo thread to join them.
+   */
+  void stopPipeline();
+
   void setupNetwork(char* cfgfile, char* weightfile, char* datafile, float thresh, char** names, int classes, int delay, char* prefix,
                     int avg_frames, float hier, int w, int h, int frames, int fullscreen);
 
+  /*!
+   * Loads the network of the cfg and weights, its batchnorm fused, from
+   * the cache of detection/network_cache if enabled, building it if stale.
+   */
+  network* loadNetwork(char* cfgfile, char* weightfile);
+
+  /*!
+   * Creates the backend of detection/backend, darknet if another one fails.
+   */
+  void setupBackend(const char* cfgfile, const char* weightfile);
+
+  /*!
+   * Loads the network of the attention regions, of a batch of one and their
+   * input, the attention left off if it cannot be resized.
+   */
+  void setupAttention(char* cfgfile, char* weightfile);
+
+  /*!
+   * Makes the copies of net_ of the input sizes, of their own outputs and
+   * backends, the resolutions left off if it cannot be resized.
+   */
+  void setupResolutions();
+
+  //! The network of the input size of a buffer, and its forward pass.
+  network* bufferNetwork(int buffer) const;
+  InferenceBackend* bufferBackend(int buffer) const;
+
   void yolo();
 
-  CvMatWithHeader_ getCvMatWithHeader();
+  CvMatWithHeader_ getCvMatWithHeader(int stream);
 
   bool getImageStatus(void);
 
   bool isNodeRunning(void);
 
-  void* publishInThread();
+  void* publishInThread(int buffer);
+
+  /*!
+   * Publishes the boxes detected in a camera of a buffer, its image published by the rendering.
+   */
+  void publishStream(int buffer, int stream);
 };
 
 } /* namespace darknet_ros*/
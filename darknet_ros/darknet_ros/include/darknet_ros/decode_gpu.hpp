@@ -0,0 +1,93 @@
+/*
+ * decode_gpu.hpp
+ *
+ *  Decoding of the boxes of the YOLO layers on the GPU: the anchors above
+ *  the threshold decoded by a kernel from the outputs left on the device,
+ *  their non-maximum suppression by another, and only the boxes kept
+ *  copied back to the host.
+ */
+
+#pragma once
+
+#ifdef GPU
+
+#include <vector>
+
+extern "C" {
+#include "network.h"
+}
+
+namespace darknet_ros {
+
+//! An anchor above the threshold, its box corrected to the image.
+struct YoloCandidateGpu {
+  float x, y, w, h;
+  float objectness;
+  //! Output of the YOLO layer, index of the objectness of the anchor in the output of its image.
+  const float* output;
+  int index;
+  int classes;
+  int plane;
+};
+
+//! A box kept by the non-maximum suppression.
+struct YoloBoxGpu {
+  float x, y, w, h;
+  float objectness;
+};
+
+//! Device buffers of the decoding, of a network and a batch.
+struct YoloDecoderGpu {
+  int batch = 0;
+  int classes = 0;
+  //! Anchors decoded per image at most, the others dropped.
+  int maxCandidates = 0;
+  //! Widths and heights of the anchors of the YOLO layers, in pixels of the network input.
+  std::vector<float*> anchors;
+  //! Classes evaluated, all if none: the anchors without any of them above the threshold dropped before the suppression.
+  int* classIds = nullptr;
+  int classCount = 0;
+  //! Sizes of the images of the batch, width and height.
+  int* sizes = nullptr;
+  YoloCandidateGpu* candidates = nullptr;
+  int* candidateCounts = nullptr;
+  YoloBoxGpu* boxes = nullptr;
+  float* probs = nullptr;
+  int* boxCounts = nullptr;
+
+  //! The boxes of the last decoding, copied back, per image.
+  std::vector<int> hostCandidateCounts;
+  std::vector<int> hostBoxCounts;
+  std::vector<std::vector<YoloBoxGpu> > hostBoxes;
+  std::vector<std::vector<float> > hostProbs;
+};
+
+/*!
+ * Allocates the buffers of the decoding of a network all of whose
+ * detection layers are YOLO layers.
+ * @param[in] classIds classes evaluated, all if empty.
+ * @return false if the network has other detection layers.
+ */
+bool setupYoloDecoderGpu(YoloDecoderGpu& decoder, network* net, const std::vector<int>& classIds);
+
+/*!
+ * Decodes the boxes of the batch from the output_gpu buffers of the YOLO
+ * layers, as get_network_boxes and do_nms_obj: the anchors of objectness
+ * above thresh, the probabilities of the classes above thresh, the boxes
+ * sorted by objectness and those overlapping a box before them by more
+ * than nms dropped. The boxes kept are copied back to the host.
+ * @param[in] widths, heights sizes of the images of the batch.
+ */
+void decodeYoloGpu(YoloDecoderGpu& decoder, network* net, const int* widths, const int* heights, float thresh, float nms);
+
+/*!
+ * The boxes of the b-th image of the last decoding, freed by free_detections.
+ */
+detection* yoloDetectionsGpu(const YoloDecoderGpu& decoder, int b, int* nboxes);
+
+//! Frees the buffers of the decoding.
+void freeYoloDecoderGpu(YoloDecoderGpu& decoder);
+
+} /* namespace darknet_ros*/
+
+#endif
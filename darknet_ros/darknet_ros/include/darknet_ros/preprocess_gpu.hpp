@@ -0,0 +1,49 @@
+/*
+ * preprocess_gpu.hpp
+ *
+ *  Preprocessing of the camera images on the GPU: the BGR8 pixels are
+ *  uploaded once and converted, scaled and letterboxed into the network
+ *  input by a single kernel.
+ */
+
+#pragma once
+
+#ifdef GPU
+
+#include <cstddef>
+
+#include "cuda_runtime.h"
+
+namespace darknet_ros {
+
+//! Device buffer of the interleaved 8-bit pixels uploaded, and its pinned staging copy, grown as needed.
+struct Bgr8BufferGpu {
+  unsigned char* data = nullptr;
+  unsigned char* staging = nullptr;
+  size_t size = 0;
+  //! Recorded once the staging copy is uploaded, for it to be overwritten.
+  cudaEvent_t uploaded = nullptr;
+};
+
+/*!
+ * Uploads an image of interleaved 8-bit pixels and letterboxes it into a
+ * planar float input of the network, as letterbox_mat_into of darknet on
+ * the CPU: the channels in the order of the pixels, the values scaled to
+ * [0, 1], the image resized bilinearly to fit netWidth x netHeight and
+ * centered, the borders at 0.5. The pixels
+ * are copied into the pinned staging buffer before it returns, their
+ * upload and the kernel queued on the stream of the calling thread: the
+ * input is ready once an event recorded after it is.
+ * @param[in] pixels rows of width x 3 bytes, step bytes apart.
+ * @param[in,out] buffer device buffer of the pixels.
+ * @param[out] input device input of netWidth x netHeight x 3 floats.
+ */
+void letterboxBgr8Gpu(const unsigned char* pixels, int width, int height, int step, Bgr8BufferGpu& buffer, float* input,
+                      int netWidth, int netHeight);
+
+//! Frees the device and staging buffers of the pixels and their event.
+void freeBgr8BufferGpu(Bgr8BufferGpu& buffer);
+
+} /* namespace darknet_ros*/
+
+#endif
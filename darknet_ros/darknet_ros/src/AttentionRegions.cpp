@@ -0,0 +1,196 @@
+/*
+ * AttentionRegions.cpp
+ *
+ *  The regions of a camera image where the people tracked, or the clusters
+ *  of the lidar, are expected.
+ */
+
+#include "darknet_ros/AttentionRegions.hpp"
+
+extern "C" {
+#include "blas.h"
+}
+
+// c++
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace darknet_ros {
+
+namespace {
+enum Source { Tracks, Clusters };
+}
+
+AttentionRegions::AttentionRegions(ros::NodeHandle& nodeHandle) {
+  nodeHandle.param("detection/attention/enable", enabled_, false);
+  nodeHandle.param("detection/attention/input_size", inputSize_, 320);
+  nodeHandle.param("detection/attention/full_frame_period", fullFramePeriod_, 10);
+  nodeHandle.param("detection/attention/max_regions", maxRegions_, 4);
+  nodeHandle.param("detection/attention/max_age", maxAge_, 0.5);
+  nodeHandle.param("detection/attention/person_height", personHeight_, 1.8);
+  nodeHandle.param("detection/attention/margin", margin_, 1.4);
+  if (!enabled_) return;
+
+  std::string tracksTopic, clustersTopic, cameraInfoTopic;
+  nodeHandle.param("detection/attention/tracks_topic", tracksTopic, std::string("/people_tracker/people"));
+  nodeHandle.param("detection/attention/clusters_topic", clustersTopic, std::string("/object3d_detector_gpu/measurements"));
+  nodeHandle.param("detection/attention/camera_info_topic", cameraInfoTopic, std::string("/camera/color/camera_info"));
+  inputSize_ = std::max(32, inputSize_ / 32 * 32);
+  fullFramePeriod_ = std::max(1, fullFramePeriod_);
+
+  listener_.reset(new tf::TransformListener());
+  if (!tracksTopic.empty()) tracksSubscriber_ = nodeHandle.subscribe(tracksTopic, 1, &AttentionRegions::tracksCallback, this);
+  if (!clustersTopic.empty()) {
+    clustersSubscriber_ = nodeHandle.subscribe(clustersTopic, 1, &AttentionRegions::clustersCallback, this);
+  }
+  cameraInfoSubscriber_ = nodeHandle.subscribe(cameraInfoTopic, 1, &AttentionRegions::cameraInfoCallback, this);
+}
+
+void AttentionRegions::tracksCallback(const people_msgs::People::ConstPtr& msg) {
+  std::vector<geometry_msgs::Point> points;
+  for (const people_msgs::Person& person : msg->people) points.push_back(person.position);
+  setTargets(Tracks, msg->header, points);
+}
+
+void AttentionRegions::clustersCallback(const people_msgs::PositionMeasurementArray::ConstPtr& msg) {
+  std::vector<geometry_msgs::Point> points;
+  for (const people_msgs::PositionMeasurement& measurement : msg->people) points.push_back(measurement.pos);
+  setTargets(Clusters, msg->header, points);
+}
+
+void AttentionRegions::cameraInfoCallback(const sensor_msgs::CameraInfo::ConstPtr& msg) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cameraFrame_ = msg->header.frame_id;
+  fx_ = msg->K[0];
+  cx_ = msg->K[2];
+  fy_ = msg->K[4];
+  cy_ = msg->K[5];
+}
+
+void AttentionRegions::setTargets(int source, const std_msgs::Header& header, const std::vector<geometry_msgs::Point>& points) {
+  std::string cameraFrame;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cameraFrame = cameraFrame_;
+  }
+  if (cameraFrame.empty()) return;
+
+  // The latest transform, the targets moving less than the camera over its latency.
+  tf::StampedTransform transform;
+  try {
+    listener_->lookupTransform(cameraFrame, header.frame_id, ros::Time(0), transform);
+  } catch (tf::TransformException& ex) {
+    ROS_WARN_THROTTLE(5.0, "[AttentionRegions] %s", ex.what());
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  targets_.erase(std::remove_if(targets_.begin(), targets_.end(), [source](const Target& t) { return t.source == source; }),
+                 targets_.end());
+  for (const geometry_msgs::Point& point : points) {
+    targets_.push_back({transform * tf::Point(point.x, point.y, point.z), header.stamp, source});
+  }
+}
+
+bool AttentionRegions::regions(const std_msgs::Header& header, int width, int height, std::vector<AttentionRoi>& rois) {
+  rois.clear();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fx_ <= 0 || fy_ <= 0) return false;
+
+  // A square around each target ahead of the camera, of the height of a
+  // person with a margin at its distance, clipped to the image.
+  for (const Target& target : targets_) {
+    if (std::fabs((header.stamp - target.stamp).toSec()) > maxAge_) continue;
+    const tf::Point& p = target.point;
+    if (p.z() <= 0.1) continue;
+    double u = fx_ * p.x() / p.z() + cx_;
+    double v = fy_ * p.y() / p.z() + cy_;
+    int side = (int)std::ceil(fy_ * personHeight_ * margin_ / p.z());
+    int x0 = std::max(0, (int)(u - side / 2.));
+    int y0 = std::max(0, (int)(v - side / 2.));
+    int x1 = std::min(width, (int)(u + side / 2.));
+    int y1 = std::min(height, (int)(v + side / 2.));
+    if (x1 - x0 < 8 || y1 - y0 < 8) continue;
+    rois.push_back({x0, y0, x1 - x0, y1 - y0});
+  }
+
+  // A track and the cluster it follows, overlapping, detected once.
+  std::vector<AttentionRoi> merged;
+  for (const AttentionRoi& roi : rois) {
+    bool covered = false;
+    for (AttentionRoi& other : merged) {
+      int ix = std::min(roi.x + roi.w, other.x + other.w) - std::max(roi.x, other.x);
+      int iy = std::min(roi.y + roi.h, other.y + other.h) - std::max(roi.y, other.y);
+      if (ix <= 0 || iy <= 0 || ix * iy < .5 * std::min(roi.w * roi.h, other.w * other.h)) continue;
+      int x1 = std::max(roi.x + roi.w, other.x + other.w);
+      int y1 = std::max(roi.y + roi.h, other.y + other.h);
+      other.x = std::min(roi.x, other.x);
+      other.y = std::min(roi.y, other.y);
+      other.w = x1 - other.x;
+      other.h = y1 - other.y;
+      covered = true;
+      break;
+    }
+    if (!covered) merged.push_back(roi);
+  }
+  rois.swap(merged);
+  return (int)rois.size() <= maxRegions_;
+}
+
+std::vector<AttentionTile> AttentionRegions::layout(const std::vector<AttentionRoi>& rois, int inputWidth, int inputHeight) {
+  std::vector<AttentionTile> tiles;
+  if (rois.empty()) return tiles;
+  int cols = (int)std::ceil(std::sqrt((double)rois.size()));
+  int rows = (rois.size() + cols - 1) / cols;
+  int tileWidth = inputWidth / cols;
+  int tileHeight = inputHeight / rows;
+  for (size_t i = 0; i < rois.size(); ++i) {
+    const AttentionRoi& roi = rois[i];
+    float scale = std::min(1.f, std::min((float)tileWidth / roi.w, (float)tileHeight / roi.h));
+    int w = std::max(1, (int)(roi.w * scale));
+    int h = std::max(1, (int)(roi.h * scale));
+    int x = (i % cols) * tileWidth + (tileWidth - w) / 2;
+    int y = (i / cols) * tileHeight + (tileHeight - h) / 2;
+    tiles.push_back({roi, x, y, scale});
+  }
+  return tiles;
+}
+
+void AttentionRegions::tile(const image& im, const std::vector<AttentionTile>& tiles, image& input) {
+  fill_cpu(input.w * input.h * input.c, .5, input.data, 1);
+  for (const AttentionTile& t : tiles) {
+    image crop = crop_image(im, t.roi.x, t.roi.y, t.roi.w, t.roi.h);
+    if (t.scale < 1) {
+      image resized = resize_image(crop, std::max(1, (int)(t.roi.w * t.scale)), std::max(1, (int)(t.roi.h * t.scale)));
+      free_image(crop);
+      crop = resized;
+    }
+    embed_image(crop, input, t.x, t.y);
+    free_image(crop);
+  }
+}
+
+int AttentionRegions::untile(detection* dets, int nboxes, const std::vector<AttentionTile>& tiles, int inputWidth, int inputHeight,
+                             int width, int height) {
+  int kept = 0;
+  for (int i = 0; i < nboxes; ++i) {
+    box& b = dets[i].bbox;
+    float x = b.x * inputWidth;
+    float y = b.y * inputHeight;
+    for (const AttentionTile& t : tiles) {
+      float w = t.roi.w * t.scale;
+      float h = t.roi.h * t.scale;
+      if (x < t.x || x >= t.x + w || y < t.y || y >= t.y + h) continue;
+      b.x = (t.roi.x + (x - t.x) / t.scale) / width;
+      b.y = (t.roi.y + (y - t.y) / t.scale) / height;
+      b.w = b.w * inputWidth / t.scale / width;
+      b.h = b.h * inputHeight / t.scale / height;
+      std::swap(dets[i], dets[kept++]);
+      break;
+    }
+  }
+  return kept;
+}
+
+} /* namespace darknet_ros*/
@@ -0,0 +1,21 @@
+/*
+ * InferenceBackend.cpp
+ *
+ *  The forward pass of darknet.
+ */
+
+#include "darknet_ros/InferenceBackend.hpp"
+
+namespace darknet_ros {
+
+void DarknetBackend::predict(float* input, float* inputGpu) {
+#ifdef GPU
+  if (inputGpu) {
+    network_predict_gpu(net_, inputGpu);
+    return;
+  }
+#endif
+  network_predict(net_, input);
+}
+
+} /* namespace darknet_ros*/
@@ -0,0 +1,95 @@
+/*
+ * InputResolutions.cpp
+ *
+ *  The input sizes the network is run at, chosen frame by frame.
+ */
+
+#include "darknet_ros/InputResolutions.hpp"
+
+// c++
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace darknet_ros {
+
+InputResolutions::InputResolutions(ros::NodeHandle& nodeHandle, int cfgSize) {
+  std::vector<int> sizes;
+  std::vector<double> maxDistances;
+  nodeHandle.param("detection/resolutions/sizes", sizes, std::vector<int>(0));
+  nodeHandle.param("detection/resolutions/max_distances", maxDistances, std::vector<double>(0));
+  nodeHandle.param("detection/resolutions/max_age", maxAge_, 1.0);
+  nodeHandle.param("detection/resolutions/robot_frame", robotFrame_, std::string("base_link"));
+  if (sizes.empty()) return;
+  if (sizes.size() != maxDistances.size()) {
+    ROS_ERROR("[InputResolutions] %lu sizes but %lu max distances, detecting at the size of the cfg.", (unsigned long)sizes.size(),
+              (unsigned long)maxDistances.size());
+    return;
+  }
+
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    int size = std::max(32, sizes[i] / 32 * 32);
+    if (size != cfgSize) resolutions_.push_back({size, maxDistances[i]});
+  }
+  // The size of the cfg chosen without tracks, by the distance only if it is one of the sizes.
+  resolutions_.push_back({cfgSize, -1});
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    if (std::max(32, sizes[i] / 32 * 32) == cfgSize) resolutions_.back().maxDistance = maxDistances[i];
+  }
+  std::sort(resolutions_.begin(), resolutions_.end(),
+            [](const InputResolution& a, const InputResolution& b) { return a.size < b.size; });
+  resolutions_.erase(std::unique(resolutions_.begin(), resolutions_.end(),
+                                 [](const InputResolution& a, const InputResolution& b) { return a.size == b.size; }),
+                     resolutions_.end());
+  for (size_t i = 0; i < resolutions_.size(); ++i) {
+    if (resolutions_[i].size == cfgSize) cfgIndex_ = i;
+  }
+  if (resolutions_.size() < 2) return;
+  enabled_ = true;
+
+  std::string tracksTopic;
+  nodeHandle.param("detection/resolutions/tracks_topic", tracksTopic, std::string("/people_tracker/people"));
+  listener_.reset(new tf::TransformListener());
+  if (!tracksTopic.empty()) tracksSubscriber_ = nodeHandle.subscribe(tracksTopic, 1, &InputResolutions::tracksCallback, this);
+}
+
+void InputResolutions::tracksCallback(const people_msgs::People::ConstPtr& msg) {
+  double nearest = -1;
+  if (!msg->people.empty()) {
+    tf::StampedTransform transform;
+    try {
+      listener_->lookupTransform(robotFrame_, msg->header.frame_id, ros::Time(0), transform);
+    } catch (tf::TransformException& ex) {
+      ROS_WARN_THROTTLE(5.0, "[InputResolutions] %s", ex.what());
+      return;
+    }
+    nearest = std::numeric_limits<double>::infinity();
+    for (const people_msgs::Person& person : msg->people) {
+      tf::Point p = transform * tf::Point(person.position.x, person.position.y, person.position.z);
+      nearest = std::min(nearest, std::hypot(p.x(), p.y()));
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  nearest_ = nearest;
+  stamp_ = msg->header.stamp;
+}
+
+int InputResolutions::select(const ros::Time& stamp, int degradationLevel) {
+  int index = cfgIndex_;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (nearest_ >= 0 && std::fabs((stamp - stamp_).toSec()) <= maxAge_) {
+      index = resolutions_.size() - 1;
+      for (size_t i = 0; i < resolutions_.size(); ++i) {
+        if (resolutions_[i].maxDistance >= nearest_) {
+          index = i;
+          break;
+        }
+      }
+    }
+  }
+  if (degradationLevel >= 2) index = std::max(0, index - (degradationLevel - 1));
+  return index;
+}
+
+} /* namespace darknet_ros*/
@@ -0,0 +1,128 @@
+/*
+ * Int8Backend.cpp
+ *
+ *  The forward pass of darknet with its convolutional layers in INT8.
+ */
+
+#include "darknet_ros/Int8Backend.hpp"
+
+// c++
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/stat.h>
+
+// ROS
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/Image.h>
+
+// OpenCV
+#include <cv_bridge/cv_bridge.h>
+#include <opencv2/core/core.hpp>
+
+extern "C" {
+#include "image.h"
+}
+
+extern "C" void mat_into_image(cv::Mat m, image im);
+
+namespace darknet_ros {
+
+namespace {
+
+bool olderThan(const std::string& path, const std::string& other) {
+  struct stat status, otherStatus;
+  if (stat(path.c_str(), &status) != 0) return true;
+  return stat(other.c_str(), &otherStatus) == 0 && status.st_mtime < otherStatus.st_mtime;
+}
+
+bool isBag(const std::string& path) { return path.size() > 4 && path.compare(path.size() - 4, 4, ".bag") == 0; }
+
+}  // namespace
+
+Int8Backend::Int8Backend(network* net, const Int8Options& options) : net_(net), options_(options) {
+#ifdef GPU
+  if (net_->gpu_index >= 0) throw std::runtime_error("the INT8 backend runs on the CPU only");
+#endif
+  std::string cache = options_.calibrationFile.empty() ? options_.weightsFile + ".int8" : options_.calibrationFile;
+  if (olderThan(cache, options_.weightsFile) || !load_int8_calibration(net_, &cache[0])) {
+    int frames = calibrate();
+    if (frames == 0) throw std::runtime_error("no images to calibrate INT8 in '" + options_.calibration + "'");
+    ROS_INFO("[Int8Backend] Calibrated on %d images, saved to %s.", frames, cache.c_str());
+    save_int8_calibration(net_, &cache[0]);
+  }
+  int layers = quantize_int8_network(net_);
+  if (layers == 0) throw std::runtime_error("no layer of the network can be quantized");
+  ROS_INFO("[Int8Backend] %d convolutional layers in INT8.", layers);
+}
+
+void Int8Backend::predict(float* input, float* inputGpu) {
+  net_->int8 = 1;
+  network_predict(net_, input);
+  net_->int8 = 0;
+}
+
+int Int8Backend::calibrate() {
+  if (isBag(options_.calibration)) return calibrateBag();
+  std::vector<cv::String> files;
+  if (!options_.calibration.empty()) cv::glob(options_.calibration + "/*", files);
+  int frames = 0;
+  for (const cv::String& file : files) {
+    if (frames >= options_.calibrationFrames) break;
+    std::string extension = file.substr(file.find_last_of('.') + 1);
+    if (extension != "jpg" && extension != "jpeg" && extension != "png") continue;
+    image im = load_image_color(const_cast<char*>(file.c_str()), 0, 0);
+    calibrate(im);
+    free_image(im);
+    ++frames;
+  }
+  return frames;
+}
+
+// The frames evenly spread over the bag would need it read twice, the first ones are taken.
+int Int8Backend::calibrateBag() {
+  rosbag::Bag bag;
+  try {
+    bag.open(options_.calibration, rosbag::bagmode::Read);
+  } catch (const rosbag::BagException& e) {
+    ROS_ERROR("[Int8Backend] %s.", e.what());
+    return 0;
+  }
+  std::string topic = options_.calibrationTopic;
+  int frames = 0;
+  rosbag::View view(bag);
+  for (const rosbag::MessageInstance& message : view) {
+    if (frames >= options_.calibrationFrames) break;
+    if (topic.empty() && message.isType<sensor_msgs::Image>()) topic = message.getTopic();
+    if (message.getTopic() != topic) continue;
+    sensor_msgs::Image::ConstPtr msg = message.instantiate<sensor_msgs::Image>();
+    if (!msg) continue;
+    cv_bridge::CvImagePtr pixels;
+    try {
+      pixels = cv_bridge::toCvCopy(msg, "bgr8");
+    } catch (const cv_bridge::Exception& e) {
+      ROS_ERROR("[Int8Backend] %s.", e.what());
+      continue;
+    }
+    image im = make_image(pixels->image.cols, pixels->image.rows, pixels->image.channels());
+    mat_into_image(pixels->image, im);
+    calibrate(im);
+    free_image(im);
+    ++frames;
+  }
+  return frames;
+}
+
+void Int8Backend::calibrate(image im) {
+  // The other images of the batch left to zeros, which do not widen the ranges.
+  std::vector<float> input(net_->inputs * net_->batch, 0.f);
+  image sized = letterbox_image(im, net_->w, net_->h);
+  std::copy(sized.data, sized.data + net_->inputs, input.begin());
+  free_image(sized);
+  calibrate_int8_network(net_, input.data());
+}
+
+} /* namespace darknet_ros*/
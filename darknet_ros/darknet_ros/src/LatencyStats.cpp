@@ -0,0 +1,41 @@
+/*
+ * LatencyStats.cpp
+ *
+ *  The latencies of a stage of the detection.
+ */
+
+#include "darknet_ros/LatencyStats.hpp"
+
+// c++
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace darknet_ros {
+
+void LatencyStats::add(double seconds) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  samples_.push_back(seconds * 1000.);
+}
+
+LatencySummary LatencyStats::take() {
+  std::vector<double> samples;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    samples.swap(samples_);
+  }
+  LatencySummary summary;
+  if (samples.empty()) return summary;
+  std::sort(samples.begin(), samples.end());
+  // Of the nearest rank.
+  auto percentile = [&samples](double p) { return samples[std::max(0., std::ceil(p * samples.size()) - 1)]; };
+  summary.count = samples.size();
+  summary.mean = std::accumulate(samples.begin(), samples.end(), 0.) / samples.size();
+  summary.p50 = percentile(.5);
+  summary.p90 = percentile(.9);
+  summary.p99 = percentile(.99);
+  summary.max = samples.back();
+  return summary;
+}
+
+} /* namespace darknet_ros*/
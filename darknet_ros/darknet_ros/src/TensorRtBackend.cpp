@@ -0,0 +1,447 @@
+/*
+ * TensorRtBackend.cpp
+ *
+ *  The forward pass of the network by a TensorRT engine.
+ */
+
+#include "darknet_ros/TensorRtBackend.hpp"
+
+// c++
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+// ROS
+#include <ros/ros.h>
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+
+#include "NvInfer.h"
+#include "cuda_runtime.h"
+
+extern "C" {
+#include "activations.h"
+#include "blas.h"
+#include "cuda.h"
+#include "image.h"
+}
+
+using namespace nvinfer1;
+
+namespace darknet_ros {
+
+namespace {
+
+class Logger : public ILogger {
+ public:
+  void log(Severity severity, const char* msg) noexcept override {
+    if (severity <= Severity::kERROR) {
+      ROS_ERROR("[TensorRtBackend] %s", msg);
+    } else if (severity <= Severity::kWARNING) {
+      ROS_WARN("[TensorRtBackend] %s", msg);
+    }
+  }
+};
+
+Logger logger;
+
+template <typename T>
+void destroy(T*& object) {
+  if (object) object->destroy();
+  object = nullptr;
+}
+
+std::string fileKey(const std::string& path) {
+  struct stat status;
+  if (stat(path.c_str(), &status) != 0) return path;
+  std::ostringstream key;
+  key << path << " " << status.st_size << " " << status.st_mtime;
+  return key.str();
+}
+
+// Calibrates INT8 on the images of a directory, letterboxed as the camera
+// images, the scales cached next to the engine.
+class Calibrator : public IInt8EntropyCalibrator2 {
+ public:
+  Calibrator(network* net, const std::string& directory, const std::string& cacheFile)
+      : net_(net), cacheFile_(cacheFile), size_(net->w * net->h * net->c) {
+    std::vector<cv::String> files;
+    if (!directory.empty()) cv::glob(directory + "/*", files);
+    for (const cv::String& file : files) {
+      std::string extension = file.substr(file.find_last_of('.') + 1);
+      if (extension == "jpg" || extension == "jpeg" || extension == "png") images_.push_back(file);
+    }
+    check_error(cudaMalloc((void**)&input_, size_ * net->batch * sizeof(float)));
+  }
+
+  ~Calibrator() override { cudaFree(input_); }
+
+  int getBatchSize() const noexcept override { return 1; }
+
+  // The engine takes net->batch images at once.
+  bool getBatch(void* bindings[], const char* names[], int nbBindings) noexcept override {
+    if (next_ + net_->batch > images_.size()) return false;
+    for (int b = 0; b < net_->batch; ++b) {
+      image im = load_image_color(const_cast<char*>(images_[next_++].c_str()), 0, 0);
+      image sized = letterbox_image(im, net_->w, net_->h);
+      cudaMemcpy(input_ + b * size_, sized.data, size_ * sizeof(float), cudaMemcpyHostToDevice);
+      free_image(im);
+      free_image(sized);
+    }
+    bindings[0] = input_;
+    return true;
+  }
+
+  const void* readCalibrationCache(size_t& length) noexcept override {
+    std::ifstream file(cacheFile_, std::ios::binary);
+    cache_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    length = cache_.size();
+    return cache_.empty() ? nullptr : cache_.data();
+  }
+
+  void writeCalibrationCache(const void* cache, size_t length) noexcept override {
+    std::ofstream file(cacheFile_, std::ios::binary);
+    file.write(static_cast<const char*>(cache), length);
+  }
+
+  bool empty() const { return images_.empty(); }
+
+ private:
+  network* net_;
+  std::string cacheFile_;
+  int size_;
+  std::vector<std::string> images_;
+  size_t next_ = 0;
+  float* input_ = nullptr;
+  std::vector<char> cache_;
+};
+
+// Builds the engine network from the layers of darknet, the weights stored
+// until the engine is built.
+class NetworkBuilder {
+ public:
+  NetworkBuilder(network* net, INetworkDefinition* definition) : net_(net), definition_(definition) {}
+
+  void build() {
+    ITensor* input = definition_->addInput("data", DataType::kFLOAT, Dims4{net_->batch, net_->c, net_->h, net_->w});
+    std::vector<ITensor*> outputs(net_->n);
+    for (int i = 0; i < net_->n; ++i) {
+      const layer& l = net_->layers[i];
+      ITensor* in = i == 0 ? input : outputs[i - 1];
+      switch (l.type) {
+        case CONVOLUTIONAL:
+          outputs[i] = convolutional(l, in);
+          break;
+        case MAXPOOL: {
+          IPoolingLayer* pool = definition_->addPoolingNd(*in, PoolingType::kMAX, DimsHW{l.size, l.size});
+          pool->setStrideNd(DimsHW{l.stride, l.stride});
+          pool->setPrePadding(DimsHW{l.pad / 2, l.pad / 2});
+          pool->setPostPadding(DimsHW{l.pad - l.pad / 2, l.pad - l.pad / 2});
+          outputs[i] = pool->getOutput(0);
+          break;
+        }
+        case ROUTE: {
+          std::vector<ITensor*> routed;
+          for (int j = 0; j < l.n; ++j) routed.push_back(outputs[l.input_layers[j]]);
+          if (routed.size() == 1) {
+            outputs[i] = routed[0];
+          } else {
+            IConcatenationLayer* concat = definition_->addConcatenation(routed.data(), routed.size());
+            concat->setAxis(1);
+            outputs[i] = concat->getOutput(0);
+          }
+          break;
+        }
+        case UPSAMPLE: {
+          if (l.reverse || l.scale != 1) unsupported(i, "downsampling or scaled upsample");
+          IResizeLayer* resize = definition_->addResize(*in);
+          resize->setResizeMode(ResizeMode::kNEAREST);
+          const float scales[] = {1, 1, (float)l.stride, (float)l.stride};
+          resize->setScales(scales, 4);
+          outputs[i] = resize->getOutput(0);
+          break;
+        }
+        case SHORTCUT: {
+          if (l.w != l.out_w || l.h != l.out_h || l.c != l.out_c || l.alpha != 1 || l.beta != 1) {
+            unsupported(i, "shortcut of other dimensions or weighted");
+          }
+          IElementWiseLayer* sum = definition_->addElementWise(*in, *outputs[l.index], ElementWiseOperation::kSUM);
+          outputs[i] = activation(i, l.activation, sum->getOutput(0));
+          break;
+        }
+        case REGION:
+          if (l.softmax_tree) unsupported(i, "softmax tree");
+          // fall through
+        case YOLO:
+          in->setName(("output_" + std::to_string(i)).c_str());
+          definition_->markOutput(*in);
+          outputs[i] = in;
+          break;
+        default:
+          unsupported(i, get_layer_string(l.type));
+      }
+    }
+  }
+
+ private:
+  [[noreturn]] void unsupported(int i, const char* what) {
+    std::ostringstream message;
+    message << "layer " << i << " of the network (" << what << ") is not supported";
+    throw std::runtime_error(message.str());
+  }
+
+  ITensor* activation(int i, ACTIVATION type, ITensor* in) {
+    IActivationLayer* activation = nullptr;
+    switch (type) {
+      case LINEAR:
+        return in;
+      case LEAKY:
+        activation = definition_->addActivation(*in, ActivationType::kLEAKY_RELU);
+        activation->setAlpha(.1);
+        break;
+      case RELU:
+        activation = definition_->addActivation(*in, ActivationType::kRELU);
+        break;
+      case LOGISTIC:
+        activation = definition_->addActivation(*in, ActivationType::kSIGMOID);
+        break;
+      default:
+        unsupported(i, get_activation_string(type));
+    }
+    return activation->getOutput(0);
+  }
+
+  // The batch normalization folded into the weights and the biases, as
+  // normalize_cpu, scale_bias and add_bias.
+  ITensor* convolutional(const layer& l, ITensor* in) {
+    if (l.binary || l.xnor) unsupported(&l - net_->layers, "binary convolution");
+    std::vector<float>& weights = store(l.weights, l.nweights);
+    std::vector<float>& biases = store(l.biases, l.n);
+    if (l.batch_normalize) {
+      int size = l.nweights / l.n;
+      for (int f = 0; f < l.n; ++f) {
+        float scale = l.scales[f] / (std::sqrt(l.rolling_variance[f]) + .000001f);
+        for (int k = 0; k < size; ++k) weights[f * size + k] *= scale;
+        biases[f] -= l.rolling_mean[f] * scale;
+      }
+    }
+    IConvolutionLayer* conv = definition_->addConvolutionNd(*in, l.n, DimsHW{l.size, l.size},
+                                                            Weights{DataType::kFLOAT, weights.data(), (int64_t)weights.size()},
+                                                            Weights{DataType::kFLOAT, biases.data(), (int64_t)biases.size()});
+    conv->setStrideNd(DimsHW{l.stride, l.stride});
+    conv->setPaddingNd(DimsHW{l.pad, l.pad});
+    conv->setNbGroups(l.groups);
+    return activation(&l - net_->layers, l.activation, conv->getOutput(0));
+  }
+
+  std::vector<float>& store(const float* values, int n) {
+    weights_.emplace_back(values, values + n);
+    return weights_.back();
+  }
+
+  network* net_;
+  INetworkDefinition* definition_;
+  std::deque<std::vector<float> > weights_;
+};
+
+}  // namespace
+
+TensorRtBackend::TensorRtBackend(network* net, const TensorRtOptions& options) : net_(net), options_(options) {
+  if (options_.precision != "fp32" && options_.precision != "fp16" && options_.precision != "int8") {
+    throw std::runtime_error("unknown precision " + options_.precision);
+  }
+  std::string path = options_.engineFile;
+  if (path.empty()) {
+    path = options_.weightsFile + "." + options_.precision;
+    if (options_.dlaCore >= 0) path += ".dla" + std::to_string(options_.dlaCore);
+    path += ".engine";
+  }
+  if (loadEngine(path)) {
+    ROS_INFO("[TensorRtBackend] Engine loaded from %s.", path.c_str());
+  } else {
+    ROS_INFO("[TensorRtBackend] Building the %s engine, this takes a while.", options_.precision.c_str());
+    buildEngine(path);
+  }
+  createContext();
+}
+
+TensorRtBackend::~TensorRtBackend() {
+  destroy(context_);
+  destroy(engine_);
+  if (input_) cudaFree(input_);
+  for (Output& output : outputs_) cudaFree(output.data);
+}
+
+std::string TensorRtBackend::engineKey() const {
+  std::ostringstream key;
+  key << "darknet_ros TensorRT " << NV_TENSORRT_MAJOR << "." << NV_TENSORRT_MINOR << "." << NV_TENSORRT_PATCH << " "
+      << options_.precision << " dla " << options_.dlaCore << " " << net_->batch << "x" << net_->w << "x" << net_->h << "x"
+      << net_->c << " "
+      << fileKey(options_.configFile) << " " << fileKey(options_.weightsFile);
+  return key.str();
+}
+
+// The engine file is the key of the engine on a line, the serialized engine
+// after it.
+bool TensorRtBackend::loadEngine(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  std::string key;
+  if (!file || !std::getline(file, key)) return false;
+  if (key != engineKey()) {
+    ROS_INFO("[TensorRtBackend] Engine %s built for another network or options.", path.c_str());
+    return false;
+  }
+  std::vector<char> plan((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  IRuntime* runtime = createInferRuntime(logger);
+  if (options_.dlaCore >= 0) runtime->setDLACore(options_.dlaCore);
+#if NV_TENSORRT_MAJOR >= 8
+  engine_ = runtime->deserializeCudaEngine(plan.data(), plan.size());
+#else
+  engine_ = runtime->deserializeCudaEngine(plan.data(), plan.size(), nullptr);
+#endif
+  destroy(runtime);
+  return engine_ != nullptr;
+}
+
+void TensorRtBackend::buildEngine(const std::string& path) {
+  IBuilder* builder = createInferBuilder(logger);
+  INetworkDefinition* definition =
+      builder->createNetworkV2(1U << static_cast<uint32_t>(NetworkDefinitionCreationFlag::kEXPLICIT_BATCH));
+  IBuilderConfig* config = builder->createBuilderConfig();
+  std::unique_ptr<Calibrator> calibrator;
+  try {
+    NetworkBuilder networkBuilder(net_, definition);
+    networkBuilder.build();
+
+    config->setMaxWorkspaceSize((size_t)options_.workspaceSize << 20);
+    std::string precision = options_.precision;
+    if (precision == "int8" && !builder->platformHasFastInt8()) {
+      ROS_WARN("[TensorRtBackend] No fast INT8 on this platform, building in FP16.");
+      precision = "fp16";
+    }
+    if (precision == "int8") {
+      calibrator.reset(new Calibrator(net_, options_.calibrationImages, path + ".calibration"));
+      if (calibrator->empty() && !std::ifstream(path + ".calibration")) {
+        throw std::runtime_error("no images to calibrate INT8 in '" + options_.calibrationImages + "'");
+      }
+      config->setFlag(BuilderFlag::kINT8);
+      config->setInt8Calibrator(calibrator.get());
+    }
+    if (precision != "fp32" || options_.dlaCore >= 0) {
+      if (builder->platformHasFastFp16()) {
+        config->setFlag(BuilderFlag::kFP16);
+      } else if (precision == "fp16") {
+        ROS_WARN("[TensorRtBackend] No fast FP16 on this platform, building in FP32.");
+      }
+    }
+    if (options_.dlaCore >= 0) {
+      config->setDefaultDeviceType(DeviceType::kDLA);
+      config->setDLACore(options_.dlaCore);
+      config->setFlag(BuilderFlag::kGPU_FALLBACK);
+    }
+
+#if NV_TENSORRT_MAJOR >= 8
+    IHostMemory* plan = builder->buildSerializedNetwork(*definition, *config);
+    if (!plan) throw std::runtime_error("the engine could not be built");
+    IRuntime* runtime = createInferRuntime(logger);
+    if (options_.dlaCore >= 0) runtime->setDLACore(options_.dlaCore);
+    engine_ = runtime->deserializeCudaEngine(plan->data(), plan->size());
+    destroy(runtime);
+#else
+    engine_ = builder->buildEngineWithConfig(*definition, *config);
+    if (!engine_) throw std::runtime_error("the engine could not be built");
+    IHostMemory* plan = engine_->serialize();
+#endif
+
+    std::ofstream file(path, std::ios::binary);
+    file << engineKey() << "\n";
+    file.write(static_cast<const char*>(plan->data()), plan->size());
+    if (file) {
+      ROS_INFO("[TensorRtBackend] Engine saved to %s.", path.c_str());
+    } else {
+      ROS_WARN("[TensorRtBackend] Engine could not be saved to %s.", path.c_str());
+    }
+    destroy(plan);
+  } catch (...) {
+    destroy(config);
+    destroy(definition);
+    destroy(builder);
+    throw;
+  }
+  destroy(config);
+  destroy(definition);
+  destroy(builder);
+  if (!engine_) throw std::runtime_error("the engine could not be built");
+}
+
+void TensorRtBackend::createContext() {
+  context_ = engine_->createExecutionContext();
+  if (!context_) throw std::runtime_error("the execution context could not be created");
+  bindings_.assign(engine_->getNbBindings(), nullptr);
+  inputBinding_ = engine_->getBindingIndex("data");
+  for (int i = 0; i < net_->n; ++i) {
+    const layer& l = net_->layers[i];
+    if (l.type != YOLO && l.type != REGION) continue;
+    Output output = {i, engine_->getBindingIndex(("output_" + std::to_string(i)).c_str()), nullptr};
+    if (inputBinding_ < 0 || output.binding < 0) throw std::runtime_error("the engine does not match the network");
+    check_error(cudaMalloc((void**)&output.data, l.outputs * l.batch * sizeof(float)));
+    bindings_[output.binding] = output.data;
+    outputs_.push_back(output);
+  }
+}
+
+void TensorRtBackend::predict(float* input, float* inputGpu) {
+  cuda_set_device(net_->gpu_index);
+  if (!inputGpu) {
+    size_t size = (size_t)net_->w * net_->h * net_->c * net_->batch * sizeof(float);
+    if (!input_) check_error(cudaMalloc((void**)&input_, size));
+    check_error(cudaMemcpy(input_, input, size, cudaMemcpyHostToDevice));
+    inputGpu = input_;
+  }
+  bindings_[inputBinding_] = inputGpu;
+  if (!context_->executeV2(bindings_.data())) {
+    ROS_ERROR("[TensorRtBackend] Inference failed.");
+  }
+  for (const Output& output : outputs_) {
+    const layer& l = net_->layers[output.layer];
+    check_error(cudaMemcpy(l.output, output.data, l.outputs * l.batch * sizeof(float), cudaMemcpyDeviceToHost));
+    activateOutput(l);
+  }
+}
+
+// As forward_yolo_layer and forward_region_layer on the CPU, the softmax of
+// the classes in place.
+void TensorRtBackend::activateOutput(const layer& l) const {
+  int plane = l.w * l.h;
+  if (l.type == YOLO) {
+    for (int b = 0; b < l.batch; ++b) {
+      for (int n = 0; n < l.n; ++n) {
+        float* entries = l.output + b * l.outputs + n * plane * (4 + l.classes + 1);
+        activate_array(entries, 2 * plane, LOGISTIC);
+        activate_array(entries + 4 * plane, (1 + l.classes) * plane, LOGISTIC);
+      }
+    }
+    return;
+  }
+  for (int b = 0; b < l.batch; ++b) {
+    for (int n = 0; n < l.n; ++n) {
+      float* entries = l.output + b * l.outputs + n * plane * (l.coords + l.classes + 1);
+      activate_array(entries, 2 * plane, LOGISTIC);
+      if (!l.background) activate_array(entries + l.coords * plane, plane, LOGISTIC);
+      if (!l.softmax) activate_array(entries + (l.coords + 1) * plane, l.classes * plane, LOGISTIC);
+    }
+  }
+  if (l.softmax) {
+    int index = (l.coords + !l.background) * plane;
+    softmax_cpu(l.output + index, l.classes + l.background, l.batch * l.n, l.inputs / l.n, plane, 1, plane, 1, l.output + index);
+  }
+}
+
+} /* namespace darknet_ros*/
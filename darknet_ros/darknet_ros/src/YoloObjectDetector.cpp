@@ -12,6 +12,14 @@
 // Check for xServer
 #include <X11/Xlib.h>
 
+// Latency of the frames
+#include <perception_trace/trace.h>
+
+// Priority of the rendering thread
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #ifdef DARKNET_FILE_PATH
 std::string darknetFilePath_ = DARKNET_FILE_PATH;
 #else
@@ -20,13 +28,29 @@ std::string darknetFilePath_ = DARKNET_FILE_PATH;
 
 namespace darknet_ros {
 
+namespace {
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+#ifdef GPU
+// After every layer of a forward pass if the GPU is shared: the layer done, the GPU handed over to the lidar clustering
+// waiting for it, so that it never waits for more than one layer.
+void yieldGpu(void* client) {
+  if (!gpu_arbiter::arbitrated()) return;
+  check_error(cudaStreamSynchronize(cudaStreamPerThread));
+  gpu_arbiter::checkpoint(static_cast<gpu_arbiter::Client*>(client));
+}
+#endif
+}  // namespace
+
 char* cfg;
 char* weights;
 char* data;
 char** detectionNames;
 
 YoloObjectDetector::YoloObjectDetector(ros::NodeHandle nh)
-    : nodeHandle_(nh), imageTransport_(nodeHandle_), numClasses_(0), classLabels_(0), rosBoxes_(0), rosBoxCounter_(0) {
+    : nodeHandle_(nh), imageTransport_(nodeHandle_), numClasses_(0), classLabels_(0), rosBoxes_(0) {
   ROS_INFO("[YoloObjectDetector] Node started.");
 
   // Read parameters from config file.
@@ -42,7 +66,22 @@ YoloObjectDetector::~YoloObjectDetector() {
     boost::unique_lock<boost::shared_mutex> lockNodeStatus(mutexNodeStatus_);
     isNodeRunning_ = false;
   }
+  stopPipeline();
   yoloThread_.join();
+  resolutionBackends_.clear();
+  for (network* net : resolutionNets_) {
+    if (net != net_) free_resized_network(net);
+  }
+#ifdef GPU
+  if (gpuDecode_) freeYoloDecoderGpu(decoderGpu_);
+  if (gpuPreprocessing_ && buffLetterGpu_[0]) {
+    for (int i = 0; i < 3; ++i) {
+      check_error(cudaEventDestroy(buffLetterReady_[i]));
+      cuda_free(buffLetterGpu_[i]);
+    }
+    freeBgr8BufferGpu(pixelsGpu_);
+  }
+#endif
 }
 
 bool YoloObjectDetector::readParameters() {
@@ -50,6 +89,42 @@ bool YoloObjectDetector::readParameters() {
   nodeHandle_.param("image_view/enable_opencv", viewImage_, true);
   nodeHandle_.param("image_view/wait_key_delay", waitKeyDelay_, 3);
   nodeHandle_.param("image_view/enable_console_output", enableConsoleOutput_, false);
+  nodeHandle_.param("detection/max_rate", maxRate_, 0.0);
+  nodeHandle_.param("detection/degraded_max_rate", degradedMaxRate_, 5.0);
+  nodeHandle_.param("detection/gpu_preprocessing", gpuPreprocessing_, true);
+#ifndef GPU
+  gpuPreprocessing_ = false;
+#endif
+  nodeHandle_.param("detection/batch_window", batchWindow_, 0.02);
+  nodeHandle_.param("detection/gpu_decode", gpuDecode_, true);
+#ifndef GPU
+  gpuDecode_ = false;
+#endif
+  nodeHandle_.param("detection/mapped_outputs", mappedOutputs_, true);
+
+  std::string averaging;
+  nodeHandle_.param("detection/averaging", averaging, std::string("running"));
+  if (averaging == "window") {
+    averaging_ = Averaging::Window;
+  } else if (averaging == "gpu") {
+    averaging_ = Averaging::Gpu;
+  } else {
+    if (averaging != "running") ROS_ERROR("[YoloObjectDetector] Unknown averaging %s, averaging running.", averaging.c_str());
+    averaging_ = Averaging::Running;
+  }
+
+  // One camera, or a batch of them.
+  std::vector<std::string> cameraTopics;
+  nodeHandle_.param("subscribers/camera_reading/topics", cameraTopics, std::vector<std::string>(0));
+  streams_ = std::vector<CameraStream>(std::max<size_t>(cameraTopics.size(), 1));
+
+  attention_.reset(new AttentionRegions(nodeHandle_));
+  if (!attention_->enabled()) {
+    attention_.reset();
+  } else if (streams_.size() > 1) {
+    ROS_ERROR("[YoloObjectDetector] Attention regions are of a single camera, detecting the whole frames.");
+    attention_.reset();
+  }
 
   // Check if Xserver is running on Linux.
   if (XOpenDisplay(NULL)) {
@@ -63,8 +138,19 @@ bool YoloObjectDetector::readParameters() {
   // Set vector sizes.
   nodeHandle_.param("yolo_model/detection_classes/names", classLabels_, std::vector<std::string>(0));
   numClasses_ = classLabels_.size();
-  rosBoxes_ = std::vector<std::vector<RosBox_> >(numClasses_);
-  rosBoxCounter_ = std::vector<int>(numClasses_);
+
+  // Classes detected, by name.
+  std::vector<std::string> whitelist;
+  nodeHandle_.param("detection/class_whitelist", whitelist, std::vector<std::string>(0));
+  for (const std::string& name : whitelist) {
+    auto label = std::find(classLabels_.begin(), classLabels_.end(), name);
+    if (label == classLabels_.end()) {
+      ROS_ERROR("[YoloObjectDetector] Unknown class %s in the whitelist.", name.c_str());
+    } else {
+      classWhitelist_.push_back(label - classLabels_.begin());
+    }
+  }
+  if (!whitelist.empty() && classWhitelist_.empty()) ROS_ERROR("[YoloObjectDetector] No known class in the whitelist, detecting all.");
 
   return true;
 }
@@ -83,6 +169,10 @@ void YoloObjectDetector::init() {
   float thresh;
   nodeHandle_.param("yolo_model/threshold/value", thresh, (float)0.3);
 
+  // Frames the outputs of the network are averaged over.
+  int averageFrames;
+  nodeHandle_.param("detection/average_frames", averageFrames, 1);
+
   // Path to weights file.
   nodeHandle_.param("yolo_model/weight_file/name", weightsModel, std::string("yolov2-tiny.weights"));
   nodeHandle_.param("weights_path", weightsPath, std::string("/default"));
@@ -111,7 +201,7 @@ void YoloObjectDetector::init() {
   }
 
   // Load network.
-  setupNetwork(cfg, weights, data, thresh, detectionNames, numClasses_, 0, 0, 1, 0.5, 0, 0, 0, 0);
+  setupNetwork(cfg, weights, data, thresh, detectionNames, numClasses_, 0, 0, std::max(averageFrames, 1), 0.5, 0, 0, 0, 0);
   yoloThread_ = std::thread(&YoloObjectDetector::yolo, this);
 
   // Initialize publisher and subscriber.
@@ -128,6 +218,9 @@ void YoloObjectDetector::init() {
   bool detectionImageLatch;
 
   nodeHandle_.param("subscribers/camera_reading/topic", cameraTopicName, std::string("/camera/image_raw"));
+  std::vector<std::string> cameraTopics;
+  nodeHandle_.param("subscribers/camera_reading/topics", cameraTopics, std::vector<std::string>(0));
+  if (cameraTopics.empty()) cameraTopics.push_back(cameraTopicName);
   nodeHandle_.param("subscribers/camera_reading/queue_size", cameraQueueSize, 1);
   nodeHandle_.param("publishers/object_detector/topic", objectDetectorTopicName, std::string("found_object"));
   nodeHandle_.param("publishers/object_detector/queue_size", objectDetectorQueueSize, 1);
@@ -139,13 +232,27 @@ void YoloObjectDetector::init() {
   nodeHandle_.param("publishers/detection_image/queue_size", detectionImageQueueSize, 1);
   nodeHandle_.param("publishers/detection_image/latch", detectionImageLatch, true);
 
-  imageSubscriber_ = imageTransport_.subscribe(cameraTopicName, cameraQueueSize, &YoloObjectDetector::cameraCallback, this);
-  objectPublisher_ =
-      nodeHandle_.advertise<darknet_ros_msgs::ObjectCount>(objectDetectorTopicName, objectDetectorQueueSize, objectDetectorLatch);
-  boundingBoxesPublisher_ =
-      nodeHandle_.advertise<darknet_ros_msgs::BoundingBoxes>(boundingBoxesTopicName, boundingBoxesQueueSize, boundingBoxesLatch);
-  detectionImagePublisher_ =
-      nodeHandle_.advertise<sensor_msgs::Image>(detectionImageTopicName, detectionImageQueueSize, detectionImageLatch);
+  // The detections of the cameras on topics of their own, under those of
+  // the single camera, if several.
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    CameraStream& stream = streams_[i];
+    std::string suffix = streams_.size() > 1 ? "/camera" + std::to_string(i) : "";
+    stream.subscriber = imageTransport_.subscribe(cameraTopics[i], cameraQueueSize,
+                                                  boost::bind(&YoloObjectDetector::cameraCallback, this, _1, (int)i));
+    stream.objectPublisher = nodeHandle_.advertise<darknet_ros_msgs::ObjectCount>(objectDetectorTopicName + suffix,
+                                                                                  objectDetectorQueueSize, objectDetectorLatch);
+    stream.boundingBoxesPublisher = nodeHandle_.advertise<darknet_ros_msgs::BoundingBoxes>(
+        boundingBoxesTopicName + suffix, boundingBoxesQueueSize, boundingBoxesLatch);
+    stream.detectionImagePublisher =
+        nodeHandle_.advertise<sensor_msgs::Image>(detectionImageTopicName + suffix, detectionImageQueueSize, detectionImageLatch);
+  }
+
+  // The degradation level of the perception stack, the first step of which
+  // lowers the detection rate.
+  std::string degradationTopicName;
+  nodeHandle_.param("subscribers/degradation/topic", degradationTopicName, std::string("/perception/degradation_level"));
+  if (!degradationTopicName.empty())
+    degradationSubscriber_ = nodeHandle_.subscribe(degradationTopicName, 1, &YoloObjectDetector::degradationCallback, this);
 
   // Action servers.
   std::string checkForObjectsActionName;
@@ -154,16 +261,50 @@ void YoloObjectDetector::init() {
   checkForObjectsActionServer_->registerGoalCallback(boost::bind(&YoloObjectDetector::checkForObjectsActionGoalCB, this));
   checkForObjectsActionServer_->registerPreemptCallback(boost::bind(&YoloObjectDetector::checkForObjectsActionPreemptCB, this));
   checkForObjectsActionServer_->start();
+
+  // Diagnostics.
+  double diagnosticsPeriod;
+  nodeHandle_.param("diagnostics/period", diagnosticsPeriod, 1.0);
+  diagnostics_.setHardwareID("darknet_ros");
+  diagnostics_.add("yolo_frames", this, &YoloObjectDetector::frameStatus);
+  diagnostics_.add("yolo_latency", this, &YoloObjectDetector::latencyStatus);
+#ifdef GPU
+  diagnostics_.add("yolo_gpu", this, &YoloObjectDetector::gpuStatus);
+#endif
+  diagnostics_.add("yolo_threads", this, &YoloObjectDetector::threadStatus);
+  diagnosticsTimer_ = nodeHandle_.createTimer(ros::Duration(diagnosticsPeriod),
+                                              [this](const ros::TimerEvent&) { diagnostics_.update(); });
 }
 
-void YoloObjectDetector::cameraCallback(const sensor_msgs::ImageConstPtr& msg) {
+void YoloObjectDetector::degradationCallback(const std_msgs::UInt8::ConstPtr& msg) {
+  bool degraded = msg->data >= 1;
+  if (degradationLevel_.exchange(msg->data) != msg->data && resolutions_ && msg->data >= 2)
+    ROS_INFO("[YoloObjectDetector] Degradation level %d, input sizes %d smaller.", msg->data, msg->data - 1);
+  if (degraded_.exchange(degraded) != degraded)
+    ROS_INFO("[YoloObjectDetector] Degradation level %d, detections %s.", msg->data, degraded ? "rate limited" : "at full rate");
+}
+
+void YoloObjectDetector::cameraCallback(const sensor_msgs::ImageConstPtr& msg, int stream) {
   ROS_DEBUG("[YoloObjectDetector] USB image received.");
+  receivedFrames_++;
+  CameraStream& camera = streams_[stream];
+
+  // The same frame received again, e.g. republished, is not detected again.
+  {
+    boost::shared_lock<boost::shared_mutex> lockImageCallback(mutexImageCallback_);
+    if (camera.image && !msg->header.stamp.isZero() && msg->header.stamp == camera.image->header.stamp) {
+      duplicateFrames_++;
+      return;
+    }
+  }
 
-  cv_bridge::CvImagePtr cam_image;
+  // Shared with the message if of an encoding the network takes, else converted:
+  // the fetch stage reads the pixels in place, never copied before.
+  cv_bridge::CvImageConstPtr cam_image;
 
   try {
     if (msg->encoding == "mono8" || msg->encoding == "bgr8" || msg->encoding == "rgb8") {
-      cam_image = cv_bridge::toCvCopy(msg, msg->encoding);
+      cam_image = cv_bridge::toCvShare(msg);
     } else if ( msg->encoding == "bgra8") {
       cam_image = cv_bridge::toCvCopy(msg, "bgr8");
     } else if ( msg->encoding == "rgba8") {
@@ -181,16 +322,16 @@ void YoloObjectDetector::cameraCallback(const sensor_msgs::ImageConstPtr& msg) {
 
   if (cam_image) {
     {
+      // The last image swapped out, released once unlocked.
       boost::unique_lock<boost::shared_mutex> lockImageCallback(mutexImageCallback_);
-      imageHeader_ = msg->header;
-      camImageCopy_ = cam_image->image.clone();
+      camera.image.swap(cam_image);
+      camera.seq++;
     }
+    newImageCondition_.notify_one();
     {
       boost::unique_lock<boost::shared_mutex> lockImageStatus(mutexImageStatus_);
       imageStatus_ = true;
     }
-    frameWidth_ = cam_image->image.size().width;
-    frameHeight_ = cam_image->image.size().height;
   }
   return;
 }
@@ -199,9 +340,9 @@ void YoloObjectDetector::checkForObjectsActionGoalCB() {
   ROS_DEBUG("[YoloObjectDetector] Start check for objects action.");
 
   boost::shared_ptr<const darknet_ros_msgs::CheckForObjectsGoal> imageActionPtr = checkForObjectsActionServer_->acceptNewGoal();
-  sensor_msgs::Image imageAction = imageActionPtr->image;
+  const sensor_msgs::Image& imageAction = imageActionPtr->image;
 
-  cv_bridge::CvImagePtr cam_image;
+  cv_bridge::CvImageConstPtr cam_image;
 
   try {
     cam_image = cv_bridge::toCvCopy(imageAction, sensor_msgs::image_encodings::BGR8);
@@ -212,9 +353,12 @@ void YoloObjectDetector::checkForObjectsActionGoalCB() {
 
   if (cam_image) {
     {
+      // The last image swapped out, released once unlocked.
       boost::unique_lock<boost::shared_mutex> lockImageCallback(mutexImageCallback_);
-      camImageCopy_ = cam_image->image.clone();
+      streams_[0].image.swap(cam_image);
+      streams_[0].seq++;
     }
+    newImageCondition_.notify_one();
     {
       boost::unique_lock<boost::shared_mutex> lockImageCallback(mutexActionStatus_);
       actionId_ = imageActionPtr->id;
@@ -223,8 +367,6 @@ void YoloObjectDetector::checkForObjectsActionGoalCB() {
       boost::unique_lock<boost::shared_mutex> lockImageStatus(mutexImageStatus_);
       imageStatus_ = true;
     }
-    frameWidth_ = cam_image->image.size().width;
-    frameHeight_ = cam_image->image.size().height;
   }
   return;
 }
@@ -238,18 +380,71 @@ bool YoloObjectDetector::isCheckingForObjects() const {
   return (ros::ok() && checkForObjectsActionServer_->isActive() && !checkForObjectsActionServer_->isPreemptRequested());
 }
 
-bool YoloObjectDetector::publishDetectionImage(const cv::Mat& detectionImage) {
-  if (detectionImagePublisher_.getNumSubscribers() < 1) return false;
+bool YoloObjectDetector::publishDetectionImage(const cv::Mat& detectionImage, ros::Publisher& publisher) {
+  if (publisher.getNumSubscribers() < 1 || detectionImage.empty()) return false;
   cv_bridge::CvImage cvImage;
   cvImage.header.stamp = ros::Time::now();
   cvImage.header.frame_id = "detection_image";
   cvImage.encoding = sensor_msgs::image_encodings::BGR8;
   cvImage.image = detectionImage;
-  detectionImagePublisher_.publish(*cvImage.toImageMsg());
+  publisher.publish(*cvImage.toImageMsg());
   ROS_DEBUG("Detection image has been published.");
   return true;
 }
 
+void YoloObjectDetector::frameStatus(diagnostic_updater::DiagnosticStatusWrapper& stat) {
+  stat.summaryf(diagnostic_msgs::DiagnosticStatus::OK, "%lu frames detected", (unsigned long)detectedFrames_.load());
+  stat.add("Frames received", receivedFrames_.load());
+  stat.add("Frames detected", detectedFrames_.load());
+  stat.add("Frames skipped", skippedFrames_.load());
+  stat.add("Frames duplicated", duplicateFrames_.load());
+  stat.add("Frames detected over the attention regions", attentionFrames_.load());
+  stat.add("Max rate (Hz)", maxRate_);
+  stat.add("Degraded", degraded_.load() ? "true" : "false");
+  stat.add("Input size", inputSize_.load());
+  stat.add("Cameras", streams_.size());
+}
+
+void YoloObjectDetector::latencyStatus(diagnostic_updater::DiagnosticStatusWrapper& stat) {
+  double period = secondsSince(lastLatencyReport_);
+  lastLatencyReport_ = std::chrono::steady_clock::now();
+  const std::pair<const char*, LatencyStats*> stages[] = {{"Camera to fetch", &fetchLatency_}, {"Preprocess", &preprocessLatency_},
+                                                          {"Forward", &forwardLatency_},       {"Decode and NMS", &decodeLatency_},
+                                                          {"Publish", &publishLatency_},       {"Camera to boxes", &ageLatency_}};
+  LatencySummary age;
+  for (const auto& stage : stages) {
+    LatencySummary summary = stage.second->take();
+    if (stage.second == &ageLatency_) age = summary;
+    std::string name = stage.first;
+    stat.add(name + " p50 (ms)", summary.p50);
+    stat.add(name + " p90 (ms)", summary.p90);
+    stat.add(name + " p99 (ms)", summary.p99);
+    stat.add(name + " max (ms)", summary.max);
+  }
+  stat.add("Boxes published per second", period > 0 ? age.count / period : 0.);
+  stat.summaryf(diagnostic_msgs::DiagnosticStatus::OK, "%.1f ms from the camera to the boxes (p50)", age.p50);
+}
+
+void YoloObjectDetector::gpuStatus(diagnostic_updater::DiagnosticStatusWrapper& stat) {
+  if (!gpuClient_) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Not on the GPU");
+    return;
+  }
+  gpu_arbiter::Stats stats = gpu_arbiter::stats(gpuClient_);
+  stat.summary(diagnostic_msgs::DiagnosticStatus::OK, gpu_arbiter::arbitrated() ? "GPU handed over to the lidar clustering after every layer"
+                                                                                 : "GPU not shared in this process");
+  stat.add("Slots", stats.window_grants);
+  stat.add("Slots handed over", stats.preemptions);
+  stat.add("Wait for the GPU mean (ms)", stats.wait_mean);
+  stat.add("Wait for the GPU max (ms)", stats.wait_max);
+  stat.add("GPU held mean (ms)", stats.hold_mean);
+  stat.add("GPU held max (ms)", stats.hold_max);
+}
+
+void YoloObjectDetector::threadStatus(diagnostic_updater::DiagnosticStatusWrapper& stat) {
+  thread_config::diagnostics(stat, nodeHandle_.getNamespace());
+}
+
 // double YoloObjectDetector::getWallTime()
 // {
 //   struct timeval time;
@@ -265,7 +460,7 @@ int YoloObjectDetector::sizeNetwork(network* net) {
   for (i = 0; i < net->n; ++i) {
     layer l = net->layers[i];
     if (l.type == YOLO || l.type == REGION || l.type == DETECTION) {
-      count += l.outputs;
+      count += l.outputs * l.batch;
     }
   }
   return count;
@@ -277,54 +472,266 @@ void YoloObjectDetector::rememberNetwork(network* net) {
   for (i = 0; i < net->n; ++i) {
     layer l = net->layers[i];
     if (l.type == YOLO || l.type == REGION || l.type == DETECTION) {
-      memcpy(predictions_[demoIndex_] + count, net->layers[i].output, sizeof(float) * l.outputs);
-      count += l.outputs;
+      memcpy(predictions_[demoIndex_] + count, net->layers[i].output, sizeof(float) * l.outputs * l.batch);
+      count += l.outputs * l.batch;
     }
   }
 }
 
-detection* YoloObjectDetector::avgPredictions(network* net, int* nboxes) {
+void YoloObjectDetector::avgPredictions(network* net) {
   int i, j;
   int count = 0;
   fill_cpu(demoTotal_, 0, avg_, 1);
   for (j = 0; j < demoFrame_; ++j) {
     axpy_cpu(demoTotal_, 1. / demoFrame_, predictions_[j], 1, avg_, 1);
   }
+  // Decoded from avg_, the slot of the frame kept.
+  if (mappedWindow_) {
+    point_network_outputs(net, avg_, nullptr);
+    return;
+  }
   for (i = 0; i < net->n; ++i) {
     layer l = net->layers[i];
     if (l.type == YOLO || l.type == REGION || l.type == DETECTION) {
-      memcpy(l.output, avg_ + count, sizeof(float) * l.outputs);
-      count += l.outputs;
+      memcpy(l.output, avg_ + count, sizeof(float) * l.outputs * l.batch);
+      count += l.outputs * l.batch;
     }
   }
-  detection* dets = get_network_boxes(net, buff_[0].w, buff_[0].h, demoThresh_, demoHier_, 0, 1, nboxes);
-  return dets;
 }
 
-void* YoloObjectDetector::detectInThread() {
+void YoloObjectDetector::runningAvgPredictions(network* net) {
+  float scale = 1. / demoFrame_;
+  int count = 0;
+  for (int i = 0; i < net->n; ++i) {
+    layer l = net->layers[i];
+    if (l.type == YOLO || l.type == REGION || l.type == DETECTION) {
+      int n = l.outputs * l.batch;
+      float* oldest = predictions_[demoIndex_] + count;
+      float* sum = sum_ + count;
+      for (int k = 0; k < n; ++k) {
+        sum[k] += l.output[k] - oldest[k];
+        oldest[k] = l.output[k];
+        l.output[k] = sum[k] * scale;
+      }
+      count += n;
+    }
+  }
+  if (++summedFrames_ % sumPeriod_ == 0) {
+    fill_cpu(demoTotal_, 0, sum_, 1);
+    for (int j = 0; j < demoFrame_; ++j) {
+      axpy_cpu(demoTotal_, 1, predictions_[j], 1, sum_, 1);
+    }
+  }
+}
+
+#ifdef GPU
+void YoloObjectDetector::gpuAvgPredictions(network* net) {
+  float scale = 1. / demoFrame_;
+  int count = 0;
+  for (int i = 0; i < net->n; ++i) {
+    layer l = net->layers[i];
+    if (l.type == YOLO || l.type == REGION) {
+      int n = l.outputs * l.batch;
+      float* oldest = predictionsGpu_[demoIndex_] + count;
+      float* sum = sumGpu_ + count;
+      axpy_gpu(n, -1, oldest, 1, sum, 1);
+      axpy_gpu(n, 1, l.output_gpu, 1, sum, 1);
+      copy_gpu(n, l.output_gpu, 1, oldest, 1);
+      copy_gpu(n, sum, 1, l.output_gpu, 1);
+      scal_gpu(n, scale, l.output_gpu, 1);
+      if (!gpuDecode_ && !net->mapped) cuda_pull_array_async(l.output_gpu, l.output, n);
+      count += n;
+    }
+  }
+  if (++summedFrames_ % sumPeriod_ == 0) {
+    fill_gpu(demoTotal_, 0, sumGpu_, 1);
+    for (int j = 0; j < demoFrame_; ++j) {
+      axpy_gpu(demoTotal_, 1, predictionsGpu_[j], 1, sumGpu_, 1);
+    }
+  }
+  if (!gpuDecode_) check_error(cudaStreamSynchronize(cudaStreamPerThread));
+}
+#endif
+
+// get_network_boxes decodes the first image of the batch, and takes a batch
+// of two for an image and its flip: the outputs of a camera are passed as
+// those of a copy of the layers of a batch of one.
+detection* YoloObjectDetector::streamBoxes(network* net, int stream, const image& im, int* nboxes) {
+  std::vector<layer> layers(net->layers, net->layers + net->n);
+  for (layer& l : layers) {
+    if (l.type == YOLO || l.type == REGION || l.type == DETECTION) {
+      l.output += stream * l.outputs;
+      l.batch = 1;
+    }
+  }
+  network view = *net;
+  view.layers = layers.data();
+  return get_network_boxes(&view, im.w, im.h, demoThresh_, demoHier_, 0, 1, nboxes);
+}
+
+int YoloObjectDetector::whitelistBoxes(detection* dets, int nboxes) {
+  int kept = 0;
+  std::vector<float> probs(classWhitelist_.size());
+  for (int i = 0; i < nboxes; ++i) {
+    bool listed = false;
+    for (size_t k = 0; k < classWhitelist_.size(); ++k) {
+      probs[k] = dets[i].prob[classWhitelist_[k]];
+      if (probs[k] > 0) listed = true;
+    }
+    if (!listed) continue;
+    std::fill(dets[i].prob, dets[i].prob + dets[i].classes, 0.f);
+    for (size_t k = 0; k < classWhitelist_.size(); ++k) {
+      dets[i].prob[classWhitelist_[k]] = probs[k];
+    }
+    std::swap(dets[i], dets[kept++]);
+  }
+  return kept;
+}
+
+void YoloObjectDetector::detectRegions(int buffer, float nms) {
+  RosBox_* roiBoxes = roiBoxes_[buffer][0];
+  StreamDetections& detections = buffDets_[buffer][0];
+  free_detections(detections.dets, detections.total);
+  detections = StreamDetections();
+  roiBoxes[0].num = 0;
+  const std::vector<AttentionTile>& tiles = buffTiles_[buffer];
+  if (!tiles.empty()) {
+    int size = attention_->inputSize();
+    auto start = std::chrono::steady_clock::now();
+    {
+      gpu_arbiter::Slot slot(gpuClient_);
+      attentionBackend_->predict(attentionInput_[buffer].data, nullptr);
+    }
+    forwardLatency_.add(secondsSince(start));
+    start = std::chrono::steady_clock::now();
+    int nboxes = 0;
+    detection* dets = get_network_boxes(attentionNet_, size, size, demoThresh_, demoHier_, 0, 1, &nboxes);
+    detections.dets = dets;
+    detections.total = nboxes;
+    nboxes = AttentionRegions::untile(dets, nboxes, tiles, size, size, buff_[buffer][0].w, buff_[buffer][0].h);
+    if (!classWhitelist_.empty()) nboxes = whitelistBoxes(dets, nboxes);
+    if (nms > 0) do_nms_obj(dets, nboxes, attentionNet_->layers[attentionNet_->n - 1].classes, nms);
+    extractBoxes(dets, nboxes, roiBoxes);
+    detections.nboxes = nboxes;
+    decodeLatency_.add(secondsSince(start));
+  }
+  attentionFrames_++;
+  detectedFrames_++;
+}
+
+void* YoloObjectDetector::detectInThread(int buffer) {
   running_ = 1;
   float nms = .4;
 
-  layer l = net_->layers[net_->n - 1];
-  float* X = buffLetter_[(buffIndex_ + 2) % 3].data;
-  float* prediction = network_predict(net_, X);
-
-  rememberNetwork(net_);
-  detection* dets = 0;
-  int nboxes = 0;
-  dets = avgPredictions(net_, &nboxes);
+  // The attention regions detected alone, the outputs of the whole frames
+  // averaged with those of the whole frames only.
+  if (buffAttention_[buffer]) {
+    detectRegions(buffer, nms);
+    running_ = 0;
+    return 0;
+  }
 
-  if (nms > 0) do_nms_obj(dets, nboxes, l.classes, nms);
+  // The outputs of the other input sizes, of other shapes, neither averaged nor decoded on the GPU.
+  network* net = bufferNetwork(buffer);
+  Averaging averaging = net == net_ ? averaging_ : Averaging::None;
+  bool gpuDecode = gpuDecode_ && net == net_;
+  inputSize_ = net->w;
+  layer l = net->layers[net->n - 1];
+  float* X = buffLetter_[buffer].data;
+  float* inputGpu = nullptr;
+  auto start = std::chrono::steady_clock::now();
+#ifdef GPU
+  // The input uploaded and letterboxed on the stream of the fetch stage.
+  if (gpuPreprocessing_) {
+    inputGpu = buffLetterGpu_[buffer];
+    check_error(cudaEventSynchronize(buffLetterReady_[buffer]));
+  }
+  // The outputs written by the network in the slot of the frame.
+  if (averaging == Averaging::Window && mappedWindow_) {
+    point_network_outputs(net_, predictions_[demoIndex_], predictionsGpu_[demoIndex_]);
+  }
+#endif
+  {
+    gpu_arbiter::Slot slot(gpuClient_);
+    bufferBackend(buffer)->predict(X, inputGpu);
+
+    switch (averaging) {
+      case Averaging::None:
+        break;
+      case Averaging::Window:
+        if (!mappedWindow_) rememberNetwork(net_);
+        avgPredictions(net_);
+        break;
+      case Averaging::Running:
+        runningAvgPredictions(net_);
+        break;
+      case Averaging::Gpu:
+#ifdef GPU
+        gpuAvgPredictions(net_);
+#endif
+        break;
+    }
+  }
+  forwardLatency_.add(secondsSince(start));
+  start = std::chrono::steady_clock::now();
+
+#ifdef GPU
+  // The boxes of the whole batch decoded at once, only those kept copied back.
+  if (gpuDecode) {
+    std::vector<int> widths(streams_.size()), heights(streams_.size());
+    for (size_t stream = 0; stream < streams_.size(); ++stream) {
+      widths[stream] = buff_[buffer][stream].w;
+      heights[stream] = buff_[buffer][stream].h;
+    }
+    decodeYoloGpu(decoderGpu_, net_, widths.data(), heights.data(), demoThresh_, nms);
+    for (size_t stream = 0; stream < streams_.size(); ++stream) {
+      if (decoderGpu_.hostCandidateCounts[stream] > decoderGpu_.maxCandidates) {
+        ROS_WARN_THROTTLE(1.0, "[YoloObjectDetector] %d boxes above the threshold, only the first %d decoded.",
+                          decoderGpu_.hostCandidateCounts[stream], decoderGpu_.maxCandidates);
+      }
+    }
+  }
+#endif
 
-  if (enableConsoleOutput_) {
-    printf("\033[2J");
-    printf("\033[1;1H");
-    printf("\nFPS:%.1f\n", fps_);
-    printf("Objects:\n\n");
+  for (size_t stream = 0; stream < streams_.size(); ++stream) {
+    RosBox_* roiBoxes = roiBoxes_[buffer][stream];
+    StreamDetections& detections = buffDets_[buffer][stream];
+    free_detections(detections.dets, detections.total);
+    detections = StreamDetections();
+    if (!buffActive_[buffer][stream]) {
+      roiBoxes[0].num = 0;
+      continue;
+    }
+    image display = buff_[buffer][stream];
+    int nboxes = 0;
+    detection* dets;
+#ifdef GPU
+    if (gpuDecode) {
+      dets = yoloDetectionsGpu(decoderGpu_, stream, &nboxes);
+    } else
+#endif
+    {
+      dets = streamBoxes(net, stream, display, &nboxes);
+    }
+    int total = nboxes;
+    if (!gpuDecode) {
+      if (!classWhitelist_.empty()) nboxes = whitelistBoxes(dets, nboxes);
+      if (nms > 0) do_nms_obj(dets, nboxes, l.classes, nms);
+    }
+    extractBoxes(dets, nboxes, roiBoxes);
+    detections.dets = dets;
+    detections.nboxes = nboxes;
+    detections.total = total;
+    detectedFrames_++;
   }
-  image display = buff_[(buffIndex_ + 2) % 3];
-  draw_detections(display, dets, nboxes, demoThresh_, demoNames_, demoAlphabet_, demoClasses_);
+  decodeLatency_.add(secondsSince(start));
 
+  if (averaging != Averaging::None) demoIndex_ = (demoIndex_ + 1) % demoFrame_;
+  running_ = 0;
+  return 0;
+}
+
+void YoloObjectDetector::extractBoxes(detection* dets, int nboxes, RosBox_* roiBoxes) {
   // extract the bounding boxes and send them to ROS
   int i, j;
   int count = 0;
@@ -340,7 +747,9 @@ void* YoloObjectDetector::detectInThread() {
     if (ymax > 1) ymax = 1;
 
     // iterate through possible boxes and collect the bounding boxes
-    for (j = 0; j < demoClasses_; ++j) {
+    int classes = classWhitelist_.empty() ? demoClasses_ : classWhitelist_.size();
+    for (int k = 0; k < classes; ++k) {
+      j = classWhitelist_.empty() ? k : classWhitelist_[k];
       if (dets[i].prob[j]) {
         float x_center = (xmin + xmax) / 2;
         float y_center = (ymin + ymax) / 2;
@@ -350,12 +759,12 @@ void* YoloObjectDetector::detectInThread() {
         // define bounding box
         // BoundingBox must be 1% size of frame (3.2x2.4 pixels)
         if (BoundingBox_width > 0.01 && BoundingBox_height > 0.01) {
-          roiBoxes_[count].x = x_center;
-          roiBoxes_[count].y = y_center;
-          roiBoxes_[count].w = BoundingBox_width;
-          roiBoxes_[count].h = BoundingBox_height;
-          roiBoxes_[count].Class = j;
-          roiBoxes_[count].prob = dets[i].prob[j];
+          roiBoxes[count].x = x_center;
+          roiBoxes[count].y = y_center;
+          roiBoxes[count].w = BoundingBox_width;
+          roiBoxes[count].h = BoundingBox_height;
+          roiBoxes[count].Class = j;
+          roiBoxes[count].prob = dets[i].prob[j];
           count++;
         }
       }
@@ -365,33 +774,119 @@ void* YoloObjectDetector::detectInThread() {
   // create array to store found bounding boxes
   // if no object detected, make sure that ROS knows that num = 0
   if (count == 0) {
-    roiBoxes_[0].num = 0;
+    roiBoxes[0].num = 0;
   } else {
-    roiBoxes_[0].num = count;
+    roiBoxes[0].num = count;
   }
+}
 
-  free_detections(dets, nboxes);
-  demoIndex_ = (demoIndex_ + 1) % demoFrame_;
-  running_ = 0;
-  return 0;
+size_t YoloObjectDetector::newImages() const {
+  size_t count = 0;
+  for (const CameraStream& stream : streams_) {
+    if (stream.seq != stream.fetchedSeq) ++count;
+  }
+  return count;
 }
 
-void* YoloObjectDetector::fetchInThread() {
+bool YoloObjectDetector::fetchInThread(int buffer) {
+  // At most maxRate_ detections per second, the frames arriving meanwhile skipped but the last.
+  double maxRate = maxRate_;
+  if (degraded_ && degradedMaxRate_ > 0) maxRate = maxRate > 0 ? std::min(maxRate, degradedMaxRate_) : degradedMaxRate_;
+  if (maxRate > 0) {
+    std::this_thread::sleep_until(lastFetchTime_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                       std::chrono::duration<double>(1. / maxRate)));
+  }
+  network* net = net_;
+  size_t inputSize = 0;
   {
     boost::shared_lock<boost::shared_mutex> lock(mutexImageCallback_);
-    CvMatWithHeader_ imageAndHeader = getCvMatWithHeader();
-    free_image(buff_[buffIndex_]);
-    buff_[buffIndex_] = mat_to_image(imageAndHeader.image);
-    headerBuff_[buffIndex_] = imageAndHeader.header;
-    buffId_[buffIndex_] = actionId_;
-  }
-  rgbgr_image(buff_[buffIndex_]);
-  letterbox_image_into(buff_[buffIndex_], net_->w, net_->h, buffLetter_[buffIndex_]);
-  return 0;
+    newImageCondition_.wait(lock, [this] { return pipelineStopped_ || newImages() > 0; });
+    if (streams_.size() > 1 && batchWindow_ > 0) {
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                              std::chrono::duration<double>(batchWindow_));
+      newImageCondition_.wait_until(lock, deadline, [this] { return pipelineStopped_ || newImages() == streams_.size(); });
+    }
+    if (pipelineStopped_) return false;
+    lastFetchTime_ = std::chrono::steady_clock::now();
+    buffFetchStamp_[buffer] = ros::Time::now();
+    // The input size of the nearest person, of the whole batch.
+    if (resolutions_) buffResolution_[buffer] = resolutions_->select(buffFetchStamp_[buffer], degradationLevel_);
+    net = bufferNetwork(buffer);
+    inputSize = net->w * net->h * net->c;
+    for (size_t i = 0; i < streams_.size(); ++i) {
+      CameraStream& stream = streams_[i];
+      buffActive_[buffer][i] = stream.seq != stream.fetchedSeq;
+      if (!buffActive_[buffer][i]) continue;
+      skippedFrames_ += stream.seq - stream.fetchedSeq - 1;
+      stream.fetchedSeq = stream.seq;
+      CvMatWithHeader_ imageAndHeader = getCvMatWithHeader(i);
+      fetchLatency_.add((ros::Time::now() - imageAndHeader.header.stamp).toSec());
+      // The regions of the targets detected in place of the whole frame, but every fullFramePeriod frames.
+      if (attention_) {
+        std::vector<AttentionRoi> rois;
+        const cv::Mat& frame = imageAndHeader.image;
+        buffAttention_[buffer] = fetchedFrames_++ % attention_->fullFramePeriod() != 0 &&
+                                 attention_->regions(imageAndHeader.header, frame.cols, frame.rows, rois);
+        buffTiles_[buffer] = AttentionRegions::layout(rois, attention_->inputSize(), attention_->inputSize());
+      }
+#ifdef GPU
+      // The network input letterboxed on the GPU while the image of the buffer is converted.
+      const cv::Mat& pixels = imageAndHeader.image;
+      if (gpuPreprocessing_ && pixels.type() == CV_8UC3 && !buffAttention_[buffer]) {
+        letterboxBgr8Gpu(pixels.data, pixels.cols, pixels.rows, pixels.step, pixelsGpu_, buffLetterGpu_[buffer] + i * inputSize,
+                         net->w, net->h);
+      }
+#endif
+      buffImages_[buffer][i] = stream.image;
+      headerBuff_[buffer][i] = imageAndHeader.header;
+    }
+    buffId_[buffer] = actionId_;
+  }
+  // The letterboxing pads another input size anew.
+  image& input = buffLetter_[buffer];
+  if (input.w != net->w || input.h != net->h) {
+    input.w = net->w;
+    input.h = net->h;
+    fill_cpu(input.w * input.h * input.c, .5, input.data, 1);
+  }
+  // The network input letterboxed from the pixels in place, in one pass over the rows it samples, the
+  // whole frame converted only for its rendering or the attention regions.
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    if (!buffActive_[buffer][i]) continue;
+    cv_bridge::CvImageConstPtr pixels;
+    pixels.swap(buffImages_[buffer][i]);
+    const cv::Mat& frame = pixels->image;
+    image& im = buff_[buffer][i];
+    if (im.w != frame.cols || im.h != frame.rows || im.c != frame.channels()) {
+      free_image(im);
+      im = make_image(frame.cols, frame.rows, frame.channels());
+    }
+    buffConverted_[buffer][i] = buffAttention_[buffer] || renderStream(i);
+    if (buffConverted_[buffer][i]) mat_into_image(frame, im);
+    if (buffAttention_[buffer]) {
+      AttentionRegions::tile(im, buffTiles_[buffer], attentionInput_[buffer]);
+      continue;
+    }
+    // Those of three channels letterboxed on the GPU above, the others uploaded once letterboxed.
+    if (!gpuPreprocessing_ || frame.type() != CV_8UC3) {
+      image letter = buffLetter_[buffer];
+      letter.c = net->c;
+      letter.data += i * inputSize;
+      letterbox_mat_into(frame, net->w, net->h, letter);
+#ifdef GPU
+      if (gpuPreprocessing_) cuda_push_array(buffLetterGpu_[buffer] + i * inputSize, letter.data, inputSize);
+#endif
+    }
+  }
+#ifdef GPU
+  if (gpuPreprocessing_) check_error(cudaEventRecord(buffLetterReady_[buffer], cudaStreamPerThread));
+#endif
+  preprocessLatency_.add(secondsSince(lastFetchTime_));
+  return true;
 }
 
-void* YoloObjectDetector::displayInThread(void* ptr) {
-  int c = show_image(buff_[(buffIndex_ + 1) % 3], "YOLO", 1);
+void* YoloObjectDetector::displayInThread(int buffer) {
+  int c = show_image(buff_[buffer][0], "YOLO", 1);
   if (c != -1) c = c % 256;
   if (c == 27) {
     demoDone_ = 1;
@@ -416,10 +911,85 @@ void* YoloObjectDetector::displayLoop(void* ptr) {
   }
 }
 
+void* YoloObjectDetector::fetchLoop(void* ptr) {
+  thread_config::configure(nodeHandle_, "fetch");
+  int buffer;
+  while (freeBuffers_.pop(buffer)) {
+    if (!fetchInThread(buffer) || !fetchedBuffers_.push(buffer)) break;
+  }
+  return 0;
+}
+
 void* YoloObjectDetector::detectLoop(void* ptr) {
-  while (1) {
-    detectInThread();
+  thread_config::configure(nodeHandle_, "detect");
+  int buffer;
+  while (fetchedBuffers_.pop(buffer)) {
+    detectInThread(buffer);
+    if (!detectedBuffers_.push(buffer)) break;
+  }
+  return 0;
+}
+
+bool YoloObjectDetector::renderStream(int stream) {
+  if (stream == 0 && (viewImage_ || demoPrefix_)) return true;
+  return enableConsoleOutput_ || streams_[stream].detectionImagePublisher.getNumSubscribers() > 0;
+}
+
+void YoloObjectDetector::renderInThread(int buffer) {
+  if (enableConsoleOutput_) {
+    printf("\033[2J");
+    printf("\033[1;1H");
+    printf("\nFPS:%.1f\n", fps_);
+    printf("Objects:\n\n");
+  }
+  for (size_t stream = 0; stream < streams_.size(); ++stream) {
+    if (!buffActive_[buffer][stream] || !buffConverted_[buffer][stream] || !renderStream(stream)) continue;
+    image display = buff_[buffer][stream];
+    const StreamDetections& detections = buffDets_[buffer][stream];
+    draw_detections(display, detections.dets, detections.nboxes, demoThresh_, demoNames_, demoAlphabet_, demoClasses_);
+    if (stream == 0 && demoPrefix_) {
+      char name[256];
+      sprintf(name, "%s_%08d", demoPrefix_, renderedFrames_);
+      save_image(display, name);
+      continue;
+    }
+    if (stream == 0 && viewImage_) displayInThread(buffer);
+    CameraStream& camera = streams_[stream];
+    if (camera.detectionImagePublisher.getNumSubscribers() > 0) {
+      if (disp_[stream].cols != display.w || disp_[stream].rows != display.h) disp_[stream].create(display.h, display.w, CV_8UC(display.c));
+      generate_image(display, disp_[stream]);
+      if (!publishDetectionImage(disp_[stream], camera.detectionImagePublisher)) {
+        ROS_DEBUG("Detection image has not been broadcasted.");
+      }
+    }
+  }
+  ++renderedFrames_;
+}
+
+void* YoloObjectDetector::renderLoop(void* ptr) {
+  // Niced below the other stages, this thread only of the process, unless
+  // given a priority of its own.
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+  thread_config::configure(nodeHandle_, "render");
+  int buffer;
+  while (renderBuffers_.pop(buffer)) {
+    renderInThread(buffer);
+    rendering_ = false;
+    if (!freeBuffers_.push(buffer)) break;
   }
+  return 0;
+}
+
+void YoloObjectDetector::stopPipeline() {
+  {
+    boost::unique_lock<boost::shared_mutex> lockImageCallback(mutexImageCallback_);
+    pipelineStopped_ = true;
+  }
+  newImageCondition_.notify_all();
+  freeBuffers_.close();
+  fetchedBuffers_.close();
+  detectedBuffers_.close();
+  renderBuffers_.close();
 }
 
 void YoloObjectDetector::setupNetwork(char* cfgfile, char* weightfile, char* datafile, float thresh, char** names, int classes, int delay,
@@ -435,11 +1005,155 @@ void YoloObjectDetector::setupNetwork(char* cfgfile, char* weightfile, char* dat
   demoHier_ = hier;
   fullScreen_ = fullscreen;
   printf("YOLO\n");
-  net_ = load_network(cfgfile, weightfile, 0);
-  set_batch_network(net_, 1);
+  net_ = loadNetwork(cfgfile, weightfile);
+  set_batch_network(net_, streams_.size());
+  share_network_outputs(net_);
+  if (streams_.size() > 1) {
+    ROS_INFO("[YoloObjectDetector] Detecting %lu cameras in batches.", (unsigned long)streams_.size());
+  }
+  setupBackend(cfgfile, weightfile);
+  setupAttention(cfgfile, weightfile);
+  setupResolutions();
+#ifdef GPU
+  // A layer at most between the lidar clustering of the process and the GPU.
+  if (net_->gpu_index >= 0) {
+    gpuClient_ = gpu_arbiter::client("darknet_ros", gpu_arbiter::LOW);
+    net_->layer_hook = yieldGpu;
+    net_->layer_hook_arg = gpuClient_;
+    if (attentionNet_) {
+      attentionNet_->layer_hook = yieldGpu;
+      attentionNet_->layer_hook_arg = gpuClient_;
+    }
+    for (network* net : resolutionNets_) {
+      net->layer_hook = yieldGpu;
+      net->layer_hook_arg = gpuClient_;
+    }
+  }
+#endif
+}
+
+network* YoloObjectDetector::loadNetwork(char* cfgfile, char* weightfile) {
+  bool cache;
+  std::string cacheFile;
+  nodeHandle_.param("detection/network_cache/enable", cache, true);
+  nodeHandle_.param("detection/network_cache/file", cacheFile, std::string(""));
+  if (!cache) {
+    network* net = load_network(cfgfile, weightfile, 0);
+    fuse_batchnorm_network(net);
+    return net;
+  }
+  if (cacheFile.empty()) cacheFile = std::string(weightfile) + ".fused";
+  return load_network_cached(cfgfile, weightfile, &cacheFile[0]);
+}
+
+void YoloObjectDetector::setupAttention(char* cfgfile, char* weightfile) {
+  if (!attention_) return;
+  for (int i = 0; i < net_->n; ++i) {
+    LAYER_TYPE type = net_->layers[i].type;
+    if (type == DETECTION || type == CONNECTED || type == LOCAL || type == SOFTMAX) {
+      ROS_ERROR("[YoloObjectDetector] The network cannot be resized to the attention regions, detecting the whole frames.");
+      attention_.reset();
+      return;
+    }
+  }
+  int size = attention_->inputSize();
+  attentionNet_ = loadNetwork(cfgfile, weightfile);
+  set_batch_network(attentionNet_, 1);
+  resize_network(attentionNet_, size, size);
+  share_network_outputs(attentionNet_);
+  attentionBackend_.reset(new DarknetBackend(attentionNet_));
+  ROS_INFO("[YoloObjectDetector] Detecting the attention regions in %dx%d, the whole frame every %d frames.", size, size,
+           attention_->fullFramePeriod());
+}
+
+void YoloObjectDetector::setupResolutions() {
+  resolutions_.reset(new InputResolutions(nodeHandle_, net_->w));
+  if (!resolutions_->enabled()) {
+    resolutions_.reset();
+    return;
+  }
+  bool resizable = net_->w == net_->h && std::string(backend_->name()) != "tensorrt";
+  for (int i = 0; i < net_->n; ++i) {
+    LAYER_TYPE type = net_->layers[i].type;
+    if (type == DETECTION || type == CONNECTED || type == LOCAL || type == SOFTMAX) resizable = false;
+  }
+  if (!resizable) {
+    ROS_ERROR("[YoloObjectDetector] The network or its backend cannot be resized to the input sizes, detecting at %dx%d.", net_->w,
+              net_->h);
+    resolutions_.reset();
+    return;
+  }
+
+  // The copies of the INT8 backend run its quantized weights too.
+  bool int8 = std::string(backend_->name()) == "int8";
+  std::string sizes;
+  for (const InputResolution& resolution : resolutions_->resolutions()) {
+    sizes += (sizes.empty() ? "" : ", ") + std::to_string(resolution.size);
+    if (resolution.size == net_->w) {
+      resolutionNets_.push_back(net_);
+      resolutionBackends_.emplace_back();
+      continue;
+    }
+    network* net = resized_network_copy(net_, resolution.size, resolution.size);
+    share_network_outputs(net);
+    net->int8 = int8;
+    resolutionNets_.push_back(net);
+    resolutionBackends_.emplace_back(new DarknetBackend(net));
+  }
+  for (int i = 0; i < 3; ++i) buffResolution_[i] = resolutions_->cfgIndex();
+  ROS_INFO("[YoloObjectDetector] Detecting at the input sizes %s of the nearest person.", sizes.c_str());
+}
+
+network* YoloObjectDetector::bufferNetwork(int buffer) const {
+  return resolutionNets_.empty() ? net_ : resolutionNets_[buffResolution_[buffer]];
+}
+
+InferenceBackend* YoloObjectDetector::bufferBackend(int buffer) const {
+  return bufferNetwork(buffer) == net_ ? backend_.get() : resolutionBackends_[buffResolution_[buffer]].get();
+}
+
+void YoloObjectDetector::setupBackend(const char* cfgfile, const char* weightfile) {
+  std::string backend;
+  nodeHandle_.param("detection/backend", backend, std::string("darknet"));
+  if (backend == "tensorrt") {
+#ifdef DARKNET_ROS_TENSORRT
+    TensorRtOptions options;
+    nodeHandle_.param("detection/tensorrt/precision", options.precision, options.precision);
+    nodeHandle_.param("detection/tensorrt/dla_core", options.dlaCore, options.dlaCore);
+    nodeHandle_.param("detection/tensorrt/engine_file", options.engineFile, options.engineFile);
+    nodeHandle_.param("detection/tensorrt/calibration_images", options.calibrationImages, options.calibrationImages);
+    nodeHandle_.param("detection/tensorrt/workspace_size", options.workspaceSize, options.workspaceSize);
+    options.configFile = cfgfile;
+    options.weightsFile = weightfile;
+    try {
+      backend_.reset(new TensorRtBackend(net_, options));
+    } catch (const std::exception& e) {
+      ROS_ERROR("[YoloObjectDetector] TensorRT backend failed: %s.", e.what());
+    }
+#else
+    ROS_ERROR("[YoloObjectDetector] Built without TensorRT.");
+#endif
+  } else if (backend == "int8") {
+    Int8Options options;
+    nodeHandle_.param("detection/int8/calibration", options.calibration, options.calibration);
+    nodeHandle_.param("detection/int8/calibration_topic", options.calibrationTopic, options.calibrationTopic);
+    nodeHandle_.param("detection/int8/calibration_frames", options.calibrationFrames, options.calibrationFrames);
+    nodeHandle_.param("detection/int8/calibration_file", options.calibrationFile, options.calibrationFile);
+    options.weightsFile = weightfile;
+    try {
+      backend_.reset(new Int8Backend(net_, options));
+    } catch (const std::exception& e) {
+      ROS_ERROR("[YoloObjectDetector] INT8 backend failed: %s.", e.what());
+    }
+  } else if (backend != "darknet") {
+    ROS_ERROR("[YoloObjectDetector] Unknown backend %s.", backend.c_str());
+  }
+  if (!backend_) backend_.reset(new DarknetBackend(net_));
+  ROS_INFO("[YoloObjectDetector] Inference backend: %s.", backend_->name());
 }
 
 void YoloObjectDetector::yolo() {
+  thread_config::configure(nodeHandle_, "yolo");
   const auto wait_duration = std::chrono::milliseconds(2000);
   while (!getImageStatus()) {
     printf("Waiting for image.\n");
@@ -449,38 +1163,110 @@ void YoloObjectDetector::yolo() {
     std::this_thread::sleep_for(wait_duration);
   }
 
-  std::thread detect_thread;
-  std::thread fetch_thread;
-
   srand(2222222);
 
   int i;
   demoTotal_ = sizeNetwork(net_);
-  predictions_ = (float**)calloc(demoFrame_, sizeof(float*));
-  for (i = 0; i < demoFrame_; ++i) {
-    predictions_[i] = (float*)calloc(demoTotal_, sizeof(float));
+
+  // The outputs averaged on the GPU only if they are all there.
+  bool outputsOnGpu = backend_->outputsOnGpu();
+  for (i = 0; i < net_->n; ++i) {
+    if (net_->layers[i].type == DETECTION) outputsOnGpu = false;
+  }
+  if (averaging_ == Averaging::Gpu && !outputsOnGpu) {
+    ROS_WARN("[YoloObjectDetector] The outputs of the network are not on the GPU, averaging them running.");
+    averaging_ = Averaging::Running;
+  }
+  if (demoFrame_ <= 1) averaging_ = Averaging::None;
+
+  // The boxes decoded on the GPU if the outputs are there and of YOLO layers
+  // only, the outputs then averaged there too and never pulled to the host.
+#ifdef GPU
+  if (gpuDecode_) {
+    gpuDecode_ = outputsOnGpu && setupYoloDecoderGpu(decoderGpu_, net_, classWhitelist_);
+    if (!gpuDecode_) ROS_WARN("[YoloObjectDetector] The boxes of this network and backend are decoded on the CPU.");
+  }
+  if (gpuDecode_) {
+    if (averaging_ != Averaging::None) averaging_ = Averaging::Gpu;
+    net_->gpu_outputs_only = 1;
+    ROS_INFO("[YoloObjectDetector] Decoding the boxes on the GPU.");
   }
-  avg_ = (float*)calloc(demoTotal_, sizeof(float));
 
-  layer l = net_->layers[net_->n - 1];
-  roiBoxes_ = (darknet_ros::RosBox_*)calloc(l.w * l.h * l.n, sizeof(darknet_ros::RosBox_));
+  // The outputs decoded on the CPU read in place on a GPU sharing the host
+  // memory, those decoded on the GPU left there.
+  if (mappedOutputs_) {
+    if (outputsOnGpu && !gpuDecode_) map_network_outputs(net_);
+    for (network* net : resolutionNets_) {
+      if (net != net_) map_network_outputs(net);
+    }
+    if (attentionNet_) map_network_outputs(attentionNet_);
+    if (net_->mapped) ROS_INFO("[YoloObjectDetector] Reading the outputs of the network in place, in memory mapped to the GPU.");
+  }
+  mappedWindow_ = averaging_ == Averaging::Window && net_->mapped;
+#endif
 
-  {
-    boost::shared_lock<boost::shared_mutex> lock(mutexImageCallback_);
-    CvMatWithHeader_ imageAndHeader = getCvMatWithHeader();
-    buff_[0] = mat_to_image(imageAndHeader.image);
-    headerBuff_[0] = imageAndHeader.header;
-  }
-  buff_[1] = copy_image(buff_[0]);
-  buff_[2] = copy_image(buff_[0]);
-  headerBuff_[1] = headerBuff_[0];
-  headerBuff_[2] = headerBuff_[0];
-  buffLetter_[0] = letterbox_image(buff_[0], net_->w, net_->h);
-  buffLetter_[1] = letterbox_image(buff_[0], net_->w, net_->h);
-  buffLetter_[2] = letterbox_image(buff_[0], net_->w, net_->h);
-  disp_ = image_to_mat(buff_[0]);
+  if (averaging_ == Averaging::Window || averaging_ == Averaging::Running) {
+    predictions_ = (float**)calloc(demoFrame_, sizeof(float*));
+    for (i = 0; i < demoFrame_; ++i) {
+#ifdef GPU
+      if (mappedWindow_) {
+        if (!predictionsGpu_) predictionsGpu_ = (float**)calloc(demoFrame_, sizeof(float*));
+        predictions_[i] = cuda_make_mapped_array(demoTotal_, &predictionsGpu_[i]);
+        continue;
+      }
+#endif
+      predictions_[i] = (float*)calloc(demoTotal_, sizeof(float));
+    }
+  }
+  if (averaging_ == Averaging::Window) avg_ = (float*)calloc(demoTotal_, sizeof(float));
+  if (averaging_ == Averaging::Running) sum_ = (float*)calloc(demoTotal_, sizeof(float));
+#ifdef GPU
+  if (averaging_ == Averaging::Gpu) {
+    predictionsGpu_ = (float**)calloc(demoFrame_, sizeof(float*));
+    for (i = 0; i < demoFrame_; ++i) {
+      predictionsGpu_[i] = cuda_make_array(0, demoTotal_);
+    }
+    sumGpu_ = cuda_make_array(0, demoTotal_);
+  }
+#endif
+
+  // The images of the buffers replaced by those fetched, the inputs of the
+  // cameras without image yet left out of the detection; the network inputs
+  // and the boxes of the largest input size.
+  layer l = net_->layers[net_->n - 1];
+  int maxWidth = net_->w, maxHeight = net_->h, maxBoxes = l.w * l.h * l.n;
+  for (network* net : resolutionNets_) {
+    l = net->layers[net->n - 1];
+    maxWidth = std::max(maxWidth, net->w);
+    maxHeight = std::max(maxHeight, net->h);
+    maxBoxes = std::max(maxBoxes, l.w * l.h * l.n);
+  }
+  size_t numStreams = streams_.size();
+  for (i = 0; i < 3; ++i) {
+    for (size_t stream = 0; stream < numStreams; ++stream) {
+      roiBoxes_[i].push_back((darknet_ros::RosBox_*)calloc(maxBoxes, sizeof(darknet_ros::RosBox_)));
+      buff_[i].push_back(make_image(1, 1, 3));
+    }
+    headerBuff_[i].resize(numStreams);
+    buffConverted_[i].assign(numStreams, false);
+    buffImages_[i].resize(numStreams);
+    buffActive_[i].assign(numStreams, false);
+    buffDets_[i].resize(numStreams);
+    if (attention_) attentionInput_[i] = make_image(attention_->inputSize(), attention_->inputSize(), net_->c);
+    buffLetter_[i] = make_image(maxWidth, maxHeight, net_->c * numStreams);
+    fill_cpu(buffLetter_[i].w * buffLetter_[i].h * buffLetter_[i].c, .5, buffLetter_[i].data, 1);
+  }
+#ifdef GPU
+  if (gpuPreprocessing_) {
+    for (i = 0; i < 3; ++i) {
+      buffLetterGpu_[i] = cuda_make_array(buffLetter_[i].data, maxWidth * maxHeight * net_->c * numStreams);
+      check_error(cudaEventCreateWithFlags(&buffLetterReady_[i], cudaEventDisableTiming));
+    }
+    ROS_INFO("[YoloObjectDetector] Preprocessing the images on the GPU.");
+  }
+#endif
+  disp_.resize(numStreams);
 
-  int count = 0;
   if (!demoPrefix_ && viewImage_) {
     cv::namedWindow("YOLO", cv::WINDOW_NORMAL);
     if (fullScreen_) {
@@ -493,35 +1279,48 @@ void YoloObjectDetector::yolo() {
 
   demoTime_ = what_time_is_it_now();
 
-  while (!demoDone_) {
-    buffIndex_ = (buffIndex_ + 1) % 3;
-    fetch_thread = std::thread(&YoloObjectDetector::fetchInThread, this);
-    detect_thread = std::thread(&YoloObjectDetector::detectInThread, this);
+  // The fetch and the detect stages run on threads of their own for the
+  // whole node, this one publishing the buffers detected and freeing them
+  // for the next images.
+  for (i = 0; i < 3; ++i) {
+    freeBuffers_.push(i);
+  }
+  fetchThread_ = std::thread(&YoloObjectDetector::fetchLoop, this, nullptr);
+  detectThread_ = std::thread(&YoloObjectDetector::detectLoop, this, nullptr);
+  renderThread_ = std::thread(&YoloObjectDetector::renderLoop, this, nullptr);
+
+  // The boxes published first, the buffer then rendered if anyone looks at
+  // it and the rendering is idle, every one of them if saved.
+  int buffer;
+  while (!demoDone_ && detectedBuffers_.pop(buffer)) {
     if (!demoPrefix_) {
       fps_ = 1. / (what_time_is_it_now() - demoTime_);
       demoTime_ = what_time_is_it_now();
-      if (viewImage_) {
-        displayInThread(0);
-      } else {
-        generate_image(buff_[(buffIndex_ + 1) % 3], disp_);
-      }
-      publishInThread();
+      publishInThread(buffer);
+    }
+    bool render = false;
+    for (size_t stream = 0; stream < numStreams; ++stream) {
+      if (buffActive_[buffer][stream] && renderStream(stream)) render = true;
+    }
+    if (render && (demoPrefix_ || !rendering_)) {
+      rendering_ = true;
+      renderBuffers_.push(buffer);
     } else {
-      char name[256];
-      sprintf(name, "%s_%08d", demoPrefix_, count);
-      save_image(buff_[(buffIndex_ + 1) % 3], name);
+      freeBuffers_.push(buffer);
     }
-    fetch_thread.join();
-    detect_thread.join();
-    ++count;
     if (!isNodeRunning()) {
       demoDone_ = true;
     }
   }
+  stopPipeline();
+  fetchThread_.join();
+  detectThread_.join();
+  renderThread_.join();
 }
 
-CvMatWithHeader_ YoloObjectDetector::getCvMatWithHeader() {
-  CvMatWithHeader_ header = {.image = camImageCopy_, .header = imageHeader_};
+CvMatWithHeader_ YoloObjectDetector::getCvMatWithHeader(int stream) {
+  const cv_bridge::CvImageConstPtr& camImage = streams_[stream].image;
+  CvMatWithHeader_ header = {.image = camImage->image, .header = camImage->header};
   return header;
 }
 
@@ -535,77 +1334,73 @@ bool YoloObjectDetector::isNodeRunning(void) {
   return isNodeRunning_;
 }
 
-void* YoloObjectDetector::publishInThread() {
-  // Publish image.
-  cv::Mat cvImage = disp_;
-  if (!publishDetectionImage(cv::Mat(cvImage))) {
-    ROS_DEBUG("Detection image has not been broadcasted.");
+void* YoloObjectDetector::publishInThread(int buffer) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t stream = 0; stream < streams_.size(); ++stream) {
+    if (!buffActive_[buffer][stream]) continue;
+    publishStream(buffer, stream);
+    ageLatency_.add((ros::Time::now() - headerBuff_[buffer][stream].stamp).toSec());
+    perception_trace::record("darknet_ros", headerBuff_[buffer][stream].stamp, buffFetchStamp_[buffer]);
   }
+  publishLatency_.add(secondsSince(start));
+  return 0;
+}
+
+void YoloObjectDetector::publishStream(int buffer, int stream) {
+  CameraStream& camera = streams_[stream];
+  int frameWidth = buff_[buffer][stream].w;
+  int frameHeight = buff_[buffer][stream].h;
 
   // Publish bounding boxes and detection result.
-  int num = roiBoxes_[0].num;
+  RosBox_* roiBoxes = roiBoxes_[buffer][stream];
+  int num = roiBoxes[0].num;
   if (num > 0 && num <= 100) {
-    for (int i = 0; i < num; i++) {
-      for (int j = 0; j < numClasses_; j++) {
-        if (roiBoxes_[i].Class == j) {
-          rosBoxes_[j].push_back(roiBoxes_[i]);
-          rosBoxCounter_[j]++;
-        }
-      }
-    }
+    rosBoxes_.assign(roiBoxes, roiBoxes + num);
+    std::stable_sort(rosBoxes_.begin(), rosBoxes_.end(), [](const RosBox_& a, const RosBox_& b) { return a.Class < b.Class; });
 
     darknet_ros_msgs::ObjectCount msg;
     msg.header.stamp = ros::Time::now();
     msg.header.frame_id = "detection";
     msg.count = num;
-    objectPublisher_.publish(msg);
-
-    for (int i = 0; i < numClasses_; i++) {
-      if (rosBoxCounter_[i] > 0) {
-        darknet_ros_msgs::BoundingBox boundingBox;
-
-        for (int j = 0; j < rosBoxCounter_[i]; j++) {
-          int xmin = (rosBoxes_[i][j].x - rosBoxes_[i][j].w / 2) * frameWidth_;
-          int ymin = (rosBoxes_[i][j].y - rosBoxes_[i][j].h / 2) * frameHeight_;
-          int xmax = (rosBoxes_[i][j].x + rosBoxes_[i][j].w / 2) * frameWidth_;
-          int ymax = (rosBoxes_[i][j].y + rosBoxes_[i][j].h / 2) * frameHeight_;
-
-          boundingBox.Class = classLabels_[i];
-          boundingBox.id = i;
-          boundingBox.probability = rosBoxes_[i][j].prob;
-          boundingBox.xmin = xmin;
-          boundingBox.ymin = ymin;
-          boundingBox.xmax = xmax;
-          boundingBox.ymax = ymax;
-          boundingBoxesResults_.bounding_boxes.push_back(boundingBox);
-        }
-      }
+    camera.objectPublisher.publish(msg);
+
+    darknet_ros_msgs::BoundingBox boundingBox;
+    for (const RosBox_& box : rosBoxes_) {
+      if (box.Class < 0 || box.Class >= numClasses_) continue;
+      int xmin = (box.x - box.w / 2) * frameWidth;
+      int ymin = (box.y - box.h / 2) * frameHeight;
+      int xmax = (box.x + box.w / 2) * frameWidth;
+      int ymax = (box.y + box.h / 2) * frameHeight;
+
+      boundingBox.Class = classLabels_[box.Class];
+      boundingBox.id = box.Class;
+      boundingBox.probability = box.prob;
+      boundingBox.xmin = xmin;
+      boundingBox.ymin = ymin;
+      boundingBox.xmax = xmax;
+      boundingBox.ymax = ymax;
+      boundingBoxesResults_.bounding_boxes.push_back(boundingBox);
     }
     boundingBoxesResults_.header.stamp = ros::Time::now();
     boundingBoxesResults_.header.frame_id = "detection";
-    boundingBoxesResults_.image_header = headerBuff_[(buffIndex_ + 1) % 3];
-    boundingBoxesPublisher_.publish(boundingBoxesResults_);
+    boundingBoxesResults_.image_header = headerBuff_[buffer][stream];
+    camera.boundingBoxesPublisher.publish(boundingBoxesResults_);
   } else {
     darknet_ros_msgs::ObjectCount msg;
     msg.header.stamp = ros::Time::now();
     msg.header.frame_id = "detection";
     msg.count = 0;
-    objectPublisher_.publish(msg);
+    camera.objectPublisher.publish(msg);
   }
-  if (isCheckingForObjects()) {
+  if (stream == 0 && isCheckingForObjects()) {
     ROS_DEBUG("[YoloObjectDetector] check for objects in image.");
     darknet_ros_msgs::CheckForObjectsResult objectsActionResult;
-    objectsActionResult.id = buffId_[0];
+    objectsActionResult.id = buffId_[buffer];
     objectsActionResult.bounding_boxes = boundingBoxesResults_;
     checkForObjectsActionServer_->setSucceeded(objectsActionResult, "Send bounding boxes.");
   }
   boundingBoxesResults_.bounding_boxes.clear();
-  for (int i = 0; i < numClasses_; i++) {
-    rosBoxes_[i].clear();
-    rosBoxCounter_[i] = 0;
-  }
-
-  return 0;
+  rosBoxes_.clear();
 }
 
 } /* namespace darknet_ros*/
@@ -0,0 +1,278 @@
+/*
+ * decode_kernels.cu
+ *
+ *  Decoding and non-maximum suppression of the boxes of the YOLO layers on
+ *  the GPU.
+ */
+
+#include "cuda_runtime.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+extern "C" {
+#include "cuda.h"
+}
+
+#include "darknet_ros/decode_gpu.hpp"
+
+namespace darknet_ros {
+
+// Threads of the suppression of an image, and its candidates at most.
+static const int NMS_THREADS = 1024;
+
+// As get_yolo_box and correct_yolo_boxes, relative to the image.
+__device__ void yoloBox(const float* output, int loc, int plane, int col, int row, int layerWidth, int layerHeight, float anchorWidth,
+                        float anchorHeight, int netWidth, int netHeight, int width, int height, float* box) {
+  float x = (col + output[loc]) / layerWidth;
+  float y = (row + output[plane + loc]) / layerHeight;
+  float w = expf(output[2 * plane + loc]) * anchorWidth / netWidth;
+  float h = expf(output[3 * plane + loc]) * anchorHeight / netHeight;
+
+  int newWidth, newHeight;
+  if (((float)netWidth / width) < ((float)netHeight / height)) {
+    newWidth = netWidth;
+    newHeight = (height * netWidth) / width;
+  } else {
+    newHeight = netHeight;
+    newWidth = (width * netHeight) / height;
+  }
+  box[0] = (x - (netWidth - newWidth) / 2. / netWidth) / ((float)newWidth / netWidth);
+  box[1] = (y - (netHeight - newHeight) / 2. / netHeight) / ((float)newHeight / netHeight);
+  box[2] = w * ((float)netWidth / newWidth);
+  box[3] = h * ((float)netHeight / newHeight);
+}
+
+// As overlap and box_iou.
+__device__ float overlap(float x1, float w1, float x2, float w2) {
+  float left = fmaxf(x1 - w1 / 2, x2 - w2 / 2);
+  float right = fminf(x1 + w1 / 2, x2 + w2 / 2);
+  return right - left;
+}
+
+__device__ float boxIou(const YoloCandidateGpu& a, const YoloCandidateGpu& b) {
+  float w = overlap(a.x, a.w, b.x, b.w);
+  float h = overlap(a.y, a.h, b.y, b.h);
+  float intersection = (w < 0 || h < 0) ? 0 : w * h;
+  return intersection / (a.w * a.h + b.w * b.h - intersection);
+}
+
+// One thread per anchor of the layer and image of the batch, those of none
+// of the classes evaluated above the threshold dropped if not all are.
+__global__ void decodeYoloKernel(const float* output, int outputs, int layerWidth, int layerHeight, int n, int classes,
+                                 const int* classIds, int classCount, const float* anchors, int netWidth, int netHeight, int batch,
+                                 const int* sizes, float thresh, YoloCandidateGpu* candidates, int* candidateCounts,
+                                 int maxCandidates) {
+  int plane = layerWidth * layerHeight;
+  int i = (blockIdx.x + blockIdx.y * gridDim.x) * blockDim.x + threadIdx.x;
+  if (i >= batch * n * plane) return;
+  int b = i / (n * plane);
+  int anchor = i / plane % n;
+  int loc = i % plane;
+
+  const float* imageOutput = output + b * outputs;
+  int index = anchor * plane * (4 + classes + 1);
+  float objectness = imageOutput[index + 4 * plane + loc];
+  if (objectness <= thresh) return;
+  if (classCount > 0) {
+    bool evaluated = false;
+    for (int c = 0; c < classCount && !evaluated; ++c) {
+      evaluated = objectness * imageOutput[index + (5 + classIds[c]) * plane + loc] > thresh;
+    }
+    if (!evaluated) return;
+  }
+
+  float box[4];
+  yoloBox(imageOutput + index, loc, plane, loc % layerWidth, loc / layerWidth, layerWidth, layerHeight, anchors[2 * anchor],
+          anchors[2 * anchor + 1], netWidth, netHeight, sizes[2 * b], sizes[2 * b + 1], box);
+  int slot = atomicAdd(&candidateCounts[b], 1);
+  if (slot >= maxCandidates) return;
+  YoloCandidateGpu& candidate = candidates[b * maxCandidates + slot];
+  candidate.x = box[0];
+  candidate.y = box[1];
+  candidate.w = box[2];
+  candidate.h = box[3];
+  candidate.objectness = objectness;
+  candidate.output = imageOutput;
+  candidate.index = index + 4 * plane + loc;
+  candidate.classes = classes;
+  candidate.plane = plane;
+}
+
+// One block per image: the candidates ranked by objectness, then
+// suppressed in that order by those kept before them, as do_nms_obj, and
+// the boxes kept written in that order with the probabilities of their
+// classes.
+__global__ void suppressYoloKernel(const YoloCandidateGpu* candidates, const int* candidateCounts, int maxCandidates,
+                                   const int* classIds, int classCount, int classes, float thresh, float nms, YoloBoxGpu* boxes,
+                                   float* probs, int* boxCounts) {
+  __shared__ int order[NMS_THREADS];
+  __shared__ bool keep[NMS_THREADS];
+  int b = blockIdx.x;
+  int count = min(candidateCounts[b], maxCandidates);
+  const YoloCandidateGpu* own = candidates + b * maxCandidates;
+
+  for (int i = threadIdx.x; i < count; i += blockDim.x) {
+    int rank = 0;
+    for (int j = 0; j < count; ++j) {
+      if (own[j].objectness > own[i].objectness || (own[j].objectness == own[i].objectness && j < i)) ++rank;
+    }
+    order[rank] = i;
+    keep[rank] = true;
+  }
+  __syncthreads();
+
+  for (int i = 0; i < count; ++i) {
+    if (keep[i]) {
+      const YoloCandidateGpu& a = own[order[i]];
+      for (int j = i + 1 + threadIdx.x; j < count; j += blockDim.x) {
+        if (keep[j] && boxIou(a, own[order[j]]) > nms) keep[j] = false;
+      }
+    }
+    __syncthreads();
+  }
+
+  if (threadIdx.x != 0) return;
+  int kept = 0;
+  for (int i = 0; i < count; ++i) {
+    if (!keep[i]) continue;
+    const YoloCandidateGpu& candidate = own[order[i]];
+    YoloBoxGpu& box = boxes[b * maxCandidates + kept];
+    box.x = candidate.x;
+    box.y = candidate.y;
+    box.w = candidate.w;
+    box.h = candidate.h;
+    box.objectness = candidate.objectness;
+    float* prob = probs + (size_t)(b * maxCandidates + kept) * classes;
+    for (int i = 0; i < (classCount > 0 ? classCount : classes); ++i) {
+      int c = classCount > 0 ? classIds[i] : i;
+      float p = candidate.objectness * candidate.output[candidate.index + (1 + c) * candidate.plane];
+      prob[c] = p > thresh ? p : 0;
+    }
+    ++kept;
+  }
+  boxCounts[b] = kept;
+}
+
+bool setupYoloDecoderGpu(YoloDecoderGpu& decoder, network* net, const std::vector<int>& classIds) {
+  int classes = -1;
+  for (int i = 0; i < net->n; ++i) {
+    const layer& l = net->layers[i];
+    if (l.type == REGION || l.type == DETECTION) return false;
+    if (l.type != YOLO) continue;
+    if (classes >= 0 && l.classes != classes) return false;
+    classes = l.classes;
+  }
+  if (classes < 0) return false;
+
+  for (int i = 0; i < net->n; ++i) {
+    const layer& l = net->layers[i];
+    if (l.type != YOLO) continue;
+    std::vector<float> anchors(2 * l.n);
+    for (int n = 0; n < l.n; ++n) {
+      anchors[2 * n] = l.biases[2 * l.mask[n]];
+      anchors[2 * n + 1] = l.biases[2 * l.mask[n] + 1];
+    }
+    decoder.anchors.push_back(cuda_make_array(anchors.data(), anchors.size()));
+  }
+
+  decoder.batch = net->batch;
+  decoder.classes = classes;
+  decoder.maxCandidates = NMS_THREADS;
+  std::vector<int> ids;
+  for (int c : classIds) {
+    if (c >= 0 && c < classes) ids.push_back(c);
+  }
+  decoder.classCount = ids.size();
+  if (!ids.empty()) {
+    check_error(cudaMalloc((void**)&decoder.classIds, ids.size() * sizeof(int)));
+    check_error(cudaMemcpy(decoder.classIds, ids.data(), ids.size() * sizeof(int), cudaMemcpyHostToDevice));
+  }
+  size_t candidates = (size_t)decoder.batch * decoder.maxCandidates;
+  check_error(cudaMalloc((void**)&decoder.sizes, 2 * decoder.batch * sizeof(int)));
+  check_error(cudaMalloc((void**)&decoder.candidates, candidates * sizeof(YoloCandidateGpu)));
+  check_error(cudaMalloc((void**)&decoder.candidateCounts, decoder.batch * sizeof(int)));
+  check_error(cudaMalloc((void**)&decoder.boxes, candidates * sizeof(YoloBoxGpu)));
+  check_error(cudaMalloc((void**)&decoder.probs, candidates * classes * sizeof(float)));
+  // Only the probabilities of the classes evaluated ever written, those of the others left at 0.
+  check_error(cudaMemset(decoder.probs, 0, candidates * classes * sizeof(float)));
+  check_error(cudaMalloc((void**)&decoder.boxCounts, decoder.batch * sizeof(int)));
+  decoder.hostCandidateCounts.resize(decoder.batch);
+  decoder.hostBoxCounts.resize(decoder.batch);
+  decoder.hostBoxes.resize(decoder.batch);
+  decoder.hostProbs.resize(decoder.batch);
+  return true;
+}
+
+void decodeYoloGpu(YoloDecoderGpu& decoder, network* net, const int* widths, const int* heights, float thresh, float nms) {
+  std::vector<int> sizes(2 * decoder.batch);
+  for (int b = 0; b < decoder.batch; ++b) {
+    sizes[2 * b] = widths[b];
+    sizes[2 * b + 1] = heights[b];
+  }
+  check_error(cudaMemcpy(decoder.sizes, sizes.data(), sizes.size() * sizeof(int), cudaMemcpyHostToDevice));
+  check_error(cudaMemset(decoder.candidateCounts, 0, decoder.batch * sizeof(int)));
+
+  int yolo = 0;
+  for (int i = 0; i < net->n; ++i) {
+    const layer& l = net->layers[i];
+    if (l.type != YOLO) continue;
+    size_t n = (size_t)l.batch * l.n * l.w * l.h;
+    decodeYoloKernel<<<cuda_gridsize(n), BLOCK>>>(l.output_gpu, l.outputs, l.w, l.h, l.n, l.classes, decoder.classIds,
+                                                  decoder.classCount, decoder.anchors[yolo++], net->w, net->h, l.batch,
+                                                  decoder.sizes, thresh, decoder.candidates, decoder.candidateCounts,
+                                                  decoder.maxCandidates);
+    check_error(cudaPeekAtLastError());
+  }
+  suppressYoloKernel<<<decoder.batch, NMS_THREADS>>>(decoder.candidates, decoder.candidateCounts, decoder.maxCandidates,
+                                                     decoder.classIds, decoder.classCount, decoder.classes, thresh, nms,
+                                                     decoder.boxes, decoder.probs, decoder.boxCounts);
+  check_error(cudaPeekAtLastError());
+
+  check_error(cudaMemcpy(decoder.hostCandidateCounts.data(), decoder.candidateCounts, decoder.batch * sizeof(int),
+                         cudaMemcpyDeviceToHost));
+  check_error(cudaMemcpy(decoder.hostBoxCounts.data(), decoder.boxCounts, decoder.batch * sizeof(int), cudaMemcpyDeviceToHost));
+  for (int b = 0; b < decoder.batch; ++b) {
+    int count = decoder.hostBoxCounts[b];
+    decoder.hostBoxes[b].resize(count);
+    decoder.hostProbs[b].resize((size_t)count * decoder.classes);
+    if (count == 0) continue;
+    size_t offset = (size_t)b * decoder.maxCandidates;
+    check_error(cudaMemcpy(decoder.hostBoxes[b].data(), decoder.boxes + offset, count * sizeof(YoloBoxGpu), cudaMemcpyDeviceToHost));
+    check_error(cudaMemcpy(decoder.hostProbs[b].data(), decoder.probs + offset * decoder.classes,
+                           (size_t)count * decoder.classes * sizeof(float), cudaMemcpyDeviceToHost));
+  }
+}
+
+detection* yoloDetectionsGpu(const YoloDecoderGpu& decoder, int b, int* nboxes) {
+  const std::vector<YoloBoxGpu>& boxes = decoder.hostBoxes[b];
+  *nboxes = boxes.size();
+  detection* dets = (detection*)calloc(boxes.size() + 1, sizeof(detection));
+  for (size_t i = 0; i < boxes.size(); ++i) {
+    dets[i].bbox.x = boxes[i].x;
+    dets[i].bbox.y = boxes[i].y;
+    dets[i].bbox.w = boxes[i].w;
+    dets[i].bbox.h = boxes[i].h;
+    dets[i].objectness = boxes[i].objectness;
+    dets[i].classes = decoder.classes;
+    dets[i].prob = (float*)calloc(decoder.classes, sizeof(float));
+    std::copy(decoder.hostProbs[b].begin() + i * decoder.classes, decoder.hostProbs[b].begin() + (i + 1) * decoder.classes,
+              dets[i].prob);
+  }
+  return dets;
+}
+
+void freeYoloDecoderGpu(YoloDecoderGpu& decoder) {
+  for (float* anchors : decoder.anchors) cuda_free(anchors);
+  decoder.anchors.clear();
+  if (decoder.classIds) check_error(cudaFree(decoder.classIds));
+  if (decoder.sizes) check_error(cudaFree(decoder.sizes));
+  if (decoder.candidates) check_error(cudaFree(decoder.candidates));
+  if (decoder.candidateCounts) check_error(cudaFree(decoder.candidateCounts));
+  if (decoder.boxes) check_error(cudaFree(decoder.boxes));
+  if (decoder.probs) check_error(cudaFree(decoder.probs));
+  if (decoder.boxCounts) check_error(cudaFree(decoder.boxCounts));
+  decoder = YoloDecoderGpu();
+}
+
+} /* namespace darknet_ros*/
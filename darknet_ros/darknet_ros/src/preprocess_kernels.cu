@@ -0,0 +1,106 @@
+/*
+ * preprocess_kernels.cu
+ *
+ *  Letterboxing of the camera images into the network input on the GPU.
+ */
+
+#include <cstring>
+
+#include "cuda_runtime.h"
+
+extern "C" {
+#include "cuda.h"
+}
+
+#include "darknet_ros/preprocess_gpu.hpp"
+
+namespace darknet_ros {
+
+// One thread per pixel of the input, its three planes written at once. The
+// sampling is that of darknet's resize_image: bilinear, the corners of the
+// image on the corners of the resized one.
+__global__ void letterboxBgr8Kernel(const unsigned char* pixels, int width, int height, int step, float* input, int netWidth,
+                                    int netHeight, int resizedWidth, int resizedHeight, int left, int top) {
+  int i = (blockIdx.x + blockIdx.y * gridDim.x) * blockDim.x + threadIdx.x;
+  if (i >= netWidth * netHeight) return;
+  int x = i % netWidth - left;
+  int y = i / netWidth - top;
+  int plane = netWidth * netHeight;
+
+  if (x < 0 || x >= resizedWidth || y < 0 || y >= resizedHeight) {
+    input[i] = .5f;
+    input[i + plane] = .5f;
+    input[i + 2 * plane] = .5f;
+    return;
+  }
+
+  float sx = 0, sy = 0;
+  int ix = width - 1, iy = height - 1;
+  if (x < resizedWidth - 1 && width > 1) {
+    sx = x * ((float)(width - 1) / (resizedWidth - 1));
+    ix = (int)sx;
+    sx -= ix;
+  }
+  if (y < resizedHeight - 1 && height > 1) {
+    sy = y * ((float)(height - 1) / (resizedHeight - 1));
+    iy = (int)sy;
+    sy -= iy;
+  }
+  int ix1 = ix + 1 < width ? ix + 1 : ix;
+  int iy1 = iy + 1 < height ? iy + 1 : iy;
+  const unsigned char* row0 = pixels + iy * step;
+  const unsigned char* row1 = pixels + iy1 * step;
+
+  for (int k = 0; k < 3; ++k) {
+    float top_value = (1 - sx) * row0[ix * 3 + k] + sx * row0[ix1 * 3 + k];
+    float bottom_value = (1 - sx) * row1[ix * 3 + k] + sx * row1[ix1 * 3 + k];
+    input[i + k * plane] = ((1 - sy) * top_value + sy * bottom_value) * (1.f / 255.f);
+  }
+}
+
+void letterboxBgr8Gpu(const unsigned char* pixels, int width, int height, int step, Bgr8BufferGpu& buffer, float* input,
+                      int netWidth, int netHeight) {
+  size_t size = (size_t)step * height;
+  if (!buffer.uploaded) check_error(cudaEventCreateWithFlags(&buffer.uploaded, cudaEventDisableTiming));
+  // The upload of the previous image out of the staging buffer before it is overwritten.
+  check_error(cudaEventSynchronize(buffer.uploaded));
+  if (size > buffer.size) {
+    if (buffer.data) check_error(cudaFree(buffer.data));
+    if (buffer.staging) check_error(cudaFreeHost(buffer.staging));
+    check_error(cudaMalloc((void**)&buffer.data, size));
+    check_error(cudaHostAlloc((void**)&buffer.staging, size, cudaHostAllocWriteCombined));
+    buffer.size = size;
+  }
+  memcpy(buffer.staging, pixels, size);
+  check_error(cudaMemcpyAsync(buffer.data, buffer.staging, size, cudaMemcpyHostToDevice, cudaStreamPerThread));
+  check_error(cudaEventRecord(buffer.uploaded, cudaStreamPerThread));
+
+  // As letterbox_image_into.
+  int resizedWidth = width;
+  int resizedHeight = height;
+  if (((float)netWidth / width) < ((float)netHeight / height)) {
+    resizedWidth = netWidth;
+    resizedHeight = (height * netWidth) / width;
+  } else {
+    resizedHeight = netHeight;
+    resizedWidth = (width * netHeight) / height;
+  }
+
+  size_t n = (size_t)netWidth * netHeight;
+  letterboxBgr8Kernel<<<cuda_gridsize(n), BLOCK>>>(buffer.data, width, height, step, input, netWidth, netHeight, resizedWidth,
+                                                   resizedHeight, (netWidth - resizedWidth) / 2, (netHeight - resizedHeight) / 2);
+  check_error(cudaPeekAtLastError());
+}
+
+void freeBgr8BufferGpu(Bgr8BufferGpu& buffer) {
+  if (buffer.uploaded) check_error(cudaEventSynchronize(buffer.uploaded));
+  if (buffer.data) check_error(cudaFree(buffer.data));
+  if (buffer.staging) check_error(cudaFreeHost(buffer.staging));
+  if (buffer.uploaded) check_error(cudaEventDestroy(buffer.uploaded));
+  buffer.data = nullptr;
+  buffer.staging = nullptr;
+  buffer.size = 0;
+  buffer.uploaded = nullptr;
+}
+
+} /* namespace darknet_ros*/
@@ -0,0 +1,218 @@
+/*
+ * yolo_benchmark.cpp
+ *
+ *  Detects the images of a directory with each backend and reports the
+ *  latencies of the preprocessing, the forward pass and the decoding, over
+ *  as many passes as asked, the first one a warm-up left out, and how far
+ *  the detections of the other backends are from those of darknet in FP32.
+ *  The INT8 backend calibrates on the images, or on those of calibration,
+ *  a directory or a bag.
+ *
+ *  darknet_ros_benchmark <cfg> <weights> <images> [passes] [backends] [calibration]
+ */
+
+// c++
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+
+#include "darknet_ros/InferenceBackend.hpp"
+#include "darknet_ros/Int8Backend.hpp"
+#include "darknet_ros/LatencyStats.hpp"
+#ifdef DARKNET_ROS_TENSORRT
+#include "darknet_ros/TensorRtBackend.hpp"
+#endif
+
+extern "C" {
+#include "box.h"
+#include "image.h"
+#include "parser.h"
+}
+
+using namespace darknet_ros;
+
+namespace {
+
+void report(const char* backend, const char* stage, LatencyStats& stats) {
+  LatencySummary s = stats.take();
+  printf("%-10s %-16s %6lu  mean %8.2f  p50 %8.2f  p90 %8.2f  p99 %8.2f  max %8.2f ms\n", backend, stage, (unsigned long)s.count,
+         s.mean, s.p50, s.p90, s.p99, s.max);
+}
+
+struct Detection {
+  box bbox;
+  int cls;
+};
+
+// The detections above thresh, each of its most probable class.
+std::vector<Detection> detect(network* net, const image& im, float thresh, float hier, float nms) {
+  layer output = net->layers[net->n - 1];
+  int nboxes = 0;
+  detection* dets = get_network_boxes(net, im.w, im.h, thresh, hier, 0, 1, &nboxes);
+  if (nms > 0) do_nms_obj(dets, nboxes, output.classes, nms);
+  std::vector<Detection> found;
+  for (int i = 0; i < nboxes; ++i) {
+    int best = -1;
+    for (int j = 0; j < dets[i].classes; ++j) {
+      if (dets[i].prob[j] > thresh && (best < 0 || dets[i].prob[j] > dets[i].prob[best])) best = j;
+    }
+    if (best >= 0) found.push_back({dets[i].bbox, best});
+  }
+  free_detections(dets, nboxes);
+  return found;
+}
+
+// Detections matched greedily to the reference ones of their class at an IoU of .5 at least.
+struct Agreement {
+  int matched = 0, detected = 0, reference = 0;
+  double iou = 0;
+
+  void add(const std::vector<Detection>& found, const std::vector<Detection>& truth) {
+    std::vector<bool> taken(truth.size(), false);
+    for (const Detection& d : found) {
+      int best = -1;
+      float bestIou = .5;
+      for (size_t t = 0; t < truth.size(); ++t) {
+        if (taken[t] || truth[t].cls != d.cls) continue;
+        float overlap = box_iou(d.bbox, truth[t].bbox);
+        if (overlap >= bestIou) {
+          best = t;
+          bestIou = overlap;
+        }
+      }
+      if (best < 0) continue;
+      taken[best] = true;
+      ++matched;
+      iou += bestIou;
+    }
+    detected += found.size();
+    reference += truth.size();
+  }
+};
+
+void report(const char* backend, const Agreement& a) {
+  printf("%-10s %-16s recall %6.2f%%  precision %6.2f%%  mean IoU %5.3f  (%d of %d detections of darknet FP32)\n", backend,
+         "Accuracy", a.reference ? 100. * a.matched / a.reference : 100., a.detected ? 100. * a.matched / a.detected : 100.,
+         a.matched ? a.iou / a.matched : 0., a.matched, a.reference);
+}
+
+std::unique_ptr<InferenceBackend> makeBackend(const std::string& name, network* net, const char* cfg, const char* weights,
+                                              const char* calibration) {
+  if (name == "darknet") return std::unique_ptr<InferenceBackend>(new DarknetBackend(net));
+  if (name == "int8") {
+    Int8Options options;
+    options.calibration = calibration;
+    options.weightsFile = weights;
+    return std::unique_ptr<InferenceBackend>(new Int8Backend(net, options));
+  }
+#ifdef DARKNET_ROS_TENSORRT
+  if (name == "tensorrt") {
+    TensorRtOptions options;
+    options.configFile = cfg;
+    options.weightsFile = weights;
+    return std::unique_ptr<InferenceBackend>(new TensorRtBackend(net, options));
+  }
+#endif
+  return nullptr;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    fprintf(stderr, "usage: %s <cfg> <weights> <images> [passes] [backends, comma separated] [calibration]\n", argv[0]);
+    return 1;
+  }
+  char* cfg = argv[1];
+  char* weights = argv[2];
+  int passes = argc > 4 ? atoi(argv[4]) : 3;
+  std::string backends = argc > 5 ? argv[5] : "darknet";
+  const char* calibration = argc > 6 ? argv[6] : argv[3];
+#ifdef DARKNET_ROS_TENSORRT
+  if (argc <= 5) backends += ",tensorrt";
+#endif
+
+  std::vector<cv::String> files;
+  std::vector<image> images;
+  cv::glob(std::string(argv[3]) + "/*", files);
+  for (const cv::String& file : files) {
+    std::string extension = file.substr(file.find_last_of('.') + 1);
+    if (extension == "jpg" || extension == "jpeg" || extension == "png") {
+      images.push_back(load_image_color(const_cast<char*>(file.c_str()), 0, 0));
+    }
+  }
+  if (images.empty()) {
+    fprintf(stderr, "No jpg or png images in %s\n", argv[3]);
+    return 1;
+  }
+
+  network* net = load_network(cfg, weights, 0);
+  set_batch_network(net, 1);
+  fuse_batchnorm_network(net);
+  share_network_outputs(net);
+  image letter = make_image(net->w, net->h, net->c);
+  float thresh = .3, hier = .5, nms = .4;
+
+  std::vector<std::vector<Detection> > reference;
+  DarknetBackend darknet(net);
+  for (const image& im : images) {
+    letterbox_image_into(im, net->w, net->h, letter);
+    darknet.predict(letter.data, nullptr);
+    reference.push_back(detect(net, im, thresh, hier, nms));
+  }
+
+  std::stringstream names(backends);
+  std::string name;
+  while (std::getline(names, name, ',')) {
+    std::unique_ptr<InferenceBackend> backend;
+    try {
+      backend = makeBackend(name, net, cfg, weights, calibration);
+    } catch (const std::exception& e) {
+      fprintf(stderr, "%s backend failed: %s\n", name.c_str(), e.what());
+      continue;
+    }
+    if (!backend) {
+      fprintf(stderr, "Unknown backend %s\n", name.c_str());
+      continue;
+    }
+    LatencyStats preprocess, forward, decode, total;
+    Agreement agreement;
+    for (int pass = 0; pass <= passes; ++pass) {
+      for (size_t i = 0; i < images.size(); ++i) {
+        const image& im = images[i];
+        double start = what_time_is_it_now();
+        letterbox_image_into(im, net->w, net->h, letter);
+        double preprocessed = what_time_is_it_now();
+        backend->predict(letter.data, nullptr);
+        double forwarded = what_time_is_it_now();
+        std::vector<Detection> found = detect(net, im, thresh, hier, nms);
+        double decoded = what_time_is_it_now();
+        if (pass == 0) {
+          agreement.add(found, reference[i]);
+          continue;
+        }
+        preprocess.add(preprocessed - start);
+        forward.add(forwarded - preprocessed);
+        decode.add(decoded - forwarded);
+        total.add(decoded - start);
+      }
+    }
+    report(backend->name(), "Preprocess", preprocess);
+    report(backend->name(), "Forward", forward);
+    report(backend->name(), "Decode and NMS", decode);
+    report(backend->name(), "Total", total);
+    if (name != "darknet") report(backend->name(), agreement);
+  }
+
+  for (image& im : images) free_image(im);
+  free_image(letter);
+  free_network(net);
+  return 0;
+}
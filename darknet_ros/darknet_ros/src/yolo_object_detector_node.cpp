@@ -14,6 +14,8 @@ int main(int argc, char** argv) {
   ros::NodeHandle nodeHandle("~");
   darknet_ros::YoloObjectDetector yoloObjectDetector(nodeHandle);
 
+  // The callbacks, of the images in particular.
+  thread_config::configure(nodeHandle, "spinner");
   ros::spin();
   return 0;
 }
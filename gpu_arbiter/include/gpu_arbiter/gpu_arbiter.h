@@ -0,0 +1,78 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#ifndef GPU_ARBITER_GPU_ARBITER_H
+#define GPU_ARBITER_GPU_ARBITER_H
+
+// The GPU shared by the nodes of a process (a nodelet manager): the HIGH
+// clients, the lidar clustering, get it as soon as the LOW clients, the YOLO
+// forward passes, reach their next checkpoint, e.g. the end of a layer. A
+// HIGH client of a known period also has a slot reserved around its next
+// frame, that the LOW clients do not start into. The HIGH clients thus wait
+// for one LOW part of work at most, as long as the LOW clients keep nothing
+// more queued on the GPU than until their next checkpoint.
+//
+// The arbitration is of the process only: nodes of other processes are
+// time-sliced by the driver as before.
+namespace gpu_arbiter {
+
+enum Priority { LOW, HIGH };
+
+class Client;
+
+// In ms, the window being since the last stats() of the client.
+struct Stats {
+  unsigned long grants;      // slots granted since the start
+  unsigned long preemptions; // slots a LOW client handed over at a checkpoint
+  unsigned long window_grants;
+  double wait_mean, wait_max; // queueing delay, from the request of a slot to its grant
+  double hold_mean, hold_max; // time the slot was held
+};
+
+// The client of name (kept as is: a literal) made at the first call, the same
+// one after. period is of the sensor a HIGH client runs for, in s, 0 if it has
+// none: no slot is reserved then.
+Client *client(const char *name, Priority priority, double period = 0.0);
+
+// Whether a HIGH client is in the process, the LOW ones have to stay at most
+// one checkpoint ahead of the GPU then.
+bool arbitrated();
+
+// The GPU for the client, as soon as it is its turn.
+void acquire(Client *client);
+void release(Client *client);
+
+// For a LOW client holding the GPU, its queued work being done: the GPU handed
+// over to the HIGH clients waiting for it or to their reserved slot, and back.
+// Returns whether it was.
+bool checkpoint(Client *client);
+
+Stats stats(Client *client);
+
+// The GPU from the construction to the destruction.
+class Slot {
+public:
+  explicit Slot(Client *client) : client_(client) {
+    if(client_) {
+      acquire(client_);
+    }
+  }
+  ~Slot() {
+    if(client_) {
+      release(client_);
+    }
+  }
+
+private:
+  Slot(const Slot &);
+  Slot &operator=(const Slot &);
+  Client *client_;
+};
+
+} // namespace gpu_arbiter
+
+#endif // GPU_ARBITER_GPU_ARBITER_H
@@ -0,0 +1,29 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#ifndef GPU_ARBITER_STREAMS_H
+#define GPU_ARBITER_STREAMS_H
+
+#include <cuda_runtime.h>
+
+#include "gpu_arbiter/gpu_arbiter.h"
+
+namespace gpu_arbiter {
+
+// A stream of the priority: the blocks of the kernels of a HIGH stream are
+// scheduled ahead of those queued on the other streams of the process.
+inline cudaError_t createStream(cudaStream_t *stream, Priority priority) {
+  int least, greatest;
+  if(cudaDeviceGetStreamPriorityRange(&least, &greatest) != cudaSuccess) {
+    return cudaStreamCreate(stream);
+  }
+  return cudaStreamCreateWithPriority(stream, cudaStreamDefault, priority == HIGH ? greatest : least);
+}
+
+} // namespace gpu_arbiter
+
+#endif // GPU_ARBITER_STREAMS_H
@@ -0,0 +1,242 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "gpu_arbiter/gpu_arbiter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace gpu_arbiter {
+
+typedef std::chrono::steady_clock Clock;
+
+namespace {
+
+// Of the period of a HIGH client, the lateness of its frames its slot is kept for.
+const double RESERVE_SLACK = 0.1;
+// Decay of the longest step of a LOW client per step.
+const double STEP_DECAY = 0.05;
+
+double toMs(Clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+Clock::duration fromMs(double ms) {
+  return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(ms));
+}
+
+} // namespace
+
+// Every member guarded by the mutex of the arbiter.
+class Client {
+public:
+  Client(const char *name, Priority priority, double period) :
+    name(name), priority(priority), period(period), has_request(false), step_ms(0.0), grants(0), preemptions(0) {
+    resetWindow();
+  }
+
+  void resetWindow() {
+    window_grants = 0;
+    wait_sum = wait_max = hold_sum = hold_max = 0.0;
+  }
+
+  const char *name;
+  Priority priority;
+  double period;
+  Clock::time_point requested, granted, last_checkpoint;
+  bool has_request;   // HIGH: requested is of its last frame
+  double step_ms;     // LOW: the longest time between two checkpoints, decaying
+  unsigned long grants, preemptions, window_grants;
+  double wait_sum, wait_max, hold_sum, hold_max;
+};
+
+namespace {
+
+class Arbiter {
+public:
+  static Arbiter &instance() {
+    static Arbiter arbiter;
+    return arbiter;
+  }
+
+  Client *client(const char *name, Priority priority, double period) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(size_t i = 0; i < clients_.size(); i++) {
+      if(!strcmp(clients_[i]->name, name)) {
+        return clients_[i].get();
+      }
+    }
+    clients_.emplace_back(new Client(name, priority, period));
+    if(priority == HIGH) {
+      high_clients_++;
+    }
+    return clients_.back().get();
+  }
+
+  bool arbitrated() const {
+    return high_clients_.load(std::memory_order_relaxed) > 0;
+  }
+
+  void acquire(Client *c) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    c->requested = Clock::now();
+    if(c->priority == HIGH) {
+      // the frame of a HIGH client waits for no reservation, nor for the other HIGH clients
+      c->has_request = true;
+      waiting_high_++;
+      changed_.wait(lock, [this] { return running_[LOW] == 0; });
+      waiting_high_--;
+    } else {
+      waitForTurn(lock);
+    }
+    running_[c->priority]++;
+    grant(c);
+  }
+
+  void release(Client *c) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      finish(c);
+      running_[c->priority]--;
+    }
+    changed_.notify_all();
+  }
+
+  bool checkpoint(Client *c) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Clock::time_point now = Clock::now();
+    c->step_ms = std::max(toMs(now - c->last_checkpoint), c->step_ms * (1.0 - STEP_DECAY));
+    c->last_checkpoint = now;
+    Clock::time_point until;
+    if(!waiting_high_ && !reserved(now, until)) {
+      return false;
+    }
+    finish(c);
+    running_[LOW]--;
+    c->preemptions++;
+    changed_.notify_all();
+    c->requested = now;
+    waitForTurn(lock);
+    running_[LOW]++;
+    grant(c);
+    return true;
+  }
+
+  Stats stats(Client *c) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats s;
+    s.grants = c->grants;
+    s.preemptions = c->preemptions;
+    s.window_grants = c->window_grants;
+    s.wait_mean = c->window_grants ? c->wait_sum / c->window_grants : 0.0;
+    s.wait_max = c->wait_max;
+    s.hold_mean = c->window_grants ? c->hold_sum / c->window_grants : 0.0;
+    s.hold_max = c->hold_max;
+    c->resetWindow();
+    return s;
+  }
+
+private:
+  Arbiter() : high_clients_(0), waiting_high_(0) {
+    running_[LOW] = running_[HIGH] = 0;
+  }
+
+  // The turn of a LOW client: no HIGH client on the GPU, waiting, or about to.
+  void waitForTurn(std::unique_lock<std::mutex> &lock) {
+    Clock::time_point until;
+    for(;;) {
+      if(running_[HIGH] || waiting_high_) {
+        changed_.wait(lock);
+      } else if(reserved(Clock::now(), until)) {
+        changed_.wait_until(lock, until);
+      } else {
+        return;
+      }
+    }
+  }
+
+  // Whether now is in the slot of the next frame of a HIGH client, from one
+  // step of the LOW clients before it is expected to a slack after, until
+  // the end of the slot.
+  bool reserved(Clock::time_point now, Clock::time_point &until) const {
+    double guard = 0.0;
+    for(size_t i = 0; i < clients_.size(); i++) {
+      if(clients_[i]->priority == LOW) {
+        guard = std::max(guard, clients_[i]->step_ms);
+      }
+    }
+    for(size_t i = 0; i < clients_.size(); i++) {
+      const Client &c = *clients_[i];
+      if(c.priority != HIGH || c.period <= 0.0 || !c.has_request) {
+        continue;
+      }
+      Clock::time_point next = c.requested + fromMs(c.period * 1000.0);
+      if(now >= next - fromMs(guard) && now < next + fromMs(c.period * RESERVE_SLACK * 1000.0)) {
+        until = next + fromMs(c.period * RESERVE_SLACK * 1000.0);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void grant(Client *c) {
+    Clock::time_point now = Clock::now();
+    double wait = toMs(now - c->requested);
+    c->granted = c->last_checkpoint = now;
+    c->grants++;
+    c->window_grants++;
+    c->wait_sum += wait;
+    c->wait_max = std::max(c->wait_max, wait);
+  }
+
+  void finish(Client *c) {
+    double hold = toMs(Clock::now() - c->granted);
+    c->hold_sum += hold;
+    c->hold_max = std::max(c->hold_max, hold);
+  }
+
+  std::mutex mutex_;
+  std::condition_variable changed_; // of running_ and waiting_high_
+  std::vector<std::unique_ptr<Client> > clients_;
+  std::atomic<int> high_clients_;
+  int running_[2];   // clients on the GPU, per priority
+  int waiting_high_;
+};
+
+} // namespace
+
+Client *client(const char *name, Priority priority, double period) {
+  return Arbiter::instance().client(name, priority, period);
+}
+
+bool arbitrated() {
+  return Arbiter::instance().arbitrated();
+}
+
+void acquire(Client *client) {
+  Arbiter::instance().acquire(client);
+}
+
+void release(Client *client) {
+  Arbiter::instance().release(client);
+}
+
+bool checkpoint(Client *client) {
+  return Arbiter::instance().checkpoint(client);
+}
+
+Stats stats(Client *client) {
+  return Arbiter::instance().stats(client);
+}
+
+} // namespace gpu_arbiter
@@ -0,0 +1,87 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+// Google Test
+#include <gtest/gtest.h>
+
+// c++
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "gpu_arbiter/gpu_arbiter.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double msSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// The tests share the arbiter of the process, the HIGH clients come last.
+TEST(GpuArbiter, LowClientsShareTheGpu) {
+  gpu_arbiter::Client *yolo = gpu_arbiter::client("yolo", gpu_arbiter::LOW);
+  gpu_arbiter::Client *attention = gpu_arbiter::client("attention", gpu_arbiter::LOW);
+  EXPECT_EQ(yolo, gpu_arbiter::client("yolo", gpu_arbiter::LOW));
+  EXPECT_FALSE(gpu_arbiter::arbitrated());
+  gpu_arbiter::acquire(yolo);
+  gpu_arbiter::acquire(attention);
+  EXPECT_FALSE(gpu_arbiter::checkpoint(yolo));
+  gpu_arbiter::release(attention);
+  gpu_arbiter::release(yolo);
+  gpu_arbiter::Stats stats = gpu_arbiter::stats(yolo);
+  EXPECT_EQ(1u, stats.grants);
+  EXPECT_EQ(0u, stats.preemptions);
+  EXPECT_EQ(0u, gpu_arbiter::stats(yolo).window_grants);
+}
+
+TEST(GpuArbiter, HighClientGetsTheGpuAtTheNextCheckpoint) {
+  gpu_arbiter::Client *yolo = gpu_arbiter::client("yolo", gpu_arbiter::LOW);
+  gpu_arbiter::Client *lidar = gpu_arbiter::client("lidar", gpu_arbiter::HIGH);
+  EXPECT_TRUE(gpu_arbiter::arbitrated());
+  gpu_arbiter::acquire(yolo);
+  std::atomic<bool> granted(false), released(false);
+  std::thread high([&] {
+    gpu_arbiter::Slot slot(lidar);
+    granted = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    released = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_FALSE(granted);
+  EXPECT_TRUE(gpu_arbiter::checkpoint(yolo));
+  EXPECT_TRUE(released);
+  gpu_arbiter::release(yolo);
+  high.join();
+  gpu_arbiter::Stats stats = gpu_arbiter::stats(lidar);
+  EXPECT_EQ(1u, stats.grants);
+  EXPECT_GE(stats.wait_max, 15.0);
+  EXPECT_EQ(1u, gpu_arbiter::stats(yolo).preemptions);
+}
+
+TEST(GpuArbiter, LowClientDoesNotStartIntoReservedSlot) {
+  gpu_arbiter::Client *yolo = gpu_arbiter::client("yolo", gpu_arbiter::LOW);
+  gpu_arbiter::Client *scan = gpu_arbiter::client("scan", gpu_arbiter::HIGH, 0.2);
+  Clock::time_point start = Clock::now();
+  {
+    gpu_arbiter::Slot slot(scan);
+  }
+  // the next scan is expected at 200 ms, its slot kept until 220 ms
+  std::this_thread::sleep_for(std::chrono::milliseconds(205));
+  gpu_arbiter::acquire(yolo);
+  EXPECT_GE(msSince(start), 219.0);
+  gpu_arbiter::release(yolo);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  Clock::time_point free = Clock::now();
+  gpu_arbiter::acquire(yolo);
+  EXPECT_LT(msSince(free), 5.0);
+  gpu_arbiter::release(yolo);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
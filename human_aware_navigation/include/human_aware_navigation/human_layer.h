@@ -0,0 +1,70 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#ifndef HUMAN_AWARE_NAVIGATION_HUMAN_LAYER_H
+#define HUMAN_AWARE_NAVIGATION_HUMAN_LAYER_H
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <bayes_people_tracker/TrackStates.h>
+#include <costmap_2d/layer.h>
+#include <ros/ros.h>
+
+#include "human_aware_navigation/social_kernels.h"
+
+namespace human_aware_navigation {
+
+// The people of bayes_people_tracker in the costmap, from its track states
+// (~topic), each one the precomputed kernel of their velocity bin stamped at
+// their cell. Only the cells of the people who moved to another cell or bin,
+// came or left are updated: their old and new kernels are the bounds of the
+// layer, the other people are stamped again only where they overlap them.
+class HumanLayer : public costmap_2d::Layer {
+public:
+  HumanLayer();
+
+  virtual void onInitialize();
+  virtual void updateBounds(double robot_x, double robot_y, double robot_yaw, double *min_x, double *min_y, double *max_x, double *max_y);
+  virtual void updateCosts(costmap_2d::Costmap2D &master_grid, int min_i, int min_j, int max_i, int max_j);
+  virtual void matchSize();
+  virtual void reset();
+
+private:
+  struct Person {
+    double x, y;   // in the global frame of the costmap
+    double vx, vy;
+  };
+  // A person as stamped: the centre of their cell and the kernel.
+  struct Stamp {
+    double x, y;
+    int kernel;
+  };
+
+  void trackStatesCallback(const bayes_people_tracker::TrackStates::ConstPtr &msg);
+  // The world bounds of a stamp expanded by it.
+  void touch(const Stamp &stamp, double *min_x, double *min_y, double *max_x, double *max_y) const;
+  // Every stamp to be updated, from the next tracks on.
+  void clearStamps(double *min_x, double *min_y, double *max_x, double *max_y);
+
+  ros::Subscriber sub_;
+  double track_timeout_;
+  SocialKernels kernels_;
+
+  std::mutex mutex_;                 // of the next tracks, from the callback
+  std::map<long, Person> pending_;
+  bool has_pending_;
+  ros::Time last_states_;
+
+  std::map<long, Stamp> stamps_;     // by track ID, as in the master grid
+  bool reset_;                       // all stamps to be updated
+};
+
+} // namespace human_aware_navigation
+
+#endif // HUMAN_AWARE_NAVIGATION_HUMAN_LAYER_H
@@ -0,0 +1,63 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#ifndef HUMAN_AWARE_NAVIGATION_SOCIAL_KERNELS_H
+#define HUMAN_AWARE_NAVIGATION_SOCIAL_KERNELS_H
+
+#include <cstddef>
+#include <vector>
+
+namespace human_aware_navigation {
+
+// The cost around a person, a Gaussian of sigma stretched ahead of them by
+// their speed: sigma + velocity_factor * speed in the direction they walk.
+struct KernelParams {
+  double amplitude = 200.0;     // cost at the person
+  double sigma = 0.4;           // m
+  double velocity_factor = 1.0; // s
+  double max_speed = 1.5;       // m/s, faster people get the kernel of the last bin
+  int speed_bins = 6;           // the first one of the people standing
+  int heading_bins = 16;
+  double cutoff = 10.0;         // lower costs are not stamped
+};
+
+// The cells of a kernel, row-major, the person in the cell (0, 0): cell (i, j)
+// of the kernel is (offset_x + i, offset_y + j) from them.
+struct SocialKernel {
+  int offset_x, offset_y;
+  int width, height;
+  std::vector<unsigned char> costs;
+};
+
+// The kernels of every velocity bin, computed once for the resolution of the
+// costmap: stamping a person is a copy of the kernel of their bin, with no
+// exp() per cell and per update.
+class SocialKernels {
+public:
+  explicit SocialKernels(const KernelParams &params = KernelParams());
+
+  // The kernels of cells of resolution m, 0 before the first build.
+  void build(double resolution);
+  double resolution() const { return resolution_; }
+
+  // The kernel of a velocity: the standing one under half a speed bin, else
+  // that of the nearest speed and heading bins.
+  int index(double vx, double vy) const;
+  const SocialKernel &kernel(int index) const { return kernels_[index]; }
+  size_t size() const { return kernels_.size(); }
+
+private:
+  SocialKernel compute(double speed, double heading) const;
+
+  KernelParams params_;
+  double resolution_;
+  std::vector<SocialKernel> kernels_;
+};
+
+} // namespace human_aware_navigation
+
+#endif // HUMAN_AWARE_NAVIGATION_SOCIAL_KERNELS_H
@@ -0,0 +1,77 @@
+#!/usr/bin/env python
+
+import struct
+import time
+from os import makedirs
+from os.path import dirname, exists
+
+import rospy
+from diagnostic_msgs.msg import DiagnosticArray
+
+class CrowdBenchmark(object):
+    """The throughput and the latency of the outputs of a stage, while a bag
+    of crowd_generator.py is played: one line per topic appended to ~output
+    at shutdown."""
+
+    def __init__(self):
+        # ROS
+        rospy.init_node('crowd_benchmark')
+        # Labels of the run, c.f. crowd_benchmark.launch
+        self.stage = rospy.get_param('~stage', '')
+        self.people = rospy.get_param('~people', 0)
+        # The outputs of the stage, every one of them starting with a std_msgs/Header
+        self.topics = rospy.get_param('~topics', ['/people_tracker/track_states'])
+        # The diagnostics of the stage, their last report kept, e.g. "object3d_detector_gpu: latency"
+        self.diagnostics = rospy.get_param('~diagnostics', [])
+        self.output = rospy.get_param('~output', dirname(__file__) + '/metrics/crowd_benchmark.csv')
+        # Per topic: the wall time of the messages and their latency, ros time (the clock of the bag) to their stamp
+        self.arrivals = dict((topic, []) for topic in self.topics)
+        self.latencies = dict((topic, []) for topic in self.topics)
+        self.reports = {}
+        for topic in self.topics:
+            # only the header deserialized, whatever the type
+            rospy.Subscriber(topic, rospy.AnyMsg, self.callback_output, topic, queue_size=100)
+        if self.diagnostics:
+            rospy.Subscriber('/diagnostics', DiagnosticArray, self.callback_diagnostics)
+        rospy.on_shutdown(self.write_metric)
+
+    def callback_output(self, msg, topic):
+        now = rospy.get_rostime()
+        seq, secs, nsecs = struct.unpack('<III', msg._buff[:12])
+        self.arrivals[topic].append(time.time())
+        self.latencies[topic].append((now - rospy.Time(secs, nsecs)).to_sec() * 1000.0)
+
+    def callback_diagnostics(self, msg):
+        for status in msg.status:
+            if status.name in self.diagnostics:
+                self.reports[status.name] = ', '.join(kv.key + ' = ' + kv.value for kv in status.values)
+
+    @staticmethod
+    def percentile(values, p):
+        if not values:
+            return float('nan')
+        ordered = sorted(values)
+        return ordered[min(int(p / 100.0 * len(ordered)), len(ordered) - 1)]
+
+    def write_metric(self):
+        folder = dirname(self.output)
+        if folder and not exists(folder):
+            makedirs(folder)
+        new = not exists(self.output)
+        with open(self.output, 'a') as f:
+            if new:
+                f.write('stage,people,topic,messages,rate_hz,latency_p50_ms,latency_p90_ms,latency_p99_ms,diagnostics\n')
+            diagnostics = '; '.join(name + ': ' + report for name, report in sorted(self.reports.items()))
+            for topic in self.topics:
+                arrivals = self.arrivals[topic]
+                period = arrivals[-1] - arrivals[0] if len(arrivals) > 1 else 0.0
+                rate = (len(arrivals) - 1) / period if period > 0.0 else 0.0
+                latencies = self.latencies[topic]
+                f.write('%s,%d,%s,%d,%.2f,%.2f,%.2f,%.2f,"%s"\n' % (self.stage, self.people, topic, len(arrivals), rate,
+                        self.percentile(latencies, 50), self.percentile(latencies, 90), self.percentile(latencies, 99),
+                        diagnostics.replace('"', "'")))
+        rospy.loginfo('Benchmark of %s with %d people written to %s', self.stage, self.people, self.output)
+
+if __name__ == '__main__':
+    CrowdBenchmark()
+    rospy.spin()
@@ -0,0 +1,386 @@
+#!/usr/bin/env python
+
+import argparse
+import math
+import sys
+
+import numpy as np
+import rosbag
+import rospy
+from darknet_ros_msgs.msg import BoundingBox, BoundingBoxes
+from geometry_msgs.msg import TransformStamped
+from people_msgs.msg import People, Person, PositionMeasurement, PositionMeasurementArray
+from sensor_msgs.msg import CameraInfo, Image, PointCloud2, PointField
+from tf2_msgs.msg import TFMessage
+
+# The sensors of the robot (base_link on the ground), c.f. the static
+# transforms of human_aware_navigation.launch
+LIDAR_HEIGHT = 0.627
+CAMERA_X = 0.106
+CAMERA_HEIGHT = 0.327
+# RS-LiDAR-16: 16 rings from -15 to 15 degrees, 0.2 degree per column at 10 Hz
+LIDAR_RINGS = np.radians(np.linspace(-15.0, 15.0, 16))
+LIDAR_COLUMNS = 1800
+LIDAR_MAX_RANGE = 50.0
+# RealSense D435 color, the depth aligned to it
+CAMERA_WIDTH, CAMERA_HEIGHT_PX = 640, 480
+CAMERA_FX = CAMERA_FY = 615.0
+CAMERA_CX, CAMERA_CY = 320.0, 240.0
+CAMERA_MAX_DEPTH = 10.0
+# Hits kept per ray, the nearest ones: enough for a person seen over a shorter one
+RAY_HITS = 4
+# Intensities of the lidar, colors of the camera
+PERSON_INTENSITY, CLUTTER_INTENSITY, GROUND_INTENSITY = 30.0, 80.0, 10.0
+CLUTTER_COLOR, GROUND_COLOR, BACKGROUND_COLOR = 120, 90, 200
+
+PATTERNS = ['random', 'corridor', 'crossing', 'standing']
+OUTPUTS = ['lidar', 'camera', 'boxes', 'measurements']
+
+
+class Crowd(object):
+    """People as vertical cylinders walking in a square of area m around the
+    robot, and static clutter (poles, bins, walls ends) as other cylinders."""
+
+    def __init__(self, people, pattern, area, clutter, rng):
+        self.rng = rng
+        self.pattern = pattern
+        self.half = area / 2.0
+        self.radius = rng.uniform(0.2, 0.3, people)
+        self.height = rng.uniform(1.5, 1.9, people)
+        self.speed = rng.uniform(0.5, 1.5, people)
+        self.position = self.free_positions(people)
+        self.goal = self.free_positions(people)
+        # the side of a band of the corridor and of the crossing flows
+        band = min(2.0, self.half)
+        direction = np.where(rng.uniform(size=people) < 0.5, -1.0, 1.0)
+        self.velocity = np.zeros((people, 2))
+        if pattern == 'corridor':
+            self.position[:, 1] = rng.uniform(-band, band, people)
+            self.velocity[:, 0] = direction * self.speed
+        elif pattern == 'crossing':
+            across = np.arange(people) % 2 == 1
+            self.position[~across, 1] = rng.uniform(-band, band, np.count_nonzero(~across))
+            self.position[across, 0] = rng.uniform(-band, band, np.count_nonzero(across))
+            self.velocity[~across, 0] = direction[~across] * self.speed[~across]
+            self.velocity[across, 1] = direction[across] * self.speed[across]
+        self.clutter_position = self.free_positions(clutter)
+        self.clutter_radius = rng.uniform(0.05, 0.5, clutter)
+        self.clutter_height = rng.uniform(0.5, 2.5, clutter)
+
+    def free_positions(self, n):
+        # not on the robot
+        positions = self.rng.uniform(-self.half, self.half, (n, 2))
+        near = np.hypot(positions[:, 0], positions[:, 1]) < 1.0
+        while np.any(near):
+            positions[near] = self.rng.uniform(-self.half, self.half, (np.count_nonzero(near), 2))
+            near = np.hypot(positions[:, 0], positions[:, 1]) < 1.0
+        return positions
+
+    def step(self, dt):
+        if self.pattern == 'standing':
+            return
+        if self.pattern == 'random':
+            # towards their goal, a new one once there
+            to_goal = self.goal - self.position
+            distance = np.hypot(to_goal[:, 0], to_goal[:, 1])
+            arrived = distance < 0.5
+            self.goal[arrived] = self.free_positions(np.count_nonzero(arrived))
+            to_goal = self.goal - self.position
+            distance = np.maximum(np.hypot(to_goal[:, 0], to_goal[:, 1]), 1e-6)
+            self.velocity = to_goal * (self.speed / distance)[:, None]
+        self.position += self.velocity * dt
+        # the flows come back on the other side of the area
+        if self.pattern in ('corridor', 'crossing'):
+            self.position = (self.position + self.half) % (2.0 * self.half) - self.half
+
+    def cylinders(self):
+        """Centres, radii, heights and IDs of all the cylinders, -1 for the clutter."""
+        centres = np.vstack((self.position, self.clutter_position))
+        radii = np.concatenate((self.radius, self.clutter_radius))
+        heights = np.concatenate((self.height, self.clutter_height))
+        ids = np.concatenate((np.arange(len(self.radius)), -np.ones(len(self.clutter_radius), dtype=int)))
+        return centres, radii, heights, ids
+
+
+def cast(origin, directions, centres, radii):
+    """The nearest RAY_HITS cylinders along the horizontal unit directions
+    from origin: their distances (inf for none) and indices, nearest first."""
+    oc = centres - origin
+    b = directions.dot(oc.T)
+    disc = radii[None, :] ** 2 - (np.sum(oc ** 2, axis=1)[None, :] - b ** 2)
+    with np.errstate(invalid='ignore'):
+        t = b - np.sqrt(disc)
+    t[~(disc >= 0.0) | (t <= 0.0)] = np.inf
+    k = min(RAY_HITS, t.shape[1])
+    index = np.argsort(t, axis=1)[:, :k]
+    return t[np.arange(len(directions))[:, None], index], index
+
+
+def first_hit(t, z, heights):
+    """Of every ray, the first of its hits whose height z is on its cylinder:
+    whether there is one, and which."""
+    hit = np.isfinite(t) & (z >= 0.0) & (z <= heights)
+    return hit.any(axis=1), hit.argmax(axis=1)
+
+
+def render_lidar(crowd, rng):
+    """An organized cloud of the rings, PointXYZI as rslidar_pointcloud, NaN
+    where no return."""
+    centres, radii, heights, ids = crowd.cylinders()
+    azimuth = np.linspace(0.0, 2.0 * math.pi, LIDAR_COLUMNS, endpoint=False)
+    directions = np.stack((np.cos(azimuth), np.sin(azimuth)), axis=1)
+    t, index = cast(np.zeros(2), directions, centres, radii)
+    columns = np.arange(LIDAR_COLUMNS)
+    points = np.full((len(LIDAR_RINGS), LIDAR_COLUMNS, 8), np.nan, dtype=np.float32)
+    for ring, elevation in enumerate(LIDAR_RINGS):
+        z = LIDAR_HEIGHT + t * math.tan(elevation)
+        hit, first = first_hit(t, z, heights[index])
+        distance = np.where(hit, t[columns, first], np.inf)
+        intensity = np.where(ids[index[columns, first]] >= 0, PERSON_INTENSITY, CLUTTER_INTENSITY)
+        if elevation < 0.0:
+            ground = LIDAR_HEIGHT / math.tan(-elevation)
+            intensity = np.where(hit, intensity, GROUND_INTENSITY)
+            distance = np.where(hit, distance, ground)
+        distance = distance + rng.normal(0.0, 0.01, LIDAR_COLUMNS)
+        ok = np.isfinite(distance) & (distance < LIDAR_MAX_RANGE)
+        points[ring, ok, 0] = distance[ok] * directions[ok, 0]
+        points[ring, ok, 1] = distance[ok] * directions[ok, 1]
+        points[ring, ok, 2] = distance[ok] * math.tan(elevation)
+        points[ring, ok, 4] = intensity[ok]
+    return points
+
+
+def render_camera(crowd):
+    """The depth in mm (0 for none), the color and the ID of the person of
+    every pixel (-1 for none), the camera looking along x."""
+    centres, radii, heights, ids = crowd.cylinders()
+    u = np.arange(CAMERA_WIDTH) + 0.5
+    lateral = -(u - CAMERA_CX) / CAMERA_FX
+    norm = np.sqrt(1.0 + lateral ** 2)
+    directions = np.stack((1.0 / norm, lateral / norm), axis=1)
+    t, index = cast(np.array([CAMERA_X, 0.0]), directions, centres, radii)
+    forward = t * directions[:, 0:1]
+    columns = np.arange(CAMERA_WIDTH)
+    depth = np.zeros((CAMERA_HEIGHT_PX, CAMERA_WIDTH), dtype=np.uint16)
+    color = np.full((CAMERA_HEIGHT_PX, CAMERA_WIDTH, 3), BACKGROUND_COLOR, dtype=np.uint8)
+    label = np.full((CAMERA_HEIGHT_PX, CAMERA_WIDTH), -1, dtype=int)
+    palette = np.array([[(37 * i) % 256, (91 * i + 60) % 256, (157 * i + 120) % 256] for i in range(max(len(crowd.radius), 1))], dtype=np.uint8)
+    for row in range(CAMERA_HEIGHT_PX):
+        slope = -(row + 0.5 - CAMERA_CY) / CAMERA_FY
+        z = CAMERA_HEIGHT + forward * slope
+        hit, first = first_hit(t, z, heights[index])
+        d = np.where(hit, forward[columns, first], np.inf)
+        who = np.where(hit, ids[index[columns, first]], -1)
+        if slope < 0.0:
+            ground = CAMERA_HEIGHT / -slope
+            d = np.where(hit, d, ground)
+            color[row, ~hit] = GROUND_COLOR
+        ok = d < CAMERA_MAX_DEPTH
+        depth[row, ok] = (d[ok] * 1000.0).astype(np.uint16)
+        color[row, hit & (who < 0)] = CLUTTER_COLOR
+        people = who >= 0
+        color[row, people] = palette[who[people]]
+        label[row, people] = who[people]
+    return depth, color, label
+
+
+def detect_boxes(crowd, label):
+    """The boxes of the people in the image, as YOLO would: the projection of
+    their cylinder, with the part of it they are seen of as probability."""
+    boxes = []
+    for i in range(len(crowd.radius)):
+        forward = crowd.position[i, 0] - CAMERA_X
+        if forward < 0.3:
+            continue
+        u = CAMERA_CX - CAMERA_FX * (crowd.position[i, 1] + np.array([crowd.radius[i], -crowd.radius[i]])) / forward
+        v = CAMERA_CY - CAMERA_FY * (np.array([crowd.height[i], 0.0]) - CAMERA_HEIGHT) / forward
+        xmin, xmax = int(max(u[0], 0)), int(min(u[1], CAMERA_WIDTH - 1))
+        ymin, ymax = int(max(v[0], 0)), int(min(v[1], CAMERA_HEIGHT_PX - 1))
+        if xmax <= xmin or ymax <= ymin:
+            continue
+        area = (u[1] - u[0]) * (v[1] - v[0])
+        visible = np.count_nonzero(label[ymin:ymax + 1, xmin:xmax + 1] == i) / area
+        if visible < 0.2:
+            continue
+        box = BoundingBox()
+        box.probability = min(0.5 + 0.5 * visible, 1.0)
+        box.xmin, box.ymin, box.xmax, box.ymax = xmin, ymin, xmax, ymax
+        box.id = 0
+        box.Class = 'person'
+        boxes.append(box)
+    return boxes
+
+
+def detect_measurements(crowd, args, rng):
+    """The people in range, at their centroid in the lidar frame, with noise,
+    misses and false positives."""
+    measurements = []
+    distance = np.hypot(crowd.position[:, 0], crowd.position[:, 1])
+    for i in range(len(crowd.radius)):
+        if distance[i] > args.detection_range or rng.uniform() > args.detection_probability:
+            continue
+        measurements.append((crowd.position[i] + rng.normal(0.0, args.measurement_noise, 2), crowd.height[i] / 2.0))
+    for _ in range(rng.poisson(args.false_positives)):
+        measurements.append((rng.uniform(-crowd.half, crowd.half, 2), rng.uniform(0.3, 1.2)))
+    people = []
+    for position, z in measurements:
+        pm = PositionMeasurement()
+        pm.name = 'person'
+        pm.pos.x, pm.pos.y = position
+        pm.pos.z = z - LIDAR_HEIGHT
+        pm.reliability = 1.0
+        pm.covariance = [args.measurement_noise ** 2, 0.0, 0.0, 0.0, args.measurement_noise ** 2, 0.0, 0.0, 0.0, 0.0]
+        people.append(pm)
+    return people
+
+
+def cloud_message(points, stamp):
+    cloud = PointCloud2()
+    cloud.header.stamp = stamp
+    cloud.header.frame_id = 'rslidar'
+    cloud.height, cloud.width = points.shape[0], points.shape[1]
+    cloud.fields = [PointField('x', 0, PointField.FLOAT32, 1), PointField('y', 4, PointField.FLOAT32, 1),
+                    PointField('z', 8, PointField.FLOAT32, 1), PointField('intensity', 16, PointField.FLOAT32, 1)]
+    cloud.is_bigendian = False
+    cloud.point_step = 32
+    cloud.row_step = cloud.point_step * cloud.width
+    cloud.data = points.tobytes()
+    cloud.is_dense = False
+    return cloud
+
+
+def image_message(data, encoding, step, stamp):
+    image = Image()
+    image.header.stamp = stamp
+    image.header.frame_id = 'camera_color_optical_frame'
+    image.height, image.width = data.shape[0], data.shape[1]
+    image.encoding = encoding
+    image.is_bigendian = 0
+    image.step = step
+    image.data = data.tobytes()
+    return image
+
+
+def camera_info_message(stamp):
+    info = CameraInfo()
+    info.header.stamp = stamp
+    info.header.frame_id = 'camera_color_optical_frame'
+    info.width, info.height = CAMERA_WIDTH, CAMERA_HEIGHT_PX
+    info.distortion_model = 'plumb_bob'
+    info.D = [0.0] * 5
+    info.K = [CAMERA_FX, 0.0, CAMERA_CX, 0.0, CAMERA_FY, CAMERA_CY, 0.0, 0.0, 1.0]
+    info.R = [1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0]
+    info.P = [CAMERA_FX, 0.0, CAMERA_CX, 0.0, 0.0, CAMERA_FY, CAMERA_CY, 0.0, 0.0, 0.0, 1.0, 0.0]
+    return info
+
+
+def static_transforms(stamp):
+    def transform(parent, child, xyz, quaternion):
+        t = TransformStamped()
+        t.header.stamp = stamp
+        t.header.frame_id = parent
+        t.child_frame_id = child
+        t.transform.translation.x, t.transform.translation.y, t.transform.translation.z = xyz
+        t.transform.rotation.x, t.transform.rotation.y, t.transform.rotation.z, t.transform.rotation.w = quaternion
+        return t
+    # optical: z forward, x right, y down
+    return TFMessage([transform('base_link', 'rslidar', (0.0, 0.0, LIDAR_HEIGHT), (0.0, 0.0, 0.0, 1.0)),
+                      transform('base_link', 'camera_link', (CAMERA_X, 0.0, CAMERA_HEIGHT), (0.0, 0.0, 0.0, 1.0)),
+                      transform('camera_link', 'camera_color_optical_frame', (0.0, 0.0, 0.0), (-0.5, 0.5, -0.5, 0.5))])
+
+
+def ground_truth_message(crowd, stamp):
+    people = People()
+    people.header.stamp = stamp
+    people.header.frame_id = 'base_link'
+    for i in range(len(crowd.radius)):
+        person = Person()
+        person.name = str(i)
+        person.position.x, person.position.y = crowd.position[i]
+        person.position.z = crowd.height[i] / 2.0
+        person.velocity.x, person.velocity.y = crowd.velocity[i]
+        person.reliability = 1.0
+        people.people.append(person)
+    return people
+
+
+def generate(args):
+    rng = np.random.RandomState(args.seed)
+    crowd = Crowd(args.people, args.pattern, args.area, args.clutter, rng)
+    rates = {'lidar': args.lidar_rate, 'camera': args.camera_rate, 'boxes': args.camera_rate, 'measurements': args.measurement_rate}
+    outputs = [output for output in args.outputs if rates[output] > 0.0]
+    # the crowd moves at the rate of the fastest stream, each one at its own
+    dt = 1.0 / max(rates[output] for output in outputs)
+    steps = int(round(args.duration / dt))
+    next_time = dict((output, 0.0) for output in outputs)
+    start = rospy.Time.from_sec(args.start)
+
+    with rosbag.Bag(args.bag, 'w') as bag:
+        bag.write('/tf_static', static_transforms(start), start, connection_header={'latching': '1'})
+        for step in range(steps):
+            time = step * dt
+            stamp = start + rospy.Duration.from_sec(time)
+            due = [output for output in outputs if time + 1e-9 >= next_time[output]]
+            for output in due:
+                next_time[output] += 1.0 / rates[output]
+            if due:
+                bag.write('/crowd/ground_truth', ground_truth_message(crowd, stamp), stamp)
+            if 'lidar' in due:
+                bag.write('/rslidar_points', cloud_message(render_lidar(crowd, rng), stamp), stamp)
+            if 'camera' in due or 'boxes' in due:
+                depth, color, label = render_camera(crowd)
+                if 'camera' in due:
+                    bag.write('/camera/color/image_raw', image_message(color, 'rgb8', 3 * CAMERA_WIDTH, stamp), stamp)
+                    bag.write('/camera/aligned_depth_to_color/image_raw', image_message(depth, '16UC1', 2 * CAMERA_WIDTH, stamp), stamp)
+                    bag.write('/camera/aligned_depth_to_color/camera_info', camera_info_message(stamp), stamp)
+                if 'boxes' in due:
+                    boxes = BoundingBoxes()
+                    boxes.header.stamp = stamp
+                    boxes.header.frame_id = 'detection'
+                    boxes.image_header.stamp = stamp
+                    boxes.image_header.frame_id = 'camera_color_optical_frame'
+                    boxes.bounding_boxes = detect_boxes(crowd, label)
+                    bag.write('/darknet_ros/bounding_boxes', boxes, stamp)
+            if 'measurements' in due:
+                pma = PositionMeasurementArray()
+                pma.header.stamp = stamp
+                pma.header.frame_id = 'rslidar'
+                pma.people = detect_measurements(crowd, args, rng)
+                bag.write('/object3d_detector_gpu/measurements', pma, stamp)
+            crowd.step(dt)
+            if args.verbose and step % int(round(1.0 / dt)) == 0:
+                sys.stdout.write('\r%.0f / %.0f s' % (time, args.duration))
+                sys.stdout.flush()
+    if args.verbose:
+        sys.stdout.write('\n')
+
+
+def parse_args(argv):
+    parser = argparse.ArgumentParser(description='Writes a bag of a synthetic crowd around the robot, as its sensors and detectors see it.')
+    parser.add_argument('bag', help='the bag written')
+    parser.add_argument('--people', type=int, default=50)
+    parser.add_argument('--pattern', choices=PATTERNS, default='random',
+                        help='random: to random goals; corridor: both ways along x; crossing: along x and along y; standing: still')
+    parser.add_argument('--area', type=float, default=20.0, help='side in m of the square around the robot the people walk in')
+    parser.add_argument('--clutter', type=int, default=20, help='static objects, poles and bins')
+    parser.add_argument('--duration', type=float, default=60.0, help='s')
+    parser.add_argument('--outputs', nargs='+', choices=OUTPUTS, default=['lidar'],
+                        help='lidar: /rslidar_points; camera: color and aligned depth; boxes: /darknet_ros/bounding_boxes; measurements: /object3d_detector_gpu/measurements')
+    parser.add_argument('--lidar-rate', type=float, default=10.0)
+    parser.add_argument('--camera-rate', type=float, default=15.0)
+    parser.add_argument('--measurement-rate', type=float, default=10.0)
+    parser.add_argument('--detection-range', type=float, default=15.0, help='m, of the measurements')
+    parser.add_argument('--detection-probability', type=float, default=0.9)
+    parser.add_argument('--measurement-noise', type=float, default=0.05, help='m, standard deviation')
+    parser.add_argument('--false-positives', type=float, default=0.5, help='mean per measurement message')
+    parser.add_argument('--seed', type=int, default=0)
+    parser.add_argument('--start', type=float, default=1.0, help='s, stamp of the first message')
+    parser.add_argument('--verbose', action='store_true')
+    args = parser.parse_args(argv)
+    if args.people < 1:
+        parser.error('at least one person')
+    return args
+
+
+if __name__ == '__main__':
+    generate(parse_args(rospy.myargv()[1:]))
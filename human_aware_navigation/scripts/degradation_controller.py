@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+
+import re
+import rospy
+from diagnostic_msgs.msg import DiagnosticArray
+from std_msgs.msg import UInt8
+
+# The steps of the perception stack under load, in the order they are taken:
+# each node applies its own from its level on.
+STEPS = ['full perception',
+         'YOLO rate lowered (darknet_ros detection/degraded_max_rate)',
+         'lidar ROI tightened (object3d_detector_gpu degraded_nested_regions)',
+         'lidar clusters raised (object3d_detector_gpu degraded_cluster_size_min)',
+         'tracker filter switched (bayes_people_tracker degraded_filter_type)']
+
+class DegradationController(object):
+    def __init__(self):
+        # ROS
+        rospy.init_node('degradation_controller')
+        # End-to-end latency budget in ms: the slower detector to its measurements (p90), then the tracker update (p99)
+        self.budget = rospy.get_param('~budget', 150.0)
+        # Reports over the budget before the next step, and under recover_ratio of it before the last step is undone
+        self.escalate_reports = rospy.get_param('~escalate_reports', 3)
+        self.recover_reports = rospy.get_param('~recover_reports', 10)
+        self.recover_ratio = rospy.get_param('~recover_ratio', 0.7)
+        self.max_level = min(rospy.get_param('~max_level', len(STEPS) - 1), len(STEPS) - 1)
+        self.pub_level = rospy.Publisher('/perception/degradation_level', UInt8, queue_size=1, latch=True)
+        # The latest latencies of the stages, in ms, by status
+        self.detectors = {}
+        self.tracker = 0.0
+        self.level = 0
+        self.over = 0
+        self.under = 0
+        self.publish()
+        rospy.Subscriber('/diagnostics', DiagnosticArray, self.callback_diagnostics)
+
+    @staticmethod
+    def percentile(value, name):
+        # "p50 1.00, p90 2.00, ..." of the diagnostics of object3d_detector_gpu and of bayes_people_tracker
+        match = re.search(name + r' ([0-9.]+)', value)
+        return float(match.group(1)) if match else None
+
+    def callback_diagnostics(self, msg):
+        updated = False
+        for status in msg.status:
+            values = dict((kv.key, kv.value) for kv in status.values)
+            latency = None
+            if status.name.endswith(': latency') and 'header to publish' in values:
+                latency = self.percentile(values['header to publish'], 'p90')
+            elif status.name.endswith(': yolo_latency') and 'Camera to boxes p90 (ms)' in values:
+                latency = float(values['Camera to boxes p90 (ms)'])
+            elif status.name.endswith(': tracker') and 'observation' in values:
+                observation = self.percentile(values['observation'], 'p99')
+                if observation is not None:
+                    self.tracker = observation
+                continue
+            if latency is not None:
+                self.detectors[status.name] = latency
+                updated = True
+        # one decision per report of a detector
+        if updated:
+            self.update(max(self.detectors.values()) + self.tracker)
+
+    def update(self, latency):
+        if latency > self.budget:
+            self.over += 1
+            self.under = 0
+        elif latency < self.recover_ratio * self.budget:
+            self.under += 1
+            self.over = 0
+        else:
+            self.over = self.under = 0
+        if self.over >= self.escalate_reports and self.level < self.max_level:
+            self.level += 1
+            self.over = 0
+            rospy.logwarn('Perception at %.1f ms over the %.1f ms budget, degradation level %d: %s', latency, self.budget, self.level, STEPS[self.level])
+            self.publish()
+        elif self.under >= self.recover_reports and self.level > 0:
+            self.level -= 1
+            self.under = 0
+            rospy.loginfo('Perception at %.1f ms, back to degradation level %d: %s', latency, self.level, STEPS[self.level])
+            self.publish()
+
+    def publish(self):
+        self.pub_level.publish(UInt8(self.level))
+
+if __name__ == '__main__':
+    DegradationController()
+    rospy.spin()
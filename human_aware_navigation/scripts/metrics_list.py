@@ -7,8 +7,153 @@ from people_msgs.msg import People
 from std_msgs.msg import Bool
 from nav_msgs.srv import GetPlan
 from nav_msgs.msg import Odometry
+from diagnostic_msgs.msg import DiagnosticArray
 from os.path import dirname, exists
-from os import makedirs
+from os import makedirs, sysconf
+import rosgraph
+import rosnode
+import subprocess
+import time
+try:
+    from xmlrpc.client import ServerProxy
+except ImportError:
+    from xmlrpclib import ServerProxy
+
+# The per-stage latency diagnostics of the C++ nodes, by the suffix of their status
+LATENCY_STATUSES = [': latency', ': yolo_latency', ': tracker', ': pipeline', ': removal', ': rslidar_receiver']
+# The load of the GPU of a Jetson, in per mille
+JETSON_GPU_LOAD = '/sys/devices/gpu.0/load'
+
+class PerformanceProfile(object):
+    """The performance of the nodes over an experiment: their last latency
+    diagnostics, the CPU time and memory high-water mark of their processes,
+    and the CPU, GPU and memory use of the system."""
+
+    def __init__(self, period):
+        self.clock_ticks = float(sysconf('SC_CLK_TCK'))
+        self.master = rosgraph.Master(rospy.get_name())
+        self.reports = {}
+        self.start()
+        rospy.Subscriber('/diagnostics', DiagnosticArray, self.callback_diagnostics)
+        rospy.Timer(rospy.Duration(period), self.callback_sample)
+
+    def start(self):
+        self.start_wall = time.time()
+        self.cpu = []
+        self.gpu = []
+        self.gpu_memory = []
+        self.memory = []
+        self.last_stat = self.read_stat()
+        # the nodes by process, nodelets share their manager
+        self.processes = {}
+        self.update_processes()
+
+    def callback_diagnostics(self, msg):
+        for status in msg.status:
+            if any(status.name.endswith(suffix) for suffix in LATENCY_STATUSES):
+                self.reports[status.name] = ', '.join(kv.key + ' = ' + kv.value for kv in status.values)
+
+    def callback_sample(self, event):
+        stat = self.read_stat()
+        if self.last_stat and stat:
+            total = sum(stat) - sum(self.last_stat)
+            idle = (stat[3] + stat[4]) - (self.last_stat[3] + self.last_stat[4])
+            if total > 0:
+                self.cpu.append(100.0 * (total - idle) / total)
+        self.last_stat = stat
+        self.sample_gpu()
+        meminfo = self.read_meminfo()
+        if 'MemTotal' in meminfo and 'MemAvailable' in meminfo:
+            self.memory.append((meminfo['MemTotal'] - meminfo['MemAvailable']) / 1024.0)
+        # the nodes started since
+        if len(self.cpu) % 10 == 0:
+            self.update_processes()
+
+    @staticmethod
+    def read_stat():
+        try:
+            with open('/proc/stat') as f:
+                return [int(v) for v in f.readline().split()[1:9]]
+        except (IOError, ValueError):
+            return None
+
+    @staticmethod
+    def read_meminfo(path='/proc/meminfo'):
+        # in kB
+        values = {}
+        try:
+            with open(path) as f:
+                for line in f:
+                    fields = line.split()
+                    if len(fields) >= 2 and fields[1].isdigit():
+                        values[fields[0].rstrip(':')] = int(fields[1])
+        except IOError:
+            pass
+        return values
+
+    def sample_gpu(self):
+        if exists(JETSON_GPU_LOAD):
+            with open(JETSON_GPU_LOAD) as f:
+                self.gpu.append(int(f.read()) / 10.0)
+            return
+        try:
+            output = subprocess.check_output(['nvidia-smi', '--query-gpu=utilization.gpu,memory.used', '--format=csv,noheader,nounits'])
+            utilization, memory = output.decode().splitlines()[0].split(',')
+            self.gpu.append(float(utilization))
+            self.gpu_memory.append(float(memory))
+        except (OSError, subprocess.CalledProcessError, ValueError, IndexError):
+            pass
+
+    def update_processes(self):
+        try:
+            nodes = rosnode.get_node_names()
+        except rosnode.ROSNodeIOException:
+            return
+        known = set(node for process in self.processes.values() for node in process['nodes'])
+        for node in nodes:
+            if node in known:
+                continue
+            try:
+                code, _, pid = ServerProxy(rosnode.get_api_uri(self.master, node)).getPid(rospy.get_name())
+            except Exception:
+                continue
+            if code != 1:
+                continue
+            if pid not in self.processes:
+                self.processes[pid] = {'nodes': [], 'cpu_time': self.read_cpu_time(pid)}
+            self.processes[pid]['nodes'].append(node)
+
+    def read_cpu_time(self, pid):
+        # utime and stime, after the command which may have spaces
+        try:
+            with open('/proc/%d/stat' % pid) as f:
+                fields = f.read().rsplit(')', 1)[1].split()
+            return (int(fields[11]) + int(fields[12])) / self.clock_ticks
+        except (IOError, IndexError, ValueError):
+            return None
+
+    @staticmethod
+    def mean_max(values):
+        if not values:
+            return 'n/a'
+        return '%.1f, %.1f' % (sum(values) / len(values), max(values))
+
+    def report(self):
+        wall = max(time.time() - self.start_wall, 1e-6)
+        lines = ['The CPU utilization of the system in % (mean, max): ' + self.mean_max(self.cpu),
+                 'The GPU utilization in % (mean, max): ' + self.mean_max(self.gpu),
+                 'The memory used in MB (mean, max): ' + self.mean_max(self.memory)]
+        if self.gpu_memory:
+            lines.append('The GPU memory used in MB (mean, max): ' + self.mean_max(self.gpu_memory))
+        for pid, process in sorted(self.processes.items()):
+            cpu_time = self.read_cpu_time(pid)
+            hwm = self.read_meminfo('/proc/%d/status' % pid).get('VmHWM')
+            cpu = '%.1f' % (100.0 * (cpu_time - process['cpu_time']) / wall) if cpu_time is not None and process['cpu_time'] is not None else 'n/a'
+            memory = '%.1f' % (hwm / 1024.0) if hwm is not None else 'n/a'
+            lines.append('The process of ' + ' '.join(sorted(process['nodes'])) + ': CPU ' + cpu + ' %, memory high-water mark ' + memory + ' MB')
+        for name, values in sorted(self.reports.items()):
+            lines.append('The latency of ' + name + ': ' + values)
+        return '\n'.join(lines) + '\n'
 
 class Metrics(object):
     def __init__(self):
@@ -39,6 +184,10 @@ class Metrics(object):
         self.flag_log = False
         self.end_node_flag = True
         self.dir_name = dirname(__file__)
+        #Performance of the nodes during the experiment, sampled every profile_period s
+        self.profile = None
+        if rospy.get_param('~benchmark', False):
+            self.profile = PerformanceProfile(rospy.get_param('~profile_period', 1.0))
 
     def callback_start(self, callback_start):
         rospy.logwarn('Metrics - start of the experiment')
@@ -46,6 +195,8 @@ class Metrics(object):
         self.path_points_real = []
         self.length_real = 0
 
+        if self.profile:
+            self.profile.start()
         #Get the start time
         start_time = rospy.get_time()
         #Get the start position
@@ -141,6 +292,8 @@ class Metrics(object):
             f.write('The length of the real path: ' + str(self.length_real) + '\n')
             f.write('The ration of the mean velocities near of the pedestrians and the usual velocity: ' + 
             str(self.mean_velocity / self.usual_velocity) + '\n')
+            if self.profile:
+                f.write(self.profile.report())
 
     def shutdown_func(self):
         if self.end_node_flag:
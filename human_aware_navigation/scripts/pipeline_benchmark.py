@@ -0,0 +1,303 @@
+#!/usr/bin/env python
+
+import argparse
+import json
+import sys
+import time
+from os import listdir, makedirs
+from os.path import basename, dirname, exists, join
+
+import rosbag
+import rosgraph
+import rosnode
+import rospy
+from diagnostic_msgs.msg import DiagnosticArray
+try:
+    from xmlrpc.client import ServerProxy
+except ImportError:
+    from xmlrpclib import ServerProxy
+
+# The per-stage latency diagnostics of the C++ nodes, c.f. metrics_list.py
+LATENCY_STATUSES = [': latency', ': yolo_latency', ': tracker', ': pipeline', ': removal', ': rslidar_receiver']
+# The scans of the lidar, either topic: the packets go through the decoder
+SCAN_TOPICS = ['/rslidar_packets', '/rslidar_points']
+# The outputs of the detectors a bag may have, not replayed into the pipeline
+DETECTOR_TOPICS = ['/darknet_ros/bounding_boxes', '/object3d_detector_gpu/measurements', '/crowd/ground_truth']
+
+
+def load_trace(path):
+    # c.f. merge_traces.py of perception_trace: a trace still being written has no closing bracket
+    with open(path) as f:
+        text = f.read().rstrip()
+    if not text.endswith(']'):
+        text = text.rstrip(',') + ']'
+    try:
+        return json.loads(text)
+    except ValueError:
+        # an event cut in the middle of its write
+        return json.loads(text[:text.rfind(',\n{')] + ']')
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    ordered = sorted(values)
+    return ordered[min(int(p / 100.0 * len(ordered)), len(ordered) - 1)]
+
+
+def gate(report, baseline, tolerance):
+    """True if the score of the report is no more than its baseline, plus the
+    tolerance (a fraction of it): the p99 age of the score hop, lower is better."""
+    if report.get('score') is None:
+        return False
+    if baseline.get('score') is None:
+        return True
+    return report['score'] <= baseline['score'] * (1.0 + tolerance)
+
+
+class PipelineBenchmark(object):
+    """Replays crowd bags through the whole perception, as fast as it goes:
+    a scan of the lidar is published once the one before it has come out of
+    the detector (or after ~timeout s), the camera frames of the bag in
+    between, every message restamped to the time it is published. The
+    latency of every stage is that of the hops of perception_trace, the
+    sensor-to-hop age and the duration of the hop, of the scans and frames
+    after the ~warmup ones; the report, in JSON, has a single score to gate
+    on: the 99th percentile of the age of ~score_hop, the worst of the bags."""
+
+    def __init__(self):
+        # ROS
+        rospy.init_node('pipeline_benchmark')
+        self.bags = rospy.get_param('~bags', [])
+        self.trace = rospy.get_param('~trace', '/tmp/trace')
+        self.output = rospy.get_param('~output', dirname(__file__) + '/metrics/pipeline_benchmark.json')
+        # A report of an earlier run the score is compared to, tolerance a fraction of the baseline score
+        self.baseline = rospy.get_param('~baseline', '')
+        self.tolerance = rospy.get_param('~tolerance', 0.1)
+        # The nodes whose processes are profiled, the nodelets are in their manager
+        self.processes = rospy.get_param('~processes', ['/perception_nodelet_manager'])
+        # One message of it per scan through the lidar detector
+        self.pace_topic = rospy.get_param('~pace_topic', '/object3d_detector_gpu/measurements')
+        self.in_flight = rospy.get_param('~in_flight', 1)
+        self.timeout = rospy.get_param('~timeout', 0.5)
+        self.warmup = rospy.get_param('~warmup', 10)
+        self.startup = rospy.get_param('~startup', 60.0)
+        self.score_hop = rospy.get_param('~score_hop', 'bayes_people_tracker')
+        # The outputs counted, every one of them starting with a std_msgs/Header
+        self.topics = rospy.get_param('~topics', ['/object3d_detector_gpu/measurements', '/darknet_ros/bounding_boxes',
+                                                  '/rgbd_detection2d_3d/measurements', '/people_tracker/track_states'])
+        if self.pace_topic not in self.topics:
+            self.topics.append(self.pace_topic)
+        self.master = rosgraph.Master(rospy.get_name())
+        self.publishers = {}
+        self.stamps = {}
+        self.paced = 0
+        self.arrivals = dict((topic, []) for topic in self.topics)
+        self.reports = {}
+        for topic in self.topics:
+            # nothing deserialized, whatever the type
+            rospy.Subscriber(topic, rospy.AnyMsg, self.callback_output, topic, queue_size=100)
+        rospy.Subscriber('/diagnostics', DiagnosticArray, self.callback_diagnostics)
+
+    def callback_output(self, msg, topic):
+        self.arrivals[topic].append(time.time())
+        if topic == self.pace_topic:
+            self.paced += 1
+
+    def callback_diagnostics(self, msg):
+        for status in msg.status:
+            if any(status.name.endswith(suffix) for suffix in LATENCY_STATUSES):
+                self.reports[status.name] = dict((kv.key, kv.value) for kv in status.values)
+
+    def publisher(self, topic, msg):
+        if topic not in self.publishers:
+            self.publishers[topic] = rospy.Publisher(topic, type(msg), queue_size=10, latch=(topic == '/tf_static'))
+        return self.publishers[topic]
+
+    def restamp(self, msg, now):
+        # the color, depth and camera info of a frame keep a stamp in common
+        if not hasattr(msg, 'header'):
+            return
+        stamp = msg.header.stamp
+        if stamp not in self.stamps:
+            if len(self.stamps) > 64:
+                self.stamps.clear()
+            self.stamps[stamp] = now
+        msg.header.stamp = self.stamps[stamp]
+
+    def wait_subscribers(self, topics):
+        deadline = time.time() + self.startup
+        while not rospy.is_shutdown() and time.time() < deadline:
+            if all(self.publishers[topic].get_num_connections() > 0 for topic in topics):
+                return True
+            time.sleep(0.1)
+        return False
+
+    def pids(self):
+        pids = set()
+        for node in self.processes:
+            try:
+                code, _, pid = ServerProxy(rosnode.get_api_uri(self.master, node)).getPid(rospy.get_name())
+            except Exception:
+                continue
+            if code == 1:
+                pids.add(pid)
+        return pids
+
+    @staticmethod
+    def peak_memory(pid):
+        # VmHWM in MB
+        try:
+            with open('/proc/%d/status' % pid) as f:
+                for line in f:
+                    if line.startswith('VmHWM:'):
+                        return int(line.split()[1]) / 1024.0
+        except (IOError, ValueError, IndexError):
+            pass
+        return None
+
+    def hops(self, pids, begin, end):
+        """The hops of the traces of the processes, of the origins from begin to end (s)."""
+        hops = {}
+        if not exists(self.trace):
+            rospy.logwarn('No trace in %s, PERCEPTION_TRACE not set?', self.trace)
+            return hops
+        for name in listdir(self.trace):
+            if not name.endswith('.json') or not any(name.endswith('_%d.json' % pid) for pid in pids):
+                continue
+            for e in load_trace(join(self.trace, name)):
+                if e.get('ph') != 'X' or not begin * 1e6 <= e['args']['origin_us'] <= end * 1e6:
+                    continue
+                hop = hops.setdefault(e['name'], {'age_ms': [], 'duration_ms': []})
+                hop['age_ms'].append(e['args']['age_ms'])
+                hop['duration_ms'].append(e['dur'] / 1000.0)
+        return dict((name, {'count': len(hop['age_ms']),
+                            'age_p50_ms': percentile(hop['age_ms'], 50), 'age_p99_ms': percentile(hop['age_ms'], 99),
+                            'duration_p50_ms': percentile(hop['duration_ms'], 50),
+                            'duration_p99_ms': percentile(hop['duration_ms'], 99)}) for name, hop in hops.items())
+
+    def replay(self, path):
+        self.paced = 0
+        with rosbag.Bag(path) as bag:
+            topics = bag.get_type_and_topic_info().topics
+            scan_topic = next((topic for topic in SCAN_TOPICS if topic in topics), None)
+            if scan_topic is None:
+                rospy.logerr('No scan of the lidar in %s, one of %s', path, ', '.join(SCAN_TOPICS))
+                return None
+            # the publishers made, the pipeline given time to subscribe (and YOLO to load)
+            for topic, msg, _ in bag.read_messages():
+                if topic not in DETECTOR_TOPICS:
+                    self.publisher(topic, msg)
+                if all(topic in self.publishers for topic in topics if topic not in DETECTOR_TOPICS):
+                    break
+            if not self.wait_subscribers([topic for topic in self.publishers if topic != '/tf_static']):
+                rospy.logwarn('Not every topic of %s is subscribed to after %.0f s', path, self.startup)
+
+            scans = 0
+            begin = None
+            for topic, msg, _ in bag.read_messages():
+                if rospy.is_shutdown():
+                    return None
+                if topic in DETECTOR_TOPICS:
+                    continue
+                if topic == scan_topic:
+                    # at most in_flight scans not through the detector yet
+                    deadline = time.time() + self.timeout
+                    while scans - self.paced >= self.in_flight and time.time() < deadline and not rospy.is_shutdown():
+                        time.sleep(0.0005)
+                    self.paced = max(self.paced, scans - self.in_flight + 1)
+                    scans += 1
+                    if scans == self.warmup + 1:
+                        begin = rospy.get_rostime()
+                        start_wall = time.time()
+                        start_arrivals = dict((t, len(a)) for t, a in self.arrivals.items())
+                        self.reports = {}
+                if topic == '/tf_static':
+                    for transform in msg.transforms:
+                        transform.header.stamp = rospy.get_rostime()
+                else:
+                    self.restamp(msg, rospy.get_rostime())
+                self.publishers[topic].publish(msg)
+            if begin is None:
+                rospy.logerr('%s has %d scans, no more than the %d of the warmup', path, scans, self.warmup)
+                return None
+            end = rospy.get_rostime()
+            wall = max(time.time() - start_wall, 1e-6)
+            # the last scans through, the hops written out by the tracers
+            deadline = time.time() + 2.0 * self.timeout
+            while self.paced < scans and time.time() < deadline:
+                time.sleep(0.01)
+            time.sleep(1.0)
+
+        pids = self.pids()
+        hops = self.hops(pids, begin.to_sec(), end.to_sec())
+        score = hops.get(self.score_hop, {}).get('age_p99_ms')
+        return {'bag': basename(path),
+                'scan_topic': scan_topic,
+                'scans': scans - self.warmup,
+                'scan_rate_hz': (scans - self.warmup) / wall,
+                'outputs_hz': dict((t, (len(self.arrivals[t]) - start_arrivals[t]) / wall) for t in self.topics),
+                'hops': hops,
+                'diagnostics': self.reports,
+                'peak_memory_mb': dict((str(pid), self.peak_memory(pid)) for pid in pids),
+                'score': score}
+
+    def run(self):
+        runs = []
+        for path in self.bags:
+            rospy.loginfo('Replaying %s', path)
+            result = self.replay(path)
+            if result is None:
+                return 1
+            rospy.loginfo('%s: %d scans at %.1f Hz, p99 age of %s %s ms', result['bag'], result['scans'],
+                          result['scan_rate_hz'], self.score_hop, result['score'])
+            runs.append(result)
+        if not runs:
+            rospy.logerr('No bag to replay, c.f. ~bags')
+            return 1
+        scores = [run['score'] for run in runs]
+        memory = [m for run in runs for m in run['peak_memory_mb'].values() if m is not None]
+        report = {'score_hop': self.score_hop,
+                  'score': None if None in scores else max(scores),
+                  'peak_memory_mb': max(memory) if memory else None,
+                  'runs': runs}
+        status = 0
+        if self.baseline:
+            with open(self.baseline) as f:
+                baseline = json.load(f)
+            report['baseline_score'] = baseline.get('score')
+            report['passed'] = gate(report, baseline, self.tolerance)
+            if not report['passed']:
+                rospy.logerr('Regression: score %s ms, baseline %s ms (tolerance %.0f %%)', report['score'],
+                             report['baseline_score'], 100.0 * self.tolerance)
+                status = 1
+        folder = dirname(self.output)
+        if folder and not exists(folder):
+            makedirs(folder)
+        with open(self.output, 'w') as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+        rospy.loginfo('Benchmark of %d bags written to %s, score %s ms', len(runs), self.output, report['score'])
+        return status
+
+
+def main(argv):
+    # without ROS: the gate of a report on a baseline, for CI
+    if len(argv) > 1 and argv[1] == '--gate':
+        parser = argparse.ArgumentParser(description='Fails if the score of a report regressed from a baseline.')
+        parser.add_argument('--gate', nargs=2, metavar=('REPORT', 'BASELINE'), required=True)
+        parser.add_argument('--tolerance', type=float, default=0.1, help='fraction of the baseline score')
+        args = parser.parse_args(argv[1:])
+        with open(args.gate[0]) as f:
+            report = json.load(f)
+        with open(args.gate[1]) as f:
+            baseline = json.load(f)
+        passed = gate(report, baseline, args.tolerance)
+        sys.stdout.write('score %s ms, baseline %s ms: %s\n' % (report.get('score'), baseline.get('score'), 'passed' if passed else 'regression'))
+        return 0 if passed else 1
+    status = PipelineBenchmark().run()
+    rospy.signal_shutdown('benchmark done')
+    return status
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,209 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "human_aware_navigation/human_layer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <pluginlib/class_list_macros.h>
+#include <tf2/LinearMath/Transform.h>
+#include <tf2_geometry_msgs/tf2_geometry_msgs.h>
+
+PLUGINLIB_EXPORT_CLASS(human_aware_navigation::HumanLayer, costmap_2d::Layer)
+
+namespace human_aware_navigation {
+
+HumanLayer::HumanLayer() : track_timeout_(1.0), has_pending_(false), reset_(true) {}
+
+void HumanLayer::onInitialize() {
+  ros::NodeHandle nh("~/" + name_);
+  current_ = true;
+
+  std::string topic;
+  KernelParams params;
+  nh.param("enabled", enabled_, true);
+  nh.param("topic", topic, std::string("/people_tracker/track_states"));
+  nh.param("track_timeout", track_timeout_, 1.0);
+  nh.param("amplitude", params.amplitude, params.amplitude);
+  nh.param("sigma", params.sigma, params.sigma);
+  nh.param("velocity_factor", params.velocity_factor, params.velocity_factor);
+  nh.param("max_speed", params.max_speed, params.max_speed);
+  nh.param("speed_bins", params.speed_bins, params.speed_bins);
+  nh.param("heading_bins", params.heading_bins, params.heading_bins);
+  nh.param("cutoff", params.cutoff, params.cutoff);
+  // a person is no obstacle the planners would not go near
+  params.amplitude = std::min(params.amplitude, (double)costmap_2d::INSCRIBED_INFLATED_OBSTACLE - 1);
+  kernels_ = SocialKernels(params);
+
+  sub_ = nh.subscribe(topic, 1, &HumanLayer::trackStatesCallback, this);
+}
+
+void HumanLayer::trackStatesCallback(const bayes_people_tracker::TrackStates::ConstPtr &msg) {
+  if(msg->positions.size() != 2 * msg->ids.size() || msg->velocities.size() != 2 * msg->ids.size()) {
+    ROS_WARN_THROTTLE(1.0, "[%s] track states of %zu tracks with %zu positions and %zu velocities, dropped", name_.c_str(),
+                      msg->ids.size(), msg->positions.size() / 2, msg->velocities.size() / 2);
+    return;
+  }
+
+  // at the time of the tracks, else the latest one
+  std::string global_frame = layered_costmap_->getGlobalFrameID();
+  ros::Time stamp = tf_->canTransform(global_frame, msg->header.frame_id, msg->header.stamp) ? msg->header.stamp : ros::Time(0);
+  tf2::Transform transform;
+  try {
+    tf2::fromMsg(tf_->lookupTransform(global_frame, msg->header.frame_id, stamp).transform, transform);
+  } catch(tf2::TransformException &ex) {
+    ROS_WARN_THROTTLE(1.0, "[%s] %s", name_.c_str(), ex.what());
+    return;
+  }
+
+  std::map<long, Person> people;
+  for(size_t i = 0; i < msg->ids.size(); i++) {
+    tf2::Vector3 position = transform * tf2::Vector3(msg->positions[2 * i], msg->positions[2 * i + 1], 0.0);
+    tf2::Vector3 velocity = transform.getBasis() * tf2::Vector3(msg->velocities[2 * i], msg->velocities[2 * i + 1], 0.0);
+    Person person = {position.x(), position.y(), velocity.x(), velocity.y()};
+    people[msg->ids[i]] = person;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  pending_.swap(people);
+  has_pending_ = true;
+  last_states_ = ros::Time::now();
+}
+
+void HumanLayer::updateBounds(double robot_x, double robot_y, double robot_yaw, double *min_x, double *min_y, double *max_x, double *max_y) {
+  if(!enabled_) {
+    return;
+  }
+
+  std::map<long, Person> people;
+  bool fresh, stale;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fresh = has_pending_;
+    if(fresh) {
+      people.swap(pending_);
+      has_pending_ = false;
+    }
+    stale = !fresh && (ros::Time::now() - last_states_).toSec() > track_timeout_;
+  }
+
+  costmap_2d::Costmap2D *master = layered_costmap_->getCostmap();
+  double resolution = master->getResolution();
+  if(kernels_.resolution() != resolution) {
+    kernels_.build(resolution);
+    reset_ = true;
+  }
+
+  // no tracker, nobody left
+  if(stale) {
+    clearStamps(min_x, min_y, max_x, max_y);
+    return;
+  }
+  if(!fresh) {
+    if(reset_) {
+      for(std::map<long, Stamp>::const_iterator it = stamps_.begin(); it != stamps_.end(); ++it) {
+        touch(it->second, min_x, min_y, max_x, max_y);
+      }
+      reset_ = false;
+    }
+    return;
+  }
+
+  // the people at the centres of the cells of the grid, which keeps its
+  // origin on them when it rolls
+  double origin_x = master->getOriginX(), origin_y = master->getOriginY();
+  std::map<long, Stamp> stamps;
+  for(std::map<long, Person>::const_iterator it = people.begin(); it != people.end(); ++it) {
+    const Person &person = it->second;
+    Stamp stamp = {origin_x + (std::floor((person.x - origin_x) / resolution) + 0.5) * resolution,
+                   origin_y + (std::floor((person.y - origin_y) / resolution) + 0.5) * resolution,
+                   kernels_.index(person.vx, person.vy)};
+    stamps[it->first] = stamp;
+
+    std::map<long, Stamp>::iterator old = stamps_.find(it->first);
+    if(old == stamps_.end()) {
+      touch(stamp, min_x, min_y, max_x, max_y);
+      continue;
+    }
+    if(reset_ || old->second.kernel != stamp.kernel || std::fabs(old->second.x - stamp.x) > resolution / 2 ||
+       std::fabs(old->second.y - stamp.y) > resolution / 2) {
+      touch(old->second, min_x, min_y, max_x, max_y);
+      touch(stamp, min_x, min_y, max_x, max_y);
+    }
+    stamps_.erase(old);
+  }
+  // those who left
+  for(std::map<long, Stamp>::const_iterator it = stamps_.begin(); it != stamps_.end(); ++it) {
+    touch(it->second, min_x, min_y, max_x, max_y);
+  }
+  stamps_.swap(stamps);
+  reset_ = false;
+}
+
+void HumanLayer::updateCosts(costmap_2d::Costmap2D &master_grid, int min_i, int min_j, int max_i, int max_j) {
+  if(!enabled_) {
+    return;
+  }
+  min_i = std::max(min_i, 0);
+  min_j = std::max(min_j, 0);
+  max_i = std::min(max_i, (int)master_grid.getSizeInCellsX());
+  max_j = std::min(max_j, (int)master_grid.getSizeInCellsY());
+  unsigned char *costs = master_grid.getCharMap();
+
+  // every person the bounds cut, the other layers drew over them
+  for(std::map<long, Stamp>::const_iterator it = stamps_.begin(); it != stamps_.end(); ++it) {
+    const SocialKernel &kernel = kernels_.kernel(it->second.kernel);
+    int mx, my;
+    master_grid.worldToMapNoBounds(it->second.x, it->second.y, mx, my);
+    int x0 = mx + kernel.offset_x, y0 = my + kernel.offset_y;
+    int i_begin = std::max(min_i, x0), i_end = std::min(max_i, x0 + kernel.width);
+    int j_begin = std::max(min_j, y0), j_end = std::min(max_j, y0 + kernel.height);
+    for(int j = j_begin; j < j_end; j++) {
+      const unsigned char *row = kernel.costs.data() + (j - y0) * kernel.width;
+      for(int i = i_begin; i < i_end; i++) {
+        unsigned char cost = row[i - x0];
+        if(cost == 0) {
+          continue;
+        }
+        unsigned char &old_cost = costs[master_grid.getIndex(i, j)];
+        if(old_cost == costmap_2d::NO_INFORMATION || old_cost < cost) {
+          old_cost = cost;
+        }
+      }
+    }
+  }
+}
+
+void HumanLayer::matchSize() {
+  reset_ = true;
+}
+
+void HumanLayer::reset() {
+  reset_ = true;
+}
+
+void HumanLayer::touch(const Stamp &stamp, double *min_x, double *min_y, double *max_x, double *max_y) const {
+  const SocialKernel &kernel = kernels_.kernel(stamp.kernel);
+  if(kernel.width == 0) {
+    return;
+  }
+  double resolution = kernels_.resolution();
+  *min_x = std::min(*min_x, stamp.x + (kernel.offset_x - 0.5) * resolution);
+  *min_y = std::min(*min_y, stamp.y + (kernel.offset_y - 0.5) * resolution);
+  *max_x = std::max(*max_x, stamp.x + (kernel.offset_x + kernel.width - 0.5) * resolution);
+  *max_y = std::max(*max_y, stamp.y + (kernel.offset_y + kernel.height - 0.5) * resolution);
+}
+
+void HumanLayer::clearStamps(double *min_x, double *min_y, double *max_x, double *max_y) {
+  for(std::map<long, Stamp>::const_iterator it = stamps_.begin(); it != stamps_.end(); ++it) {
+    touch(it->second, min_x, min_y, max_x, max_y);
+  }
+  stamps_.clear();
+}
+
+} // namespace human_aware_navigation
@@ -0,0 +1,93 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "human_aware_navigation/social_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace human_aware_navigation {
+
+SocialKernels::SocialKernels(const KernelParams &params) : params_(params), resolution_(0.0) {
+  params_.speed_bins = std::max(params_.speed_bins, 1);
+  params_.heading_bins = std::max(params_.heading_bins, 1);
+}
+
+void SocialKernels::build(double resolution) {
+  resolution_ = resolution;
+  kernels_.clear();
+  kernels_.push_back(compute(0.0, 0.0));
+  for(int s = 1; s < params_.speed_bins; s++) {
+    double speed = params_.max_speed * s / (params_.speed_bins - 1);
+    for(int h = 0; h < params_.heading_bins; h++) {
+      kernels_.push_back(compute(speed, 2.0 * M_PI * h / params_.heading_bins));
+    }
+  }
+}
+
+int SocialKernels::index(double vx, double vy) const {
+  if(params_.speed_bins < 2 || params_.max_speed <= 0.0) {
+    return 0;
+  }
+  double bin_speed = params_.max_speed / (params_.speed_bins - 1);
+  int s = std::min((int)std::floor(std::hypot(vx, vy) / bin_speed + 0.5), params_.speed_bins - 1);
+  if(s == 0) {
+    return 0;
+  }
+  double bin_heading = 2.0 * M_PI / params_.heading_bins;
+  int h = (int)std::floor(std::atan2(vy, vx) / bin_heading + 0.5);
+  h = (h % params_.heading_bins + params_.heading_bins) % params_.heading_bins;
+  return 1 + (s - 1) * params_.heading_bins + h;
+}
+
+SocialKernel SocialKernels::compute(double speed, double heading) const {
+  SocialKernel kernel = {0, 0, 0, 0, std::vector<unsigned char>()};
+  if(resolution_ <= 0.0 || params_.amplitude <= params_.cutoff || params_.cutoff <= 0.0) {
+    return kernel;
+  }
+  double sigma_side = params_.sigma;
+  double sigma_front = params_.sigma + params_.velocity_factor * speed;
+  // the distance, in sigmas, the cost falls to the cutoff at
+  double reach = std::sqrt(2.0 * std::log(params_.amplitude / params_.cutoff));
+  int n = (int)std::ceil(std::max(sigma_front, sigma_side) * reach / resolution_);
+  double c = std::cos(heading), s = std::sin(heading);
+
+  // over the square of the farthest reach, cropped to the cells stamped
+  int side = 2 * n + 1;
+  std::vector<unsigned char> square(side * side, 0);
+  int min_i = side, min_j = side, max_i = -1, max_j = -1;
+  for(int j = 0; j < side; j++) {
+    for(int i = 0; i < side; i++) {
+      double dx = (i - n) * resolution_, dy = (j - n) * resolution_;
+      double along = dx * c + dy * s, across = -dx * s + dy * c;
+      double sigma_along = along > 0.0 ? sigma_front : sigma_side;
+      double cost = params_.amplitude * std::exp(-0.5 * (along * along / (sigma_along * sigma_along) + across * across / (sigma_side * sigma_side)));
+      if(cost >= params_.cutoff) {
+        square[j * side + i] = (unsigned char)std::min(cost + 0.5, params_.amplitude);
+        min_i = std::min(min_i, i);
+        max_i = std::max(max_i, i);
+        min_j = std::min(min_j, j);
+        max_j = std::max(max_j, j);
+      }
+    }
+  }
+  if(max_i < 0) {
+    return kernel;
+  }
+  kernel.offset_x = min_i - n;
+  kernel.offset_y = min_j - n;
+  kernel.width = max_i - min_i + 1;
+  kernel.height = max_j - min_j + 1;
+  kernel.costs.resize(kernel.width * kernel.height);
+  for(int j = 0; j < kernel.height; j++) {
+    std::copy(square.begin() + (min_j + j) * side + min_i, square.begin() + (min_j + j) * side + max_i + 1,
+              kernel.costs.begin() + j * kernel.width);
+  }
+  return kernel;
+}
+
+} // namespace human_aware_navigation
@@ -0,0 +1,85 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+// Google Test
+#include <gtest/gtest.h>
+
+#include "human_aware_navigation/social_kernels.h"
+
+using human_aware_navigation::KernelParams;
+using human_aware_navigation::SocialKernel;
+using human_aware_navigation::SocialKernels;
+
+namespace {
+
+int cost(const SocialKernel &kernel, int x, int y) {
+  int i = x - kernel.offset_x, j = y - kernel.offset_y;
+  if(i < 0 || j < 0 || i >= kernel.width || j >= kernel.height) {
+    return 0;
+  }
+  return kernel.costs[j * kernel.width + i];
+}
+
+} // namespace
+
+TEST(SocialKernels, BinsTheVelocities) {
+  SocialKernels kernels;
+  kernels.build(0.05);
+  // the standing one, then 5 speeds of 16 headings
+  EXPECT_EQ(81u, kernels.size());
+  EXPECT_EQ(0, kernels.index(0.0, 0.0));
+  EXPECT_EQ(0, kernels.index(0.1, 0.0));
+  EXPECT_EQ(1, kernels.index(0.3, 0.0));
+  EXPECT_EQ(1 + 4 * 16, kernels.index(5.0, 0.0));
+  EXPECT_EQ(1 + 4, kernels.index(0.0, 0.3));
+  EXPECT_EQ(1 + 8, kernels.index(-0.3, 0.0));
+  EXPECT_EQ(1 + 15, kernels.index(0.3, -0.15));
+}
+
+TEST(SocialKernels, StretchesAheadOfThePerson) {
+  SocialKernels kernels;
+  kernels.build(0.05);
+
+  const SocialKernel &standing = kernels.kernel(0);
+  EXPECT_EQ(200, cost(standing, 0, 0));
+  EXPECT_EQ(cost(standing, 10, 0), cost(standing, -10, 0));
+  EXPECT_EQ(cost(standing, 10, 0), cost(standing, 0, 10));
+  EXPECT_EQ(standing.width, standing.height);
+
+  // walking along x at 1.2 m/s
+  const SocialKernel &walking = kernels.kernel(kernels.index(1.2, 0.0));
+  EXPECT_EQ(200, cost(walking, 0, 0));
+  EXPECT_GT(cost(walking, 20, 0), cost(walking, -20, 0));
+  EXPECT_EQ(cost(standing, -10, 0), cost(walking, -10, 0));
+  EXPECT_EQ(cost(walking, 20, 5), cost(walking, 20, -5));
+  EXPECT_GT(walking.width, standing.width);
+  EXPECT_EQ(standing.offset_x, walking.offset_x);
+
+  // nothing stamped under the cutoff
+  for(size_t k = 0; k < walking.costs.size(); k++) {
+    EXPECT_TRUE(walking.costs[k] == 0 || walking.costs[k] >= 10);
+  }
+}
+
+TEST(SocialKernels, FollowsTheResolution) {
+  KernelParams params;
+  params.speed_bins = 1;
+  SocialKernels kernels(params);
+  EXPECT_EQ(0u, kernels.size());
+  kernels.build(0.1);
+  ASSERT_EQ(1u, kernels.size());
+  EXPECT_EQ(0, kernels.index(1.0, 1.0));
+  int coarse = kernels.kernel(0).width;
+  kernels.build(0.05);
+  EXPECT_NEAR(2 * coarse, kernels.kernel(0).width, 2);
+  EXPECT_DOUBLE_EQ(0.05, kernels.resolution());
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
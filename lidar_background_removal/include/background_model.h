@@ -0,0 +1,84 @@
+// Copyright (C) 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef BACKGROUND_MODEL_H
+#define BACKGROUND_MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Learned background, for what the map misses (e.g. furniture): every map
+// cell keeps the persistence of its returns, an exponential average over the
+// frames of whether the cell was hit, learning_rate being the weight of one
+// frame. Cells hit in most frames for long enough (persistence above
+// threshold) are static. Cells are only touched when hit, their decay over
+// the frames in between is applied lazily from a table.
+class BackgroundModel {
+public:
+  BackgroundModel() : width_(0), height_(0), learning_rate_(0.005f), threshold_(0.8f), frame_(0) {}
+  
+  void configure(float learning_rate, float threshold);
+  // Forgets everything learned, e.g. for a new map.
+  void reset(int width, int height);
+  
+  // Frames must be started before their cells are hit, a cell counts once per frame.
+  void beginFrame() { frame_++; }
+  void hit(int x, int y);
+  // Fractional grid coordinates as InflatedMap::background(), off the map is never static.
+  bool isStatic(float x, float y) const {
+    if(!(x >= 0.0f && y >= 0.0f && x < width_ && y < height_)) {
+      return false;
+    }
+    const Cell &cell = cells_[(size_t)(int)y * width_ + (int)x];
+    return cell.persistence >= threshold_ && decayed(cell, frame_ - 1) >= threshold_; // as of the last frame
+  }
+  // Linear index of the cell at these coordinates, -1 off the map.
+  long index(float x, float y) const {
+    if(!(x >= 0.0f && y >= 0.0f && x < width_ && y < height_)) {
+      return -1;
+    }
+    return (long)(int)y * width_ + (int)x;
+  }
+  void hit(long index);
+  
+  int width() const { return width_; }
+  int height() const { return height_; }
+  bool empty() const { return cells_.empty(); }
+  
+private:
+  struct Cell {
+    float persistence; // as of frame
+    uint32_t frame;
+  };
+  // Persistence as of frame (not before cell.frame), the frames since its last hit being misses.
+  float decayed(const Cell &cell, uint32_t frame) const {
+    uint32_t age = frame - cell.frame;
+    if(age > frame_ - cell.frame) {
+      return cell.persistence; // frame before the last hit
+    }
+    return age < decay_.size() ? cell.persistence * decay_[age] : 0.0f;
+  }
+  
+  int width_;
+  int height_;
+  float learning_rate_;
+  float threshold_;
+  uint32_t frame_;
+  std::vector<Cell> cells_;
+  std::vector<float> decay_; // (1 - learning_rate)^age, until negligible
+};
+
+#endif // BACKGROUND_MODEL_H
@@ -0,0 +1,77 @@
+// Copyright (C) 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef EXPECTED_RANGES_H
+#define EXPECTED_RANGES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+// Ranges a 2D lidar should measure in the map, for the positions quantized
+// into square bins of bin_size cells: from the centre of a bin, one ray per
+// heading (angles over a full turn, from the x axis of the map) is cast to the
+// first occupied (100) or unknown (-1) cell, the map border or max_range. A
+// bin is ray-cast the first time it is looked up, then served from the cache
+// of the capacity most recently used bins, so the areas the robot keeps
+// coming back to cost one table lookup per beam. All lengths are in cells.
+class ExpectedRanges {
+public:
+  ExpectedRanges() : grid_(NULL), width_(0), height_(0), max_range_(0.0f), bin_size_(2.0f), angles_(1440), capacity_(4096), hits_(0), misses_(0) {}
+
+  // Empties the cache when the bins change.
+  void configure(float bin_size, int angles, size_t capacity);
+  // Starts over on another grid, which must outlive its use here.
+  void reset(const int8_t *grid, int width, int height, float max_range);
+
+  // The expected ranges of the bin of (x, y), fractional grid coordinates;
+  // valid until the next lookup.
+  const float *profile(float x, float y);
+  // Index of the heading closest to angle (radians, map frame).
+  int heading(double angle) const;
+
+  int angles() const { return angles_; }
+  size_t size() const { return lru_.size(); }
+  unsigned long hits() const { return hits_; }
+  unsigned long misses() const { return misses_; }
+
+private:
+  struct Bin {
+    uint64_t key;
+    std::vector<float> ranges;
+  };
+
+  void clear();
+  void cast(float x, float y, std::vector<float> &ranges) const;
+  float castRay(float x, float y, float dx, float dy) const;
+
+  const int8_t *grid_;
+  int width_;
+  int height_;
+  float max_range_;
+  float bin_size_;
+  int angles_;
+  size_t capacity_;
+  std::vector<float> cos_;
+  std::vector<float> sin_;
+  std::list<Bin> lru_;  // most recently used first
+  std::unordered_map<uint64_t, std::list<Bin>::iterator> bins_;
+  unsigned long hits_;
+  unsigned long misses_;
+};
+
+#endif // EXPECTED_RANGES_H
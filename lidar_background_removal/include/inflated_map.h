@@ -0,0 +1,65 @@
+// Copyright (C) 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef INFLATED_MAP_H
+#define INFLATED_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// One bit per map cell, set when an occupied (100) or unknown (-1) cell, or
+// the border of the map, lies within `radius` cells (square window). Built
+// once per map, so testing a point costs one lookup whatever the inflation.
+class InflatedMap {
+public:
+  InflatedMap() : width_(0), height_(0), radius_(0) {}
+  
+  void build(const int8_t *data, int width, int height, int radius);
+  // The cells of the rectangle changed in data (the whole grid, as given to
+  // build()): only their neighbourhood is inflated again.
+  void update(const int8_t *data, int x, int y, int width, int height);
+  
+  // Cells outside the map are background too.
+  bool background(int x, int y) const {
+    if(x < 0 || y < 0 || x >= width_ || y >= height_) {
+      return true;
+    }
+    size_t i = (size_t)y * width_ + x;
+    return (bits_[i >> 6] >> (i & 63)) & 1;
+  }
+  // Fractional grid coordinates, NaN and infinity are background.
+  bool background(float x, float y) const {
+    if(!(x >= 0.0f && y >= 0.0f && x < width_ && y < height_)) {
+      return true;
+    }
+    return background((int)x, (int)y);
+  }
+  
+  int width() const { return width_; }
+  int height() const { return height_; }
+  // Row-major, bit i of the map in word i / 64, e.g. to upload it to a GPU.
+  const std::vector<uint64_t> &bits() const { return bits_; }
+  
+private:
+  void inflate(const int8_t *data, int x, int y, int width, int height);
+  
+  int width_;
+  int height_;
+  int radius_;
+  std::vector<uint64_t> bits_;
+};
+
+#endif // INFLATED_MAP_H
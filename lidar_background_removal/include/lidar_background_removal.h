@@ -0,0 +1,150 @@
+// Copyright (C) 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIDAR_BACKGROUND_REMOVAL_H
+#define LIDAR_BACKGROUND_REMOVAL_H
+
+#include <ros/ros.h>
+#include <tf/transform_listener.h>
+#include <tf/message_filter.h>
+#include <message_filters/subscriber.h>
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <sensor_msgs/LaserScan.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <nav_msgs/OccupancyGrid.h>
+#include <map_msgs/OccupancyGridUpdate.h>
+#include <thread_config/thread_config.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <deque>
+
+#include "background_model.h"
+#include "expected_ranges.h"
+#include "inflated_map.h"
+#include "scan_projection.h"
+
+#define __APP_NAME__ "lidar_background_removal"
+
+// The filter of the node and of the nodelet, on the given node handles. The
+// lidar callbacks run on one thread, the map is inflated on another one.
+class LidarBackgroundRemoval {
+public:
+  LidarBackgroundRemoval(ros::NodeHandle nh = ros::NodeHandle(), ros::NodeHandle private_nh = ros::NodeHandle("~"));
+  ~LidarBackgroundRemoval();
+  
+private:
+  // The occupancy grid and its inflation, never modified once published to the
+  // callbacks: map changes are applied to a copy, which then replaces it.
+  struct BackgroundMap {
+    std_msgs::Header header;
+    nav_msgs::MapMetaData info;
+    std::vector<int8_t> grid;  // kept for the re-inflation of partial updates
+    InflatedMap inflated;
+  };
+  // full maps or partial updates, applied in order by mapThread()
+  struct MapChange {
+    nav_msgs::OccupancyGrid::ConstPtr map;
+    map_msgs::OccupancyGridUpdate::ConstPtr update;
+  };
+  
+  boost::shared_ptr<const BackgroundMap> currentMap();
+  boost::shared_ptr<BackgroundMap> inflateMap(const nav_msgs::OccupancyGrid &msg);
+  void applyUpdate(BackgroundMap &map, const map_msgs::OccupancyGridUpdate &update);
+  void mapThread(const thread_config::Settings &settings);
+  void pushMapChange(const MapChange &change);
+  void mapCallback(const nav_msgs::OccupancyGrid::ConstPtr &msg);
+  void mapUpdateCallback(const map_msgs::OccupancyGridUpdate::ConstPtr &msg);
+  
+  void gridTransform(const tf::Transform &transform, const BackgroundMap &map, float affine[6]);
+  bool lookupTransform(const std_msgs::Header &header, tf::StampedTransform &transform);
+  template <typename M> void arrivalCallback(const boost::shared_ptr<const M> &msg);
+  template <typename M> void failureCallback(const boost::shared_ptr<const M> &msg, tf::filter_failure_reasons::FilterFailureReason reason);
+  template <typename M> tf::MessageFilter<M> *subscribeWithTransform(message_filters::Subscriber<M> &sub, ros::NodeHandle &nh, const std::string &topic, int queue_size, void (LidarBackgroundRemoval::*callback)(const boost::shared_ptr<const M> &));
+  
+  void prepareModel(const BackgroundMap &map);
+  void learnHits();
+  void countRemoval(unsigned long points, unsigned long removed, size_t input_bytes, size_t output_bytes);
+  void laserCallback(const sensor_msgs::LaserScan::ConstPtr &scan);
+  void pointCallback(const sensor_msgs::PointCloud2::ConstPtr &cloud);
+  
+  void tfDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void modelDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void removalDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void threadDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  
+  std::string map_frame_;
+  float inflation_;
+  int threads_;
+  ros::Publisher lidar_filtered_pub_;
+  tf::TransformListener *listener_;
+  ScanProjection scan_projection_;
+  diagnostic_updater::Updater diagnostics_;
+  
+  // Learned on the map cells, only by the lidar callbacks, c.f.
+  // background_model.h. It starts over with every map of another size.
+  bool learn_background_;
+  BackgroundModel background_model_;
+  std::vector<long> hit_cells_;
+  unsigned long learned_points_;
+  
+  // 2D scans are compared beam by beam to the ranges ray-cast in the map,
+  // c.f. expected_ranges.h, instead of testing their endpoints against the
+  // inflated map; the cache starts over with every map
+  bool use_expected_ranges_;
+  float expected_range_margin_;  // cells
+  ExpectedRanges expected_ranges_;
+  boost::shared_ptr<const BackgroundMap> ranges_map_;
+  float ranges_max_range_;
+  
+  // 3D clouds are published as they came, the removed points set to NaN, or
+  // compacted to the surviving points (compact)
+  bool compact_;
+  std::vector<uint8_t> removed_;  // per point of the cloud being filtered
+  unsigned long input_points_;
+  unsigned long removed_points_;
+  double last_removal_ratio_;
+  unsigned long long input_bytes_;
+  unsigned long long output_bytes_;
+  
+  // messages published, waiting for their transform on arrival, dropped
+  // without one (too old, or pushed out of the queue), failed lookups, and
+  // dropped before the first map
+  unsigned long filtered_frames_;
+  unsigned long deferred_frames_;
+  unsigned long dropped_frames_;
+  unsigned long lookup_failures_;
+  unsigned long frames_without_map_;
+  
+  boost::mutex map_mutex_;
+  boost::shared_ptr<const BackgroundMap> map_;
+  
+  boost::mutex changes_mutex_;
+  boost::condition_variable changes_cond_;
+  std::deque<MapChange> changes_;
+  bool running_;
+  unsigned long map_updates_;
+  boost::thread map_thread_;
+  std::string node_name_;  // the threads are recorded for, c.f. thread_config
+  
+  ros::Subscriber map_sub_;
+  ros::Subscriber map_updates_sub_;
+  message_filters::Subscriber<sensor_msgs::PointCloud2> cloud_sub_;
+  message_filters::Subscriber<sensor_msgs::LaserScan> scan_sub_;
+  boost::shared_ptr<tf::MessageFilter<sensor_msgs::PointCloud2> > cloud_filter_;
+  boost::shared_ptr<tf::MessageFilter<sensor_msgs::LaserScan> > scan_filter_;
+};
+
+#endif // LIDAR_BACKGROUND_REMOVAL_H
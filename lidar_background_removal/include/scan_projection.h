@@ -0,0 +1,51 @@
+// Copyright (C) 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SCAN_PROJECTION_H
+#define SCAN_PROJECTION_H
+
+#include <stddef.h>
+#include <vector>
+
+// Map cells of the endpoints of a whole laser scan. The beam directions are
+// tabulated once per scan configuration, the endpoints then come from plain
+// structure-of-arrays loops (polar to cartesian, then one 2D affine transform
+// into grid coordinates) that the compiler vectorizes.
+class ScanProjection {
+public:
+  ScanProjection() : angle_min_(0.0f), angle_increment_(0.0f) {}
+  
+  // Only rebuilds the sin/cos table when the configuration changed.
+  void configure(float angle_min, float angle_increment, size_t beams);
+  
+  // affine = {a00, a01, b0, a10, a11, b1} maps a point of the scan plane to
+  // fractional grid coordinates, i.e. the transform into the map frame, minus
+  // the map origin, over the resolution. Non-finite ranges give non-finite cells.
+  void project(const float *ranges, const float affine[6]);
+  
+  size_t beams() const { return cos_.size(); }
+  const float *cellX() const { return cell_x_.data(); }
+  const float *cellY() const { return cell_y_.data(); }
+  
+private:
+  float angle_min_;
+  float angle_increment_;
+  std::vector<float> cos_;
+  std::vector<float> sin_;
+  std::vector<float> cell_x_;
+  std::vector<float> cell_y_;
+};
+
+#endif // SCAN_PROJECTION_H
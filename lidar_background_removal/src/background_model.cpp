@@ -0,0 +1,51 @@
+// Copyright (C) 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "background_model.h"
+
+#include <algorithm>
+#include <cmath>
+
+void BackgroundModel::configure(float learning_rate, float threshold) {
+  learning_rate_ = std::min(std::max(learning_rate, 1e-6f), 1.0f);
+  threshold_ = threshold;
+  decay_.clear();
+  for(float d = 1.0f; d > 1e-3f && decay_.size() < 1000000; d *= 1.0f - learning_rate_) {
+    decay_.push_back(d);
+  }
+}
+
+void BackgroundModel::reset(int width, int height) {
+  width_ = width > 0 ? width : 0;
+  height_ = height > 0 ? height : 0;
+  Cell empty = {0.0f, frame_};
+  cells_.assign((size_t)width_ * height_, empty);
+}
+
+void BackgroundModel::hit(int x, int y) {
+  if(x >= 0 && y >= 0 && x < width_ && y < height_) {
+    hit((long)y * width_ + x);
+  }
+}
+
+void BackgroundModel::hit(long index) {
+  Cell &cell = cells_[index];
+  if(cell.frame == frame_ && cell.persistence > 0.0f) {
+    return; // already hit in this frame
+  }
+  // the frames since the last hit were misses, this one is a hit
+  cell.persistence = decayed(cell, frame_) + learning_rate_;
+  cell.frame = frame_;
+}
@@ -0,0 +1,123 @@
+// Copyright (C) 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "expected_ranges.h"
+
+#include <algorithm>
+#include <cmath>
+
+void ExpectedRanges::configure(float bin_size, int angles, size_t capacity) {
+  bin_size = std::max(bin_size, 1e-3f);
+  angles = std::max(angles, 1);
+  capacity = std::max(capacity, (size_t)1);
+  if(bin_size == bin_size_ && angles == angles_ && capacity == capacity_ && (int)cos_.size() == angles_) {
+    return;
+  }
+  bin_size_ = bin_size;
+  angles_ = angles;
+  capacity_ = capacity;
+  cos_.resize(angles_);
+  sin_.resize(angles_);
+  for(int k = 0; k < angles_; k++) {
+    double angle = 2.0 * M_PI * k / angles_;
+    cos_[k] = cos(angle);
+    sin_[k] = sin(angle);
+  }
+  clear();
+}
+
+void ExpectedRanges::reset(const int8_t *grid, int width, int height, float max_range) {
+  grid_ = grid;
+  width_ = width > 0 ? width : 0;
+  height_ = height > 0 ? height : 0;
+  max_range_ = max_range > 0.0f ? max_range : 0.0f;
+  if(cos_.empty()) {
+    configure(bin_size_, angles_, capacity_);
+  }
+  clear();
+}
+
+void ExpectedRanges::clear() {
+  lru_.clear();
+  bins_.clear();
+}
+
+int ExpectedRanges::heading(double angle) const {
+  long k = lround(angle * angles_ / (2.0 * M_PI)) % angles_;
+  return k < 0 ? k + angles_ : k;
+}
+
+const float *ExpectedRanges::profile(float x, float y) {
+  int ix = (int)floor(x / bin_size_), iy = (int)floor(y / bin_size_);
+  uint64_t key = ((uint64_t)(uint32_t)ix << 32) | (uint32_t)iy;
+  std::unordered_map<uint64_t, std::list<Bin>::iterator>::iterator it = bins_.find(key);
+  if(it != bins_.end()) {
+    hits_++;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return lru_.front().ranges.data();
+  }
+
+  misses_++;
+  if(lru_.size() >= capacity_) {
+    // the least recently used bin is recycled, with its buffer
+    bins_.erase(lru_.back().key);
+    lru_.splice(lru_.begin(), lru_, --lru_.end());
+  } else {
+    lru_.push_front(Bin());
+  }
+  Bin &bin = lru_.front();
+  bin.key = key;
+  cast((ix + 0.5f) * bin_size_, (iy + 0.5f) * bin_size_, bin.ranges);
+  bins_[key] = lru_.begin();
+  return bin.ranges.data();
+}
+
+void ExpectedRanges::cast(float x, float y, std::vector<float> &ranges) const {
+  ranges.resize(angles_);
+  for(int k = 0; k < angles_; k++) {
+    ranges[k] = castRay(x, y, cos_[k], sin_[k]);
+  }
+}
+
+// Cell by cell along the ray (Amanatides & Woo), the distance to where it
+// enters the first background cell, i.e. the nearest a return from it can be.
+float ExpectedRanges::castRay(float x, float y, float dx, float dy) const {
+  int cx = (int)floor(x), cy = (int)floor(y);
+  const int step_x = dx < 0.0f ? -1 : 1, step_y = dy < 0.0f ? -1 : 1;
+  const float delta_x = dx != 0.0f ? fabsf(1.0f / dx) : INFINITY;
+  const float delta_y = dy != 0.0f ? fabsf(1.0f / dy) : INFINITY;
+  float next_x = dx != 0.0f ? ((step_x > 0 ? cx + 1 - x : x - cx) * delta_x) : INFINITY;
+  float next_y = dy != 0.0f ? ((step_y > 0 ? cy + 1 - y : y - cy) * delta_y) : INFINITY;
+  float t = 0.0f;
+  while(t < max_range_) {
+    if(cx < 0 || cy < 0 || cx >= width_ || cy >= height_) {
+      return t; // the cells beyond the map count as background
+    }
+    int8_t cell = grid_[(size_t)cy * width_ + cx];
+    if(cell == 100 || cell == -1) {
+      return t;
+    }
+    if(next_x < next_y) {
+      t = next_x;
+      next_x += delta_x;
+      cx += step_x;
+    } else {
+      t = next_y;
+      next_y += delta_y;
+      cy += step_y;
+    }
+  }
+  return max_range_;
+}
@@ -0,0 +1,81 @@
+// Copyright (C) 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "inflated_map.h"
+
+#include <algorithm>
+
+// Whether any cell of [i - radius, i + radius] is set in a line of n cells,
+// the cells beyond the line count as set. prefix[k] holds the set cells of
+// [lo, lo + k), which must cover the window.
+static bool windowSet(const std::vector<int> &prefix, int lo, int i, int n, int radius) {
+  if(i - radius < 0 || i + radius >= n) {
+    return true;
+  }
+  return prefix[i + radius + 1 - lo] - prefix[i - radius - lo] > 0;
+}
+
+void InflatedMap::build(const int8_t *data, int width, int height, int radius) {
+  width_ = width > 0 ? width : 0;
+  height_ = height > 0 ? height : 0;
+  radius_ = radius > 0 ? radius : 0;
+  bits_.assign(((size_t)width_ * height_ + 63) / 64, 0);
+  inflate(data, 0, 0, width_, height_);
+}
+
+void InflatedMap::update(const int8_t *data, int x, int y, int width, int height) {
+  // a changed cell affects every cell up to radius_ away
+  int x0 = std::max(x - radius_, 0), y0 = std::max(y - radius_, 0);
+  int x1 = std::min(x + width + radius_, width_), y1 = std::min(y + height + radius_, height_);
+  if(x0 < x1 && y0 < y1) {
+    inflate(data, x0, y0, x1 - x0, y1 - y0);
+  }
+}
+
+// The square dilation is separable: rows first, then columns, both with
+// prefix sums over the region and its margin, i.e. O(region) for any radius.
+void InflatedMap::inflate(const int8_t *data, int x, int y, int width, int height) {
+  const int r = radius_;
+  int ry0 = std::max(y - r, 0), ry1 = std::min(y + height + r, height_); // rows the columns need
+  int cx0 = std::max(x - r, 0), cx1 = std::min(x + width + r, width_);   // cells the rows need
+  std::vector<uint8_t> rows((size_t)(ry1 - ry0) * width);
+  std::vector<int> prefix(std::max(cx1 - cx0, ry1 - ry0) + 1);
+  
+  for(int j = ry0; j < ry1; j++) {
+    const int8_t *line = data + (size_t)j * width_;
+    prefix[0] = 0;
+    for(int i = cx0; i < cx1; i++) {
+      prefix[i-cx0+1] = prefix[i-cx0] + (line[i] == 100 || line[i] == -1);
+    }
+    for(int i = x; i < x + width; i++) {
+      rows[(size_t)(j - ry0) * width + (i - x)] = windowSet(prefix, cx0, i, width_, r);
+    }
+  }
+  
+  for(int i = x; i < x + width; i++) {
+    prefix[0] = 0;
+    for(int j = ry0; j < ry1; j++) {
+      prefix[j-ry0+1] = prefix[j-ry0] + rows[(size_t)(j - ry0) * width + (i - x)];
+    }
+    for(int j = y; j < y + height; j++) {
+      size_t k = (size_t)j * width_ + i;
+      if(windowSet(prefix, ry0, j, height_, r)) {
+	bits_[k >> 6] |= (uint64_t)1 << (k & 63);
+      } else {
+	bits_[k >> 6] &= ~((uint64_t)1 << (k & 63));
+      }
+    }
+  }
+}
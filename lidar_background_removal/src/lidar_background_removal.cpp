@@ -13,151 +13,493 @@
 // You should have received a copy of the GNU General Public License along
 // with this program.  If not, see <http://www.gnu.org/licenses/>.
 
-// ROS
-#include <ros/ros.h>
-#include <tf/transform_listener.h>
-#include <sensor_msgs/LaserScan.h>
-#include <sensor_msgs/PointCloud.h>
-#include <sensor_msgs/PointCloud2.h>
-#include <sensor_msgs/point_cloud_conversion.h>
-#include <geometry_msgs/Point.h>
-#include <nav_msgs/OccupancyGrid.h>
-
-#define __APP_NAME__ "lidar_background_removal"
-
-std::string map_frame_;
-float inflation_;
-ros::Publisher lidar_filtered_pub_;
-tf::TransformListener *listener_;
-nav_msgs::OccupancyGrid::ConstPtr map_;
-
-bool lookupTransform(const std::string &source_frame, tf::StampedTransform &transform) {
+#include "lidar_background_removal.h"
+
+#include <point_cloud_pool/point_cloud_pool.h>
+
+#include <cstring>
+
+boost::shared_ptr<const LidarBackgroundRemoval::BackgroundMap> LidarBackgroundRemoval::currentMap() {
+  boost::lock_guard<boost::mutex> lock(map_mutex_);
+  return map_;
+}
+
+// Inflation is applied once to the whole map, c.f. inflated_map.h, in whole
+// cells (a fractional inflation is rounded up).
+boost::shared_ptr<LidarBackgroundRemoval::BackgroundMap> LidarBackgroundRemoval::inflateMap(const nav_msgs::OccupancyGrid &msg) {
+  boost::shared_ptr<BackgroundMap> map(new BackgroundMap);
+  map->header = msg.header;
+  map->info = msg.info;
+  map->grid = msg.data;
+  map->grid.resize((size_t)msg.info.width * msg.info.height, -1);
+  map->inflated.build(map->grid.data(), map->info.width, map->info.height, (int)ceil(inflation_ - 1e-3));
+  return map;
+}
+
+// Patches outside the map are clipped.
+void LidarBackgroundRemoval::applyUpdate(BackgroundMap &map, const map_msgs::OccupancyGridUpdate &update) {
+  int x0 = std::max(update.x, 0), y0 = std::max(update.y, 0);
+  int x1 = std::min(update.x + (int)update.width, (int)map.info.width);
+  int y1 = std::min(update.y + (int)update.height, (int)map.info.height);
+  if(x0 >= x1 || y0 >= y1 || update.data.size() < (size_t)update.width * update.height) {
+    return;
+  }
+  for(int y = y0; y < y1; y++) {
+    const int8_t *row = &update.data[(size_t)(y - update.y) * update.width + (x0 - update.x)];
+    std::copy(row, row + (x1 - x0), &map.grid[(size_t)y * map.info.width + x0]);
+  }
+  map.inflated.update(map.grid.data(), x0, y0, x1 - x0, y1 - y0);
+}
+
+// The inflation runs here, the filter callbacks keep using the previous map
+// until the new one is swapped in.
+void LidarBackgroundRemoval::mapThread(const thread_config::Settings &settings) {
+  thread_config::apply(node_name_, "map", settings);
+  while(true) {
+    std::deque<MapChange> changes;
+    {
+      boost::unique_lock<boost::mutex> lock(changes_mutex_);
+      while(running_ && changes_.empty()) {
+	changes_cond_.wait(lock);
+      }
+      if(!running_) {
+	return;
+      }
+      changes.swap(changes_);
+    }
+    
+    // a full map makes the changes before it moot
+    size_t first = 0;
+    for(size_t i = 0; i < changes.size(); i++) {
+      if(changes[i].map) {
+	first = i;
+      }
+    }
+    boost::shared_ptr<BackgroundMap> map;
+    for(size_t i = first; i < changes.size(); i++) {
+      if(changes[i].map) {
+	map = inflateMap(*changes[i].map);
+      } else {
+	if(!map) {
+	  boost::shared_ptr<const BackgroundMap> current = currentMap();
+	  if(!current) {
+	    continue; // no map to patch yet
+	  }
+	  map.reset(new BackgroundMap(*current));
+	}
+	applyUpdate(*map, *changes[i].update);
+      }
+    }
+    if(map) {
+      boost::lock_guard<boost::mutex> lock(map_mutex_);
+      if(!map_) {
+	ROS_WARN("[%s] Map received!", __APP_NAME__);
+      }
+      map_ = map;
+      map_updates_++;
+    }
+  }
+}
+
+void LidarBackgroundRemoval::pushMapChange(const MapChange &change) {
+  {
+    boost::lock_guard<boost::mutex> lock(changes_mutex_);
+    changes_.push_back(change);
+  }
+  changes_cond_.notify_one();
+}
+
+void LidarBackgroundRemoval::mapCallback(const nav_msgs::OccupancyGrid::ConstPtr &msg) {
+  boost::shared_ptr<const BackgroundMap> current = currentMap();
+  if(current && current->header.stamp == msg->header.stamp && current->info.map_load_time == msg->info.map_load_time &&
+     current->info.width == msg->info.width && current->info.height == msg->info.height) {
+    return; // the same latched map again, e.g. after a reconnection
+  }
+  MapChange change;
+  change.map = msg;
+  pushMapChange(change);
+}
+
+void LidarBackgroundRemoval::mapUpdateCallback(const map_msgs::OccupancyGridUpdate::ConstPtr &msg) {
+  MapChange change;
+  change.update = msg;
+  pushMapChange(change);
+}
+
+// Lidar plane -> map frame -> grid cells, as one 2D affine transform
+// {a00, a01, b0, a10, a11, b1}; the map is 2D, points are taken at height 0.
+void LidarBackgroundRemoval::gridTransform(const tf::Transform &transform, const BackgroundMap &map, float affine[6]) {
+  const tf::Matrix3x3 &r = transform.getBasis();
+  const tf::Vector3 &t = transform.getOrigin();
+  double res = map.info.resolution;
+  affine[0] = r[0][0] / res;
+  affine[1] = r[0][1] / res;
+  affine[2] = (t.x() - map.info.origin.position.x) / res;
+  affine[3] = r[1][0] / res;
+  affine[4] = r[1][1] / res;
+  affine[5] = (t.y() - map.info.origin.position.y) / res;
+}
+
+static bool pointOffsets(const sensor_msgs::PointCloud2 &cloud, int offsets[3]) {
+  const char *names[3] = {"x", "y", "z"};
+  for(int k = 0; k < 3; k++) {
+    offsets[k] = -1;
+    for(size_t i = 0; i < cloud.fields.size(); i++) {
+      if(cloud.fields[i].name == names[k] && cloud.fields[i].datatype == sensor_msgs::PointField::FLOAT32) {
+	offsets[k] = cloud.fields[i].offset;
+      }
+    }
+    if(offsets[k] < 0 || offsets[k] + sizeof(float) > cloud.point_step) {
+      return false;
+    }
+  }
+  return cloud.data.size() >= (size_t)cloud.row_step * cloud.height;
+}
+
+// At the stamp of the message, interpolated by tf. Never waits: the message
+// filter only hands over messages once their transform is buffered.
+bool LidarBackgroundRemoval::lookupTransform(const std_msgs::Header &header, tf::StampedTransform &transform) {
   try {
-    ros::Time now = ros::Time::now();
-    listener_->waitForTransform(map_frame_, source_frame, now, ros::Duration(0.1));
-    listener_->lookupTransform(map_frame_, source_frame, now, transform);
-  } catch(tf::TransformException ex) {
-    ROS_ERROR("-------> %s", ex.what());
+    listener_->lookupTransform(map_frame_, header.frame_id, header.stamp, transform);
+  } catch(tf::TransformException &ex) {
+    lookup_failures_++;
+    ROS_WARN_THROTTLE(5.0, "[%s] %s", __APP_NAME__, ex.what());
     return false;
   }
   
   return true;
 }
 
-void laserCallback(const sensor_msgs::LaserScan::ConstPtr &scan) {
+template <typename M>
+void LidarBackgroundRemoval::arrivalCallback(const boost::shared_ptr<const M> &msg) {
+  if(!listener_->canTransform(map_frame_, msg->header.frame_id, msg->header.stamp)) {
+    deferred_frames_++;
+  }
+}
+
+template <typename M>
+void LidarBackgroundRemoval::failureCallback(const boost::shared_ptr<const M> &msg, tf::filter_failure_reasons::FilterFailureReason reason) {
+  dropped_frames_++;
+}
+
+// The points left by the map are tested against the model, their cells are
+// learned once the frame is filtered, so a hit only counts from the next frame.
+void LidarBackgroundRemoval::prepareModel(const BackgroundMap &map) {
+  if(background_model_.width() != (int)map.info.width || background_model_.height() != (int)map.info.height) {
+    background_model_.reset(map.info.width, map.info.height);
+  }
+  background_model_.beginFrame();
+}
+
+void LidarBackgroundRemoval::learnHits() {
+  for(size_t i = 0; i < hit_cells_.size(); i++) {
+    if(hit_cells_[i] >= 0) {
+      background_model_.hit(hit_cells_[i]);
+    }
+  }
+}
+
+void LidarBackgroundRemoval::countRemoval(unsigned long points, unsigned long removed, size_t input_bytes, size_t output_bytes) {
+  input_points_ += points;
+  removed_points_ += removed;
+  last_removal_ratio_ = points > 0 ? (double)removed / points : 0.0;
+  input_bytes_ += input_bytes;
+  output_bytes_ += output_bytes;
+}
+
+void LidarBackgroundRemoval::removalDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  stat.summary(diagnostic_msgs::DiagnosticStatus::OK, compact_ ? "Compacted output" : "NaN-filled output");
+  stat.add("removal ratio (last frame)", last_removal_ratio_);
+  stat.add("removal ratio", input_points_ > 0 ? (double)removed_points_ / input_points_ : 0.0);
+  stat.add("points in", input_points_);
+  stat.add("points removed", removed_points_);
+  if(input_bytes_ > 0) {
+    stat.add("cloud bytes out / in", (double)output_bytes_ / input_bytes_);
+  }
+  if(use_expected_ranges_) {
+    unsigned long lookups = expected_ranges_.hits() + expected_ranges_.misses();
+    stat.add("expected range bins cached", expected_ranges_.size());
+    stat.add("expected range hit rate", lookups > 0 ? (double)expected_ranges_.hits() / lookups : 0.0);
+  }
+}
+
+void LidarBackgroundRemoval::threadDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  thread_config::diagnostics(stat, node_name_);
+}
+
+void LidarBackgroundRemoval::modelDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  stat.summary(diagnostic_msgs::DiagnosticStatus::OK, learn_background_ ? "Learning" : "Disabled");
+  stat.add("points removed as learned background", learned_points_);
+}
+
+void LidarBackgroundRemoval::tfDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  if(!currentMap()) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "Waiting for the map");
+  } else if(dropped_frames_ + lookup_failures_ > 0) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "Frames dropped without transform");
+  } else {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "OK");
+  }
+  stat.add("filtered frames", filtered_frames_);
+  stat.add("deferred frames", deferred_frames_);
+  stat.add("dropped frames", dropped_frames_);
+  stat.add("lookup failures", lookup_failures_);
+  stat.add("frames before the map", frames_without_map_);
+  stat.add("map updates", map_updates_);
+}
+
+// The lidar messages go through a tf::MessageFilter, which queues them until
+// the transform at their stamp is available and drops the oldest ones beyond
+// queue_size.
+template <typename M>
+tf::MessageFilter<M> *LidarBackgroundRemoval::subscribeWithTransform(message_filters::Subscriber<M> &sub, ros::NodeHandle &nh, const std::string &topic, int queue_size, void (LidarBackgroundRemoval::*callback)(const boost::shared_ptr<const M> &)) {
+  sub.subscribe(nh, topic, 1);
+  sub.registerCallback(boost::bind(&LidarBackgroundRemoval::arrivalCallback<M>, this, _1));
+  tf::MessageFilter<M> *filter = new tf::MessageFilter<M>(sub, *listener_, map_frame_, queue_size, nh);
+  filter->registerCallback(boost::bind(callback, this, _1));
+  filter->registerFailureCallback(boost::bind(&LidarBackgroundRemoval::failureCallback<M>, this, _1, _2));
+  return filter;
+}
+
+void LidarBackgroundRemoval::laserCallback(const sensor_msgs::LaserScan::ConstPtr &scan) {
   tf::StampedTransform transform;
   
-  if(lookupTransform(scan->header.frame_id, transform)) {
-    float angle;
-    geometry_msgs::Point p;
-    tf::Point point_in_lidar, point_in_map;
-    sensor_msgs::LaserScan scan_filtered = *scan;
+  boost::shared_ptr<const BackgroundMap> map = currentMap();
+  if(!map) {
+    frames_without_map_++;
+  } else if(lookupTransform(scan->header, transform)) {
+    sensor_msgs::LaserScan::Ptr scan_filtered(new sensor_msgs::LaserScan(*scan));
     
-    for(int i = 0; i < scan->ranges.size(); i++) {
-      angle = scan->angle_min + (i * scan->angle_increment);
-      p.x = scan->ranges[i] * cos(angle);
-      p.y = scan->ranges[i] * sin(angle);
-      
-      tf::pointMsgToTF(p, point_in_lidar);
-      point_in_map = transform * point_in_lidar;
-
-      float x = (point_in_map.getX() - map_->info.origin.position.x) / map_->info.resolution;
-      float y = (point_in_map.getY() - map_->info.origin.position.y) / map_->info.resolution;
-
-      for(int j = x - inflation_; j <= x + inflation_; j++) {
-	for(int k = y - inflation_; k <= y + inflation_; k++) {
-	  int idx = j + k * (int)map_->info.width;
-	  if(idx >= map_->data.size()) {
-	    scan_filtered.ranges[i] = NAN;
-	    scan_filtered.intensities[i] = NAN;
-	  } else {
-	    if(map_->data[idx] == 100 || map_->data[idx] == -1) {
-	      scan_filtered.ranges[i] = NAN;
-	      scan_filtered.intensities[i] = NAN;
-	      k = y + inflation_;
-	      j = x + inflation_;
-	    }
-	  }
+    float affine[6];
+    gridTransform(transform, *map, affine);
+    scan_projection_.configure(scan->angle_min, scan->angle_increment, scan->ranges.size());
+    scan_projection_.project(scan->ranges.data(), affine);
+    
+    const float *cell_x = scan_projection_.cellX(), *cell_y = scan_projection_.cellY();
+    const float *expected = NULL;
+    double yaw = 0.0, turn = 1.0;
+    if(use_expected_ranges_) {
+      float max_range = scan->range_max / map->info.resolution;
+      if(ranges_map_ != map || ranges_max_range_ != max_range) {
+	expected_ranges_.reset(map->grid.data(), map->info.width, map->info.height, max_range);
+	ranges_map_ = map;
+	ranges_max_range_ = max_range;
+      }
+      expected = expected_ranges_.profile(affine[2], affine[5]);
+      // the heading of the scan's x axis in the map, the beams turning the
+      // other way round on a lidar mounted upside down
+      yaw = atan2(affine[3], affine[0]);
+      turn = affine[0] * affine[4] - affine[1] * affine[3] < 0.0f ? -1.0 : 1.0;
+    }
+    if(learn_background_) {
+      prepareModel(*map);
+      hit_cells_.assign(scan->ranges.size(), -1);
+    }
+    unsigned long removed_count = 0;
+    for(size_t i = 0; i < scan->ranges.size(); i++) {
+      bool background;
+      if(expected) {
+	// NaN and out of range beams are removed, as their endpoints are off the map
+	float range = scan->ranges[i] / map->info.resolution;
+	int heading = expected_ranges_.heading(yaw + turn * (scan->angle_min + i * scan->angle_increment));
+	background = !(range < expected[heading] - expected_range_margin_);
+      } else {
+	background = map->inflated.background(cell_x[i], cell_y[i]);
+      }
+      if(!background && learn_background_) {
+	hit_cells_[i] = background_model_.index(cell_x[i], cell_y[i]);
+	background = background_model_.isStatic(cell_x[i], cell_y[i]);
+	learned_points_ += background;
+      }
+      if(background) {
+	removed_count++;
+	scan_filtered->ranges[i] = NAN;
+	if(i < scan_filtered->intensities.size()) {
+	  scan_filtered->intensities[i] = NAN;
 	}
       }
     }
+    if(learn_background_) {
+      learnHits();
+    }
+    // beams are indexed by their angle, scans are never compacted
+    countRemoval(scan->ranges.size(), removed_count, 0, 0);
     
-    lidar_filtered_pub_.publish(scan_filtered);
+    lidar_filtered_pub_.publish(sensor_msgs::LaserScan::ConstPtr(scan_filtered));
+    filtered_frames_++;
   }
+  diagnostics_.update();
 }
 
-void pointCallback(const sensor_msgs::PointCloud2::ConstPtr &cloud) {
+void LidarBackgroundRemoval::pointCallback(const sensor_msgs::PointCloud2::ConstPtr &cloud) {
   tf::StampedTransform transform;
   
-  if(lookupTransform(cloud->header.frame_id, transform)) {
-    geometry_msgs::Point p;
-    tf::Point point_in_lidar, point_in_map;
-    sensor_msgs::PointCloud pc;
-    sensor_msgs::PointCloud2 cloud_filtered;
+  boost::shared_ptr<const BackgroundMap> map = currentMap();
+  if(!map) {
+    frames_without_map_++;
+  } else if(lookupTransform(cloud->header, transform)) {
+    int offsets[3];
+    if(!pointOffsets(*cloud, offsets)) {
+      ROS_WARN_THROTTLE(5.0, "[%s] Clouds need FLOAT32 x, y and z fields, dropped.", __APP_NAME__);
+      return;
+    }
+    float affine[6];
+    gridTransform(transform, *map, affine);
     
-    sensor_msgs::convertPointCloud2ToPointCloud(*cloud, pc);
+    // contiguous chunks of points per thread, every point is tested by one thread only
+    const long width = cloud->width, points = (long)cloud->width * cloud->height;
+    const uint8_t *input = cloud->data.data();
+    const uint32_t row_step = cloud->row_step, point_step = cloud->point_step;
+    removed_.resize(points);
+    uint8_t *removed = removed_.data();
+    const InflatedMap &inflated = map->inflated;
+    const bool learn = learn_background_;
+    if(learn) {
+      prepareModel(*map);
+      hit_cells_.assign(points, -1);
+    }
+    const BackgroundModel &model = background_model_;
+    long *hit_cells = hit_cells_.data();
+    unsigned long learned = 0, removed_count = 0;
+#pragma omp parallel for schedule(static) num_threads(threads_) if(threads_ > 1) reduction(+:learned, removed_count)
+    for(long i = 0; i < points; i++) {
+      const uint8_t *point = input + (i / width) * row_step + (i % width) * point_step;
+      float x, y;
+      memcpy(&x, point + offsets[0], sizeof(float));
+      memcpy(&y, point + offsets[1], sizeof(float));
+      float cx = affine[0] * x + affine[1] * y + affine[2], cy = affine[3] * x + affine[4] * y + affine[5];
+      bool background = inflated.background(cx, cy);
+      if(!background && learn) {
+	// the hits are learned afterwards, by this thread alone
+	hit_cells[i] = model.index(cx, cy);
+	background = model.isStatic(cx, cy);
+	learned += background;
+      }
+      removed[i] = background;
+      removed_count += background;
+    }
+    if(learn) {
+      learnHits();
+      learned_points_ += learned;
+    }
     
-    for(int i = 0; i < pc.points.size(); i++) {
-      p.x = pc.points[i].x;
-      p.y = pc.points[i].y;
-      
-      tf::pointMsgToTF(p, point_in_lidar);
-      point_in_map = transform * point_in_lidar;
-      
-      float x = (point_in_map.getX() - map_->info.origin.position.x) / map_->info.resolution;
-      float y = (point_in_map.getY() - map_->info.origin.position.y) / map_->info.resolution;
-
-      for(int j = x - inflation_; j <= x + inflation_; j++) {
-	for(int k = y - inflation_; k <= y + inflation_; k++) {
-	  int idx = j + k * (int)map_->info.width;
-	  if(idx >= map_->data.size()) {
-	    pc.points[i].x = NAN;
-	    pc.points[i].y = NAN;
-	    pc.points[i].z = NAN;
-	  } else {
-	    if(map_->data[idx] == 100 || map_->data[idx] == -1) {
-	      pc.points[i].x = NAN;
-	      pc.points[i].y = NAN;
-	      pc.points[i].z = NAN;
-	      k = y + inflation_;
-	      j = x + inflation_;
-	    }
+    // a cloud released by its subscribers, of this or another node of the
+    // process, written in place; every field of the points is kept
+    sensor_msgs::PointCloud2::Ptr cloud_filtered_ptr =
+      point_cloud_pool::acquire(compact_ ? (points - removed_count) * point_step : cloud->data.size());
+    sensor_msgs::PointCloud2 &cloud_filtered = *cloud_filtered_ptr;
+    cloud_filtered.header = cloud->header;
+    cloud_filtered.fields = cloud->fields;
+    cloud_filtered.is_bigendian = cloud->is_bigendian;
+    cloud_filtered.point_step = point_step;
+    if(compact_) {
+      // the survivors only, as one row in their order
+      cloud_filtered.height = 1;
+      cloud_filtered.width = points - removed_count;
+      cloud_filtered.row_step = cloud_filtered.width * point_step;
+      cloud_filtered.data.resize(cloud_filtered.row_step);
+      cloud_filtered.is_dense = cloud->is_dense;
+      uint8_t *output = cloud_filtered.data.data();
+      for(long i = 0; i < points; i++) {
+	if(!removed[i]) {
+	  memcpy(output, input + (i / width) * row_step + (i % width) * point_step, point_step);
+	  output += point_step;
+	}
+      }
+    } else {
+      // the input as it is, the removed points set to NaN
+      cloud_filtered.height = cloud->height;
+      cloud_filtered.width = cloud->width;
+      cloud_filtered.row_step = row_step;
+      cloud_filtered.data.assign(cloud->data.begin(), cloud->data.end());
+      cloud_filtered.is_dense = cloud->is_dense && removed_count == 0;
+      uint8_t *data = cloud_filtered.data.data();
+#pragma omp parallel for schedule(static) num_threads(threads_) if(threads_ > 1)
+      for(long i = 0; i < points; i++) {
+	if(removed[i]) {
+	  static const float nan = NAN;
+	  uint8_t *point = data + (i / width) * row_step + (i % width) * point_step;
+	  for(int k = 0; k < 3; k++) {
+	    memcpy(point + offsets[k], &nan, sizeof(float));
 	  }
 	}
       }
     }
+    countRemoval(points, removed_count, cloud->data.size(), cloud_filtered.data.size());
     
-    sensor_msgs::convertPointCloudToPointCloud2(pc, cloud_filtered);
-    lidar_filtered_pub_.publish(cloud_filtered);
+    lidar_filtered_pub_.publish(sensor_msgs::PointCloud2::ConstPtr(cloud_filtered_ptr));
+    filtered_frames_++;
   }
+  diagnostics_.update();
 }
 
-int main(int argc, char ** argv) {
-  ros::init(argc, argv, __APP_NAME__);
-  ros::NodeHandle nh;
-  ros::NodeHandle private_nh("~");
-  
+LidarBackgroundRemoval::LidarBackgroundRemoval(ros::NodeHandle nh, ros::NodeHandle private_nh)
+  : diagnostics_(nh, private_nh, private_nh.getNamespace()), learned_points_(0), use_expected_ranges_(false),
+    ranges_max_range_(0.0f), input_points_(0), removed_points_(0),
+    last_removal_ratio_(0.0), input_bytes_(0), output_bytes_(0), filtered_frames_(0), deferred_frames_(0),
+    dropped_frames_(0), lookup_failures_(0), frames_without_map_(0), running_(true), map_updates_(0),
+    node_name_(private_nh.getNamespace()) {
   bool three_d;
   private_nh.param<bool>("three_d", three_d, false);
   private_nh.param<std::string>("map_frame", map_frame_, "/map");
   private_nh.param<float>("inflation", inflation_, 2.0);
+  int tf_queue_size;
+  private_nh.param<int>("tf_queue_size", tf_queue_size, 10); // messages waiting for their transform
+  private_nh.param<int>("threads", threads_, 1); // 3D clouds are split among this many threads
+  threads_ = std::max(threads_, 1);
+  private_nh.param<bool>("compact", compact_, false); // 3D clouds of the surviving points only
+  // learned background, for the static objects missing from the map
+  private_nh.param<bool>("learn_background", learn_background_, false);
+  float learning_rate, persistence;
+  private_nh.param<float>("background_learning_rate", learning_rate, 0.005); // weight of one frame
+  private_nh.param<float>("background_persistence", persistence, 0.8); // static above
+  background_model_.configure(learning_rate, persistence);
+  // ray-cast expected ranges for 2D scans, c.f. expected_ranges.h
+  private_nh.param<bool>("expected_ranges", use_expected_ranges_, false);
+  private_nh.param<float>("expected_range_margin", expected_range_margin_, inflation_); // cells short of the expected range still removed
+  float range_bin;
+  int range_angles, range_cache;
+  private_nh.param<float>("expected_range_bin", range_bin, 2.0); // cells, side of the position bins
+  private_nh.param<int>("expected_range_angles", range_angles, 1440); // headings ray-cast per bin
+  private_nh.param<int>("expected_range_cache", range_cache, 4096); // bins kept
+  expected_ranges_.configure(range_bin, range_angles, std::max(range_cache, 1));
   
   listener_ = new tf::TransformListener();
+  diagnostics_.setHardwareID(__APP_NAME__);
+  diagnostics_.add("tf", this, &LidarBackgroundRemoval::tfDiagnostics);
+  diagnostics_.add("background model", this, &LidarBackgroundRemoval::modelDiagnostics);
+  diagnostics_.add("removal", this, &LidarBackgroundRemoval::removalDiagnostics);
+  diagnostics_.add("threads", this, &LidarBackgroundRemoval::threadDiagnostics);
   ROS_WARN("[%s] Please make sure that the map is loaded and the localization module (e.g. amcl) is launched.", __APP_NAME__);
   
-  map_ = ros::topic::waitForMessage<nav_msgs::OccupancyGrid>("map");
-  ROS_WARN("[%s] Map received!", __APP_NAME__);
+  // Nothing blocks here (a nodelet must come up at once): the first map, later
+  // ones (e.g. a costmap) and partial updates are all inflated in the
+  // background, lidar messages before the first map are dropped.
+  map_thread_ = boost::thread(boost::bind(&LidarBackgroundRemoval::mapThread, this, thread_config::read(private_nh, "map")));
+  map_sub_ = nh.subscribe<nav_msgs::OccupancyGrid>("map", 1, &LidarBackgroundRemoval::mapCallback, this);
+  map_updates_sub_ = nh.subscribe<map_msgs::OccupancyGridUpdate>("map_updates", 10, &LidarBackgroundRemoval::mapUpdateCallback, this);
   
-  ros::Subscriber lidar_sub;
   if(three_d) {
-    lidar_sub = nh.subscribe<sensor_msgs::PointCloud2>("velodyne_points", 1, pointCallback);
     lidar_filtered_pub_ = private_nh.advertise<sensor_msgs::PointCloud2>("cloud_filtered", 1);
+    cloud_filter_.reset(subscribeWithTransform(cloud_sub_, nh, "velodyne_points", tf_queue_size, &LidarBackgroundRemoval::pointCallback));
   } else {
-    lidar_sub = nh.subscribe<sensor_msgs::LaserScan>("scan", 1, laserCallback);
     lidar_filtered_pub_ = private_nh.advertise<sensor_msgs::LaserScan>("scan_filtered", 1);
+    scan_filter_.reset(subscribeWithTransform(scan_sub_, nh, "scan", tf_queue_size, &LidarBackgroundRemoval::laserCallback));
   }
-  
-  ros::spin();
-  
-  return 0;
+}
+
+LidarBackgroundRemoval::~LidarBackgroundRemoval() {
+  cloud_filter_.reset();
+  scan_filter_.reset();
+  cloud_sub_.unsubscribe();
+  scan_sub_.unsubscribe();
+  map_sub_.shutdown();
+  map_updates_sub_.shutdown();
+  {
+    boost::lock_guard<boost::mutex> lock(changes_mutex_);
+    running_ = false;
+  }
+  changes_cond_.notify_one();
+  map_thread_.join();
+  delete listener_;
 }
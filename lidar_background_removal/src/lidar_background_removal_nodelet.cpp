@@ -0,0 +1,39 @@
+// Copyright (C) 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// The filter as a nodelet: loaded into the manager of the lidar driver (and
+// of object3d_detector_gpu), clouds come and go as shared pointers, without
+// being serialized. Parameters are the same as for the node.
+
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+
+#include "lidar_background_removal.h"
+
+namespace lidar_background_removal {
+
+class LidarBackgroundRemovalNodelet : public nodelet::Nodelet {
+private:
+  virtual void onInit() {
+    // the single-threaded queue keeps the lidar callbacks serialized, as in the node
+    filter_.reset(new LidarBackgroundRemoval(getNodeHandle(), getPrivateNodeHandle()));
+  }
+  
+  boost::shared_ptr<LidarBackgroundRemoval> filter_;
+};
+
+} // namespace lidar_background_removal
+
+PLUGINLIB_EXPORT_CLASS(lidar_background_removal::LidarBackgroundRemovalNodelet, nodelet::Nodelet)
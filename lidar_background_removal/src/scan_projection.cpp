@@ -0,0 +1,52 @@
+// Copyright (C) 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "scan_projection.h"
+
+#include <cmath>
+
+void ScanProjection::configure(float angle_min, float angle_increment, size_t beams) {
+  if(beams == cos_.size() && angle_min == angle_min_ && angle_increment == angle_increment_) {
+    return;
+  }
+  angle_min_ = angle_min;
+  angle_increment_ = angle_increment;
+  cos_.resize(beams);
+  sin_.resize(beams);
+  cell_x_.resize(beams);
+  cell_y_.resize(beams);
+  for(size_t i = 0; i < beams; i++) {
+    // same angles as angle_min + i * angle_increment in the scan message
+    double angle = angle_min + (i * angle_increment);
+    cos_[i] = cos(angle);
+    sin_[i] = sin(angle);
+  }
+}
+
+void ScanProjection::project(const float *__restrict ranges, const float affine[6]) {
+  const size_t n = cos_.size();
+  const float a00 = affine[0], a01 = affine[1], b0 = affine[2];
+  const float a10 = affine[3], a11 = affine[4], b1 = affine[5];
+  const float *__restrict c = cos_.data();
+  const float *__restrict s = sin_.data();
+  float *__restrict cx = cell_x_.data();
+  float *__restrict cy = cell_y_.data();
+  for(size_t i = 0; i < n; i++) {
+    float x = ranges[i] * c[i];
+    float y = ranges[i] * s[i];
+    cx[i] = a00 * x + a01 * y + b0;
+    cy[i] = a10 * x + a11 * y + b1;
+  }
+}
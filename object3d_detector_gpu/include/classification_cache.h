@@ -0,0 +1,80 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <Eigen/Core>
+
+/* The features and the SVM skipped for the clusters of the people the tracker
+ * is already sure of. The tracks with at least min_probability are predicted
+ * to the frame at constant velocity, and a cluster whose centroid is within
+ * match_distance of one of them, the nearest one not matched yet in the frame,
+ * is labelled human as its track. Every reverify_frames frames of a track its
+ * cluster is classified again, and a track the SVM does not take for human is
+ * no longer reused until the SVM does again.
+ * The tracks come from the callback thread, the frames from the clustering
+ * thread and the verdicts from the classification one, hence the mutex.
+ */
+class ClassificationCache {
+public:
+  struct Params {
+    bool enabled;
+    double min_probability;
+    double match_distance;   // m, in the plane
+    int reverify_frames;     // frames reused between two classifications
+  };
+
+  /* A track in the frame of the clusters. */
+  struct Track {
+    long id;
+    float x, y;
+    float vx, vy;
+    float probability;
+  };
+
+  ClassificationCache();
+  void configure(const Params &params);
+  const Params &params() const { return params_; }
+
+  /* The tracks of the tracker at stamp (s), those gone forget their state. */
+  void setTracks(const std::vector<Track> &tracks, double stamp);
+  /* The confident tracks predicted to the frame at stamp (s), none matched yet. */
+  void beginFrame(double stamp);
+  /* The track of a cluster, -1 if none; *reuse tells whether it is labelled
+   * without the SVM or classified to verify its track. */
+  long match(const Eigen::Vector4f &centroid, bool *reuse);
+  /* The SVM verdict on the cluster of a track, not reused. */
+  void verified(long id, bool human);
+
+  unsigned long matched() const { return matched_; }
+  unsigned long reused() const { return reused_; }
+  unsigned long verifications() const { return verifications_; }
+  unsigned long rejections() const { return rejections_; }
+  /* Fraction of the matched clusters labelled without the SVM. */
+  double reuseRate() const { return matched_ ? (double)reused_ / matched_ : 0.0; }
+
+private:
+  struct State {
+    int reused;              // frames since the last classification
+    bool rejected;
+  };
+
+  Params params_;
+  std::mutex mutex_;
+  std::vector<Track> tracks_;
+  double tracks_stamp_;
+  std::unordered_map<long, State> states_;
+  std::vector<Track> frame_tracks_;  // confident ones, predicted
+  std::vector<char> taken_;
+  unsigned long matched_;
+  unsigned long reused_;
+  unsigned long verifications_;
+  unsigned long rejections_;
+};
@@ -0,0 +1,116 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cuda_runtime.h>
+
+/*** Where x/y/z live inside the raw bytes of a sensor_msgs::PointCloud2 ***/
+struct CloudIngestLayout {
+  unsigned int width;
+  unsigned int height;
+  unsigned int point_step;
+  unsigned int row_step;
+  unsigned int offset_x;
+  unsigned int offset_y;
+  unsigned int offset_z;
+};
+
+/*** One sensor's cloud and its transform into the detector frame ***/
+struct CloudIngestInput {
+  const uint8_t *data;
+  size_t bytes;
+  CloudIngestLayout layout;
+  float transform[12]; // row-major 3x4, [R | t]
+  const uint8_t *device_data; // the bytes mapped for the GPU, read in place; NULL to copy them
+};
+
+/*** The ground under the points, instead of the fixed z_limit_min ***/
+struct CloudIngestGround {
+  bool enabled;
+  float cell_size;   // m, square cells around the origin of the common frame
+  float range;       // m, half the side of the grid, z_limit_min beyond
+  float threshold;   // m, the points up to this above the ground of their cell are dropped
+  float ground_z;    // the floor under the origin
+  float max_slope;   // tangent, a cell whose lowest point is above the floor this steep is no ground
+};
+
+/* GPU ingest of a raw PointCloud2: the message bytes are copied once into
+ * managed memory, then the z-limit filter and the nested-region binning run
+ * in CUDA kernels. The result is a single region-sorted buffer (4 floats per
+ * point) that the clustering can read in place, one contiguous slice per region.
+ * Several clouds can be fused into one buffer: every input is transformed into
+ * the common frame and binned on its own stream, the binning of all inputs
+ * runs concurrently and only the region counts are shared.
+ * With a background map, the points that fall on the inflated occupancy grid
+ * (c.f. lidar_background_removal) are dropped by the same kernel, before any
+ * clustering; the bitmap stays in managed memory, read through the read-only cache.
+ * A cloud of a pinned buffer of point_cloud_pool is read by the kernels where it
+ * was written, without the copy.
+ * With ground segmentation, a first kernel keeps the lowest point of every
+ * cell of a grid in the common frame, and the points of a cell up to threshold
+ * above it are dropped as ground, so a ramp or a tilted sensor leaves no ground
+ * in the clusters. A cell whose lowest point is too high for the floor, seen
+ * through a crowd, falls back on z_limit_min.
+ */
+class CloudIngest {
+public:
+  static const int MAX_REGIONS = 32;
+  static const int MAX_INPUTS = 4;
+
+  CloudIngest(int regions, const int *zones, float z_limit_min, float z_limit_max);
+  ~CloudIngest();
+
+  /* Returns the number of points that survived the filter, all regions included. */
+  unsigned int process(const uint8_t *data, size_t bytes, const CloudIngestLayout &layout);
+  /* Fuses up to MAX_INPUTS clouds, each after its own transform, the z limits apply in the common frame.
+   * background (row-major 2x4, common frame to fractional map cells) enables the background map for this call. */
+  unsigned int process(const CloudIngestInput *inputs, int count, const float *background = NULL);
+  
+  /* One bit per map cell, set for background, c.f. InflatedMap::bits(). Must not be called during process(). */
+  void setBackgroundMap(const uint64_t *bits, int width, int height);
+  /* regions+1 ring bounds from 0 (m), c.f. RegionLayout. Must not be called during process(). */
+  void setBounds(const double *bounds);
+  /* Must not be called during process(). */
+  void setGround(const CloudIngestGround &ground);
+  bool hasBackgroundMap() const { return background_width_ > 0; }
+
+  const float *points() const { return sorted_; }
+  unsigned int count(int region) const { return counts_[region]; }
+  unsigned int offset(int region) const { return offsets_[region]; }
+  cudaStream_t stream() const { return streams_[0]; }
+
+private:
+  void reserve(unsigned int points, size_t bytes);
+
+  int regions_;
+  float bounds2_[MAX_REGIONS+1]; // squared ring bounds
+  float z_limit_min_;
+  float z_limit_max_;
+  cudaStream_t streams_[MAX_INPUTS];
+
+  uint8_t *staging_;           // managed, raw message bytes
+  size_t staging_capacity_;
+  unsigned char *region_of_;   // device, region id per input point
+  unsigned int *slot_of_;      // device, slot within its region
+  float *sorted_;              // managed, region-sorted output
+  unsigned int points_capacity_;
+  unsigned int *counts_;       // managed, points per region
+  unsigned int *offsets_;      // managed, exclusive scan of counts_
+  float *device_bounds2_;      // device copy of bounds2_
+  
+  CloudIngestGround ground_;
+  int ground_side_;                 // cells per side of the grid
+  int *ground_cells_;               // device, the lowest z of every cell as an ordered int
+
+  unsigned long long *background_;  // managed, the inflated map bitmap
+  size_t background_words_;
+  int background_width_;
+  int background_height_;
+};
@@ -0,0 +1,67 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <vector>
+#include <cuda_runtime.h>
+
+/*** CUDA resources owned by one nested region, reused across frames ***/
+struct ClusterRegionBuffers {
+  cudaStream_t stream;
+  cudaEvent_t start, stop; // bracket the clustering of the region on its stream
+  float *input;         // 4 floats per point
+  float *output;        // 4 floats per point
+  unsigned int *index;  // [0] = number of clusters, [1..n] = cluster sizes
+  unsigned int capacity; // in points
+  unsigned int used;     // points requested in the current frame
+};
+
+/* Streams and managed buffers are allocated once per region and only grow
+ * (geometrically) when a region receives more points than it can hold, so a
+ * steady-state frame performs no cudaMallocManaged/cudaFree at all.
+ * Without a CUDA device (host), the buffers are plain host memory and the
+ * regions have no stream, c.f. CpuExtractCluster.
+ */
+class ClusterBufferPool {
+public:
+  ClusterBufferPool(int regions, unsigned int initial_capacity = 4096, double growth_factor = 2.0, bool host = false);
+  ~ClusterBufferPool();
+
+  int size() const { return regions_.size(); }
+
+  /* Returns the buffers of a region with room for at least 'points' points. */
+  ClusterRegionBuffers &acquire(int region, unsigned int points);
+  ClusterRegionBuffers &region(int region) { return regions_[region]; }
+
+  /* Marks the end of a frame and folds its occupancy into the statistics. */
+  void endFrame();
+
+  /*** diagnostics ***/
+  double lastOccupancy() const { return last_occupancy_; }
+  double peakOccupancy() const { return peak_occupancy_; }
+  double averageOccupancy() const { return frames_ ? occupancy_sum_ / frames_ : 0.0; }
+  unsigned int peakPoints() const { return peak_points_; }
+  size_t allocatedBytes() const;
+  unsigned long growCount() const { return grow_count_; }
+  unsigned long frames() const { return frames_; }
+
+private:
+  void reserve(ClusterRegionBuffers &b, unsigned int points);
+  void release(ClusterRegionBuffers &b);
+
+  std::vector<ClusterRegionBuffers> regions_;
+  double growth_factor_;
+  bool host_;
+
+  double last_occupancy_;
+  double peak_occupancy_;
+  double occupancy_sum_;
+  unsigned int peak_points_;
+  unsigned long grow_count_;
+  unsigned long frames_;
+};
@@ -0,0 +1,66 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <vector>
+#include <Eigen/Dense>
+
+#include "cluster_view.h"
+#include "feature_layout.h"
+
+typedef struct feature {
+  /*** for visualization ***/
+  Eigen::Vector4f centroid;
+  Eigen::Vector4f min;
+  Eigen::Vector4f max;
+  /*** for classification ***/
+  int number_points;
+  double min_distance;
+  Eigen::Matrix3f covariance_3d;
+  Eigen::Matrix3f moment_3d;
+#if OBJECT3D_FEATURE_F5
+  double partial_covariance_2d[9];
+#endif
+#if OBJECT3D_FEATURE_F6
+  double histogram_main_2d[98];
+#endif
+#if OBJECT3D_FEATURE_F7
+  double histogram_second_2d[45];
+#endif
+  double slice[20];
+  float point_weight; // raw points per point of the cluster, c.f. VoxelDecimation; f1 is renormalized by it
+  /*** c.f. ClassificationCache ***/
+  long track_id;  // the confident track the cluster matched, -1 if none
+  bool reused;    // labelled human as its track, neither features nor SVM
+} Feature;
+
+static const int FEATURE_SIZE = feature_layout::size();
+static const int MAX_SLICES = 10; // Feature::slice holds two extents per block
+
+/* The helpers below follow the arithmetic of their PCL 1.8 counterparts
+ * (pcl::getMinMax3D, pcl::compute3DCentroid, pcl::PCA, ...) so the features
+ * fed to the SVM do not change, but they read a ClusterView in place.
+ */
+void computeMinMax3D(const ClusterView &pc, Eigen::Vector4f &min, Eigen::Vector4f &max);
+void computeCentroid(const ClusterView &pc, Eigen::Vector4f &centroid);
+double computeMinDistance(const ClusterView &pc);
+void computeCovarianceMatrixNormalized(const ClusterView &pc, const Eigen::Vector4f &centroid, Eigen::Matrix3f &covariance);
+void computeMomentOfInertiaTensorNormalized(const ClusterView &pc, Eigen::Matrix3f &moment_3d);
+/* Eigenvectors sorted by decreasing eigenvalue, as pcl::PCA; needs at least 3 points. */
+void computePCA(const ClusterView &pc, Eigen::Vector4f &mean, Eigen::Matrix3f &eigenvectors);
+/* Writes the PCA projection of pc into projected (resized to 4 floats per point). */
+ClusterView projectPCA(const ClusterView &pc, std::vector<float> &projected, Eigen::Vector4f *mean = NULL, Eigen::Matrix3f *eigenvectors = NULL);
+/* Two passes over the cluster with fixed-size per-block sums, no heap allocation. */
+void computeSlice(const ClusterView &pc, int n, double *slice);
+/* f5-f7, c.f. feature_layout.h */
+ClusterView computeProjectedPlane(const ClusterView &pc, const Eigen::Matrix3f &eigenvectors, int axe, const Eigen::Vector4f &centroid, std::vector<float> &plane);
+void compute3ZoneCovarianceMatrix(const ClusterView &plane, const Eigen::Vector4f &mean, double *partial_covariance_2d);
+void computeHistogramNormalized(const ClusterView &pc, int horiz_bins, int verti_bins, double *histogram);
+
+/* Writes the enabled feature groups of f at their feature_layout offsets, FEATURE_SIZE values. */
+void saveFeature(const Feature &f, double *x);
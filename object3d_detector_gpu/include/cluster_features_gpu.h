@@ -0,0 +1,43 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "cluster_view.h"
+
+/* Batched CUDA version of the f1, f2, f3, f4 and f8 features: one thread block
+ * per cluster, all clusters of a frame in one launch. Each output row holds
+ * GPU_FEATURE_SIZE floats in the order used by Object3dDetector::saveFeature.
+ *
+ * Since the cluster is projected on its own PCA basis, the normalized
+ * covariance around the (unprojected) centroid reduces to diag(lambda)/n + c*c^T
+ * and the inertia tensor to sums of eigenvalues; only the slices need
+ * eigenvectors, which are found with a few Jacobi sweeps per height bin.
+ */
+class GpuFeatureExtractor {
+public:
+  static const int GPU_FEATURE_SIZE = 34;
+  static const int SLICES = 10;
+
+  GpuFeatureExtractor();
+  ~GpuFeatureExtractor();
+
+  /* Cluster points must live in CUDA-accessible (managed) memory. Returns the
+   * feature matrix, clusters.size() rows, valid until the next call. */
+  const float *compute(const std::vector<ClusterView> &clusters);
+
+private:
+  void reserve(size_t clusters);
+
+  cudaStream_t stream_;
+  ClusterView *clusters_; // managed
+  float *features_;       // managed
+  size_t capacity_;
+};
@@ -0,0 +1,16 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+/*** A cluster as a zero-copy view into the clustering output (4 floats per point) ***/
+struct ClusterView {
+  const float *data;
+  unsigned int size;
+
+  const float *point(unsigned int i) const { return data + i * 4; }
+};
@@ -0,0 +1,46 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+#include "cudaCluster.h"
+
+/* CPU counterpart of cudaExtractCluster, for the machines without a CUDA
+ * device, with the same parameters and the same output layout. The points
+ * are hashed into voxels of voxelX x voxelY x voxelZ, the voxels holding more
+ * than countThreshold points are kept, and two kept voxels touching each
+ * other (26-neighbourhood) belong to the same cluster. The voxels are joined
+ * by a lock-free union-find over OpenMP threads, always under the root of
+ * the lower voxel, so the clusters do not depend on the threads: they come
+ * out in the order of their lowest voxels (by z, y then x), their points in
+ * voxel then input order.
+ * output gets the points of the clusters of minClusterSize to maxClusterSize
+ * points back to back, index[0] their number and index[1..] their sizes.
+ */
+class CpuExtractCluster {
+public:
+  CpuExtractCluster();
+  int set(extractClusterParam_t param) { param_ = param; return 0; }
+  /* cloud_in and output hold 4 floats per point, index up to nCount + 1 words. */
+  int extract(const float *cloud_in, int nCount, float *output, unsigned int *index);
+
+private:
+  int find(int voxel);
+  void unite(int a, int b);
+
+  extractClusterParam_t param_;
+  std::vector<uint64_t> keys_;               // per point, then sorted with their points
+  std::vector<unsigned int> order_;          // points by voxel
+  std::vector<uint64_t> voxel_keys_;         // of the voxels, sorted
+  std::vector<unsigned int> voxel_begin_;    // their first point in order_, one more at the end
+  std::vector<std::atomic<int> > parent_;    // union-find over the voxels
+  std::vector<unsigned int> cluster_size_;   // per root voxel
+};
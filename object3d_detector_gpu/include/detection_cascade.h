@@ -0,0 +1,66 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <vector>
+#include <Eigen/Core>
+
+/* Early rejection of clusters before the expensive features and the RBF SVM.
+ * The stages run from the cheapest to the most expensive, each one only sees
+ * the survivors of the previous ones, and all of them only use what unpacking
+ * a cluster already computes (size, bounding box, centroid):
+ *   1. points vs range: a person at range d returns about k/d^2 points,
+ *   2. bounding box extents,
+ *   3. height above ground: a person stands on the floor,
+ *   4. a linear classifier on [points, range, dx, dy, dz, points*d^2].
+ * Each stage can be disabled on its own.
+ */
+class DetectionCascade {
+public:
+  enum Stage {
+    STAGE_POINTS_VS_RANGE = 0,
+    STAGE_EXTENTS,
+    STAGE_GROUND,
+    STAGE_LINEAR,
+    STAGE_COUNT  // accepted
+  };
+
+  struct Params {
+    bool points_vs_range;
+    double min_points_range2;   // minimum points * range^2
+    bool extents;
+    Eigen::Vector3f min_extent;
+    Eigen::Vector3f max_extent;
+    bool ground;
+    double ground_z;            // floor height in the sensor frame
+    double max_ground_gap;      // lowest point at most this far above the floor
+    std::vector<double> linear_weights; // bias, then one weight per linear feature, empty disables
+    double linear_threshold;
+  };
+
+  static const int LINEAR_FEATURES = 6;
+
+  DetectionCascade();
+  void configure(const Params &params) { params_ = params; }
+  const Params &params() const { return params_; }
+
+  /* Returns the stage that rejects the cluster, STAGE_COUNT if it passes them all. */
+  int evaluate(unsigned int points, const Eigen::Vector4f &min, const Eigen::Vector4f &max, const Eigen::Vector4f &centroid);
+
+  unsigned long evaluated() const { return evaluated_; }
+  unsigned long rejected(int stage) const { return rejected_[stage]; }
+  /* Fraction of the clusters reaching a stage that it rejects. */
+  double rejectionRate(int stage) const;
+  static const char *name(int stage);
+
+private:
+  Params params_;
+  unsigned long evaluated_;
+  unsigned long reached_[STAGE_COUNT];
+  unsigned long rejected_[STAGE_COUNT];
+};
@@ -0,0 +1,58 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+/* Compile-time layout of the SVM feature vector. Every feature group has a
+ * fixed width, disabled groups take no room, and the offsets of the enabled
+ * ones follow in order, so FEATURE_SIZE, Feature and saveFeature can never
+ * disagree. f5-f7 are off in production builds; enable them (together with
+ * a model trained on them) with -DOBJECT3D_EXTRA_FEATURES=ON.
+ */
+#ifndef OBJECT3D_FEATURE_F5
+#define OBJECT3D_FEATURE_F5 0
+#endif
+#ifndef OBJECT3D_FEATURE_F6
+#define OBJECT3D_FEATURE_F6 0
+#endif
+#ifndef OBJECT3D_FEATURE_F7
+#define OBJECT3D_FEATURE_F7 0
+#endif
+
+namespace feature_layout {
+
+enum Group {
+  F1_NUMBER_POINTS = 0,   // 1d
+  F2_MIN_DISTANCE,        // 1d
+  F3_COVARIANCE,          // 6d
+  F4_MOMENT,              // 6d
+  F5_PARTIAL_COVARIANCE,  // 9d
+  F6_HISTOGRAM_MAIN,      // 98d, 14 x 7 bins
+  F7_HISTOGRAM_SECOND,    // 45d, 9 x 5 bins
+  F8_SLICE,               // 20d
+  GROUP_COUNT
+};
+
+static constexpr int GROUP_WIDTH[GROUP_COUNT] = {1, 1, 6, 6, 9, 98, 45, 20};
+static constexpr bool GROUP_ENABLED[GROUP_COUNT] = {true, true, true, true,
+						    OBJECT3D_FEATURE_F5 != 0, OBJECT3D_FEATURE_F6 != 0, OBJECT3D_FEATURE_F7 != 0,
+						    true};
+
+constexpr bool enabled(int group) { return GROUP_ENABLED[group]; }
+constexpr int width(int group) { return GROUP_ENABLED[group] ? GROUP_WIDTH[group] : 0; }
+constexpr int offset(int group) { return group == 0 ? 0 : offset(group - 1) + width(group - 1); }
+constexpr int size() { return offset(GROUP_COUNT); }
+
+/* Only f1-f4 and f8, in this order, can be computed on the GPU. */
+constexpr bool baseline() { return !GROUP_ENABLED[F5_PARTIAL_COVARIANCE] && !GROUP_ENABLED[F6_HISTOGRAM_MAIN] && !GROUP_ENABLED[F7_HISTOGRAM_SECOND]; }
+
+/* Width of f1-f4 and f8. */
+constexpr int baseline_size() { return GROUP_WIDTH[F1_NUMBER_POINTS] + GROUP_WIDTH[F2_MIN_DISTANCE] + GROUP_WIDTH[F3_COVARIANCE] + GROUP_WIDTH[F4_MOMENT] + GROUP_WIDTH[F8_SLICE]; }
+
+static_assert(offset(F8_SLICE) + width(F8_SLICE) == size(), "f8 must close the feature vector");
+
+} // namespace feature_layout
@@ -0,0 +1,61 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/* Bounded lock-free single-producer single-consumer ring. The slots are
+ * allocated once and handed out in place: the producer fills the slot from
+ * writeSlot() and publishes it with commitWrite(), the consumer reads the slot
+ * from readSlot() and recycles it with commitRead(). Swapping containers in
+ * and out of the slots keeps their capacity alive across frames.
+ */
+template <typename T>
+class FrameQueue {
+public:
+  explicit FrameQueue(size_t capacity) : slots_(capacity + 1), head_(0), tail_(0) {}
+
+  /* Producer side, NULL when the queue is full. */
+  T *writeSlot() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if(next(tail) == head_.load(std::memory_order_acquire)) {
+      return NULL;
+    }
+    return &slots_[tail];
+  }
+  void commitWrite() {
+    tail_.store(next(tail_.load(std::memory_order_relaxed)), std::memory_order_release);
+  }
+
+  /* Consumer side, NULL when the queue is empty. */
+  T *readSlot() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if(head == tail_.load(std::memory_order_acquire)) {
+      return NULL;
+    }
+    return &slots_[head];
+  }
+  void commitRead() {
+    head_.store(next(head_.load(std::memory_order_relaxed)), std::memory_order_release);
+  }
+
+  size_t size() const {
+    size_t head = head_.load(std::memory_order_acquire), tail = tail_.load(std::memory_order_acquire);
+    return tail >= head ? tail - head : tail + slots_.size() - head;
+  }
+  size_t capacity() const { return slots_.size() - 1; }
+
+private:
+  size_t next(size_t i) const { return i + 1 == slots_.size() ? 0 : i + 1; }
+
+  std::vector<T> slots_;      // one slot stays empty to tell full from empty
+  std::atomic<size_t> head_;  // written by the consumer only
+  std::atomic<size_t> tail_;  // written by the producer only
+};
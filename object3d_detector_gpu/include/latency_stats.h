@@ -0,0 +1,54 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+/* Wall-clock stopwatch, unlike clock() it also counts the time spent waiting
+ * for the GPU and other threads. */
+class WallTimer {
+public:
+  WallTimer() : start_(std::chrono::steady_clock::now()) {}
+  void reset() { start_ = std::chrono::steady_clock::now(); }
+  /* Milliseconds since construction or the last lap()/reset(), then restarts. */
+  double lap() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(now - start_).count();
+    start_ = now;
+    return ms;
+  }
+  double elapsed() const {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+/* Percentiles over the last 'window' samples (in milliseconds). Samples may
+ * be added from the classification thread while the diagnostics read them. */
+class RollingStats {
+public:
+  explicit RollingStats(size_t window = 256);
+
+  /* Drops the samples so far. */
+  void resize(size_t window);
+  void add(double ms);
+  size_t count() const;
+  /* Returns false while no sample has been added. */
+  bool percentiles(double &p50, double &p90, double &p99, double &max) const;
+
+private:
+  mutable std::mutex mutex_;
+  std::vector<double> samples_;  // ring buffer
+  size_t next_;
+  size_t total_;
+  mutable std::vector<double> sorted_;  // scratch
+};
@@ -0,0 +1,329 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ 
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#pragma once
+
+// ROS
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <std_msgs/UInt8.h>
+#include <people_msgs/People.h>
+#include <people_msgs/PositionMeasurementArray.h>
+#include <bayes_people_tracker/TrackStates.h>
+#include <visualization_msgs/MarkerArray.h>
+#include <nav_msgs/OccupancyGrid.h>
+#include <map_msgs/OccupancyGridUpdate.h>
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <tf/transform_listener.h>
+#include <pcl_ros/transforms.h>
+
+// Boost
+#include <boost/thread.hpp>
+#include <atomic>
+
+// PCL
+#include <pcl_conversions/pcl_conversions.h>
+#include <pcl/common/common.h>
+
+// CUDA-PCL
+#include <cuda_runtime.h>
+#include <gpu_arbiter/gpu_arbiter.h>
+#include <point_cloud_pool/cuda.h>
+#include <thread_config/thread_config.h>
+#include "cudaCluster.h"
+#include "cpu_cluster.h"
+#include "cluster_buffer_pool.h"
+#include "cloud_ingest.h"
+#include "region_binning.h"
+#include "region_layout.h"
+#include "voxel_decimation.h"
+#include "range_image_clustering.h"
+#include "detection_cascade.h"
+#include "classification_cache.h"
+#include "cluster_features.h"
+#include "cluster_features_gpu.h"
+#include "svm_engine.h"
+#include "svm_model.h"
+#include "frame_queue.h"
+#include "inflated_map.h"
+#include "latency_stats.h"
+
+// SVM
+#include <libsvm/svm.h>
+
+const int nested_regions_ = 14;
+const int zone_[nested_regions_] = {2,3,3,3,3,3,3,2,3,3,3,3,3,3}; // for more details, see our IROS'17 paper.
+
+/* Timed stages of a frame, c.f. latencyDiagnostics. */
+enum Stage {
+  STAGE_FROM_ROS_MSG = 0,
+  STAGE_GPU_INGEST,
+  STAGE_Z_FILTER,
+  STAGE_REGION_SPLIT,
+  STAGE_CLUSTERING,
+  STAGE_FEATURES,
+  STAGE_SVM,
+  STAGE_PUBLISH,
+  STAGE_LATENCY, // message header stamp to publish
+  STAGE_COUNT
+};
+
+/* The projections of a cluster in extractFeature, one per OpenMP thread,
+ * kept from frame to frame. */
+struct FeatureScratch {
+  std::vector<float> projected;
+  std::vector<float> plane;
+  std::vector<float> plane_secondary;
+};
+
+/* Hand-off from the clustering stage to the classification stage. */
+struct DetectionFrame {
+  std_msgs::Header header;
+  std::vector<Feature> features;
+};
+
+class Object3dDetector {
+private:
+  /*** ROS Publishers and Subscribers ***/
+  ros::NodeHandle node_handle_;
+  std::string node_name_;  // the threads are recorded for, c.f. thread_config
+  ros::Subscriber point_cloud_sub_;
+  std::vector<ros::Subscriber> input_subs_;
+  ros::Publisher people_pub_;
+  ros::Publisher measurements_pub_;
+  ros::Publisher marker_array_pub_;
+  /* published as shared pointers and reused while no subscriber holds them, c.f. classify() */
+  visualization_msgs::MarkerArrayPtr marker_array_msg_;
+  people_msgs::PositionMeasurementArrayPtr measurements_msg_;
+  people_msgs::PeoplePtr people_msg_;
+  ros::Subscriber gates_sub_;
+  ros::Subscriber track_states_sub_;
+  ros::Subscriber degradation_sub_;
+  diagnostic_updater::Updater diagnostics_;
+
+  /*** ROS Parameters ***/
+  bool print_fps_;
+  std::string frame_id_;
+  double z_limit_min_;
+  double z_limit_max_;
+  int cluster_size_min_;          // of the frame, c.f. applyDegradation()
+  int cluster_size_max_;
+  int base_cluster_size_min_;
+  int degraded_nested_regions_;
+  int degraded_cluster_size_min_;
+  double human_probability_;
+  bool human_size_limit_;
+  bool cascade_enabled_;
+  std::string model_file_name_;
+  std::string range_file_name_;
+  double model_reload_interval_;
+  int cluster_buffer_capacity_;
+  bool batched_clustering_;
+  bool gpu_ingest_;
+  bool pinned_clouds_;
+  bool gpu_features_;
+  bool gpu_arbitration_;
+  double gpu_period_;
+  int queue_size_;
+  bool pipelined_;
+  int pipeline_depth_;
+  std::string clustering_backend_;
+  bool cpu_clustering_;
+  double range_image_angle_;
+  bool roi_gating_;
+  int full_scan_interval_;
+  double gate_radius_min_;
+  double gate_timeout_;
+  std::vector<std::string> input_topics_;
+  double fusion_max_age_;
+  double dedup_distance_;
+  bool background_removal_;
+  std::string map_frame_;
+  double background_inflation_;
+  bool ground_segmentation_;
+  double ground_cell_size_;
+  double ground_range_;
+  double ground_threshold_;
+  double ground_max_slope_;
+  bool voxel_decimation_;
+  std::vector<double> decimation_leaf_sizes_;
+  bool classification_reuse_;
+  
+  /*** Pipeline stuffs ***/
+  FrameQueue<DetectionFrame> *frame_queue_;
+  boost::shared_ptr<boost::thread> classify_thread_;
+  boost::mutex wake_mutex_;
+  boost::condition_variable wake_;
+  volatile bool running_;
+  unsigned int pipelined_frames_;
+  unsigned int dropped_frames_;
+  
+  /*** Multi-lidar stuffs, the first input paces the detector ***/
+  std::vector<sensor_msgs::PointCloud2::ConstPtr> latest_clouds_;
+  
+  /*** ROI gating stuffs, gates are x, y and squared radius in frame_id_ ***/
+  tf::TransformListener *tf_listener_;
+  boost::mutex gates_mutex_;
+  std::vector<Eigen::Vector3f> gates_;
+  ros::Time gates_stamp_;
+  std::vector<Eigen::Vector3f> frame_gates_;
+  unsigned int gating_frames_;
+  unsigned int full_scans_;
+  unsigned int gated_scans_;
+  
+  /*** Background removal stuffs, the map is filtered on the GPU by the ingest ***/
+  ros::Subscriber map_sub_;
+  ros::Subscriber map_updates_sub_;
+  nav_msgs::MapMetaData map_info_;
+  std::vector<int8_t> map_grid_;
+  InflatedMap inflated_map_;
+  float background_transform_[8]; // points of the frame to map cells, c.f. CloudIngest::process
+  bool background_frame_;
+  unsigned int background_frames_;
+  unsigned int background_skipped_;
+  
+  /*** Timing stuffs, wall-clock and CUDA events ***/
+  RollingStats stage_stats_[STAGE_COUNT];
+  RollingStats region_stats_[nested_regions_];
+  WallTimer fps_timer_;
+  unsigned int fps_frames_;
+  int latency_window_;
+  size_t last_clusters_;
+  
+  /*** CUDA stuffs ***/
+  ClusterBufferPool *buffer_pool_;
+  CloudIngest *cloud_ingest_;
+  RegionBinning *region_binning_;
+  RangeImageClustering *range_clustering_;
+  GpuFeatureExtractor *feature_extractor_;
+  cudaExtractCluster *extractors_[nested_regions_];      // NULL with the CPU clustering
+  CpuExtractCluster *cpu_extractors_[nested_regions_];
+  VoxelDecimation *decimators_[nested_regions_];  // NULL where no leaf size
+  float region_weights_[nested_regions_];         // raw points per point clustered, of the frame
+  gpu_arbiter::Client *gpu_client_; // NULL without arbitration
+  
+  /*** Nested regions, c.f. RegionLayout ***/
+  RegionLayout region_layout_;
+  std::string region_layout_mode_;
+  int region_layout_frames_;            // 0 with the fixed layout
+  int layout_frames_;                   // added to the layout so far
+  double region_min_width_;
+  double degraded_range_;               // m, of the fixed degraded_nested_regions
+  int degraded_regions_;                // within degraded_range_, of the layout
+  
+  /*** Feature stuffs ***/
+  DetectionCascade cascade_;
+  ClassificationCache classification_cache_;
+  std::vector<ClusterView> clusters_;
+  std::vector<ClusterView> classified_clusters_; // those not reused, for the GPU features
+  std::vector<unsigned int> cluster_offsets_;
+  int feature_threads_;
+  std::vector<FeatureScratch> feature_scratch_;
+  
+  /*** Load degradation, c.f. degradation_controller.py ***/
+  std::atomic<int> degradation_level_;  // requested, from the callback thread
+  int applied_degradation_;             // of the frame
+  int active_regions_;                  // nested regions clustered
+  
+  /*** SVM stuffs ***/
+  std::vector<Feature> features_;
+  struct svm_node svm_node_[FEATURE_SIZE+1]; // 1 more size for end index (-1)
+  bool use_svm_model_;
+  bool batched_svm_;
+  boost::shared_ptr<SvmModel> svm_;          // only touched by classify()
+  
+  /*** SVM model hot swap ***/
+  boost::mutex svm_mutex_;
+  boost::shared_ptr<SvmModel> pending_svm_;  // reloaded, swapped in by the next classify()
+  boost::shared_ptr<SvmModel> retired_svm_;  // swapped out, freed by the loader thread
+  boost::shared_ptr<boost::thread> model_thread_;
+  SvmEngine::Matrix feature_matrix_;
+  std::vector<double> svm_scores_;
+  std::vector<char> is_human_;
+  std::vector<size_t> svm_rows_;             // the features classified, one per row
+  
+public:
+  /* node resolves the input topics, private_nh the parameters and the outputs;
+   * the nodelet passes its own handles, c.f. object3d_detector_gpu_nodelet.cpp */
+  Object3dDetector(ros::NodeHandle node = ros::NodeHandle(), ros::NodeHandle private_nh = ros::NodeHandle("~"));
+  ~Object3dDetector();
+  
+  void pointCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& ros_pc2);
+  void sensorCallback(const sensor_msgs::PointCloud2::ConstPtr& ros_pc2, int sensor);
+  bool lookupTransform(const std_msgs::Header &header, Eigen::Matrix4f &transform);
+  void finishFrame(const std_msgs::Header &header);
+  void gatesCallback(const people_msgs::PositionMeasurementArray::ConstPtr& gates);
+  void trackStatesCallback(const bayes_people_tracker::TrackStates::ConstPtr& states);
+  void degradationCallback(const std_msgs::UInt8::ConstPtr& level);
+  void applyDegradation();
+  void configureRegions();
+  void learnRegionLayout(const float *xyz, size_t stride, size_t n);
+  bool startGatedFrame();
+  bool inGates(const pcl::PointXYZ &p) const;
+  void mapCallback(const nav_msgs::OccupancyGrid::ConstPtr& map);
+  void mapUpdateCallback(const map_msgs::OccupancyGridUpdate::ConstPtr& update);
+  void startBackgroundFrame(const std_msgs::Header &header);
+  void extractCluster(pcl::PointCloud<pcl::PointXYZ>::Ptr pc);
+  void extractCluster(const sensor_msgs::PointCloud2 &ros_pc2, const CloudIngestLayout &layout);
+  void extractCluster(const CloudIngestInput *inputs, int count);
+  void uploadRegion(pcl::PointCloud<pcl::PointXYZ>::Ptr pc, const int *indices, unsigned int size, ClusterRegionBuffers &buffers);
+  void launchDecimation(int region, const float *points, unsigned int size);
+  const float *decimatedRegion(int region, const float *points, ClusterRegionBuffers &buffers);
+  void unpackRegion(ClusterRegionBuffers &buffers, float point_weight = 1.0f);
+  void extractClusterRangeImage(pcl::PointCloud<pcl::PointXYZ>::Ptr pc);
+  void addCluster(const ClusterView &cluster, float point_weight = 1.0f);
+  void extractFeatures(bool gpu);
+  void extractFeature(const ClusterView &pc, Feature &f, FeatureScratch &scratch);
+  void extractRegion(int region, float *input, ClusterRegionBuffers &buffers);
+  void recordRegionTime(int region);
+  void classify(const std_msgs::Header &header, const std::vector<Feature> &features);
+  void classifyThread(const thread_config::Settings &settings);
+  void modelThread(const thread_config::Settings &settings);
+  void bufferPoolDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void pipelineDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void latencyDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void regionLayoutDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void gatingDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void cascadeDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void reuseDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void backgroundDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void gpuDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void threadDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  
+  /*** for the offline benchmark ***/
+  static const char *stageName(int stage);
+  const RollingStats &stageStats(int stage) const { return stage_stats_[stage]; }
+  const RollingStats &regionStats(int region) const { return region_stats_[region]; }
+  const ClusterBufferPool &bufferPool() const { return *buffer_pool_; }
+  /* Clusters that survived the cascade in the last frame. */
+  size_t lastClusters() const { return last_clusters_; }
+};
@@ -0,0 +1,52 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <vector>
+
+#include "cluster_view.h"
+
+/* CPU clustering of an organized lidar cloud (height = rings, width =
+ * azimuth steps) on its range image, after Bogoslavskyi and Stachniss,
+ * "Fast range image-based segmentation of sparse 3D laser scans", IROS'16.
+ * Two neighbouring returns belong to the same object when the angle beta
+ * between the farther beam and the line joining both returns is large:
+ * flat angles mean a depth jump. Every pixel is visited once by a
+ * breadth-first labelling over its 4 ring/azimuth neighbours (the azimuth
+ * wraps around), so the cost is linear in the number of pixels. The clusters
+ * are written point after point into one buffer, 4 floats per point, so
+ * they come out in the same layout as the CUDA clustering.
+ */
+class RangeImageClustering {
+public:
+  RangeImageClustering(double angle_threshold, unsigned int min_cluster_size, unsigned int max_cluster_size, float z_limit_min, float z_limit_max);
+
+  /* xyz holds width * height points, row-major, x/y/z first every 'stride'
+   * floats. Non-finite returns and returns outside the z limits are skipped. */
+  void process(const float *xyz, unsigned int stride, unsigned int width, unsigned int height);
+
+  const std::vector<ClusterView> &clusters() const { return clusters_; }
+
+private:
+  bool valid(unsigned int pixel) const { return range_[pixel] > 0.0f; }
+  bool connected(unsigned int a, unsigned int b) const;
+
+  double angle_threshold_;       // beta threshold, radians
+  unsigned int min_cluster_size_;
+  unsigned int max_cluster_size_;
+  float z_limit_min_;
+  float z_limit_max_;
+
+  const float *xyz_;
+  unsigned int stride_;
+  std::vector<float> range_;     // per pixel, 0 for invalid returns
+  std::vector<int> label_;       // per pixel, -1 until visited
+  std::vector<unsigned int> queue_;
+  std::vector<float> points_;    // clustered points, 4 floats each
+  std::vector<ClusterView> clusters_;
+};
@@ -0,0 +1,41 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+/* CPU counterpart of the nested-region split in CloudIngest. The squared ring
+ * bounds are computed once, every point is classified branch-free (the region
+ * is the number of outer bounds below its squared distance), then a histogram
+ * and an exclusive scan give every region one contiguous slice of indices().
+ */
+class RegionBinning {
+public:
+  static const int MAX_REGIONS = 32;
+
+  RegionBinning(int regions, const int *zones);
+
+  /* regions+1 ring bounds from 0 (m), c.f. RegionLayout. Must not be called during process(). */
+  void setBounds(const double *bounds);
+
+  /* Bins the n points at xyz (x, y, z floats every 'stride' floats). */
+  void process(const float *xyz, size_t stride, size_t n);
+
+  unsigned int count(int region) const { return offsets_[region+1] - offsets_[region]; }
+  unsigned int offset(int region) const { return offsets_[region]; }
+  /* Point indices, region by region, in input order within a region. */
+  const int *indices(int region) const { return &indices_[offsets_[region]]; }
+
+private:
+  int regions_;
+  double bounds2_[MAX_REGIONS+1];       // squared ring bounds
+  unsigned int offsets_[MAX_REGIONS+1];
+  std::vector<unsigned char> region_of_; // per point, regions_ when outside all rings
+  std::vector<int> indices_;
+};
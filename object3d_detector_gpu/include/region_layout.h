@@ -0,0 +1,54 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* The ring bounds and the clustering tolerance of the nested regions. The
+ * fixed layout is that of the zones, a tolerance of 0.1 m more every ring out.
+ * A balanced layout keeps the same outer range and the same number of rings,
+ * but places the bounds at the quantiles of the ranges of the points seen,
+ * add()ed over some frames, so that every ring holds about the same number of
+ * points whatever the sensor and its mounting: a dense ring no longer
+ * serializes the clustering behind a few near empty ones. The tolerance of a
+ * ring is the fixed one at its middle range, so the clusters of a range are
+ * joined as before.
+ */
+class RegionLayout {
+public:
+  static const int MAX_REGIONS = 32;
+
+  RegionLayout(int regions, const int *zones, double resolution = 0.1);
+
+  /* Histograms the ranges of the n points at xyz (x, y, z floats every 'stride' floats). */
+  void add(const float *xyz, size_t stride, size_t n);
+  /* The bounds at the quantiles of the points added, no ring narrower than
+   * min_width (m); false, the layout unchanged, without any point. */
+  bool balance(double min_width);
+
+  int regions() const { return regions_; }
+  /* regions()+1 ring bounds from 0 (m), region j is (bounds[j], bounds[j+1]]. */
+  const double *bounds() const { return bounds_; }
+  double tolerance(int region) const { return tolerances_[region]; }
+  /* Of the fixed layout, at the range r (m). */
+  double fixedTolerance(double r) const;
+  /* The regions starting before the range r (m), at least 1. */
+  int regionsWithin(double r) const;
+  uint64_t samples() const { return samples_; }
+
+private:
+  int regions_;
+  double resolution_;                   // m, histogram bins
+  double bounds_[MAX_REGIONS+1];
+  double fixed_bounds_[MAX_REGIONS+1];
+  double tolerances_[MAX_REGIONS];
+  std::vector<uint64_t> histogram_;     // points per bin, out to the outer bound
+  uint64_t samples_;
+};
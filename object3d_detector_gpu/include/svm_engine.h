@@ -0,0 +1,98 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "feature_layout.h"
+
+struct svm_model;
+
+/* Dense, batched evaluation of a two-class RBF C-SVC trained with libsvm.
+ * The support vectors are stored as one aligned row-major matrix, so the
+ * kernel values of all clusters of a frame come from a single matrix
+ * product (vectorized by Eigen) instead of one sparse svm_predict per cluster.
+ * The svm-scale range is applied to the batch in place before prediction.
+ * Rows are as wide as the compile-time feature layout, c.f. feature_layout.h.
+ *
+ * save() writes the model and range as one binary file, map() memory-maps
+ * such a file and evaluates its support vectors in place: no parsing at
+ * startup, and the matrix the kernel reads is the page cache itself.
+ */
+class SvmEngine {
+public:
+  static const int FEATURE_SIZE = feature_layout::size();
+  typedef Eigen::Matrix<double, Eigen::Dynamic, FEATURE_SIZE, Eigen::RowMajor> Matrix;
+
+  SvmEngine();
+  ~SvmEngine();
+  SvmEngine(const SvmEngine &) = delete;
+  SvmEngine &operator=(const SvmEngine &) = delete;
+
+  /* Returns false if the model is not a two-class RBF C-SVC; scale() still works then. */
+  bool init(const svm_model *model);
+  /* Reads a range file written by svm-scale, c.f. https://github.com/cjlin1/libsvm/ */
+  bool loadRange(const std::string &range_file_name);
+  
+  /* Binary model and range, only from a ready engine. The file is tied to the
+   * feature layout and the byte order of the build that wrote it. */
+  bool save(const std::string &file_name) const;
+  /* False (and the engine untouched) if the file is not a binary model of this build. */
+  bool map(const std::string &file_name);
+
+  bool ready() const { return ready_; }
+  bool isProbabilityModel() const { return probability_; }
+  int supportVectors() const { return sv_.rows(); }
+
+  /* Applies the svm-scale range to every row of x (one feature vector per row). */
+  void scale(Matrix &x) const;
+  void scale(double *x) const;
+  /* Decision values (or probability of the first label, for probability
+   * models) of the already scaled rows of x. */
+  void predict(const Matrix &x, std::vector<double> &scores);
+  /* Whether a score from predict() classifies its cluster as the label 1 (human). */
+  bool isHuman(double score, double human_probability) const;
+
+private:
+  typedef Eigen::Map<const Matrix, Eigen::Aligned> MatrixView;
+  typedef Eigen::Map<const Eigen::VectorXd, Eigen::Aligned> VectorView;
+  
+  /* Points the views at the owned storage or into the mapping. */
+  void bind(const double *sv, const double *sv_norm, const double *coef, int l, const double *range_min, const double *range_max);
+  void unmap();
+
+  bool ready_;
+  bool probability_;
+  double gamma_;
+  double rho_;
+  double prob_a_;
+  double prob_b_;
+  int label_[2];
+
+  MatrixView sv_;            // support vectors, one per row
+  VectorView sv_norm_;       // squared norm of every support vector
+  VectorView coef_;
+  const double *range_min_;
+  const double *range_max_;
+  double x_lower_;
+  double x_upper_;
+  
+  // storage behind the views when built from libsvm
+  Matrix sv_data_;
+  Eigen::VectorXd sv_norm_data_;
+  Eigen::VectorXd coef_data_;
+  std::vector<double> range_min_data_;
+  std::vector<double> range_max_data_;
+  
+  void *mapped_;             // the mapped binary model, if any
+  size_t mapped_bytes_;
+
+  Eigen::MatrixXd kernel_;   // scratch, clusters x support vectors
+};
@@ -0,0 +1,46 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <string>
+#include <boost/noncopyable.hpp>
+
+#include "svm_engine.h"
+
+struct svm_model;
+
+/* A libsvm model together with its svm-scale range and its batched
+ * representation, i.e. everything classify() needs. Built in one go, so a
+ * new one can be prepared off the detection thread and swapped in whole.
+ */
+class SvmModel : private boost::noncopyable {
+public:
+  enum Status {
+    LOADED = 0,
+    MODEL_FAILED,  // no model, nothing else was tried
+    RANGE_FAILED   // the model is loaded but can not be used without its range
+  };
+
+  SvmModel();
+  ~SvmModel();
+
+  /* A binary model written by SvmEngine::save() is mapped and carries its
+   * range, range_file_name is only read for a libsvm text model. */
+  Status load(const std::string &model_file_name, const std::string &range_file_name);
+
+  /* NULL for a binary model, it can only be evaluated by the engine. */
+  const svm_model *model() const { return model_; }
+  bool isProbabilityModel() const { return probability_; }
+  /* Not const, predict() uses the engine's scratch. */
+  SvmEngine &engine() { return engine_; }
+
+private:
+  svm_model *model_;
+  bool probability_;
+  SvmEngine engine_;
+};
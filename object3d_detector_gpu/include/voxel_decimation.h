@@ -0,0 +1,40 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#pragma once
+
+#include <cuda_runtime.h>
+
+/* Voxel-grid decimation of the points of one nested region on its stream,
+ * before the clustering: the points of every voxel of leaf_size are replaced
+ * by their centroid, as pcl::VoxelGrid does. The voxels are found by open
+ * addressing in a hash table of twice the points, one atomicCAS per point,
+ * then the occupied slots are compacted into points(). The buffers are kept
+ * and only grow, as those of ClusterBufferPool.
+ */
+class VoxelDecimation {
+public:
+  explicit VoxelDecimation(cudaStream_t stream);
+  ~VoxelDecimation();
+
+  /* Launches the decimation of n points (4 floats each, CUDA-accessible) on the stream. */
+  void launch(const float *points, unsigned int n, float leaf_size);
+  /* Once the stream is synchronized: the centroids, 4 floats each with w = 1. */
+  unsigned int size() const { return *count_; }
+  const float *points() const { return points_; }
+
+private:
+  void reserve(unsigned int n);
+
+  cudaStream_t stream_;
+  unsigned long long *keys_;  // device, the voxel of every slot, ~0 if empty
+  float4 *sums_;              // device, x, y, z and points of every slot
+  unsigned int slots_;        // a power of two
+  float *points_;             // managed, the centroids
+  unsigned int capacity_;     // in points
+  unsigned int *count_;       // managed
+};
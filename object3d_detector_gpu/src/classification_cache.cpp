@@ -0,0 +1,106 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "classification_cache.h"
+
+#include <unordered_set>
+
+ClassificationCache::ClassificationCache()
+  : tracks_stamp_(0.0), matched_(0), reused_(0), verifications_(0), rejections_(0) {
+  params_.enabled = false;
+  params_.min_probability = 0.9;
+  params_.match_distance = 0.3;
+  params_.reverify_frames = 10;
+}
+
+void ClassificationCache::configure(const Params &params) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  params_ = params;
+  states_.clear();
+}
+
+void ClassificationCache::setTracks(const std::vector<Track> &tracks, double stamp) {
+  std::unordered_set<long> alive;
+  for(size_t i = 0; i < tracks.size(); i++) {
+    alive.insert(tracks[i].id);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  tracks_ = tracks;
+  tracks_stamp_ = stamp;
+  for(std::unordered_map<long, State>::iterator it = states_.begin(); it != states_.end();) {
+    if(alive.count(it->first)) {
+      ++it;
+    } else {
+      it = states_.erase(it);
+    }
+  }
+}
+
+void ClassificationCache::beginFrame(double stamp) {
+  frame_tracks_.clear();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if(!params_.enabled) {
+    taken_.clear();
+    return;
+  }
+  // a track ahead of the frame is not moved back
+  float dt = stamp > tracks_stamp_ ? stamp - tracks_stamp_ : 0.0;
+  for(size_t i = 0; i < tracks_.size(); i++) {
+    if(tracks_[i].probability < params_.min_probability) {
+      continue;
+    }
+    Track track = tracks_[i];
+    track.x += track.vx * dt;
+    track.y += track.vy * dt;
+    frame_tracks_.push_back(track);
+  }
+  taken_.assign(frame_tracks_.size(), 0);
+}
+
+long ClassificationCache::match(const Eigen::Vector4f &centroid, bool *reuse) {
+  *reuse = false;
+  int nearest = -1;
+  float nearest_d2 = params_.match_distance * params_.match_distance;
+  for(size_t i = 0; i < frame_tracks_.size(); i++) {
+    float dx = centroid[0] - frame_tracks_[i].x, dy = centroid[1] - frame_tracks_[i].y;
+    float d2 = dx * dx + dy * dy;
+    if(!taken_[i] && d2 <= nearest_d2) {
+      nearest = i;
+      nearest_d2 = d2;
+    }
+  }
+  if(nearest < 0) {
+    return -1;
+  }
+  taken_[nearest] = 1;
+  long id = frame_tracks_[nearest].id;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  matched_++;
+  State &state = states_.emplace(id, State{0, false}).first->second;
+  if(state.rejected || state.reused >= params_.reverify_frames) {
+    state.reused = 0;
+    verifications_++;
+    return id;
+  }
+  state.reused++;
+  reused_++;
+  *reuse = true;
+  return id;
+}
+
+void ClassificationCache::verified(long id, bool human) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unordered_map<long, State>::iterator it = states_.find(id);
+  if(it == states_.end()) {
+    return;
+  }
+  if(!human && !it->second.rejected) {
+    rejections_++;
+  }
+  it->second.rejected = !human;
+}
@@ -0,0 +1,342 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "cloud_ingest.h"
+#include <gpu_arbiter/streams.h>
+
+#include <string.h>
+#include <algorithm>
+
+static const unsigned char NO_REGION = 0xff;
+static const int THREADS = 256;
+
+/* 3x4 transform, passed by value so every input launch carries its own. */
+struct Transform {
+  float m[12];
+};
+
+/* The background bitmap and the 2x4 transform into its cells, bits NULL when disabled. */
+struct BackgroundGrid {
+  const unsigned long long *bits;
+  int width;
+  int height;
+  float m[8];
+};
+
+/* The ground grid, cells NULL when disabled. */
+struct GroundGrid {
+  int *cells;
+  int side;
+  float origin;      // -range
+  float inv_cell;
+  float threshold;
+  float ground_z;
+  float max_slope;
+};
+
+/* Floats as ints of the same order, for atomicMin. */
+__device__ int orderedInt(float f) {
+  int i = __float_as_int(f);
+  return i >= 0 ? i : i ^ 0x7fffffff;
+}
+
+__device__ float orderedFloat(int i) {
+  return __int_as_float(i >= 0 ? i : i ^ 0x7fffffff);
+}
+
+/* The cell of a point, -1 off the grid (NaNs included). */
+__device__ int groundCell(const GroundGrid &g, float x, float y) {
+  float gx = (x - g.origin) * g.inv_cell, gy = (y - g.origin) * g.inv_cell;
+  if(!(gx >= 0.0f && gy >= 0.0f && gx < g.side && gy < g.side)) {
+    return -1;
+  }
+  return (int)gy * g.side + (int)gx;
+}
+
+/* Above the ground of its cell, or above z_min where the lowest point of the
+ * cell is no ground. */
+__device__ bool aboveGround(const GroundGrid &g, float x, float y, float z, float z_min) {
+  int cell = g.cells == NULL ? -1 : groundCell(g, x, y);
+  if(cell < 0) {
+    return z >= z_min;
+  }
+  float lowest = orderedFloat(g.cells[cell]);
+  if(lowest <= g.ground_z + sqrtf(x * x + y * y) * g.max_slope + g.threshold) {
+    return z > lowest + g.threshold;
+  }
+  return z >= z_min;
+}
+
+/* Cells off the map are background, as in InflatedMap::background(). */
+__device__ bool isBackground(const BackgroundGrid &g, float x, float y, float z) {
+  float gx = g.m[0] * x + g.m[1] * y + g.m[2] * z + g.m[3];
+  float gy = g.m[4] * x + g.m[5] * y + g.m[6] * z + g.m[7];
+  if(!(gx >= 0.0f && gy >= 0.0f && gx < g.width && gy < g.height)) {
+    return true;
+  }
+  size_t i = (size_t)(int)gy * g.width + (int)gx;
+  return (__ldg(&g.bits[i >> 6]) >> (i & 63)) & 1;
+}
+
+__device__ float4 loadPoint(const uint8_t *data, const CloudIngestLayout &l, const Transform &t, unsigned int idx) {
+  const uint8_t *p = data + (idx / l.width) * l.row_step + (idx % l.width) * l.point_step;
+  float x = *(const float *)(p + l.offset_x);
+  float y = *(const float *)(p + l.offset_y);
+  float z = *(const float *)(p + l.offset_z);
+  float4 out;
+  out.x = t.m[0] * x + t.m[1] * y + t.m[2] * z + t.m[3];
+  out.y = t.m[4] * x + t.m[5] * y + t.m[6] * z + t.m[7];
+  out.z = t.m[8] * x + t.m[9] * y + t.m[10] * z + t.m[11];
+  out.w = 1.0f;
+  return out;
+}
+
+__global__ void groundKernel(const uint8_t *data, CloudIngestLayout l, Transform t, float z_max, GroundGrid ground) {
+  unsigned int idx = blockIdx.x * blockDim.x + threadIdx.x;
+  if(idx >= l.width * l.height) {
+    return;
+  }
+  float4 q = loadPoint(data, l, t, idx);
+  int cell = groundCell(ground, q.x, q.y);
+  if(cell >= 0 && q.z <= z_max) {
+    atomicMin(&ground.cells[cell], orderedInt(q.z));
+  }
+}
+
+__global__ void binPointsKernel(const uint8_t *data, CloudIngestLayout l, Transform t, float z_min, float z_max,
+				GroundGrid ground, BackgroundGrid background, const float *bounds2, int regions,
+				unsigned char *region_of, unsigned int *slot_of, unsigned int *counts) {
+  unsigned int idx = blockIdx.x * blockDim.x + threadIdx.x;
+  if(idx >= l.width * l.height) {
+    return;
+  }
+  float4 q = loadPoint(data, l, t, idx);
+  float x = q.x, y = q.y, z = q.z;
+
+  // Remove ground and ceiling (NaNs fail both comparisons)
+  unsigned char region = NO_REGION;
+  if(z <= z_max && aboveGround(ground, x, y, z, z_min) && (background.bits == NULL || !isBackground(background, x, y, z))) {
+    float d2 = x * x + y * y + z * z;
+    for(int j = 0; j < regions; j++) {
+      if(d2 > bounds2[j] && d2 <= bounds2[j+1]) {
+	region = j;
+	break;
+      }
+    }
+  }
+  region_of[idx] = region;
+  if(region != NO_REGION) {
+    slot_of[idx] = atomicAdd(&counts[region], 1);
+  }
+}
+
+__global__ void scatterPointsKernel(const uint8_t *data, CloudIngestLayout l, Transform t,
+				    const unsigned char *region_of, const unsigned int *slot_of,
+				    const unsigned int *offsets, float *sorted) {
+  unsigned int idx = blockIdx.x * blockDim.x + threadIdx.x;
+  if(idx >= l.width * l.height || region_of[idx] == NO_REGION) {
+    return;
+  }
+  reinterpret_cast<float4 *>(sorted)[offsets[region_of[idx]] + slot_of[idx]] = loadPoint(data, l, t, idx);
+}
+
+CloudIngest::CloudIngest(int regions, const int *zones, float z_limit_min, float z_limit_max)
+  : regions_(std::min(regions, (int)MAX_REGIONS)), z_limit_min_(z_limit_min), z_limit_max_(z_limit_max),
+    staging_(NULL), staging_capacity_(0), region_of_(NULL), slot_of_(NULL),
+    sorted_(NULL), points_capacity_(0), counts_(NULL), offsets_(NULL), device_bounds2_(NULL),
+    ground_side_(0), ground_cells_(NULL), background_(NULL), background_words_(0), background_width_(0), background_height_(0) {
+  ground_.enabled = false;
+  float range = 0.0f;
+  bounds2_[0] = 0.0f;
+  for(int j = 0; j < regions_; j++) {
+    range += zones[j];
+    bounds2_[j+1] = range * range;
+  }
+  for(int i = 0; i < MAX_INPUTS; i++) {
+    gpu_arbiter::createStream(&streams_[i], gpu_arbiter::HIGH);
+  }
+  // counts/offsets are read back by the host after every kernel
+  cudaMallocManaged(&counts_, sizeof(unsigned int) * MAX_REGIONS);
+  cudaMallocManaged(&offsets_, sizeof(unsigned int) * MAX_REGIONS);
+  cudaMalloc(&device_bounds2_, sizeof(float) * (MAX_REGIONS + 1));
+  cudaMemcpy(device_bounds2_, bounds2_, sizeof(float) * (regions_ + 1), cudaMemcpyHostToDevice);
+}
+
+CloudIngest::~CloudIngest() {
+  for(int i = 0; i < MAX_INPUTS; i++) {
+    cudaStreamSynchronize(streams_[i]);
+  }
+  if(staging_) cudaFree(staging_);
+  if(region_of_) cudaFree(region_of_);
+  if(slot_of_) cudaFree(slot_of_);
+  if(sorted_) cudaFree(sorted_);
+  if(counts_) cudaFree(counts_);
+  if(offsets_) cudaFree(offsets_);
+  if(device_bounds2_) cudaFree(device_bounds2_);
+  if(ground_cells_) cudaFree(ground_cells_);
+  if(background_) cudaFree(background_);
+  for(int i = 0; i < MAX_INPUTS; i++) {
+    cudaStreamDestroy(streams_[i]);
+  }
+}
+
+void CloudIngest::reserve(unsigned int points, size_t bytes) {
+  if(bytes > staging_capacity_) {
+    if(staging_) cudaFree(staging_);
+    staging_capacity_ = std::max(bytes, staging_capacity_ * 2);
+    cudaMallocManaged(&staging_, staging_capacity_);
+  }
+  if(points > points_capacity_) {
+    if(region_of_) cudaFree(region_of_);
+    if(slot_of_) cudaFree(slot_of_);
+    if(sorted_) cudaFree(sorted_);
+    points_capacity_ = std::max(points, points_capacity_ * 2);
+    cudaMalloc(&region_of_, sizeof(unsigned char) * points_capacity_);
+    cudaMalloc(&slot_of_, sizeof(unsigned int) * points_capacity_);
+    cudaMallocManaged(&sorted_, sizeof(float) * 4 * points_capacity_);
+  }
+}
+
+unsigned int CloudIngest::process(const uint8_t *data, size_t bytes, const CloudIngestLayout &layout) {
+  CloudIngestInput input = {data, bytes, layout, {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0}, NULL};
+  return process(&input, 1);
+}
+
+void CloudIngest::setBackgroundMap(const uint64_t *bits, int width, int height) {
+  size_t words = width > 0 && height > 0 ? ((size_t)width * height + 63) / 64 : 0;
+  if(words > background_words_) {
+    if(background_) cudaFree(background_);
+    cudaMallocManaged(&background_, sizeof(unsigned long long) * words);
+    background_words_ = words;
+  }
+  // the kernels of the previous frame are done, c.f. process()
+  if(words > 0) {
+    memcpy(background_, bits, sizeof(unsigned long long) * words);
+  }
+  background_width_ = words > 0 ? width : 0;
+  background_height_ = words > 0 ? height : 0;
+}
+
+void CloudIngest::setBounds(const double *bounds) {
+  for(int j = 0; j <= regions_; j++) {
+    bounds2_[j] = bounds[j] * bounds[j];
+  }
+  cudaMemcpy(device_bounds2_, bounds2_, sizeof(float) * (regions_ + 1), cudaMemcpyHostToDevice);
+}
+
+void CloudIngest::setGround(const CloudIngestGround &ground) {
+  ground_ = ground;
+  int side = ground.enabled && ground.cell_size > 0.0f ? (int)ceilf(2.0f * ground.range / ground.cell_size) : 0;
+  if(side != ground_side_) {
+    if(ground_cells_) cudaFree(ground_cells_);
+    ground_cells_ = NULL;
+    if(side > 0) {
+      cudaMalloc(&ground_cells_, sizeof(int) * side * side);
+    }
+    ground_side_ = side;
+  }
+  ground_.enabled = side > 0;
+}
+
+unsigned int CloudIngest::process(const CloudIngestInput *inputs, int count, const float *background) {
+  count = std::min(count, (int)MAX_INPUTS);
+  // every input gets its slice of the per-point arrays, and of the staging
+  // bytes unless mapped
+  size_t byte_offset[MAX_INPUTS+1] = {0};
+  unsigned int point_offset[MAX_INPUTS+1] = {0};
+  for(int i = 0; i < count; i++) {
+    size_t staged = inputs[i].device_data ? 0 : inputs[i].bytes;
+    byte_offset[i+1] = byte_offset[i] + ((staged + 15) & ~(size_t)15); // keep floats aligned
+    point_offset[i+1] = point_offset[i] + inputs[i].layout.width * inputs[i].layout.height;
+  }
+  unsigned int n = point_offset[count];
+  for(int j = 0; j < regions_; j++) {
+    counts_[j] = 0;
+    offsets_[j] = 0;
+  }
+  if(n == 0) {
+    return 0;
+  }
+  reserve(n, byte_offset[count]);
+
+  // the only host-side copy of the clouds: raw message bytes into managed
+  // memory, none of those already mapped
+  const uint8_t *source[MAX_INPUTS];
+  for(int i = 0; i < count; i++) {
+    if(inputs[i].device_data) {
+      source[i] = inputs[i].device_data;
+    } else {
+      memcpy(staging_ + byte_offset[i], inputs[i].data, inputs[i].bytes);
+      source[i] = staging_ + byte_offset[i];
+    }
+  }
+
+  BackgroundGrid grid = {NULL, background_width_, background_height_, {0}};
+  if(background != NULL && hasBackgroundMap()) {
+    grid.bits = background_;
+    std::copy(background, background + 8, grid.m);
+  }
+  
+  Transform t[MAX_INPUTS];
+  for(int i = 0; i < count; i++) {
+    std::copy(inputs[i].transform, inputs[i].transform + 12, t[i].m);
+  }
+  
+  // the lowest point of every cell, all inputs in, before any of them is binned
+  GroundGrid ground = {NULL, ground_side_, -ground_.range, 0.0f, ground_.threshold, ground_.ground_z, ground_.max_slope};
+  if(ground_.enabled) {
+    ground.cells = ground_cells_;
+    ground.inv_cell = 1.0f / ground_.cell_size;
+    // 0x7f7f7f7f is a float of 3.4e38, no point is that low
+    cudaMemsetAsync(ground_cells_, 0x7f, sizeof(int) * ground_side_ * ground_side_, streams_[0]);
+    cudaStreamSynchronize(streams_[0]);
+    for(int i = 0; i < count; i++) {
+      unsigned int points = point_offset[i+1] - point_offset[i];
+      if(points == 0) {
+	continue;
+      }
+      unsigned int blocks = (points + THREADS - 1) / THREADS;
+      groundKernel<<<blocks, THREADS, 0, streams_[i]>>>(source[i], inputs[i].layout, t[i], z_limit_max_, ground);
+    }
+    for(int i = 0; i < count; i++) {
+      cudaStreamSynchronize(streams_[i]);
+    }
+  }
+  
+  for(int i = 0; i < count; i++) {
+    unsigned int points = point_offset[i+1] - point_offset[i];
+    if(points == 0) {
+      continue;
+    }
+    unsigned int blocks = (points + THREADS - 1) / THREADS;
+    binPointsKernel<<<blocks, THREADS, 0, streams_[i]>>>(source[i], inputs[i].layout, t[i], z_limit_min_, z_limit_max_,
+							 ground, grid, device_bounds2_, regions_, region_of_ + point_offset[i], slot_of_ + point_offset[i], counts_);
+  }
+  for(int i = 0; i < count; i++) {
+    cudaStreamSynchronize(streams_[i]);
+  }
+
+  unsigned int total = 0;
+  for(int j = 0; j < regions_; j++) {
+    offsets_[j] = total;
+    total += counts_[j];
+  }
+
+  for(int i = 0; i < count; i++) {
+    unsigned int points = point_offset[i+1] - point_offset[i];
+    if(points == 0) {
+      continue;
+    }
+    unsigned int blocks = (points + THREADS - 1) / THREADS;
+    scatterPointsKernel<<<blocks, THREADS, 0, streams_[i]>>>(source[i], inputs[i].layout, t[i],
+							     region_of_ + point_offset[i], slot_of_ + point_offset[i], offsets_, sorted_);
+  }
+  for(int i = 0; i < count; i++) {
+    cudaStreamSynchronize(streams_[i]);
+  }
+  return total;
+}
@@ -0,0 +1,131 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "cluster_buffer_pool.h"
+#include <gpu_arbiter/streams.h>
+
+#include <algorithm>
+#include <stdlib.h>
+#include <ros/ros.h>
+
+ClusterBufferPool::ClusterBufferPool(int regions, unsigned int initial_capacity, double growth_factor, bool host)
+  : regions_(regions), growth_factor_(std::max(growth_factor, 1.1)), host_(host),
+    last_occupancy_(0.0), peak_occupancy_(0.0), occupancy_sum_(0.0),
+    peak_points_(0), grow_count_(0), frames_(0) {
+  for(size_t i = 0; i < regions_.size(); i++) {
+    ClusterRegionBuffers &b = regions_[i];
+    b.stream = NULL;
+    b.input = NULL;
+    b.output = NULL;
+    b.index = NULL;
+    b.capacity = 0;
+    b.used = 0;
+    b.start = b.stop = NULL;
+    if(!host_) {
+      gpu_arbiter::createStream(&b.stream, gpu_arbiter::HIGH);
+      cudaEventCreate(&b.start);
+      cudaEventCreate(&b.stop);
+    }
+    reserve(b, initial_capacity);
+  }
+  grow_count_ = 0; // initial allocations are not growth
+}
+
+ClusterBufferPool::~ClusterBufferPool() {
+  for(size_t i = 0; i < regions_.size(); i++) {
+    release(regions_[i]);
+    if(host_) {
+      continue;
+    }
+    if(regions_[i].stream) {
+      cudaStreamDestroy(regions_[i].stream);
+    }
+    cudaEventDestroy(regions_[i].start);
+    cudaEventDestroy(regions_[i].stop);
+  }
+}
+
+void ClusterBufferPool::release(ClusterRegionBuffers &b) {
+  if(host_) {
+    free(b.input);
+    free(b.output);
+    free(b.index);
+  } else {
+    if(b.input) cudaFree(b.input);
+    if(b.output) cudaFree(b.output);
+    if(b.index) cudaFree(b.index);
+  }
+  b.input = NULL;
+  b.output = NULL;
+  b.index = NULL;
+  b.capacity = 0;
+}
+
+void ClusterBufferPool::reserve(ClusterRegionBuffers &b, unsigned int points) {
+  if(points <= b.capacity) {
+    return;
+  }
+  unsigned int capacity = std::max(b.capacity, 1u);
+  while(capacity < points) {
+    capacity = (unsigned int)(capacity * growth_factor_) + 1;
+  }
+
+  // make sure nothing is still in flight on the old buffers
+  if(!host_) {
+    cudaStreamSynchronize(b.stream);
+  }
+  release(b);
+  
+  if(host_) {
+    b.input = static_cast<float *>(malloc(sizeof(float) * 4 * capacity));
+    b.output = static_cast<float *>(malloc(sizeof(float) * 4 * capacity));
+    b.index = static_cast<unsigned int *>(malloc(sizeof(unsigned int) * 4 * capacity));
+    b.capacity = capacity;
+    grow_count_++;
+    return;
+  }
+
+  // globally attached: the batched feature stage reads every region's output
+  // from its own stream; the host only touches them while the GPU is idle
+  cudaMallocManaged(&b.input, sizeof(float) * 4 * capacity, cudaMemAttachGlobal);
+  cudaMallocManaged(&b.output, sizeof(float) * 4 * capacity, cudaMemAttachGlobal);
+  // the clustering library may use up to 4 words per point for its index output
+  cudaMallocManaged(&b.index, sizeof(unsigned int) * 4 * capacity, cudaMemAttachGlobal);
+
+  b.capacity = capacity;
+  grow_count_++;
+  ROS_DEBUG("[object3d_detector_gpu] Cluster buffer grown to %u points.", capacity);
+}
+
+ClusterRegionBuffers &ClusterBufferPool::acquire(int region, unsigned int points) {
+  ClusterRegionBuffers &b = regions_[region];
+  reserve(b, points);
+  b.used = points;
+  return b;
+}
+
+void ClusterBufferPool::endFrame() {
+  unsigned long used = 0, capacity = 0;
+  for(size_t i = 0; i < regions_.size(); i++) {
+    used += regions_[i].used;
+    capacity += regions_[i].capacity;
+    peak_points_ = std::max(peak_points_, regions_[i].used);
+    regions_[i].used = 0;
+  }
+  last_occupancy_ = capacity ? double(used) / double(capacity) : 0.0;
+  peak_occupancy_ = std::max(peak_occupancy_, last_occupancy_);
+  occupancy_sum_ += last_occupancy_;
+  frames_++;
+}
+
+size_t ClusterBufferPool::allocatedBytes() const {
+  size_t bytes = 0;
+  for(size_t i = 0; i < regions_.size(); i++) {
+    bytes += regions_[i].capacity * (sizeof(float) * 4 * 2 + sizeof(unsigned int) * 4);
+  }
+  return bytes;
+}
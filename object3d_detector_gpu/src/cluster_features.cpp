@@ -0,0 +1,313 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "cluster_features.h"
+
+#include <cfloat>
+#include <algorithm>
+
+/* *** Feature Extraction ***
+ * f1 (1d): the number of points included in a cluster.
+ * f2 (1d): the minimum distance of the cluster to the sensor.
+ * => f1 and f2 should be used in pairs, since f1 varies with f2 changes.
+ * f3 (6d): 3D covariance matrix of the cluster.
+ * f4 (6d): the normalized moment of inertia tensor.
+ * => Since both f3 and f4 are symmetric, we only use 6 elements from each as features.
+ * f5 (9d): 2D covariance matrix in 3 zones, which are the upper half, and the left and right lower halves.
+ * f6 (98d): The normalized 2D histogram for the main plane, 14 × 7 bins.
+ * f7 (45d): The normalized 2D histogram for the secondary plane, 9 × 5 bins.
+ * f8 (20d): Slice feature for the cluster.
+ */
+
+void computeMinMax3D(const ClusterView &pc, Eigen::Vector4f &min, Eigen::Vector4f &max) {
+  min.setConstant(FLT_MAX);
+  max.setConstant(-FLT_MAX);
+  for(unsigned int i = 0; i < pc.size; i++) {
+    const float *p = pc.point(i);
+    for(int k = 0; k < 3; k++) {
+      min[k] = std::min(min[k], p[k]);
+      max[k] = std::max(max[k], p[k]);
+    }
+  }
+  min[3] = max[3] = 1.0f;
+}
+
+void computeCentroid(const ClusterView &pc, Eigen::Vector4f &centroid) {
+  centroid.setZero();
+  for(unsigned int i = 0; i < pc.size; i++) {
+    const float *p = pc.point(i);
+    centroid[0] += p[0];
+    centroid[1] += p[1];
+    centroid[2] += p[2];
+  }
+  if(pc.size) {
+    centroid /= static_cast<float>(pc.size);
+  }
+  centroid[3] = 1.0f;
+}
+
+double computeMinDistance(const ClusterView &pc) {
+  double min_distance = FLT_MAX;
+  double d2; //squared Euclidean distance
+  for(unsigned int i = 0; i < pc.size; i++) {
+    const float *p = pc.point(i);
+    d2 = p[0]*p[0] + p[1]*p[1] + p[2]*p[2];
+    if(min_distance > d2) {
+      min_distance = d2;
+    }
+  }
+  return min_distance;
+}
+
+void computeCovarianceMatrixNormalized(const ClusterView &pc, const Eigen::Vector4f &centroid, Eigen::Matrix3f &covariance) {
+  covariance.setZero();
+  for(unsigned int i = 0; i < pc.size; i++) {
+    const float *p = pc.point(i);
+    float x = p[0] - centroid[0], y = p[1] - centroid[1], z = p[2] - centroid[2];
+    covariance(1,1) += y * y;
+    covariance(1,2) += y * z;
+    covariance(2,2) += z * z;
+    covariance(0,0) += x * x;
+    covariance(0,1) += x * y;
+    covariance(0,2) += x * z;
+  }
+  covariance(1,0) = covariance(0,1);
+  covariance(2,0) = covariance(0,2);
+  covariance(2,1) = covariance(1,2);
+  if(pc.size) {
+    covariance /= static_cast<float>(pc.size);
+  }
+}
+
+void computeMomentOfInertiaTensorNormalized(const ClusterView &pc, Eigen::Matrix3f &moment_3d) {
+  moment_3d.setZero();
+  for(unsigned int i = 0; i < pc.size; i++) {
+    const float *p = pc.point(i);
+    moment_3d(0,0) += p[1]*p[1]+p[2]*p[2];
+    moment_3d(0,1) -= p[0]*p[1];
+    moment_3d(0,2) -= p[0]*p[2];
+    moment_3d(1,1) += p[0]*p[0]+p[2]*p[2];
+    moment_3d(1,2) -= p[1]*p[2];
+    moment_3d(2,2) += p[0]*p[0]+p[1]*p[1];
+  }
+  moment_3d(1, 0) = moment_3d(0, 1);
+  moment_3d(2, 0) = moment_3d(0, 2);
+  moment_3d(2, 1) = moment_3d(1, 2);
+}
+
+void computePCA(const ClusterView &pc, Eigen::Vector4f &mean, Eigen::Matrix3f &eigenvectors) {
+  computeCentroid(pc, mean);
+  // scatter matrix of the demeaned cloud, its eigenvectors are those of the covariance
+  Eigen::Matrix3f alpha = Eigen::Matrix3f::Zero();
+  for(unsigned int i = 0; i < pc.size; i++) {
+    Eigen::Vector3f d = Eigen::Map<const Eigen::Vector3f>(pc.point(i)) - mean.head<3>();
+    alpha += d * d.transpose();
+  }
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> evd(alpha);
+  // organize eigenvectors in decreasing eigenvalue order
+  for(int i = 0; i < 3; i++) {
+    eigenvectors.col(i) = evd.eigenvectors().col(2-i);
+  }
+}
+
+ClusterView projectPCA(const ClusterView &pc, std::vector<float> &projected, Eigen::Vector4f *pca_mean, Eigen::Matrix3f *pca_eigenvectors) {
+  Eigen::Vector4f mean;
+  Eigen::Matrix3f eigenvectors;
+  computePCA(pc, mean, eigenvectors);
+  if(pca_mean) *pca_mean = mean;
+  if(pca_eigenvectors) *pca_eigenvectors = eigenvectors;
+  Eigen::Matrix3f basis = eigenvectors.transpose();
+  
+  projected.resize(pc.size * 4);
+  for(unsigned int i = 0; i < pc.size; i++) {
+    Eigen::Map<Eigen::Vector3f> out(&projected[i*4]);
+    out = basis * (Eigen::Map<const Eigen::Vector3f>(pc.point(i)) - mean.head<3>());
+    projected[i*4+3] = 1.0f;
+  }
+  ClusterView view = {projected.data(), pc.size};
+  return view;
+}
+
+void computeSlice(const ClusterView &pc, int n, double *slice) {
+  for(int i = 0; i < 20; i++) {
+    slice[i] = 0;
+  }
+  n = std::min(n, MAX_SLICES);
+
+  Eigen::Vector4f pc_min, pc_max;
+  computeMinMax3D(pc, pc_min, pc_max);
+  
+  double itv = (pc_max[2] - pc_min[2]) / n;
+  if(itv <= 0) {
+    return;
+  }
+  
+  // Running sums per block, on the stack. Points are taken relative to the
+  // bounding box center to keep the float sums well conditioned.
+  Eigen::Vector3f origin = 0.5f * (pc_min.head<3>() + pc_max.head<3>());
+  unsigned int count[MAX_SLICES];
+  Eigen::Vector3f sum[MAX_SLICES];
+  Eigen::Matrix3f sum_sq[MAX_SLICES];
+  for(int i = 0; i < n; i++) {
+    count[i] = 0;
+    sum[i].setZero();
+    sum_sq[i].setZero();
+  }
+  for(unsigned int i = 0, j; i < pc.size; i++) {
+    const float *p = pc.point(i);
+    j = std::min((n-1), (int)((p[2] - pc_min[2]) / itv));
+    Eigen::Vector3f q = Eigen::Map<const Eigen::Vector3f>(p) - origin;
+    count[j]++;
+    sum[j] += q;
+    sum_sq[j].selfadjointView<Eigen::Upper>().rankUpdate(q);
+  }
+  
+  // Main two axes of every block, as pcl::PCA would find them.
+  Eigen::Vector3f axis0[MAX_SLICES], axis1[MAX_SLICES];
+  float block_min[MAX_SLICES][2], block_max[MAX_SLICES][2];
+  for(int i = 0; i < n; i++) {
+    if(count[i] > 2) { // At least 3 points to perform pca.
+      Eigen::Matrix3f scatter = sum_sq[i].selfadjointView<Eigen::Upper>();
+      scatter -= sum[i] * sum[i].transpose() / static_cast<float>(count[i]);
+      Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> evd(scatter);
+      axis0[i] = evd.eigenvectors().col(2);
+      axis1[i] = evd.eigenvectors().col(1);
+    }
+    block_min[i][0] = block_min[i][1] = FLT_MAX;
+    block_max[i][0] = block_max[i][1] = -FLT_MAX;
+  }
+  for(unsigned int i = 0, j; i < pc.size; i++) {
+    const float *p = pc.point(i);
+    j = std::min((n-1), (int)((p[2] - pc_min[2]) / itv));
+    if(count[j] > 2) {
+      Eigen::Vector3f q = Eigen::Map<const Eigen::Vector3f>(p) - origin;
+      float u = axis0[j].dot(q), v = axis1[j].dot(q);
+      block_min[j][0] = std::min(block_min[j][0], u);
+      block_max[j][0] = std::max(block_max[j][0], u);
+      block_min[j][1] = std::min(block_min[j][1], v);
+      block_max[j][1] = std::max(block_max[j][1], v);
+    }
+  }
+  for(int i = 0; i < n; i++) {
+    if(count[i] > 2) {
+      slice[i*2] = block_max[i][0] - block_min[i][0];
+      slice[i*2+1] = block_max[i][1] - block_min[i][1];
+    }
+  }
+}
+
+/* Main plane is formed from the maximum and middle eigenvectors.
+ * Secondary plane is formed from the middle and minimum eigenvectors.
+ */
+ClusterView computeProjectedPlane(const ClusterView &pc, const Eigen::Matrix3f &eigenvectors, int axe, const Eigen::Vector4f &centroid, std::vector<float> &plane) {
+  Eigen::Vector4f coefficients;
+  coefficients[0] = eigenvectors(0,axe);
+  coefficients[1] = eigenvectors(1,axe);
+  coefficients[2] = eigenvectors(2,axe);
+  coefficients[3] = 0;
+  coefficients[3] = -1 * coefficients.dot(centroid);
+  plane.resize(pc.size * 4);
+  for(unsigned int i = 0; i < pc.size; i++) {
+    const float *p = pc.point(i);
+    double distance_to_plane =
+      coefficients[0] * p[0] +
+      coefficients[1] * p[1] +
+      coefficients[2] * p[2] +
+      coefficients[3];
+    plane[i*4+0] = p[0] - distance_to_plane * coefficients[0];
+    plane[i*4+1] = p[1] - distance_to_plane * coefficients[1];
+    plane[i*4+2] = p[2] - distance_to_plane * coefficients[2];
+    plane[i*4+3] = 1.0f;
+  }
+  ClusterView view = {plane.data(), pc.size};
+  return view;
+}
+
+/* Upper half, and the left and right lower halves of a pedestrian. */
+void compute3ZoneCovarianceMatrix(const ClusterView &plane, const Eigen::Vector4f &mean, double *partial_covariance_2d) {
+  // two passes with fixed-size sums per zone: centroid, then covariance around it
+  int zone_of[3] = {0, 0, 0};
+  Eigen::Vector3d sum[3] = {Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero()};
+  for(unsigned int i = 0; i < plane.size; i++) {
+    const float *p = plane.point(i);
+    int z = p[2] >= mean(2) ? 0 : (p[1] >= mean(1) ? 1 : 2); // upper half, left or right lower half
+    zone_of[z]++;
+    sum[z] += Eigen::Vector3d(p[0], p[1], p[2]);
+  }
+  double cov[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}}; // xx, xy, yy per zone
+  for(unsigned int i = 0; i < plane.size; i++) {
+    const float *p = plane.point(i);
+    int z = p[2] >= mean(2) ? 0 : (p[1] >= mean(1) ? 1 : 2);
+    double x = p[0] - sum[z][0] / zone_of[z], y = p[1] - sum[z][1] / zone_of[z];
+    cov[z][0] += x * x;
+    cov[z][1] += x * y;
+    cov[z][2] += y * y;
+  }
+  for(int i = 0; i < 3; i++) {
+    partial_covariance_2d[i*3+0] = cov[i][0];
+    partial_covariance_2d[i*3+1] = cov[i][1];
+    partial_covariance_2d[i*3+2] = cov[i][2];
+  }
+}
+
+void computeHistogramNormalized(const ClusterView &pc, int horiz_bins, int verti_bins, double *histogram) {
+  for(int i = 0; i < horiz_bins * verti_bins; i++) {
+    histogram[i] = 0;
+  }
+  if(pc.size == 0) {
+    return;
+  }
+  Eigen::Vector4f min, max;
+  computeMinMax3D(pc, min, max);
+  // bin along the longer horizontal extent and the height
+  int horiz_axis = (max[0]-min[0] > max[1]-min[1]) ? 0 : 1;
+  double horiz_itv = (max[horiz_axis] - min[horiz_axis]) / horiz_bins;
+  double verti_itv = (max[2] - min[2]) / verti_bins;
+  
+  for(unsigned int k = 0; k < pc.size; k++) {
+    const float *p = pc.point(k);
+    int i = horiz_itv > 0 ? std::min(horiz_bins - 1, (int)((p[horiz_axis] - min[horiz_axis]) / horiz_itv)) : 0;
+    int j = verti_itv > 0 ? std::min(verti_bins - 1, (int)((p[2] - min[2]) / verti_itv)) : 0;
+    histogram[i*verti_bins+j] += 1.0;
+  }
+  for(int i = 0; i < horiz_bins * verti_bins; i++) {
+    histogram[i] /= (double)pc.size;
+  }
+}
+
+void saveFeature(const Feature &f, double *x) {
+  using namespace feature_layout;
+  x[offset(F1_NUMBER_POINTS)] = f.number_points;
+  x[offset(F2_MIN_DISTANCE)] = f.min_distance;
+  
+  double *covariance = x + offset(F3_COVARIANCE);
+  covariance[0] = f.covariance_3d(0,0);
+  covariance[1] = f.covariance_3d(0,1);
+  covariance[2] = f.covariance_3d(0,2);
+  covariance[3] = f.covariance_3d(1,1);
+  covariance[4] = f.covariance_3d(1,2);
+  covariance[5] = f.covariance_3d(2,2);
+  
+  double *moment = x + offset(F4_MOMENT);
+  moment[0] = f.moment_3d(0,0);
+  moment[1] = f.moment_3d(0,1);
+  moment[2] = f.moment_3d(0,2);
+  moment[3] = f.moment_3d(1,1);
+  moment[4] = f.moment_3d(1,2);
+  moment[5] = f.moment_3d(2,2);
+  
+#if OBJECT3D_FEATURE_F5
+  std::copy(f.partial_covariance_2d, f.partial_covariance_2d + width(F5_PARTIAL_COVARIANCE), x + offset(F5_PARTIAL_COVARIANCE));
+#endif
+#if OBJECT3D_FEATURE_F6
+  std::copy(f.histogram_main_2d, f.histogram_main_2d + width(F6_HISTOGRAM_MAIN), x + offset(F6_HISTOGRAM_MAIN));
+#endif
+#if OBJECT3D_FEATURE_F7
+  std::copy(f.histogram_second_2d, f.histogram_second_2d + width(F7_HISTOGRAM_SECOND), x + offset(F7_HISTOGRAM_SECOND));
+#endif
+  std::copy(f.slice, f.slice + width(F8_SLICE), x + offset(F8_SLICE));
+}
@@ -0,0 +1,288 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "cluster_features_gpu.h"
+#include <gpu_arbiter/streams.h>
+
+#include <cfloat>
+#include <algorithm>
+
+static const int THREADS = 256;
+static const int SLICES = GpuFeatureExtractor::SLICES;
+static const int FEATURES = GpuFeatureExtractor::GPU_FEATURE_SIZE;
+
+/* Cyclic Jacobi eigen decomposition of a symmetric 3x3 matrix. On return w holds
+ * the eigenvalues in decreasing order and the columns of v the matching eigenvectors.
+ */
+__host__ __device__ void jacobiEigen3(float a[3][3], float v[3][3], float w[3]) {
+  for(int i = 0; i < 3; i++) {
+    for(int j = 0; j < 3; j++) {
+      v[i][j] = (i == j) ? 1.0f : 0.0f;
+    }
+  }
+  const int P[3] = {0, 0, 1};
+  const int Q[3] = {1, 2, 2};
+  for(int sweep = 0; sweep < 10; sweep++) {
+    float off = a[0][1]*a[0][1] + a[0][2]*a[0][2] + a[1][2]*a[1][2];
+    float diag = a[0][0]*a[0][0] + a[1][1]*a[1][1] + a[2][2]*a[2][2];
+    if(off <= 1e-14f * diag || off == 0.0f) {
+      break;
+    }
+    for(int r = 0; r < 3; r++) {
+      int p = P[r], q = Q[r];
+      if(a[p][q] == 0.0f) {
+	continue;
+      }
+      float theta = (a[q][q] - a[p][p]) / (2.0f * a[p][q]);
+      float t = (theta >= 0.0f ? 1.0f : -1.0f) / (fabsf(theta) + sqrtf(theta * theta + 1.0f));
+      float c = 1.0f / sqrtf(t * t + 1.0f);
+      float s = t * c;
+      for(int k = 0; k < 3; k++) {
+	float akp = a[k][p], akq = a[k][q];
+	a[k][p] = c * akp - s * akq;
+	a[k][q] = s * akp + c * akq;
+      }
+      for(int k = 0; k < 3; k++) {
+	float apk = a[p][k], aqk = a[q][k];
+	a[p][k] = c * apk - s * aqk;
+	a[q][k] = s * apk + c * aqk;
+      }
+      for(int k = 0; k < 3; k++) {
+	float vkp = v[k][p], vkq = v[k][q];
+	v[k][p] = c * vkp - s * vkq;
+	v[k][q] = s * vkp + c * vkq;
+      }
+    }
+  }
+  for(int i = 0; i < 3; i++) {
+    w[i] = a[i][i];
+  }
+  // sort in decreasing order, as pcl::PCA does
+  for(int i = 0; i < 2; i++) {
+    for(int j = i + 1; j < 3; j++) {
+      if(w[j] > w[i]) {
+	float tw = w[i]; w[i] = w[j]; w[j] = tw;
+	for(int k = 0; k < 3; k++) {
+	  float tv = v[k][i]; v[k][i] = v[k][j]; v[k][j] = tv;
+	}
+      }
+    }
+  }
+}
+
+__device__ void atomicMinFloat(float *address, float value) {
+  int *a = reinterpret_cast<int *>(address);
+  int old = *a, assumed;
+  while(value < __int_as_float(old)) {
+    assumed = old;
+    old = atomicCAS(a, assumed, __float_as_int(value));
+    if(old == assumed) {
+      break;
+    }
+  }
+}
+
+__device__ void atomicMaxFloat(float *address, float value) {
+  int *a = reinterpret_cast<int *>(address);
+  int old = *a, assumed;
+  while(value > __int_as_float(old)) {
+    assumed = old;
+    old = atomicCAS(a, assumed, __float_as_int(value));
+    if(old == assumed) {
+      break;
+    }
+  }
+}
+
+/* Symmetric 3x3 stored as xx, xy, xz, yy, yz, zz. */
+__device__ void accumulateOuter(float *sq, float x, float y, float z) {
+  atomicAdd(&sq[0], x * x);
+  atomicAdd(&sq[1], x * y);
+  atomicAdd(&sq[2], x * z);
+  atomicAdd(&sq[3], y * y);
+  atomicAdd(&sq[4], y * z);
+  atomicAdd(&sq[5], z * z);
+}
+
+__device__ void unpackSymmetric(const float *sq, float a[3][3]) {
+  a[0][0] = sq[0]; a[0][1] = sq[1]; a[0][2] = sq[2];
+  a[1][0] = sq[1]; a[1][1] = sq[3]; a[1][2] = sq[4];
+  a[2][0] = sq[2]; a[2][1] = sq[4]; a[2][2] = sq[5];
+}
+
+__global__ void clusterFeaturesKernel(const ClusterView *clusters, float *features) {
+  const float4 *pts = reinterpret_cast<const float4 *>(clusters[blockIdx.x].data);
+  const unsigned int n = clusters[blockIdx.x].size;
+  float *row = features + blockIdx.x * FEATURES;
+
+  __shared__ float s_sum[3];
+  __shared__ float s_min_z, s_max_z, s_min_d2;
+  __shared__ float s_scatter[6];
+  __shared__ unsigned int s_count[SLICES];
+  __shared__ float s_bin_sum[SLICES][3];
+  __shared__ float s_bin_sq[SLICES][6];
+  __shared__ float s_axes[SLICES][6];
+  __shared__ float s_ext[SLICES][4];
+
+  const unsigned int tid = threadIdx.x;
+  if(tid == 0) {
+    s_sum[0] = s_sum[1] = s_sum[2] = 0.0f;
+    s_min_z = FLT_MAX;
+    s_max_z = -FLT_MAX;
+    s_min_d2 = FLT_MAX;
+  }
+  if(tid < 6) {
+    s_scatter[tid] = 0.0f;
+  }
+  if(tid < SLICES) {
+    s_count[tid] = 0;
+    for(int k = 0; k < 3; k++) s_bin_sum[tid][k] = 0.0f;
+    for(int k = 0; k < 6; k++) s_bin_sq[tid][k] = 0.0f;
+    s_ext[tid][0] = s_ext[tid][2] = FLT_MAX;
+    s_ext[tid][1] = s_ext[tid][3] = -FLT_MAX;
+  }
+  __syncthreads();
+
+  // pass 1: centroid, height extent and minimum squared distance
+  float sx = 0.0f, sy = 0.0f, sz = 0.0f, zmin = FLT_MAX, zmax = -FLT_MAX, d2min = FLT_MAX;
+  for(unsigned int i = tid; i < n; i += blockDim.x) {
+    float4 p = pts[i];
+    sx += p.x; sy += p.y; sz += p.z;
+    zmin = fminf(zmin, p.z);
+    zmax = fmaxf(zmax, p.z);
+    d2min = fminf(d2min, p.x * p.x + p.y * p.y + p.z * p.z);
+  }
+  atomicAdd(&s_sum[0], sx);
+  atomicAdd(&s_sum[1], sy);
+  atomicAdd(&s_sum[2], sz);
+  atomicMinFloat(&s_min_z, zmin);
+  atomicMaxFloat(&s_max_z, zmax);
+  atomicMinFloat(&s_min_d2, d2min);
+  __syncthreads();
+
+  const float mx = s_sum[0] / n, my = s_sum[1] / n, mz = s_sum[2] / n;
+  const float itv = (s_max_z - s_min_z) / SLICES;
+
+  // pass 2: scatter of the cluster and of every height bin, around the cluster mean
+  float sc[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  for(unsigned int i = tid; i < n; i += blockDim.x) {
+    float4 p = pts[i];
+    float x = p.x - mx, y = p.y - my, z = p.z - mz;
+    sc[0] += x * x; sc[1] += x * y; sc[2] += x * z;
+    sc[3] += y * y; sc[4] += y * z; sc[5] += z * z;
+    if(itv > 0.0f) {
+      int j = min(SLICES - 1, (int)((p.z - s_min_z) / itv));
+      atomicAdd(&s_count[j], 1u);
+      atomicAdd(&s_bin_sum[j][0], x);
+      atomicAdd(&s_bin_sum[j][1], y);
+      atomicAdd(&s_bin_sum[j][2], z);
+      accumulateOuter(s_bin_sq[j], x, y, z);
+    }
+  }
+  for(int k = 0; k < 6; k++) {
+    atomicAdd(&s_scatter[k], sc[k]);
+  }
+  __syncthreads();
+
+  float a[3][3], v[3][3], w[3];
+  if(tid < SLICES && itv > 0.0f && s_count[tid] > 2) { // At least 3 points to perform pca.
+    float cnt = s_count[tid];
+    float bin_scatter[6];
+    for(int k = 0, r = 0; r < 3; r++) {
+      for(int c = r; c < 3; c++, k++) {
+	bin_scatter[k] = s_bin_sq[tid][k] - s_bin_sum[tid][r] * s_bin_sum[tid][c] / cnt;
+      }
+    }
+    unpackSymmetric(bin_scatter, a);
+    jacobiEigen3(a, v, w);
+    for(int k = 0; k < 3; k++) {
+      s_axes[tid][k] = v[k][0];
+      s_axes[tid][k+3] = v[k][1];
+    }
+  } else if(tid == SLICES) {
+    unpackSymmetric(s_scatter, a);
+    jacobiEigen3(a, v, w);
+    const float c[3] = {mx, my, mz};
+    row[0] = n;
+    row[1] = s_min_d2;
+    // f3: covariance of the projected cluster around the original centroid
+    row[2] = w[0] / n + c[0] * c[0];
+    row[3] = c[0] * c[1];
+    row[4] = c[0] * c[2];
+    row[5] = w[1] / n + c[1] * c[1];
+    row[6] = c[1] * c[2];
+    row[7] = w[2] / n + c[2] * c[2];
+    // f4: moment of inertia tensor of the projected cluster
+    row[8] = w[1] + w[2];
+    row[9] = 0.0f;
+    row[10] = 0.0f;
+    row[11] = w[0] + w[2];
+    row[12] = 0.0f;
+    row[13] = w[0] + w[1];
+  }
+  __syncthreads();
+
+  // pass 3: extents of every bin along its two main axes
+  if(itv > 0.0f) {
+    for(unsigned int i = tid; i < n; i += blockDim.x) {
+      float4 p = pts[i];
+      int j = min(SLICES - 1, (int)((p.z - s_min_z) / itv));
+      if(s_count[j] > 2) {
+	float x = p.x - mx, y = p.y - my, z = p.z - mz;
+	float u = x * s_axes[j][0] + y * s_axes[j][1] + z * s_axes[j][2];
+	float t = x * s_axes[j][3] + y * s_axes[j][4] + z * s_axes[j][5];
+	atomicMinFloat(&s_ext[j][0], u);
+	atomicMaxFloat(&s_ext[j][1], u);
+	atomicMinFloat(&s_ext[j][2], t);
+	atomicMaxFloat(&s_ext[j][3], t);
+      }
+    }
+  }
+  __syncthreads();
+
+  // f8: slice feature
+  if(tid < SLICES) {
+    bool valid = itv > 0.0f && s_count[tid] > 2;
+    row[14 + tid * 2] = valid ? s_ext[tid][1] - s_ext[tid][0] : 0.0f;
+    row[15 + tid * 2] = valid ? s_ext[tid][3] - s_ext[tid][2] : 0.0f;
+  }
+}
+
+GpuFeatureExtractor::GpuFeatureExtractor()
+  : stream_(NULL), clusters_(NULL), features_(NULL), capacity_(0) {
+  gpu_arbiter::createStream(&stream_, gpu_arbiter::HIGH);
+  reserve(64);
+}
+
+GpuFeatureExtractor::~GpuFeatureExtractor() {
+  cudaStreamSynchronize(stream_);
+  if(clusters_) cudaFree(clusters_);
+  if(features_) cudaFree(features_);
+  cudaStreamDestroy(stream_);
+}
+
+void GpuFeatureExtractor::reserve(size_t clusters) {
+  if(clusters <= capacity_) {
+    return;
+  }
+  if(clusters_) cudaFree(clusters_);
+  if(features_) cudaFree(features_);
+  capacity_ = std::max(clusters, capacity_ * 2);
+  cudaMallocManaged(&clusters_, sizeof(ClusterView) * capacity_);
+  cudaMallocManaged(&features_, sizeof(float) * FEATURES * capacity_);
+}
+
+const float *GpuFeatureExtractor::compute(const std::vector<ClusterView> &clusters) {
+  if(clusters.empty()) {
+    return features_;
+  }
+  reserve(clusters.size());
+  std::copy(clusters.begin(), clusters.end(), clusters_);
+  clusterFeaturesKernel<<<clusters.size(), THREADS, 0, stream_>>>(clusters_, features_);
+  cudaStreamSynchronize(stream_);
+  return features_;
+}
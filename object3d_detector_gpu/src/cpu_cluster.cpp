@@ -0,0 +1,153 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "cpu_cluster.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const int BIAS = 1 << 20; // 21 bits per axis
+
+static uint64_t packKey(int ix, int iy, int iz) {
+  return (uint64_t)(ix + BIAS) | ((uint64_t)(iy + BIAS) << 21) | ((uint64_t)(iz + BIAS) << 42);
+}
+
+static void unpackKey(uint64_t key, int &ix, int &iy, int &iz) {
+  ix = (int)(key & 0x1fffff) - BIAS;
+  iy = (int)((key >> 21) & 0x1fffff) - BIAS;
+  iz = (int)((key >> 42) & 0x1fffff) - BIAS;
+}
+
+static int voxelIndex(float v, float size) {
+  return std::min(std::max((int)std::floor(v / size), -BIAS + 1), BIAS - 2);
+}
+
+CpuExtractCluster::CpuExtractCluster() {
+  memset(&param_, 0, sizeof(param_));
+}
+
+int CpuExtractCluster::find(int voxel) {
+  int parent = parent_[voxel].load(std::memory_order_relaxed);
+  while(parent != voxel) {
+    voxel = parent;
+    parent = parent_[voxel].load(std::memory_order_relaxed);
+  }
+  return voxel;
+}
+
+/* The higher root goes under the lower one; a root linked meanwhile by
+ * another thread fails the exchange and is found again. */
+void CpuExtractCluster::unite(int a, int b) {
+  while(true) {
+    a = find(a);
+    b = find(b);
+    if(a == b) {
+      return;
+    }
+    if(a < b) {
+      std::swap(a, b);
+    }
+    int expected = a;
+    if(parent_[a].compare_exchange_strong(expected, b)) {
+      return;
+    }
+  }
+}
+
+int CpuExtractCluster::extract(const float *cloud_in, int nCount, float *output, unsigned int *index) {
+  index[0] = 0;
+  if(nCount <= 0 || param_.voxelX <= 0.0f || param_.voxelY <= 0.0f || param_.voxelZ <= 0.0f) {
+    return 0;
+  }
+  const int n = nCount;
+
+  // the voxel of every point, non-finite points out
+  keys_.resize(n);
+  order_.resize(n);
+#pragma omp parallel for
+  for(int i = 0; i < n; i++) {
+    const float *p = cloud_in + 4 * i;
+    bool finite = std::isfinite(p[0]) && std::isfinite(p[1]) && std::isfinite(p[2]);
+    keys_[i] = finite ? packKey(voxelIndex(p[0], param_.voxelX), voxelIndex(p[1], param_.voxelY), voxelIndex(p[2], param_.voxelZ)) : UINT64_MAX;
+    order_[i] = i;
+  }
+  std::sort(order_.begin(), order_.end(), [this](unsigned int a, unsigned int b) {
+    return keys_[a] < keys_[b] || (keys_[a] == keys_[b] && a < b);
+  });
+
+  // the voxels kept, and their points
+  voxel_keys_.clear();
+  voxel_begin_.clear();
+  std::vector<unsigned int> kept;
+  for(int begin = 0, end; begin < n && keys_[order_[begin]] != UINT64_MAX; begin = end) {
+    uint64_t key = keys_[order_[begin]];
+    for(end = begin + 1; end < n && keys_[order_[end]] == key; end++) {
+    }
+    if(end - begin > param_.countThreshold) {
+      voxel_keys_.push_back(key);
+      voxel_begin_.push_back(kept.size());
+      kept.insert(kept.end(), order_.begin() + begin, order_.begin() + end);
+    }
+  }
+  voxel_begin_.push_back(kept.size());
+  const int voxels = voxel_keys_.size();
+
+  // every voxel joins its 13 neighbours ahead of it, the other 13 join it
+  std::vector<std::atomic<int> >(voxels).swap(parent_);
+  for(int v = 0; v < voxels; v++) {
+    parent_[v].store(v, std::memory_order_relaxed);
+  }
+#pragma omp parallel for schedule(dynamic, 256)
+  for(int v = 0; v < voxels; v++) {
+    int ix, iy, iz;
+    unpackKey(voxel_keys_[v], ix, iy, iz);
+    for(int dz = -1; dz <= 1; dz++) {
+      for(int dy = -1; dy <= 1; dy++) {
+	for(int dx = -1; dx <= 1; dx++) {
+	  uint64_t key = packKey(ix + dx, iy + dy, iz + dz);
+	  if(key <= voxel_keys_[v]) {
+	    continue;
+	  }
+	  std::vector<uint64_t>::const_iterator it = std::lower_bound(voxel_keys_.begin(), voxel_keys_.end(), key);
+	  if(it != voxel_keys_.end() && *it == key) {
+	    unite(v, it - voxel_keys_.begin());
+	  }
+	}
+      }
+    }
+  }
+
+  // the clusters by root, in voxel order since a root is the lowest voxel of its cluster
+  cluster_size_.assign(voxels, 0);
+  for(int v = 0; v < voxels; v++) {
+    cluster_size_[find(v)] += voxel_begin_[v+1] - voxel_begin_[v];
+  }
+  std::vector<unsigned int> offset(voxels, 0);
+  unsigned int clusters = 0, points = 0;
+  for(int v = 0; v < voxels; v++) {
+    unsigned int size = cluster_size_[v];
+    if(size > 0 && size >= param_.minClusterSize && size <= param_.maxClusterSize) {
+      offset[v] = points;
+      points += size;
+      index[++clusters] = size;
+    } else {
+      cluster_size_[v] = 0;
+    }
+  }
+  index[0] = clusters;
+  for(int v = 0; v < voxels; v++) {
+    int root = find(v);
+    if(cluster_size_[root] == 0) {
+      continue;
+    }
+    for(unsigned int k = voxel_begin_[v]; k < voxel_begin_[v+1]; k++) {
+      memcpy(output + 4 * offset[root]++, cloud_in + 4 * kept[k], sizeof(float) * 4);
+    }
+  }
+  return 0;
+}
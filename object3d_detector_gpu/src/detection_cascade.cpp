@@ -0,0 +1,74 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "detection_cascade.h"
+
+#include <algorithm>
+#include <cmath>
+
+DetectionCascade::DetectionCascade() : evaluated_(0) {
+  params_.points_vs_range = false;
+  params_.min_points_range2 = 0.0;
+  params_.extents = false;
+  params_.min_extent.setZero();
+  params_.max_extent.setConstant(1e6);
+  params_.ground = false;
+  params_.ground_z = 0.0;
+  params_.max_ground_gap = 1e6;
+  params_.linear_threshold = 0.0;
+  std::fill(reached_, reached_ + STAGE_COUNT, 0);
+  std::fill(rejected_, rejected_ + STAGE_COUNT, 0);
+}
+
+int DetectionCascade::evaluate(unsigned int points, const Eigen::Vector4f &min, const Eigen::Vector4f &max, const Eigen::Vector4f &centroid) {
+  evaluated_++;
+  float range2 = centroid[0] * centroid[0] + centroid[1] * centroid[1];
+  Eigen::Vector3f extent = (max - min).head<3>();
+  
+  int stage = STAGE_POINTS_VS_RANGE;
+  reached_[stage]++;
+  if(params_.points_vs_range && points * range2 < params_.min_points_range2) {
+    rejected_[stage]++;
+    return stage;
+  }
+  
+  reached_[++stage]++;
+  if(params_.extents &&
+     ((extent.array() < params_.min_extent.array()).any() || (extent.array() > params_.max_extent.array()).any())) {
+    rejected_[stage]++;
+    return stage;
+  }
+  
+  reached_[++stage]++;
+  if(params_.ground && min[2] - params_.ground_z > params_.max_ground_gap) {
+    rejected_[stage]++;
+    return stage;
+  }
+  
+  reached_[++stage]++;
+  if(params_.linear_weights.size() == LINEAR_FEATURES + 1) {
+    const double x[LINEAR_FEATURES] = {(double)points, std::sqrt(range2), extent[0], extent[1], extent[2], points * range2};
+    double score = params_.linear_weights[0];
+    for(int i = 0; i < LINEAR_FEATURES; i++) {
+      score += params_.linear_weights[i+1] * x[i];
+    }
+    if(score < params_.linear_threshold) {
+      rejected_[stage]++;
+      return stage;
+    }
+  }
+  return STAGE_COUNT;
+}
+
+double DetectionCascade::rejectionRate(int stage) const {
+  return reached_[stage] ? (double)rejected_[stage] / reached_[stage] : 0.0;
+}
+
+const char *DetectionCascade::name(int stage) {
+  static const char *names[STAGE_COUNT+1] = {"points vs range", "extents", "height above ground", "linear", "accepted"};
+  return names[stage];
+}
@@ -0,0 +1,48 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "latency_stats.h"
+
+#include <algorithm>
+
+RollingStats::RollingStats(size_t window)
+  : samples_(std::max(window, (size_t)1)), next_(0), total_(0) {}
+
+void RollingStats::resize(size_t window) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  samples_.assign(std::max(window, (size_t)1), 0.0);
+  next_ = 0;
+  total_ = 0;
+}
+
+void RollingStats::add(double ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  samples_[next_] = ms;
+  next_ = (next_ + 1) % samples_.size();
+  total_++;
+}
+
+size_t RollingStats::count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return total_;
+}
+
+bool RollingStats::percentiles(double &p50, double &p90, double &p99, double &max) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t n = std::min(total_, samples_.size());
+  if(n == 0) {
+    return false;
+  }
+  sorted_.assign(samples_.begin(), samples_.begin() + n);
+  std::sort(sorted_.begin(), sorted_.end());
+  // nearest-rank percentiles
+  p50 = sorted_[(n - 1) * 50 / 100];
+  p90 = sorted_[(n - 1) * 90 / 100];
+  p99 = sorted_[(n - 1) * 99 / 100];
+  max = sorted_[n - 1];
+  return true;
+}
@@ -30,540 +30,1421 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  **/
 
-// ROS
-#include <ros/ros.h>
-#include <sensor_msgs/PointCloud2.h>
-#include <people_msgs/People.h>
-#include <people_msgs/PositionMeasurementArray.h>
-#include <visualization_msgs/MarkerArray.h>
-
-// PCL
-#include <pcl_conversions/pcl_conversions.h>
-#include <pcl/common/common.h>
-#include <pcl/common/centroid.h>
-#include <pcl/common/pca.h>
-
-// CUDA-PCL
-#include <cuda_runtime.h>
-#include "cudaCluster.h"
-
-// SVM
-#include <libsvm/svm.h>
-
-typedef struct feature {
-  /*** for visualization ***/
-  Eigen::Vector4f centroid;
-  Eigen::Vector4f min;
-  Eigen::Vector4f max;
-  /*** for classification ***/
-  int number_points;
-  double min_distance;
-  Eigen::Matrix3f covariance_3d;
-  Eigen::Matrix3f moment_3d;
-  // double partial_covariance_2d[9];
-  // double histogram_main_2d[98];
-  // double histogram_second_2d[45];
-  double slice[20];
-} Feature;
-
-static const int FEATURE_SIZE = 34;
-
-class Object3dDetector {
-private:
-  /*** ROS Publishers and Subscribers ***/
-  ros::NodeHandle node_handle_;
-  ros::Subscriber point_cloud_sub_;
-  ros::Publisher people_pub_;
-  ros::Publisher measurements_pub_;
-  ros::Publisher marker_array_pub_;
-
-  /*** ROS Parameters ***/
-  bool print_fps_;
-  std::string frame_id_;
-  double z_limit_min_;
-  double z_limit_max_;
-  int cluster_size_min_;
-  int cluster_size_max_;
-  double human_probability_;
-  bool human_size_limit_;
-  std::string model_file_name_;
-  std::string range_file_name_;
-  
-  /*** SVM stuffs ***/
-  std::vector<Feature> features_;
-  struct svm_node *svm_node_;
-  struct svm_model *svm_model_;
-  bool use_svm_model_;
-  bool is_probability_model_;
-  double svm_scale_range_[FEATURE_SIZE][2];
-  double svm_x_lower_;
-  double svm_x_upper_;
-  
-public:
-  Object3dDetector();
-  ~Object3dDetector();
-  
-  void pointCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& ros_pc2);
-  void extractCluster(pcl::PointCloud<pcl::PointXYZ>::Ptr pc);
-  void extractFeature(pcl::PointCloud<pcl::PointXYZ>::Ptr pc, Feature &f, Eigen::Vector4f &min, Eigen::Vector4f &max, Eigen::Vector4f &centroid);
-  void saveFeature(Feature &f, struct svm_node *x);
-  void classify();
-};
-
-Object3dDetector::Object3dDetector() {
-  ros::NodeHandle private_nh("~");
-  
+#include "object3d_detector_gpu.h"
+#include <perception_trace/trace.h>
+
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+const char *stage_names_[STAGE_COUNT] = {"fromROSMsg", "gpu ingest", "z-filter", "region split", "clustering", "features", "svm", "publish", "header to publish"};
+
+const char *Object3dDetector::stageName(int stage) {
+  return stage_names_[stage];
+}
+
+Object3dDetector::Object3dDetector(ros::NodeHandle node, ros::NodeHandle private_nh)
+  : node_handle_(node), node_name_(private_nh.getNamespace()), diagnostics_(node, private_nh, private_nh.getNamespace()),
+    region_layout_(nested_regions_, zone_) {
   people_pub_ = private_nh.advertise<people_msgs::People>("people", 100);
   measurements_pub_ = private_nh.advertise<people_msgs::PositionMeasurementArray>("measurements", 100);
   marker_array_pub_ = private_nh.advertise<visualization_msgs::MarkerArray>("markers", 100);
   
-  point_cloud_sub_ = node_handle_.subscribe<sensor_msgs::PointCloud2>("rslidar_points", 1, &Object3dDetector::pointCloudCallback, this);
-  
   private_nh.param<bool>("print_fps", print_fps_, false);
   private_nh.param<std::string>("frame_id", frame_id_, "rslidar");
   private_nh.param<double>("z_limit_min", z_limit_min_, -0.8);
   private_nh.param<double>("z_limit_max", z_limit_max_, 1.2);
   private_nh.param<int>("cluster_size_min", cluster_size_min_, 5);
   private_nh.param<int>("cluster_size_max", cluster_size_max_, 30000);
+  /*** under load (perception/degradation_level): the nested regions clustered from level 2, the minimum cluster size from level 3 ***/
+  private_nh.param<int>("degraded_nested_regions", degraded_nested_regions_, 7);
+  private_nh.param<int>("degraded_cluster_size_min", degraded_cluster_size_min_, 2 * cluster_size_min_);
   private_nh.param<double>("human_probability", human_probability_, 0.7);
   private_nh.param<bool>("human_size_limit", human_size_limit_, false);
+  /*** early rejection before the features: points vs range, extents, height above ground, linear ***/
+  private_nh.param<bool>("cascade", cascade_enabled_, false);
+  DetectionCascade::Params cascade_params = cascade_.params();
+  std::vector<double> min_extent, max_extent;
+  private_nh.param<double>("cascade_min_points_range2", cascade_params.min_points_range2, 0.0);
+  private_nh.param<std::vector<double> >("cascade_min_extent", min_extent, {0.2, 0.2, 0.5});
+  private_nh.param<std::vector<double> >("cascade_max_extent", max_extent, {1.0, 1.0, 2.0});
+  private_nh.param<double>("cascade_ground_z", cascade_params.ground_z, z_limit_min_);
+  private_nh.param<double>("cascade_max_ground_gap", cascade_params.max_ground_gap, 0.0);
+  private_nh.param<std::vector<double> >("cascade_linear_weights", cascade_params.linear_weights, std::vector<double>());
+  private_nh.param<double>("cascade_linear_threshold", cascade_params.linear_threshold, 0.0);
+  /*** the clusters of the tracker's confident tracks labelled human without the SVM, classified again every reuse_reverify_frames ***/
+  private_nh.param<bool>("classification_reuse", classification_reuse_, false);
+  ClassificationCache::Params reuse_params = classification_cache_.params();
+  private_nh.param<double>("reuse_min_probability", reuse_params.min_probability, 0.9);
+  private_nh.param<double>("reuse_match_distance", reuse_params.match_distance, 0.3);
+  private_nh.param<int>("reuse_reverify_frames", reuse_params.reverify_frames, 10);
   /*** load a pre-trained svm model ***/
   private_nh.param<std::string>("model_file_name", model_file_name_, "");
   private_nh.param<std::string>("range_file_name", range_file_name_, "");
+  /*** check the model and range files every N seconds and swap in a newer model, 0 disables ***/
+  private_nh.param<double>("model_reload_interval", model_reload_interval_, 0.0);
+  /*** evaluate all clusters of a frame at once instead of one svm_predict each ***/
+  private_nh.param<bool>("batched_svm", batched_svm_, true);
+  /*** initial per-region point capacity of the CUDA buffer pool ***/
+  private_nh.param<int>("cluster_buffer_capacity", cluster_buffer_capacity_, 4096);
+  /*** launch all regions on their own streams and synchronize once per frame ***/
+  private_nh.param<bool>("batched_clustering", batched_clustering_, true);
+  /*** filter and bin the raw PointCloud2 on the GPU, no pcl::PointCloud is built ***/
+  private_nh.param<bool>("gpu_ingest", gpu_ingest_, false);
+  /*** the clouds of point_cloud_pool (rslidar, lidar_background_removal) of the process pinned, read in place by the ingest ***/
+  private_nh.param<bool>("pinned_clouds", pinned_clouds_, true);
+  /*** compute the features of all clusters in one CUDA launch ***/
+  private_nh.param<bool>("gpu_features", gpu_features_, false);
+  /*** OpenMP threads of the CPU features, a cluster each at a time, 0 for all of them ***/
+  private_nh.param<int>("feature_threads", feature_threads_, 0);
+  /*** GPU ahead of the YOLO forward passes of the same nodelet manager, a slot reserved every gpu_period (s, the scan period) ***/
+  private_nh.param<bool>("gpu_arbitration", gpu_arbitration_, true);
+  private_nh.param<double>("gpu_period", gpu_period_, 0.1);
+  /*** subscriber queue depth, 1 keeps only the latest scan ***/
+  private_nh.param<int>("queue_size", queue_size_, 1);
+  /*** classify and publish frame N-1 on a worker thread while frame N is being clustered ***/
+  private_nh.param<bool>("pipelined", pipelined_, false);
+  /*** frames that may wait for classification, the clustering stage drops frames beyond it ***/
+  private_nh.param<int>("pipeline_depth", pipeline_depth_, 2);
+  /*** "gpu": voxel clustering per nested region, "cpu": the same on the CPU, "range_image": CPU clustering of organized clouds ***/
+  private_nh.param<std::string>("clustering_backend", clustering_backend_, "gpu");
+  /*** range image: minimum angle (degree) between a beam and its neighbour segment to connect them ***/
+  private_nh.param<double>("range_image_angle", range_image_angle_, 10.0);
+  /*** between full scans, only cluster the points inside the track gates predicted by the tracker ***/
+  private_nh.param<bool>("roi_gating", roi_gating_, false);
+  /*** every N-th frame is a full scan, so that new tracks can be born ***/
+  private_nh.param<int>("full_scan_interval", full_scan_interval_, 5);
+  /*** lower bound of the gate radius (m), the tracker's gates can be tight for settled tracks ***/
+  private_nh.param<double>("gate_radius_min", gate_radius_min_, 1.0);
+  /*** gates older than this (s) are ignored and the frame is a full scan ***/
+  private_nh.param<double>("gate_timeout", gate_timeout_, 0.5);
+  /*** more than one lidar: all inputs are fused in frame_id, the first one sets the pace ***/
+  private_nh.param<std::vector<std::string> >("input_topics", input_topics_, std::vector<std::string>());
+  /*** inputs older than this (s) relative to the first one are left out of the fused frame ***/
+  private_nh.param<double>("fusion_max_age", fusion_max_age_, 0.1);
+  /*** detections closer than this (m) are published once, 0 disables ***/
+  private_nh.param<double>("dedup_distance", dedup_distance_, input_topics_.size() > 1 ? 0.3 : 0.0);
+  /*** drop the points on the inflated occupancy grid map in the GPU ingest, as lidar_background_removal does ***/
+  private_nh.param<bool>("background_removal", background_removal_, false);
+  private_nh.param<std::string>("map_frame", map_frame_, "map");
+  /*** in map cells, rounded up ***/
+  private_nh.param<double>("background_inflation", background_inflation_, 2.0);
+  /*** in the GPU ingest, the ground of every ground_cell_size cell is its lowest point instead of z_limit_min, ground_threshold above it ***/
+  private_nh.param<bool>("ground_segmentation", ground_segmentation_, false);
+  private_nh.param<double>("ground_cell_size", ground_cell_size_, 0.5);
+  private_nh.param<double>("ground_range", ground_range_, 40.0);
+  private_nh.param<double>("ground_threshold", ground_threshold_, 0.15);
+  /*** in degree, a cell whose lowest point is above a floor this steep is seen through an obstacle, z_limit_min applies ***/
+  private_nh.param<double>("ground_max_slope", ground_max_slope_, 15.0);
+  /*** before the clustering, the points of every nested region replaced by their voxel centroids, a leaf size (m) per region from the sensor out, 0 or none keeps the region as is ***/
+  private_nh.param<bool>("voxel_decimation", voxel_decimation_, false);
+  private_nh.param<std::vector<double> >("decimation_leaf_sizes", decimation_leaf_sizes_, {0.1, 0.08, 0.06, 0.04});
+  /*** "fixed": the rings of zone_, "balanced": the same outer range cut at the quantiles of the ranges of the first region_layout_frames frames, as many points per ring ***/
+  private_nh.param<std::string>("region_layout", region_layout_mode_, "fixed");
+  private_nh.param<int>("region_layout_frames", region_layout_frames_, 50);
+  /*** in m, no balanced ring narrower ***/
+  private_nh.param<double>("region_min_width", region_min_width_, 0.5);
+  /*** samples behind the latency percentiles ***/
+  private_nh.param<int>("latency_window", latency_window_, 256);
+  
+  // human_size_limit is the legacy name of the extents stage
+  cascade_params.points_vs_range = cascade_enabled_ && cascade_params.min_points_range2 > 0.0;
+  cascade_params.extents = human_size_limit_ || cascade_enabled_;
+  if(min_extent.size() == 3 && max_extent.size() == 3) {
+    cascade_params.min_extent << min_extent[0], min_extent[1], min_extent[2];
+    cascade_params.max_extent << max_extent[0], max_extent[1], max_extent[2];
+  } else {
+    ROS_WARN("[object3d_detector_gpu] Cascade extents need 3 values each, use the default ones.");
+    cascade_params.min_extent << 0.2, 0.2, 0.5;
+    cascade_params.max_extent << 1.0, 1.0, 2.0;
+  }
+  cascade_params.ground = cascade_enabled_ && cascade_params.max_ground_gap > 0.0;
+  if(!cascade_enabled_) {
+    cascade_params.linear_weights.clear();
+  } else if(!cascade_params.linear_weights.empty() && cascade_params.linear_weights.size() != DetectionCascade::LINEAR_FEATURES + 1) {
+    ROS_WARN("[object3d_detector_gpu] Cascade linear stage needs %d weights, disabled.", DetectionCascade::LINEAR_FEATURES + 1);
+    cascade_params.linear_weights.clear();
+  }
+  cascade_.configure(cascade_params);
+  
+  /*** without a CUDA device, the regions are clustered on the CPU, as the "cpu" backend does ***/
+  int cuda_devices = 0;
+  bool cuda = cudaGetDeviceCount(&cuda_devices) == cudaSuccess && cuda_devices > 0;
+  cpu_clustering_ = clustering_backend_ == "cpu" || !cuda;
+  if(!cuda) {
+    ROS_WARN("[object3d_detector_gpu] No CUDA device, clustering and features on the CPU.");
+    gpu_ingest_ = gpu_features_ = gpu_arbitration_ = voxel_decimation_ = false;
+  }
+  
+  /*** streams, buffers and extractors are created once and reused by every frame, c.f. configureRegions() ***/
+  base_cluster_size_min_ = cluster_size_min_;
+  buffer_pool_ = new ClusterBufferPool(nested_regions_, std::max(cluster_buffer_capacity_, 1), 2.0, !cuda);
+  for(int i = 0; i < nested_regions_; i++) {
+    extractors_[i] = NULL;
+    cpu_extractors_[i] = NULL;
+    if(cpu_clustering_) {
+      cpu_extractors_[i] = new CpuExtractCluster();
+    } else {
+      extractors_[i] = new cudaExtractCluster(buffer_pool_->region(i).stream);
+    }
+    bool decimated = voxel_decimation_ && i < (int)decimation_leaf_sizes_.size() && decimation_leaf_sizes_[i] > 0.0;
+    decimators_[i] = decimated ? new VoxelDecimation(buffer_pool_->region(i).stream) : NULL;
+    region_weights_[i] = 1.0f;
+  }
+  
+  cloud_ingest_ = gpu_ingest_ ? new CloudIngest(nested_regions_, zone_, z_limit_min_, z_limit_max_) : NULL;
+  if(ground_segmentation_ && !cloud_ingest_) {
+    ROS_WARN("[object3d_detector_gpu] Ground segmentation runs in the GPU ingest, enable gpu_ingest, disabled.");
+    ground_segmentation_ = false;
+  }
+  if(ground_segmentation_) {
+    CloudIngestGround ground;
+    ground.enabled = true;
+    ground.cell_size = std::max(ground_cell_size_, 0.05);
+    ground.range = ground_range_;
+    ground.threshold = ground_threshold_;
+    ground.ground_z = z_limit_min_;
+    ground.max_slope = tan(ground_max_slope_ * M_PI / 180.0);
+    cloud_ingest_->setGround(ground);
+  }
+  if(gpu_ingest_ && pinned_clouds_) {
+    point_cloud_pool::enableCudaPinning();
+  }
+  region_binning_ = new RegionBinning(nested_regions_, zone_);
+  // the degraded regions cover the range of as many fixed ones, whatever the layout
+  degraded_range_ = region_layout_.bounds()[std::max(1, std::min(degraded_nested_regions_, nested_regions_))];
+  layout_frames_ = 0;
+  if(region_layout_mode_ != "balanced") {
+    if(region_layout_mode_ != "fixed") {
+      ROS_WARN("[object3d_detector_gpu] Unknown region layout '%s', use fixed.", region_layout_mode_.c_str());
+      region_layout_mode_ = "fixed";
+    }
+    layout_frames_ = region_layout_frames_ = 0;
+  }
+  configureRegions();
+  range_clustering_ = NULL;
+  if(clustering_backend_ == "range_image") {
+    range_clustering_ = new RangeImageClustering(range_image_angle_ * M_PI / 180.0, std::max(cluster_size_min_, 1), cluster_size_max_, z_limit_min_, z_limit_max_);
+    ROS_INFO("[object3d_detector_gpu] Range image clustering of organized clouds.");
+  } else if(clustering_backend_ != "gpu" && clustering_backend_ != "cpu") {
+    ROS_WARN("[object3d_detector_gpu] Unknown clustering backend '%s', use %s.", clustering_backend_.c_str(), cpu_clustering_ ? "cpu" : "gpu");
+  }
+  if(gpu_features_ && !feature_layout::baseline()) {
+    ROS_WARN("[object3d_detector_gpu] f5-f7 are enabled, GPU features disabled.");
+    gpu_features_ = false;
+  }
+  feature_extractor_ = gpu_features_ ? new GpuFeatureExtractor() : NULL;
+#ifdef _OPENMP
+  if(feature_threads_ <= 0) {
+    feature_threads_ = omp_get_max_threads();
+  }
+#else
+  feature_threads_ = 1;
+#endif
+  feature_scratch_.resize(feature_threads_);
+  gpu_client_ = gpu_arbitration_ ? gpu_arbiter::client("object3d_detector_gpu", gpu_arbiter::HIGH, gpu_period_) : NULL;
+  
+  diagnostics_.setHardwareID("object3d_detector_gpu");
+  diagnostics_.add("cluster buffer pool", this, &Object3dDetector::bufferPoolDiagnostics);
+  diagnostics_.add("pipeline", this, &Object3dDetector::pipelineDiagnostics);
+  diagnostics_.add("latency", this, &Object3dDetector::latencyDiagnostics);
+  diagnostics_.add("region layout", this, &Object3dDetector::regionLayoutDiagnostics);
+  diagnostics_.add("roi gating", this, &Object3dDetector::gatingDiagnostics);
+  diagnostics_.add("cascade", this, &Object3dDetector::cascadeDiagnostics);
+  diagnostics_.add("classification reuse", this, &Object3dDetector::reuseDiagnostics);
+  diagnostics_.add("background removal", this, &Object3dDetector::backgroundDiagnostics);
+  diagnostics_.add("gpu arbitration", this, &Object3dDetector::gpuDiagnostics);
+  diagnostics_.add("threads", this, &Object3dDetector::threadDiagnostics);
+  fps_frames_ = 0;
+  last_clusters_ = 0;
+  for(int i = 0; i < STAGE_COUNT; i++) {
+    stage_stats_[i].resize(std::max(latency_window_, 1));
+  }
+  for(int i = 0; i < nested_regions_; i++) {
+    region_stats_[i].resize(std::max(latency_window_, 1));
+  }
   
   use_svm_model_ = false;
-  if((svm_model_ = svm_load_model(model_file_name_.c_str())) == NULL) {
+  svm_.reset(new SvmModel);
+  SvmModel::Status svm_status = svm_->load(model_file_name_, range_file_name_);
+  if(svm_status == SvmModel::MODEL_FAILED) {
     ROS_WARN("[object3d_detector_gpu] Can not load SVM model, use model-free detection.");
   } else {
     ROS_INFO("[object3d_detector_gpu] Load SVM model from '%s'.", model_file_name_.c_str());
-    is_probability_model_ = svm_check_probability_model(svm_model_)?true:false;
-    svm_node_ = (struct svm_node *)malloc((FEATURE_SIZE+1)*sizeof(struct svm_node)); // 1 more size for end index (-1)
 
+    /*** dense support vectors for batched prediction ***/
+    if(svm_->engine().ready()) {
+      ROS_INFO("[object3d_detector_gpu] Batched SVM inference over %d support vectors.", svm_->engine().supportVectors());
+    } else {
+      ROS_INFO("[object3d_detector_gpu] SVM model not supported by the batched inference, use libsvm.");
+    }
+    
     /*** load range file, c.f. https://github.com/cjlin1/libsvm/ ***/
-    FILE *range_file = fopen(range_file_name_.c_str(),"r");
-    if(range_file != NULL) {
+    if(svm_status == SvmModel::LOADED && svm_->model() == NULL) {
+      ROS_INFO("[object3d_detector_gpu] Binary SVM model, range mapped along.");
+      use_svm_model_ = true;
+    } else if(svm_status == SvmModel::LOADED) {
       ROS_INFO("[object3d_detector_gpu] Load SVM range from '%s'.", range_file_name_.c_str());
-      fscanf(range_file, "x\n");
-      fscanf(range_file, "%lf %lf\n", &svm_x_lower_, &svm_x_upper_);
-      //ROS_INFO_STREAM("svm_x_lower = " << svm_x_lower_ << ", svm_x_upper = " << svm_x_upper_);
-      int idx = 1;
-      double fmin, fmax;
-      while(fscanf(range_file, "%d %lf %lf\n",&idx, &fmin, &fmax) == 3) {
-	svm_scale_range_[idx-1][0] = fmin;
-	svm_scale_range_[idx-1][1] =fmax;
-	//ROS_INFO_STREAM(idx << " " << svm_scale_range_[idx-1][0] << " " << svm_scale_range_[idx-1][1]);
-      }
-      fclose(range_file);
       use_svm_model_ = true;
     } else {
       ROS_WARN("[object3d_detector_gpu] Can not load range file, use model-free detection.");
     }
   }
+  
+  /*** newer models are loaded in the background, the features must not change, so only a loaded model is replaced ***/
+  if(use_svm_model_ && model_reload_interval_ > 0.0) {
+    model_thread_ = boost::shared_ptr<boost::thread>(new boost::thread(
+      boost::bind(&Object3dDetector::modelThread, this, thread_config::read(private_nh, "model"))));
+  } else if(model_reload_interval_ > 0.0) {
+    ROS_WARN("[object3d_detector_gpu] No SVM model to reload, model_reload_interval ignored.");
+  }
+  
+  /*** the classification stage owns the SVM, the callback only clusters ***/
+  frame_queue_ = NULL;
+  running_ = true;
+  pipelined_frames_ = 0;
+  dropped_frames_ = 0;
+  if(pipelined_) {
+    frame_queue_ = new FrameQueue<DetectionFrame>(std::max(pipeline_depth_, 1));
+    classify_thread_ = boost::shared_ptr<boost::thread>(new boost::thread(
+      boost::bind(&Object3dDetector::classifyThread, this, thread_config::read(private_nh, "classify"))));
+  }
+  
+  if(background_removal_ && !cloud_ingest_) {
+    ROS_WARN("[object3d_detector_gpu] Background removal runs in the GPU ingest, enable gpu_ingest, disabled.");
+    background_removal_ = false;
+  }
+  background_frame_ = false;
+  background_frames_ = 0;
+  background_skipped_ = 0;
+  
+  tf_listener_ = NULL;
+  gating_frames_ = 0;
+  full_scans_ = 0;
+  gated_scans_ = 0;
+  if(classification_reuse_ && !use_svm_model_) {
+    ROS_WARN("[object3d_detector_gpu] No SVM model, classification_reuse ignored.");
+    classification_reuse_ = false;
+  }
+  reuse_params.enabled = classification_reuse_;
+  classification_cache_.configure(reuse_params);
+  if(roi_gating_ || input_topics_.size() > 1 || background_removal_ || classification_reuse_) {
+    tf_listener_ = new tf::TransformListener();
+  }
+  if(roi_gating_) {
+    gates_sub_ = node_handle_.subscribe<people_msgs::PositionMeasurementArray>("people_tracker/gates", 1, &Object3dDetector::gatesCallback, this);
+  }
+  if(classification_reuse_) {
+    track_states_sub_ = node_handle_.subscribe<bayes_people_tracker::TrackStates>("people_tracker/track_states", 1, &Object3dDetector::trackStatesCallback, this);
+  }
+  degradation_level_ = applied_degradation_ = 0;
+  active_regions_ = nested_regions_;
+  degradation_sub_ = node_handle_.subscribe<std_msgs::UInt8>("perception/degradation_level", 1, &Object3dDetector::degradationCallback, this);
+  if(background_removal_) {
+    map_sub_ = node_handle_.subscribe<nav_msgs::OccupancyGrid>("map", 1, &Object3dDetector::mapCallback, this);
+    map_updates_sub_ = node_handle_.subscribe<map_msgs::OccupancyGridUpdate>("map_updates", 10, &Object3dDetector::mapUpdateCallback, this);
+  }
+  
+  if(input_topics_.size() > 1) {
+    if(input_topics_.size() > CloudIngest::MAX_INPUTS && gpu_ingest_) {
+      ROS_WARN("[object3d_detector_gpu] GPU ingest fuses at most %d lidars, the others are ignored.", CloudIngest::MAX_INPUTS);
+      input_topics_.resize(CloudIngest::MAX_INPUTS);
+    }
+    latest_clouds_.resize(input_topics_.size());
+    for(size_t i = 0; i < input_topics_.size(); i++) {
+      input_subs_.push_back(node_handle_.subscribe<sensor_msgs::PointCloud2>(input_topics_[i], std::max(queue_size_, 1), boost::bind(&Object3dDetector::sensorCallback, this, _1, (int)i)));
+      ROS_INFO("[object3d_detector_gpu] Fuse lidar %zu from '%s'.", i, input_topics_[i].c_str());
+    }
+  } else {
+    std::string topic = input_topics_.empty() ? "rslidar_points" : input_topics_[0];
+    point_cloud_sub_ = node_handle_.subscribe<sensor_msgs::PointCloud2>(topic, std::max(queue_size_, 1), &Object3dDetector::pointCloudCallback, this);
+  }
 }
 
 Object3dDetector::~Object3dDetector() {
-  if(use_svm_model_) {
-    svm_free_and_destroy_model(&svm_model_);
-    free(svm_node_);
+  point_cloud_sub_.shutdown();
+  for(size_t i = 0; i < input_subs_.size(); i++) {
+    input_subs_[i].shutdown();
+  }
+  if(classify_thread_) {
+    {
+      boost::lock_guard<boost::mutex> lock(wake_mutex_);
+      running_ = false;
+    }
+    wake_.notify_one();
+    classify_thread_->join();
+  }
+  delete frame_queue_;
+  if(model_thread_) {
+    model_thread_->interrupt();
+    model_thread_->join();
+  }
+  gates_sub_.shutdown();
+  track_states_sub_.shutdown();
+  degradation_sub_.shutdown();
+  map_sub_.shutdown();
+  map_updates_sub_.shutdown();
+  delete tf_listener_;
+  for(int i = 0; i < nested_regions_; i++) {
+    delete extractors_[i];
+    delete cpu_extractors_[i];
+    delete decimators_[i];
+  }
+  delete cloud_ingest_;
+  delete region_binning_;
+  delete range_clustering_;
+  delete feature_extractor_;
+  delete buffer_pool_;
+}
+
+void Object3dDetector::bufferPoolDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "CUDA cluster buffers reused across frames");
+  stat.add("last occupancy", buffer_pool_->lastOccupancy());
+  stat.add("peak occupancy", buffer_pool_->peakOccupancy());
+  stat.add("average occupancy", buffer_pool_->averageOccupancy());
+  stat.add("peak region points", buffer_pool_->peakPoints());
+  stat.add("allocated bytes", buffer_pool_->allocatedBytes());
+  stat.add("grow count", buffer_pool_->growCount());
+  stat.add("frames", buffer_pool_->frames());
+}
+
+void Object3dDetector::pipelineDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  if(!pipelined_) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Clustering and classification run back to back");
+    return;
+  }
+  if(dropped_frames_ > 0) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "Classification is the bottleneck, frames dropped");
+  } else {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Clustering overlaps classification");
+  }
+  stat.add("queued frames", frame_queue_->size());
+  stat.add("pipeline depth", frame_queue_->capacity());
+  stat.add("pipelined frames", pipelined_frames_);
+  stat.add("dropped frames", dropped_frames_);
+}
+
+/* Rolling p50/p90/p99/max in milliseconds of every stage seen so far. */
+void Object3dDetector::latencyDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Per-stage wall time and per-region GPU time, in ms");
+  double p50, p90, p99, max;
+  char value[64];
+  for(int i = 0; i < STAGE_COUNT; i++) {
+    if(stage_stats_[i].percentiles(p50, p90, p99, max)) {
+      snprintf(value, sizeof(value), "p50 %.2f, p90 %.2f, p99 %.2f, max %.2f", p50, p90, p99, max);
+      stat.add(stage_names_[i], std::string(value));
+    }
+  }
+  for(int i = 0; i < nested_regions_; i++) {
+    if(region_stats_[i].percentiles(p50, p90, p99, max)) {
+      snprintf(value, sizeof(value), "p50 %.2f, p90 %.2f, p99 %.2f, max %.2f", p50, p90, p99, max);
+      stat.add("region " + std::to_string(i) + (cpu_clustering_ ? " clustering (cpu)" : " clustering (gpu)"), std::string(value));
+    }
+  }
+}
+
+void Object3dDetector::cascadeDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Clusters rejected before feature extraction");
+  stat.add("evaluated", cascade_.evaluated());
+  for(int i = 0; i < DetectionCascade::STAGE_COUNT; i++) {
+    stat.addf(std::string(DetectionCascade::name(i)) + " rejection rate", "%.3f (%lu)", cascade_.rejectionRate(i), cascade_.rejected(i));
+  }
+}
+
+void Object3dDetector::reuseDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  stat.summary(diagnostic_msgs::DiagnosticStatus::OK, classification_reuse_ ? "Clusters of confident tracks labelled without the SVM" : "Disabled");
+  stat.add("matched", classification_cache_.matched());
+  stat.addf("reuse rate", "%.3f (%lu)", classification_cache_.reuseRate(), classification_cache_.reused());
+  stat.add("verifications", classification_cache_.verifications());
+  stat.add("rejections", classification_cache_.rejections());
+}
+
+void Object3dDetector::gatingDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  stat.summary(diagnostic_msgs::DiagnosticStatus::OK, roi_gating_ ? "Gated by the tracker between full scans" : "Every frame is a full scan");
+  stat.add("full scans", full_scans_);
+  stat.add("gated scans", gated_scans_);
+  stat.add("gates", frame_gates_.size());
+}
+
+void Object3dDetector::backgroundDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  if(!background_removal_) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Disabled");
+  } else if(!cloud_ingest_->hasBackgroundMap()) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "No map received");
+  } else {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Map filtered on the GPU");
+  }
+  stat.add("map cells", map_grid_.size());
+  stat.add("filtered frames", background_frames_);
+  stat.add("frames without transform", background_skipped_);
+}
+
+/* The level of the controller, applied by the next frame. */
+void Object3dDetector::degradationCallback(const std_msgs::UInt8::ConstPtr& level) {
+  degradation_level_ = level->data;
+}
+
+/* Level 2 clusters the regions within the range of the inner degraded_nested_regions
+ * of the fixed layout only, level 3 also drops the clusters smaller than
+ * degraded_cluster_size_min; lower levels are those of the perception nodes
+ * before, c.f. degradation_controller.py. */
+void Object3dDetector::applyDegradation() {
+  int level = degradation_level_;
+  if(level == applied_degradation_) {
+    return;
+  }
+  applied_degradation_ = level;
+  active_regions_ = level >= 2 ? degraded_regions_ : nested_regions_;
+  cluster_size_min_ = level >= 3 ? std::max(degraded_cluster_size_min_, base_cluster_size_min_) : base_cluster_size_min_;
+  ROS_INFO("[object3d_detector_gpu] Degradation level %d: %d nested regions, clusters of %d points at least.", level, active_regions_, cluster_size_min_);
+}
+
+/* The bounds of the layout to the binning and the ingest, the tolerance of
+ * every region to its extractor; between frames, the streams idle. */
+void Object3dDetector::configureRegions() {
+  for(int i = 0; i < nested_regions_; i++) {
+    extractClusterParam_t ecp;
+    ecp.minClusterSize = base_cluster_size_min_;
+    ecp.maxClusterSize = cluster_size_max_;
+    ecp.voxelX = region_layout_.tolerance(i);
+    ecp.voxelY = region_layout_.tolerance(i);
+    ecp.voxelZ = region_layout_.tolerance(i);
+    ecp.countThreshold = 0;
+    if(cpu_extractors_[i]) {
+      cpu_extractors_[i]->set(ecp);
+    } else {
+      extractors_[i]->set(ecp);
+    }
+  }
+  region_binning_->setBounds(region_layout_.bounds());
+  if(cloud_ingest_) {
+    cloud_ingest_->setBounds(region_layout_.bounds());
+  }
+  degraded_regions_ = region_layout_.regionsWithin(degraded_range_);
+  applied_degradation_ = -1; // the degraded regions again with the next frame
+}
+
+/* The ranges of the points of the first region_layout_frames frames, then the
+ * balanced layout from the next frame on, once any point is in range. */
+void Object3dDetector::learnRegionLayout(const float *xyz, size_t stride, size_t n) {
+  if(layout_frames_ >= region_layout_frames_) {
+    return;
+  }
+  region_layout_.add(xyz, stride, n);
+  if(++layout_frames_ < region_layout_frames_) {
+    return;
+  }
+  if(!region_layout_.balance(region_min_width_)) {
+    layout_frames_--;
+    return;
+  }
+  configureRegions();
+  std::string bounds;
+  char value[16];
+  for(int j = 1; j <= nested_regions_; j++) {
+    snprintf(value, sizeof(value), j > 1 ? ", %.1f" : "%.1f", region_layout_.bounds()[j]);
+    bounds += value;
+  }
+  ROS_INFO("[object3d_detector_gpu] Nested regions balanced over %lu points, up to %s m.", (unsigned long)region_layout_.samples(), bounds.c_str());
+}
+
+void Object3dDetector::regionLayoutDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  if(region_layout_frames_ == 0) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Fixed nested regions");
+  } else if(layout_frames_ < region_layout_frames_) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Fixed nested regions until balanced");
+  } else {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Nested regions balanced by their points");
+  }
+  stat.add("frames", layout_frames_);
+  stat.add("points", region_layout_.samples());
+  stat.add("degraded regions", degraded_regions_);
+  for(int i = 0; i < nested_regions_; i++) {
+    stat.addf("region " + std::to_string(i), "%.1f - %.1f m, tolerance %.1f m", region_layout_.bounds()[i], region_layout_.bounds()[i+1], region_layout_.tolerance(i));
+  }
+}
+
+/* The worker threads, their CPUs and scheduling. */
+void Object3dDetector::threadDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  thread_config::diagnostics(stat, node_name_);
+}
+
+/* Queueing delay of the clustering behind the YOLO layers, since the last report. */
+void Object3dDetector::gpuDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  if(!gpu_client_) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Disabled");
+    return;
+  }
+  gpu_arbiter::Stats stats = gpu_arbiter::stats(gpu_client_);
+  stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "GPU ahead of the other clients of the process, in ms");
+  stat.add("slots", stats.window_grants);
+  stat.add("wait mean", stats.wait_mean);
+  stat.add("wait max", stats.wait_max);
+  stat.add("held mean", stats.hold_mean);
+  stat.add("held max", stats.hold_max);
+}
+
+/* The map and its updates come on the callback thread, between two frames,
+ * so the bitmap can be replaced in the managed memory of the ingest. */
+void Object3dDetector::mapCallback(const nav_msgs::OccupancyGrid::ConstPtr& map) {
+  map_info_ = map->info;
+  map_grid_ = map->data;
+  map_grid_.resize((size_t)map->info.width * map->info.height, -1);
+  inflated_map_.build(map_grid_.data(), map->info.width, map->info.height, (int)ceil(background_inflation_ - 1e-3));
+  cloud_ingest_->setBackgroundMap(inflated_map_.bits().data(), inflated_map_.width(), inflated_map_.height());
+  ROS_INFO("[object3d_detector_gpu] Background map of %ux%u cells.", map->info.width, map->info.height);
+}
+
+/* Only around the patch is the map inflated again, patches outside the map are clipped. */
+void Object3dDetector::mapUpdateCallback(const map_msgs::OccupancyGridUpdate::ConstPtr& update) {
+  int x0 = std::max(update->x, 0), y0 = std::max(update->y, 0);
+  int x1 = std::min(update->x + (int)update->width, inflated_map_.width());
+  int y1 = std::min(update->y + (int)update->height, inflated_map_.height());
+  if(x0 >= x1 || y0 >= y1 || update->data.size() < (size_t)update->width * update->height) {
+    return;
+  }
+  for(int y = y0; y < y1; y++) {
+    const int8_t *row = &update->data[(size_t)(y - update->y) * update->width + (x0 - update->x)];
+    std::copy(row, row + (x1 - x0), &map_grid_[(size_t)y * map_info_.width + x0]);
+  }
+  inflated_map_.update(map_grid_.data(), x0, y0, x1 - x0, y1 - y0);
+  cloud_ingest_->setBackgroundMap(inflated_map_.bits().data(), inflated_map_.width(), inflated_map_.height());
+}
+
+/* The frame's points to map cells, at the frame's stamp. Without that
+ * transform the frame is not filtered rather than filtered with a wrong pose. */
+void Object3dDetector::startBackgroundFrame(const std_msgs::Header &header) {
+  background_frame_ = false;
+  if(!background_removal_ || !cloud_ingest_->hasBackgroundMap()) {
+    return;
+  }
+  tf::StampedTransform st;
+  try {
+    if(!tf_listener_->canTransform(map_frame_, header.frame_id, header.stamp)) {
+      background_skipped_++;
+      return;
+    }
+    tf_listener_->lookupTransform(map_frame_, header.frame_id, header.stamp, st);
+  } catch(tf::TransformException &e) {
+    background_skipped_++;
+    return;
+  }
+  Eigen::Matrix4f m;
+  pcl_ros::transformAsMatrix(st, m);
+  double res = map_info_.resolution;
+  double origin[2] = {map_info_.origin.position.x, map_info_.origin.position.y};
+  for(int r = 0; r < 2; r++) {
+    for(int c = 0; c < 4; c++) {
+      background_transform_[r*4+c] = (m(r, c) - (c == 3 ? origin[r] : 0.0)) / res;
+    }
+  }
+  background_frame_ = true;
+  background_frames_++;
+}
+
+/* Gates come in the tracker's frame, they are kept in frame_id_ so the points
+ * can be tested as they are. */
+void Object3dDetector::gatesCallback(const people_msgs::PositionMeasurementArray::ConstPtr& gates) {
+  std::vector<Eigen::Vector3f> local;
+  for(size_t i = 0; i < gates->people.size(); i++) {
+    const people_msgs::PositionMeasurement &gate = gates->people[i];
+    geometry_msgs::PointStamped in, out;
+    in.header.frame_id = gates->header.frame_id;
+    in.header.stamp = ros::Time(0); // latest transform
+    in.point = gate.pos;
+    try {
+      tf_listener_->transformPoint(frame_id_, in, out);
+    } catch(tf::TransformException &e) {
+      ROS_WARN_THROTTLE(5.0, "[object3d_detector_gpu] Can not transform gates: %s", e.what());
+      return;
+    }
+    double radius = std::max(gate_radius_min_, std::sqrt(std::max(gate.covariance[0], gate.covariance[4])));
+    local.push_back(Eigen::Vector3f(out.point.x, out.point.y, radius * radius));
+  }
+  boost::lock_guard<boost::mutex> lock(gates_mutex_);
+  gates_.swap(local);
+  gates_stamp_ = ros::Time::now();
+}
+
+/* Tracks come in the tracker's frame, they are kept in frame_id_ as the
+ * gates, their velocities only rotated. */
+void Object3dDetector::trackStatesCallback(const bayes_people_tracker::TrackStates::ConstPtr& states) {
+  if(states->positions.size() != 2 * states->ids.size() || states->velocities.size() != 2 * states->ids.size() ||
+     states->probabilities.size() != states->ids.size()) {
+    ROS_WARN_THROTTLE(5.0, "[object3d_detector_gpu] Track states of %zu tracks with %zu positions, dropped.", states->ids.size(), states->positions.size() / 2);
+    return;
+  }
+  tf::StampedTransform st;
+  try {
+    tf_listener_->lookupTransform(frame_id_, states->header.frame_id, ros::Time(0), st); // latest transform
+  } catch(tf::TransformException &e) {
+    ROS_WARN_THROTTLE(5.0, "[object3d_detector_gpu] Can not transform track states: %s", e.what());
+    return;
+  }
+  std::vector<ClassificationCache::Track> tracks(states->ids.size());
+  for(size_t i = 0; i < tracks.size(); i++) {
+    tf::Vector3 position = st * tf::Vector3(states->positions[2*i], states->positions[2*i+1], 0.0);
+    tf::Vector3 velocity = st.getBasis() * tf::Vector3(states->velocities[2*i], states->velocities[2*i+1], 0.0);
+    ClassificationCache::Track &track = tracks[i];
+    track.id = states->ids[i];
+    track.x = position.x();
+    track.y = position.y();
+    track.vx = velocity.x();
+    track.vy = velocity.y();
+    track.probability = states->probabilities[i];
+  }
+  classification_cache_.setTracks(tracks, states->header.stamp.toSec());
+}
+
+/* Decides whether the coming frame is gated, and snapshots the gates if so. */
+bool Object3dDetector::startGatedFrame() {
+  if(!roi_gating_ || full_scan_interval_ <= 1 || gating_frames_++ % full_scan_interval_ == 0) {
+    full_scans_++;
+    return false;
+  }
+  {
+    boost::lock_guard<boost::mutex> lock(gates_mutex_);
+    if(gates_stamp_.isZero() || (ros::Time::now() - gates_stamp_).toSec() > gate_timeout_) {
+      full_scans_++;
+      return false;
+    }
+    frame_gates_ = gates_;
+  }
+  gated_scans_++;
+  return true;
+}
+
+bool Object3dDetector::inGates(const pcl::PointXYZ &p) const {
+  for(size_t i = 0; i < frame_gates_.size(); i++) {
+    float dx = p.x - frame_gates_[i][0], dy = p.y - frame_gates_[i][1];
+    if(dx * dx + dy * dy <= frame_gates_[i][2]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Stage 2 of the pipeline: the SVM, the markers and the publishers are only
+ * touched here, the callback thread never waits for them. */
+void Object3dDetector::classifyThread(const thread_config::Settings &settings) {
+  thread_config::apply(node_name_, "classify", settings);
+  while(true) {
+    DetectionFrame *frame = frame_queue_->readSlot();
+    if(frame == NULL) {
+      boost::unique_lock<boost::mutex> lock(wake_mutex_);
+      // check again under the lock, a frame committed since would miss its notify
+      while(running_ && (frame = frame_queue_->readSlot()) == NULL) {
+	wake_.wait(lock);
+      }
+      if(!running_) {
+	return;
+      }
+    }
+    classify(frame->header, frame->features);
+    frame_queue_->commitRead();
+  }
+}
+
+static time_t modificationTime(const std::string &file_name) {
+  struct stat st;
+  return stat(file_name.c_str(), &st) == 0 ? st.st_mtime : 0;
+}
+
+/* Polls the model and range files, and prepares a complete SvmModel whenever
+ * one of them changed, e.g. after a retraining on the tracker's samples. The
+ * files should be replaced by a rename, a half-written model fails to load and
+ * is retried with the next change. Freeing a swapped out model happens here too,
+ * so the detection thread never waits for the loader nor for the allocator. */
+void Object3dDetector::modelThread(const thread_config::Settings &settings) {
+  thread_config::apply(node_name_, "model", settings);
+  time_t model_time = modificationTime(model_file_name_), range_time = modificationTime(range_file_name_);
+  try {
+    while(true) {
+      boost::this_thread::sleep(boost::posix_time::milliseconds((long)(model_reload_interval_ * 1000.0)));
+      boost::shared_ptr<SvmModel> retired;
+      {
+	boost::lock_guard<boost::mutex> lock(svm_mutex_);
+	retired.swap(retired_svm_);
+      }
+      retired.reset();
+      
+      time_t mt = modificationTime(model_file_name_), rt = modificationTime(range_file_name_);
+      if(mt == model_time && rt == range_time) {
+	continue;
+      }
+      model_time = mt;
+      range_time = rt;
+      boost::shared_ptr<SvmModel> svm(new SvmModel);
+      if(svm->load(model_file_name_, range_file_name_) != SvmModel::LOADED) {
+	ROS_WARN("[object3d_detector_gpu] Can not reload SVM model from '%s', keep the current one.", model_file_name_.c_str());
+	continue;
+      }
+      ROS_INFO("[object3d_detector_gpu] Reload SVM model from '%s' (%d support vectors), swapped in with the next frame.", model_file_name_.c_str(), svm->engine().supportVectors());
+      boost::lock_guard<boost::mutex> lock(svm_mutex_);
+      pending_svm_ = svm;
+    }
+  } catch(boost::thread_interrupted &) {
+  }
+}
+
+/* The GPU ingest reads x/y/z straight from the message bytes, so it needs them as
+ * little-endian FLOAT32 fields; anything else goes through pcl::fromROSMsg. */
+static bool cloudLayout(const sensor_msgs::PointCloud2 &msg, CloudIngestLayout &layout) {
+  if(msg.is_bigendian || msg.data.size() < (size_t)msg.row_step * msg.height) {
+    return false;
+  }
+  int found = 0;
+  for(size_t i = 0; i < msg.fields.size(); i++) {
+    const sensor_msgs::PointField &f = msg.fields[i];
+    if(f.datatype != sensor_msgs::PointField::FLOAT32 || f.offset % 4 != 0) {
+      continue;
+    }
+    if(f.name == "x") { layout.offset_x = f.offset; found |= 1; }
+    else if(f.name == "y") { layout.offset_y = f.offset; found |= 2; }
+    else if(f.name == "z") { layout.offset_z = f.offset; found |= 4; }
   }
+  layout.width = msg.width;
+  layout.height = msg.height;
+  layout.point_step = msg.point_step;
+  layout.row_step = msg.row_step;
+  return found == 7 && msg.point_step % 4 == 0 && msg.row_step % 4 == 0;
 }
 
-int frames; clock_t start_time; bool reset = true;//fps
 void Object3dDetector::pointCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& ros_pc2) {
-  if(print_fps_){if(reset){frames=0;start_time=clock();reset=false;}}//fps
+  perception_trace::ScopedHop hop("object3d_detector_gpu clusters", perception_trace::origin(ros_pc2->header.stamp));
+  applyDegradation();
+  classification_cache_.beginFrame(ros_pc2->header.stamp.toSec());
+  CloudIngestLayout layout;
+  if(range_clustering_ && ros_pc2->height > 1) {
+    WallTimer timer;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr pcl_pc(new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::fromROSMsg(*ros_pc2, *pcl_pc);
+    stage_stats_[STAGE_FROM_ROS_MSG].add(timer.lap());
+    extractClusterRangeImage(pcl_pc);
+  } else if(gpu_ingest_ && cloudLayout(*ros_pc2, layout)) {
+    startBackgroundFrame(ros_pc2->header);
+    extractCluster(*ros_pc2, layout);
+  } else {
+    WallTimer timer;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr pcl_pc(new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::fromROSMsg(*ros_pc2, *pcl_pc);
+    stage_stats_[STAGE_FROM_ROS_MSG].add(timer.lap());
+    extractCluster(pcl_pc);
+  }
+  finishFrame(ros_pc2->header);
+}
+
+/* The transform from the header's frame into frame_id_, at the header's stamp
+ * if tf has it, else the latest one. */
+bool Object3dDetector::lookupTransform(const std_msgs::Header &header, Eigen::Matrix4f &transform) {
+  if(header.frame_id == frame_id_) {
+    transform.setIdentity();
+    return true;
+  }
+  tf::StampedTransform st;
+  try {
+    if(tf_listener_->canTransform(frame_id_, header.frame_id, header.stamp)) {
+      tf_listener_->lookupTransform(frame_id_, header.frame_id, header.stamp, st);
+    } else {
+      tf_listener_->lookupTransform(frame_id_, header.frame_id, ros::Time(0), st);
+    }
+  } catch(tf::TransformException &e) {
+    ROS_WARN_THROTTLE(5.0, "[object3d_detector_gpu] Can not transform '%s': %s", header.frame_id.c_str(), e.what());
+    return false;
+  }
+  pcl_ros::transformAsMatrix(st, transform);
+  return true;
+}
+
+/* Every input only refreshes its latest cloud, the first one then triggers a
+ * frame that fuses all inputs recent enough, in frame_id_. */
+void Object3dDetector::sensorCallback(const sensor_msgs::PointCloud2::ConstPtr& ros_pc2, int sensor) {
+  perception_trace::ScopedHop hop("object3d_detector_gpu clusters", perception_trace::origin(ros_pc2->header.stamp));
+  latest_clouds_[sensor] = ros_pc2;
+  if(sensor != 0) {
+    return;
+  }
+  applyDegradation();
+  classification_cache_.beginFrame(ros_pc2->header.stamp.toSec());
   
-  pcl::PointCloud<pcl::PointXYZ>::Ptr pcl_pc(new pcl::PointCloud<pcl::PointXYZ>);
-  pcl::fromROSMsg(*ros_pc2, *pcl_pc);
+  std::vector<sensor_msgs::PointCloud2::ConstPtr> clouds;
+  std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > transforms;
+  for(size_t i = 0; i < latest_clouds_.size(); i++) {
+    const sensor_msgs::PointCloud2::ConstPtr &cloud = latest_clouds_[i];
+    Eigen::Matrix4f transform;
+    if(!cloud || fabs((cloud->header.stamp - ros_pc2->header.stamp).toSec()) > fusion_max_age_ || !lookupTransform(cloud->header, transform)) {
+      continue;
+    }
+    clouds.push_back(cloud);
+    transforms.push_back(transform);
+  }
+  
+  bool gpu = gpu_ingest_;
+  CloudIngestInput inputs[CloudIngest::MAX_INPUTS];
+  for(size_t i = 0; gpu && i < clouds.size(); i++) {
+    gpu = cloudLayout(*clouds[i], inputs[i].layout);
+    inputs[i].data = &clouds[i]->data[0];
+    inputs[i].bytes = clouds[i]->data.size();
+    inputs[i].device_data = static_cast<const uint8_t *>(point_cloud_pool::devicePointer(inputs[i].data, inputs[i].bytes));
+    for(int r = 0; r < 3; r++) {
+      for(int c = 0; c < 4; c++) {
+	inputs[i].transform[r*4+c] = transforms[i](r, c);
+      }
+    }
+  }
+  if(gpu) {
+    // transforms are applied by the ingest kernels, one stream per lidar
+    std_msgs::Header header = ros_pc2->header;
+    header.frame_id = frame_id_;
+    startBackgroundFrame(header);
+    extractCluster(inputs, clouds.size());
+  } else {
+    WallTimer timer;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr pcl_pc(new pcl::PointCloud<pcl::PointXYZ>), sensor_pc(new pcl::PointCloud<pcl::PointXYZ>);
+    for(size_t i = 0; i < clouds.size(); i++) {
+      pcl::fromROSMsg(*clouds[i], *sensor_pc);
+      pcl::transformPointCloud(*sensor_pc, *sensor_pc, transforms[i]);
+      *pcl_pc += *sensor_pc;
+    }
+    stage_stats_[STAGE_FROM_ROS_MSG].add(timer.lap());
+    extractCluster(pcl_pc);
+  }
   
-  extractCluster(pcl_pc);
-  classify();
+  std_msgs::Header header = ros_pc2->header;
+  header.frame_id = frame_id_;
+  finishFrame(header);
+}
+
+/* Classifies the features of the frame, or hands them to the classification stage. */
+void Object3dDetector::finishFrame(const std_msgs::Header &header) {
+  last_clusters_ = features_.size();
+  if(pipelined_) {
+    // hand the features over by swapping vectors, both keep their capacity
+    DetectionFrame *frame = frame_queue_->writeSlot();
+    if(frame != NULL) {
+      frame->header = header;
+      frame->features.swap(features_);
+      frame_queue_->commitWrite();
+      {
+	boost::lock_guard<boost::mutex> lock(wake_mutex_);
+      }
+      wake_.notify_one();
+      pipelined_frames_++;
+    } else {
+      dropped_frames_++;
+    }
+  } else {
+    classify(header, features_);
+  }
+  diagnostics_.update();
   
-  if(print_fps_){if(++frames>10){std::cerr<<"[object3d_detector_gpu]: fps = "<<double(frames)/(double(clock()-start_time)/CLOCKS_PER_SEC)<<", timestamp = "<<clock()/CLOCKS_PER_SEC<<std::endl;reset=true;}}//fps
+  if(print_fps_ && ++fps_frames_ > 10) {
+    std::cerr << "[object3d_detector_gpu]: fps = " << fps_frames_ / (fps_timer_.lap() / 1000.0) << ", timestamp = " << ros::WallTime::now().toSec() << std::endl;
+    fps_frames_ = 0;
+  }
+}
+
+/* The clustering of a region, launched on its stream, or on the CPU once the
+ * stream is done with the input. */
+void Object3dDetector::extractRegion(int region, float *input, ClusterRegionBuffers &buffers) {
+  if(cpu_extractors_[region]) {
+    if(buffers.stream) {
+      cudaStreamSynchronize(buffers.stream);
+    }
+    WallTimer timer;
+    cpu_extractors_[region]->extract(input, buffers.used, buffers.output, buffers.index);
+    region_stats_[region].add(timer.lap());
+    return;
+  }
+  cudaEventRecord(buffers.start, buffers.stream);
+  extractors_[region]->extract(input, buffers.used, buffers.output, buffers.index);
+  cudaEventRecord(buffers.stop, buffers.stream);
+}
+
+/* GPU time of the region's last clustering, its stream must be synchronized;
+ * the CPU clustering is timed as it runs. */
+void Object3dDetector::recordRegionTime(int region) {
+  if(cpu_clustering_) {
+    return;
+  }
+  float ms = 0.0f;
+  ClusterRegionBuffers &buffers = buffer_pool_->region(region);
+  if(cudaEventElapsedTime(&ms, buffers.start, buffers.stop) == cudaSuccess) {
+    region_stats_[region].add(ms);
+  }
 }
 
-const int nested_regions_ = 14;
-int zone_[nested_regions_] = {2,3,3,3,3,3,3,2,3,3,3,3,3,3}; // for more details, see our IROS'17 paper.
 void Object3dDetector::extractCluster(pcl::PointCloud<pcl::PointXYZ>::Ptr pc) {
   features_.clear();
+  clusters_.clear();
   
-  // Remove ground and ceiling
+  WallTimer timer;
+  // Remove ground and ceiling, and between full scans everything out of the track gates
+  bool gated = startGatedFrame();
   std::vector<int> indices;
   for(int i = 0; i < pc->size(); ++i) {
-    if(pc->points[i].z >= z_limit_min_ && pc->points[i].z <= z_limit_max_) {
+    if(pc->points[i].z >= z_limit_min_ && pc->points[i].z <= z_limit_max_ && (!gated || inGates(pc->points[i]))) {
       indices.push_back(i);
     }
   }
   pcl::copyPointCloud(*pc, indices, *pc);
+  stage_stats_[STAGE_Z_FILTER].add(timer.lap());
 
   // Divide the point cloud into nested circular regions
-  boost::array<std::vector<int>, nested_regions_> indices_array;
-  for(int i = 0; i < pc->size(); i++) {
-    double range = 0.0;
-    for(int j = 0; j < nested_regions_; j++) {
-      double d2 = pc->points[i].x * pc->points[i].x + pc->points[i].y * pc->points[i].y + pc->points[i].z * pc->points[i].z;
-      if(d2 > range * range && d2 <= (range + zone_[j]) * (range + zone_[j])) {
-      	indices_array[j].push_back(i);
-      	break;
+  // (pcl::PointXYZ is 4 floats wide, x/y/z first)
+  region_binning_->process(reinterpret_cast<const float *>(pc->points.data()), 4, pc->size());
+  stage_stats_[STAGE_REGION_SPLIT].add(timer.lap());
+
+  // Clustering, the GPU taken from the other clients of the process
+  gpu_arbiter::Slot slot(gpu_client_);
+  if(batched_clustering_) {
+    // fill every region first, then launch all of them back to back on their
+    // own streams, so the regions run concurrently and we only wait once
+    bool active[nested_regions_];
+    for(int i = 0; i < nested_regions_; i++) {
+      unsigned int size = region_binning_->count(i);
+      active[i] = i < active_regions_ && size > cluster_size_min_;
+      if(active[i]) {
+	ClusterRegionBuffers &buffers = buffer_pool_->acquire(i, size);
+	uploadRegion(pc, region_binning_->indices(i), size, buffers);
+	launchDecimation(i, buffers.input, size);
+      }
+    }
+    for(int i = 0; i < nested_regions_; i++) {
+      if(active[i]) {
+	ClusterRegionBuffers &buffers = buffer_pool_->region(i);
+	const float *input = decimatedRegion(i, buffers.input, buffers);
+	extractRegion(i, const_cast<float *>(input), buffers);
+      }
+    }
+    for(int i = 0; i < nested_regions_; i++) {
+      if(active[i]) {
+	cudaStreamSynchronize(buffer_pool_->region(i).stream);
+      }
+    }
+    for(int i = 0; i < nested_regions_; i++) {
+      if(active[i]) {
+	recordRegionTime(i);
+	unpackRegion(buffer_pool_->region(i), region_weights_[i]);
+      }
+    }
+  } else {
+    for(int i = 0; i < active_regions_; i++) {
+      unsigned int size = region_binning_->count(i);
+      if(size > cluster_size_min_) {
+	ClusterRegionBuffers &buffers = buffer_pool_->acquire(i, size);
+	uploadRegion(pc, region_binning_->indices(i), size, buffers);
+	launchDecimation(i, buffers.input, size);
+	const float *input = decimatedRegion(i, buffers.input, buffers);
+	extractRegion(i, const_cast<float *>(input), buffers);
+	cudaStreamSynchronize(buffers.stream);
+	recordRegionTime(i);
+	unpackRegion(buffers, region_weights_[i]);
       }
-      range += zone_[j];
     }
   }
+  stage_stats_[STAGE_CLUSTERING].add(timer.lap());
+  extractFeatures(feature_extractor_ != NULL);
+  stage_stats_[STAGE_FEATURES].add(timer.lap());
+  buffer_pool_->endFrame();
+  if(!gated) {
+    learnRegionLayout(reinterpret_cast<const float *>(pc->points.data()), 4, pc->size());
+  }
+}
 
-  // Clustering
-  double tolerance = 0.0;
+void Object3dDetector::extractCluster(const sensor_msgs::PointCloud2 &ros_pc2, const CloudIngestLayout &layout) {
+  CloudIngestInput input = {&ros_pc2.data[0], ros_pc2.data.size(), layout, {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0},
+                            static_cast<const uint8_t *>(point_cloud_pool::devicePointer(&ros_pc2.data[0], ros_pc2.data.size()))};
+  extractCluster(&input, 1);
+}
+
+void Object3dDetector::extractCluster(const CloudIngestInput *inputs, int count) {
+  features_.clear();
+  clusters_.clear();
+  
+  // z-limit filtering and region binning happen on the GPU, the result is
+  // one region-sorted buffer the extractors read in place
+  gpu_arbiter::Slot slot(gpu_client_);
+  WallTimer timer;
+  cloud_ingest_->process(inputs, count, background_frame_ ? background_transform_ : NULL);
+  stage_stats_[STAGE_GPU_INGEST].add(timer.lap());
+  
+  bool active[nested_regions_];
   for(int i = 0; i < nested_regions_; i++) {
-    tolerance += 0.1;
-    if(indices_array[i].size() > cluster_size_min_) {
-      pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_regionalized(new pcl::PointCloud<pcl::PointXYZ>);
-      pcl::copyPointCloud(*pc, indices_array[i], *cloud_regionalized);
-      
-      cudaStream_t stream = NULL;
-      cudaStreamCreate(&stream);
-      
-      float *inputEC = NULL;
-      unsigned int sizeEC = cloud_regionalized->size();
-      cudaMallocManaged(&inputEC, sizeof(float) * 4 * sizeEC, cudaMemAttachHost);
-      cudaStreamAttachMemAsync(stream, inputEC);
-      cudaMemcpyAsync(inputEC, cloud_regionalized->points.data(), sizeof(float) * 4 * sizeEC, cudaMemcpyHostToDevice, stream);
-      cudaStreamSynchronize(stream);
-      
-      float *outputEC = NULL;
-      cudaMallocManaged(&outputEC, sizeof(float) * 4 * sizeEC, cudaMemAttachHost);
-      cudaStreamAttachMemAsync(stream, outputEC);
-      cudaMemcpyAsync(outputEC, cloud_regionalized->points.data(), sizeof(float) * 4 * sizeEC, cudaMemcpyHostToDevice, stream);
-      cudaStreamSynchronize(stream);
-      
-      unsigned int *indexEC = NULL;
-      cudaMallocManaged(&indexEC, sizeof(float) * 4 * sizeEC, cudaMemAttachHost);
-      cudaStreamAttachMemAsync(stream, indexEC);
-      cudaMemsetAsync(indexEC, 0, sizeof(float) * 4 * sizeEC, stream);
-      cudaStreamSynchronize(stream);
-      
-      extractClusterParam_t ecp;
-      ecp.minClusterSize = cluster_size_min_;
-      ecp.maxClusterSize = cluster_size_max_;
-      ecp.voxelX = tolerance;
-      ecp.voxelY = tolerance;
-      ecp.voxelZ = tolerance;
-      ecp.countThreshold = 0;
-      cudaExtractCluster cudaec(stream);
-      cudaec.set(ecp);
-      
-      cudaec.extract(inputEC, sizeEC, outputEC, indexEC);
-      cudaStreamSynchronize(stream);
-      
-      for(int i = 1; i <= indexEC[0]; i++) {
-	pcl::PointCloud<pcl::PointXYZ>::Ptr cluster(new pcl::PointCloud<pcl::PointXYZ>);
-	cluster->width = indexEC[i];
-	cluster->height = 1;
-	cluster->points.resize(cluster->width * cluster->height);
-	cluster->is_dense = true;
-	
-	unsigned int outoff = 0;
-	for(int w = 1; w < i; w++) {
-	  if(i > 1) {
-	    outoff += indexEC[w];
-	  }
-	}
-	
-	for(std::size_t k = 0; k < indexEC[i]; ++k) {
-	  cluster->points[k].x = outputEC[(outoff+k)*4+0];
-	  cluster->points[k].y = outputEC[(outoff+k)*4+1];
-	  cluster->points[k].z = outputEC[(outoff+k)*4+2];
-	}
-	
-	Eigen::Vector4f min, max, centroid;
-	pcl::getMinMax3D(*cluster, min, max);
-      	pcl::compute3DCentroid(*cluster, centroid);
-	
-      	// Size limitation is not cool, but can increase fps
-	if(human_size_limit_ &&
-	   (max[0]-min[0] < 0.2 || max[0]-min[0] > 1.0 ||
-	    max[1]-min[1] < 0.2 || max[1]-min[1] > 1.0 ||
-	    max[2]-min[2] < 0.5 || max[2]-min[2] > 2.0)) {
-	  continue;
-	}
-	
-	Feature f;
-	extractFeature(cluster, f, min, max, centroid);
-	features_.push_back(f);
+    unsigned int sizeEC = cloud_ingest_->count(i);
+    active[i] = i < active_regions_ && sizeEC > cluster_size_min_;
+    if(active[i]) {
+      buffer_pool_->acquire(i, sizeEC);
+      launchDecimation(i, cloud_ingest_->points() + cloud_ingest_->offset(i) * 4, sizeEC);
+    }
+  }
+  for(int i = 0; i < nested_regions_; i++) {
+    if(active[i]) {
+      ClusterRegionBuffers &buffers = buffer_pool_->region(i);
+      const float *region = cloud_ingest_->points() + cloud_ingest_->offset(i) * 4;
+      float *inputEC = const_cast<float *>(decimatedRegion(i, region, buffers));
+      unsigned int sizeEC = buffers.used;
+      if(inputEC == region) {
+	cudaMemcpyAsync(buffers.output, inputEC, sizeof(float) * 4 * sizeEC, cudaMemcpyDeviceToDevice, buffers.stream);
+      }
+      cudaMemsetAsync(buffers.index, 0, sizeof(unsigned int) * 4 * sizeEC, buffers.stream);
+      extractRegion(i, inputEC, buffers);
+      if(!batched_clustering_) {
+	cudaStreamSynchronize(buffers.stream);
       }
-      
-      cudaFree(inputEC);
-      cudaFree(outputEC);
-      cudaFree(indexEC);
-    }
-  }
-}
-
-/* *** Feature Extraction ***
- * f1 (1d): the number of points included in a cluster.
- * f2 (1d): the minimum distance of the cluster to the sensor.
- * => f1 and f2 should be used in pairs, since f1 varies with f2 changes.
- * f3 (6d): 3D covariance matrix of the cluster.
- * f4 (6d): the normalized moment of inertia tensor.
- * => Since both f3 and f4 are symmetric, we only use 6 elements from each as features.
- * f5 (9d): 2D covariance matrix in 3 zones, which are the upper half, and the left and right lower halves.
- * f6 (98d): The normalized 2D histogram for the main plane, 14 × 7 bins.
- * f7 (45d): The normalized 2D histogram for the secondary plane, 9 × 5 bins.
- * f8 (20d): Slice feature for the cluster.
- */
-
-void computeMomentOfInertiaTensorNormalized(pcl::PointCloud<pcl::PointXYZ> &pc, Eigen::Matrix3f &moment_3d) {
-  moment_3d.setZero();
-  for(size_t i = 0; i < pc.size(); i++) {
-    moment_3d(0,0) += pc[i].y*pc[i].y+pc[i].z*pc[i].z;
-    moment_3d(0,1) -= pc[i].x*pc[i].y;
-    moment_3d(0,2) -= pc[i].x*pc[i].z;
-    moment_3d(1,1) += pc[i].x*pc[i].x+pc[i].z*pc[i].z;
-    moment_3d(1,2) -= pc[i].y*pc[i].z;
-    moment_3d(2,2) += pc[i].x*pc[i].x+pc[i].y*pc[i].y;
-  }
-  moment_3d(1, 0) = moment_3d(0, 1);
-  moment_3d(2, 0) = moment_3d(0, 2);
-  moment_3d(2, 1) = moment_3d(1, 2);
-}
-
-/* Main plane is formed from the maximum and middle eigenvectors.
- * Secondary plane is formed from the middle and minimum eigenvectors.
- */
-void computeProjectedPlane(pcl::PointCloud<pcl::PointXYZ>::Ptr pc, Eigen::Matrix3f &eigenvectors, int axe, Eigen::Vector4f &centroid, pcl::PointCloud<pcl::PointXYZ>::Ptr plane) {
-  Eigen::Vector4f coefficients;
-  coefficients[0] = eigenvectors(0,axe);
-  coefficients[1] = eigenvectors(1,axe);
-  coefficients[2] = eigenvectors(2,axe);
-  coefficients[3] = 0;
-  coefficients[3] = -1 * coefficients.dot(centroid);
-  for(size_t i = 0; i < pc->size(); i++) {
-    double distance_to_plane =
-      coefficients[0] * pc->points[i].x +
-      coefficients[1] * pc->points[i].y +
-      coefficients[2] * pc->points[i].z +
-      coefficients[3];
-    pcl::PointXYZ p;
-    p.x = pc->points[i].x - distance_to_plane * coefficients[0];
-    p.y = pc->points[i].y - distance_to_plane * coefficients[1];
-    p.z = pc->points[i].z - distance_to_plane * coefficients[2];
-    plane->points.push_back(p);
-  }
-}
-
-/* Upper half, and the left and right lower halves of a pedestrian. */
-void compute3ZoneCovarianceMatrix(pcl::PointCloud<pcl::PointXYZ>::Ptr plane, Eigen::Vector4f &mean, double *partial_covariance_2d) {
-  pcl::PointCloud<pcl::PointXYZ>::Ptr zone_decomposed[3];
-  for(int i = 0; i < 3; i++)
-    zone_decomposed[i].reset(new pcl::PointCloud<pcl::PointXYZ>);
-  for(size_t i = 0; i < plane->size(); i++) {
-    if(plane->points[i].z >= mean(2)) { // upper half
-      zone_decomposed[0]->points.push_back(plane->points[i]);
-    } else {
-      if(plane->points[i].y >= mean(1)) // left lower half
-	zone_decomposed[1]->points.push_back(plane->points[i]);
-      else // right lower half
-	zone_decomposed[2]->points.push_back(plane->points[i]);
     }
   }
+  for(int i = 0; i < nested_regions_; i++) {
+    if(active[i]) {
+      cudaStreamSynchronize(buffer_pool_->region(i).stream);
+      recordRegionTime(i);
+      unpackRegion(buffer_pool_->region(i), region_weights_[i]);
+    }
+  }
+  stage_stats_[STAGE_CLUSTERING].add(timer.lap());
+  extractFeatures(feature_extractor_ != NULL);
+  stage_stats_[STAGE_FEATURES].add(timer.lap());
+  buffer_pool_->endFrame();
+  // the points binned, after the filters of the ingest
+  learnRegionLayout(cloud_ingest_->points(), 4, cloud_ingest_->offset(nested_regions_-1) + cloud_ingest_->count(nested_regions_-1));
+}
+
+void Object3dDetector::uploadRegion(pcl::PointCloud<pcl::PointXYZ>::Ptr pc, const int *indices, unsigned int size, ClusterRegionBuffers &buffers) {
+  unsigned int sizeEC = size;
   
-  Eigen::Matrix3f covariance;
-  Eigen::Vector4f centroid;
-  for(int i = 0; i < 3; i++) {
-    pcl::compute3DCentroid(*zone_decomposed[i], centroid);
-    pcl::computeCovarianceMatrix(*zone_decomposed[i], centroid, covariance);
-    partial_covariance_2d[i*3+0] = covariance(0,0);
-    partial_covariance_2d[i*3+1] = covariance(0,1);
-    partial_covariance_2d[i*3+2] = covariance(1,1);
-  }
-}
-
-void computeHistogramNormalized(pcl::PointCloud<pcl::PointXYZ>::Ptr pc, int horiz_bins, int verti_bins, double *histogram) {
-  Eigen::Vector4f min, max, min_box, max_box;
-  pcl::getMinMax3D(*pc, min, max);
-  double horiz_itv, verti_itv;
-  horiz_itv = (max[0]-min[0]>max[1]-min[1]) ? (max[0]-min[0])/horiz_bins : (max[1]-min[1])/horiz_bins;
-  verti_itv = (max[2] - min[2])/verti_bins;
+  // the GPU is idle here, so the managed buffers can be filled in place
+  float *inputEC = buffers.input;
+  for(unsigned int k = 0; k < sizeEC; k++) {
+    const pcl::PointXYZ &p = pc->points[indices[k]];
+    inputEC[k*4+0] = p.x;
+    inputEC[k*4+1] = p.y;
+    inputEC[k*4+2] = p.z;
+    inputEC[k*4+3] = 1.0f;
+  }
+  memcpy(buffers.output, inputEC, sizeof(float) * 4 * sizeEC);
+  memset(buffers.index, 0, sizeof(unsigned int) * 4 * sizeEC);
+}
+
+/* The decimation of a region is launched on its stream behind the points,
+ * all regions before any of them is clustered. */
+void Object3dDetector::launchDecimation(int region, const float *points, unsigned int size) {
+  if(decimators_[region]) {
+    decimators_[region]->launch(points, size, decimation_leaf_sizes_[region]);
+  }
+}
+
+/* The points the region clusters: its own, or its voxel centroids, then
+ * already in the output of the extractor and counted by buffers.used. */
+const float *Object3dDetector::decimatedRegion(int region, const float *points, ClusterRegionBuffers &buffers) {
+  region_weights_[region] = 1.0f;
+  VoxelDecimation *decimator = decimators_[region];
+  if(!decimator) {
+    return points;
+  }
+  cudaStreamSynchronize(buffers.stream);
+  unsigned int size = decimator->size();
+  if(size == 0) {
+    return points;
+  }
+  region_weights_[region] = (float)buffers.used / size;
+  buffers.used = size;
+  cudaMemcpyAsync(buffers.output, decimator->points(), sizeof(float) * 4 * size, cudaMemcpyDeviceToDevice, buffers.stream);
+  return decimator->points();
+}
+
+void Object3dDetector::unpackRegion(ClusterRegionBuffers &buffers, float point_weight) {
+  const float *outputEC = buffers.output;
+  const unsigned int *indexEC = buffers.index;
   
-  for(int i = 0; i < horiz_bins; i++) {
-    for(int j = 0; j < verti_bins; j++) {
-      if(max[0]-min[0] > max[1]-min[1]) {
-	min_box << min[0]+horiz_itv*i, min[1], min[2]+verti_itv*j, 0;
-	max_box << min[0]+horiz_itv*(i+1), max[1], min[2]+verti_itv*(j+1), 0;
-      } else {
-	min_box << min[0], min[1]+horiz_itv*i, min[2]+verti_itv*j, 0;
-	max_box << max[0], min[1]+horiz_itv*(i+1), min[2]+verti_itv*(j+1), 0;
-      }
-      std::vector<int> indices;
-      pcl::getPointsInBox(*pc, min_box, max_box, indices);
-      histogram[i*verti_bins+j] = (double)indices.size() / (double)pc->size();
-    }
+  // exclusive scan over the cluster sizes gives every cluster its offset in outputEC
+  unsigned int clusters = indexEC[0];
+  cluster_offsets_.resize(clusters + 1);
+  cluster_offsets_[0] = 0;
+  for(unsigned int i = 0; i < clusters; i++) {
+    cluster_offsets_[i+1] = cluster_offsets_[i] + indexEC[i+1];
+  }
+  
+  for(unsigned int i = 0; i < clusters; i++) {
+    ClusterView cluster = {outputEC + cluster_offsets_[i] * 4, indexEC[i+1]};
+    addCluster(cluster, point_weight);
   }
 }
 
-void computeSlice(pcl::PointCloud<pcl::PointXYZ>::Ptr pc, int n, double *slice) {
-  for(int i = 0; i < 20; i++) {
-    slice[i] = 0;
+/* Organized clouds only, the whole frame is clustered on the CPU, which
+ * leaves the GPU to the image detector. */
+void Object3dDetector::extractClusterRangeImage(pcl::PointCloud<pcl::PointXYZ>::Ptr pc) {
+  features_.clear();
+  clusters_.clear();
+  
+  WallTimer timer;
+  // pcl::PointXYZ is 4 floats wide, x/y/z first
+  range_clustering_->process(reinterpret_cast<const float *>(pc->points.data()), 4, pc->width, pc->height);
+  const std::vector<ClusterView> &clusters = range_clustering_->clusters();
+  for(size_t i = 0; i < clusters.size(); i++) {
+    addCluster(clusters[i]);
   }
+  stage_stats_[STAGE_CLUSTERING].add(timer.lap());
+  // the clusters live in host memory, so the features are computed on the CPU
+  extractFeatures(false);
+  stage_stats_[STAGE_FEATURES].add(timer.lap());
+}
 
-  Eigen::Vector4f pc_min, pc_max;
-  pcl::getMinMax3D(*pc, pc_min, pc_max);
+void Object3dDetector::addCluster(const ClusterView &cluster, float point_weight) {
+  // the extractors keep the minimum size they were set up with, the points of a decimated region count as the raw ones
+  unsigned int points = (unsigned int)(cluster.size * point_weight + 0.5f);
+  if((int)points < cluster_size_min_) {
+    return;
+  }
+  Eigen::Vector4f min, max, centroid;
+  computeMinMax3D(cluster, min, max);
+  computeCentroid(cluster, centroid);
   
-  pcl::PointCloud<pcl::PointXYZ>::Ptr blocks[n];
-  double itv = (pc_max[2] - pc_min[2]) / n;
+  // Cheap tests first, only the survivors get the full features and the SVM
+  if(cascade_.evaluate(points, min, max, centroid) != DetectionCascade::STAGE_COUNT) {
+    return;
+  }
   
-  if(itv > 0) {
-    for(int i = 0; i < n; i++) {
-      blocks[i].reset(new pcl::PointCloud<pcl::PointXYZ>);
+  Feature f;
+  f.centroid = centroid;
+  f.min = min;
+  f.max = max;
+  f.point_weight = point_weight;
+  f.track_id = classification_cache_.match(centroid, &f.reused);
+  features_.push_back(f);
+  clusters_.push_back(cluster);
+}
+
+/* All region buffers stay untouched until the next frame, so the views
+ * collected by unpackRegion are still valid here. */
+void Object3dDetector::extractFeatures(bool gpu) {
+  if(!use_svm_model_) {
+    return;
+  }
+  if(gpu && feature_extractor_) {
+    static_assert(GpuFeatureExtractor::GPU_FEATURE_SIZE == feature_layout::baseline_size(), "GPU features out of sync with feature_layout.h");
+    // one launch for the clusters not reused only
+    const std::vector<ClusterView> *clusters = &clusters_;
+    if(classification_reuse_) {
+      classified_clusters_.clear();
+      for(size_t i = 0; i < features_.size(); i++) {
+	if(!features_[i].reused) {
+	  classified_clusters_.push_back(clusters_[i]);
+	}
+      }
+      clusters = &classified_clusters_;
     }
-    for(unsigned int i = 0, j; i < pc->size(); i++) {
-      j = std::min((n-1), (int)((pc->points[i].z - pc_min[2]) / itv));
-      blocks[j]->points.push_back(pc->points[i]);
+    const float *matrix = feature_extractor_->compute(*clusters);
+    size_t r = 0;
+    for(size_t i = 0; i < features_.size(); i++) {
+      Feature &f = features_[i];
+      if(f.reused) {
+	continue;
+      }
+      const float *row = matrix + r++ * GpuFeatureExtractor::GPU_FEATURE_SIZE;
+      f.number_points = (int)(row[0] * f.point_weight + 0.5f);
+      f.min_distance = row[1];
+      f.covariance_3d << row[2], row[3], row[4],
+			 row[3], row[5], row[6],
+			 row[4], row[6], row[7];
+      f.moment_3d << row[8], row[9], row[10],
+		     row[9], row[11], row[12],
+		     row[10], row[12], row[13];
+      for(int k = 0; k < 20; k++) {
+	f.slice[k] = row[14+k];
+      }
     }
-    
-    Eigen::Vector4f block_min, block_max;
-    for(int i = 0; i < n; i++) {
-      if(blocks[i]->size() > 2) { // At least 3 points to perform pca.
-	pcl::PCA<pcl::PointXYZ> pca;
-	pcl::PointCloud<pcl::PointXYZ>::Ptr block_projected(new pcl::PointCloud<pcl::PointXYZ>);
-	pca.setInputCloud(blocks[i]);
-	pca.project(*blocks[i], *block_projected);
-	pcl::getMinMax3D(*block_projected, block_min, block_max);
-      } else {
-	block_min.setZero();
-	block_max.setZero();
+  } else {
+    // every feature written in place by one thread, the large clusters spread by the dynamic schedule
+    const long n = features_.size();
+#pragma omp parallel for schedule(dynamic, 1) num_threads(feature_threads_) if(n > 1)
+    for(long i = 0; i < n; i++) {
+      if(!features_[i].reused) {
+#ifdef _OPENMP
+	FeatureScratch &scratch = feature_scratch_[omp_get_thread_num()];
+#else
+	FeatureScratch &scratch = feature_scratch_[0];
+#endif
+	extractFeature(clusters_[i], features_[i], scratch);
       }
-      slice[i*2] = block_max[0] - block_min[0];
-      slice[i*2+1] = block_max[1] - block_min[1];
     }
   }
 }
 
-void Object3dDetector::extractFeature(pcl::PointCloud<pcl::PointXYZ>::Ptr pc, Feature &f, Eigen::Vector4f &min, Eigen::Vector4f &max, Eigen::Vector4f &centroid) {
-  f.centroid = centroid;
-  f.min = min;
-  f.max = max;
-  
+/* Thread-safe, the projections are kept in scratch. */
+void Object3dDetector::extractFeature(const ClusterView &pc, Feature &f, FeatureScratch &scratch) {
   if(use_svm_model_) {
     // f1: Number of points included the cluster.
-    f.number_points = pc->size();
+    f.number_points = (int)(pc.size * f.point_weight + 0.5f);
     // f2: The minimum distance to the cluster.
-    f.min_distance = FLT_MAX;
-    double d2; //squared Euclidean distance
-    for(int i = 0; i < pc->size(); i++) {
-      d2 = pc->points[i].x*pc->points[i].x + pc->points[i].y*pc->points[i].y + pc->points[i].z*pc->points[i].z;
-      if(f.min_distance > d2) {
-	f.min_distance = d2;
-      }
-    }
+    f.min_distance = computeMinDistance(pc);
     //f.min_distance = sqrt(f.min_distance);
     
-    pcl::PCA<pcl::PointXYZ> pca;
-    pcl::PointCloud<pcl::PointXYZ>::Ptr pc_projected(new pcl::PointCloud<pcl::PointXYZ>);
-    pca.setInputCloud(pc);
-    pca.project(*pc, *pc_projected);
+    Eigen::Vector4f pca_mean;
+    Eigen::Matrix3f pca_eigenvectors;
+    ClusterView pc_projected = projectPCA(pc, scratch.projected, &pca_mean, &pca_eigenvectors);
     // f3: 3D covariance matrix of the cluster.
-    pcl::computeCovarianceMatrixNormalized(*pc_projected, centroid, f.covariance_3d);
+    computeCovarianceMatrixNormalized(pc_projected, f.centroid, f.covariance_3d);
     // f4: The normalized moment of inertia tensor.
-    computeMomentOfInertiaTensorNormalized(*pc_projected, f.moment_3d);
+    computeMomentOfInertiaTensorNormalized(pc_projected, f.moment_3d);
     // Navarro et al. assume that a pedestrian is in an upright position.
-    //pcl::PointCloud<pcl::PointXYZ>::Ptr main_plane(new pcl::PointCloud<pcl::PointXYZ>), secondary_plane(new pcl::PointCloud<pcl::PointXYZ>);
-    //computeProjectedPlane(pc, pca.getEigenVectors(), 2, centroid, main_plane);
-    //computeProjectedPlane(pc, pca.getEigenVectors(), 1, centroid, secondary_plane);
+#if OBJECT3D_FEATURE_F5 || OBJECT3D_FEATURE_F6
+    ClusterView main_plane = computeProjectedPlane(pc, pca_eigenvectors, 2, f.centroid, scratch.plane);
+#endif
+#if OBJECT3D_FEATURE_F5
     // f5: 2D covariance matrix in 3 zones, which are the upper half, and the left and right lower halves.
-    //compute3ZoneCovarianceMatrix(main_plane, pca.getMean(), f.partial_covariance_2d);
+    compute3ZoneCovarianceMatrix(main_plane, pca_mean, f.partial_covariance_2d);
+#endif
     // f6 and f7
-    //computeHistogramNormalized(main_plane, 7, 14, f.histogram_main_2d);
-    //computeHistogramNormalized(secondary_plane, 5, 9, f.histogram_second_2d);
+#if OBJECT3D_FEATURE_F6
+    computeHistogramNormalized(main_plane, 7, 14, f.histogram_main_2d);
+#endif
+#if OBJECT3D_FEATURE_F7
+    ClusterView secondary_plane = computeProjectedPlane(pc, pca_eigenvectors, 1, f.centroid, scratch.plane_secondary);
+    computeHistogramNormalized(secondary_plane, 5, 9, f.histogram_second_2d);
+#endif
     // f8
     computeSlice(pc, 10, f.slice);
   }
 }
 
-void Object3dDetector::saveFeature(Feature &f, struct svm_node *x) {
-  x[0].index  = 1;  x[0].value  = f.number_points; // libsvm indices start at 1
-  x[1].index  = 2;  x[1].value  = f.min_distance;
-  x[2].index  = 3;  x[2].value  = f.covariance_3d(0,0);
-  x[3].index  = 4;  x[3].value  = f.covariance_3d(0,1);
-  x[4].index  = 5;  x[4].value  = f.covariance_3d(0,2);
-  x[5].index  = 6;  x[5].value  = f.covariance_3d(1,1);
-  x[6].index  = 7;  x[6].value  = f.covariance_3d(1,2);
-  x[7].index  = 8;  x[7].value  = f.covariance_3d(2,2);
-  x[8].index  = 9;  x[8].value  = f.moment_3d(0,0);
-  x[9].index  = 10; x[9].value  = f.moment_3d(0,1);
-  x[10].index = 11; x[10].value = f.moment_3d(0,2);
-  x[11].index = 12; x[11].value = f.moment_3d(1,1);
-  x[12].index = 13; x[12].value = f.moment_3d(1,2);
-  x[13].index = 14; x[13].value = f.moment_3d(2,2);
-  // for(int i = 0; i < 9; i++) {
-  //   x[i+14].index = i+15;
-  //   x[i+14].value = f.partial_covariance_2d[i];
-  // }
-  // for(int i = 0; i < 98; i++) {
-  // 	x[i+23].index = i+24;
-  // 	x[i+23].value = f.histogram_main_2d[i];
-  // }
-  // for(int i = 0; i < 45; i++) {
-  // 	x[i+121].index = i+122;
-  // 	x[i+121].value = f.histogram_second_2d[i];
-  // }
-  for(int i = 0; i < 20; i++) {
-    x[i+14].index = i+15;
-    x[i+14].value = f.slice[i];
-  }
-  x[FEATURE_SIZE].index = -1;
-  
-  // for(int i = 0; i < FEATURE_SIZE; i++) {
-  //   std::cerr << x[i].index << ":" << x[i].value << " ";
-  //   std::cerr << std::endl;
-  // }
+/* The message of the previous frame is reused as long as nobody else holds it,
+ * i.e. no intra-process subscriber still has it queued; otherwise a new one is
+ * allocated, published messages are never modified. */
+template <typename M>
+static M &reuseMessage(boost::shared_ptr<M> &msg) {
+  if(!msg || !msg.unique()) {
+    msg.reset(new M);
+  }
+  return *msg;
 }
 
-void Object3dDetector::classify() {
-  visualization_msgs::MarkerArray marker_array;
-  people_msgs::PositionMeasurementArray pma;
-  people_msgs::People ppl;
+void Object3dDetector::classify(const std_msgs::Header &header, const std::vector<Feature> &features) {
+  const ros::Time origin = perception_trace::origin(header.stamp);
+  perception_trace::ScopedHop hop("object3d_detector_gpu classify", origin);
+  WallTimer timer;
+  // the messages are refilled in place, resizing keeps the capacity of their vectors
+  bool markers = marker_array_pub_.getNumSubscribers() > 0;
+  visualization_msgs::MarkerArray &marker_array = reuseMessage(marker_array_msg_);
+  people_msgs::PositionMeasurementArray &pma = reuseMessage(measurements_msg_);
+  people_msgs::People &ppl = reuseMessage(people_msg_);
+  size_t people = 0;
   
-  for(std::vector<Feature>::iterator it = features_.begin(); it != features_.end(); ++it) {
-    if(use_svm_model_) {
-      saveFeature(*it, svm_node_);
-      //std::cerr << "test_id = " << it->id << ", number_points = " << it->number_points << ", min_distance = " << it->min_distance << std::endl;
-      
-      // scale data
-      for(int i = 0; i < FEATURE_SIZE; i++) {
-	if(std::fabs(svm_scale_range_[i][0] - svm_scale_range_[i][1]) < DBL_EPSILON) { // skip single-valued attribute
-	  continue;
-	}
-	if(std::fabs(svm_node_[i].value - svm_scale_range_[i][0]) < DBL_EPSILON) {
-	  svm_node_[i].value = svm_x_lower_;
-	}
-	else if(std::fabs(svm_node_[i].value - svm_scale_range_[i][1]) < DBL_EPSILON) {
-	  svm_node_[i].value = svm_x_upper_;
-	}
-	else {
-	  svm_node_[i].value = svm_x_lower_ + (svm_x_upper_ - svm_x_lower_) * (svm_node_[i].value - svm_scale_range_[i][0]) / (svm_scale_range_[i][1] - svm_scale_range_[i][0]);
-	}
+  if(use_svm_model_) {
+    // a reloaded model is swapped in between frames, never waiting for the loader
+    {
+      boost::unique_lock<boost::mutex> lock(svm_mutex_, boost::try_to_lock);
+      if(lock.owns_lock() && pending_svm_) {
+	retired_svm_ = svm_;
+	svm_.swap(pending_svm_);
+	pending_svm_.reset();
       }
-      
-      // predict
-      if(is_probability_model_) {
-	double prob_estimates[svm_model_->nr_class];
-	svm_predict_probability(svm_model_, svm_node_, prob_estimates);
-	if(prob_estimates[0] < human_probability_) {
-	  continue;
+    }
+    SvmModel &svm = *svm_;
+    
+    // one scaled feature vector per row, the reused clusters are human already
+    is_human_.resize(features.size());
+    svm_rows_.clear();
+    for(size_t i = 0; i < features.size(); i++) {
+      is_human_[i] = features[i].reused;
+      if(!features[i].reused) {
+	svm_rows_.push_back(i);
+      }
+    }
+    feature_matrix_.resize(svm_rows_.size(), FEATURE_SIZE);
+    for(size_t i = 0; i < svm_rows_.size(); i++) {
+      saveFeature(features[svm_rows_[i]], feature_matrix_.row(i).data());
+    }
+    svm.engine().scale(feature_matrix_);
+    
+    // predict
+    // binary models have no libsvm representation
+    if((batched_svm_ || svm.model() == NULL) && svm.engine().ready()) {
+      svm.engine().predict(feature_matrix_, svm_scores_);
+      for(size_t i = 0; i < svm_rows_.size(); i++) {
+	is_human_[svm_rows_[i]] = svm.engine().isHuman(svm_scores_[i], human_probability_);
+      }
+    } else {
+      for(size_t i = 0; i < svm_rows_.size(); i++) {
+	for(int k = 0; k < FEATURE_SIZE; k++) {
+	  svm_node_[k].index = k+1; // libsvm indices start at 1
+	  svm_node_[k].value = feature_matrix_(i, k);
 	}
-      } else {
-	if(svm_predict(svm_model_, svm_node_) != 1) {
-	  continue;
+	svm_node_[FEATURE_SIZE].index = -1;
+	if(svm.isProbabilityModel()) {
+	  double prob_estimates[svm.model()->nr_class];
+	  svm_predict_probability(svm.model(), svm_node_, prob_estimates);
+	  is_human_[svm_rows_[i]] = prob_estimates[0] >= human_probability_;
+	} else {
+	  is_human_[svm_rows_[i]] = svm_predict(svm.model(), svm_node_) == 1;
 	}
       }
     }
     
-    visualization_msgs::Marker marker;
+    // the clusters of the confident tracks classified again
+    for(size_t i = 0; i < svm_rows_.size(); i++) {
+      const Feature &f = features[svm_rows_[i]];
+      if(f.track_id >= 0) {
+	classification_cache_.verified(f.track_id, is_human_[svm_rows_[i]]);
+      }
+    }
+  }
+  
+  stage_stats_[STAGE_SVM].add(timer.lap());
+  
+  // the same person seen by several lidars in their overlap is published once
+  std::vector<size_t> published;
+  for(std::vector<Feature>::const_iterator it = features.begin(); it != features.end(); ++it) {
+    if(use_svm_model_ && !is_human_[it-features.begin()]) {
+      continue;
+    }
+    if(dedup_distance_ > 0.0) {
+      bool duplicate = false;
+      for(size_t j = 0; j < published.size() && !duplicate; j++) {
+	duplicate = (features[published[j]].centroid - it->centroid).head<2>().squaredNorm() < dedup_distance_ * dedup_distance_;
+      }
+      if(duplicate) {
+	continue;
+      }
+      published.push_back(it-features.begin());
+    }
+    
+    if(pma.people.size() <= people) {
+      pma.people.resize(people + 1);
+      ppl.people.resize(people + 1);
+    }
+    if(markers && marker_array.markers.size() <= people) {
+      marker_array.markers.resize(people + 1);
+    }
+    
+    people_msgs::PositionMeasurement &pm = pma.people[people];
+    pm.pos.x = it->centroid[0];
+    pm.pos.y = it->centroid[1];
+    pm.pos.z = it->centroid[2];
+    // the evidence of the SVM for the probability of the track, none from a reused label
+    if(classification_reuse_) {
+      pm.reliability = it->reused ? 0.0 : human_probability_;
+    }
+
+    people_msgs::Person &ps = ppl.people[people];
+    ps.position.x = it->centroid[0];
+    ps.position.y = it->centroid[1];
+    ps.position.z = it->centroid[2];
+    
+    if(!markers) {
+      people++;
+      continue;
+    }
+    
+    visualization_msgs::Marker &marker = marker_array.markers[people++];
     marker.header.stamp = ros::Time::now();
     marker.header.frame_id = frame_id_;
     marker.ns = "object3d";
-    marker.id = it-features_.begin();
+    marker.id = it-features.begin();
     marker.type = visualization_msgs::Marker::LINE_LIST;
 
-    geometry_msgs::Point p[24];
+    marker.points.resize(24);
+    geometry_msgs::Point *p = &marker.points[0];
     p[0].x = it->max[0]; p[0].y = it->max[1]; p[0].z = it->max[2];
     p[1].x = it->min[0]; p[1].y = it->max[1]; p[1].z = it->max[2];
     p[2].x = it->max[0]; p[2].y = it->max[1]; p[2].z = it->max[2];
@@ -589,9 +1470,6 @@ void Object3dDetector::classify() {
     p[22].x = it->max[0]; p[22].y = it->max[1]; p[22].z = it->min[2];
     p[23].x = it->max[0]; p[23].y = it->min[1]; p[23].z = it->min[2];
 
-    for(int i = 0; i < 24; i++) {
-      marker.points.push_back(p[i]);
-    }
     marker.scale.x = 0.02;
     marker.color.a = 1.0;
     if(!use_svm_model_) {
@@ -605,41 +1483,28 @@ void Object3dDetector::classify() {
     }
     
     marker.lifetime = ros::Duration(0.1);
-    marker_array.markers.push_back(marker);
-    
-    people_msgs::PositionMeasurement pm;
-    pm.pos.x = it->centroid[0];
-    pm.pos.y = it->centroid[1];
-    pm.pos.z = it->centroid[2];
-    pma.people.push_back(pm);
-
-    people_msgs::Person ps;
-    ps.position.x = it->centroid[0];
-    ps.position.y = it->centroid[1];
-    ps.position.z = it->centroid[2];
-    ppl.people.push_back(ps);
   }
+  pma.people.resize(people);
+  ppl.people.resize(people);
   
-  if(marker_array.markers.size()) {
-    marker_array_pub_.publish(marker_array);
+  // shared pointers are handed to nodelet subscribers without a copy
+  if(markers && people) {
+    marker_array.markers.resize(people);
+    marker_array_pub_.publish(marker_array_msg_);
   }
   
-  if(pma.people.size()) {
+  if(people) {
     pma.header.stamp = ros::Time::now();
     pma.header.frame_id = frame_id_;
-    measurements_pub_.publish(pma);
-  }
-  
-  if(ppl.people.size()) {
+    perception_trace::link(pma.header.stamp, origin);
+    measurements_pub_.publish(measurements_msg_);
+    
     ppl.header.stamp = ros::Time::now();
     ppl.header.frame_id = frame_id_;
-    people_pub_.publish(ppl);
+    people_pub_.publish(people_msg_);
+  }
+  stage_stats_[STAGE_PUBLISH].add(timer.lap());
+  if(!header.stamp.isZero()) {
+    stage_stats_[STAGE_LATENCY].add((ros::Time::now() - header.stamp).toSec() * 1000.0);
   }
-}
-
-int main(int argc, char **argv) {
-  ros::init(argc, argv, "object3d_detector_gpu");
-  Object3dDetector d;
-  ros::spin();
-  return 0;
 }
@@ -0,0 +1,158 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+/* Offline replay of recorded scans through Object3dDetector, without a bag
+ * player or a lidar driver: every scan is loaded up front, then fed to the
+ * callback one after the other on this thread. Only a roscore is needed for
+ * the parameters and the publishers. The detector is configured as usual with
+ * private parameters, e.g.
+ *   rosrun object3d_detector_gpu object3d_detector_gpu_benchmark scans.bag _gpu_features:=true
+ *   rosrun object3d_detector_gpu object3d_detector_gpu_benchmark pcd_dir/ _batched_clustering:=false
+ */
+
+#include "object3d_detector_gpu.h"
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <pcl/io/pcd_io.h>
+
+#include <sys/resource.h>
+#include <dirent.h>
+#include <algorithm>
+#include <cstdio>
+
+static bool endsWith(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void loadBag(const std::string &file_name, const std::string &topic, std::vector<sensor_msgs::PointCloud2::Ptr> &scans) {
+  rosbag::Bag bag(file_name, rosbag::bagmode::Read);
+  rosbag::View view(bag, rosbag::TopicQuery(topic));
+  for(rosbag::View::iterator it = view.begin(); it != view.end(); ++it) {
+    sensor_msgs::PointCloud2::Ptr scan = it->instantiate<sensor_msgs::PointCloud2>();
+    if(scan) {
+      scans.push_back(scan);
+    }
+  }
+  bag.close();
+}
+
+static void loadPCDs(const std::string &directory, std::vector<sensor_msgs::PointCloud2::Ptr> &scans) {
+  std::vector<std::string> files;
+  DIR *dir = opendir(directory.c_str());
+  if(dir == NULL) {
+    return;
+  }
+  for(struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+    if(endsWith(entry->d_name, ".pcd")) {
+      files.push_back(directory + "/" + entry->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end()); // replay order must not depend on the file system
+
+  for(size_t i = 0; i < files.size(); i++) {
+    pcl::PCLPointCloud2 pcl_pc2;
+    if(pcl::io::loadPCDFile(files[i], pcl_pc2) < 0) {
+      ROS_WARN("[object3d_detector_gpu_benchmark] Can not load '%s', skipped.", files[i].c_str());
+      continue;
+    }
+    sensor_msgs::PointCloud2::Ptr scan(new sensor_msgs::PointCloud2);
+    pcl_conversions::fromPCL(pcl_pc2, *scan);
+    scans.push_back(scan);
+  }
+}
+
+static void printStats(const char *name, const RollingStats &stats) {
+  double p50, p90, p99, max;
+  if(stats.percentiles(p50, p90, p99, max)) {
+    printf("  %-24s %9.3f %9.3f %9.3f %9.3f\n", name, p50, p90, p99, max);
+  }
+}
+
+int main(int argc, char **argv) {
+  ros::init(argc, argv, "object3d_detector_gpu_benchmark");
+  if(argc < 2) {
+    fprintf(stderr, "usage: %s <bag file | pcd directory> [_topic:=rslidar_points] [_warmup:=10] [_repeat:=1] [detector parameters]\n", argv[0]);
+    return 1;
+  }
+  std::string input = argv[1];
+
+  ros::NodeHandle private_nh("~");
+  std::string topic;
+  int warmup, repeat;
+  private_nh.param<std::string>("topic", topic, "rslidar_points");
+  private_nh.param<int>("warmup", warmup, 10);
+  private_nh.param<int>("repeat", repeat, 1);
+
+  std::vector<sensor_msgs::PointCloud2::Ptr> scans;
+  if(endsWith(input, ".bag")) {
+    loadBag(input, topic, scans);
+  } else {
+    loadPCDs(input, scans);
+  }
+  if(scans.empty()) {
+    fprintf(stderr, "no scans found in '%s'\n", input.c_str());
+    return 1;
+  }
+
+  // deterministic runs: everything on this thread, nothing depending on the clock or other nodes
+  unsigned int measured = scans.size() * std::max(repeat, 1);
+  warmup = std::min(std::max(warmup, 0), (int)scans.size());
+  private_nh.setParam("pipelined", false);
+  private_nh.setParam("roi_gating", false);
+  private_nh.setParam("print_fps", false);
+  private_nh.setParam("latency_window", (int)measured);
+
+  size_t gpu_free_before = 0, gpu_total = 0;
+  cudaMemGetInfo(&gpu_free_before, &gpu_total);
+
+  Object3dDetector detector;
+
+  for(int i = 0; i < warmup; i++) {
+    scans[i]->header.stamp = ros::Time::now();
+    detector.pointCloudCallback(scans[i]);
+  }
+
+  RollingStats frame_stats(measured);
+  unsigned long clusters = 0;
+  size_t max_clusters = 0;
+  for(int r = 0; r < std::max(repeat, 1); r++) {
+    for(size_t i = 0; i < scans.size(); i++) {
+      scans[i]->header.stamp = ros::Time::now();
+      WallTimer timer;
+      detector.pointCloudCallback(scans[i]);
+      frame_stats.add(timer.lap());
+      clusters += detector.lastClusters();
+      max_clusters = std::max(max_clusters, detector.lastClusters());
+    }
+  }
+
+  size_t gpu_free_after = 0;
+  cudaMemGetInfo(&gpu_free_after, &gpu_total);
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  printf("[object3d_detector_gpu_benchmark] %zu scans x %d, %d warm-up frames\n", scans.size(), std::max(repeat, 1), warmup);
+  printf("  %-24s %9s %9s %9s %9s  (ms)\n", "stage", "p50", "p90", "p99", "max");
+  printStats("frame", frame_stats);
+  for(int i = 0; i < STAGE_COUNT; i++) {
+    if(i != STAGE_LATENCY) { // stamps are rewritten, only the stages are meaningful offline
+      printStats(Object3dDetector::stageName(i), detector.stageStats(i));
+    }
+  }
+  char name[32];
+  for(int i = 0; i < nested_regions_; i++) {
+    snprintf(name, sizeof(name), "region %d (gpu)", i);
+    printStats(name, detector.regionStats(i));
+  }
+  printf("  clusters/frame           %9.2f (max %zu)\n", (double)clusters / measured, max_clusters);
+  printf("  cpu max resident         %9.1f MB\n", usage.ru_maxrss / 1024.0);
+  printf("  gpu buffer pool          %9.1f MB (grown %lu times)\n", detector.bufferPool().allocatedBytes() / 1048576.0, detector.bufferPool().growCount());
+  printf("  gpu memory used by run   %9.1f MB\n", ((double)gpu_free_before - (double)gpu_free_after) / 1048576.0);
+  return 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+/* Converts a libsvm model and its svm-scale range into the binary model the
+ * detector maps at startup, e.g.
+ *   rosrun object3d_detector_gpu object3d_detector_gpu_convert_model pedestrian.model pedestrian.range pedestrian.svmb
+ * then point model_file_name at pedestrian.svmb (range_file_name is not needed).
+ * The binary file is tied to the feature layout of this build.
+ */
+
+#include "svm_model.h"
+
+#include <cstdio>
+
+int main(int argc, char **argv) {
+  if(argc != 4) {
+    fprintf(stderr, "usage: %s <libsvm model> <svm-scale range> <binary model>\n", argv[0]);
+    return 1;
+  }
+  
+  SvmModel svm;
+  SvmModel::Status status = svm.load(argv[1], argv[2]);
+  if(status == SvmModel::MODEL_FAILED) {
+    fprintf(stderr, "can not load the model '%s'\n", argv[1]);
+    return 1;
+  }
+  if(status == SvmModel::RANGE_FAILED) {
+    fprintf(stderr, "can not load the range '%s'\n", argv[2]);
+    return 1;
+  }
+  if(!svm.engine().ready()) {
+    fprintf(stderr, "only two-class RBF C-SVC models can be converted\n");
+    return 1;
+  }
+  if(!svm.engine().save(argv[3])) {
+    fprintf(stderr, "can not write '%s'\n", argv[3]);
+    return 1;
+  }
+  
+  // read it back the way the detector will
+  SvmEngine mapped;
+  if(!mapped.map(argv[3]) || mapped.supportVectors() != svm.engine().supportVectors()) {
+    fprintf(stderr, "'%s' does not map back\n", argv[3]);
+    return 1;
+  }
+  printf("%s: %d support vectors x %d features%s\n", argv[3], mapped.supportVectors(), SvmEngine::FEATURE_SIZE, mapped.isProbabilityModel() ? ", probability model" : "");
+  return 0;
+}
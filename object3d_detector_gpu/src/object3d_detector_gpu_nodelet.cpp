@@ -0,0 +1,32 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+/* Object3dDetector as a nodelet: loaded into the manager of rslidar_pointcloud,
+ * the clouds arrive as the ConstPtr the CloudNodelet published, without being
+ * serialized. Parameters are the same as for the node.
+ */
+
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+
+#include "object3d_detector_gpu.h"
+
+namespace object3d_detector_gpu {
+
+class Object3dDetectorNodelet : public nodelet::Nodelet {
+private:
+  virtual void onInit() {
+    // the single-threaded queue keeps the callbacks serialized, as in the node
+    detector_.reset(new Object3dDetector(getNodeHandle(), getPrivateNodeHandle()));
+  }
+  
+  boost::shared_ptr<Object3dDetector> detector_;
+};
+
+} // namespace object3d_detector_gpu
+
+PLUGINLIB_EXPORT_CLASS(object3d_detector_gpu::Object3dDetectorNodelet, nodelet::Nodelet)
@@ -0,0 +1,105 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "range_image_clustering.h"
+
+#include <cmath>
+#include <algorithm>
+
+RangeImageClustering::RangeImageClustering(double angle_threshold, unsigned int min_cluster_size, unsigned int max_cluster_size, float z_limit_min, float z_limit_max)
+  : angle_threshold_(angle_threshold), min_cluster_size_(min_cluster_size), max_cluster_size_(max_cluster_size),
+    z_limit_min_(z_limit_min), z_limit_max_(z_limit_max), xyz_(NULL), stride_(4) {}
+
+/* beta = atan2(d2 sin(alpha), d1 - d2 cos(alpha)), d1 >= d2 the two ranges and
+ * alpha the angle between both beams. */
+bool RangeImageClustering::connected(unsigned int a, unsigned int b) const {
+  const float *p = xyz_ + a * stride_;
+  const float *q = xyz_ + b * stride_;
+  float ra = range_[a], rb = range_[b];
+  double cos_alpha = (p[0] * q[0] + p[1] * q[1] + p[2] * q[2]) / (ra * rb);
+  cos_alpha = std::min(1.0, std::max(-1.0, cos_alpha));
+  double sin_alpha = std::sqrt(1.0 - cos_alpha * cos_alpha);
+  double d1 = std::max(ra, rb), d2 = std::min(ra, rb);
+  return std::atan2(d2 * sin_alpha, d1 - d2 * cos_alpha) > angle_threshold_;
+}
+
+void RangeImageClustering::process(const float *xyz, unsigned int stride, unsigned int width, unsigned int height) {
+  xyz_ = xyz;
+  stride_ = stride;
+  const unsigned int pixels = width * height;
+  range_.resize(pixels);
+  label_.assign(pixels, -1);
+  queue_.resize(pixels);
+  points_.clear();
+  clusters_.clear();
+  
+  for(unsigned int i = 0; i < pixels; i++) {
+    const float *p = xyz + i * stride;
+    bool ok = std::isfinite(p[0]) && std::isfinite(p[1]) && std::isfinite(p[2]) && p[2] >= z_limit_min_ && p[2] <= z_limit_max_;
+    range_[i] = ok ? std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]) : 0.0f;
+  }
+  
+  // first pass: labels and cluster sizes, the sizes decide which clusters are kept
+  std::vector<unsigned int> sizes;
+  for(unsigned int seed = 0; seed < pixels; seed++) {
+    if(label_[seed] >= 0 || !valid(seed)) {
+      continue;
+    }
+    int label = sizes.size();
+    unsigned int head = 0, tail = 0;
+    queue_[tail++] = seed;
+    label_[seed] = label;
+    while(head < tail) {
+      unsigned int pixel = queue_[head++];
+      unsigned int row = pixel / width, col = pixel % width;
+      unsigned int neighbours[4];
+      int n = 0;
+      neighbours[n++] = row * width + (col + 1) % width;
+      neighbours[n++] = row * width + (col + width - 1) % width;
+      if(row > 0) neighbours[n++] = pixel - width;
+      if(row + 1 < height) neighbours[n++] = pixel + width;
+      for(int k = 0; k < n; k++) {
+	unsigned int next = neighbours[k];
+	if(label_[next] < 0 && valid(next) && connected(pixel, next)) {
+	  label_[next] = label;
+	  queue_[tail++] = next;
+	}
+      }
+    }
+    sizes.push_back(tail);
+  }
+  
+  // second pass: gather the kept clusters, one contiguous slice each
+  std::vector<int> offsets(sizes.size(), -1);
+  unsigned int total = 0;
+  for(size_t c = 0; c < sizes.size(); c++) {
+    if(sizes[c] >= min_cluster_size_ && sizes[c] <= max_cluster_size_) {
+      offsets[c] = total;
+      total += sizes[c];
+    }
+  }
+  points_.resize(total * 4);
+  std::vector<unsigned int> fill(sizes.size(), 0);
+  for(unsigned int i = 0; i < pixels; i++) {
+    int c = label_[i];
+    if(c < 0 || offsets[c] < 0) {
+      continue;
+    }
+    float *out = &points_[(offsets[c] + fill[c]++) * 4];
+    const float *p = xyz + i * stride;
+    out[0] = p[0];
+    out[1] = p[1];
+    out[2] = p[2];
+    out[3] = 1.0f;
+  }
+  for(size_t c = 0; c < sizes.size(); c++) {
+    if(offsets[c] >= 0) {
+      ClusterView view = {&points_[offsets[c] * 4], sizes[c]};
+      clusters_.push_back(view);
+    }
+  }
+}
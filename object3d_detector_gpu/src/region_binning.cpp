@@ -0,0 +1,68 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "region_binning.h"
+
+#include <algorithm>
+
+RegionBinning::RegionBinning(int regions, const int *zones)
+  : regions_(std::min(regions, (int)MAX_REGIONS)) {
+  double range = 0.0;
+  bounds2_[0] = 0.0;
+  for(int j = 0; j < regions_; j++) {
+    range += zones[j];
+    bounds2_[j+1] = range * range;
+  }
+  std::fill(offsets_, offsets_ + MAX_REGIONS + 1, 0);
+}
+
+void RegionBinning::setBounds(const double *bounds) {
+  for(int j = 0; j <= regions_; j++) {
+    bounds2_[j] = bounds[j] * bounds[j];
+  }
+}
+
+void RegionBinning::process(const float *xyz, size_t stride, size_t n) {
+  region_of_.resize(n);
+  
+  // pass 1: region of every point, independent iterations the compiler can vectorize
+  const int regions = regions_;
+  const double *bounds2 = bounds2_;
+  unsigned char *region_of = region_of_.data();
+#pragma omp parallel for
+  for(long i = 0; i < (long)n; i++) {
+    const float *p = xyz + i * stride;
+    double d2 = p[0] * p[0] + p[1] * p[1] + p[2] * p[2];
+    // d2 in (bounds2[j], bounds2[j+1]] falls in region j, the origin in none
+    int j = 0;
+    for(int k = 1; k < regions; k++) {
+      j += d2 > bounds2[k];
+    }
+    region_of[i] = (d2 > 0.0 && d2 <= bounds2[regions]) ? j : regions;
+  }
+  
+  // histogram and exclusive scan
+  unsigned int counts[MAX_REGIONS+1] = {0};
+  for(size_t i = 0; i < n; i++) {
+    counts[region_of[i]]++;
+  }
+  offsets_[0] = 0;
+  for(int j = 0; j < regions_; j++) {
+    offsets_[j+1] = offsets_[j] + counts[j];
+  }
+  
+  // pass 2: scatter, stable within every region
+  indices_.resize(offsets_[regions_]);
+  unsigned int slot[MAX_REGIONS+1];
+  std::copy(offsets_, offsets_ + regions_ + 1, slot);
+  for(size_t i = 0; i < n; i++) {
+    unsigned char j = region_of[i];
+    if(j < regions_) {
+      indices_[slot[j]++] = i;
+    }
+  }
+}
@@ -0,0 +1,78 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "region_layout.h"
+
+#include <algorithm>
+#include <cmath>
+
+RegionLayout::RegionLayout(int regions, const int *zones, double resolution)
+  : regions_(std::max(1, std::min(regions, (int)MAX_REGIONS))), resolution_(std::max(resolution, 1e-3)), samples_(0) {
+  double range = 0.0;
+  fixed_bounds_[0] = 0.0;
+  for(int j = 0; j < regions_; j++) {
+    range += zones[j];
+    fixed_bounds_[j+1] = range;
+    tolerances_[j] = 0.1 * (j + 1);
+  }
+  std::copy(fixed_bounds_, fixed_bounds_ + regions_ + 1, bounds_);
+  histogram_.assign((size_t)ceil(range / resolution_), 0);
+}
+
+void RegionLayout::add(const float *xyz, size_t stride, size_t n) {
+  // the origin and the points beyond the outer bound are in no region
+  const double outer2 = bounds_[regions_] * bounds_[regions_];
+  const size_t bins = histogram_.size();
+  for(size_t i = 0; i < n; i++) {
+    const float *p = xyz + i * stride;
+    double d2 = p[0] * p[0] + p[1] * p[1] + p[2] * p[2];
+    if(d2 > 0.0 && d2 <= outer2) {
+      histogram_[std::min((size_t)(sqrt(d2) / resolution_), bins - 1)]++;
+      samples_++;
+    }
+  }
+}
+
+bool RegionLayout::balance(double min_width) {
+  if(samples_ == 0 || histogram_.empty()) {
+    return false;
+  }
+  const double outer = bounds_[regions_];
+  min_width = std::max(0.0, std::min(min_width, outer / regions_));
+  // bound k closes the bin where the cumulative count reaches k/regions of the points
+  uint64_t cumulative = 0;
+  size_t bin = 0;
+  for(int k = 1; k < regions_; k++) {
+    uint64_t target = (samples_ * k + regions_ - 1) / regions_;
+    while(bin < histogram_.size() && cumulative < target) {
+      cumulative += histogram_[bin++];
+    }
+    double bound = std::min(bin * resolution_, outer);
+    bound = std::max(bound, bounds_[k-1] + min_width);
+    bounds_[k] = std::min(bound, outer - (regions_ - k) * min_width);
+  }
+  for(int j = 0; j < regions_; j++) {
+    tolerances_[j] = fixedTolerance(0.5 * (bounds_[j] + bounds_[j+1]));
+  }
+  return true;
+}
+
+double RegionLayout::fixedTolerance(double r) const {
+  int j = 0;
+  while(j < regions_ - 1 && r > fixed_bounds_[j+1]) {
+    j++;
+  }
+  return 0.1 * (j + 1);
+}
+
+int RegionLayout::regionsWithin(double r) const {
+  int n = 0;
+  while(n < regions_ && bounds_[n] < r) {
+    n++;
+  }
+  return std::max(n, 1);
+}
@@ -0,0 +1,293 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "svm_engine.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libsvm/svm.h>
+
+/* Binary model: this header, then the range, the coefficients, the support
+ * vector norms and the row-major support vectors, every section on its own
+ * cache line (mmap itself returns page aligned memory). */
+struct SvmBinaryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t feature_size;
+  uint32_t support_vectors;
+  uint32_t probability;
+  int32_t label[2];
+  double gamma;
+  double rho;
+  double prob_a;
+  double prob_b;
+  double x_lower;
+  double x_upper;
+};
+
+static const char SVM_BINARY_MAGIC[8] = {'O', '3', 'D', 'S', 'V', 'M', 'B', '\n'};
+static const uint32_t SVM_BINARY_VERSION = 1;
+
+static size_t alignSection(size_t bytes) {
+  return (bytes + 63) & ~(size_t)63;
+}
+
+struct SvmBinaryLayout {
+  size_t range_min, range_max, coef, sv_norm, sv, bytes;
+  SvmBinaryLayout(size_t features, size_t l) {
+    range_min = alignSection(sizeof(SvmBinaryHeader));
+    range_max = range_min + alignSection(features * sizeof(double));
+    coef = range_max + alignSection(features * sizeof(double));
+    sv_norm = coef + alignSection(l * sizeof(double));
+    sv = sv_norm + alignSection(l * sizeof(double));
+    bytes = sv + l * features * sizeof(double);
+  }
+};
+
+static bool writeSection(FILE *file, size_t offset, const void *data, size_t bytes) {
+  static const char zeros[64] = {0};
+  long pad = (long)offset - ftell(file);
+  return pad >= 0 && pad <= 64 && fwrite(zeros, 1, pad, file) == (size_t)pad && (bytes == 0 || fwrite(data, 1, bytes, file) == bytes);
+}
+
+SvmEngine::SvmEngine()
+  : ready_(false), probability_(false), gamma_(0.0), rho_(0.0),
+    prob_a_(0.0), prob_b_(0.0), sv_(NULL, 0, FEATURE_SIZE), sv_norm_(NULL, 0), coef_(NULL, 0),
+    range_min_(NULL), range_max_(NULL), x_lower_(-1.0), x_upper_(1.0),
+    range_min_data_(FEATURE_SIZE, 0.0), range_max_data_(FEATURE_SIZE, 0.0), mapped_(NULL), mapped_bytes_(0) {
+  label_[0] = 1;
+  label_[1] = -1;
+  bind(NULL, NULL, NULL, 0, &range_min_data_[0], &range_max_data_[0]);
+}
+
+SvmEngine::~SvmEngine() {
+  unmap();
+}
+
+void SvmEngine::bind(const double *sv, const double *sv_norm, const double *coef, int l, const double *range_min, const double *range_max) {
+  // Eigen's way to reseat a Map
+  new (&sv_) MatrixView(sv, l, FEATURE_SIZE);
+  new (&sv_norm_) VectorView(sv_norm, l);
+  new (&coef_) VectorView(coef, l);
+  range_min_ = range_min;
+  range_max_ = range_max;
+}
+
+void SvmEngine::unmap() {
+  if(mapped_ != NULL) {
+    munmap(mapped_, mapped_bytes_);
+    mapped_ = NULL;
+    mapped_bytes_ = 0;
+  }
+}
+
+bool SvmEngine::init(const svm_model *model) {
+  ready_ = false;
+  if(mapped_ != NULL) {
+    // keep the range of the mapped model, as loadRange() may not follow
+    range_min_data_.assign(range_min_, range_min_ + FEATURE_SIZE);
+    range_max_data_.assign(range_max_, range_max_ + FEATURE_SIZE);
+  }
+  bind(sv_data_.data(), sv_norm_data_.data(), coef_data_.data(), sv_data_.rows(), &range_min_data_[0], &range_max_data_[0]);
+  unmap();
+  if(model == NULL || model->param.svm_type != C_SVC || model->param.kernel_type != RBF || model->nr_class != 2) {
+    return false;
+  }
+  gamma_ = model->param.gamma;
+  rho_ = model->rho[0];
+  label_[0] = model->label[0];
+  label_[1] = model->label[1];
+  probability_ = model->probA != NULL && model->probB != NULL;
+  if(probability_) {
+    prob_a_ = model->probA[0];
+    prob_b_ = model->probB[0];
+  }
+
+  // densify the sparse support vectors, missing attributes are zeros
+  sv_data_.setZero(model->l, FEATURE_SIZE);
+  coef_data_.resize(model->l);
+  for(int i = 0; i < model->l; i++) {
+    for(const svm_node *n = model->SV[i]; n->index != -1; n++) {
+      if(n->index >= 1 && n->index <= FEATURE_SIZE) {
+	sv_data_(i, n->index - 1) = n->value;
+      }
+    }
+    coef_data_[i] = model->sv_coef[0][i];
+  }
+  sv_norm_data_ = sv_data_.rowwise().squaredNorm();
+  bind(sv_data_.data(), sv_norm_data_.data(), coef_data_.data(), model->l, &range_min_data_[0], &range_max_data_[0]);
+  ready_ = true;
+  return true;
+}
+
+bool SvmEngine::loadRange(const std::string &range_file_name) {
+  FILE *range_file = fopen(range_file_name.c_str(), "r");
+  if(range_file == NULL) {
+    return false;
+  }
+  range_min_data_.assign(FEATURE_SIZE, 0.0);
+  range_max_data_.assign(FEATURE_SIZE, 0.0);
+  range_min_ = &range_min_data_[0];
+  range_max_ = &range_max_data_[0];
+  if(fscanf(range_file, "x\n") != 0 || fscanf(range_file, "%lf %lf\n", &x_lower_, &x_upper_) != 2) {
+    fclose(range_file);
+    return false;
+  }
+  int idx = 1;
+  double fmin, fmax;
+  while(fscanf(range_file, "%d %lf %lf\n", &idx, &fmin, &fmax) == 3) {
+    if(idx >= 1 && idx <= FEATURE_SIZE) {
+      range_min_data_[idx-1] = fmin;
+      range_max_data_[idx-1] = fmax;
+    }
+  }
+  fclose(range_file);
+  return true;
+}
+
+bool SvmEngine::save(const std::string &file_name) const {
+  if(!ready_) {
+    return false;
+  }
+  SvmBinaryHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SVM_BINARY_MAGIC, sizeof(header.magic));
+  header.version = SVM_BINARY_VERSION;
+  header.feature_size = FEATURE_SIZE;
+  header.support_vectors = sv_.rows();
+  header.probability = probability_ ? 1 : 0;
+  header.label[0] = label_[0];
+  header.label[1] = label_[1];
+  header.gamma = gamma_;
+  header.rho = rho_;
+  header.prob_a = prob_a_;
+  header.prob_b = prob_b_;
+  header.x_lower = x_lower_;
+  header.x_upper = x_upper_;
+  
+  FILE *file = fopen(file_name.c_str(), "wb");
+  if(file == NULL) {
+    return false;
+  }
+  SvmBinaryLayout layout(FEATURE_SIZE, sv_.rows());
+  bool ok = writeSection(file, 0, &header, sizeof(header))
+    && writeSection(file, layout.range_min, range_min_, FEATURE_SIZE * sizeof(double))
+    && writeSection(file, layout.range_max, range_max_, FEATURE_SIZE * sizeof(double))
+    && writeSection(file, layout.coef, coef_.data(), coef_.size() * sizeof(double))
+    && writeSection(file, layout.sv_norm, sv_norm_.data(), sv_norm_.size() * sizeof(double))
+    && writeSection(file, layout.sv, sv_.data(), sv_.size() * sizeof(double));
+  return fclose(file) == 0 && ok;
+}
+
+bool SvmEngine::map(const std::string &file_name) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if(fd < 0) {
+    return false;
+  }
+  struct stat st;
+  void *data = MAP_FAILED;
+  if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SvmBinaryHeader)) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if(data == MAP_FAILED) {
+    return false;
+  }
+  
+  const SvmBinaryHeader &header = *static_cast<const SvmBinaryHeader *>(data);
+  SvmBinaryLayout layout(FEATURE_SIZE, header.support_vectors);
+  if(memcmp(header.magic, SVM_BINARY_MAGIC, sizeof(header.magic)) != 0 || header.version != SVM_BINARY_VERSION ||
+     header.feature_size != (uint32_t)FEATURE_SIZE || (size_t)st.st_size < layout.bytes) {
+    munmap(data, st.st_size);
+    return false;
+  }
+  
+  gamma_ = header.gamma;
+  rho_ = header.rho;
+  label_[0] = header.label[0];
+  label_[1] = header.label[1];
+  probability_ = header.probability != 0;
+  prob_a_ = header.prob_a;
+  prob_b_ = header.prob_b;
+  x_lower_ = header.x_lower;
+  x_upper_ = header.x_upper;
+  const char *base = static_cast<const char *>(data);
+  bind(reinterpret_cast<const double *>(base + layout.sv), reinterpret_cast<const double *>(base + layout.sv_norm),
+       reinterpret_cast<const double *>(base + layout.coef), header.support_vectors,
+       reinterpret_cast<const double *>(base + layout.range_min), reinterpret_cast<const double *>(base + layout.range_max));
+  unmap();
+  sv_data_.resize(0, FEATURE_SIZE);
+  sv_norm_data_.resize(0);
+  coef_data_.resize(0);
+  mapped_ = data;
+  mapped_bytes_ = st.st_size;
+  ready_ = true;
+  return true;
+}
+
+void SvmEngine::scale(double *x) const {
+  for(int i = 0; i < FEATURE_SIZE; i++) {
+    if(std::fabs(range_min_[i] - range_max_[i]) < DBL_EPSILON) { // skip single-valued attribute
+      continue;
+    }
+    if(std::fabs(x[i] - range_min_[i]) < DBL_EPSILON) {
+      x[i] = x_lower_;
+    }
+    else if(std::fabs(x[i] - range_max_[i]) < DBL_EPSILON) {
+      x[i] = x_upper_;
+    }
+    else {
+      x[i] = x_lower_ + (x_upper_ - x_lower_) * (x[i] - range_min_[i]) / (range_max_[i] - range_min_[i]);
+    }
+  }
+}
+
+void SvmEngine::scale(Matrix &x) const {
+  for(int r = 0; r < x.rows(); r++) {
+    scale(x.row(r).data());
+  }
+}
+
+void SvmEngine::predict(const Matrix &x, std::vector<double> &scores) {
+  scores.resize(x.rows());
+  if(x.rows() == 0) {
+    return;
+  }
+  // |x - sv|^2 = |x|^2 + |sv|^2 - 2 x.sv, the cross terms as one product
+  kernel_.noalias() = -2.0 * x * sv_.transpose();
+  kernel_.colwise() += x.rowwise().squaredNorm();
+  kernel_.rowwise() += sv_norm_.transpose();
+  kernel_ = (-gamma_ * kernel_.array().max(0.0)).exp().matrix();
+
+  Eigen::VectorXd dec = kernel_ * coef_;
+  for(int i = 0; i < x.rows(); i++) {
+    double d = dec[i] - rho_;
+    if(probability_) {
+      // libsvm's sigmoid_predict, clamped as in svm_predict_probability
+      double fApB = d * prob_a_ + prob_b_;
+      double p = fApB >= 0 ? std::exp(-fApB) / (1.0 + std::exp(-fApB)) : 1.0 / (1.0 + std::exp(fApB));
+      scores[i] = std::min(std::max(p, 1e-7), 1 - 1e-7);
+    } else {
+      scores[i] = d;
+    }
+  }
+}
+
+bool SvmEngine::isHuman(double score, double human_probability) const {
+  if(probability_) {
+    return score >= human_probability;
+  }
+  return (score > 0 ? label_[0] : label_[1]) == 1;
+}
@@ -0,0 +1,35 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "svm_model.h"
+
+#include <libsvm/svm.h>
+
+SvmModel::SvmModel() : model_(NULL), probability_(false) {}
+
+SvmModel::~SvmModel() {
+  if(model_ != NULL) {
+    svm_free_and_destroy_model(&model_);
+  }
+}
+
+SvmModel::Status SvmModel::load(const std::string &model_file_name, const std::string &range_file_name) {
+  if(model_ != NULL) {
+    svm_free_and_destroy_model(&model_);
+  }
+  if(engine_.map(model_file_name)) {
+    probability_ = engine_.isProbabilityModel();
+    return LOADED;
+  }
+  if((model_ = svm_load_model(model_file_name.c_str())) == NULL) {
+    return MODEL_FAILED;
+  }
+  probability_ = svm_check_probability_model(model_) ? true : false;
+  // falls back to libsvm if the model is not supported, c.f. SvmEngine::ready()
+  engine_.init(model_);
+  return engine_.loadRange(range_file_name) ? LOADED : RANGE_FAILED;
+}
@@ -0,0 +1,109 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "voxel_decimation.h"
+
+#include <algorithm>
+
+static const int THREADS = 256;
+static const unsigned long long EMPTY = ~0ull;
+
+/* 21 bits per axis, about 200 km of 0.1 m voxels around the origin. */
+__device__ unsigned long long voxelKey(float4 p, float inv_leaf) {
+  const int bias = 1 << 20;
+  int ix = min(max((int)floorf(p.x * inv_leaf) + bias, 0), 2 * bias - 1);
+  int iy = min(max((int)floorf(p.y * inv_leaf) + bias, 0), 2 * bias - 1);
+  int iz = min(max((int)floorf(p.z * inv_leaf) + bias, 0), 2 * bias - 1);
+  return (unsigned long long)ix | ((unsigned long long)iy << 21) | ((unsigned long long)iz << 42);
+}
+
+__global__ void voxelInsertKernel(const float4 *points, unsigned int n, float inv_leaf,
+				  unsigned long long *keys, float4 *sums, unsigned int mask) {
+  unsigned int idx = blockIdx.x * blockDim.x + threadIdx.x;
+  if(idx >= n) {
+    return;
+  }
+  float4 p = points[idx];
+  if(!isfinite(p.x) || !isfinite(p.y) || !isfinite(p.z)) {
+    return;
+  }
+  unsigned long long key = voxelKey(p, inv_leaf);
+  unsigned int slot = (unsigned int)((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+  // the table holds twice the points, a free or matching slot is always found
+  while(true) {
+    unsigned long long prev = atomicCAS(&keys[slot], EMPTY, key);
+    if(prev == EMPTY || prev == key) {
+      break;
+    }
+    slot = (slot + 1) & mask;
+  }
+  atomicAdd(&sums[slot].x, p.x);
+  atomicAdd(&sums[slot].y, p.y);
+  atomicAdd(&sums[slot].z, p.z);
+  atomicAdd(&sums[slot].w, 1.0f);
+}
+
+__global__ void voxelCompactKernel(const unsigned long long *keys, const float4 *sums, unsigned int slots,
+				   float4 *points, unsigned int *count) {
+  unsigned int idx = blockIdx.x * blockDim.x + threadIdx.x;
+  if(idx >= slots || keys[idx] == EMPTY) {
+    return;
+  }
+  float4 s = sums[idx];
+  points[atomicAdd(count, 1)] = make_float4(s.x / s.w, s.y / s.w, s.z / s.w, 1.0f);
+}
+
+VoxelDecimation::VoxelDecimation(cudaStream_t stream)
+  : stream_(stream), keys_(NULL), sums_(NULL), slots_(0), points_(NULL), capacity_(0), count_(NULL) {
+  cudaMallocManaged(&count_, sizeof(unsigned int));
+  *count_ = 0;
+}
+
+VoxelDecimation::~VoxelDecimation() {
+  cudaStreamSynchronize(stream_);
+  if(keys_) cudaFree(keys_);
+  if(sums_) cudaFree(sums_);
+  if(points_) cudaFree(points_);
+  if(count_) cudaFree(count_);
+}
+
+void VoxelDecimation::reserve(unsigned int n) {
+  if(n <= capacity_) {
+    return;
+  }
+  cudaStreamSynchronize(stream_);
+  if(keys_) cudaFree(keys_);
+  if(sums_) cudaFree(sums_);
+  if(points_) cudaFree(points_);
+  capacity_ = std::max(n, capacity_ * 2);
+  slots_ = 1;
+  while(slots_ < 2 * capacity_) {
+    slots_ <<= 1;
+  }
+  cudaMalloc(&keys_, sizeof(unsigned long long) * slots_);
+  cudaMalloc(&sums_, sizeof(float4) * slots_);
+  cudaMallocManaged(&points_, sizeof(float) * 4 * capacity_);
+}
+
+void VoxelDecimation::launch(const float *points, unsigned int n, float leaf_size) {
+  reserve(n);
+  cudaMemsetAsync(count_, 0, sizeof(unsigned int), stream_);
+  if(n == 0) {
+    return;
+  }
+  // the slots the n points can reach: twice n, rounded up to a power of two
+  unsigned int slots = 1;
+  while(slots < 2 * n) {
+    slots <<= 1;
+  }
+  cudaMemsetAsync(keys_, 0xff, sizeof(unsigned long long) * slots, stream_);
+  cudaMemsetAsync(sums_, 0, sizeof(float4) * slots, stream_);
+  voxelInsertKernel<<<(n + THREADS - 1) / THREADS, THREADS, 0, stream_>>>(reinterpret_cast<const float4 *>(points), n, 1.0f / leaf_size,
+									   keys_, sums_, slots - 1);
+  voxelCompactKernel<<<(slots + THREADS - 1) / THREADS, THREADS, 0, stream_>>>(keys_, sums_, slots,
+									       reinterpret_cast<float4 *>(points_), count_);
+}
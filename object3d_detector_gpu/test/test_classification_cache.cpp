@@ -0,0 +1,103 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+// Google Test
+#include <gtest/gtest.h>
+
+#include "classification_cache.h"
+
+namespace {
+
+ClassificationCache::Track track(long id, float x, float y, float vx, float probability) {
+  ClassificationCache::Track t = {id, x, y, vx, 0.0f, probability};
+  return t;
+}
+
+ClassificationCache::Params params(int reverify_frames) {
+  ClassificationCache::Params p;
+  p.enabled = true;
+  p.min_probability = 0.9;
+  p.match_distance = 0.3;
+  p.reverify_frames = reverify_frames;
+  return p;
+}
+
+} // namespace
+
+TEST(ClassificationCache, MatchesConfidentTracksOnce) {
+  ClassificationCache cache;
+  cache.configure(params(10));
+  std::vector<ClassificationCache::Track> tracks;
+  tracks.push_back(track(1, 2.0, 0.0, 1.0, 0.95));
+  tracks.push_back(track(2, 5.0, 0.0, 0.0, 0.6));
+  cache.setTracks(tracks, 10.0);
+  cache.beginFrame(10.5);
+
+  bool reuse;
+  // predicted to x = 2.5
+  EXPECT_EQ(-1, cache.match(Eigen::Vector4f(2.0, 0.0, 0.0, 1.0), &reuse));
+  EXPECT_FALSE(reuse);
+  EXPECT_EQ(1, cache.match(Eigen::Vector4f(2.6, 0.1, 0.0, 1.0), &reuse));
+  EXPECT_TRUE(reuse);
+  // taken in this frame
+  EXPECT_EQ(-1, cache.match(Eigen::Vector4f(2.5, 0.0, 0.0, 1.0), &reuse));
+  // not confident
+  EXPECT_EQ(-1, cache.match(Eigen::Vector4f(5.0, 0.0, 0.0, 1.0), &reuse));
+  EXPECT_EQ(1u, cache.matched());
+  EXPECT_EQ(1u, cache.reused());
+}
+
+TEST(ClassificationCache, ReverifiesAndRejects) {
+  ClassificationCache cache;
+  cache.configure(params(2));
+  std::vector<ClassificationCache::Track> tracks(1, track(7, 1.0, 1.0, 0.0, 0.99));
+  cache.setTracks(tracks, 0.0);
+  Eigen::Vector4f centroid(1.0, 1.0, 0.0, 1.0);
+
+  bool reuse[4];
+  for(int frame = 0; frame < 3; frame++) {
+    cache.beginFrame(frame * 0.1);
+    EXPECT_EQ(7, cache.match(centroid, &reuse[frame]));
+  }
+  EXPECT_TRUE(reuse[0]);
+  EXPECT_TRUE(reuse[1]);
+  EXPECT_FALSE(reuse[2]);
+
+  // the SVM disagrees, classified every frame until it agrees again
+  cache.verified(7, false);
+  cache.beginFrame(0.3);
+  cache.match(centroid, &reuse[3]);
+  EXPECT_FALSE(reuse[3]);
+  EXPECT_EQ(1u, cache.rejections());
+  cache.verified(7, true);
+  cache.beginFrame(0.4);
+  cache.match(centroid, &reuse[3]);
+  EXPECT_TRUE(reuse[3]);
+
+  // a dropped track starts over
+  cache.verified(7, false);
+  cache.setTracks(std::vector<ClassificationCache::Track>(), 0.5);
+  cache.setTracks(tracks, 0.6);
+  cache.beginFrame(0.6);
+  cache.match(centroid, &reuse[3]);
+  EXPECT_TRUE(reuse[3]);
+}
+
+TEST(ClassificationCache, Disabled) {
+  ClassificationCache cache;
+  std::vector<ClassificationCache::Track> tracks(1, track(1, 0.0, 0.0, 0.0, 1.0));
+  cache.setTracks(tracks, 0.0);
+  cache.beginFrame(0.0);
+  bool reuse;
+  EXPECT_EQ(-1, cache.match(Eigen::Vector4f(0.0, 0.0, 0.0, 1.0), &reuse));
+  EXPECT_FALSE(reuse);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
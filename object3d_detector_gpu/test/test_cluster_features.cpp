@@ -0,0 +1,172 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+// Google Test
+#include <gtest/gtest.h>
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/common/common.h>
+#include <pcl/common/centroid.h>
+#include <pcl/common/pca.h>
+
+// c++
+#include <random>
+
+#include "cluster_features.h"
+
+/* The PCL based slice feature the detector shipped with. */
+void computeSlicePCL(pcl::PointCloud<pcl::PointXYZ>::Ptr pc, int n, double *slice) {
+  for(int i = 0; i < 20; i++) {
+    slice[i] = 0;
+  }
+
+  Eigen::Vector4f pc_min, pc_max;
+  pcl::getMinMax3D(*pc, pc_min, pc_max);
+
+  pcl::PointCloud<pcl::PointXYZ>::Ptr blocks[n];
+  double itv = (pc_max[2] - pc_min[2]) / n;
+
+  if(itv > 0) {
+    for(int i = 0; i < n; i++) {
+      blocks[i].reset(new pcl::PointCloud<pcl::PointXYZ>);
+    }
+    for(unsigned int i = 0, j; i < pc->size(); i++) {
+      j = std::min((n-1), (int)((pc->points[i].z - pc_min[2]) / itv));
+      blocks[j]->points.push_back(pc->points[i]);
+    }
+
+    Eigen::Vector4f block_min, block_max;
+    for(int i = 0; i < n; i++) {
+      if(blocks[i]->size() > 2) { // At least 3 points to perform pca.
+	pcl::PCA<pcl::PointXYZ> pca;
+	pcl::PointCloud<pcl::PointXYZ>::Ptr block_projected(new pcl::PointCloud<pcl::PointXYZ>);
+	pca.setInputCloud(blocks[i]);
+	pca.project(*blocks[i], *block_projected);
+	pcl::getMinMax3D(*block_projected, block_min, block_max);
+      } else {
+	block_min.setZero();
+	block_max.setZero();
+      }
+      slice[i*2] = block_max[0] - block_min[0];
+      slice[i*2+1] = block_max[1] - block_min[1];
+    }
+  }
+}
+
+/* A pedestrian-like cluster: elliptic cross-section, upright, at a random place. */
+pcl::PointCloud<pcl::PointXYZ>::Ptr randomCluster(std::mt19937 &gen) {
+  std::normal_distribution<float> normal(0.0, 1.0);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  int size = 10 + gen() % 1500;
+  float sx = 0.1 + 0.3 * uniform(gen), sy = 0.05 + 0.1 * uniform(gen);
+  float cx = 20.0 * uniform(gen) - 10.0, cy = 20.0 * uniform(gen) - 10.0;
+  float yaw = 3.14159 * uniform(gen);
+
+  pcl::PointCloud<pcl::PointXYZ>::Ptr pc(new pcl::PointCloud<pcl::PointXYZ>);
+  for(int i = 0; i < size; i++) {
+    float u = sx * normal(gen), v = sy * normal(gen);
+    pc->points.push_back(pcl::PointXYZ(cx + u * cos(yaw) - v * sin(yaw), cy + u * sin(yaw) + v * cos(yaw), -0.8 + 1.8 * uniform(gen)));
+  }
+  pc->width = pc->points.size();
+  pc->height = 1;
+  pc->is_dense = true;
+  return pc;
+}
+
+ClusterView toView(pcl::PointCloud<pcl::PointXYZ>::Ptr pc) {
+  // pcl::PointXYZ is 4 floats wide, exactly the clustering output layout
+  ClusterView view = {reinterpret_cast<const float *>(pc->points.data()), (unsigned int)pc->size()};
+  return view;
+}
+
+TEST(ClusterFeatures, SliceMatchesPCL) {
+  std::mt19937 gen(42);
+  for(int t = 0; t < 500; t++) {
+    pcl::PointCloud<pcl::PointXYZ>::Ptr pc = randomCluster(gen);
+    double expected[20], actual[20];
+    computeSlicePCL(pc, 10, expected);
+    computeSlice(toView(pc), 10, actual);
+    for(int k = 0; k < 20; k++) {
+      EXPECT_NEAR(expected[k], actual[k], 1e-3) << "cluster " << t << ", slice " << k;
+    }
+  }
+}
+
+TEST(ClusterFeatures, SliceOfFlatCluster) {
+  pcl::PointCloud<pcl::PointXYZ>::Ptr pc(new pcl::PointCloud<pcl::PointXYZ>);
+  for(int i = 0; i < 50; i++) {
+    pc->points.push_back(pcl::PointXYZ(0.01 * i, 0.02 * i, 0.5));
+  }
+  double slice[20];
+  computeSlice(toView(pc), 10, slice);
+  for(int k = 0; k < 20; k++) {
+    EXPECT_EQ(0.0, slice[k]);
+  }
+}
+
+TEST(ClusterFeatures, ProjectedCovarianceMatchesPCL) {
+  std::mt19937 gen(7);
+  std::vector<float> projected;
+  for(int t = 0; t < 100; t++) {
+    pcl::PointCloud<pcl::PointXYZ>::Ptr pc = randomCluster(gen);
+
+    Eigen::Vector4f centroid, expected_centroid;
+    computeCentroid(toView(pc), centroid);
+    pcl::compute3DCentroid(*pc, expected_centroid);
+    EXPECT_TRUE(centroid.isApprox(expected_centroid, 1e-5));
+
+    pcl::PCA<pcl::PointXYZ> pca;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr pc_projected(new pcl::PointCloud<pcl::PointXYZ>);
+    pca.setInputCloud(pc);
+    pca.project(*pc, *pc_projected);
+    Eigen::Matrix3f expected, actual;
+    pcl::computeCovarianceMatrixNormalized(*pc_projected, expected_centroid, expected);
+    computeCovarianceMatrixNormalized(projectPCA(toView(pc), projected), centroid, actual);
+    // off-diagonal terms only depend on the centroid, the diagonal on the eigenvalues
+    EXPECT_TRUE(actual.isApprox(expected, 1e-3)) << expected << "\n\n" << actual;
+  }
+}
+
+TEST(ClusterFeatures, HistogramIsNormalized) {
+  std::mt19937 gen(3);
+  double histogram[98];
+  for(int t = 0; t < 50; t++) {
+    pcl::PointCloud<pcl::PointXYZ>::Ptr pc = randomCluster(gen);
+    computeHistogramNormalized(toView(pc), 7, 14, histogram);
+    double sum = 0;
+    for(int k = 0; k < 98; k++) {
+      sum += histogram[k];
+    }
+    EXPECT_NEAR(1.0, sum, 1e-9);
+  }
+}
+
+TEST(ClusterFeatures, SaveFeatureLayout) {
+  Feature f;
+  f.number_points = 7;
+  f.min_distance = 2.5;
+  f.covariance_3d.setConstant(3);
+  f.moment_3d.setConstant(4);
+  for(int k = 0; k < 20; k++) {
+    f.slice[k] = 100 + k;
+  }
+  double x[FEATURE_SIZE];
+  saveFeature(f, x);
+  EXPECT_EQ(7.0, x[feature_layout::offset(feature_layout::F1_NUMBER_POINTS)]);
+  EXPECT_EQ(2.5, x[feature_layout::offset(feature_layout::F2_MIN_DISTANCE)]);
+  EXPECT_EQ(119.0, x[FEATURE_SIZE-1]);
+  if(feature_layout::baseline()) {
+    EXPECT_EQ(34, FEATURE_SIZE);
+    EXPECT_EQ(100.0, x[14]);
+  }
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
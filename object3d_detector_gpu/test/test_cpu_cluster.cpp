@@ -0,0 +1,125 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+// Google Test
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+#include "cpu_cluster.h"
+
+namespace {
+
+void addPoint(std::vector<float> &cloud, float x, float y, float z) {
+  cloud.push_back(x);
+  cloud.push_back(y);
+  cloud.push_back(z);
+  cloud.push_back(1.0f);
+}
+
+/* A column of points every 5 cm, as a lidar sees a person. */
+void addColumn(std::vector<float> &cloud, float x, float y, int points) {
+  for(int k = 0; k < points; k++) {
+    addPoint(cloud, x + 0.01f * (k % 3), y, -0.7f + 0.05f * k);
+  }
+}
+
+extractClusterParam_t param(float voxel) {
+  extractClusterParam_t p;
+  p.minClusterSize = 5;
+  p.maxClusterSize = 1000;
+  p.voxelX = p.voxelY = p.voxelZ = voxel;
+  p.countThreshold = 0;
+  return p;
+}
+
+} // namespace
+
+TEST(CpuExtractCluster, SeparatesObjects) {
+  std::vector<float> cloud;
+  addColumn(cloud, 2.0f, 0.0f, 30);
+  addPoint(cloud, 0.0f, 5.0f, 0.0f);  // too small
+  addColumn(cloud, 2.05f, 0.95f, 20);
+  addPoint(cloud, NAN, 0.0f, 0.0f);
+  addColumn(cloud, -3.0f, 1.0f, 10);
+
+  CpuExtractCluster extractor;
+  extractor.set(param(0.1f));
+  int n = cloud.size() / 4;
+  std::vector<float> output(cloud.size());
+  std::vector<unsigned int> index(n + 1);
+  extractor.extract(cloud.data(), n, output.data(), index.data());
+
+  ASSERT_EQ(3u, index[0]);
+  // in the order of their lowest voxels, by z, y then x
+  EXPECT_EQ(30u, index[1]);
+  EXPECT_EQ(20u, index[2]);
+  EXPECT_EQ(10u, index[3]);
+  for(unsigned int k = index[1] + index[2]; k < 60; k++) {
+    EXPECT_NEAR(-3.0f, output[4 * k], 0.03f);
+  }
+}
+
+TEST(CpuExtractCluster, JoinsTouchingVoxels) {
+  std::vector<float> cloud;
+  addColumn(cloud, 2.0f, 0.0f, 30);
+  addColumn(cloud, 2.0f, 0.15f, 30);
+
+  CpuExtractCluster extractor;
+  int n = cloud.size() / 4;
+  std::vector<float> output(cloud.size());
+  std::vector<unsigned int> index(n + 1);
+
+  extractor.set(param(0.1f));
+  extractor.extract(cloud.data(), n, output.data(), index.data());
+  EXPECT_EQ(1u, index[0]);
+  EXPECT_EQ(60u, index[1]);
+
+  extractor.set(param(0.05f));
+  extractor.extract(cloud.data(), n, output.data(), index.data());
+  EXPECT_EQ(2u, index[0]);
+
+  // 2 points at most in the voxels of 5 cm
+  extractClusterParam_t p = param(0.05f);
+  p.countThreshold = 2;
+  extractor.set(p);
+  extractor.extract(cloud.data(), n, output.data(), index.data());
+  EXPECT_EQ(0u, index[0]);
+
+  p = param(0.1f);
+  p.maxClusterSize = 50;
+  extractor.set(p);
+  extractor.extract(cloud.data(), n, output.data(), index.data());
+  EXPECT_EQ(0u, index[0]);
+}
+
+TEST(CpuExtractCluster, IsDeterministic) {
+  std::vector<float> cloud;
+  for(int k = 0; k < 2000; k++) {
+    addPoint(cloud, std::fmod(k * 0.37f, 10.0f), std::fmod(k * 0.53f, 10.0f), std::fmod(k * 0.11f, 1.5f));
+  }
+  int n = cloud.size() / 4;
+  std::vector<float> first(cloud.size()), second(cloud.size());
+  std::vector<unsigned int> index(n + 1), index2(n + 1);
+  CpuExtractCluster extractor;
+  extractClusterParam_t p = param(0.3f);
+  p.maxClusterSize = 100000;
+  extractor.set(p);
+  extractor.extract(cloud.data(), n, first.data(), index.data());
+  extractor.extract(cloud.data(), n, second.data(), index2.data());
+  ASSERT_EQ(index[0], index2[0]);
+  EXPECT_GT(index[0], 0u);
+  for(unsigned int c = 1; c <= index[0]; c++) {
+    EXPECT_EQ(index[c], index2[c]);
+  }
+  EXPECT_EQ(first, second);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
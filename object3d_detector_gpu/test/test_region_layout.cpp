@@ -0,0 +1,107 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+// Google Test
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+#include "region_layout.h"
+#include "region_binning.h"
+
+namespace {
+
+const int regions = 14;
+const int zones[regions] = {2,3,3,3,3,3,3,2,3,3,3,3,3,3};
+
+/* A scan of rings on the floor, as a lidar sees it: points at every 0.1 m of
+ * range, their number falling with the square of the range past 2 m. */
+std::vector<float> floorScan() {
+  std::vector<float> cloud;
+  for(int k = 1; k < 400; k++) {
+    float r = 0.1f * k;
+    int points = (int)(2000.0f / std::max(r * r, 4.0f));
+    for(int i = 0; i < points; i++) {
+      float a = 2.0f * M_PI * i / points;
+      cloud.push_back(r * cosf(a));
+      cloud.push_back(r * sinf(a));
+      cloud.push_back(0.0f);
+      cloud.push_back(1.0f);
+    }
+  }
+  return cloud;
+}
+
+} // namespace
+
+TEST(RegionLayout, FixedZones) {
+  RegionLayout layout(regions, zones);
+  ASSERT_EQ(regions, layout.regions());
+  EXPECT_DOUBLE_EQ(0.0, layout.bounds()[0]);
+  EXPECT_DOUBLE_EQ(2.0, layout.bounds()[1]);
+  EXPECT_DOUBLE_EQ(20.0, layout.bounds()[7]);
+  EXPECT_DOUBLE_EQ(40.0, layout.bounds()[regions]);
+  EXPECT_NEAR(0.1, layout.tolerance(0), 1e-9);
+  EXPECT_NEAR(1.4, layout.tolerance(regions - 1), 1e-9);
+  EXPECT_EQ(7, layout.regionsWithin(20.0));
+  EXPECT_EQ(1, layout.regionsWithin(0.0));
+  EXPECT_FALSE(layout.balance(0.5));
+  EXPECT_DOUBLE_EQ(2.0, layout.bounds()[1]);
+}
+
+TEST(RegionLayout, BalancedPoints) {
+  std::vector<float> cloud = floorScan();
+  RegionLayout layout(regions, zones);
+  layout.add(cloud.data(), 4, cloud.size() / 4);
+  ASSERT_TRUE(layout.balance(0.2));
+  EXPECT_DOUBLE_EQ(40.0, layout.bounds()[regions]);
+  for(int j = 0; j < regions; j++) {
+    EXPECT_GE(layout.bounds()[j+1] - layout.bounds()[j], 0.2 - 1e-9);
+    // the tolerance of the fixed ring at the middle of the balanced one
+    EXPECT_DOUBLE_EQ(layout.fixedTolerance(0.5 * (layout.bounds()[j] + layout.bounds()[j+1])), layout.tolerance(j));
+  }
+
+  RegionBinning fixed(regions, zones), balanced(regions, zones);
+  fixed.process(cloud.data(), 4, cloud.size() / 4);
+  balanced.setBounds(layout.bounds());
+  balanced.process(cloud.data(), 4, cloud.size() / 4);
+  unsigned int fixed_max = 0, balanced_max = 0, total = 0;
+  for(int j = 0; j < regions; j++) {
+    fixed_max = std::max(fixed_max, fixed.count(j));
+    balanced_max = std::max(balanced_max, balanced.count(j));
+    total += balanced.count(j);
+  }
+  EXPECT_EQ(cloud.size() / 4, total);
+  // the largest ring about an even share, far below the first fixed one
+  EXPECT_LT(balanced_max, 1.5 * total / regions);
+  EXPECT_GT(fixed_max, 2 * balanced_max);
+}
+
+TEST(RegionLayout, MinimumWidth) {
+  // all points within a meter, the rings kept apart by their minimum width
+  std::vector<float> cloud;
+  for(int i = 0; i < 1000; i++) {
+    cloud.push_back(0.2f + 0.0008f * i);
+    cloud.push_back(0.0f);
+    cloud.push_back(0.0f);
+  }
+  RegionLayout layout(regions, zones);
+  layout.add(cloud.data(), 3, cloud.size() / 3);
+  ASSERT_TRUE(layout.balance(1.0));
+  for(int j = 0; j < regions; j++) {
+    EXPECT_GE(layout.bounds()[j+1] - layout.bounds()[j], 1.0 - 1e-9);
+  }
+  EXPECT_DOUBLE_EQ(40.0, layout.bounds()[regions]);
+  // the degraded range of 20 m holds more rings than the fixed 7
+  EXPECT_GT(layout.regionsWithin(20.0), 7);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,113 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+// Google Test
+#include <gtest/gtest.h>
+
+// c++
+#include <cstdio>
+#include <random>
+#include <unistd.h>
+
+#include <libsvm/svm.h>
+#include "svm_engine.h"
+
+/* A small two-class RBF model, built the way svm_load_model lays it out. */
+class SvmEngineTest : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<double> value(-1.0, 1.0);
+    const int l = 5;
+    nodes_.resize(l * (SvmEngine::FEATURE_SIZE + 1));
+    sv_.resize(l);
+    coef_.resize(l);
+    for(int i = 0; i < l; i++) {
+      sv_[i] = &nodes_[i * (SvmEngine::FEATURE_SIZE + 1)];
+      for(int k = 0; k < SvmEngine::FEATURE_SIZE; k++) {
+	sv_[i][k].index = k + 1;
+	sv_[i][k].value = value(gen);
+      }
+      sv_[i][SvmEngine::FEATURE_SIZE].index = -1;
+      coef_[i] = i % 2 ? -value(gen) : value(gen);
+    }
+    sv_coef_ = &coef_[0];
+    rho_ = 0.1;
+    label_[0] = 1;
+    label_[1] = -1;
+    
+    model_ = svm_model();
+    model_.param.svm_type = C_SVC;
+    model_.param.kernel_type = RBF;
+    model_.param.gamma = 0.05;
+    model_.nr_class = 2;
+    model_.l = l;
+    model_.SV = &sv_[0];
+    model_.sv_coef = &sv_coef_;
+    model_.rho = &rho_;
+    model_.label = label_;
+    
+    x_.resize(8, SvmEngine::FEATURE_SIZE);
+    for(int r = 0; r < x_.rows(); r++) {
+      for(int k = 0; k < SvmEngine::FEATURE_SIZE; k++) {
+	x_(r, k) = value(gen);
+      }
+    }
+    file_name_ = "/tmp/test_svm_engine_" + std::to_string(getpid()) + ".svmb";
+  }
+  
+  virtual void TearDown() {
+    remove(file_name_.c_str());
+  }
+  
+  std::vector<svm_node> nodes_;
+  std::vector<svm_node *> sv_;
+  std::vector<double> coef_;
+  double *sv_coef_;
+  double rho_;
+  int label_[2];
+  svm_model model_;
+  SvmEngine::Matrix x_;
+  std::string file_name_;
+};
+
+TEST_F(SvmEngineTest, MappedModelPredictsTheSame) {
+  SvmEngine engine;
+  ASSERT_TRUE(engine.init(&model_));
+  ASSERT_TRUE(engine.save(file_name_));
+  
+  SvmEngine mapped;
+  ASSERT_TRUE(mapped.map(file_name_));
+  EXPECT_TRUE(mapped.ready());
+  EXPECT_EQ(engine.supportVectors(), mapped.supportVectors());
+  EXPECT_EQ(engine.isProbabilityModel(), mapped.isProbabilityModel());
+  
+  std::vector<double> expected, scores;
+  engine.predict(x_, expected);
+  mapped.predict(x_, scores);
+  ASSERT_EQ(expected.size(), scores.size());
+  for(size_t i = 0; i < scores.size(); i++) {
+    EXPECT_EQ(expected[i], scores[i]) << "row " << i;
+  }
+}
+
+TEST_F(SvmEngineTest, MapRejectsOtherFiles) {
+  FILE *file = fopen(file_name_.c_str(), "w");
+  ASSERT_TRUE(file != NULL);
+  fprintf(file, "svm_type c_svc\nkernel_type rbf\ngamma 0.05\nnr_class 2\ntotal_sv 0\nrho 0.1\nlabel 1 -1\nnr_sv 0 0\nSV\n");
+  fclose(file);
+  
+  SvmEngine engine;
+  EXPECT_FALSE(engine.map(file_name_));
+  EXPECT_FALSE(engine.ready());
+  EXPECT_FALSE(engine.map("/nonexistent/model.svmb"));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,68 @@
+// Copyright (C) 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PERCEPTION_TRACE_TRACE_H
+#define PERCEPTION_TRACE_TRACE_H
+
+#include <ros/time.h>
+
+// The hops of the sensor data through the perception nodes, each with the
+// origin of its data: the stamp of the lidar scan or of the camera exposure
+// it came from. With PERCEPTION_TRACE set to a directory, every process
+// writes its hops there as a Chrome trace (<node>_<pid>.json), every hop a
+// slice linked to the other hops of its origin, c.f. merge_traces.py.
+// Otherwise every call returns right away.
+//
+// A hop is appended to a ring of the calling thread only, without a lock,
+// and the rings are written out by a thread of the tracer; the hops of a
+// full ring are dropped.
+namespace perception_trace {
+
+// Whether the hops are traced.
+bool enabled();
+
+// The hop of the data of origin from begin to end (now by default). hop is
+// kept as is: a literal.
+void record(const char *hop, const ros::Time &origin, const ros::Time &begin);
+void record(const char *hop, const ros::Time &origin, const ros::Time &begin, const ros::Time &end);
+
+// Messages of the process stamped otherwise than their data, e.g. by the
+// time of their detection: stamp is of the origin origin.
+void link(const ros::Time &stamp, const ros::Time &origin);
+
+// The origin of a message of the process stamped stamp, linked by link() as
+// long as it is one of the last few, or stamp itself.
+ros::Time origin(const ros::Time &stamp);
+
+// A hop from the construction to the destruction.
+class ScopedHop {
+public:
+  ScopedHop(const char *hop, const ros::Time &origin) :
+    hop_(hop), origin_(origin), begin_(enabled() ? ros::Time::now() : ros::Time()) {}
+  ~ScopedHop() {
+    if(!begin_.isZero()) {
+      record(hop_, origin_, begin_);
+    }
+  }
+
+private:
+  const char *hop_;
+  ros::Time origin_;
+  ros::Time begin_;
+};
+
+} // namespace perception_trace
+
+#endif // PERCEPTION_TRACE_TRACE_H
@@ -0,0 +1,50 @@
+#!/usr/bin/env python
+
+# Merges the traces of the processes of a run (PERCEPTION_TRACE) into one
+# file for Perfetto or chrome://tracing, and prints the sensor-to-track age
+# of every hop: the hops of one origin are linked across the processes, their
+# timestamps all being of the ROS clock.
+#
+#   rosrun perception_trace merge_traces.py merged.json /tmp/trace/*.json
+
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        text = f.read().rstrip()
+    # a trace still being written has no closing bracket
+    if not text.endswith(']'):
+        text = text.rstrip(',') + ']'
+    return json.loads(text)
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(p * len(values)))]
+
+
+def main(argv):
+    if len(argv) < 3:
+        sys.stderr.write('usage: merge_traces.py OUTPUT TRACE...\n')
+        return 1
+    events = []
+    for path in argv[2:]:
+        events.extend(load(path))
+    with open(argv[1], 'w') as f:
+        json.dump(events, f)
+
+    ages = {}
+    for e in events:
+        if e.get('ph') == 'X':
+            ages.setdefault(e['name'], []).append(e['args']['age_ms'])
+    print('%-40s %8s %10s %10s %10s' % ('hop', 'count', 'p50 ms', 'p90 ms', 'max ms'))
+    for hop in sorted(ages, key=lambda h: percentile(ages[h], 0.5)):
+        a = ages[hop]
+        print('%-40s %8d %10.2f %10.2f %10.2f' % (hop, len(a), percentile(a, 0.5), percentile(a, 0.9), max(a)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,257 @@
+// Copyright (C) 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "perception_trace/trace.h"
+
+#include <ros/this_node.h>
+#include <ros/console.h>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace perception_trace {
+
+namespace {
+
+const size_t RING_SIZE = 4096;   // hops per thread between two writes
+const size_t LINK_SIZE = 1024;   // messages whose origin is kept
+const int WRITE_PERIOD_MS = 200;
+
+struct Hop {
+  const char *hop;
+  uint64_t origin, begin, end; // ns
+};
+
+// The hops of one thread: written by it, read by the writer thread.
+struct Ring {
+  explicit Ring(long tid) : hops(RING_SIZE), head(0), tail(0), dropped(0), tid(tid) {}
+  std::vector<Hop> hops;
+  std::atomic<size_t> head, tail; // counts of the hops recorded and written
+  std::atomic<unsigned long> dropped;
+  long tid;
+};
+
+struct Link {
+  Link() : seq(0), stamp(0), origin(0) {}
+  std::atomic<unsigned> seq; // odd while written
+  std::atomic<uint64_t> stamp, origin;
+};
+
+class Tracer {
+public:
+  static Tracer &instance() {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  bool enabled() const { return enabled_; }
+
+  void record(const char *hop, uint64_t origin, uint64_t begin, uint64_t end) {
+    Ring &ring = threadRing();
+    size_t head = ring.head.load(std::memory_order_relaxed);
+    if(head - ring.tail.load(std::memory_order_acquire) >= ring.hops.size()) {
+      ring.dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    Hop &h = ring.hops[head % ring.hops.size()];
+    h.hop = hop;
+    h.origin = origin;
+    h.begin = begin;
+    h.end = end;
+    ring.head.store(head + 1, std::memory_order_release);
+  }
+
+  // A slot per stamp, the last message of the slot wins. The slot is a
+  // seqlock: a reader retries nothing, it misses a slot being written, and
+  // of two threads writing the same slot one gives up its link.
+  void link(uint64_t stamp, uint64_t origin) {
+    Link &l = links_[slot(stamp)];
+    unsigned seq = l.seq.load(std::memory_order_relaxed);
+    if((seq & 1) || !l.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) {
+      return;
+    }
+    l.stamp.store(stamp, std::memory_order_relaxed);
+    l.origin.store(origin, std::memory_order_relaxed);
+    l.seq.store(seq + 2, std::memory_order_release);
+  }
+
+  uint64_t origin(uint64_t stamp) {
+    const Link &l = links_[slot(stamp)];
+    unsigned seq = l.seq.load(std::memory_order_acquire);
+    uint64_t linked = l.stamp.load(std::memory_order_relaxed);
+    uint64_t origin = l.origin.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(!(seq & 1) && linked == stamp && l.seq.load(std::memory_order_relaxed) == seq) {
+      return origin;
+    }
+    return stamp;
+  }
+
+private:
+  Tracer() : enabled_(false), file_(NULL), links_(LINK_SIZE), stop_(false) {
+    const char *dir = getenv("PERCEPTION_TRACE");
+    if(!dir || !*dir) {
+      return;
+    }
+    std::string node = ros::this_node::getName();
+    std::string name = node.substr(node.find_first_not_of('/') == std::string::npos ? node.size() : node.find_first_not_of('/'));
+    for(size_t i = 0; i < name.size(); i++) {
+      if(name[i] == '/') {
+        name[i] = '_';
+      }
+    }
+    std::string path = std::string(dir) + "/" + (name.empty() ? "trace" : name) + "_" + std::to_string(getpid()) + ".json";
+    file_ = fopen(path.c_str(), "w");
+    if(!file_) {
+      ROS_ERROR("[perception_trace] Can not open the trace '%s', nothing is traced.", path.c_str());
+      return;
+    }
+    // the JSON array of Chrome traces may end without its ']', the file is valid at any time
+    fprintf(file_, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}", getpid(), node.c_str());
+    fflush(file_);
+    ROS_INFO("[perception_trace] Tracing into '%s'.", path.c_str());
+    enabled_ = true;
+    writer_ = std::thread(&Tracer::writerThread, this);
+  }
+
+  ~Tracer() {
+    if(!enabled_) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    stop_condition_.notify_one();
+    writer_.join();
+    write();
+    fprintf(file_, "\n]\n");
+    fclose(file_);
+  }
+
+  static size_t slot(uint64_t stamp) {
+    return (stamp ^ (stamp >> 17) ^ (stamp >> 31)) % LINK_SIZE;
+  }
+
+  // The ring of the calling thread, made at its first hop.
+  Ring &threadRing() {
+    thread_local Ring *ring = NULL;
+    if(!ring) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      rings_.emplace_back(new Ring(syscall(SYS_gettid)));
+      ring = rings_.back().get();
+    }
+    return *ring;
+  }
+
+  void writerThread() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(!stop_) {
+      stop_condition_.wait_for(lock, std::chrono::milliseconds(WRITE_PERIOD_MS));
+      lock.unlock();
+      write();
+      lock.lock();
+    }
+  }
+
+  // Every hop recorded since the last time, as a slice of its thread bound to
+  // the flow of its origin, which Perfetto draws as arrows from hop to hop.
+  void write() {
+    std::vector<Ring*> rings;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for(size_t i = 0; i < rings_.size(); i++) {
+        rings.push_back(rings_[i].get());
+      }
+    }
+    for(size_t i = 0; i < rings.size(); i++) {
+      Ring &ring = *rings[i];
+      size_t tail = ring.tail.load(std::memory_order_relaxed);
+      size_t head = ring.head.load(std::memory_order_acquire);
+      for(; tail != head; tail++) {
+        const Hop &h = ring.hops[tail % ring.hops.size()];
+        fprintf(file_, ",\n{\"name\":\"%s\",\"cat\":\"perception\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f,"
+                "\"bind_id\":\"0x%llx\",\"flow_in\":true,\"flow_out\":true,\"args\":{\"origin_us\":%.3f,\"age_ms\":%.3f}}",
+                h.hop, getpid(), ring.tid, h.begin / 1e3, (h.end - h.begin) / 1e3,
+                (unsigned long long)h.origin, h.origin / 1e3, ((double)h.end - (double)h.origin) / 1e6);
+        ring.tail.store(tail + 1, std::memory_order_release);
+      }
+      unsigned long dropped = ring.dropped.exchange(0, std::memory_order_relaxed);
+      if(dropped) {
+        ROS_WARN_THROTTLE(5.0, "[perception_trace] %lu hops of thread %ld dropped, its ring was full.", dropped, ring.tid);
+      }
+    }
+    fflush(file_);
+  }
+
+  bool enabled_;
+  FILE *file_;
+  std::vector<Link> links_;
+  std::mutex mutex_; // of rings_ and stop_, never taken by a hop but the first of a thread
+  std::vector<std::unique_ptr<Ring> > rings_;
+  bool stop_;
+  std::condition_variable stop_condition_;
+  std::thread writer_;
+};
+
+} // namespace
+
+bool enabled() {
+  return Tracer::instance().enabled();
+}
+
+void record(const char *hop, const ros::Time &origin, const ros::Time &begin) {
+  Tracer &tracer = Tracer::instance();
+  if(tracer.enabled()) {
+    tracer.record(hop, origin.toNSec(), begin.toNSec(), ros::Time::now().toNSec());
+  }
+}
+
+void record(const char *hop, const ros::Time &origin, const ros::Time &begin, const ros::Time &end) {
+  Tracer &tracer = Tracer::instance();
+  if(tracer.enabled()) {
+    tracer.record(hop, origin.toNSec(), begin.toNSec(), end.toNSec());
+  }
+}
+
+void link(const ros::Time &stamp, const ros::Time &origin) {
+  Tracer &tracer = Tracer::instance();
+  if(tracer.enabled() && stamp != origin) {
+    tracer.link(stamp.toNSec(), origin.toNSec());
+  }
+}
+
+ros::Time origin(const ros::Time &stamp) {
+  Tracer &tracer = Tracer::instance();
+  if(!tracer.enabled()) {
+    return stamp;
+  }
+  ros::Time t;
+  t.fromNSec(tracer.origin(stamp.toNSec()));
+  return t;
+}
+
+} // namespace perception_trace
@@ -0,0 +1,45 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#ifndef POINT_CLOUD_POOL_CUDA_H
+#define POINT_CLOUD_POOL_CUDA_H
+
+#include <cuda_runtime.h>
+
+#include "point_cloud_pool/point_cloud_pool.h"
+
+namespace point_cloud_pool {
+
+inline bool pinCuda(void *data, size_t bytes, void **device) {
+  if(cudaHostRegister(data, bytes, cudaHostRegisterMapped) != cudaSuccess) {
+    cudaGetLastError();
+    return false;
+  }
+  if(cudaHostGetDevicePointer(device, data, 0) != cudaSuccess) {
+    cudaHostUnregister(data);
+    cudaGetLastError();
+    return false;
+  }
+  return true;
+}
+
+inline void unpinCuda(void *data) {
+  // an error if the buffer was reallocated and freed meanwhile, nothing to undo then
+  if(cudaHostUnregister(data) != cudaSuccess) {
+    cudaGetLastError();
+  }
+}
+
+// The buffers of the pool page-locked and mapped: on the Xavier, the GPU
+// reads them where the CPU wrote them, in the same DRAM.
+inline void enableCudaPinning() {
+  setPinning(&pinCuda, &unpinCuda);
+}
+
+} // namespace point_cloud_pool
+
+#endif // POINT_CLOUD_POOL_CUDA_H
@@ -0,0 +1,48 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#ifndef POINT_CLOUD_POOL_POINT_CLOUD_POOL_H
+#define POINT_CLOUD_POOL_POINT_CLOUD_POOL_H
+
+#include <stddef.h>
+
+#include <sensor_msgs/PointCloud2.h>
+
+// The clouds published by the lidar nodes of a process (a nodelet manager),
+// kept to be reused once all their subscribers released them: a cloud of
+// the same size class is written in place, without allocation or page
+// faults, whichever node published it before. The buffers are sized in
+// classes of powers of two, with an eighth of headroom at least.
+//
+// With pinning, installed by a CUDA node of the process (c.f. cuda.h), the
+// buffers are also page-locked and mapped for the GPU: a kernel reads the
+// points of a received cloud in place, c.f. devicePointer().
+namespace point_cloud_pool {
+
+// Pins the bytes of a buffer, their device address returned in device;
+// false if they can not be.
+typedef bool (*PinFunction)(void *data, size_t bytes, void **device);
+typedef void (*UnpinFunction)(void *data);
+
+// The buffers pinned from then on, those already in the pool at their next
+// acquire().
+void setPinning(PinFunction pin, UnpinFunction unpin);
+
+// A cloud nobody else holds, its data of a capacity of bytes at least. Its
+// header, fields and sizes are reset, its data is of the size and the
+// bytes of its last message, to be resized: the data must not grow beyond
+// bytes, a pinned buffer would be reallocated under the GPU.
+sensor_msgs::PointCloud2::Ptr acquire(size_t bytes);
+
+// The device address of bytes of a pinned buffer of the pool, NULL if they
+// are not in one (e.g. the cloud came through a socket). Valid while the
+// cloud of the buffer is held.
+const void *devicePointer(const void *data, size_t bytes);
+
+} // namespace point_cloud_pool
+
+#endif // POINT_CLOUD_POOL_POINT_CLOUD_POOL_H
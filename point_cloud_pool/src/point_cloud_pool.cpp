@@ -0,0 +1,156 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "point_cloud_pool/point_cloud_pool.h"
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace point_cloud_pool {
+
+namespace {
+
+// The smallest class, 64 KiB, and the largest, 2 GiB; larger clouds are not kept.
+const size_t MIN_CLASS_BYTES = 1 << 16;
+const int CLASSES = 16;
+// Clouds kept per class, those taken beyond allocated for one message.
+const size_t CLOUDS_PER_CLASS = 32;
+
+// The class of a buffer of bytes and an eighth more, CLASSES if too large.
+int sizeClass(size_t bytes) {
+  size_t wanted = bytes + bytes / 8;
+  int c = 0;
+  while(c < CLASSES && (MIN_CLASS_BYTES << c) < wanted) {
+    c++;
+  }
+  return c;
+}
+
+struct Buffer {
+  sensor_msgs::PointCloud2::Ptr cloud;
+  uint8_t *pinned;      // the data pinned, NULL if not
+  size_t pinned_bytes;
+};
+
+struct PinnedRange {
+  size_t bytes;
+  uint8_t *device;
+};
+
+class Pool {
+public:
+  // never destroyed: clouds may still be released by the nodelets, and the
+  // buffers unpinned, after the static objects of the process
+  static Pool &instance() {
+    static Pool *pool = new Pool;
+    return *pool;
+  }
+
+  void setPinning(PinFunction pin, UnpinFunction unpin) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pin_ = pin;
+    unpin_ = unpin;
+  }
+
+  sensor_msgs::PointCloud2::Ptr acquire(size_t bytes) {
+    int c = sizeClass(bytes);
+    if(c == CLASSES) {
+      sensor_msgs::PointCloud2::Ptr cloud(new sensor_msgs::PointCloud2);
+      cloud->data.reserve(bytes);
+      return cloud;
+    }
+    size_t capacity = MIN_CLASS_BYTES << c;
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Buffer> &buffers = classes_[c];
+    // held by the pool only, so no subscriber or queue of a publisher has it,
+    // and nobody can take it but through the pool
+    for(size_t i = 0; i < buffers.size(); i++) {
+      if(buffers[i].cloud.unique()) {
+        prepare(buffers[i], capacity);
+        return buffers[i].cloud;
+      }
+    }
+    Buffer buffer = {sensor_msgs::PointCloud2::Ptr(new sensor_msgs::PointCloud2), NULL, 0};
+    if(buffers.size() >= CLOUDS_PER_CLASS) {
+      buffer.cloud->data.reserve(capacity);
+      return buffer.cloud;
+    }
+    buffers.push_back(buffer);
+    prepare(buffers.back(), capacity);
+    return buffers.back().cloud;
+  }
+
+  const void *devicePointer(const void *data, size_t bytes) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<const uint8_t *, PinnedRange>::const_iterator it = pinned_.upper_bound(p);
+    if(it == pinned_.begin()) {
+      return NULL;
+    }
+    --it;
+    if(p + bytes > it->first + it->second.bytes) {
+      return NULL;
+    }
+    return it->second.device + (p - it->first);
+  }
+
+private:
+  Pool() : pin_(NULL), unpin_(NULL) {}
+
+  // A free cloud for its next message, its buffer pinned again if it moved.
+  void prepare(Buffer &buffer, size_t capacity) {
+    sensor_msgs::PointCloud2 &cloud = *buffer.cloud;
+    cloud.header = std_msgs::Header();
+    cloud.height = cloud.width = 0;
+    cloud.fields.clear();
+    cloud.is_bigendian = false;
+    cloud.point_step = cloud.row_step = 0;
+    cloud.is_dense = false;
+    if(cloud.data.capacity() < capacity) {
+      cloud.data.reserve(capacity);
+    }
+    uint8_t *data = cloud.data.data();
+    if(buffer.pinned && (buffer.pinned != data || buffer.pinned_bytes != cloud.data.capacity())) {
+      // grown by its last writer
+      if(unpin_) {
+        unpin_(buffer.pinned);
+      }
+      pinned_.erase(buffer.pinned);
+      buffer.pinned = NULL;
+    }
+    void *device;
+    if(pin_ && !buffer.pinned && pin_(data, cloud.data.capacity(), &device)) {
+      buffer.pinned = data;
+      buffer.pinned_bytes = cloud.data.capacity();
+      PinnedRange range = {buffer.pinned_bytes, static_cast<uint8_t *>(device)};
+      pinned_[data] = range;
+    }
+  }
+
+  std::mutex mutex_;
+  std::vector<Buffer> classes_[CLASSES];
+  std::map<const uint8_t *, PinnedRange> pinned_; // by host address
+  PinFunction pin_;
+  UnpinFunction unpin_;
+};
+
+} // namespace
+
+void setPinning(PinFunction pin, UnpinFunction unpin) {
+  Pool::instance().setPinning(pin, unpin);
+}
+
+sensor_msgs::PointCloud2::Ptr acquire(size_t bytes) {
+  return Pool::instance().acquire(bytes);
+}
+
+const void *devicePointer(const void *data, size_t bytes) {
+  return Pool::instance().devicePointer(data, bytes);
+}
+
+} // namespace point_cloud_pool
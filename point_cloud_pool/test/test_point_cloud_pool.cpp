@@ -0,0 +1,81 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+// Google Test
+#include <gtest/gtest.h>
+
+#include "point_cloud_pool/point_cloud_pool.h"
+
+static int pinned = 0, unpinned = 0;
+
+static bool pin(void *data, size_t bytes, void **device) {
+  pinned++;
+  *device = data; // as unified addressing does
+  return true;
+}
+
+static void unpin(void *data) {
+  unpinned++;
+}
+
+// The tests share the pool of the process, pinning comes last.
+TEST(PointCloudPool, ReleasedCloudIsReused) {
+  sensor_msgs::PointCloud2::Ptr cloud = point_cloud_pool::acquire(100000);
+  EXPECT_GE(cloud->data.capacity(), 100000u);
+  cloud->fields.resize(4);
+  cloud->width = 10;
+  cloud->data.resize(100000);
+  const uint8_t *data = cloud->data.data();
+  sensor_msgs::PointCloud2::ConstPtr subscriber = cloud;
+  cloud.reset();
+  // still held by a subscriber
+  sensor_msgs::PointCloud2::Ptr other = point_cloud_pool::acquire(100000);
+  EXPECT_NE(data, other->data.data());
+  subscriber.reset();
+  sensor_msgs::PointCloud2::Ptr again = point_cloud_pool::acquire(90000);
+  EXPECT_EQ(data, again->data.data());
+  EXPECT_EQ(100000u, again->data.size());
+  EXPECT_TRUE(again->fields.empty());
+  EXPECT_EQ(0u, again->width);
+}
+
+TEST(PointCloudPool, SizeClassesAreApart) {
+  sensor_msgs::PointCloud2::Ptr small = point_cloud_pool::acquire(1000);
+  const uint8_t *data = small->data.data();
+  small.reset();
+  sensor_msgs::PointCloud2::Ptr large = point_cloud_pool::acquire(1 << 20);
+  EXPECT_NE(data, large->data.data());
+  EXPECT_GE(large->data.capacity(), (1u << 20) + (1u << 17));
+  EXPECT_EQ(NULL, point_cloud_pool::devicePointer(large->data.data(), 1));
+}
+
+TEST(PointCloudPool, PinnedBuffersAreMapped) {
+  point_cloud_pool::setPinning(&pin, &unpin);
+  sensor_msgs::PointCloud2::Ptr cloud = point_cloud_pool::acquire(100000);
+  EXPECT_EQ(1, pinned);
+  cloud->data.resize(100000);
+  const uint8_t *data = cloud->data.data();
+  EXPECT_EQ(data + 16, point_cloud_pool::devicePointer(data + 16, 1000));
+  EXPECT_EQ(NULL, point_cloud_pool::devicePointer(data + 16, cloud->data.capacity()));
+  cloud.reset();
+  cloud = point_cloud_pool::acquire(100000);
+  EXPECT_EQ(1, pinned);
+  // grown beyond its class by its writer: pinned again where it moved
+  cloud->data.resize(cloud->data.capacity() + 1);
+  data = cloud->data.data();
+  cloud.reset();
+  cloud = point_cloud_pool::acquire(100000);
+  EXPECT_EQ(data, cloud->data.data());
+  EXPECT_EQ(2, pinned);
+  EXPECT_EQ(1, unpinned);
+  EXPECT_EQ(data, point_cloud_pool::devicePointer(data, 1));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,37 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <librealsense2/h/rs_types.h>
+#include <librealsense2/h/rs_sensor.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace realsense2_camera
+{
+    // Depth aligned to the viewpoint of another stream on the GPU, as rs2::align
+    // does it on the CPU: each depth pixel is spread over the pixels its corners
+    // project to, keeping the nearest depth. The buffers live in managed memory,
+    // which on a Jetson is the same memory as the CPU's, so the upload and the
+    // download are plain copies.
+    class AlignDepthCuda
+    {
+        public:
+            AlignDepthCuda();
+            ~AlignDepthCuda();
+
+            // Whether the distortion models are ones the kernels handle.
+            static bool supports(const rs2_intrinsics& depth_intrin, const rs2_intrinsics& other_intrin);
+
+            // False if the GPU failed, aligned untouched then.
+            bool align(const uint16_t* depth, const rs2_intrinsics& depth_intrin, float depth_units,
+                       const rs2_extrinsics& depth_to_other, const rs2_intrinsics& other_intrin, uint16_t* aligned);
+
+        private:
+            uint16_t*   _depth;     // managed
+            uint32_t*   _nearest;   // managed, the nearest depth of each pixel of the other stream.
+            size_t      _depth_capacity, _nearest_capacity;
+            void*       _stream;    // cudaStream_t, kept out of this header
+    };
+}
@@ -5,6 +5,9 @@
 
 #include "realsense2_camera/realsense_node_factory.h"
 #include <realsense2_camera/DeviceInfo.h>
+#include <realsense2_camera/GetDepthRoi.h>
+#include <darknet_ros_msgs/BoundingBoxes.h>
+#include <bayes_people_tracker/PeopleTracker.h>
 #include "realsense2_camera/Metadata.h"
 #include <ddynamic_reconfigure/ddynamic_reconfigure.h>
 
@@ -19,6 +22,8 @@
 #include <tf2_ros/static_transform_broadcaster.h>
 #include <condition_variable>
 
+#include <deque>
+#include <functional>
 #include <queue>
 #include <mutex>
 #include <atomic>
@@ -96,12 +101,12 @@ namespace realsense2_camera
     class SyncedImuPublisher
     {
         public:
-            SyncedImuPublisher() {_is_enabled=false;};
+            SyncedImuPublisher() : _pause_mode(false), _head(0), _tail(0), _is_enabled(false) {_draining.clear();};
             SyncedImuPublisher(ros::Publisher imu_publisher, std::size_t waiting_list_size=1000);
             ~SyncedImuPublisher();
             void Pause();   // Pause sending messages. All messages from now on are saved in queue.
             void Resume();  // Send all pending messages and allow sending future messages.
-            void Publish(sensor_msgs::Imu msg);     //either send or hold message.
+            void Publish(const sensor_msgs::Imu& msg);     //either send or hold message.
             uint32_t getNumSubscribers() { return _publisher.getNumSubscribers();};
             void Enable(bool is_enabled) {_is_enabled=is_enabled;};
         
@@ -109,14 +114,64 @@ namespace realsense2_camera
             void PublishPendingMessages();
 
         private:
-            std::mutex                    _mutex;
+            // The messages are kept in a ring of preallocated slots, written by the IMU thread
+            // only. Whoever holds _draining publishes from it: the IMU thread while not paused,
+            // or the image thread on Resume. Nothing here blocks either of them.
             ros::Publisher                _publisher;
-            bool                          _pause_mode;
-            std::queue<sensor_msgs::Imu>  _pending_messages;
-            std::size_t                     _waiting_list_size;
+            std::atomic<bool>             _pause_mode;
+            std::vector<sensor_msgs::Imu> _pending_messages;
+            std::atomic<std::size_t>      _head, _tail;   // Counts of messages pushed and published.
+            std::atomic_flag              _draining;
             bool                          _is_enabled;
     };
 
+    // A frame on its way from the callback through the filters to the publishers.
+    struct FrameJob
+    {
+        rs2::frame      frame;
+        rs2::frameset   frameset;
+        bool            is_frameset = false;
+        rs2::frame      original_depth_frame;
+        bool            is_color_frame = false;
+        ros::Time       t;
+        double          frame_time = 0;
+    };
+
+    // Runs each stage of a chain on its own thread, so successive frames go
+    // through the stages concurrently, and in order. Bounded queues between the
+    // stages; the first one drops its oldest frame when full.
+    class FramePipeline
+    {
+        public:
+            typedef std::function<void(FrameJob&)> Stage;
+            FramePipeline(const std::vector<Stage>& stages, std::size_t queue_size);
+            ~FramePipeline();   // Finish the queued frames and join the threads.
+            bool Push(FrameJob job);    // false if it dropped a frame to make room.
+
+        private:
+            class Queue
+            {
+                public:
+                    Queue(std::size_t capacity) : _capacity(capacity), _closed(false) {}
+                    bool Push(FrameJob job, bool drop_oldest);
+                    bool Pop(FrameJob& job);    // false once closed and empty.
+                    void Close();
+
+                private:
+                    std::mutex              _mutex;
+                    std::condition_variable _not_empty, _not_full;
+                    std::deque<FrameJob>    _jobs;
+                    std::size_t             _capacity;
+                    bool                    _closed;
+            };
+            void Run(std::size_t stage);
+
+        private:
+            std::vector<Stage>                  _stages;
+            std::vector<std::unique_ptr<Queue>> _queues;    // _queues[i] feeds stage i.
+            std::vector<std::thread>            _threads;
+    };
+
     class BaseRealSenseNode : public InterfaceRealSenseNode
     {
     public:
@@ -164,12 +219,16 @@ namespace realsense2_camera
         std::map<stream_index_pair, std::string> _depth_aligned_frame_id;
         ros::NodeHandle& _node_handle, _pnh;
         bool _align_depth;
+        bool _align_depth_cuda;
         std::vector<rs2_option> _monitor_options;
         std::shared_ptr<ros::ServiceServer> _device_info_srv;
+        std::shared_ptr<ros::ServiceServer> _depth_roi_srv;
 
         virtual void calcAndPublishStaticTransform(const stream_index_pair& stream, const rs2::stream_profile& base_profile);
         bool getDeviceInfo(realsense2_camera::DeviceInfo::Request& req,
                            realsense2_camera::DeviceInfo::Response& res);
+        bool getDepthRoi(realsense2_camera::GetDepthRoi::Request& req,
+                         realsense2_camera::GetDepthRoi::Response& res);
         rs2::stream_profile getAProfile(const stream_index_pair& stream);
         tf::Quaternion rotationMatrixToQuaternion(const float rotation[9]) const;
         void publish_static_tf(const ros::Time& t,
@@ -205,7 +264,7 @@ namespace realsense2_camera
         void setupStreams();
         bool setBaseTime(double frame_time, rs2_timestamp_domain time_domain);
         double frameSystemTimeSec(rs2::frame frame);
-        cv::Mat& fix_depth_scale(const cv::Mat& from_image, cv::Mat& to_image);
+        void fix_depth_scale(const cv::Mat& from_image, cv::Mat& to_image);
         void clip_depth(rs2::depth_frame depth_frame, float clipping_dist);
         void updateStreamCalibData(const rs2::video_stream_profile& video_profile);
         void SetBaseStream();
@@ -214,6 +273,14 @@ namespace realsense2_camera
         void publishIntrinsics();
         void runFirstFrameInitialization(rs2_stream stream_type);
         void publishPointCloud(rs2::points f, const ros::Time& t, const rs2::frameset& frameset);
+        void keepAlignedDepth(const rs2::frame& f, const ros::Time& t);
+        struct AlignedDepth;
+        const AlignedDepth* findAlignedDepth(const ros::Time& t) const;
+        void roiBoxesCallback(const darknet_ros_msgs::BoundingBoxes::ConstPtr& boxes);
+        void setupGovernor();
+        void governorCallback(const bayes_people_tracker::PeopleTracker::ConstPtr& people);
+        void governorTimerCallback(const ros::TimerEvent& event);
+        void setGovernorIdle(bool idle);
         Extrinsics rsExtrinsicsToMsg(const rs2_extrinsics& extrinsics, const std::string& frame_id) const;
 
         IMUInfo getImuInfo(const stream_index_pair& stream_index);
@@ -227,20 +294,27 @@ namespace realsense2_camera
                           std::map<stream_index_pair, sensor_msgs::CameraInfo>& camera_info,
                           const std::map<rs2_stream, std::string>& encoding,
                           bool copy_data_from_frame = true);
+        sensor_msgs::ImagePtr getImageMessage(const void* publisher, size_t size);
         void publishMetadata(rs2::frame f, const ros::Time& header_time, const std::string& frame_id);
         bool getEnabledProfile(const stream_index_pair& stream_index, rs2::stream_profile& profile);
 
         void publishAlignedDepthToOthers(rs2::frameset frames, const ros::Time& t);
         sensor_msgs::Imu CreateUnitedMessage(const CimuData accel_data, const CimuData gyro_data);
 
-        void FillImuData_Copy(const CimuData imu_data, std::deque<sensor_msgs::Imu>& imu_msgs);
+        void FillImuData_Copy(const CimuData imu_data, std::vector<sensor_msgs::Imu>& imu_msgs);
         void ImuMessage_AddDefaultValues(sensor_msgs::Imu& imu_msg);
-        void FillImuData_LinearInterpolation(const CimuData imu_data, std::deque<sensor_msgs::Imu>& imu_msgs);
+        void FillImuData_LinearInterpolation(const CimuData imu_data, std::vector<sensor_msgs::Imu>& imu_msgs);
         void imu_callback(rs2::frame frame);
         void imu_callback_sync(rs2::frame frame, imu_sync_method sync_method=imu_sync_method::COPY);
         void pose_callback(rs2::frame frame);
         void multiple_message_callback(rs2::frame frame, imu_sync_method sync_method);
         void frame_callback(rs2::frame frame);
+        void applyFilter(const NamedFilter& filter, FrameJob& job);
+        void publishFrames(const FrameJob& job);
+        void setupFramePipeline();
+#ifdef REALSENSE2_CAMERA_CUDA
+        std::shared_ptr<rs2::filter> makeCudaAlignFilter();
+#endif
         void registerDynamicOption(ros::NodeHandle& nh, rs2::options sensor, std::string& module_name);
         void registerHDRoptions();
         void set_sensor_parameter_to_ros(const std::string& module_name, rs2::options sensor, rs2_option option);
@@ -289,11 +363,18 @@ namespace realsense2_camera
         std::map<stream_index_pair, ImagePublisherWithFrequencyDiagnostics> _image_publishers;
         std::map<stream_index_pair, ros::Publisher> _imu_publishers;
         std::shared_ptr<SyncedImuPublisher> _synced_imu_publisher;
+        // United IMU messages are built in these, reused from one IMU sample to the next.
+        CimuData _imu_accel0;                       // The accel the pending gyros came after.
+        std::vector<CimuData> _imu_gyros;
+        std::vector<sensor_msgs::Imu> _imu_msgs;
         std::map<rs2_stream, int> _image_format;
         std::map<stream_index_pair, ros::Publisher> _info_publisher;
         std::map<stream_index_pair, std::shared_ptr<ros::Publisher>> _metadata_publishers;
         std::map<stream_index_pair, cv::Mat> _image;
         std::map<rs2_stream, std::string> _encoding;
+        // Image messages of each publisher, reused once nobody holds them.
+        std::map<const void*, std::vector<sensor_msgs::ImagePtr>> _image_msg_pool;
+        std::mutex _image_msg_pool_mutex;
 
         std::map<stream_index_pair, int> _seq;
         std::map<rs2_stream, int> _unit_step_size;
@@ -312,11 +393,27 @@ namespace realsense2_camera
         stream_index_pair _pointcloud_texture;
         PipelineSyncer _syncer;
         std::vector<NamedFilter> _filters;
+        bool _pipeline_filters;
+        int _pipeline_queue_size;
+        std::unique_ptr<FramePipeline> _frame_pipeline;
+
+        // Frames skipped and depth decimated while no tracked person is close.
+        bool _governor;
+        std::string _governor_topic;
+        double _governor_active_distance;
+        double _governor_hold;
+        int _governor_idle_frame_skip;
+        int _governor_idle_decimation;
+        std::atomic<bool> _governor_idle;
+        ros::Time _governor_last_close;
+        float _governor_active_decimation;
+        std::mutex _governor_mutex;
+        ros::Subscriber _governor_subscriber;
+        ros::Timer _governor_timer;
         std::shared_ptr<rs2::filter> _colorizer, _pointcloud_filter;
         std::vector<rs2::sensor> _dev_sensors;
 
         std::map<stream_index_pair, cv::Mat> _depth_aligned_image;
-        std::map<stream_index_pair, cv::Mat> _depth_scaled_image;
         std::map<rs2_stream, std::string> _depth_aligned_encoding;
         std::map<stream_index_pair, sensor_msgs::CameraInfo> _depth_aligned_camera_info;
         std::map<stream_index_pair, int> _depth_aligned_seq;
@@ -337,7 +434,29 @@ namespace realsense2_camera
         stream_index_pair _base_stream;
         const std::string _namespace;
 
-        sensor_msgs::PointCloud2 _msg_pointcloud;
+        // Point cloud messages, reused once nobody holds them.
+        std::vector<sensor_msgs::PointCloud2Ptr> _pointcloud_msg_pool;
+
+        // The aligned depth of the last frames, in the depth units, for the
+        // consumers of the color images to get the depth of their exact frame
+        // (the ROI point cloud, the get_depth_roi service).
+        struct AlignedDepth
+        {
+            ros::Time       t;
+            rs2_intrinsics  intrinsics;
+            cv::Mat         depth;
+        };
+        int _depth_history_frames;
+        std::vector<AlignedDepth> _aligned_depth_history;
+        size_t _aligned_depth_next;
+        std::mutex _aligned_depth_mutex;
+        bool _roi_pointcloud;
+        std::string _roi_boxes_topic;
+        int _roi_pointcloud_frames;
+        int _roi_pointcloud_stride;
+        ros::Subscriber _roi_boxes_subscriber;
+        ros::Publisher _roi_pointcloud_publisher;
+        std::vector<sensor_msgs::PointCloud2Ptr> _roi_pointcloud_msg_pool;
         std::vector< unsigned int > _valid_pc_indices;
     };//end class
 
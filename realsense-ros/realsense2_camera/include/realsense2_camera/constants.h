@@ -43,10 +43,23 @@ namespace realsense2_camera
     
 
     const bool ALIGN_DEPTH             = false;
+    const bool ALIGN_DEPTH_CUDA        = true;
     const bool POINTCLOUD              = false;
     const bool ALLOW_NO_TEXTURE_POINTS = false;
     const bool ORDERED_POINTCLOUD      = false;
+    const bool ROI_POINTCLOUD          = false;
+    const int  ROI_POINTCLOUD_FRAMES   = 8;
+    const int  ROI_POINTCLOUD_STRIDE   = 1;
+    const int  DEPTH_HISTORY_FRAMES    = 0;
+
+    const bool   GOVERNOR                   = false;
+    const double GOVERNOR_ACTIVE_DISTANCE   = 5.0; // m
+    const double GOVERNOR_HOLD              = 3.0; // s
+    const int    GOVERNOR_IDLE_FRAME_SKIP   = 6;
+    const int    GOVERNOR_IDLE_DECIMATION   = 4;
     const bool SYNC_FRAMES             = false;
+    const bool PIPELINE_FILTERS        = false;
+    const int  PIPELINE_QUEUE_SIZE     = 2;
 
     const bool PUBLISH_TF        = true;
     const double TF_PUBLISH_RATE = 0; // Static transform
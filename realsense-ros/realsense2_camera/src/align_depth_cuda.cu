@@ -0,0 +1,196 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "realsense2_camera/align_depth_cuda.h"
+
+#include <cuda_runtime.h>
+#include <algorithm>
+#include <cstring>
+
+using namespace realsense2_camera;
+
+#define BLOCK_WIDTH 32
+#define BLOCK_HEIGHT 8
+#define NO_DEPTH 0xFFFFFFFFu
+
+namespace
+{
+    bool hasDistortion(const rs2_intrinsics& intrin)
+    {
+        for (int i = 0; i < 5; ++i)
+            if (intrin.coeffs[i] != 0.f)
+                return true;
+        return false;
+    }
+
+    // Same as rs2_deproject_pixel_to_point, for the models supports() lets through.
+    __device__ void deproject(const rs2_intrinsics& intrin, float px, float py, float depth, float point[3])
+    {
+        float x = (px - intrin.ppx) / intrin.fx;
+        float y = (py - intrin.ppy) / intrin.fy;
+        if (intrin.model == RS2_DISTORTION_INVERSE_BROWN_CONRADY)
+        {
+            const float* c = intrin.coeffs;
+            float r2 = x * x + y * y;
+            float f = 1 + c[0] * r2 + c[1] * r2 * r2 + c[4] * r2 * r2 * r2;
+            float ux = x * f + 2 * c[2] * x * y + c[3] * (r2 + 2 * x * x);
+            float uy = y * f + 2 * c[3] * x * y + c[2] * (r2 + 2 * y * y);
+            x = ux;
+            y = uy;
+        }
+        point[0] = depth * x;
+        point[1] = depth * y;
+        point[2] = depth;
+    }
+
+    // Same as rs2_project_point_to_pixel, for the models supports() lets through.
+    __device__ void project(const rs2_intrinsics& intrin, const float point[3], float pixel[2])
+    {
+        float x = point[0] / point[2];
+        float y = point[1] / point[2];
+        const float* c = intrin.coeffs;
+        if (intrin.model == RS2_DISTORTION_MODIFIED_BROWN_CONRADY || intrin.model == RS2_DISTORTION_INVERSE_BROWN_CONRADY)
+        {
+            float r2 = x * x + y * y;
+            float f = 1 + c[0] * r2 + c[1] * r2 * r2 + c[4] * r2 * r2 * r2;
+            x *= f;
+            y *= f;
+            float dx = x + 2 * c[2] * x * y + c[3] * (r2 + 2 * x * x);
+            float dy = y + 2 * c[3] * x * y + c[2] * (r2 + 2 * y * y);
+            x = dx;
+            y = dy;
+        }
+        else if (intrin.model == RS2_DISTORTION_BROWN_CONRADY)
+        {
+            float r2 = x * x + y * y;
+            float f = 1 + c[0] * r2 + c[1] * r2 * r2 + c[4] * r2 * r2 * r2;
+            float dx = x * f + 2 * c[2] * x * y + c[3] * (r2 + 2 * x * x);
+            float dy = y * f + 2 * c[3] * x * y + c[2] * (r2 + 2 * y * y);
+            x = dx;
+            y = dy;
+        }
+        pixel[0] = x * intrin.fx + intrin.ppx;
+        pixel[1] = y * intrin.fy + intrin.ppy;
+    }
+
+    __device__ void transform(const rs2_extrinsics& extrin, const float from[3], float to[3])
+    {
+        to[0] = extrin.rotation[0] * from[0] + extrin.rotation[3] * from[1] + extrin.rotation[6] * from[2] + extrin.translation[0];
+        to[1] = extrin.rotation[1] * from[0] + extrin.rotation[4] * from[1] + extrin.rotation[7] * from[2] + extrin.translation[1];
+        to[2] = extrin.rotation[2] * from[0] + extrin.rotation[5] * from[1] + extrin.rotation[8] * from[2] + extrin.translation[2];
+    }
+
+    __device__ void otherPixel(const rs2_intrinsics& depth_intrin, const rs2_extrinsics& depth_to_other, const rs2_intrinsics& other_intrin,
+                               float px, float py, float depth, int& x, int& y)
+    {
+        float point[3], other_point[3], pixel[2];
+        deproject(depth_intrin, px, py, depth, point);
+        transform(depth_to_other, point, other_point);
+        project(other_intrin, other_point, pixel);
+        x = static_cast<int>(pixel[0] + 0.5f);
+        y = static_cast<int>(pixel[1] + 0.5f);
+    }
+
+    __global__ void alignKernel(const uint16_t* depth, rs2_intrinsics depth_intrin, float depth_units,
+                                rs2_extrinsics depth_to_other, rs2_intrinsics other_intrin, uint32_t* nearest)
+    {
+        int x = blockIdx.x * blockDim.x + threadIdx.x;
+        int y = blockIdx.y * blockDim.y + threadIdx.y;
+        if (x >= depth_intrin.width || y >= depth_intrin.height)
+            return;
+        uint16_t z = depth[y * depth_intrin.width + x];
+        if (!z)
+            return;
+        float meters = z * depth_units;
+
+        // The pixels of the other stream the corners of this one project to.
+        int x0, y0, x1, y1;
+        otherPixel(depth_intrin, depth_to_other, other_intrin, x - 0.5f, y - 0.5f, meters, x0, y0);
+        otherPixel(depth_intrin, depth_to_other, other_intrin, x + 0.5f, y + 0.5f, meters, x1, y1);
+        if (x0 < 0 || y0 < 0 || x1 >= other_intrin.width || y1 >= other_intrin.height)
+            return;
+        for (int v = y0; v <= y1; ++v)
+            for (int u = x0; u <= x1; ++u)
+                atomicMin(&nearest[v * other_intrin.width + u], static_cast<uint32_t>(z));
+    }
+
+    __global__ void nearestToDepthKernel(const uint32_t* nearest, int count, uint16_t* aligned)
+    {
+        int i = blockIdx.x * blockDim.x + threadIdx.x;
+        if (i < count)
+            aligned[i] = nearest[i] == NO_DEPTH ? 0 : static_cast<uint16_t>(nearest[i]);
+    }
+
+    template <class T>
+    bool reserveManaged(T*& buffer, size_t& capacity, size_t count)
+    {
+        if (count <= capacity)
+            return true;
+        cudaFree(buffer);
+        if (cudaMallocManaged(&buffer, count * sizeof(T)) != cudaSuccess)
+        {
+            buffer = NULL;
+            capacity = 0;
+            return false;
+        }
+        capacity = count;
+        return true;
+    }
+}
+
+AlignDepthCuda::AlignDepthCuda() :
+    _depth(NULL), _nearest(NULL), _depth_capacity(0), _nearest_capacity(0)
+{
+    cudaStream_t stream;
+    cudaStreamCreate(&stream);
+    _stream = stream;
+}
+
+AlignDepthCuda::~AlignDepthCuda()
+{
+    cudaStreamDestroy(static_cast<cudaStream_t>(_stream));
+    cudaFree(_depth);
+    cudaFree(_nearest);
+}
+
+bool AlignDepthCuda::supports(const rs2_intrinsics& depth_intrin, const rs2_intrinsics& other_intrin)
+{
+    bool depth_ok = !hasDistortion(depth_intrin) ||
+                    depth_intrin.model == RS2_DISTORTION_NONE ||
+                    depth_intrin.model == RS2_DISTORTION_INVERSE_BROWN_CONRADY;
+    bool other_ok = !hasDistortion(other_intrin) ||
+                    other_intrin.model == RS2_DISTORTION_NONE ||
+                    other_intrin.model == RS2_DISTORTION_MODIFIED_BROWN_CONRADY ||
+                    other_intrin.model == RS2_DISTORTION_INVERSE_BROWN_CONRADY ||
+                    other_intrin.model == RS2_DISTORTION_BROWN_CONRADY;
+    return depth_ok && other_ok;
+}
+
+bool AlignDepthCuda::align(const uint16_t* depth, const rs2_intrinsics& depth_intrin, float depth_units,
+                           const rs2_extrinsics& depth_to_other, const rs2_intrinsics& other_intrin, uint16_t* aligned)
+{
+    cudaStream_t stream = static_cast<cudaStream_t>(_stream);
+    size_t depth_count = static_cast<size_t>(depth_intrin.width) * depth_intrin.height;
+    size_t other_count = static_cast<size_t>(other_intrin.width) * other_intrin.height;
+    // The aligned depth goes through the depth buffer too, as wide as the larger of the two.
+    if (!reserveManaged(_depth, _depth_capacity, std::max(depth_count, other_count)) ||
+        !reserveManaged(_nearest, _nearest_capacity, other_count))
+        return false;
+
+    // Distortion coefficients of zero are no distortion at all.
+    rs2_intrinsics d = depth_intrin, o = other_intrin;
+    if (!hasDistortion(d)) d.model = RS2_DISTORTION_NONE;
+    if (!hasDistortion(o)) o.model = RS2_DISTORTION_NONE;
+
+    memcpy(_depth, depth, depth_count * sizeof(uint16_t));
+    cudaMemsetAsync(_nearest, 0xFF, other_count * sizeof(uint32_t), stream);
+    dim3 block(BLOCK_WIDTH, BLOCK_HEIGHT);
+    dim3 grid((d.width + BLOCK_WIDTH - 1) / BLOCK_WIDTH, (d.height + BLOCK_HEIGHT - 1) / BLOCK_HEIGHT);
+    alignKernel<<<grid, block, 0, stream>>>(_depth, d, depth_units, depth_to_other, o, _nearest);
+    int threads = BLOCK_WIDTH * BLOCK_HEIGHT;
+    nearestToDepthKernel<<<(other_count + threads - 1) / threads, threads, 0, stream>>>(_nearest, other_count, _depth);
+    if (cudaStreamSynchronize(stream) != cudaSuccess || cudaGetLastError() != cudaSuccess)
+        return false;
+    memcpy(aligned, _depth, other_count * sizeof(uint16_t));
+    return true;
+}
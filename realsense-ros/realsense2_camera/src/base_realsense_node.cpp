@@ -1,9 +1,20 @@
 #include "realsense2_camera/base_realsense_node.h"
+#ifdef REALSENSE2_CAMERA_CUDA
+#include "realsense2_camera/align_depth_cuda.h"
+#endif
+#include <perception_trace/trace.h>
 #include "assert.h"
 #include <boost/algorithm/string.hpp>
+#include <boost/make_shared.hpp>
 #include <algorithm>
 #include <cctype>
+#include <cmath>
 #include <mutex>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include <dynamic_reconfigure/IntParameter.h>
 #include <dynamic_reconfigure/Reconfigure.h>
@@ -20,57 +31,152 @@ using namespace ddynamic_reconfigure;
 
 SyncedImuPublisher::SyncedImuPublisher(ros::Publisher imu_publisher, std::size_t waiting_list_size):
             _publisher(imu_publisher), _pause_mode(false),
-            _waiting_list_size(waiting_list_size)
-            {}
+            _pending_messages(waiting_list_size), _head(0), _tail(0),
+            _is_enabled(false)
+            {
+                _draining.clear();
+            }
 
 SyncedImuPublisher::~SyncedImuPublisher()
 {
+    _pause_mode = false;
     PublishPendingMessages();
 }
 
-void SyncedImuPublisher::Publish(sensor_msgs::Imu imu_msg)
+void SyncedImuPublisher::Publish(const sensor_msgs::Imu& imu_msg)
 {
-    std::lock_guard<std::mutex> lock_guard(_mutex);
-    if (_pause_mode)
+    // Even when not paused the message goes through the ring, so it can't overtake
+    // messages Resume is still publishing.
+    std::size_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) >= _pending_messages.size())
     {
-        if (_pending_messages.size() >= _waiting_list_size)
-        {
-            throw std::runtime_error("SyncedImuPublisher inner list reached maximum size of " + std::to_string(_pending_messages.size()));
-        }
-        _pending_messages.push(imu_msg);
+        throw std::runtime_error("SyncedImuPublisher inner list reached maximum size of " + std::to_string(_pending_messages.size()));
     }
-    else
-    {
-        _publisher.publish(imu_msg);
-        // ROS_INFO_STREAM("iid1:" << imu_msg.header.seq << ", time: " << std::setprecision (20) << imu_msg.header.stamp.toSec());
-    }
-    return;
+    _pending_messages[head % _pending_messages.size()] = imu_msg;
+    _head.store(head + 1, std::memory_order_release);
+    if (!_pause_mode)
+        PublishPendingMessages();
 }
 
 void SyncedImuPublisher::Pause()
 {
     if (!_is_enabled) return;
-    std::lock_guard<std::mutex> lock_guard(_mutex);
     _pause_mode = true;
 }
 
 void SyncedImuPublisher::Resume()
 {
-    std::lock_guard<std::mutex> lock_guard(_mutex);
-    PublishPendingMessages();
     _pause_mode = false;
+    PublishPendingMessages();
 }
 
 void SyncedImuPublisher::PublishPendingMessages()
 {
-    // ROS_INFO_STREAM("publish imu: " << _pending_messages.size());
-    while (!_pending_messages.empty())
+    // ROS_INFO_STREAM("publish imu: " << _head - _tail);
+    do
     {
-        const sensor_msgs::Imu &imu_msg = _pending_messages.front();
-        _publisher.publish(imu_msg);
-        // ROS_INFO_STREAM("iid2:" << imu_msg.header.seq << ", time: " << std::setprecision (20) << imu_msg.header.stamp.toSec());
-        _pending_messages.pop();
+        // Someone else is publishing, and will look again for what arrives meanwhile.
+        if (_draining.test_and_set(std::memory_order_acquire))
+            return;
+        std::size_t tail = _tail.load(std::memory_order_relaxed);
+        while (tail != _head.load(std::memory_order_acquire))
+        {
+            const sensor_msgs::Imu &imu_msg = _pending_messages[tail % _pending_messages.size()];
+            _publisher.publish(imu_msg);
+            // ROS_INFO_STREAM("iid2:" << imu_msg.header.seq << ", time: " << std::setprecision (20) << imu_msg.header.stamp.toSec());
+            _tail.store(++tail, std::memory_order_release);
+        }
+        _draining.clear(std::memory_order_release);
+    } while (!_pause_mode && _tail.load(std::memory_order_acquire) != _head.load(std::memory_order_acquire));
+}
+
+FramePipeline::FramePipeline(const std::vector<Stage>& stages, std::size_t queue_size):
+    _stages(stages)
+{
+    for (std::size_t i = 0; i < _stages.size(); ++i)
+        _queues.emplace_back(new Queue(std::max<std::size_t>(1, queue_size)));
+    for (std::size_t i = 0; i < _stages.size(); ++i)
+        _threads.emplace_back(&FramePipeline::Run, this, i);
+}
+
+FramePipeline::~FramePipeline()
+{
+    // Closing the first queue closes each next one as the stages drain.
+    if (!_queues.empty())
+        _queues.front()->Close();
+    for (std::thread& t : _threads)
+        t.join();
+}
+
+bool FramePipeline::Push(FrameJob job)
+{
+    if (_queues.empty())
+        return true;
+    return _queues.front()->Push(std::move(job), true);
+}
+
+void FramePipeline::Run(std::size_t stage)
+{
+    FrameJob job;
+    while (_queues[stage]->Pop(job))
+    {
+        try
+        {
+            _stages[stage](job);
+        }
+        catch(const std::exception& ex)
+        {
+            ROS_ERROR_STREAM("An error has occurred during frame pipeline: " << ex.what());
+            continue;
+        }
+        if (stage + 1 < _queues.size())
+            _queues[stage + 1]->Push(std::move(job), false);
     }
+    if (stage + 1 < _queues.size())
+        _queues[stage + 1]->Close();
+}
+
+bool FramePipeline::Queue::Push(FrameJob job, bool drop_oldest)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    bool dropped(false);
+    if (drop_oldest)
+    {
+        if (_jobs.size() >= _capacity)
+        {
+            _jobs.pop_front();
+            dropped = true;
+        }
+    }
+    else
+    {
+        _not_full.wait(lock, [this]{return _jobs.size() < _capacity || _closed;});
+    }
+    if (_closed)
+        return false;
+    _jobs.push_back(std::move(job));
+    _not_empty.notify_one();
+    return !dropped;
+}
+
+bool FramePipeline::Queue::Pop(FrameJob& job)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_empty.wait(lock, [this]{return !_jobs.empty() || _closed;});
+    if (_jobs.empty())
+        return false;
+    job = std::move(_jobs.front());
+    _jobs.pop_front();
+    _not_full.notify_one();
+    return true;
+}
+
+void FramePipeline::Queue::Close()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _closed = true;
+    _not_empty.notify_all();
+    _not_full.notify_all();
 }
 
 std::string BaseRealSenseNode::getNamespaceStr()
@@ -168,6 +274,8 @@ BaseRealSenseNode::~BaseRealSenseNode()
             ROS_ERROR_STREAM("Exception: " << e.what());
         }
     }
+    // Publish what is still in the pipeline, once no more frames arrive.
+    _frame_pipeline.reset();
 }
 
 void BaseRealSenseNode::toggleSensors(bool enabled)
@@ -242,11 +350,13 @@ void BaseRealSenseNode::publishTopics()
     getParameters();
     setupDevice();
     setupFilters();
+    setupFramePipeline();
     registerHDRoptions();
     registerDynamicReconfigCb(_node_handle);
     setupErrorCallback();
     enable_devices();
     setupPublishers();
+    setupGovernor();
     setupStreams();
     SetBaseStream();
     registerAutoExposureROIOptions(_node_handle);
@@ -729,6 +839,7 @@ void BaseRealSenseNode::getParameters()
     }
 
     _pnh.param("align_depth", _align_depth, ALIGN_DEPTH);
+    _pnh.param("align_depth_cuda", _align_depth_cuda, ALIGN_DEPTH_CUDA);
     _pnh.param("enable_pointcloud", _pointcloud, POINTCLOUD);
     std::string pc_texture_stream("");
     int pc_texture_idx;
@@ -737,6 +848,8 @@ void BaseRealSenseNode::getParameters()
     _pointcloud_texture = stream_index_pair{rs2_string_to_stream(pc_texture_stream), pc_texture_idx};
 
     _pnh.param("filters", _filters_str, DEFAULT_FILTERS);
+    _pnh.param("pipeline_filters", _pipeline_filters, PIPELINE_FILTERS);
+    _pnh.param("pipeline_queue_size", _pipeline_queue_size, PIPELINE_QUEUE_SIZE);
     _pointcloud |= (_filters_str.find("pointcloud") != std::string::npos);
 
     _pnh.param("publish_tf", _publish_tf, PUBLISH_TF);
@@ -810,6 +923,17 @@ void BaseRealSenseNode::getParameters()
 
     _pnh.param("allow_no_texture_points", _allow_no_texture_points, ALLOW_NO_TEXTURE_POINTS);
     _pnh.param("ordered_pc", _ordered_pc, ORDERED_POINTCLOUD);
+    _pnh.param("roi_pointcloud", _roi_pointcloud, ROI_POINTCLOUD);
+    _pnh.param("roi_boxes_topic", _roi_boxes_topic, std::string("/darknet_ros/bounding_boxes"));
+    _pnh.param("roi_pointcloud_frames", _roi_pointcloud_frames, ROI_POINTCLOUD_FRAMES);
+    _pnh.param("roi_pointcloud_stride", _roi_pointcloud_stride, ROI_POINTCLOUD_STRIDE);
+    _pnh.param("depth_history_frames", _depth_history_frames, DEPTH_HISTORY_FRAMES);
+    _pnh.param("governor", _governor, GOVERNOR);
+    _pnh.param("governor_topic", _governor_topic, std::string("/people_tracker/positions"));
+    _pnh.param("governor_active_distance", _governor_active_distance, GOVERNOR_ACTIVE_DISTANCE);
+    _pnh.param("governor_hold", _governor_hold, GOVERNOR_HOLD);
+    _pnh.param("governor_idle_frame_skip", _governor_idle_frame_skip, GOVERNOR_IDLE_FRAME_SKIP);
+    _pnh.param("governor_idle_decimation", _governor_idle_decimation, GOVERNOR_IDLE_DECIMATION);
     _pnh.param("clip_distance", _clipping_distance, static_cast<float>(-1.0));
     _pnh.param("linear_accel_cov", _linear_accel_cov, static_cast<double>(0.01));
     _pnh.param("angular_velocity_cov", _angular_velocity_cov, static_cast<double>(0.01));
@@ -1002,6 +1126,21 @@ void BaseRealSenseNode::setupPublishers()
         }
     }
 
+    if ((_roi_pointcloud || _depth_history_frames > 0) && !_align_depth)
+    {
+        ROS_WARN("roi_pointcloud and depth_history_frames need align_depth, the consumers being in the color image. Disabled.");
+        _roi_pointcloud = false;
+        _depth_history_frames = 0;
+    }
+    _aligned_depth_history.resize(std::max(_depth_history_frames, _roi_pointcloud ? std::max(1, _roi_pointcloud_frames) : 0));
+    _aligned_depth_next = 0;
+    if (_roi_pointcloud)
+    {
+        _roi_pointcloud_stride = std::max(1, _roi_pointcloud_stride);
+        _roi_pointcloud_publisher = _node_handle.advertise<sensor_msgs::PointCloud2>("depth/color/roi_points", 1);
+        _roi_boxes_subscriber = _node_handle.subscribe(_roi_boxes_topic, 1, &BaseRealSenseNode::roiBoxesCallback, this);
+    }
+
     _synced_imu_publisher = std::make_shared<SyncedImuPublisher>();
     if (_imu_sync_method > imu_sync_method::NONE && _enable[GYRO] && _enable[ACCEL])
     {
@@ -1127,7 +1266,6 @@ void BaseRealSenseNode::enable_devices()
 		for (auto& profiles : _enabled_profiles)
 		{
 			_depth_aligned_image[profiles.first] = cv::Mat(_height[DEPTH], _width[DEPTH], _image_format[DEPTH.first], cv::Scalar(0, 0, 0));
-			_depth_scaled_image[profiles.first] = cv::Mat(_height[DEPTH], _width[DEPTH], _image_format[DEPTH.first], cv::Scalar(0, 0, 0));
 		}
 	}
 
@@ -1256,6 +1394,14 @@ void BaseRealSenseNode::setupFilters()
     }
     if (_align_depth)
     {
+#ifdef REALSENSE2_CAMERA_CUDA
+        if (_align_depth_cuda)
+        {
+            ROS_INFO("Add Filter: align_to_color (CUDA)");
+            _filters.push_back(NamedFilter("align_to_color", makeCudaAlignFilter()));
+        }
+        else
+#endif
         _filters.push_back(NamedFilter("align_to_color", std::make_shared<rs2::align>(RS2_STREAM_COLOR)));
     }
     if (use_colorizer_filter)
@@ -1282,44 +1428,142 @@ void BaseRealSenseNode::setupFilters()
     ROS_INFO("num_filters: %d", static_cast<int>(_filters.size()));
 }
 
-cv::Mat& BaseRealSenseNode::fix_depth_scale(const cv::Mat& from_image, cv::Mat& to_image)
+void BaseRealSenseNode::setupFramePipeline()
+{
+    if (!_pipeline_filters || _filters.empty())
+        return;
+    // A stage per filter, each filter keeping to one thread as its state
+    // (temporal, hdr_merge) needs, and the publishing last.
+    std::vector<FramePipeline::Stage> stages;
+    for (const NamedFilter& filter : _filters)
+        stages.push_back([this, filter](FrameJob& job){applyFilter(filter, job);});
+    stages.push_back([this](FrameJob& job){
+        _synced_imu_publisher->Pause();
+        publishFrames(job);
+        _synced_imu_publisher->Resume();
+    });
+    ROS_INFO("Running the %d filters in a pipeline, %d frames queued", static_cast<int>(_filters.size()), _pipeline_queue_size);
+    _frame_pipeline.reset(new FramePipeline(stages, _pipeline_queue_size));
+}
+
+#ifdef REALSENSE2_CAMERA_CUDA
+std::shared_ptr<rs2::filter> BaseRealSenseNode::makeCudaAlignFilter()
+{
+    auto aligner = std::make_shared<AlignDepthCuda>();
+    auto cpu_align = std::make_shared<rs2::align>(RS2_STREAM_COLOR);
+    auto aligned_profile = std::make_shared<rs2::stream_profile>();
+    return std::make_shared<rs2::filter>([aligner, cpu_align, aligned_profile](rs2::frame frame, rs2::frame_source& source)
+    {
+        rs2::frameset frameset = frame.as<rs2::frameset>();
+        rs2::depth_frame depth = frameset.get_depth_frame();
+        rs2::video_frame color = frameset.get_color_frame();
+        if (!depth || !color)
+        {
+            source.frame_ready(frame);
+            return;
+        }
+        auto depth_profile = depth.get_profile().as<rs2::video_stream_profile>();
+        auto color_profile = color.get_profile().as<rs2::video_stream_profile>();
+        rs2_intrinsics depth_intrin = depth_profile.get_intrinsics();
+        rs2_intrinsics color_intrin = color_profile.get_intrinsics();
+        if (!AlignDepthCuda::supports(depth_intrin, color_intrin))
+        {
+            ROS_WARN_ONCE("Distortion model not handled in CUDA, aligning depth to color on the CPU");
+            source.frame_ready(cpu_align->process(frameset));
+            return;
+        }
+
+        // The depth seen from the color camera, with its intrinsics, as rs2::align makes it.
+        if (!*aligned_profile ||
+            aligned_profile->as<rs2::video_stream_profile>().width() != color_intrin.width ||
+            aligned_profile->as<rs2::video_stream_profile>().height() != color_intrin.height)
+        {
+            *aligned_profile = depth_profile.clone(depth_profile.stream_type(), depth_profile.stream_index(), depth_profile.format(),
+                                                   color_intrin.width, color_intrin.height, color_intrin);
+            rs2_extrinsics identity{{1, 0, 0, 0, 1, 0, 0, 0, 1}, {0, 0, 0}};
+            aligned_profile->register_extrinsics_to(color_profile, identity);
+        }
+        int bpp = depth.get_bytes_per_pixel();
+        rs2::frame aligned = source.allocate_video_frame(*aligned_profile, depth, bpp, color_intrin.width, color_intrin.height,
+                                                         color_intrin.width * bpp, RS2_EXTENSION_DEPTH_FRAME);
+        if (!aligned ||
+            !aligner->align(static_cast<const uint16_t*>(depth.get_data()), depth_intrin, depth.get_units(),
+                            depth_profile.get_extrinsics_to(color_profile), color_intrin,
+                            static_cast<uint16_t*>(const_cast<void*>(aligned.get_data()))))
+        {
+            ROS_WARN_THROTTLE(5, "CUDA failed to align depth to color, aligning on the CPU");
+            source.frame_ready(cpu_align->process(frameset));
+            return;
+        }
+
+        std::vector<rs2::frame> frames;
+        for (auto it = frameset.begin(); it != frameset.end(); ++it)
+        {
+            auto f = (*it);
+            frames.push_back(f.get_profile().unique_id() == depth_profile.unique_id() ? aligned : f);
+        }
+        source.frame_ready(source.allocate_composite_frame(frames));
+    });
+}
+#endif
+
+void BaseRealSenseNode::fix_depth_scale(const cv::Mat& from_image, cv::Mat& to_image)
 {
     static const float meter_to_mm = 0.001f;
+    CV_Assert(from_image.depth() == _image_format[RS2_STREAM_DEPTH]);
+    CV_Assert(to_image.size() == from_image.size() && to_image.type() == from_image.type());
     if (fabs(_depth_scale_meters - meter_to_mm) < 1e-6)
     {
-        to_image = from_image;
-        return to_image;
-    }
-
-    if (to_image.size() != from_image.size())
-    {
-        to_image.create(from_image.rows, from_image.cols, from_image.type());
+        from_image.copyTo(to_image);
+        return;
     }
 
-    CV_Assert(from_image.depth() == _image_format[RS2_STREAM_DEPTH]);
+    // Fixed point: the factor scaled by 2^shift into 16 bits, so the 16-bit
+    // high halves of the products do for units below a millimeter. Within a
+    // millimeter of the float product.
+    double factor = _depth_scale_meters / meter_to_mm;
+    int shift = 16;
+    while (shift > 0 && factor * (1 << shift) >= 65536)
+        --shift;
+    const uint32_t multiplier = std::min(65535., std::round(factor * (1 << shift)));
 
     int nRows = from_image.rows;
     int nCols = from_image.cols;
 
-    if (from_image.isContinuous())
-    {
-        nCols *= nRows;
-        nRows = 1;
-    }
-
-    int i,j;
-    const uint16_t* p_from;
-    uint16_t* p_to;
-    for( i = 0; i < nRows; ++i)
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i = 0; i < nRows; ++i)
     {
-        p_from = from_image.ptr<uint16_t>(i);
-        p_to = to_image.ptr<uint16_t>(i);
-        for ( j = 0; j < nCols; ++j)
+        const uint16_t* p_from = from_image.ptr<uint16_t>(i);
+        uint16_t* p_to = to_image.ptr<uint16_t>(i);
+        int j = 0;
+        if (shift == 16)
         {
-            p_to[j] = p_from[j] * _depth_scale_meters / meter_to_mm;
+#if defined(__SSE2__)
+            const __m128i m = _mm_set1_epi16(static_cast<short>(multiplier));
+            for (; j + 8 <= nCols; j += 8)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p_from + j));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(p_to + j), _mm_mulhi_epu16(v, m));
+            }
+#elif defined(__ARM_NEON)
+            const uint16x4_t m = vdup_n_u16(multiplier);
+            for (; j + 8 <= nCols; j += 8)
+            {
+                uint16x8_t v = vld1q_u16(p_from + j);
+                uint16x4_t lo = vshrn_n_u32(vmull_u16(vget_low_u16(v), m), 16);
+                uint16x4_t hi = vshrn_n_u32(vmull_u16(vget_high_u16(v), m), 16);
+                vst1q_u16(p_to + j, vcombine_u16(lo, hi));
+            }
+#endif
+        }
+        for (; j < nCols; ++j)
+        {
+            uint32_t to = (p_from[j] * multiplier) >> shift;
+            p_to[j] = std::min(to, 65535u);
         }
     }
-    return to_image;
 }
 
 void BaseRealSenseNode::clip_depth(rs2::depth_frame depth_frame, float clipping_dist)
@@ -1368,52 +1612,36 @@ template <typename T> T lerp(const T &a, const T &b, const double t) {
   return a * (1.0 - t) + b * t;
 }
 
-void BaseRealSenseNode::FillImuData_LinearInterpolation(const CimuData imu_data, std::deque<sensor_msgs::Imu>& imu_msgs)
+void BaseRealSenseNode::FillImuData_LinearInterpolation(const CimuData imu_data, std::vector<sensor_msgs::Imu>& imu_msgs)
 {
-    static std::deque<CimuData> _imu_history;
-    _imu_history.push_back(imu_data);
     stream_index_pair type(imu_data.m_type);
-    imu_msgs.clear();
 
-    if ((type != ACCEL) || _imu_history.size() < 3)
+    if (type == GYRO)
+    {
+        if (_imu_accel0.is_set() && imu_data.m_time >= _imu_accel0.m_time)
+            _imu_gyros.push_back(imu_data);
         return;
-    
-    std::deque<CimuData> gyros_data;
-    CimuData accel0, accel1, crnt_imu;
+    }
 
-    while (_imu_history.size()) 
+    // An accel closes the batch of gyros since the previous one: all of them are
+    // interpolated between the two at once.
+    if (_imu_accel0.is_set())
     {
-        crnt_imu = _imu_history.front();
-        _imu_history.pop_front();
-        if (!accel0.is_set() && crnt_imu.m_type == ACCEL) 
+        const CimuData& accel0 = _imu_accel0;
+        const CimuData& accel1 = imu_data;
+        const double dt = accel1.m_time - accel0.m_time;
+        for (const CimuData& crnt_gyro : _imu_gyros)
         {
-            accel0 = crnt_imu;
-        } 
-        else if (accel0.is_set() && crnt_imu.m_type == ACCEL) 
-        {
-            accel1 = crnt_imu;
-            const double dt = accel1.m_time - accel0.m_time;
-
-            while (gyros_data.size())
-            {
-                CimuData crnt_gyro = gyros_data.front();
-                gyros_data.pop_front();
-                const double alpha = (crnt_gyro.m_time - accel0.m_time) / dt;
-                CimuData crnt_accel(ACCEL, lerp(accel0.m_data, accel1.m_data, alpha), crnt_gyro.m_time);
-                imu_msgs.push_back(CreateUnitedMessage(crnt_accel, crnt_gyro));
-            }
-            accel0 = accel1;
-        } 
-        else if (accel0.is_set() && crnt_imu.m_time >= accel0.m_time && crnt_imu.m_type == GYRO)
-        {
-            gyros_data.push_back(crnt_imu);
+            const double alpha = (crnt_gyro.m_time - accel0.m_time) / dt;
+            CimuData crnt_accel(ACCEL, lerp(accel0.m_data, accel1.m_data, alpha), crnt_gyro.m_time);
+            imu_msgs.push_back(CreateUnitedMessage(crnt_accel, crnt_gyro));
         }
     }
-    _imu_history.push_back(crnt_imu);
-    return;
+    _imu_gyros.clear();
+    _imu_accel0 = imu_data;
 }
 
-void BaseRealSenseNode::FillImuData_Copy(const CimuData imu_data, std::deque<sensor_msgs::Imu>& imu_msgs)
+void BaseRealSenseNode::FillImuData_Copy(const CimuData imu_data, std::vector<sensor_msgs::Imu>& imu_msgs)
 {
     stream_index_pair type(imu_data.m_type);
 
@@ -1466,25 +1694,23 @@ void BaseRealSenseNode::imu_callback_sync(rs2::frame frame, imu_sync_method sync
         auto crnt_reading = *(reinterpret_cast<const float3*>(frame.get_data()));
         Eigen::Vector3d v(crnt_reading.x, crnt_reading.y, crnt_reading.z);
         CimuData imu_data(stream_index, v, frameSystemTimeSec(frame));
-        std::deque<sensor_msgs::Imu> imu_msgs;
+        _imu_msgs.clear();
         switch (sync_method)
         {
             case NONE: //Cannot really be NONE. Just to avoid compilation warning.
             case COPY:
-                FillImuData_Copy(imu_data, imu_msgs);
+                FillImuData_Copy(imu_data, _imu_msgs);
                 break;
             case LINEAR_INTERPOLATION:
-                FillImuData_LinearInterpolation(imu_data, imu_msgs);
+                FillImuData_LinearInterpolation(imu_data, _imu_msgs);
                 break;
         }
-        while (imu_msgs.size())
+        for (sensor_msgs::Imu& imu_msg : _imu_msgs)
         {
-            sensor_msgs::Imu imu_msg = imu_msgs.front();
             imu_msg.header.seq = seq;
             ImuMessage_AddDefaultValues(imu_msg);
             _synced_imu_publisher->Publish(imu_msg);
             ROS_DEBUG("Publish united %s stream", rs2_stream_to_string(frame.get_profile().stream_type()));
-            imu_msgs.pop_front();
         }
     }
     m_mutex.unlock();
@@ -1630,7 +1856,11 @@ void BaseRealSenseNode::pose_callback(rs2::frame frame)
 
 void BaseRealSenseNode::frame_callback(rs2::frame frame)
 {
-    _synced_imu_publisher->Pause();
+    // Idle, only one frame in _governor_idle_frame_skip goes through the filters and out.
+    if (_governor_idle && (frame.get_frame_number() % _governor_idle_frame_skip) != 0)
+        return;
+    if (!_frame_pipeline)
+        _synced_imu_publisher->Pause();
     
     try{
         double frame_time = frame.get_timestamp();
@@ -1645,6 +1875,10 @@ void BaseRealSenseNode::frame_callback(rs2::frame frame)
         }
 
         ros::Time t(frameSystemTimeSec(frame));
+        FrameJob job;
+        job.frame = frame;
+        job.t = t;
+        job.frame_time = frame_time;
         if (frame.is<rs2::frameset>())
         {
             ROS_DEBUG("Frameset arrived.");
@@ -1669,83 +1903,10 @@ void BaseRealSenseNode::frame_callback(rs2::frame frame)
             {
                 clip_depth(original_depth_frame, _clipping_distance);
             }
-
-            ROS_DEBUG("num_filters: %d", static_cast<int>(_filters.size()));
-            for (std::vector<NamedFilter>::const_iterator filter_it = _filters.begin(); filter_it != _filters.end(); filter_it++)
-            {
-                ROS_DEBUG("Applying filter: %s", filter_it->_name.c_str());
-                if ((filter_it->_name == "pointcloud") && (!original_depth_frame))
-                    continue;
-                if ((filter_it->_name == "align_to_color") && (!is_color_frame))
-                    continue;
-                frameset = filter_it->_filter->process(frameset);
-            }
-
-            ROS_DEBUG("List of frameset after applying filters: size: %d", static_cast<int>(frameset.size()));
-            bool sent_depth_frame(false);
-            for (auto it = frameset.begin(); it != frameset.end(); ++it)
-            {
-                auto f = (*it);
-                auto stream_type = f.get_profile().stream_type();
-                auto stream_index = f.get_profile().stream_index();
-                auto stream_format = f.get_profile().format();
-                stream_index_pair sip{stream_type,stream_index};
-
-                ROS_DEBUG("Frameset contain (%s, %d, %s) frame. frame_number: %llu ; frame_TS: %f ; ros_TS(NSec): %lu",
-                            rs2_stream_to_string(stream_type), stream_index, rs2_format_to_string(stream_format), f.get_frame_number(), frame_time, t.toNSec());
-                if (f.is<rs2::video_frame>())
-                    ROS_DEBUG_STREAM("frame: " << f.as<rs2::video_frame>().get_width() << " x " << f.as<rs2::video_frame>().get_height());
-
-                if (f.is<rs2::points>())
-                {
-                    publishPointCloud(f.as<rs2::points>(), t, frameset);
-                    continue;
-                }
-                if (stream_type == RS2_STREAM_DEPTH)
-                {
-                    if (sent_depth_frame) continue;
-                    sent_depth_frame = true;
-                    if (_align_depth && is_color_frame)
-                    {
-                        publishFrame(f, t, COLOR,
-                                    _depth_aligned_image,
-                                    _depth_aligned_info_publisher,
-                                    _depth_aligned_image_publishers,
-                                    false,
-                                    _depth_aligned_seq,
-                                    _depth_aligned_camera_info,
-                                    _depth_aligned_encoding);
-                        continue;
-                    }
-                }
-                publishFrame(f, t,
-                                sip,
-                                _image,
-                                _info_publisher,
-                                _image_publishers,
-                                true,
-                                _seq,
-                                _camera_info,
-                                _encoding);
-            }
-            if (original_depth_frame && _align_depth)
-            {
-                rs2::frame frame_to_send;
-                if (_colorizer)
-                    frame_to_send = _colorizer->process(original_depth_frame);
-                else
-                    frame_to_send = original_depth_frame;
-
-                publishFrame(frame_to_send, t,
-                                DEPTH,
-                                _image,
-                                _info_publisher,
-                                _image_publishers,
-                                true,
-                                _seq,
-                                _camera_info,
-                                _encoding);
-            }
+            job.frameset = frameset;
+            job.is_frameset = true;
+            job.original_depth_frame = original_depth_frame;
+            job.is_color_frame = is_color_frame;
         }
         else if (frame.is<rs2::video_frame>())
         {
@@ -1755,7 +1916,6 @@ void BaseRealSenseNode::frame_callback(rs2::frame frame)
                         rs2_stream_to_string(stream_type), stream_index, frame.get_frame_number(), frame_time, t.toNSec());
             runFirstFrameInitialization(stream_type);
 
-            stream_index_pair sip{stream_type,stream_index};
             if (frame.is<rs2::depth_frame>())
             {
                 if (_clipping_distance > 0)
@@ -1763,7 +1923,99 @@ void BaseRealSenseNode::frame_callback(rs2::frame frame)
                     clip_depth(frame, _clipping_distance);
                 }
             }
-            publishFrame(frame, t,
+        }
+
+        if (job.is_frameset || frame.is<rs2::video_frame>())
+        {
+            if (_frame_pipeline)
+            {
+                // Single frames go through it too, to stay in order with the framesets.
+                if (!_frame_pipeline->Push(std::move(job)))
+                    ROS_WARN_THROTTLE(5, "Frame pipeline is full, dropped the oldest frame");
+            }
+            else
+            {
+                ROS_DEBUG("num_filters: %d", static_cast<int>(_filters.size()));
+                for (const NamedFilter& filter : _filters)
+                    applyFilter(filter, job);
+                publishFrames(job);
+            }
+        }
+    }
+    catch(const std::exception& ex)
+    {
+        ROS_ERROR_STREAM("An error has occurred during frame callback: " << ex.what());
+    }
+    if (!_frame_pipeline)
+        _synced_imu_publisher->Resume();
+} // frame_callback
+
+void BaseRealSenseNode::applyFilter(const NamedFilter& filter, FrameJob& job)
+{
+    if (!job.is_frameset)
+        return;
+    if ((filter._name == "pointcloud") && (!job.original_depth_frame))
+        return;
+    if ((filter._name == "align_to_color") && (!job.is_color_frame))
+        return;
+    ROS_DEBUG("Applying filter: %s", filter._name.c_str());
+    job.frameset = filter._filter->process(job.frameset);
+    // The unaligned depth is published too, colored here so that the filter
+    // stays on its stage's thread.
+    if ((filter._name == "colorizer") && _align_depth && job.original_depth_frame)
+        job.original_depth_frame = filter._filter->process(job.original_depth_frame);
+}
+
+void BaseRealSenseNode::publishFrames(const FrameJob& job)
+{
+    const ros::Time& t = job.t;
+    const double frame_time = job.frame_time;
+    perception_trace::ScopedHop hop("realsense2_camera frames", t);
+    if (job.is_frameset)
+    {
+        rs2::frameset frameset = job.frameset;
+        const rs2::frame& original_depth_frame = job.original_depth_frame;
+        const bool is_color_frame = job.is_color_frame;
+        ROS_DEBUG("List of frameset after applying filters: size: %d", static_cast<int>(frameset.size()));
+        bool sent_depth_frame(false);
+        for (auto it = frameset.begin(); it != frameset.end(); ++it)
+        {
+            auto f = (*it);
+            auto stream_type = f.get_profile().stream_type();
+            auto stream_index = f.get_profile().stream_index();
+            auto stream_format = f.get_profile().format();
+            stream_index_pair sip{stream_type,stream_index};
+
+            ROS_DEBUG("Frameset contain (%s, %d, %s) frame. frame_number: %llu ; frame_TS: %f ; ros_TS(NSec): %lu",
+                        rs2_stream_to_string(stream_type), stream_index, rs2_format_to_string(stream_format), f.get_frame_number(), frame_time, t.toNSec());
+            if (f.is<rs2::video_frame>())
+                ROS_DEBUG_STREAM("frame: " << f.as<rs2::video_frame>().get_width() << " x " << f.as<rs2::video_frame>().get_height());
+
+            if (f.is<rs2::points>())
+            {
+                publishPointCloud(f.as<rs2::points>(), t, frameset);
+                continue;
+            }
+            if (stream_type == RS2_STREAM_DEPTH)
+            {
+                if (sent_depth_frame) continue;
+                sent_depth_frame = true;
+                if (_align_depth && is_color_frame)
+                {
+                    if (!_aligned_depth_history.empty())
+                        keepAlignedDepth(f, t);
+                    publishFrame(f, t, COLOR,
+                                _depth_aligned_image,
+                                _depth_aligned_info_publisher,
+                                _depth_aligned_image_publishers,
+                                false,
+                                _depth_aligned_seq,
+                                _depth_aligned_camera_info,
+                                _depth_aligned_encoding);
+                    continue;
+                }
+            }
+            publishFrame(f, t,
                             sip,
                             _image,
                             _info_publisher,
@@ -1773,13 +2025,34 @@ void BaseRealSenseNode::frame_callback(rs2::frame frame)
                             _camera_info,
                             _encoding);
         }
+        if (original_depth_frame && _align_depth)
+        {
+            publishFrame(original_depth_frame, t,
+                            DEPTH,
+                            _image,
+                            _info_publisher,
+                            _image_publishers,
+                            true,
+                            _seq,
+                            _camera_info,
+                            _encoding);
+        }
     }
-    catch(const std::exception& ex)
+    else
     {
-        ROS_ERROR_STREAM("An error has occurred during frame callback: " << ex.what());
+        const rs2::frame& frame = job.frame;
+        stream_index_pair sip{frame.get_profile().stream_type(), frame.get_profile().stream_index()};
+        publishFrame(frame, t,
+                        sip,
+                        _image,
+                        _info_publisher,
+                        _image_publishers,
+                        true,
+                        _seq,
+                        _camera_info,
+                        _encoding);
     }
-    _synced_imu_publisher->Resume();
-} // frame_callback
+}
 
 void BaseRealSenseNode::multiple_message_callback(rs2::frame frame, imu_sync_method sync_method)
 {
@@ -2155,13 +2428,17 @@ void BaseRealSenseNode::publishIntrinsics()
     }
 }
 
-void reverse_memcpy(unsigned char* dst, const unsigned char* src, size_t n)
+// A pooled message is free again once neither a subscriber nor a publisher's queue of the process holds it.
+template <class M>
+boost::shared_ptr<M> takeFromPool(std::vector<boost::shared_ptr<M>>& pool, size_t max_pool_size)
 {
-    size_t i;
-
-    for (i=0; i < n; ++i)
-        dst[n-1-i] = src[i];
-
+    auto it = std::find_if(pool.begin(), pool.end(), [](const boost::shared_ptr<M>& msg) { return msg.unique(); });
+    if (it != pool.end())
+        return *it;
+    auto msg = boost::make_shared<M>();
+    if (pool.size() < max_pool_size)
+        pool.push_back(msg);
+    return msg;
 }
 
 void BaseRealSenseNode::publishPointCloud(rs2::points pc, const ros::Time& t, const rs2::frameset& frameset)
@@ -2192,34 +2469,21 @@ void BaseRealSenseNode::publishPointCloud(rs2::points pc, const ros::Time& t, co
         warn_count = 0;
     }
 
-    int texture_width(0), texture_height(0);
-    int num_colors(0);
-
     const rs2::vertex* vertex = pc.get_vertices();
-    const rs2::texture_coordinate* color_point = pc.get_texture_coordinates();
-
+    const size_t num_points = pc.size();
     rs2_intrinsics depth_intrin = pc.get_profile().as<rs2::video_stream_profile>().get_intrinsics();
 
-    sensor_msgs::PointCloud2Modifier modifier(_msg_pointcloud);
-    modifier.setPointCloud2FieldsByString(1, "xyz");
-    modifier.resize(pc.size());
-    if (_ordered_pc)
-    {
-        _msg_pointcloud.width = depth_intrin.width;
-        _msg_pointcloud.height = depth_intrin.height;
-        _msg_pointcloud.is_dense = false;
-    }
+    static const size_t max_pool_size = 4;
+    sensor_msgs::PointCloud2Ptr msg = takeFromPool(_pointcloud_msg_pool, max_pool_size);
 
-    vertex = pc.get_vertices();
-    size_t valid_count(0);
+    // Compact layouts: x, y, z and, if textured, the texture packed in a fourth
+    // float, 12 or 16 bytes a point. The fields are only rebuilt when the
+    // texture changes.
+    const char* format_str = nullptr;
+    rs2::frame texture_frame;
     if (use_texture)
     {
-        rs2::video_frame texture_frame = (*texture_frame_itr).as<rs2::video_frame>();
-        texture_width = texture_frame.get_width();
-        texture_height = texture_frame.get_height();
-        num_colors = texture_frame.get_bytes_per_pixel();
-        uint8_t* color_data = (uint8_t*)texture_frame.get_data();
-        std::string format_str;
+        texture_frame = *texture_frame_itr;
         switch(texture_frame.get_profile().format())
         {
             case RS2_FORMAT_RGB8:
@@ -2231,81 +2495,258 @@ void BaseRealSenseNode::publishPointCloud(rs2::points pc, const ros::Time& t, co
             default:
                 throw std::runtime_error("Unhandled texture format passed in pointcloud " + std::to_string(texture_frame.get_profile().format()));
         }
-        _msg_pointcloud.point_step = addPointField(_msg_pointcloud, format_str.c_str(), 1, sensor_msgs::PointField::FLOAT32, _msg_pointcloud.point_step);
-        _msg_pointcloud.row_step = _msg_pointcloud.width * _msg_pointcloud.point_step;
-        _msg_pointcloud.data.resize(_msg_pointcloud.height * _msg_pointcloud.row_step);
-
-        sensor_msgs::PointCloud2Iterator<float>iter_x(_msg_pointcloud, "x");
-        sensor_msgs::PointCloud2Iterator<float>iter_y(_msg_pointcloud, "y");
-        sensor_msgs::PointCloud2Iterator<float>iter_z(_msg_pointcloud, "z");
-        sensor_msgs::PointCloud2Iterator<uint8_t>iter_color(_msg_pointcloud, format_str);
-        color_point = pc.get_texture_coordinates();
+    }
+    const size_t num_fields = format_str ? 4 : 3;
+    if (msg->fields.size() != num_fields || (format_str && msg->fields.back().name != format_str))
+    {
+        sensor_msgs::PointCloud2Modifier modifier(*msg);
+        if (format_str)
+            modifier.setPointCloud2Fields(4, "x", 1, sensor_msgs::PointField::FLOAT32,
+                                             "y", 1, sensor_msgs::PointField::FLOAT32,
+                                             "z", 1, sensor_msgs::PointField::FLOAT32,
+                                             format_str, 1, sensor_msgs::PointField::FLOAT32);
+        else
+            modifier.setPointCloud2Fields(3, "x", 1, sensor_msgs::PointField::FLOAT32,
+                                             "y", 1, sensor_msgs::PointField::FLOAT32,
+                                             "z", 1, sensor_msgs::PointField::FLOAT32);
+    }
+    const uint32_t point_step = msg->point_step;
+    msg->data.resize(num_points * point_step);
+    uint8_t* out = msg->data.data();
 
-        float color_pixel[2];
-        for (size_t point_idx=0; point_idx < pc.size(); point_idx++, vertex++, color_point++)
-        {
-            float i(color_point->u);
-            float j(color_point->v);
-            bool valid_color_pixel(i >= 0.f && i <=1.f && j >= 0.f && j <=1.f);
-            bool valid_pixel(vertex->z > 0 && (valid_color_pixel || _allow_no_texture_points));
-            if (valid_pixel || _ordered_pc)
+    // One pass over the vertices, storing the points back to back; the
+    // unordered cloud keeps only the valid ones.
+    size_t valid_count(0);
+    if (format_str)
+    {
+        rs2::video_frame texture = texture_frame.as<rs2::video_frame>();
+        const rs2::texture_coordinate* color_point = pc.get_texture_coordinates();
+        const int texture_width = texture.get_width();
+        const int texture_height = texture.get_height();
+        const int num_colors = texture.get_bytes_per_pixel();
+        const int stride = texture.get_stride_in_bytes();
+        const uint8_t* color_data = static_cast<const uint8_t*>(texture.get_data());
+        const float scale_u = static_cast<float>(texture_width);
+        const float scale_v = static_cast<float>(texture_height);
+        for (size_t point_idx = 0; point_idx < num_points; point_idx++)
+        {
+            const float u = color_point[point_idx].u;
+            const float v = color_point[point_idx].v;
+            bool valid_color_pixel(u >= 0.f && u <= 1.f && v >= 0.f && v <= 1.f);
+            bool valid_pixel(vertex[point_idx].z > 0 && (valid_color_pixel || _allow_no_texture_points));
+            if (!valid_pixel && !_ordered_pc)
+                continue;
+            uint32_t color = 0;
+            if (valid_color_pixel)
             {
-                *iter_x = vertex->x;
-                *iter_y = vertex->y;
-                *iter_z = vertex->z;
-
-                if (valid_color_pixel)
-                {
-                    color_pixel[0] = i * texture_width;
-                    color_pixel[1] = j * texture_height;
-                    int pixx = static_cast<int>(color_pixel[0]);
-                    int pixy = static_cast<int>(color_pixel[1]);
-                    int offset = (pixy * texture_width + pixx) * num_colors;
-                    reverse_memcpy(&(*iter_color), color_data+offset, num_colors);  // PointCloud2 order of rgb is bgr.
-                }
-                ++iter_x; ++iter_y; ++iter_z;
-                ++iter_color;
-                ++valid_count;
+                // u, v of 1 are the last pixel.
+                int pixx = std::min(static_cast<int>(u * scale_u), texture_width - 1);
+                int pixy = std::min(static_cast<int>(v * scale_v), texture_height - 1);
+                const uint8_t* c = color_data + pixy * stride + pixx * num_colors;
+                // PointCloud2 order of rgb is bgr.
+                color = (num_colors == 3) ? (uint32_t(c[0]) << 16 | uint32_t(c[1]) << 8 | c[2]) : c[0];
             }
+            uint8_t* point = out + valid_count * point_step;
+            memcpy(point, &vertex[point_idx], 3 * sizeof(float));
+            memcpy(point + 3 * sizeof(float), &color, sizeof(color));
+            ++valid_count;
         }
     }
+    else if (_ordered_pc)
+    {
+        // Same layout as the vertices.
+        memcpy(out, vertex, num_points * point_step);
+        valid_count = num_points;
+    }
     else
     {
-        std::string format_str = "intensity";
-        _msg_pointcloud.row_step = _msg_pointcloud.width * _msg_pointcloud.point_step;
-        _msg_pointcloud.data.resize(_msg_pointcloud.height * _msg_pointcloud.row_step);
-
-        sensor_msgs::PointCloud2Iterator<float>iter_x(_msg_pointcloud, "x");
-        sensor_msgs::PointCloud2Iterator<float>iter_y(_msg_pointcloud, "y");
-        sensor_msgs::PointCloud2Iterator<float>iter_z(_msg_pointcloud, "z");
-
-        for (size_t point_idx=0; point_idx < pc.size(); point_idx++, vertex++)
+        for (size_t point_idx = 0; point_idx < num_points; point_idx++)
         {
-            bool valid_pixel(vertex->z > 0);
-            if (valid_pixel || _ordered_pc)
+            if (vertex[point_idx].z > 0)
             {
-                *iter_x = vertex->x;
-                *iter_y = vertex->y;
-                *iter_z = vertex->z;
-
-                ++iter_x; ++iter_y; ++iter_z;
+                memcpy(out + valid_count * point_step, &vertex[point_idx], point_step);
                 ++valid_count;
             }
         }
     }
-    _msg_pointcloud.header.stamp = t;
-    if (_align_depth) _msg_pointcloud.header.frame_id = _optical_frame_id[COLOR];
-    else              _msg_pointcloud.header.frame_id = _optical_frame_id[DEPTH];
-    if (!_ordered_pc)
+
+    msg->header.stamp = t;
+    if (_align_depth) msg->header.frame_id = _optical_frame_id[COLOR];
+    else              msg->header.frame_id = _optical_frame_id[DEPTH];
+    if (_ordered_pc)
+    {
+        msg->width = depth_intrin.width;
+        msg->height = depth_intrin.height;
+        msg->is_dense = false;
+    }
+    else
+    {
+        msg->width = valid_count;
+        msg->height = 1;
+        msg->is_dense = true;
+        msg->data.resize(valid_count * point_step);
+    }
+    msg->row_step = msg->width * point_step;
+    _pointcloud_publisher.publish(msg);
+}
+
+void BaseRealSenseNode::keepAlignedDepth(const rs2::frame& f, const ros::Time& t)
+{
+    // Only the service may need it, or the ROI point cloud of a subscriber.
+    if (_depth_history_frames == 0 && 0 == _roi_pointcloud_publisher.getNumSubscribers())
+        return;
+    if (f.get_profile().format() != RS2_FORMAT_Z16)
+    {
+        ROS_WARN_ONCE("The depth history needs the depth values, not colorized: not kept.");
+        return;
+    }
+    auto depth = f.as<rs2::video_frame>();
+    std::lock_guard<std::mutex> lock(_aligned_depth_mutex);
+    AlignedDepth& slot = _aligned_depth_history[_aligned_depth_next];
+    _aligned_depth_next = (_aligned_depth_next + 1) % _aligned_depth_history.size();
+    slot.t = t;
+    slot.intrinsics = f.get_profile().as<rs2::video_stream_profile>().get_intrinsics();
+    // Copied, as holding librealsense's frames would starve its frame pool.
+    cv::Mat(depth.get_height(), depth.get_width(), CV_16UC1, const_cast<void*>(depth.get_data()), depth.get_stride_in_bytes()).copyTo(slot.depth);
+}
+
+void BaseRealSenseNode::setupGovernor()
+{
+    _governor_idle = false;
+    if (!_governor)
+        return;
+    _governor_idle_frame_skip = std::max(1, _governor_idle_frame_skip);
+    _governor_last_close = ros::Time::now();
+    ROS_INFO_STREAM("Governor: frames skipped to 1 in " << _governor_idle_frame_skip << " without a person within "
+                    << _governor_active_distance << "m on " << _governor_topic);
+    _governor_subscriber = _node_handle.subscribe(_governor_topic, 1, &BaseRealSenseNode::governorCallback, this);
+    // Idles too when the tracker publishes nothing.
+    _governor_timer = _node_handle.createTimer(ros::Duration(0.5), &BaseRealSenseNode::governorTimerCallback, this);
+}
+
+void BaseRealSenseNode::governorCallback(const bayes_people_tracker::PeopleTracker::ConstPtr& people)
+{
+    if (people->distances.empty() || people->min_distance > _governor_active_distance)
+        return;
     {
-        _msg_pointcloud.width = valid_count;
-        _msg_pointcloud.height = 1;
-        _msg_pointcloud.is_dense = true;
-        modifier.resize(valid_count);
+        std::lock_guard<std::mutex> lock(_governor_mutex);
+        _governor_last_close = ros::Time::now();
     }
-    _pointcloud_publisher.publish(_msg_pointcloud);
+    setGovernorIdle(false);
 }
 
+void BaseRealSenseNode::governorTimerCallback(const ros::TimerEvent& event)
+{
+    ros::Time last_close;
+    {
+        std::lock_guard<std::mutex> lock(_governor_mutex);
+        last_close = _governor_last_close;
+    }
+    if ((event.current_real - last_close).toSec() > _governor_hold)
+        setGovernorIdle(true);
+}
+
+void BaseRealSenseNode::setGovernorIdle(bool idle)
+{
+    std::lock_guard<std::mutex> lock(_governor_mutex);
+    if (_governor_idle == idle)
+        return;
+    ROS_INFO(idle ? "Governor: no person close, idle" : "Governor: person close, full rate");
+    auto decimation = std::find_if(_filters.begin(), _filters.end(), [](const NamedFilter& f){return f._name == "decimation";});
+    if (decimation != _filters.end() && _governor_idle_decimation > 0)
+    {
+        if (idle)
+        {
+            _governor_active_decimation = decimation->_filter->get_option(RS2_OPTION_FILTER_MAGNITUDE);
+            decimation->_filter->set_option(RS2_OPTION_FILTER_MAGNITUDE, std::max<float>(_governor_idle_decimation, _governor_active_decimation));
+        }
+        else
+        {
+            decimation->_filter->set_option(RS2_OPTION_FILTER_MAGNITUDE, _governor_active_decimation);
+        }
+    }
+    _governor_idle = idle;
+}
+
+// With _aligned_depth_mutex held.
+const BaseRealSenseNode::AlignedDepth* BaseRealSenseNode::findAlignedDepth(const ros::Time& t) const
+{
+    auto it = std::find_if(_aligned_depth_history.begin(), _aligned_depth_history.end(), [&t](const AlignedDepth& d){return d.t == t && !d.depth.empty();});
+    return it == _aligned_depth_history.end() ? nullptr : &(*it);
+}
+
+void BaseRealSenseNode::roiBoxesCallback(const darknet_ros_msgs::BoundingBoxes::ConstPtr& boxes)
+{
+    if (0 == _roi_pointcloud_publisher.getNumSubscribers())
+        return;
+    // The stamp of the color image the boxes were detected in, which its aligned depth shares.
+    ros::Time stamp = boxes->image_header.stamp.isZero() ? boxes->header.stamp : boxes->image_header.stamp;
+    std::lock_guard<std::mutex> lock(_aligned_depth_mutex);
+    const AlignedDepth* found = findAlignedDepth(stamp);
+    if (!found)
+    {
+        ROS_DEBUG("No aligned depth of stamp %f for the boxes, dropped.", stamp.toSec());
+        return;
+    }
+    const AlignedDepth& aligned_depth = *found;
+    const cv::Mat& depth = aligned_depth.depth;
+
+    static const size_t max_pool_size = 4;
+    sensor_msgs::PointCloud2Ptr msg = takeFromPool(_roi_pointcloud_msg_pool, max_pool_size);
+    if (msg->fields.empty())
+    {
+        sensor_msgs::PointCloud2Modifier modifier(*msg);
+        modifier.setPointCloud2Fields(4, "x", 1, sensor_msgs::PointField::FLOAT32,
+                                         "y", 1, sensor_msgs::PointField::FLOAT32,
+                                         "z", 1, sensor_msgs::PointField::FLOAT32,
+                                         "box", 1, sensor_msgs::PointField::UINT32);
+    }
+    const uint32_t point_step = msg->point_step;
+    const int stride = _roi_pointcloud_stride;
+    size_t max_points = 0;
+    for (const darknet_ros_msgs::BoundingBox& box : boxes->bounding_boxes)
+    {
+        int w = std::min<int>(box.xmax, depth.cols) - std::max<int>(box.xmin, 0);
+        int h = std::min<int>(box.ymax, depth.rows) - std::max<int>(box.ymin, 0);
+        if (w > 0 && h > 0)
+            max_points += static_cast<size_t>((w + stride - 1) / stride) * ((h + stride - 1) / stride);
+    }
+    msg->data.resize(max_points * point_step);
+
+    // Only the pixels of the boxes are deprojected, each point tagged with the index of its box.
+    uint8_t* out = msg->data.data();
+    size_t count = 0;
+    for (uint32_t b = 0; b < boxes->bounding_boxes.size(); ++b)
+    {
+        const darknet_ros_msgs::BoundingBox& box = boxes->bounding_boxes[b];
+        int x_min = std::max<int>(box.xmin, 0), x_max = std::min<int>(box.xmax, depth.cols);
+        int y_min = std::max<int>(box.ymin, 0), y_max = std::min<int>(box.ymax, depth.rows);
+        for (int y = y_min; y < y_max; y += stride)
+        {
+            const uint16_t* row = depth.ptr<uint16_t>(y);
+            for (int x = x_min; x < x_max; x += stride)
+            {
+                if (!row[x])
+                    continue;
+                float pixel[2] = {static_cast<float>(x), static_cast<float>(y)};
+                float point[3];
+                rs2_deproject_pixel_to_point(point, &aligned_depth.intrinsics, pixel, row[x] * _depth_scale_meters);
+                uint8_t* p = out + count * point_step;
+                memcpy(p, point, sizeof(point));
+                memcpy(p + sizeof(point), &b, sizeof(b));
+                ++count;
+            }
+        }
+    }
+    msg->data.resize(count * point_step);
+    msg->width = count;
+    msg->height = 1;
+    msg->row_step = count * point_step;
+    msg->is_dense = true;
+    msg->header.stamp = aligned_depth.t;
+    msg->header.frame_id = _optical_frame_id[COLOR];
+    _roi_pointcloud_publisher.publish(msg);
+}
 
 Extrinsics BaseRealSenseNode::rsExtrinsicsToMsg(const rs2_extrinsics& extrinsics, const std::string& frame_id) const
 {
@@ -2392,11 +2833,6 @@ void BaseRealSenseNode::publishFrame(rs2::frame f, const ros::Time& t,
         }
         image.data = (uint8_t*)f.get_data();
     }
-    if (f.is<rs2::depth_frame>())
-    {
-        image = fix_depth_scale(image, _depth_scaled_image[stream]);
-    }
-
     ++(seq[stream]);
     auto& info_publisher = info_publishers.at(stream);
     auto& image_publisher = image_publishers.at(stream);
@@ -2414,8 +2850,20 @@ void BaseRealSenseNode::publishFrame(rs2::frame f, const ros::Time& t,
         cam_info.header.seq = seq[stream];
         info_publisher.publish(cam_info);
 
-        sensor_msgs::ImagePtr img;
-        img = cv_bridge::CvImage(std_msgs::Header(), encoding.at(stream.first), image).toImageMsg();
+        // Copied once, straight from the frame into a message of the pool,
+        // which nodelets in the process then share; the depth rescaled on the
+        // way, only if someone subscribes.
+        sensor_msgs::ImagePtr img = getImageMessage(&image_publisher, height * width * bpp);
+        if (f.is<rs2::depth_frame>())
+        {
+            cv::Mat msg_image(height, width, image.type(), img->data.data());
+            fix_depth_scale(image, msg_image);
+        }
+        else
+        {
+            memcpy(img->data.data(), image.data, img->data.size());
+        }
+        img->encoding = encoding.at(stream.first);
         img->width = width;
         img->height = height;
         img->is_bigendian = false;
@@ -2434,6 +2882,15 @@ void BaseRealSenseNode::publishFrame(rs2::frame f, const ros::Time& t,
     }
 }
 
+sensor_msgs::ImagePtr BaseRealSenseNode::getImageMessage(const void* publisher, size_t size)
+{
+    static const size_t max_pool_size = 4;
+    std::lock_guard<std::mutex> lock(_image_msg_pool_mutex);
+    sensor_msgs::ImagePtr img = takeFromPool(_image_msg_pool[publisher], max_pool_size);
+    img->data.resize(size);
+    return img;
+}
+
 void BaseRealSenseNode::publishMetadata(rs2::frame f, const ros::Time& header_time, const std::string& frame_id)
 {
     stream_index_pair stream = {f.get_profile().stream_type(), f.get_profile().stream_index()};    
@@ -2557,6 +3014,52 @@ void TemperatureDiagnostics::diagnostics(diagnostic_updater::DiagnosticStatusWra
 void BaseRealSenseNode::publishServices()
 {
     _device_info_srv = std::make_shared<ros::ServiceServer>(_pnh.advertiseService("device_info", &BaseRealSenseNode::getDeviceInfo, this));
+    if (_depth_history_frames > 0)
+        _depth_roi_srv = std::make_shared<ros::ServiceServer>(_pnh.advertiseService("get_depth_roi", &BaseRealSenseNode::getDepthRoi, this));
+}
+
+bool BaseRealSenseNode::getDepthRoi(realsense2_camera::GetDepthRoi::Request& req,
+                                    realsense2_camera::GetDepthRoi::Response& res)
+{
+    std::lock_guard<std::mutex> lock(_aligned_depth_mutex);
+    const AlignedDepth* aligned_depth = findAlignedDepth(req.stamp);
+    res.found = aligned_depth != nullptr;
+    if (!aligned_depth)
+        return true;
+    const cv::Mat& depth = aligned_depth->depth;
+    const rs2_intrinsics& intrinsics = aligned_depth->intrinsics;
+
+    sensor_msgs::CameraInfo& info = res.camera_info;
+    info.header.stamp = aligned_depth->t;
+    info.header.frame_id = _optical_frame_id[COLOR];
+    info.width = intrinsics.width;
+    info.height = intrinsics.height;
+    info.K = {intrinsics.fx, 0, intrinsics.ppx, 0, intrinsics.fy, intrinsics.ppy, 0, 0, 1};
+    info.R = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+    info.P = {intrinsics.fx, 0, intrinsics.ppx, 0, 0, intrinsics.fy, intrinsics.ppy, 0, 0, 0, 1, 0};
+    info.distortion_model = "plumb_bob";
+    info.D.assign(intrinsics.coeffs, intrinsics.coeffs + 5);
+
+    // Each region clipped to the image, in millimeters as on the aligned depth topic.
+    res.depths.resize(req.rois.size());
+    for (size_t i = 0; i < req.rois.size(); ++i)
+    {
+        const sensor_msgs::RegionOfInterest& roi = req.rois[i];
+        cv::Rect rect = cv::Rect(roi.x_offset, roi.y_offset, roi.width, roi.height) & cv::Rect(0, 0, depth.cols, depth.rows);
+        sensor_msgs::Image& img = res.depths[i];
+        img.header = info.header;
+        img.width = rect.width;
+        img.height = rect.height;
+        img.encoding = sensor_msgs::image_encodings::TYPE_16UC1;
+        img.is_bigendian = false;
+        img.step = rect.width * sizeof(uint16_t);
+        img.data.resize(img.step * img.height);
+        if (rect.area() == 0)
+            continue;
+        cv::Mat to_image(rect.height, rect.width, CV_16UC1, img.data.data());
+        fix_depth_scale(depth(rect), to_image);
+    }
+    return true;
 }
 
 bool BaseRealSenseNode::getDeviceInfo(realsense2_camera::DeviceInfo::Request&,
@@ -0,0 +1,272 @@
+// Copyright (C) 2018 - 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef BOX_LIFTING_H
+#define BOX_LIFTING_H
+
+#include <pcl/point_types.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Per-box estimators over a point source of depth_source.h, the box being
+// the pixels [u_min, u_max) x [v_min, v_max), already clipped to the image.
+
+// Scratch buffers of the estimators, kept from box to box.
+struct BoxSamples {
+  std::vector<float> x, y, z;
+  std::vector<int> bins, queue;  // of the segmentation
+  std::vector<unsigned char> mask;
+  
+  void clear() {
+    x.clear();
+    y.clear();
+    z.clear();
+  }
+};
+
+static inline float median(std::vector<float> &values) {
+  std::vector<float>::iterator middle = values.begin() + values.size() / 2;
+  std::nth_element(values.begin(), middle, values.end());
+  return *middle;
+}
+
+// Component-wise median of the points of every stride-th pixel of the box, in
+// both directions: robust to the background and to the holes a single pixel
+// may fall in, for 1 / stride^2 of the full box traversal. False without any
+// point.
+template <typename Source>
+bool medianPoint(const Source &source, int u_min, int v_min, int u_max, int v_max, int stride, BoxSamples &samples, pcl::PointXYZ &center) {
+  stride = std::max(stride, 1);
+  samples.clear();
+  for(int v = v_min + std::min(stride, v_max - v_min) / 2; v < v_max; v += stride) {
+    for(int u = u_min + std::min(stride, u_max - u_min) / 2; u < u_max; u += stride) {
+      pcl::PointXYZ p;
+      if(source.point(u, v, p)) {
+	samples.x.push_back(p.x);
+	samples.y.push_back(p.y);
+	samples.z.push_back(p.z);
+      }
+    }
+  }
+  if(samples.z.empty()) {
+    return false;
+  }
+  center.x = median(samples.x);
+  center.y = median(samples.y);
+  center.z = median(samples.z);
+  return true;
+}
+
+// Bounds of the points of every stride-th pixel of the box, row by row as
+// the image is stored, each coordinate clamped to threshold around center.
+// Clamping commutes with min and max, so it is applied to the bounds only,
+// and the reductions over the packed rows vectorize. False without any point.
+template <typename Source>
+bool boxExtent(const Source &source, int u_min, int v_min, int u_max, int v_max, int stride, const pcl::PointXYZ &center, const float threshold[3],
+	       BoxSamples &rows, pcl::PointXYZ &min, pcl::PointXYZ &max) {
+  stride = std::max(stride, 1);
+  size_t width = (std::max(u_max - u_min, 0) + stride - 1) / stride;
+  rows.x.resize(width);
+  rows.y.resize(width);
+  rows.z.resize(width);
+  float *x = rows.x.data(), *y = rows.y.data(), *z = rows.z.data();
+  float x_min = std::numeric_limits<float>::max(), y_min = x_min, z_min = x_min;
+  float x_max = -x_min, y_max = -x_min, z_max = -x_min;
+  bool found = false;
+  for(int v = v_min; v < v_max; v += stride) {
+    int n = source.row(v, u_min, u_max, stride, x, y, z);
+    found |= n > 0;
+    for(int i = 0; i < n; i++) {
+      x_min = x[i] < x_min ? x[i] : x_min;
+      y_min = y[i] < y_min ? y[i] : y_min;
+      z_min = z[i] < z_min ? z[i] : z_min;
+      x_max = x[i] > x_max ? x[i] : x_max;
+      y_max = y[i] > y_max ? y[i] : y_max;
+      z_max = z[i] > z_max ? z[i] : z_max;
+    }
+  }
+  if(!found) {
+    return false;
+  }
+  min.x = std::min(std::max(x_min, center.x - threshold[0]), center.x + threshold[0]);
+  min.y = std::min(std::max(y_min, center.y - threshold[1]), center.y + threshold[1]);
+  min.z = std::min(std::max(z_min, center.z - threshold[2]), center.z + threshold[2]);
+  max.x = std::min(std::max(x_max, center.x - threshold[0]), center.x + threshold[0]);
+  max.y = std::min(std::max(y_max, center.y - threshold[1]), center.y + threshold[1]);
+  max.z = std::min(std::max(z_max, center.z - threshold[2]), center.z + threshold[2]);
+  return true;
+}
+
+// Depth segmentation of the box on the grid of every stride-th pixel, in
+// both directions. The mode of a histogram of the depths (bins of bin meters)
+// over the inner half of the box is taken as the depth of the person, who
+// fills most of it whatever the background at the sides, and the
+// segment grows from the cell nearest to the box center through 4-connected
+// cells within depth of that mode: the background and the clutter around
+// the person are left out without any fixed extent. The position is the mean
+// of the segment, the extent its bounds. O(box pixels / stride^2), false
+// without any point.
+template <typename Source>
+bool segmentBox(const Source &source, int u_min, int v_min, int u_max, int v_max, int stride, float bin, float depth,
+		BoxSamples &samples, pcl::PointXYZ &center, pcl::PointXYZ &min, pcl::PointXYZ &max) {
+  static const int MAX_BINS = 1024;
+  stride = std::max(stride, 1);
+  const int grid_width = (std::max(u_max - u_min, 0) + stride - 1) / stride;
+  const int grid_height = (std::max(v_max - v_min, 0) + stride - 1) / stride;
+  const int cells = grid_width * grid_height;
+  samples.x.resize(cells);
+  samples.y.resize(cells);
+  samples.z.resize(cells);
+  float z_min = std::numeric_limits<float>::max(), z_max = -z_min;
+  for(int gv = 0, c = 0; gv < grid_height; gv++) {
+    for(int gu = 0; gu < grid_width; gu++, c++) {
+      pcl::PointXYZ p;
+      if(source.point(u_min + gu * stride, v_min + gv * stride, p)) {
+	samples.x[c] = p.x;
+	samples.y[c] = p.y;
+	samples.z[c] = p.z;
+	z_min = std::min(z_min, p.z);
+	z_max = std::max(z_max, p.z);
+      } else {
+	samples.z[c] = std::numeric_limits<float>::quiet_NaN();
+      }
+    }
+  }
+  if(z_min > z_max) {
+    return false;
+  }
+  
+  // the mode, the nearest of equal bins
+  bin = std::max(bin, 0.01f);
+  if((z_max - z_min) / bin >= MAX_BINS) {
+    bin = (z_max - z_min) / (MAX_BINS - 1);
+  }
+  const int count = std::min((int)((z_max - z_min) / bin) + 1, MAX_BINS);
+  samples.bins.assign(count, 0);
+  for(int gv = grid_height / 4; gv < grid_height - grid_height / 4; gv++) {
+    for(int gu = grid_width / 4; gu < grid_width - grid_width / 4; gu++) {
+      const float z = samples.z[gv * grid_width + gu];
+      if(!std::isnan(z)) {
+	samples.bins[std::min((int)((z - z_min) / bin), count - 1)]++;
+      }
+    }
+  }
+  const int mode = std::max_element(samples.bins.begin(), samples.bins.end()) - samples.bins.begin();
+  const float mode_z = z_min + (mode + 0.5f) * bin;
+  if(samples.bins[mode] == 0) {
+    return false; // no depth in the inner half
+  }
+  depth = std::max(depth, 0.5f * bin);
+  
+  // the seed, the cell of the mode nearest to the center
+  samples.mask.assign(cells, 0);
+  int seed = -1, seed_distance = std::numeric_limits<int>::max();
+  for(int gv = 0, c = 0; gv < grid_height; gv++) {
+    for(int gu = 0; gu < grid_width; gu++, c++) {
+      if(std::fabs(samples.z[c] - mode_z) <= depth) { // false for NaN
+	samples.mask[c] = 1;
+	int du = 2 * gu - grid_width, dv = 2 * gv - grid_height;
+	if(du * du + dv * dv < seed_distance) {
+	  seed_distance = du * du + dv * dv;
+	  seed = c;
+	}
+      }
+    }
+  }
+  
+  // the segment, mask 1 for the cells of the mode, 2 once reached
+  double sum_x = 0.0, sum_y = 0.0, sum_z = 0.0;
+  min.x = min.y = min.z = std::numeric_limits<float>::max();
+  max.x = max.y = max.z = -std::numeric_limits<float>::max();
+  samples.queue.clear();
+  samples.queue.push_back(seed);
+  samples.mask[seed] = 2;
+  for(size_t head = 0; head < samples.queue.size(); head++) {
+    const int c = samples.queue[head];
+    const float x = samples.x[c], y = samples.y[c], z = samples.z[c];
+    sum_x += x;
+    sum_y += y;
+    sum_z += z;
+    min.x = std::min(min.x, x); min.y = std::min(min.y, y); min.z = std::min(min.z, z);
+    max.x = std::max(max.x, x); max.y = std::max(max.y, y); max.z = std::max(max.z, z);
+    const int gu = c % grid_width, gv = c / grid_width;
+    const int neighbours[4] = {gu > 0 ? c - 1 : -1, gu + 1 < grid_width ? c + 1 : -1, gv > 0 ? c - grid_width : -1, gv + 1 < grid_height ? c + grid_width : -1};
+    for(int i = 0; i < 4; i++) {
+      if(neighbours[i] >= 0 && samples.mask[neighbours[i]] == 1) {
+	samples.mask[neighbours[i]] = 2;
+	samples.queue.push_back(neighbours[i]);
+      }
+    }
+  }
+  const double n = samples.queue.size();
+  center.x = sum_x / n;
+  center.y = sum_y / n;
+  center.z = sum_z / n;
+  return true;
+}
+
+struct BoxLiftingParams {
+  bool median_position;  // or the center pixel
+  int sample_stride;
+  int extent_stride;
+  float thresholds[3];
+  bool extent;           // only the markers need it
+  bool segmentation;     // segmentBox() instead of the above
+  int segment_stride;
+  float segment_bin;
+  float segment_depth;
+};
+
+// One box lifted to 3D, written by one thread only.
+struct BoxResult {
+  bool found;
+  pcl::PointXYZ center;
+  pcl::PointXYZ min;
+  pcl::PointXYZ max;
+};
+
+// The box [x_min, x_max) x [y_min, y_max) of the color image, found only if its
+// position has a depth.
+template <typename Source>
+void liftBox(const Source &source, int x_min, int y_min, int x_max, int y_max, const BoxLiftingParams &params, BoxSamples &samples, BoxResult &result) {
+  int u_min = std::max(x_min, 0), u_max = std::min(x_max, source.width());
+  int v_min = std::max(y_min, 0), v_max = std::min(y_max, source.height());
+  int x_center = (x_max + x_min) / 2;
+  int y_center = (y_max + y_min) / 2;
+  
+  result.found = false;
+  if(params.segmentation) {
+    result.found = segmentBox(source, u_min, v_min, u_max, v_max, params.segment_stride, params.segment_bin, params.segment_depth,
+			      samples, result.center, result.min, result.max);
+    return;
+  }
+  if(params.median_position) {
+    if(!medianPoint(source, u_min, v_min, u_max, v_max, params.sample_stride, samples, result.center)) {
+      return;
+    }
+  } else if(x_center < 0 || y_center < 0 || x_center >= source.width() || y_center >= source.height() || !source.point(x_center, y_center, result.center)) {
+    return;
+  }
+  result.min = result.max = result.center;
+  if(params.extent) {
+    boxExtent(source, u_min, v_min, u_max, v_max, params.extent_stride, result.center, params.thresholds, samples, result.min, result.max);
+  }
+  result.found = true;
+}
+
+#endif // BOX_LIFTING_H
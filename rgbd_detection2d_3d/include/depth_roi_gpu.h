@@ -0,0 +1,60 @@
+// Copyright (C) 2018 - 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef DEPTH_ROI_GPU_H
+#define DEPTH_ROI_GPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A box of the color image, as in darknet_ros_msgs/BoundingBox.
+struct DepthRoiBox {
+  int x_min, y_min, x_max, y_max;
+};
+
+struct DepthRoiResult {
+  int found;
+  float center[3];
+  float min[3];
+  float max[3];
+};
+
+// All the boxes of a frame lifted by one kernel launch, one block per box, on
+// a depth image as DepthSource reads it. The depth, boxes and results live in
+// managed memory, which on a Jetson is the same memory as the CPU's: the
+// upload is a plain copy, and only the results are read back.
+// The position of a box is the mean of its sampled points around the median
+// of their depth histogram (4 cm bins up to 10 m), the extent is clamped to
+// thresholds around it as on the CPU.
+class DepthRoiGpu {
+public:
+  static const int MAX_BOXES = 256;
+  
+  DepthRoiGpu();
+  ~DepthRoiGpu();
+  
+  // intrinsics: fx, fy, cx, cy. False if the GPU failed, results untouched then.
+  bool lift(const uint8_t *depth, int width, int height, size_t step, bool millimeters, const float intrinsics[4],
+	    const DepthRoiBox *boxes, int count, int sample_stride, int extent_stride, const float thresholds[3], DepthRoiResult *results);
+  
+private:
+  uint8_t *depth_;          // managed
+  size_t depth_capacity_;
+  DepthRoiBox *boxes_;      // managed, MAX_BOXES
+  DepthRoiResult *results_; // managed, MAX_BOXES
+  void *stream_;            // cudaStream_t, kept out of this header
+};
+
+#endif // DEPTH_ROI_GPU_H
@@ -0,0 +1,154 @@
+// Copyright (C) 2018 - 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef DEPTH_SOURCE_H
+#define DEPTH_SOURCE_H
+
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/image_encodings.h>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <cmath>
+#include <cstring>
+
+// Where the 3D point behind a pixel of the color image comes from. Both
+// sources answer point(u, v, p) for pixels inside the image, false when the
+// pixel has no depth, and row(v, u_min, u_max, stride, x, y, z): the points of
+// every stride-th pixel of [u_min, u_max) in row v, packed into x, y and z,
+// their number returned. Nothing is bounds checked.
+
+// An organized cloud registered to the color image.
+struct CloudSource {
+  explicit CloudSource(const pcl::PointCloud<pcl::PointXYZRGB> &cloud) : cloud_(cloud) {}
+  
+  int width() const { return cloud_.width; }
+  int height() const { return cloud_.height; }
+  bool point(int u, int v, pcl::PointXYZ &p) const {
+    const pcl::PointXYZRGB &q = cloud_.points[(size_t)v * cloud_.width + u];
+    if(std::isnan(q.x) || std::isnan(q.y) || std::isnan(q.z)) {
+      return false;
+    }
+    p.x = q.x;
+    p.y = q.y;
+    p.z = q.z;
+    return true;
+  }
+  int row(int v, int u_min, int u_max, int stride, float *x, float *y, float *z) const {
+    const pcl::PointXYZRGB *q = &cloud_.points[(size_t)v * cloud_.width];
+    int n = 0;
+    for(int u = u_min; u < u_max; u += stride) {
+      x[n] = q[u].x;
+      y[n] = q[u].y;
+      z[n] = q[u].z;
+      n += !(std::isnan(q[u].x) || std::isnan(q[u].y) || std::isnan(q[u].z));
+    }
+    return n;
+  }
+  
+private:
+  const pcl::PointCloud<pcl::PointXYZRGB> &cloud_;
+};
+
+// A depth image aligned to the color image, deprojected pixel by pixel with
+// the pinhole model of its (rectified) camera info: only the pixels asked
+// for are ever touched.
+struct DepthSource {
+  DepthSource() : data_(NULL), step_(0), width_(0), height_(0), millimeters_(false), fx_(1.0f), fy_(1.0f), cx_(0.0f), cy_(0.0f) {}
+  
+  // False for other encodings than 16UC1 (millimeters) and 32FC1 (meters), or without intrinsics.
+  bool init(const sensor_msgs::Image &image, const sensor_msgs::CameraInfo &info) {
+    if(image.encoding == sensor_msgs::image_encodings::TYPE_16UC1 || image.encoding == sensor_msgs::image_encodings::MONO16) {
+      millimeters_ = true;
+    } else if(image.encoding == sensor_msgs::image_encodings::TYPE_32FC1) {
+      millimeters_ = false;
+    } else {
+      return false;
+    }
+    if(image.is_bigendian || info.K[0] <= 0.0 || info.K[4] <= 0.0 || image.data.size() < (size_t)image.step * image.height) {
+      return false;
+    }
+    data_ = image.data.data();
+    step_ = image.step;
+    width_ = image.width;
+    height_ = image.height;
+    fx_ = info.K[0];
+    fy_ = info.K[4];
+    cx_ = info.K[2];
+    cy_ = info.K[5];
+    return true;
+  }
+  
+  int width() const { return width_; }
+  int height() const { return height_; }
+  const uint8_t *data() const { return data_; }
+  uint32_t step() const { return step_; }
+  bool millimeters() const { return millimeters_; }
+  void intrinsics(float k[4]) const {
+    k[0] = fx_;
+    k[1] = fy_;
+    k[2] = cx_;
+    k[3] = cy_;
+  }
+  bool point(int u, int v, pcl::PointXYZ &p) const {
+    const uint8_t *row = data_ + (size_t)v * step_;
+    float z;
+    if(millimeters_) {
+      uint16_t d;
+      memcpy(&d, row + u * sizeof(uint16_t), sizeof(d));
+      z = d * 0.001f;
+    } else {
+      memcpy(&z, row + u * sizeof(float), sizeof(z));
+    }
+    if(!(z > 0.0f) || std::isinf(z)) { // 0 and NaN are no depth
+      return false;
+    }
+    p.x = (u - cx_) * z / fx_;
+    p.y = (v - cy_) * z / fy_;
+    p.z = z;
+    return true;
+  }
+  int row(int v, int u_min, int u_max, int stride, float *x, float *y, float *z) const {
+    const uint8_t *line = data_ + (size_t)v * step_;
+    const float y_factor = (v - cy_) / fy_;
+    int n = 0;
+    for(int u = u_min; u < u_max; u += stride) {
+      float d;
+      if(millimeters_) {
+	uint16_t mm;
+	memcpy(&mm, line + u * sizeof(uint16_t), sizeof(mm));
+	d = mm * 0.001f;
+      } else {
+	memcpy(&d, line + u * sizeof(float), sizeof(d));
+      }
+      x[n] = (u - cx_) * d / fx_;
+      y[n] = y_factor * d;
+      z[n] = d;
+      n += d > 0.0f && !std::isinf(d);
+    }
+    return n;
+  }
+  
+private:
+  const uint8_t *data_;
+  uint32_t step_;
+  int width_;
+  int height_;
+  bool millimeters_;
+  float fx_, fy_, cx_, cy_;
+};
+
+#endif // DEPTH_SOURCE_H
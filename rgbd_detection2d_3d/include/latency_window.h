@@ -0,0 +1,54 @@
+// Copyright (C) 2018 - 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LATENCY_WINDOW_H
+#define LATENCY_WINDOW_H
+
+#include <algorithm>
+#include <vector>
+
+// The last samples of a delay, in milliseconds, and their percentiles. Used
+// from the callbacks of the node only, not thread safe.
+class LatencyWindow {
+public:
+  explicit LatencyWindow(size_t window = 256) : samples_(window), next_(0), count_(0) {}
+  
+  void add(double ms) {
+    samples_[next_] = ms;
+    next_ = (next_ + 1) % samples_.size();
+    count_ = std::min(count_ + 1, samples_.size());
+  }
+  size_t count() const { return count_; }
+  // False while no sample has been added.
+  bool percentiles(double &p50, double &p90, double &max) {
+    if(count_ == 0) {
+      return false;
+    }
+    sorted_.assign(samples_.begin(), samples_.begin() + count_);
+    std::sort(sorted_.begin(), sorted_.end());
+    p50 = sorted_[(count_ - 1) / 2];
+    p90 = sorted_[(count_ - 1) * 9 / 10];
+    max = sorted_.back();
+    return true;
+  }
+  
+private:
+  std::vector<double> samples_;  // ring buffer
+  size_t next_;
+  size_t count_;
+  std::vector<double> sorted_;   // scratch
+};
+
+#endif // LATENCY_WINDOW_H
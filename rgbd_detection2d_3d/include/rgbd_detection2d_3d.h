@@ -0,0 +1,123 @@
+// Copyright (C) 2018 - 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RGBD_DETECTION2D_3D_H
+#define RGBD_DETECTION2D_3D_H
+
+// ROS
+#include <ros/ros.h>
+#include <message_filters/subscriber.h>
+#include <message_filters/time_synchronizer.h>
+#include <message_filters/sync_policies/approximate_time.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <darknet_ros_msgs/BoundingBoxes.h>
+#include <people_msgs/People.h>
+#include <people_msgs/PositionMeasurementArray.h>
+#include <visualization_msgs/MarkerArray.h>
+#include <diagnostic_updater/diagnostic_updater.h>
+
+#include "box_lifting.h"
+#ifdef RGBD_DETECTION2D_3D_GPU
+#include "depth_roi_gpu.h"
+#endif
+#include "stamp_ring.h"
+#include "latency_window.h"
+
+// The boxes of darknet_ros lifted to 3D with the depth of the camera, for the
+// node and the nodelet: subscribes with n, publishes and reads its parameters
+// with private_nh.
+class RgbdDetection2d3d {
+public:
+  RgbdDetection2d3d(ros::NodeHandle n = ros::NodeHandle(), ros::NodeHandle private_nh = ros::NodeHandle("~"));
+  ~RgbdDetection2d3d();
+  
+private:
+  // How stale the inputs are, every delay from the capture of the image the
+  // boxes were detected in, c.f. the "latency" and "drops" diagnostics.
+  enum Stage { STAGE_YOLO, STAGE_MATCH, STAGE_LIFT, STAGE_PUBLISH, STAGE_DEPTH_OFFSET, STAGE_COUNT };
+  
+  void beginLift(const darknet_ros_msgs::BoundingBoxes &boxes, const std_msgs::Header &header);
+  void countBoxes(const darknet_ros_msgs::BoundingBoxes::ConstPtr &);
+  template <typename M>
+  void countFrame(const boost::shared_ptr<const M> &);
+  void latencyDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  void dropDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat);
+  template <typename Source>
+  void detect(const darknet_ros_msgs::BoundingBoxes::ConstPtr& detect_2d, const Source &source, const std_msgs::Header &header);
+  void publishResults(const std_msgs::Header &header);
+  void cloudCallback(const darknet_ros_msgs::BoundingBoxes::ConstPtr& detect_2d, const sensor_msgs::PointCloud2::ConstPtr& depth_points);
+  void depthCallback(const darknet_ros_msgs::BoundingBoxes::ConstPtr& detect_2d, const sensor_msgs::Image::ConstPtr& depth, const sensor_msgs::CameraInfo::ConstPtr& info);
+  bool matchBoxes(const darknet_ros_msgs::BoundingBoxes::ConstPtr& detect_2d);
+  void boxesCallback(const darknet_ros_msgs::BoundingBoxes::ConstPtr& detect_2d);
+  void retryPendingBoxes(const ros::Time &newest);
+  void cloudFrameCallback(const sensor_msgs::PointCloud2::ConstPtr& depth_points);
+  void depthFrameCallback(const sensor_msgs::Image::ConstPtr& depth);
+  void depthInfoCallback(const sensor_msgs::CameraInfo::ConstPtr& info);
+  
+  typedef message_filters::sync_policies::ApproximateTime<darknet_ros_msgs::BoundingBoxes, sensor_msgs::PointCloud2> ApproximateTimePolicy;
+  typedef message_filters::sync_policies::ApproximateTime<darknet_ros_msgs::BoundingBoxes, sensor_msgs::Image, sensor_msgs::CameraInfo> DepthApproximateTimePolicy;
+  
+  ros::Publisher people_pub_;
+  ros::Publisher measurements_pub_;
+  ros::Publisher markers_pub_;
+  BoxLiftingParams params_;
+  int threads_;
+  // per-box slots and per-thread scratch, kept from frame to frame
+  std::vector<BoxResult> results_;
+  std::vector<BoxSamples> samples_;
+#ifdef RGBD_DETECTION2D_3D_GPU
+  // all boxes of a depth image in one kernel launch, c.f. depth_roi_gpu.h
+  boost::shared_ptr<DepthRoiGpu> gpu_;
+  std::vector<DepthRoiBox> gpu_boxes_;
+  std::vector<DepthRoiResult> gpu_results_;
+#endif
+  
+  LatencyWindow stage_stats_[STAGE_COUNT];
+  diagnostic_updater::Updater *diagnostics_;
+  ros::Time image_stamp_;  // of the boxes being lifted
+  ros::Time lift_begin_;   // when they were matched with their depth
+  unsigned long boxes_received_, boxes_lifted_;
+  unsigned long frames_received_, frames_used_;
+  
+  // The found results_, in their order. The messages are refilled in place
+  // while no intra-process subscriber still holds them, c.f. publishResults,
+  // and the markers are only built for a subscriber.
+  people_msgs::PeoplePtr people_;
+  people_msgs::PositionMeasurementArrayPtr measurements_;
+  visualization_msgs::MarkerArrayPtr markers_;
+  
+  // Matching on the stamp of the image the boxes were detected in
+  // (image_header, set by darknet_ros): the depth frames wait in small rings,
+  // the boxes look their frame up. Boxes are usually later than their depth
+  // frame, otherwise the newest boxes wait for it, replaced by the next ones.
+  bool use_depth_image_;
+  double stamp_tolerance_;
+  StampRing<sensor_msgs::PointCloud2> cloud_ring_;
+  StampRing<sensor_msgs::Image> depth_ring_;
+  sensor_msgs::CameraInfo::ConstPtr depth_info_;
+  darknet_ros_msgs::BoundingBoxes::ConstPtr pending_boxes_;
+  
+  ros::Subscriber boxes_sub_, frames_sub_, info_sub_;
+  message_filters::Subscriber<darknet_ros_msgs::BoundingBoxes> detection_2d_;
+  message_filters::Subscriber<sensor_msgs::PointCloud2> depth_registered_points_;
+  message_filters::Subscriber<sensor_msgs::Image> depth_image_;
+  message_filters::Subscriber<sensor_msgs::CameraInfo> depth_info_sub_;
+  boost::shared_ptr<message_filters::Synchronizer<ApproximateTimePolicy> > sync_;
+  boost::shared_ptr<message_filters::Synchronizer<DepthApproximateTimePolicy> > depth_sync_;
+};
+
+#endif // RGBD_DETECTION2D_3D_H
@@ -0,0 +1,67 @@
+// Copyright (C) 2018 - 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef STAMP_RING_H
+#define STAMP_RING_H
+
+#include <ros/time.h>
+#include <boost/shared_ptr.hpp>
+
+#include <cmath>
+#include <vector>
+
+// The last few messages of a topic, found by their header stamp. The oldest
+// one is overwritten by every new message, so memory is bounded and nothing
+// stale is kept for longer than capacity messages.
+template <typename M>
+class StampRing {
+public:
+  typedef boost::shared_ptr<const M> ConstPtr;
+  
+  explicit StampRing(size_t capacity = 4) : messages_(std::max(capacity, (size_t)1)), next_(0) {}
+  
+  void push(const ConstPtr &msg) {
+    messages_[next_] = msg;
+    next_ = (next_ + 1) % messages_.size();
+  }
+  
+  // The message nearest to stamp, NULL if none is within tolerance (seconds).
+  ConstPtr find(const ros::Time &stamp, double tolerance) const {
+    ConstPtr best;
+    double best_offset = tolerance;
+    for(size_t i = 0; i < messages_.size(); i++) {
+      if(messages_[i]) {
+	double offset = std::fabs((messages_[i]->header.stamp - stamp).toSec());
+	if(offset <= best_offset) {
+	  best = messages_[i];
+	  best_offset = offset;
+	}
+      }
+    }
+    return best;
+  }
+  
+  // The stamp of the newest message, zero if empty.
+  ros::Time newest() const {
+    const ConstPtr &msg = messages_[(next_ + messages_.size() - 1) % messages_.size()];
+    return msg ? msg->header.stamp : ros::Time();
+  }
+  
+private:
+  std::vector<ConstPtr> messages_;
+  size_t next_;
+};
+
+#endif // STAMP_RING_H
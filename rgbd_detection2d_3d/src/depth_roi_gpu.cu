@@ -0,0 +1,230 @@
+// Copyright (C) 2018 - 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "depth_roi_gpu.h"
+
+#include <cuda_runtime.h>
+#include <cfloat>
+#include <cstring>
+
+#define BLOCK_SIZE 256
+#define DEPTH_BINS 256
+#define DEPTH_BIN 0.04f // m
+
+struct DepthImage {
+  const uint8_t *data;
+  size_t step;
+  int width;
+  int height;
+  bool millimeters;
+  float fx, fy, cx, cy;
+  
+  // Same deprojection as DepthSource::point().
+  __device__ bool point(int u, int v, float *p) const {
+    const uint8_t *row = data + (size_t)v * step;
+    float z = millimeters ? reinterpret_cast<const uint16_t *>(row)[u] * 0.001f : reinterpret_cast<const float *>(row)[u];
+    if(!(z > 0.0f) || isinf(z)) {
+      return false;
+    }
+    p[0] = (u - cx) * z / fx;
+    p[1] = (v - cy) * z / fy;
+    p[2] = z;
+    return true;
+  }
+};
+
+// The i-th pixel of the stride grid of a w_cells wide box, as medianPoint() samples it.
+__device__ void gridPixel(int i, int w_cells, int u0, int v0, int stride, int &u, int &v) {
+  u = u0 + (i % w_cells) * stride;
+  v = v0 + (i / w_cells) * stride;
+}
+
+__global__ void liftBoxesKernel(DepthImage image, const DepthRoiBox *boxes, int sample_stride, int extent_stride,
+				float tx, float ty, float tz, DepthRoiResult *results) {
+  __shared__ unsigned int histogram[DEPTH_BINS];
+  __shared__ float reduce[6][BLOCK_SIZE];
+  __shared__ float center[3];
+  __shared__ unsigned int median_bin, samples;
+  
+  const DepthRoiBox box = boxes[blockIdx.x];
+  DepthRoiResult &result = results[blockIdx.x];
+  int u_min = max(box.x_min, 0), u_max = min(box.x_max, image.width);
+  int v_min = max(box.y_min, 0), v_max = min(box.y_max, image.height);
+  int w = max(u_max - u_min, 0), h = max(v_max - v_min, 0);
+  
+  for(int b = threadIdx.x; b < DEPTH_BINS; b += blockDim.x) {
+    histogram[b] = 0;
+  }
+  __syncthreads();
+  
+  // depth histogram of the sampled pixels
+  int s_u0 = u_min + min(sample_stride, w) / 2, s_v0 = v_min + min(sample_stride, h) / 2;
+  int s_w = w > 0 ? (u_max - s_u0 + sample_stride - 1) / sample_stride : 0;
+  int s_h = h > 0 ? (v_max - s_v0 + sample_stride - 1) / sample_stride : 0;
+  for(int i = threadIdx.x; i < s_w * s_h; i += blockDim.x) {
+    int u, v;
+    float p[3];
+    gridPixel(i, s_w, s_u0, s_v0, sample_stride, u, v);
+    if(image.point(u, v, p)) {
+      atomicAdd(&histogram[min((int)(p[2] / DEPTH_BIN), DEPTH_BINS - 1)], 1u);
+    }
+  }
+  __syncthreads();
+  
+  if(threadIdx.x == 0) {
+    unsigned int total = 0;
+    for(int b = 0; b < DEPTH_BINS; b++) {
+      total += histogram[b];
+    }
+    unsigned int half = (total + 1) / 2, sum = 0;
+    int b = 0;
+    while(b < DEPTH_BINS - 1 && sum + histogram[b] < half) {
+      sum += histogram[b++];
+    }
+    median_bin = b;
+    samples = total;
+  }
+  __syncthreads();
+  if(samples == 0) {
+    if(threadIdx.x == 0) {
+      result.found = 0;
+    }
+    return;
+  }
+  
+  // mean of the samples of the median bin and its neighbours
+  float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  for(int i = threadIdx.x; i < s_w * s_h; i += blockDim.x) {
+    int u, v;
+    float p[3];
+    gridPixel(i, s_w, s_u0, s_v0, sample_stride, u, v);
+    if(image.point(u, v, p) && abs(min((int)(p[2] / DEPTH_BIN), DEPTH_BINS - 1) - (int)median_bin) <= 1) {
+      sum[0] += p[0];
+      sum[1] += p[1];
+      sum[2] += p[2];
+      sum[3] += 1.0f;
+    }
+  }
+  for(int k = 0; k < 4; k++) {
+    reduce[k][threadIdx.x] = sum[k];
+  }
+  __syncthreads();
+  for(int s = blockDim.x / 2; s > 0; s >>= 1) {
+    if(threadIdx.x < s) {
+      for(int k = 0; k < 4; k++) {
+	reduce[k][threadIdx.x] += reduce[k][threadIdx.x + s];
+      }
+    }
+    __syncthreads();
+  }
+  if(threadIdx.x == 0) {
+    for(int k = 0; k < 3; k++) {
+      center[k] = reduce[k][0] / reduce[3][0];
+    }
+  }
+  __syncthreads();
+  
+  // bounds of the extent grid, clamped afterwards as boxExtent() does
+  float bounds[6] = {FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX};
+  int e_w = (w + extent_stride - 1) / extent_stride, e_h = (h + extent_stride - 1) / extent_stride;
+  for(int i = threadIdx.x; i < e_w * e_h; i += blockDim.x) {
+    int u, v;
+    float p[3];
+    gridPixel(i, e_w, u_min, v_min, extent_stride, u, v);
+    if(image.point(u, v, p)) {
+      for(int k = 0; k < 3; k++) {
+	bounds[k] = fminf(bounds[k], p[k]);
+	bounds[k+3] = fmaxf(bounds[k+3], p[k]);
+      }
+    }
+  }
+  for(int k = 0; k < 6; k++) {
+    reduce[k][threadIdx.x] = bounds[k];
+  }
+  __syncthreads();
+  for(int s = blockDim.x / 2; s > 0; s >>= 1) {
+    if(threadIdx.x < s) {
+      for(int k = 0; k < 3; k++) {
+	reduce[k][threadIdx.x] = fminf(reduce[k][threadIdx.x], reduce[k][threadIdx.x + s]);
+	reduce[k+3][threadIdx.x] = fmaxf(reduce[k+3][threadIdx.x], reduce[k+3][threadIdx.x + s]);
+      }
+    }
+    __syncthreads();
+  }
+  if(threadIdx.x == 0) {
+    const float t[3] = {tx, ty, tz};
+    for(int k = 0; k < 3; k++) {
+      result.center[k] = center[k];
+      result.min[k] = fminf(fmaxf(reduce[k][0], center[k] - t[k]), center[k] + t[k]);
+      result.max[k] = fminf(fmaxf(reduce[k+3][0], center[k] - t[k]), center[k] + t[k]);
+    }
+    result.found = 1;
+  }
+}
+
+DepthRoiGpu::DepthRoiGpu() : depth_(NULL), depth_capacity_(0) {
+  cudaMallocManaged(&boxes_, sizeof(DepthRoiBox) * MAX_BOXES);
+  cudaMallocManaged(&results_, sizeof(DepthRoiResult) * MAX_BOXES);
+  cudaStream_t stream;
+  cudaStreamCreate(&stream);
+  stream_ = stream;
+}
+
+DepthRoiGpu::~DepthRoiGpu() {
+  cudaStreamDestroy(static_cast<cudaStream_t>(stream_));
+  cudaFree(depth_);
+  cudaFree(boxes_);
+  cudaFree(results_);
+}
+
+bool DepthRoiGpu::lift(const uint8_t *depth, int width, int height, size_t step, bool millimeters, const float intrinsics[4],
+		       const DepthRoiBox *boxes, int count, int sample_stride, int extent_stride, const float thresholds[3], DepthRoiResult *results) {
+  cudaStream_t stream = static_cast<cudaStream_t>(stream_);
+  size_t bytes = step * height;
+  if(bytes > depth_capacity_) {
+    cudaFree(depth_);
+    if(cudaMallocManaged(&depth_, bytes) != cudaSuccess) {
+      depth_ = NULL;
+      depth_capacity_ = 0;
+      return false;
+    }
+    depth_capacity_ = bytes;
+  }
+  memcpy(depth_, depth, bytes);
+  
+  DepthImage image;
+  image.data = depth_;
+  image.step = step;
+  image.width = width;
+  image.height = height;
+  image.millimeters = millimeters;
+  image.fx = intrinsics[0];
+  image.fy = intrinsics[1];
+  image.cx = intrinsics[2];
+  image.cy = intrinsics[3];
+  sample_stride = sample_stride > 1 ? sample_stride : 1;
+  extent_stride = extent_stride > 1 ? extent_stride : 1;
+  
+  for(int first = 0; first < count; first += MAX_BOXES) {
+    int n = count - first < MAX_BOXES ? count - first : MAX_BOXES;
+    memcpy(boxes_, boxes + first, sizeof(DepthRoiBox) * n);
+    liftBoxesKernel<<<n, BLOCK_SIZE, 0, stream>>>(image, boxes_, sample_stride, extent_stride, thresholds[0], thresholds[1], thresholds[2], results_);
+    if(cudaStreamSynchronize(stream) != cudaSuccess) {
+      return false;
+    }
+    memcpy(results + first, results_, sizeof(DepthRoiResult) * n);
+  }
+  return true;
+}
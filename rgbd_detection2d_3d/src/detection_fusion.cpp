@@ -0,0 +1,180 @@
+// Copyright (C) 2018 - 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Fusion of the lidar (object3d_detector_gpu) and RGB-D (rgbd_detection2d_3d)
+// measurements before the tracker: every lidar message takes the latest
+// RGB-D message close enough in time, both are brought into the lidar's
+// frame, and detections of the same person (nearest neighbours within
+// association_distance) become one measurement, at the position weighted by
+// the inverse variances of the two detectors, with the reliability of either
+// detector being right. Unmatched detections are kept. The tracker then sees
+// one detector and runs one association per fused batch.
+
+// ROS
+#include <ros/ros.h>
+#include <tf/transform_listener.h>
+#include <people_msgs/PositionMeasurementArray.h>
+
+#include <cmath>
+#include <vector>
+
+ros::Publisher measurements_pub_;
+tf::TransformListener *listener_;
+double max_age_;
+double association_distance_;
+double lidar_variance_, camera_variance_;
+double lidar_reliability_, camera_reliability_;
+std::string fused_name_;
+
+// waiting for a lidar message, published alone once too old
+people_msgs::PositionMeasurementArray::ConstPtr camera_msg_;
+
+// The positions of msg in frame at its stamp, false without the transform.
+bool toFrame(const people_msgs::PositionMeasurementArray &msg, const std::string &frame, std::vector<tf::Point> &points) {
+  points.clear();
+  tf::StampedTransform transform;
+  try {
+    if(msg.header.frame_id == frame) {
+      transform.setIdentity();
+    } else {
+      listener_->lookupTransform(frame, msg.header.frame_id, msg.header.stamp, transform);
+    }
+  } catch(tf::TransformException &ex) {
+    ROS_WARN_THROTTLE(5.0, "[detection_fusion] %s", ex.what());
+    return false;
+  }
+  for(size_t i = 0; i < msg.people.size(); i++) {
+    points.push_back(transform * tf::Point(msg.people[i].pos.x, msg.people[i].pos.y, msg.people[i].pos.z));
+  }
+  return true;
+}
+
+double reliability(const people_msgs::PositionMeasurement &pm, double fallback) {
+  return pm.reliability > 0.0 ? pm.reliability : fallback; // neither detector sets it yet
+}
+
+people_msgs::PositionMeasurement measurement(const std_msgs::Header &header, const tf::Point &p, double reliability, double variance) {
+  people_msgs::PositionMeasurement pm;
+  pm.header = header;
+  pm.name = fused_name_;
+  pm.pos.x = p.x();
+  pm.pos.y = p.y();
+  pm.pos.z = p.z();
+  pm.reliability = reliability;
+  pm.covariance[0] = pm.covariance[4] = pm.covariance[8] = variance;
+  return pm;
+}
+
+void publishCamera(const people_msgs::PositionMeasurementArray &camera) {
+  people_msgs::PositionMeasurementArray fused;
+  fused.header = camera.header;
+  std::vector<tf::Point> points;
+  toFrame(camera, camera.header.frame_id, points);
+  for(size_t i = 0; i < points.size(); i++) {
+    fused.people.push_back(measurement(camera.header, points[i], reliability(camera.people[i], camera_reliability_), camera_variance_));
+  }
+  measurements_pub_.publish(fused);
+}
+
+void cameraCallback(const people_msgs::PositionMeasurementArray::ConstPtr &camera) {
+  if(camera_msg_ && !camera_msg_->people.empty()) {
+    publishCamera(*camera_msg_); // no lidar message came for it
+  }
+  camera_msg_ = camera;
+}
+
+void lidarCallback(const people_msgs::PositionMeasurementArray::ConstPtr &lidar) {
+  people_msgs::PositionMeasurementArray fused;
+  fused.header = lidar->header;
+  
+  std::vector<tf::Point> lidar_points, camera_points;
+  toFrame(*lidar, lidar->header.frame_id, lidar_points);
+  people_msgs::PositionMeasurementArray::ConstPtr camera;
+  if(camera_msg_ && fabs((camera_msg_->header.stamp - lidar->header.stamp).toSec()) <= max_age_ &&
+     toFrame(*camera_msg_, lidar->header.frame_id, camera_points)) {
+    camera = camera_msg_;
+    camera_msg_.reset();
+  }
+  
+  // greedy nearest neighbours, closest pairs first, each detection used once
+  std::vector<int> lidar_match(lidar_points.size(), -1), camera_match(camera_points.size(), -1);
+  while(true) {
+    double best = association_distance_ * association_distance_;
+    int bi = -1, bj = -1;
+    for(size_t i = 0; i < lidar_points.size(); i++) {
+      for(size_t j = 0; lidar_match[i] < 0 && j < camera_points.size(); j++) {
+	double dx = lidar_points[i].x() - camera_points[j].x(), dy = lidar_points[i].y() - camera_points[j].y();
+	if(camera_match[j] < 0 && dx * dx + dy * dy < best) {
+	  best = dx * dx + dy * dy;
+	  bi = i;
+	  bj = j;
+	}
+      }
+    }
+    if(bi < 0) {
+      break;
+    }
+    lidar_match[bi] = bj;
+    camera_match[bj] = bi;
+  }
+  
+  const double w_lidar = camera_variance_ / (lidar_variance_ + camera_variance_);
+  for(size_t i = 0; i < lidar_points.size(); i++) {
+    double r_lidar = reliability(lidar->people[i], lidar_reliability_);
+    if(lidar_match[i] < 0) {
+      fused.people.push_back(measurement(lidar->header, lidar_points[i], r_lidar, lidar_variance_));
+      continue;
+    }
+    int j = lidar_match[i];
+    double r_camera = reliability(camera->people[j], camera_reliability_);
+    tf::Point p = lidar_points[i] * w_lidar + camera_points[j] * (1.0 - w_lidar);
+    double variance = lidar_variance_ * camera_variance_ / (lidar_variance_ + camera_variance_);
+    fused.people.push_back(measurement(lidar->header, p, 1.0 - (1.0 - r_lidar) * (1.0 - r_camera), variance));
+  }
+  for(size_t j = 0; j < camera_points.size(); j++) {
+    if(camera_match[j] < 0) {
+      fused.people.push_back(measurement(lidar->header, camera_points[j], reliability(camera->people[j], camera_reliability_), camera_variance_));
+    }
+  }
+  
+  measurements_pub_.publish(fused);
+}
+
+int main(int argc, char **argv) {
+  ros::init(argc, argv, "detection_fusion");
+  ros::NodeHandle nh;
+  ros::NodeHandle private_nh("~");
+  
+  /*** Parameters ***/
+  private_nh.param<double>("max_age", max_age_, 0.1); // seconds between a lidar and an RGB-D message
+  private_nh.param<double>("association_distance", association_distance_, 0.5);
+  private_nh.param<double>("lidar_variance", lidar_variance_, 0.01); // c.f. the noise_params of the tracker
+  private_nh.param<double>("camera_variance", camera_variance_, 0.25);
+  private_nh.param<double>("lidar_reliability", lidar_reliability_, 0.7); // for measurements without one
+  private_nh.param<double>("camera_reliability", camera_reliability_, 0.6);
+  private_nh.param<std::string>("name", fused_name_, "fused_detector");
+  
+  listener_ = new tf::TransformListener();
+  
+  /*** Publishers ***/
+  measurements_pub_ = private_nh.advertise<people_msgs::PositionMeasurementArray>("measurements", 1);
+  
+  /*** Subscribers ***/
+  ros::Subscriber lidar_sub = nh.subscribe("/object3d_detector_gpu/measurements", 1, lidarCallback);
+  ros::Subscriber camera_sub = nh.subscribe("/rgbd_detection2d_3d/measurements", 1, cameraCallback);
+  
+  ros::spin();
+  return 0;
+}
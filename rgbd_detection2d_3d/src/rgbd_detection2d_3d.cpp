@@ -13,173 +13,359 @@
 // You should have received a copy of the GNU General Public License along
 // with this program.  If not, see <http://www.gnu.org/licenses/>.
 
-// ROS
-#include <ros/ros.h>
-#include <message_filters/subscriber.h>
-#include <message_filters/time_synchronizer.h>
-#include <message_filters/sync_policies/approximate_time.h>
-#include <sensor_msgs/PointCloud2.h>
-#include <darknet_ros_msgs/BoundingBoxes.h>
-#include <people_msgs/People.h>
-#include <people_msgs/PositionMeasurementArray.h>
-#include <visualization_msgs/MarkerArray.h>
+#include <boost/bind.hpp>
 // PCL
 #include <pcl_conversions/pcl_conversions.h>
+#include <perception_trace/trace.h>
 
-ros::Publisher people_pub_;
-ros::Publisher measurements_pub_;
-ros::Publisher markers_pub_;
-float x_thereshold_, y_thereshold_, z_thereshold_;
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-void callback(const darknet_ros_msgs::BoundingBoxes::ConstPtr& detect_2d, const sensor_msgs::PointCloud2::ConstPtr& depth_points) {
-  pcl::PointCloud<pcl::PointXYZRGB>::Ptr pcl_pc(new pcl::PointCloud<pcl::PointXYZRGB>);
-  pcl::fromROSMsg(*depth_points, *pcl_pc);
+#include "rgbd_detection2d_3d.h"
+#include "depth_source.h"
+
+static const char *stage_names_[] = {"capture to boxes", "boxes to depth match", "capture to lifted", "capture to published", "depth to image stamp"};
+
+static ros::Time imageStamp(const darknet_ros_msgs::BoundingBoxes &boxes) {
+  return boxes.image_header.stamp.isZero() ? boxes.header.stamp : boxes.image_header.stamp;
+}
+
+// The boxes are matched with the depth frame of header, about to be lifted.
+void RgbdDetection2d3d::beginLift(const darknet_ros_msgs::BoundingBoxes &boxes, const std_msgs::Header &header) {
+  ros::Time now = ros::Time::now();
+  image_stamp_ = imageStamp(boxes);
+  lift_begin_ = now;
+  stage_stats_[STAGE_YOLO].add((boxes.header.stamp - image_stamp_).toSec() * 1000.0);
+  stage_stats_[STAGE_MATCH].add((now - boxes.header.stamp).toSec() * 1000.0);
+  stage_stats_[STAGE_DEPTH_OFFSET].add(fabs((header.stamp - image_stamp_).toSec()) * 1000.0);
+  boxes_lifted_++;
+  frames_used_++;
+}
+
+void RgbdDetection2d3d::countBoxes(const darknet_ros_msgs::BoundingBoxes::ConstPtr &) {
+  boxes_received_++;
+}
 
-  people_msgs::People people;
-  people_msgs::PositionMeasurementArray measurements;
-  visualization_msgs::MarkerArray markers;
+template <typename M>
+void RgbdDetection2d3d::countFrame(const boost::shared_ptr<const M> &) {
+  frames_received_++;
+}
+
+void RgbdDetection2d3d::latencyDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Delays of the last boxes, in ms");
+  double p50, p90, max;
+  char value[64];
+  for(int i = 0; i < STAGE_COUNT; i++) {
+    if(stage_stats_[i].percentiles(p50, p90, max)) {
+      snprintf(value, sizeof(value), "p50 %.2f, p90 %.2f, max %.2f", p50, p90, max);
+      stat.add(stage_names_[i], std::string(value));
+    }
+  }
+}
+
+// Boxes and depth frames received but never matched, by the synchronizer or the stamp rings.
+void RgbdDetection2d3d::dropDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat) {
+  unsigned long dropped = boxes_received_ > boxes_lifted_ ? boxes_received_ - boxes_lifted_ : 0;
+  if(dropped * 10 > boxes_received_) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "More than 10% of the boxes dropped");
+  } else {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Boxes matched with a depth frame");
+  }
+  stat.add("boxes received", boxes_received_);
+  stat.add("boxes dropped", dropped);
+  stat.add("depth frames received", frames_received_);
+  stat.add("depth frames without boxes", frames_received_ > frames_used_ ? frames_received_ - frames_used_ : 0);
+}
+
+// The boxes lifted to 3D with the points of source (c.f. depth_source.h),
+// in the frame of header. Boxes are clipped to the image. They are lifted
+// in parallel, each into its own slot, then published in their order.
+template <typename Source>
+void RgbdDetection2d3d::detect(const darknet_ros_msgs::BoundingBoxes::ConstPtr& detect_2d, const Source &source, const std_msgs::Header &header) {
+  const int boxes = detect_2d->bounding_boxes.size();
+  results_.resize(boxes);
+  samples_.resize(threads_);
+  params_.extent = markers_pub_.getNumSubscribers() > 0;
+#pragma omp parallel for schedule(dynamic) num_threads(threads_) if(threads_ > 1 && boxes > 1)
+  for(int i = 0; i < boxes; i++) {
+#ifdef _OPENMP
+    BoxSamples &samples = samples_[omp_get_thread_num()];
+#else
+    BoxSamples &samples = samples_[0];
+#endif
+    const darknet_ros_msgs::BoundingBox &box = detect_2d->bounding_boxes[i];
+    liftBox(source, box.xmin, box.ymin, box.xmax, box.ymax, params_, samples, results_[i]);
+  }
+  stage_stats_[STAGE_LIFT].add((ros::Time::now() - image_stamp_).toSec() * 1000.0);
+  publishResults(header);
+}
+
+// The message of msg to be refilled: the same one once nobody holds it any
+// more, i.e. no intra-process subscriber still has it queued; otherwise a new
+// one is allocated, published messages are never modified.
+template <typename M>
+static M &reuseMessage(boost::shared_ptr<M> &msg) {
+  if(!msg || !msg.unique()) {
+    msg.reset(new M);
+  }
+  return *msg;
+}
+
+static void boxMarker(const std_msgs::Header &header, int id, const pcl::PointXYZ &min, const pcl::PointXYZ &max, visualization_msgs::Marker &marker) {
+  static const int EDGES[24][3] = { // 1 for the max, 0 for the min of x, y and z
+    {1,1,1}, {0,1,1}, {1,1,1}, {1,0,1}, {1,1,1}, {1,1,0}, {0,0,0}, {1,0,0}, {0,0,0}, {0,1,0}, {0,0,0}, {0,0,1},
+    {0,1,1}, {0,1,0}, {0,1,1}, {0,0,1}, {1,0,1}, {1,0,0}, {1,0,1}, {0,0,1}, {1,1,0}, {0,1,0}, {1,1,0}, {1,0,0}
+  };
+  marker.header = header;
+  marker.ns = "rgbd_detection2d_3d";
+  marker.id = id;
+  marker.type = visualization_msgs::Marker::LINE_LIST;
+  marker.points.resize(24);
+  for(int i = 0; i < 24; i++) {
+    marker.points[i].x = EDGES[i][0] ? max.x : min.x;
+    marker.points[i].y = EDGES[i][1] ? max.y : min.y;
+    marker.points[i].z = EDGES[i][2] ? max.z : min.z;
+  }
+  marker.pose.orientation.w = 1.0;
+  marker.scale.x = 0.02;
+  marker.color.a = 1.0;
+  marker.color.r = 1.0;
+  marker.color.g = 0.5;
+  marker.color.b = 0.0;
+  marker.lifetime = ros::Duration(0.1);
+}
+
+void RgbdDetection2d3d::publishResults(const std_msgs::Header &header) {
+  const int boxes = results_.size();
+  const bool markers = markers_pub_.getNumSubscribers() > 0;
+  int found = 0;
+  for(int i = 0; i < boxes; i++) {
+    found += results_[i].found ? 1 : 0;
+  }
+  if(!found) {
+    perception_trace::record("rgbd_detection2d_3d", image_stamp_, lift_begin_);
+    stage_stats_[STAGE_PUBLISH].add((ros::Time::now() - image_stamp_).toSec() * 1000.0);
+    diagnostics_->update();
+    return;
+  }
+  // shared pointers are handed to nodelet subscribers without a copy
+  people_msgs::People &people = reuseMessage(people_);
+  people_msgs::PositionMeasurementArray &measurements = reuseMessage(measurements_);
+  visualization_msgs::MarkerArray &marker_array = reuseMessage(markers_);
+  people.header = header;
+  people.people.resize(found);
+  measurements.header = header;
+  measurements.people.resize(found);
+  marker_array.markers.resize(markers ? found : 0);
   
-  for(int i = 0; i < detect_2d->bounding_boxes.size(); i++) {
-    int x_center = (detect_2d->bounding_boxes[i].xmax + detect_2d->bounding_boxes[i].xmin) / 2;
-    int y_center = (detect_2d->bounding_boxes[i].ymax + detect_2d->bounding_boxes[i].ymin) / 2;
-    
-    int pcl_idx = x_center + y_center * (int)depth_points->width;
-    pcl::PointXYZRGB center_point = pcl_pc->at(pcl_idx);
-    
-    if(std::isnan(center_point.x) || std::isnan(center_point.y) || std::isnan(center_point.z)) {
+  for(int i = 0, j = 0; i < boxes; i++) {
+    if(!results_[i].found) {
       continue;
     }
-    
-    float x_min, y_min, z_min, x_max, y_max, z_max;
-    x_min = y_min = z_min = std::numeric_limits<float>::max();
-    x_max = y_max = z_max = -std::numeric_limits<float>::max();
-    
-    for(int j = detect_2d->bounding_boxes[i].xmin; j < detect_2d->bounding_boxes[i].xmax; j++) {
-      for(int k = detect_2d->bounding_boxes[i].ymin; k < detect_2d->bounding_boxes[i].ymax; k++) {
-	pcl_idx = j + k * (int)depth_points->width;
-	pcl::PointXYZRGB point =  pcl_pc->at(pcl_idx);
-	
-	if(std::isnan(point.x) || std::isnan(point.y) || std::isnan(point.z)) {
-	  continue;
-	}
-	
-	if(fabs(point.x - center_point.x) > x_thereshold_) {
-	  point.x = point.x > center_point.x ? center_point.x + x_thereshold_ : center_point.x - x_thereshold_;
-	}
-	if(fabs(point.y - center_point.y) > y_thereshold_) {
-	  point.y = point.y > center_point.y ? center_point.y + y_thereshold_ : center_point.y - y_thereshold_;
-	}
-	if(fabs(point.z - center_point.z) > z_thereshold_) {
-	  point.z = point.z > center_point.z ? center_point.z + z_thereshold_ : center_point.z - z_thereshold_;
-	}
-	
-	x_min = std::min(point.x, x_min);
-	y_min = std::min(point.y, y_min);
-	z_min = std::min(point.z, z_min);
-	
-	x_max = std::max(point.x, x_max);
-	y_max = std::max(point.y, y_max);
-	z_max = std::max(point.z, z_max);
-      }
-    }
-    
-    people_msgs::Person person;
-    person.position.x = center_point.x;
-    person.position.y = center_point.y;
-    person.position.z = center_point.z;
-    people.people.push_back(person);
-    
-    people_msgs::PositionMeasurement measurement;
-    measurement.pos.x = center_point.x;
-    measurement.pos.y = center_point.y;
-    measurement.pos.z = center_point.z;
-    measurements.people.push_back(measurement);
-    
-    visualization_msgs::Marker marker;
-    marker.header = depth_points->header;
-    marker.ns = "rgbd_detection2d_3d";
-    marker.id = i;
-    marker.type = visualization_msgs::Marker::LINE_LIST;
-    
-    geometry_msgs::Point p[24];
-    p[0].x = x_max; p[0].y = y_max; p[0].z = z_max;
-    p[1].x = x_min; p[1].y = y_max; p[1].z = z_max;
-    p[2].x = x_max; p[2].y = y_max; p[2].z = z_max;
-    p[3].x = x_max; p[3].y = y_min; p[3].z = z_max;
-    p[4].x = x_max; p[4].y = y_max; p[4].z = z_max;
-    p[5].x = x_max; p[5].y = y_max; p[5].z = z_min;
-    p[6].x = x_min; p[6].y = y_min; p[6].z = z_min;
-    p[7].x = x_max; p[7].y = y_min; p[7].z = z_min;
-    p[8].x = x_min; p[8].y = y_min; p[8].z = z_min;
-    p[9].x = x_min; p[9].y = y_max; p[9].z = z_min;
-    
-    p[10].x = x_min; p[10].y = y_min; p[10].z = z_min;
-    p[11].x = x_min; p[11].y = y_min; p[11].z = z_max;
-    p[12].x = x_min; p[12].y = y_max; p[12].z = z_max;
-    p[13].x = x_min; p[13].y = y_max; p[13].z = z_min;
-    p[14].x = x_min; p[14].y = y_max; p[14].z = z_max;
-    p[15].x = x_min; p[15].y = y_min; p[15].z = z_max;
-    p[16].x = x_max; p[16].y = y_min; p[16].z = z_max;
-    p[17].x = x_max; p[17].y = y_min; p[17].z = z_min;
-    p[18].x = x_max; p[18].y = y_min; p[18].z = z_max;
-    p[19].x = x_min; p[19].y = y_min; p[19].z = z_max;
-    p[20].x = x_max; p[20].y = y_max; p[20].z = z_min;
-    p[21].x = x_min; p[21].y = y_max; p[21].z = z_min;
-    p[22].x = x_max; p[22].y = y_max; p[22].z = z_min;
-    p[23].x = x_max; p[23].y = y_min; p[23].z = z_min;
-    
-    for(int i = 0; i < 24; i++) {
-      marker.points.push_back(p[i]);
+    const pcl::PointXYZ &center_point = results_[i].center;
+    people.people[j].position.x = center_point.x;
+    people.people[j].position.y = center_point.y;
+    people.people[j].position.z = center_point.z;
+    measurements.people[j].pos.x = center_point.x;
+    measurements.people[j].pos.y = center_point.y;
+    measurements.people[j].pos.z = center_point.z;
+    if(markers) {
+      boxMarker(header, i, results_[i].min, results_[i].max, marker_array.markers[j]);
     }
-    
-    marker.pose.orientation.w = 1.0;
-    marker.scale.x = 0.02;
-    marker.color.a = 1.0;
-    marker.color.r = 1.0;
-    marker.color.g = 0.5;
-    marker.color.b = 0.0;
-    
-    marker.lifetime = ros::Duration(0.1);
-    markers.markers.push_back(marker);
+    j++;
   }
   
-  if(people.people.size()) {
-    people.header = depth_points->header;
-    people_pub_.publish(people);
+  // the measurements are stamped by their depth frame, the tracker finds the image
+  perception_trace::link(header.stamp, image_stamp_);
+  people_pub_.publish(people_);
+  measurements_pub_.publish(measurements_);
+  if(markers) {
+    markers_pub_.publish(markers_);
   }
-  
-  if(measurements.people.size()) {
-    measurements.header = depth_points->header;
-    measurements_pub_.publish(measurements);
+  perception_trace::record("rgbd_detection2d_3d", image_stamp_, lift_begin_);
+  stage_stats_[STAGE_PUBLISH].add((ros::Time::now() - image_stamp_).toSec() * 1000.0);
+  diagnostics_->update();
+}
+
+void RgbdDetection2d3d::cloudCallback(const darknet_ros_msgs::BoundingBoxes::ConstPtr& detect_2d, const sensor_msgs::PointCloud2::ConstPtr& depth_points) {
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr pcl_pc(new pcl::PointCloud<pcl::PointXYZRGB>);
+  beginLift(*detect_2d, depth_points->header);
+  pcl::fromROSMsg(*depth_points, *pcl_pc);
+  detect(detect_2d, CloudSource(*pcl_pc), depth_points->header);
+}
+
+// Only the pixels of the boxes are deprojected, nothing is converted.
+void RgbdDetection2d3d::depthCallback(const darknet_ros_msgs::BoundingBoxes::ConstPtr& detect_2d, const sensor_msgs::Image::ConstPtr& depth, const sensor_msgs::CameraInfo::ConstPtr& info) {
+  beginLift(*detect_2d, depth->header);
+  DepthSource source;
+  if(!source.init(*depth, *info)) {
+    ROS_WARN_THROTTLE(5.0, "[rgbd_detection2d_3d] Depth images must be 16UC1 or 32FC1, with the camera intrinsics, dropped.");
+    return;
   }
-  
-  if(markers.markers.size()) {
-    markers_pub_.publish(markers);
+#ifdef RGBD_DETECTION2D_3D_GPU
+  if(gpu_) {
+    const int boxes = detect_2d->bounding_boxes.size();
+    gpu_boxes_.resize(boxes);
+    gpu_results_.resize(boxes);
+    for(int i = 0; i < boxes; i++) {
+      const darknet_ros_msgs::BoundingBox &box = detect_2d->bounding_boxes[i];
+      DepthRoiBox roi = {(int)box.xmin, (int)box.ymin, (int)box.xmax, (int)box.ymax};
+      gpu_boxes_[i] = roi;
+    }
+    float intrinsics[4];
+    source.intrinsics(intrinsics);
+    if(gpu_->lift(source.data(), source.width(), source.height(), source.step(), source.millimeters(), intrinsics,
+		  gpu_boxes_.data(), boxes, params_.sample_stride, params_.extent_stride, params_.thresholds, gpu_results_.data())) {
+      results_.resize(boxes);
+      for(int i = 0; i < boxes; i++) {
+	const DepthRoiResult &r = gpu_results_[i];
+	results_[i].found = r.found != 0;
+	results_[i].center.x = r.center[0]; results_[i].center.y = r.center[1]; results_[i].center.z = r.center[2];
+	results_[i].min.x = r.min[0]; results_[i].min.y = r.min[1]; results_[i].min.z = r.min[2];
+	results_[i].max.x = r.max[0]; results_[i].max.y = r.max[1]; results_[i].max.z = r.max[2];
+      }
+      stage_stats_[STAGE_LIFT].add((ros::Time::now() - image_stamp_).toSec() * 1000.0);
+      publishResults(depth->header);
+      return;
+    }
+    ROS_WARN_THROTTLE(5.0, "[rgbd_detection2d_3d] GPU lifting failed, lifting on the CPU.");
   }
+#endif
+  detect(detect_2d, source, depth->header);
 }
 
-int main(int argc, char **argv) {
-  ros::init(argc, argv, "rgbd_detection2d_3d");
-  
-  /*** Subscribers ***/
-  ros::NodeHandle nh;
-  message_filters::Subscriber<darknet_ros_msgs::BoundingBoxes> detection_2d(nh, "/darknet_ros/bounding_boxes", 1);
-  message_filters::Subscriber<sensor_msgs::PointCloud2> depth_registered_points(nh, "/camera/depth/color/points", 1);
-  typedef message_filters::sync_policies::ApproximateTime<darknet_ros_msgs::BoundingBoxes, sensor_msgs::PointCloud2> ApproximateTimePolicy;
-  message_filters::Synchronizer<ApproximateTimePolicy> sync(ApproximateTimePolicy(10), detection_2d, depth_registered_points);
-  sync.registerCallback(boost::bind(&callback, _1, _2));
+// True once the boxes are processed.
+bool RgbdDetection2d3d::matchBoxes(const darknet_ros_msgs::BoundingBoxes::ConstPtr& detect_2d) {
+  ros::Time stamp = imageStamp(*detect_2d);
+  if(use_depth_image_) {
+    sensor_msgs::Image::ConstPtr depth = depth_info_ ? depth_ring_.find(stamp, stamp_tolerance_) : sensor_msgs::Image::ConstPtr();
+    if(depth) {
+      depthCallback(detect_2d, depth, depth_info_);
+      return true;
+    }
+  } else {
+    sensor_msgs::PointCloud2::ConstPtr cloud = cloud_ring_.find(stamp, stamp_tolerance_);
+    if(cloud) {
+      cloudCallback(detect_2d, cloud);
+      return true;
+    }
+  }
+  return false;
+}
+
+void RgbdDetection2d3d::boxesCallback(const darknet_ros_msgs::BoundingBoxes::ConstPtr& detect_2d) {
+  boxes_received_++;
+  pending_boxes_ = matchBoxes(detect_2d) ? darknet_ros_msgs::BoundingBoxes::ConstPtr() : detect_2d;
+}
+
+void RgbdDetection2d3d::retryPendingBoxes(const ros::Time &newest) {
+  if(pending_boxes_ && (matchBoxes(pending_boxes_) || newest - imageStamp(*pending_boxes_) > ros::Duration(stamp_tolerance_))) {
+    pending_boxes_.reset(); // processed, or its frame is gone
+  }
+}
+
+void RgbdDetection2d3d::cloudFrameCallback(const sensor_msgs::PointCloud2::ConstPtr& depth_points) {
+  frames_received_++;
+  cloud_ring_.push(depth_points);
+  retryPendingBoxes(depth_points->header.stamp);
+}
+
+void RgbdDetection2d3d::depthFrameCallback(const sensor_msgs::Image::ConstPtr& depth) {
+  frames_received_++;
+  depth_ring_.push(depth);
+  retryPendingBoxes(depth->header.stamp);
+}
+
+void RgbdDetection2d3d::depthInfoCallback(const sensor_msgs::CameraInfo::ConstPtr& info) {
+  depth_info_ = info; // the intrinsics of a camera do not change
+}
+
+RgbdDetection2d3d::RgbdDetection2d3d(ros::NodeHandle nh, ros::NodeHandle private_nh) :
+  boxes_received_(0), boxes_lifted_(0), frames_received_(0), frames_used_(0) {
+  /*** the aligned depth image instead of the XYZRGB cloud, c.f. rs_camera.launch align_depth:=true ***/
+  private_nh.param<bool>("use_depth_image", use_depth_image_, false);
+  /*** the depth frame of the boxes' image_header, instead of ApproximateTime on the boxes' header ***/
+  bool match_image_stamp;
+  int depth_buffer;
+  private_nh.param<bool>("match_image_stamp", match_image_stamp, false);
+  private_nh.param<int>("depth_buffer", depth_buffer, 4); // depth frames kept for the boxes to come
+  private_nh.param<double>("stamp_tolerance", stamp_tolerance_, 0.0); // seconds, 0 for exact stamps
   
   /*** Publishers ***/
-  ros::NodeHandle private_nh("~");
   people_pub_ = private_nh.advertise<people_msgs::People>("people", 1);
   measurements_pub_ = private_nh.advertise<people_msgs::PositionMeasurementArray>("measurements", 1);
   markers_pub_ = private_nh.advertise<visualization_msgs::MarkerArray>("markers", 1);
   
+  /*** Diagnostics ***/
+  diagnostics_ = new diagnostic_updater::Updater(nh, private_nh, private_nh.getNamespace());
+  diagnostics_->setHardwareID("rgbd_detection2d_3d");
+  diagnostics_->add("latency", this, &RgbdDetection2d3d::latencyDiagnostics);
+  diagnostics_->add("drops", this, &RgbdDetection2d3d::dropDiagnostics);
+  
   /*** Parameters ***/
-  private_nh.param<float>("x_thereshold", x_thereshold_, 0.5);
-  private_nh.param<float>("y_thereshold", y_thereshold_, 1.0);
-  private_nh.param<float>("z_thereshold", z_thereshold_, 0.5);
+  private_nh.param<float>("x_thereshold", params_.thresholds[0], 0.5);
+  private_nh.param<float>("y_thereshold", params_.thresholds[1], 1.0);
+  private_nh.param<float>("z_thereshold", params_.thresholds[2], 0.5);
+  /*** median of a pixel subset of the box as the position, or the center pixel alone ***/
+  private_nh.param<bool>("median_position", params_.median_position, true);
+  private_nh.param<int>("sample_stride", params_.sample_stride, 4);
+  /*** pixels of the box taken for its extent (the markers), in both directions ***/
+  private_nh.param<int>("extent_stride", params_.extent_stride, 2);
+  params_.extent = true; // per frame, with a subscriber to the markers
+  /*** position and extent of the pixels at the box's depth only, connected to its center ***/
+  private_nh.param<bool>("segmentation", params_.segmentation, false);
+  private_nh.param<int>("segment_stride", params_.segment_stride, 2);
+  private_nh.param<float>("segment_bin", params_.segment_bin, 0.1); // meters, of the depth histogram
+  private_nh.param<float>("segment_depth", params_.segment_depth, 0.3); // meters around the person's depth
+  /*** boxes are lifted by this many threads (OpenMP) ***/
+  private_nh.param<int>("threads", threads_, 1);
+  threads_ = std::max(threads_, 1);
+  /*** boxes of depth images lifted by one CUDA kernel ***/
+  bool gpu_lifting;
+  private_nh.param<bool>("gpu_lifting", gpu_lifting, false);
+  if(gpu_lifting && !use_depth_image_) {
+    ROS_WARN("[rgbd_detection2d_3d] GPU lifting needs use_depth_image, disabled.");
+  } else if(gpu_lifting && params_.segmentation) {
+    ROS_WARN("[rgbd_detection2d_3d] GPU lifting does not segment the boxes, disabled.");
+  } else if(gpu_lifting) {
+#ifdef RGBD_DETECTION2D_3D_GPU
+    gpu_.reset(new DepthRoiGpu());
+#else
+    ROS_WARN("[rgbd_detection2d_3d] Built without CUDA, GPU lifting disabled.");
+#endif
+  }
   
-  ros::spin();
-  return 0;
+  /*** Subscribers, last: in a nodelet their callbacks may come right away ***/
+  if(match_image_stamp) {
+    cloud_ring_ = StampRing<sensor_msgs::PointCloud2>(depth_buffer);
+    depth_ring_ = StampRing<sensor_msgs::Image>(depth_buffer);
+    boxes_sub_ = nh.subscribe("/darknet_ros/bounding_boxes", 1, &RgbdDetection2d3d::boxesCallback, this);
+    if(use_depth_image_) {
+      frames_sub_ = nh.subscribe("/camera/aligned_depth_to_color/image_raw", 1, &RgbdDetection2d3d::depthFrameCallback, this);
+      info_sub_ = nh.subscribe("/camera/aligned_depth_to_color/camera_info", 1, &RgbdDetection2d3d::depthInfoCallback, this);
+    } else {
+      frames_sub_ = nh.subscribe("/camera/depth/color/points", 1, &RgbdDetection2d3d::cloudFrameCallback, this);
+    }
+  } else if(use_depth_image_) {
+    detection_2d_.subscribe(nh, "/darknet_ros/bounding_boxes", 1);
+    depth_image_.subscribe(nh, "/camera/aligned_depth_to_color/image_raw", 1);
+    depth_info_sub_.subscribe(nh, "/camera/aligned_depth_to_color/camera_info", 1);
+    depth_sync_.reset(new message_filters::Synchronizer<DepthApproximateTimePolicy>(DepthApproximateTimePolicy(10), detection_2d_, depth_image_, depth_info_sub_));
+    depth_sync_->registerCallback(boost::bind(&RgbdDetection2d3d::depthCallback, this, _1, _2, _3));
+    depth_image_.registerCallback(&RgbdDetection2d3d::countFrame<sensor_msgs::Image>, this);
+  } else {
+    detection_2d_.subscribe(nh, "/darknet_ros/bounding_boxes", 1);
+    depth_registered_points_.subscribe(nh, "/camera/depth/color/points", 1);
+    sync_.reset(new message_filters::Synchronizer<ApproximateTimePolicy>(ApproximateTimePolicy(10), detection_2d_, depth_registered_points_));
+    sync_->registerCallback(boost::bind(&RgbdDetection2d3d::cloudCallback, this, _1, _2));
+    depth_registered_points_.registerCallback(&RgbdDetection2d3d::countFrame<sensor_msgs::PointCloud2>, this);
+  }
+  if(!match_image_stamp) {
+    detection_2d_.registerCallback(&RgbdDetection2d3d::countBoxes, this);
+  }
+}
+
+RgbdDetection2d3d::~RgbdDetection2d3d() {
+  delete diagnostics_;
 }
@@ -0,0 +1,40 @@
+// Copyright (C) 2022, Zhi Yan
+
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// The lifting as a nodelet: loaded into the manager of the camera and of
+// darknet_ros, the boxes and the depth frames arrive as the ConstPtr they
+// were published as, without being serialized, and the detections go to
+// bayes_people_tracker the same way. Parameters are the same as for the node.
+
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+
+#include "rgbd_detection2d_3d.h"
+
+namespace rgbd_detection2d_3d {
+
+class RgbdDetection2d3dNodelet : public nodelet::Nodelet {
+private:
+  virtual void onInit() {
+    // the single-threaded queue keeps the callbacks serialized, as in the node
+    detector_.reset(new RgbdDetection2d3d(getNodeHandle(), getPrivateNodeHandle()));
+  }
+  
+  boost::shared_ptr<RgbdDetection2d3d> detector_;
+};
+
+} // namespace rgbd_detection2d_3d
+
+PLUGINLIB_EXPORT_CLASS(rgbd_detection2d_3d::RgbdDetection2d3dNodelet, nodelet::Nodelet)
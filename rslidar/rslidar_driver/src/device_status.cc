@@ -0,0 +1,64 @@
+/*
+ *	Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  The rotation rate and the return mode of the difop packets
+ */
+#include "device_status.h"
+#include <cmath>
+
+namespace rslidar_driver
+{
+namespace
+{
+const unsigned int POINTS_ONE_CHANNEL_PER_SECOND = 18000;
+const unsigned int BLOCKS_ONE_CHANNEL_PER_PKT = 12;
+}
+
+DeviceStatus::DeviceStatus(const std::string& model)
+  : model_(model), rpm_(600), return_mode_(1), last_npackets_(0), npackets_(0)
+{
+}
+
+bool DeviceStatus::update(const rslidar_msgs::rslidarPacket& pkt)
+{
+  if (pkt.data[0] != 0xA5 || pkt.data[1] != 0xFF || pkt.data[2] != 0x00 || pkt.data[3] != 0x5A)
+  {
+    return false;
+  }
+  int rpm = (pkt.data[8] << 8) | pkt.data[9];
+  int mode = 1;
+  if ((pkt.data[45] == 0x08 && pkt.data[46] == 0x02 && pkt.data[47] >= 0x09) || (pkt.data[45] > 0x08) ||
+      (pkt.data[45] == 0x08 && pkt.data[46] > 0x02))
+  {
+    if (pkt.data[300] != 0x01 && pkt.data[300] != 0x02)
+    {
+      mode = 0;
+    }
+  }
+  if (rpm <= 0 || (rpm == rpm_ && mode == return_mode_))
+  {
+    return false;
+  }
+  rpm_ = rpm;
+  return_mode_ = mode;
+
+  int packets_rate = ceil(POINTS_ONE_CHANNEL_PER_SECOND / BLOCKS_ONE_CHANNEL_PER_PKT);
+  if (model_ == "RS16" && (mode == 1 || mode == 2))
+  {
+    packets_rate = ceil(packets_rate / 2);
+  }
+  else if ((model_ == "RS32" || model_ == "RSBPEARL" || model_ == "RSBPEARL_MINI") && (mode == 0))
+  {
+    packets_rate = packets_rate * 2;
+  }
+  last_npackets_ = ceil(packets_rate * 60 / (double)rpm);
+  npackets_.store(last_npackets_, std::memory_order_relaxed);
+  return true;
+}
+}  // namespace rslidar_driver
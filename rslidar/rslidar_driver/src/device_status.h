@@ -0,0 +1,62 @@
+/*
+ *	Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  The rotation rate and the return mode of a lidar, of its difop
+ *  packets. They are parsed by the thread reading the difop packets, and
+ *  the packets of a revolution they make are taken by the one cutting the
+ *  msop packets into scans, with one atomic exchange per scan, so that
+ *  the msop packets are not looked at for the difop ones.
+ */
+
+#ifndef __RSLIDAR_DEVICE_STATUS_H_
+#define __RSLIDAR_DEVICE_STATUS_H_
+
+#include <atomic>
+#include <string>
+#include <rslidar_msgs/rslidarPacket.h>
+
+namespace rslidar_driver
+{
+class DeviceStatus
+{
+public:
+  explicit DeviceStatus(const std::string& model);
+
+  /** @brief the rpm and the return mode of a difop packet, of the difop thread
+   *
+   *  @returns true if they changed, the packets of a revolution updated
+   */
+  bool update(const rslidar_msgs::rslidarPacket& pkt);
+
+  /// the packets of a revolution if updated since the last call, else 0
+  int takeNpackets(void)
+  {
+    return npackets_.exchange(0, std::memory_order_relaxed);
+  }
+
+  /// of the difop thread
+  int rpm(void) const
+  {
+    return rpm_;
+  }
+  int npackets(void) const
+  {
+    return last_npackets_;
+  }
+
+private:
+  std::string model_;
+  int rpm_;
+  int return_mode_;
+  int last_npackets_;
+  std::atomic<int> npackets_;  ///< not taken yet, 0 if none
+};
+}  // namespace rslidar_driver
+
+#endif  // __RSLIDAR_DEVICE_STATUS_H_
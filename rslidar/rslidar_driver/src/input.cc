@@ -17,8 +17,12 @@
  *
  *     InputPCAP -- derived class provides a similar interface from a
  *              PCAP dump
+ *
+ *     InputPCAPMapped -- derived class replays a PCAP dump mapped in
+ *              memory, at an adjustable speed
  */
 #include "input.h"
+#include <linux/sock_diag.h>
 
 extern volatile sig_atomic_t flag;
 namespace rslidar_driver
@@ -34,12 +38,9 @@ static const size_t packet_size = sizeof(rslidar_msgs::rslidarPacket().data);
  *  @param private_nh ROS private handle for calling node.
  *  @param port UDP port number.
  */
-Input::Input(ros::NodeHandle private_nh, uint16_t port) : private_nh_(private_nh), port_(port)
+Input::Input(ros::NodeHandle private_nh, uint16_t port)
+  : private_nh_(private_nh), port_(port), incomplete_packets_(0)
 {
-  npkt_update_flag_ = false;
-  cur_rpm_ = 600;
-  return_mode_ = 1;
-
   private_nh.param("device_ip", devip_str_, std::string(""));
   if (!devip_str_.empty())
   {
@@ -47,25 +48,13 @@ Input::Input(ros::NodeHandle private_nh, uint16_t port) : private_nh_(private_nh
   }
 }
 
-int Input::getRpm(void)
-{
-  return cur_rpm_;
-}
-
-int Input::getReturnMode(void)
-{
-  return return_mode_;
-}
-
-bool Input::getUpdateFlag(void)
+int Input::getPackets(rslidar_msgs::rslidarPacket* pkts, int max, const double time_offset, int& received)
 {
-  return npkt_update_flag_;
+  int rc = getPacket(pkts, time_offset);
+  received = rc == 0 ? 1 : 0;
+  return rc;
 }
 
-void Input::clearUpdateFlag(void)
-{
-  npkt_update_flag_ = false;
-}
 ////////////////////////////////////////////////////////////////////////
 // InputSocket class implementation
 ////////////////////////////////////////////////////////////////////////
@@ -75,9 +64,22 @@ void Input::clearUpdateFlag(void)
    *  @param private_nh ROS private handle for calling node.
    *  @param port UDP port number
 */
-InputSocket::InputSocket(ros::NodeHandle private_nh, uint16_t port) : Input(private_nh, port)
+InputSocket::InputSocket(ros::NodeHandle private_nh, uint16_t port)
+  : Input(private_nh, port), queue_high_water_(0), queue_capacity_(0), queue_drops_(0)
 {
   sockfd_ = -1;
+  poll_timeout_ = 1000;  // one second
+  private_nh.param("packet_stats", queue_stats_, false);
+
+  // packets per recvmmsg() syscall, 1 for one poll() and recvfrom() per packet
+  int recv_batch;
+  private_nh.param("recv_batch", recv_batch, 1);
+  recv_batch = std::max(recv_batch, 1);
+  // socket receive buffer in bytes, 0 for the system default
+  int recv_buffer_size;
+  private_nh.param("recv_buffer_size", recv_buffer_size, 0);
+  private_nh.param("kernel_timestamps", kernel_timestamps_, false);
+  mmsg_ = recv_batch > 1 || kernel_timestamps_;
 
   if (!devip_str_.empty())
   {
@@ -116,6 +118,40 @@ InputSocket::InputSocket(ros::NodeHandle private_nh, uint16_t port) : Input(priv
     ROS_ERROR("[driver][socket] fcntl fail");
     return;
   }
+
+  if (recv_buffer_size > 0)
+  {
+    // capped by net.core.rmem_max, and doubled by the kernel for its bookkeeping
+    if (setsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF, (const void*)&recv_buffer_size, sizeof(recv_buffer_size)))
+    {
+      ROS_ERROR("[driver][socket] setsockopt SO_RCVBUF fail");
+    }
+    int size = 0;
+    socklen_t size_len = sizeof(size);
+    getsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF, (void*)&size, &size_len);
+    if (size < recv_buffer_size)
+    {
+      ROS_WARN_STREAM("[driver][socket] receive buffer of " << size << " bytes only, raise net.core.rmem_max for "
+                      << recv_buffer_size);
+    }
+  }
+
+  if (kernel_timestamps_ && setsockopt(sockfd_, SOL_SOCKET, SO_TIMESTAMPNS, (const void*)&opt, sizeof(opt)))
+  {
+    ROS_ERROR("[driver][socket] setsockopt SO_TIMESTAMPNS fail, packets stamped on receipt");
+    kernel_timestamps_ = false;
+  }
+
+  if (mmsg_)
+  {
+    ROS_INFO_STREAM("[driver][socket] receiving up to " << recv_batch << " packets per syscall"
+                    << (kernel_timestamps_ ? ", stamped by the kernel" : ""));
+    msgs_.resize(recv_batch);
+    iovecs_.resize(recv_batch);
+    senders_.resize(recv_batch);
+    control_size_ = CMSG_SPACE(sizeof(timespec));
+    control_.resize(control_size_ * recv_batch);
+  }
 }
 
 /** @brief destructor */
@@ -124,14 +160,98 @@ InputSocket::~InputSocket(void)
   (void)close(sockfd_);
 }
 
-/** @brief Get one rslidar packet. */
-int InputSocket::getPacket(rslidar_msgs::rslidarPacket* pkt, const double time_offset)
+/** @brief poll() until input available
+ *
+ *  @returns 0 if available, 1 on a timeout or an error
+ */
+int InputSocket::pollSocket(void)
 {
-  double time1 = ros::Time::now().toSec();
   struct pollfd fds[1];
   fds[0].fd = sockfd_;
   fds[0].events = POLLIN;
-  static const int POLL_TIMEOUT = 1000;  // one second (in msec)
+
+  do
+  {
+    int retval = poll(fds, 1, poll_timeout_);
+    if (retval < 0)  // poll() error?
+    {
+      if (errno != EINTR)
+      {
+        ROS_ERROR("[driver][socket] poll() error: %s", strerror(errno));
+      }
+      return 1;
+    }
+    if (retval == 0 && poll_timeout_ == 0)  // nothing queued, not waited for
+    {
+      return 1;
+    }
+    if (retval == 0)  // poll() timeout?
+    {
+      ROS_WARN("[driver][socket] Rslidar poll() timeout");
+
+      char buffer_data[8] = "re-con";
+      sockaddr_in sender_address;
+      socklen_t sender_address_len = sizeof(sender_address);
+      memset(&sender_address, 0, sender_address_len);          // initialize to zeros
+      sender_address.sin_family = AF_INET;                     // host byte order
+      sender_address.sin_port = htons(MSOP_DATA_PORT_NUMBER);  // port in network byte order, set any value
+      sender_address.sin_addr.s_addr = devip_.s_addr;          // automatically fill in my IP
+      sendto(sockfd_, &buffer_data, strlen(buffer_data), 0, (sockaddr*)&sender_address, sender_address_len);
+      return 1;
+    }
+    if ((fds[0].revents & POLLERR) || (fds[0].revents & POLLHUP) || (fds[0].revents & POLLNVAL))  // device error?
+    {
+      ROS_ERROR("[driver][socket] poll() reports Rslidar error");
+      return 1;
+    }
+  } while ((fds[0].revents & POLLIN) == 0);
+  if (queue_stats_)
+  {
+    sampleQueue();
+  }
+  return 0;
+}
+
+void InputSocket::sampleQueue(void)
+{
+  uint32_t meminfo[SK_MEMINFO_VARS];
+  socklen_t len = sizeof(meminfo);
+  if (getsockopt(sockfd_, SOL_SOCKET, SO_MEMINFO, meminfo, &len) != 0 || len < sizeof(meminfo))
+  {
+    return;
+  }
+  // only this thread raises it, the reader of queueStats resets it
+  uint32_t queued = meminfo[SK_MEMINFO_RMEM_ALLOC];
+  if (queued > queue_high_water_.load(std::memory_order_relaxed))
+  {
+    queue_high_water_.store(queued, std::memory_order_relaxed);
+  }
+  queue_capacity_.store(meminfo[SK_MEMINFO_RCVBUF], std::memory_order_relaxed);
+  queue_drops_.store(meminfo[SK_MEMINFO_DROPS], std::memory_order_relaxed);
+}
+
+bool InputSocket::queueStats(uint32_t& high_water, uint32_t& capacity, uint32_t& drops)
+{
+  if (!queue_stats_)
+  {
+    return false;
+  }
+  high_water = queue_high_water_.exchange(0, std::memory_order_relaxed);
+  capacity = queue_capacity_.load(std::memory_order_relaxed);
+  drops = queue_drops_.load(std::memory_order_relaxed);
+  return true;
+}
+
+/** @brief Get one rslidar packet. */
+int InputSocket::getPacket(rslidar_msgs::rslidarPacket* pkt, const double time_offset)
+{
+  if (mmsg_)
+  {
+    int received;
+    return receive(pkt, 1, time_offset, received);
+  }
+
+  double time1 = ros::Time::now().toSec();
 
   sockaddr_in sender_address;
   socklen_t sender_address_len = sizeof(sender_address);
@@ -139,36 +259,10 @@ int InputSocket::getPacket(rslidar_msgs::rslidarPacket* pkt, const double time_o
   {
     // Receive packets that should now be available from the
     // socket using a blocking read.
-    // poll() until input available
-    do
+    if (pollSocket())
     {
-      int retval = poll(fds, 1, POLL_TIMEOUT);
-      if (retval < 0)  // poll() error?
-      {
-        if (errno != EINTR)
-        {
-          ROS_ERROR("[driver][socket] poll() error: %s", strerror(errno));
-        }
-        return 1;
-      }
-      if (retval == 0)  // poll() timeout?
-      {
-        ROS_WARN("[driver][socket] Rslidar poll() timeout");
-
-        char buffer_data[8] = "re-con";
-        memset(&sender_address, 0, sender_address_len);          // initialize to zeros
-        sender_address.sin_family = AF_INET;                     // host byte order
-        sender_address.sin_port = htons(MSOP_DATA_PORT_NUMBER);  // port in network byte order, set any value
-        sender_address.sin_addr.s_addr = devip_.s_addr;          // automatically fill in my IP
-        sendto(sockfd_, &buffer_data, strlen(buffer_data), 0, (sockaddr*)&sender_address, sender_address_len);
-        return 1;
-      }
-      if ((fds[0].revents & POLLERR) || (fds[0].revents & POLLHUP) || (fds[0].revents & POLLNVAL))  // device error?
-      {
-        ROS_ERROR("[driver][socket] poll() reports Rslidar error");
-        return 1;
-      }
-    } while ((fds[0].revents & POLLIN) == 0);
+      return 1;
+    }
     ssize_t nbytes = recvfrom(sockfd_, &pkt->data[0], packet_size, 0, (sockaddr*)&sender_address, &sender_address_len);
 
     if (nbytes < 0)
@@ -178,6 +272,7 @@ int InputSocket::getPacket(rslidar_msgs::rslidarPacket* pkt, const double time_o
         ROS_ERROR("[driver][socket] recvfail");
         return 1;
       }
+      continue;  // none queued after all
     }
     else if ((size_t)nbytes == packet_size)
     {
@@ -191,40 +286,110 @@ int InputSocket::getPacket(rslidar_msgs::rslidarPacket* pkt, const double time_o
       }
     }
 
-    ROS_WARN_STREAM("[driver][socket] incomplete rslidar packet read: " << nbytes << " bytes");
+    ++incomplete_packets_;
+    ROS_WARN_STREAM_THROTTLE(1, "[driver][socket] incomplete rslidar packet read: " << nbytes << " bytes");
   }
   if (flag == 0)
   {
     abort();
   }
 
-  if (pkt->data[0] == 0xA5 && pkt->data[1] == 0xFF && pkt->data[2] == 0x00 && pkt->data[3] == 0x5A)
-  {//difop
-    int rpm = (pkt->data[8]<<8)|pkt->data[9];
-    int mode = 1;
+  // Average the times at which we begin and end reading.  Use that to
+  // estimate when the scan occurred. Add the time offset.
+  double time2 = ros::Time::now().toSec();
+  pkt->stamp = ros::Time((time2 + time1) / 2.0 + time_offset);
+
+  return 0;
+}
+
+/** @brief Get up to max rslidar packets. */
+int InputSocket::getPackets(rslidar_msgs::rslidarPacket* pkts, int max, const double time_offset, int& received)
+{
+  if (mmsg_)
+  {
+    return receive(pkts, max, time_offset, received);
+  }
+  return Input::getPackets(pkts, max, time_offset, received);
+}
 
-    if ((pkt->data[45] == 0x08 && pkt->data[46] == 0x02 && pkt->data[47] >= 0x09) || (pkt->data[45] > 0x08)
-        || (pkt->data[45] == 0x08 && pkt->data[46] > 0x02))
+/** @brief Get up to max rslidar packets, as many as the socket holds, with
+ *  one recvmmsg() syscall, straight into pkts
+ */
+int InputSocket::receive(rslidar_msgs::rslidarPacket* pkts, int max, const double time_offset, int& received)
+{
+  received = 0;
+  double time1 = ros::Time::now().toSec();
+  int n = std::min(max, (int)msgs_.size());
+
+  while (flag == 1 && received == 0)
+  {
+    if (pollSocket())
+    {
+      return 1;
+    }
+    for (int i = 0; i < n; ++i)
     {
-      if (pkt->data[300] != 0x01 && pkt->data[300] != 0x02)
+      iovecs_[i].iov_base = &pkts[i].data[0];
+      iovecs_[i].iov_len = packet_size;
+      msghdr& hdr = msgs_[i].msg_hdr;
+      hdr.msg_name = &senders_[i];
+      hdr.msg_namelen = sizeof(sockaddr_in);
+      hdr.msg_iov = &iovecs_[i];
+      hdr.msg_iovlen = 1;
+      hdr.msg_control = kernel_timestamps_ ? &control_[i * control_size_] : NULL;
+      hdr.msg_controllen = kernel_timestamps_ ? control_size_ : 0;
+      hdr.msg_flags = 0;
+    }
+    int count = recvmmsg(sockfd_, &msgs_[0], n, MSG_DONTWAIT, NULL);
+    if (count < 0)
+    {
+      if (errno != EWOULDBLOCK && errno != EINTR)
       {
-        mode = 0;
+        ROS_ERROR("[driver][socket] recvfail");
+        return 1;
       }
+      continue;
     }
 
-    if (cur_rpm_ != rpm || return_mode_ != mode)
+    double time2 = ros::Time::now().toSec();
+    for (int i = 0; i < count; ++i)
     {
-      cur_rpm_ = rpm;
-      return_mode_ = mode;
+      const msghdr& hdr = msgs_[i].msg_hdr;
+      if (msgs_[i].msg_len != packet_size)
+      {
+        ++incomplete_packets_;
+        ROS_WARN_STREAM_THROTTLE(1, "[driver][socket] incomplete rslidar packet read: " << msgs_[i].msg_len
+                                                                                        << " bytes");
+        continue;
+      }
+      if (devip_str_ != "" && senders_[i].sin_addr.s_addr != devip_.s_addr)
+      {
+        continue;
+      }
+      if (received != i)  // over a dropped one
+      {
+        pkts[received].data = pkts[i].data;
+      }
+      rslidar_msgs::rslidarPacket* pkt = &pkts[received++];
 
-      npkt_update_flag_ = true;
+      // Without the time the kernel received it, the average of the times
+      // at which we begin and end reading, for all the batch.
+      pkt->stamp = ros::Time((time2 + time1) / 2.0 + time_offset);
+      for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(const_cast<msghdr*>(&hdr), cmsg))
+      {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+          const timespec* ts = (const timespec*)CMSG_DATA(cmsg);
+          pkt->stamp = ros::Time(ts->tv_sec + 1e-9 * ts->tv_nsec + time_offset);
+          break;
+        }
+      }
     }
   }
-  // Average the times at which we begin and end reading.  Use that to
-  // estimate when the scan occurred. Add the time offset.
-  double time2 = ros::Time::now().toSec();
-  pkt->stamp = ros::Time((time2 + time1) / 2.0 + time_offset);
-
+  if (flag == 0)
+  {
+    abort();
+  }
   return 0;
 }
 
@@ -316,29 +481,6 @@ int InputPCAP::getPacket(rslidar_msgs::rslidarPacket* pkt, const double time_off
 
       memcpy(&pkt->data[0], pkt_data + 42, packet_size);
 
-      if (pkt->data[0] == 0xA5 && pkt->data[1] == 0xFF && pkt->data[2] == 0x00 && pkt->data[3] == 0x5A)
-      {//difop
-        int rpm = (pkt->data[8]<<8)|pkt->data[9];
-        int mode = 1;
-
-        if ((pkt->data[45] == 0x08 && pkt->data[46] == 0x02 && pkt->data[47] >= 0x09) || (pkt->data[45] > 0x08)
-            || (pkt->data[45] == 0x08 && pkt->data[46] > 0x02))
-        {
-          if (pkt->data[300] != 0x01 && pkt->data[300] != 0x02)
-          {
-            mode = 0;
-          }
-        }
-
-        if (cur_rpm_ != rpm || return_mode_ != mode)
-        {
-          cur_rpm_ = rpm;
-          return_mode_ = mode;
-
-          npkt_update_flag_ = true;
-        }
-      }
-
       pkt->stamp = ros::Time::now();  // time_offset not considered here, as no
                                       // synchronization required
       empty_ = false;
@@ -378,4 +520,227 @@ int InputPCAP::getPacket(rslidar_msgs::rslidarPacket* pkt, const double time_off
     abort();
   }
 }
+
+////////////////////////////////////////////////////////////////////////
+// InputPCAPMapped class implementation
+////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+const uint32_t PCAP_MAGIC_USEC = 0xa1b2c3d4;
+const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+const uint32_t PCAP_LINKTYPE_ETHERNET = 1;
+const size_t PCAP_FILE_HEADER_SIZE = 24;
+const size_t PCAP_RECORD_HEADER_SIZE = 16;
+
+uint32_t swap32(uint32_t v)
+{
+  return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+uint16_t be16(const uint8_t* p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+double monotonicSeconds(const timespec& t)
+{
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+}
+
+/** @brief constructor
+   *
+   *  @param private_nh ROS private handle for calling node.
+   *  @param port UDP port number
+   *  @param filename PCAP dump file name
+   */
+InputPCAPMapped::InputPCAPMapped(ros::NodeHandle private_nh, uint16_t port, std::string filename)
+  : Input(private_nh, port), filename_(filename), file_(NULL), file_size_(0), next_(0)
+{
+  bool read_fast;
+  private_nh.param("read_once", read_once_, false);
+  private_nh.param("read_fast", read_fast, false);
+  private_nh.param("repeat_delay", repeat_delay_, 0.0);
+  private_nh.param("replay_speed", replay_speed_, 1.0);
+  if (read_fast || replay_speed_ < 0.0)
+  {
+    replay_speed_ = 0.0;
+  }
+  ROS_INFO_STREAM("[driver][pcap] Mapping PCAP file " << filename_ << ", replay speed "
+                  << (replay_speed_ > 0.0 ? std::to_string(replay_speed_) : std::string("max")));
+
+  if (!mapFile() || !indexPackets())
+  {
+    return;
+  }
+  ROS_INFO_STREAM("[driver][pcap] " << packets_.size() << " packets of port " << port << " indexed");
+  anchor();
+}
+
+/** destructor */
+InputPCAPMapped::~InputPCAPMapped(void)
+{
+  if (file_ != NULL)
+  {
+    munmap((void*)file_, file_size_);
+  }
+}
+
+bool InputPCAPMapped::mapFile(void)
+{
+  int fd = open(filename_.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    ROS_FATAL_STREAM("[driver][pcap] Error opening rslidar dump file: " << strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)PCAP_FILE_HEADER_SIZE)
+  {
+    ROS_FATAL("[driver][pcap] rslidar dump file too short.");
+    close(fd);
+    return false;
+  }
+  void* file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED)
+  {
+    ROS_FATAL_STREAM("[driver][pcap] Error mapping rslidar dump file: " << strerror(errno));
+    return false;
+  }
+  madvise(file, st.st_size, MADV_SEQUENTIAL);
+  file_ = static_cast<const uint8_t*>(file);
+  file_size_ = st.st_size;
+  return true;
+}
+
+/** @brief index the UDP payloads of the port, from the device ip if set */
+bool InputPCAPMapped::indexPackets(void)
+{
+  uint32_t header[6];
+  memcpy(header, file_, PCAP_FILE_HEADER_SIZE);
+  bool swapped = header[0] == swap32(PCAP_MAGIC_USEC) || header[0] == swap32(PCAP_MAGIC_NSEC);
+  uint32_t magic = swapped ? swap32(header[0]) : header[0];
+  uint32_t linktype = swapped ? swap32(header[5]) : header[5];
+  if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC)
+  {
+    ROS_FATAL("[driver][pcap] not a pcap file (pcapng is not mapped), replay it with pcap_mmap false.");
+    return false;
+  }
+  if (linktype != PCAP_LINKTYPE_ETHERNET)
+  {
+    ROS_FATAL_STREAM("[driver][pcap] link type " << linktype << " not mapped, only Ethernet.");
+    return false;
+  }
+  double fraction = magic == PCAP_MAGIC_NSEC ? 1e-9 : 1e-6;
+
+  in_addr devip;
+  bool filter_ip = !devip_str_.empty() && inet_aton(devip_str_.c_str(), &devip) != 0;
+
+  size_t offset = PCAP_FILE_HEADER_SIZE;
+  while (offset + PCAP_RECORD_HEADER_SIZE <= file_size_)
+  {
+    uint32_t record[4];  // seconds, fraction, captured and original lengths
+    memcpy(record, file_ + offset, PCAP_RECORD_HEADER_SIZE);
+    if (swapped)
+    {
+      for (int i = 0; i < 4; ++i)
+      {
+        record[i] = swap32(record[i]);
+      }
+    }
+    const uint8_t* frame = file_ + offset + PCAP_RECORD_HEADER_SIZE;
+    size_t length = record[2];
+    offset += PCAP_RECORD_HEADER_SIZE + length;
+    if (offset > file_size_)
+    {
+      ROS_WARN("[driver][pcap] rslidar dump file truncated.");
+      break;
+    }
+
+    // Ethernet, maybe VLAN tagged, IPv4, UDP
+    size_t ip = 14;
+    if (length >= 18 && be16(frame + 12) == 0x8100)
+    {
+      ip += 4;
+    }
+    if (length < ip + 20 || be16(frame + ip - 2) != 0x0800 || frame[ip + 9] != 17)
+    {
+      continue;
+    }
+    size_t udp = ip + (frame[ip] & 0x0f) * 4;
+    if (length < udp + 8 + packet_size || be16(frame + udp + 2) != port_)
+    {
+      continue;
+    }
+    if (filter_ip && memcmp(frame + ip + 12, &devip.s_addr, 4) != 0)
+    {
+      continue;
+    }
+    Packet packet;
+    packet.offset = frame + udp + 8 - file_;
+    packet.time = record[0] + record[1] * fraction;
+    packets_.push_back(packet);
+  }
+  if (packets_.empty())
+  {
+    ROS_ERROR_STREAM("[driver][pcap] no rslidar packet of port " << port_ << " in the dump file.");
+    return false;
+  }
+  return true;
+}
+
+void InputPCAPMapped::anchor(void)
+{
+  next_ = 0;
+  clock_gettime(CLOCK_MONOTONIC, &anchor_wall_);
+  anchor_stamp_ = ros::Time::now();
+}
+
+/** @brief Get one rslidar packet. */
+int InputPCAPMapped::getPacket(rslidar_msgs::rslidarPacket* pkt, const double time_offset)
+{
+  if (packets_.empty() || flag == 0)
+  {
+    return -1;
+  }
+  if (next_ == packets_.size())
+  {
+    if (read_once_)
+    {
+      ROS_INFO("[driver][pcap] end of file reached -- done reading.");
+      return -1;
+    }
+    if (repeat_delay_ > 0.0)
+    {
+      ROS_INFO("[driver][pcap] end of file reached -- delaying %.3f seconds.", repeat_delay_);
+      usleep(rint(repeat_delay_ * 1000000.0));
+    }
+    ROS_INFO("[driver][pcap] replaying rslidar dump file");
+    anchor();
+  }
+
+  const Packet& packet = packets_[next_++];
+  if (replay_speed_ > 0.0)
+  {
+    // served when its capture time comes on the scaled timeline, right away if behind
+    double elapsed = (packet.time - packets_[0].time) / replay_speed_;
+    double due = monotonicSeconds(anchor_wall_) + elapsed;
+    timespec wakeup;
+    wakeup.tv_sec = (time_t)due;
+    wakeup.tv_nsec = (long)((due - wakeup.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL) == EINTR && flag == 1)
+    {
+    }
+    pkt->stamp = anchor_stamp_ + ros::Duration(elapsed);
+  }
+  else
+  {
+    pkt->stamp = ros::Time::now();
+  }
+
+  memcpy(&pkt->data[0], file_ + packet.offset, packet_size);
+  return 0;
+}
 }
@@ -17,6 +17,9 @@
  *
  *     InputPCAP -- derived class provides a similar interface from a
  *              PCAP dump
+ *
+ *     InputPCAPMapped -- derived class replays a PCAP dump mapped in
+ *              memory, at an adjustable speed
  */
 
 #ifndef __RSLIDAR_INPUT_H_
@@ -28,6 +31,8 @@
 #include <netinet/in.h>
 #include <ros/ros.h>
 #include <rslidar_msgs/rslidarPacket.h>
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <sstream>
 #include <sys/socket.h>
@@ -36,7 +41,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <signal.h>
+#include <time.h>
+#include <vector>
 #include <sensor_msgs/TimeReference.h>
 
 namespace rslidar_driver
@@ -64,18 +73,36 @@ public:
 
   virtual int getPacket(rslidar_msgs::rslidarPacket* pkt, const double time_offset) = 0;
 
-  int getRpm(void);
-  int getReturnMode(void);
-  bool getUpdateFlag(void);
-  void clearUpdateFlag(void);
+  /**
+   * @brief Get up to max packets at once, one by default
+   * @param received the number of packets read into pkts, from 1 to max if 0 is returned
+   * @returns the same as getPacket
+   */
+  virtual int getPackets(rslidar_msgs::rslidarPacket* pkts, int max, const double time_offset, int& received);
+
+  /// packets read short, and dropped, since construction
+  uint64_t incompletePackets(void) const
+  {
+    return incomplete_packets_.load(std::memory_order_relaxed);
+  }
+
+  /** @brief the receive queue of the socket, with packet_stats
+   *
+   *  @param high_water most bytes queued since the last call
+   *  @param capacity bytes of the receive buffer
+   *  @param drops packets the kernel dropped, the buffer full, since the socket was opened
+   *  @returns false if the input has no such queue
+   */
+  virtual bool queueStats(uint32_t& high_water, uint32_t& capacity, uint32_t& drops)
+  {
+    return false;
+  }
 
 protected:
   ros::NodeHandle private_nh_;
   uint16_t port_;
   std::string devip_str_;
-  int cur_rpm_;
-  int return_mode_;
-  bool npkt_update_flag_;
+  std::atomic<uint64_t> incomplete_packets_;
 };
 
 /** @brief Live rslidar input from socket. */
@@ -88,11 +115,52 @@ public:
 
   virtual int getPacket(rslidar_msgs::rslidarPacket* pkt, const double time_offset);
 
+  /// with recv_batch > 1, up to recv_batch packets per recvmmsg() syscall
+  virtual int getPackets(rslidar_msgs::rslidarPacket* pkts, int max, const double time_offset, int& received);
+
+  /// of the socket, to wait for it with others
+  int fd(void) const
+  {
+    return sockfd_;
+  }
+
+  /** @brief read without waiting, for a socket polled by the caller
+   *
+   *  getPacket and getPackets then return 1 at once when no packet is
+   *  queued, without a poll() timeout nor its reconnection request.
+   */
+  void setNonBlocking(void)
+  {
+    poll_timeout_ = 0;
+  }
+
+  virtual bool queueStats(uint32_t& high_water, uint32_t& capacity, uint32_t& drops);
+
 private:
+  int pollSocket(void);
+  /// the bytes queued and the drops of SO_MEMINFO, before reading
+  void sampleQueue(void);
+  int receive(rslidar_msgs::rslidarPacket* pkts, int max, const double time_offset, int& received);
+
 private:
   int sockfd_;
   in_addr devip_;
-
+  int poll_timeout_;  ///< msec
+
+  // the receive queue sampled with packet_stats, read by any thread
+  bool queue_stats_;
+  std::atomic<uint32_t> queue_high_water_;
+  std::atomic<uint32_t> queue_capacity_;
+  std::atomic<uint32_t> queue_drops_;
+
+  // recvmmsg() receive, with recv_batch > 1 or kernel_timestamps
+  bool mmsg_;
+  bool kernel_timestamps_;               ///< stamps of SO_TIMESTAMPNS, when the kernel received the packets
+  std::vector<mmsghdr> msgs_;
+  std::vector<iovec> iovecs_;
+  std::vector<sockaddr_in> senders_;
+  std::vector<char> control_;            ///< the timestamp of every packet
+  size_t control_size_;
 };
 
 /** @brief rslidar input from PCAP dump file.
@@ -120,6 +188,47 @@ private:
   bool read_fast_;
   double repeat_delay_;
 };
+
+/** @brief rslidar input from a memory mapped PCAP dump file, for benchmarking.
+   *
+   * The file is mapped and its packets of the port indexed once, then served
+   * by a copy from the mapping at replay_speed times the capture rate, 0 for
+   * as fast as they are read. The stamps are those of the capture timeline
+   * scaled by the speed, or the time the packets are served at the max speed.
+   * Only classic pcap files of Ethernet frames are read.
+   */
+class InputPCAPMapped : public Input
+{
+public:
+  InputPCAPMapped(ros::NodeHandle private_nh, uint16_t port = MSOP_DATA_PORT_NUMBER, std::string filename = "");
+
+  virtual ~InputPCAPMapped();
+
+  virtual int getPacket(rslidar_msgs::rslidarPacket* pkt, const double time_offset);
+
+private:
+  bool mapFile(void);
+  bool indexPackets(void);
+  /// the replay timeline anchored at now, from the first packet
+  void anchor(void);
+
+  struct Packet
+  {
+    size_t offset;  ///< of the UDP payload in the file
+    double time;    ///< of the capture, seconds
+  };
+
+  std::string filename_;
+  const uint8_t* file_;
+  size_t file_size_;
+  std::vector<Packet> packets_;
+  size_t next_;  ///< packet to serve
+  bool read_once_;
+  double replay_speed_;
+  double repeat_delay_;
+  timespec anchor_wall_;  ///< CLOCK_MONOTONIC at the anchor
+  ros::Time anchor_stamp_;
+};
 }
 
 #endif  // __RSLIDAR_INPUT_H
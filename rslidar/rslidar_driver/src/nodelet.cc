@@ -65,6 +65,7 @@ void DriverNodelet::onInit()
 /** @brief Device poll thread main loop. */
 void DriverNodelet::devicePoll()
 {
+  thread_config::configure(getPrivateNodeHandle(), "poll");
   while (ros::ok() && dvr_->poll())
   {
     ros::spinOnce();
@@ -0,0 +1,99 @@
+/*
+ *	Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Ring of msop packet slots between the receiver thread and the scan
+ *  assembler of the driver
+ */
+#include "packet_ring.h"
+#include <algorithm>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace rslidar_driver
+{
+PacketRing::PacketRing(size_t size)
+  : slots_(std::max(size, (size_t)1)), head_(0), tail_(0), overflows_(0), closed_(false), waiting_(false)
+{
+}
+
+rslidar_msgs::rslidarPacket* PacketRing::writable(size_t& n)
+{
+  size_t head = head_.load(std::memory_order_relaxed);
+  size_t tail = tail_.load(std::memory_order_acquire);  // the slots it freed are ours
+  size_t first = head % slots_.size();
+  n = std::min(slots_.size() - (head - tail), slots_.size() - first);
+  return &slots_[first];
+}
+
+void PacketRing::commit(size_t n)
+{
+  if (n == 0)
+  {
+    return;
+  }
+  // sequentially consistent with waiting_, so a consumer going to sleep
+  // either sees the packets or is woken up
+  head_.fetch_add(n);
+  if (waiting_.load())
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    ready_.notify_one();
+  }
+}
+
+void PacketRing::overflow(size_t n)
+{
+  overflows_.fetch_add(n, std::memory_order_relaxed);
+}
+
+void PacketRing::close(void)
+{
+  closed_.store(true);
+  boost::mutex::scoped_lock lock(mutex_);
+  ready_.notify_one();
+}
+
+int PacketRing::pop(rslidar_msgs::rslidarPacket* pkts, int max, int& received, double timeout)
+{
+  received = 0;
+  size_t tail = tail_.load(std::memory_order_relaxed);
+  size_t head = head_.load(std::memory_order_acquire);
+  if (head == tail)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    waiting_.store(true);
+    boost::system_time deadline = boost::get_system_time() + boost::posix_time::microseconds((long)(timeout * 1e6));
+    while ((head = head_.load()) == tail && !closed_.load())
+    {
+      if (!ready_.timed_wait(lock, deadline))
+      {
+        break;
+      }
+    }
+    waiting_.store(false);
+    if (head == tail)
+    {
+      return closed_.load() ? -1 : 1;
+    }
+  }
+
+  size_t n = std::min(head - tail, (size_t)max);
+  for (size_t i = 0; i < n; ++i)
+  {
+    pkts[i] = slots_[(tail + i) % slots_.size()];
+  }
+  tail_.store(tail + n, std::memory_order_release);  // the slots back to the producer
+  received = n;
+  return 0;
+}
+
+size_t PacketRing::size(void) const
+{
+  return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+}
+}
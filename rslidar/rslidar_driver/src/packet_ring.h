@@ -0,0 +1,97 @@
+/*
+ *	Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Ring of msop packet slots between the receiver thread of the driver,
+ *  which reads the socket into them, and the scan assembler, which takes
+ *  them out: one producer and one consumer, lock-free but for the sleep of
+ *  the consumer on an empty ring.
+ */
+
+#ifndef __RSLIDAR_PACKET_RING_H_
+#define __RSLIDAR_PACKET_RING_H_
+
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <rslidar_msgs/rslidarPacket.h>
+
+namespace rslidar_driver
+{
+class PacketRing
+{
+public:
+  /** @brief constructor, all the slots allocated up front
+   *
+   *  @param size number of packet slots
+   */
+  explicit PacketRing(size_t size);
+
+  // producer side, the receiver thread
+
+  /** @brief the free slots following each other from the next one
+   *
+   *  @param n their number, 0 if the ring is full
+   */
+  rslidar_msgs::rslidarPacket* writable(size_t& n);
+
+  /// the first n writable slots handed to the consumer
+  void commit(size_t n);
+
+  /// n packets dropped, the ring being full
+  void overflow(size_t n);
+
+  /// no more packets, the consumer gets -1 once the ring is empty
+  void close(void);
+
+  // consumer side, the scan assembler
+
+  /** @brief Take up to max packets out of the ring, waiting for one
+   *
+   *  @param received the number of packets copied into pkts if 0 is returned
+   *  @param timeout the longest wait in seconds
+   *  @returns 0 if successful,
+   *           -1 if closed and empty,
+   *           1 if still empty after timeout
+   */
+  int pop(rslidar_msgs::rslidarPacket* pkts, int max, int& received, double timeout);
+
+  // from any thread
+
+  size_t capacity(void) const
+  {
+    return slots_.size();
+  }
+
+  /// packets in the ring
+  size_t size(void) const;
+
+  /// packets dropped since construction
+  uint64_t overflows(void) const
+  {
+    return overflows_.load(std::memory_order_relaxed);
+  }
+
+private:
+  PacketRing(const PacketRing&);
+  PacketRing& operator=(const PacketRing&);
+
+  std::vector<rslidar_msgs::rslidarPacket> slots_;
+  std::atomic<size_t> head_;  ///< packets ever committed, written by the producer
+  std::atomic<size_t> tail_;  ///< packets ever taken, written by the consumer
+  std::atomic<uint64_t> overflows_;
+  std::atomic<bool> closed_;
+  std::atomic<bool> waiting_;  ///< the consumer is about to sleep, or sleeps
+  boost::mutex mutex_;         ///< of the sleep only
+  boost::condition_variable ready_;
+};
+}
+
+#endif  // __RSLIDAR_PACKET_RING_H_
@@ -0,0 +1,163 @@
+/*
+ *	Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Statistics of the msop packets of the driver
+ */
+#include "packet_stats.h"
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <time.h>
+
+namespace rslidar_driver
+{
+const int PacketStats::LATENCY_BOUNDS[LATENCY_BUCKETS - 1] = { 50, 100, 200, 500, 1000, 5000, 20000 };
+
+PacketStats::PacketStats()
+  : last_azimuth_(-1), azimuth_step_(0), packets_total_(0), lost_total_(0), incomplete_reported_(0), drops_reported_(0)
+{
+  reset();
+}
+
+void PacketStats::reset(void)
+{
+  packets_ = 0;
+  lost_ = 0;
+  gaps_ = 0;
+  std::fill(latency_, latency_ + LATENCY_BUCKETS, 0);
+  latency_max_ = 0.0;
+  scans_ = 0;
+  scan_packets_min_ = std::numeric_limits<int>::max();
+  scan_packets_max_ = 0;
+  decode_time_sum_ = 0.0;
+  decode_time_max_ = 0.0;
+}
+
+double PacketStats::clock(void)
+{
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + 1e-9 * now.tv_nsec;
+}
+
+/** The packets lost are those the azimuth of the first block skips over:
+ *  the step from a packet to the next is learnt from the packets in a row,
+ *  whatever the rpm and the return mode, and a jump of more than one and a
+ *  half steps counts the packets it spans. A jump back, of packets out of
+ *  order, is left out, so are losses of half a revolution or more.
+ */
+void PacketStats::addPacket(const rslidar_msgs::rslidarPacket& pkt, double latency)
+{
+  ++packets_;
+  ++packets_total_;
+
+  int bucket = 0;
+  while (bucket < LATENCY_BUCKETS - 1 && latency * 1e6 >= LATENCY_BOUNDS[bucket])
+  {
+    ++bucket;
+  }
+  ++latency_[bucket];
+  latency_max_ = std::max(latency_max_, latency);
+
+  const uint8_t* data = &pkt.data[0];
+  if (data[0] != 0x55 || data[1] != 0xAA || data[2] != 0x05 || data[3] != 0x0A || data[42] != 0xFF ||
+      data[43] != 0xEE)
+  {
+    return;  // not a msop packet
+  }
+  int azimuth = 256 * data[44] + data[45];
+  if (azimuth >= 36000)
+  {
+    return;
+  }
+  int delta = (azimuth - last_azimuth_ + 36000) % 36000;
+  if (last_azimuth_ >= 0 && delta > 0 && delta < 18000)
+  {
+    if (azimuth_step_ > 0 && 2 * delta > 3 * azimuth_step_)
+    {
+      int lost = (delta + azimuth_step_ / 2) / azimuth_step_ - 1;
+      lost_ += lost;
+      lost_total_ += lost;
+      ++gaps_;
+    }
+    else
+    {
+      azimuth_step_ = delta;
+    }
+  }
+  last_azimuth_ = azimuth;
+}
+
+void PacketStats::addScan(int packets, double decode_time)
+{
+  ++scans_;
+  scan_packets_min_ = std::min(scan_packets_min_, packets);
+  scan_packets_max_ = std::max(scan_packets_max_, packets);
+  decode_time_sum_ += decode_time;
+  decode_time_max_ = std::max(decode_time_max_, decode_time);
+}
+
+void PacketStats::report(diagnostic_updater::DiagnosticStatusWrapper& stat, Input& input)
+{
+  uint64_t incomplete = input.incompletePackets();
+  uint32_t high_water = 0, capacity = 0, drops = drops_reported_;
+  bool queue = input.queueStats(high_water, capacity, drops);
+
+  if (lost_ > 0 || drops != drops_reported_ || incomplete != incomplete_reported_)
+  {
+    stat.summaryf(diagnostic_msgs::DiagnosticStatus::WARN, "%lu packets lost in %lu gaps, %u dropped by the socket, "
+                  "%lu incomplete", (unsigned long)lost_, (unsigned long)gaps_, drops - drops_reported_,
+                  (unsigned long)(incomplete - incomplete_reported_));
+  }
+  else
+  {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "no packets lost");
+  }
+
+  stat.add("Packets", packets_);
+  stat.add("Packets lost", lost_);
+  stat.add("Azimuth gaps", gaps_);
+  stat.add("Azimuth step", azimuth_step_);
+  stat.add("Packets in total", packets_total_);
+  stat.add("Packets lost in total", lost_total_);
+  stat.add("Incomplete packets in total", incomplete);
+  stat.add("Scans", scans_);
+  if (scans_ > 0)
+  {
+    stat.add("Packets per scan min", scan_packets_min_);
+    stat.add("Packets per scan max", scan_packets_max_);
+    stat.add("Decode time per scan mean (ms)", 1e3 * decode_time_sum_ / scans_);
+    stat.add("Decode time per scan max (ms)", 1e3 * decode_time_max_);
+  }
+  for (int i = 0; i < LATENCY_BUCKETS; ++i)
+  {
+    std::ostringstream name;
+    if (i < LATENCY_BUCKETS - 1)
+    {
+      name << "Latency < " << LATENCY_BOUNDS[i] << " us";
+    }
+    else
+    {
+      name << "Latency >= " << LATENCY_BOUNDS[i - 1] << " us";
+    }
+    stat.add(name.str(), latency_[i]);
+  }
+  stat.add("Latency max (us)", 1e6 * latency_max_);
+  if (queue)
+  {
+    stat.add("Socket queue high-water (bytes)", high_water);
+    stat.add("Socket buffer (bytes)", capacity);
+    stat.add("Socket drops in total", drops);
+  }
+
+  incomplete_reported_ = incomplete;
+  drops_reported_ = drops;
+  reset();
+}
+}  // namespace rslidar_driver
@@ -0,0 +1,79 @@
+/*
+ *	Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Statistics of the msop packets taken by the scan assembler of the
+ *  driver, reported on its diagnostics with packet_stats set: the packets
+ *  per scan, those lost as detected from the gaps in the block azimuths,
+ *  the latency of the packets from their stamp, the receive queue of the
+ *  socket and the decode time of the scans.
+ */
+
+#ifndef __RSLIDAR_PACKET_STATS_H_
+#define __RSLIDAR_PACKET_STATS_H_
+
+#include <stdint.h>
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <rslidar_msgs/rslidarPacket.h>
+#include "input.h"
+
+namespace rslidar_driver
+{
+class PacketStats
+{
+public:
+  PacketStats();
+
+  /** @brief a msop packet handed to the scan
+   *
+   *  @param latency seconds from its stamp, less the time offset, to now
+   */
+  void addPacket(const rslidar_msgs::rslidarPacket& pkt, double latency);
+
+  /// a scan of packets, decoded or published in decode_time seconds
+  void addScan(int packets, double decode_time);
+
+  /// the statistics since the last report, the counters of input since construction
+  void report(diagnostic_updater::DiagnosticStatusWrapper& stat, Input& input);
+
+  /// seconds of CLOCK_MONOTONIC, to time the decoding
+  static double clock(void);
+
+  /// latency histogram bounds, in microseconds
+  static const int LATENCY_BUCKETS = 8;
+  static const int LATENCY_BOUNDS[LATENCY_BUCKETS - 1];
+
+private:
+  /// the statistics since the last report cleared
+  void reset(void);
+
+  // of the azimuths, across the reports
+  int last_azimuth_;  ///< of the first block of the last packet, none if negative
+  int azimuth_step_;  ///< from a packet to the next, learnt from those without gap
+
+  // since the last report
+  uint64_t packets_;
+  uint64_t lost_;
+  uint64_t gaps_;
+  uint64_t latency_[LATENCY_BUCKETS];
+  double latency_max_;
+  int scans_;
+  int scan_packets_min_;
+  int scan_packets_max_;
+  double decode_time_sum_;
+  double decode_time_max_;
+
+  // since construction
+  uint64_t packets_total_;
+  uint64_t lost_total_;
+  uint64_t incomplete_reported_;
+  uint32_t drops_reported_;
+};
+}
+
+#endif  // __RSLIDAR_PACKET_STATS_H_
@@ -14,10 +14,9 @@
 
 namespace rslidar_driver
 {
-  static const unsigned int POINTS_ONE_CHANNEL_PER_SECOND = 18000;
-  static const unsigned int BLOCKS_ONE_CHANNEL_PER_PKT = 12;
 
 rslidarDriver::rslidarDriver(ros::NodeHandle node, ros::NodeHandle private_nh)
+  : receiving_(false), overflows_reported_(0), publish_packets_(true), private_nh_(private_nh)
 {
   skip_num_ = 0;
   // use private node handle to get parameters
@@ -65,6 +64,7 @@ rslidarDriver::rslidarDriver(ros::NodeHandle node, ros::NodeHandle private_nh)
     packet_rate = 2600.0;
   }
   std::string deviceName(std::string("Robosense ") + model_full_name);
+  status_.reset(new DeviceStatus(config_.model));
 
   private_nh.param("rpm", config_.rpm, 600.0);
   double frequency = (config_.rpm / 60.0);  // expected Hz rate
@@ -81,6 +81,11 @@ rslidarDriver::rslidarDriver(ros::NodeHandle node, ros::NodeHandle private_nh)
 
   int msop_udp_port;
   private_nh.param("msop_port", msop_udp_port, (int)MSOP_DATA_PORT_NUMBER);
+  // packets per syscall of the socket input, c.f. InputSocket
+  int recv_batch;
+  private_nh.param("recv_batch", recv_batch, 1);
+  read_ahead_.resize(std::max(recv_batch, 1));
+  read_ahead_begin_ = read_ahead_end_ = 0;
   int difop_udp_port;
   private_nh.param("difop_port", difop_udp_port, (int)DIFOP_DATA_PORT_NUMBER);
 
@@ -126,7 +131,15 @@ rslidarDriver::rslidarDriver(ros::NodeHandle node, ros::NodeHandle private_nh)
                                         TimeStampStatusParam()));
 
   // open rslidar input device or file
-  if (dump_file != "")  // have PCAP file?
+  bool pcap_mmap;
+  private_nh.param("pcap_mmap", pcap_mmap, false);
+  if (dump_file != "" && pcap_mmap)
+  {
+    // replay the packet capture file mapped in memory, at replay_speed
+    msop_input_.reset(new rslidar_driver::InputPCAPMapped(private_nh, msop_udp_port, dump_file));
+    difop_input_.reset(new rslidar_driver::InputPCAPMapped(private_nh, difop_udp_port, dump_file));
+  }
+  else if (dump_file != "")  // have PCAP file?
   {
     // read data from packet capture file
     msop_input_.reset(new rslidar_driver::InputPCAP(private_nh, msop_udp_port, packet_rate, dump_file));
@@ -144,12 +157,50 @@ rslidarDriver::rslidarDriver(ros::NodeHandle node, ros::NodeHandle private_nh)
   private_nh.param("output_packets_topic", output_packets_topic, std::string("rslidar_packets"));
   msop_output_ = node.advertise<rslidar_msgs::rslidarScan>(output_packets_topic, 10);
 
+  // the same packets losslessly compressed, for recording
+  std::string output_compressed_topic;
+  private_nh.param("output_compressed_topic", output_compressed_topic, std::string("rslidar_packets_compressed"));
+  compressed_output_ = node.advertise<rslidar_msgs::rslidarCompressedScan>(output_compressed_topic, 10);
+  codec_ = ScanCodec(ScanCodec::firingsPerBlock(config_.model));
+
   std::string output_difop_topic;
   private_nh.param("output_difop_topic", output_difop_topic, std::string("rslidar_packets_difop"));
   difop_output_ = node.advertise<rslidar_msgs::rslidarPacket>(output_difop_topic, 10);
 
   difop_thread_ = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&rslidarDriver::difopPoll, this)));
 
+  // read the msop packets in a thread of their own into a ring, so that
+  // they are not lost while a scan is published
+  bool receiver_thread;
+  private_nh.param("receiver_thread", receiver_thread, false);
+  if (receiver_thread)
+  {
+    int ring_size, receiver_cpu, receiver_priority;
+    private_nh.param("receiver_ring_size", ring_size, 4096);
+    private_nh.param("receiver_cpu", receiver_cpu, -1);
+    private_nh.param("receiver_priority", receiver_priority, 0);
+    // the defaults of scheduling/receiver/
+    thread_config::Settings receiver(receiver_cpu >= 0 ? std::to_string(receiver_cpu) : std::string(), receiver_priority);
+    msop_ring_.reset(new PacketRing(std::max(ring_size, 1)));
+    receiving_ = true;
+    msop_thread_ = boost::shared_ptr<boost::thread>(new boost::thread(
+        boost::bind(&rslidarDriver::msopReceive, this, thread_config::read(private_nh, "receiver", receiver))));
+    diagnostics_.add("rslidar_receiver", this, &rslidarDriver::receiverStatus);
+    ROS_INFO_STREAM("[driver] receiver thread with a ring of " << msop_ring_->capacity() << " packets");
+  }
+
+  // the packets per scan, lost, their latency, the socket queue and the
+  // decode time on the diagnostics, c.f. PacketStats
+  bool packet_stats;
+  private_nh.param("packet_stats", packet_stats, false);
+  if (packet_stats)
+  {
+    stats_.reset(new PacketStats);
+    diagnostics_.add("rslidar_packet_stats", this, &rslidarDriver::packetStatus);
+  }
+
+  diagnostics_.add("rslidar_threads", this, &rslidarDriver::threadStatus);
+
   private_nh.param("time_synchronization", time_synchronization_, false);
 
   if (time_synchronization_)
@@ -160,6 +211,15 @@ rslidarDriver::rslidarDriver(ros::NodeHandle node, ros::NodeHandle private_nh)
   }
 }
 
+rslidarDriver::~rslidarDriver()
+{
+  if (msop_thread_)
+  {
+    receiving_ = false;
+    msop_thread_->join();  // within the poll timeout of the socket
+  }
+}
+
 /** poll the device
  *
  *  @returns true unless end of file reached
@@ -167,24 +227,43 @@ rslidarDriver::rslidarDriver(ros::NodeHandle node, ros::NodeHandle private_nh)
 bool rslidarDriver::poll(void)
 {  // Allocate a new shared pointer for zero-copy sharing with other nodelets.
   rslidar_msgs::rslidarScanPtr scan(new rslidar_msgs::rslidarScan);
+  ros::Time stamp;  // of the last packet read
+  int scan_packets = 0;
+  double decode_time = 0.0;  // with stats_
 
   // Since the rslidar delivers data at a very high rate, keep
   // reading and publishing scans as fast as possible.
   if (config_.cut_angle >= 0)  // Cut at specific angle feature enabled
   {
-    scan->packets.reserve(config_.npackets);
+    if (publish_packets_)
+      scan->packets.reserve(config_.npackets);
+    if (decoder_)
+      decoder_->beginScan(config_.npackets, config_.frame_id);
     rslidar_msgs::rslidarPacket tmp_packet;
     while (true)
     {
       while (true)
       {
-        int rc = msop_input_->getPacket(&tmp_packet, config_.time_offset);
+        int rc = nextPacket(&tmp_packet);
         if (rc == 0)
           break;  // got a full packet?
         if (rc < 0)
           return false;  // end of file reached?
       }
-      scan->packets.push_back(tmp_packet);
+      if (publish_packets_)
+        scan->packets.push_back(tmp_packet);
+      if (stats_)
+      {
+        countPacket(tmp_packet, ros::Time::now().toSec());
+        double start = PacketStats::clock();
+        if (decoder_)
+          decoder_->decodePacket(tmp_packet);
+        decode_time += PacketStats::clock() - start;
+      }
+      else if (decoder_)
+        decoder_->decodePacket(tmp_packet);
+      stamp = tmp_packet.stamp;
+      ++scan_packets;
 
       static int ANGLE_HEAD = -36001;  // note: cannot be set to -1, or stack smashing
       static int last_azimuth = ANGLE_HEAD;
@@ -208,53 +287,70 @@ bool rslidarDriver::poll(void)
   }
   else  // standard behaviour
   {
-    if (difop_input_->getUpdateFlag())
+    // the packets of a revolution at the rpm and the return mode of the difop thread
+    int npackets = status_->takeNpackets();
+    if (npackets > 0)
     {
-      int packets_rate = ceil(POINTS_ONE_CHANNEL_PER_SECOND/BLOCKS_ONE_CHANNEL_PER_PKT);
-      int mode = difop_input_->getReturnMode();
-      if (config_.model == "RS16" && (mode == 1 || mode == 2))
-      {
-        packets_rate = ceil(packets_rate/2);
-      }
-      else if ((config_.model == "RS32" || config_.model == "RSBPEARL" || config_.model == "RSBPEARL_MINI") && (mode == 0))
-      {
-        packets_rate = packets_rate*2;
-      }
-      config_.rpm = difop_input_->getRpm();
-      config_.npackets = ceil(packets_rate*60/config_.rpm);
-
-      difop_input_->clearUpdateFlag();
-
-      ROS_INFO_STREAM("[driver] update npackets. rpm: "<<config_.rpm<<", npkts: "<<config_.npackets);
+      config_.npackets = npackets;
+    }
+    // the packets are read into the scan, or by batches into read_ahead_
+    // when only decoded
+    rslidar_msgs::rslidarPacket* buffer = &read_ahead_[0];
+    int buffer_size = read_ahead_.size();
+    if (publish_packets_)
+    {
+      scan->packets.resize(config_.npackets);
+      buffer = &scan->packets[0];
+      buffer_size = config_.npackets;
     }
-    scan->packets.resize(config_.npackets);
     // use in standard behaviour only
     while (skip_num_)
     {
-      while (true)
-      {
-        // keep reading until full packet received
-        int rc = msop_input_->getPacket(&scan->packets[0], config_.time_offset);
-        if (rc == 0)
-          break;  // got a full packet?
-        if (rc < 0)
-          return false;  // end of file reached?
-      }
-      --skip_num_;
+      // keep reading until full packets received, never more than skipped
+      int received;
+      int rc = getPackets(buffer, std::min<uint32_t>(skip_num_, buffer_size), received);
+      if (rc < 0)
+        return false;  // end of file reached?
+      if (rc == 0)
+        skip_num_ -= received;
     }
 
-    for (int i = 0; i < config_.npackets; ++i)
+    if (decoder_)
+      decoder_->beginScan(config_.npackets, config_.frame_id);
+    for (int i = 0; i < config_.npackets;)
     {
-      while (true)
+      // keep reading until full packets received, as many at once as the
+      // input has, up to the end of the scan
+      int received;
+      rslidar_msgs::rslidarPacket* pkts = publish_packets_ ? buffer + i : buffer;
+      int rc = getPackets(pkts, std::min(config_.npackets - i, publish_packets_ ? config_.npackets : buffer_size),
+                          received);
+      if (rc < 0)
+        return false;  // end of file reached?
+      if (rc == 0 && received > 0)
       {
-        // keep reading until full packet received
-        int rc = msop_input_->getPacket(&scan->packets[i], config_.time_offset);
-        if (rc == 0)
-          break;  // got a full packet?
-        if (rc < 0)
-          return false;  // end of file reached?
+        double start = 0.0;
+        if (stats_)
+        {
+          double now = ros::Time::now().toSec();
+          for (int k = 0; k < received; ++k)
+            countPacket(pkts[k], now);
+          start = PacketStats::clock();
+        }
+        if (decoder_)
+        {
+          for (int k = 0; k < received; ++k)
+            decoder_->decodePacket(pkts[k]);
+        }
+        if (stats_)
+          decode_time += PacketStats::clock() - start;
+        if (i == 0 && !publish_packets_ && time_synchronization_)
+          first_packet_ = pkts[0];
+        stamp = pkts[received - 1].stamp;
+        i += received;
       }
     }
+    scan_packets = config_.npackets;
 
     if (time_synchronization_)
     {
@@ -262,7 +358,7 @@ bool rslidarDriver::poll(void)
       // it is already the msop msg
       // if (pkt->data[0] == 0x55 && pkt->data[1] == 0xaa && pkt->data[2] == 0x05 && pkt->data[3] == 0x0a)
       // use the first packets
-      rslidar_msgs::rslidarPacket pkt = scan->packets[0];
+      const rslidar_msgs::rslidarPacket& pkt = publish_packets_ ? scan->packets[0] : first_packet_;
       struct tm stm;
       memset(&stm, 0, sizeof(stm));
       stm.tm_year = (int)pkt.data[20] + 100;
@@ -281,19 +377,153 @@ bool rslidarDriver::poll(void)
 
   // publish message using time of last packet read
 //  ROS_DEBUG("[driver] Publishing a full rslidar scan.");
-  scan->header.stamp = scan->packets.back().stamp;
-  scan->header.frame_id = config_.frame_id;
-  msop_output_.publish(scan);
+  double start = stats_ ? PacketStats::clock() : 0.0;
+  if (publish_packets_)
+  {
+    scan->header.stamp = stamp;
+    scan->header.frame_id = config_.frame_id;
+    msop_output_.publish(scan);
+    if (compressed_output_.getNumSubscribers() > 0)
+    {
+      rslidar_msgs::rslidarCompressedScanPtr compressed(new rslidar_msgs::rslidarCompressedScan);
+      codec_.encode(*scan, *compressed);
+      compressed_output_.publish(compressed);
+    }
+  }
+  if (decoder_)
+    decoder_->endScan(stamp);
+  if (stats_)
+    stats_->addScan(scan_packets, decode_time + PacketStats::clock() - start);
 
   // notify diagnostics that a message has been published, updating its status
-  diag_topic_->tick(scan->header.stamp);
+  diag_topic_->tick(stamp);
   diagnostics_.update();
 
   return true;
 }
 
+/** the scans decoded in the thread of poll, from the next one on
+ *
+ *  To be set before polling starts.
+ */
+void rslidarDriver::setDecoder(boost::shared_ptr<ScanDecoder> decoder, bool publish_packets)
+{
+  decoder_ = decoder;
+  publish_packets_ = publish_packets || !decoder_;
+}
+
+/** read the msop packets by batches, handed out one at a time
+ *
+ *  @returns the same as Input::getPacket
+ */
+int rslidarDriver::nextPacket(rslidar_msgs::rslidarPacket* pkt)
+{
+  if (read_ahead_begin_ == read_ahead_end_)
+  {
+    int received;
+    int rc = getPackets(&read_ahead_[0], read_ahead_.size(), received);
+    if (rc != 0)
+      return rc;
+    read_ahead_begin_ = 0;
+    read_ahead_end_ = received;
+  }
+  *pkt = read_ahead_[read_ahead_begin_++];
+  return 0;
+}
+
+/** the msop packets of the receiver thread, or of the input without it
+ *
+ *  @returns the same as Input::getPackets
+ */
+int rslidarDriver::getPackets(rslidar_msgs::rslidarPacket* pkts, int max, int& received)
+{
+  if (msop_ring_)
+  {
+    return msop_ring_->pop(pkts, max, received, 1.0);
+  }
+  return msop_input_->getPackets(pkts, max, config_.time_offset, received);
+}
+
+/** @brief Receiver thread main loop
+ *
+ *  Reads the msop packets by batches of recv_batch straight into the free
+ *  slots of the ring. With the ring full the socket is still drained, into
+ *  a scratch batch, and the packets counted as overflows: the newest are
+ *  dropped rather than the kernel buffer filling up.
+ *
+ *  @param settings the CPUs and the priority of the thread, c.f. thread_config
+ */
+void rslidarDriver::msopReceive(const thread_config::Settings& settings)
+{
+  thread_config::apply(private_nh_.getNamespace(), "receiver", settings);
+
+  std::vector<rslidar_msgs::rslidarPacket> scratch(read_ahead_.size());
+  while (receiving_ && ros::ok())
+  {
+    size_t n;
+    rslidar_msgs::rslidarPacket* slots = msop_ring_->writable(n);
+    bool full = (n == 0);
+    if (full)
+    {
+      slots = &scratch[0];
+      n = scratch.size();
+    }
+    int received;
+    int rc = msop_input_->getPackets(slots, std::min(n, scratch.size()), config_.time_offset, received);
+    if (rc < 0)
+      break;  // end of file reached?
+    if (rc == 0)
+    {
+      if (full)
+        msop_ring_->overflow(received);
+      else
+        msop_ring_->commit(received);
+    }
+  }
+  msop_ring_->close();
+}
+
+void rslidarDriver::threadStatus(diagnostic_updater::DiagnosticStatusWrapper& stat)
+{
+  thread_config::diagnostics(stat, private_nh_.getNamespace());
+}
+
+void rslidarDriver::receiverStatus(diagnostic_updater::DiagnosticStatusWrapper& stat)
+{
+  uint64_t overflows = msop_ring_->overflows();
+  if (overflows > overflows_reported_)
+  {
+    stat.summaryf(diagnostic_msgs::DiagnosticStatus::WARN, "%lu packets dropped, ring full",
+                  (unsigned long)(overflows - overflows_reported_));
+    ROS_WARN("[driver] receiver ring full, %lu packets dropped (%lu in total)",
+             (unsigned long)(overflows - overflows_reported_), (unsigned long)overflows);
+    overflows_reported_ = overflows;
+  }
+  else
+  {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "no packets dropped");
+  }
+  stat.add("Packets in ring", msop_ring_->size());
+  stat.add("Ring size", msop_ring_->capacity());
+  stat.add("Packets dropped", overflows);
+}
+
+void rslidarDriver::packetStatus(diagnostic_updater::DiagnosticStatusWrapper& stat)
+{
+  stats_->report(stat, *msop_input_);
+}
+
+/** the latency from the stamp, of the reception by the socket or the
+ *  kernel, to now that the scan assembler takes the packet
+ */
+void rslidarDriver::countPacket(const rslidar_msgs::rslidarPacket& pkt, double now)
+{
+  stats_->addPacket(pkt, now - (pkt.stamp.toSec() - config_.time_offset));
+}
+
 void rslidarDriver::difopPoll(void)
 {
+  thread_config::configure(private_nh_, "difop");
   // reading and publishing scans as fast as possible.
   rslidar_msgs::rslidarPacketPtr difop_packet_ptr(new rslidar_msgs::rslidarPacket);
   while (ros::ok())
@@ -303,6 +533,10 @@ void rslidarDriver::difopPoll(void)
     int rc = difop_input_->getPacket(&difop_packet_msg, config_.time_offset);
     if (rc == 0)
     {
+      if (status_->update(difop_packet_msg))
+      {
+        ROS_INFO_STREAM("[driver] update npackets. rpm: " << status_->rpm() << ", npkts: " << status_->npackets());
+      }
 //      ROS_DEBUG("[driver] Publishing a difop data.");
       *difop_packet_ptr = difop_packet_msg;
       difop_output_.publish(difop_packet_ptr);
@@ -12,7 +12,9 @@
 #ifndef _RSDRIVER_H_
 #define _RSDRIVER_H_
 
+#include <atomic>
 #include <string>
+#include <vector>
 #include <ros/ros.h>
 #include <ros/package.h>
 #include <std_msgs/Int32.h>
@@ -23,10 +25,35 @@
 #include <pcl/point_types.h>
 #include <pcl_ros/impl/transforms.hpp>
 #include <pcl_conversions/pcl_conversions.h>
+#include <thread_config/thread_config.h>
 #include "input.h"
+#include "device_status.h"
+#include "packet_ring.h"
+#include "packet_stats.h"
+#include "scan_codec.h"
 
 namespace rslidar_driver
 {
+/** @brief Decoder of the msop packets of a scan as they arrive
+ *
+ *  Set on the driver, it is given each packet as soon as it is read, so that
+ *  the scan is decoded when its last packet comes in, instead of by a
+ *  subscriber of the published rslidarScan.
+ */
+class ScanDecoder
+{
+public:
+  virtual ~ScanDecoder()
+  {
+  }
+
+  /// a new scan, of npackets packets unless cut at an angle
+  virtual void beginScan(int npackets, const std::string& frame_id) = 0;
+  virtual void decodePacket(const rslidar_msgs::rslidarPacket& pkt) = 0;
+  /// the scan is complete, stamp is that of its last packet
+  virtual void endScan(const ros::Time& stamp) = 0;
+};
+
 class rslidarDriver
 {
 public:
@@ -37,18 +64,36 @@ public:
  */
   rslidarDriver(ros::NodeHandle node, ros::NodeHandle private_nh);
 
-  ~rslidarDriver()
-  {
-  }
+  ~rslidarDriver();
 
   bool poll(void);
   void difopPoll(void);
+  /** @brief decode the packets in the driver thread
+   *
+   *  @param decoder given the packets of each scan as they are read
+   *  @param publish_packets whether the rslidarScan is still published
+   */
+  void setDecoder(boost::shared_ptr<ScanDecoder> decoder, bool publish_packets);
+  /// Receiver thread main loop, reading the msop socket into the ring
+  void msopReceive(const thread_config::Settings& settings);
 
 private:
   /// Callback for dynamic reconfigure
   void callback(rslidar_driver::rslidarNodeConfig& config, uint32_t level);
   /// Callback for skip num for time synchronization
   void skipNumCallback(const std_msgs::Int32::ConstPtr& skip_num);
+  /// Next msop packet, of a batch read ahead when cutting at an angle
+  int nextPacket(rslidar_msgs::rslidarPacket* pkt);
+  /// Up to max msop packets, out of the ring with a receiver thread
+  int getPackets(rslidar_msgs::rslidarPacket* pkts, int max, int& received);
+  /// Diagnostics of the receiver ring
+  void receiverStatus(diagnostic_updater::DiagnosticStatusWrapper& stat);
+  /// Diagnostics of the threads, their CPUs and scheduling
+  void threadStatus(diagnostic_updater::DiagnosticStatusWrapper& stat);
+  /// Diagnostics of the packets, with packet_stats
+  void packetStatus(diagnostic_updater::DiagnosticStatusWrapper& stat);
+  /// a msop packet taken into the scan, for stats_
+  void countPacket(const rslidar_msgs::rslidarPacket& pkt, double now);
 
   /// Pointer to dynamic reconfigure service srv_
   boost::shared_ptr<dynamic_reconfigure::Server<rslidar_driver::rslidarNodeConfig> > srv_;
@@ -65,8 +110,22 @@ private:
   } config_;
 
   boost::shared_ptr<Input> msop_input_;
+  std::vector<rslidar_msgs::rslidarPacket> read_ahead_;  ///< of nextPacket, begin to end not taken yet
+  size_t read_ahead_begin_;
+  size_t read_ahead_end_;
+  boost::shared_ptr<PacketRing> msop_ring_;  ///< of the receiver thread, NULL without it
+  boost::shared_ptr<boost::thread> msop_thread_;
+  std::atomic<bool> receiving_;
+  uint64_t overflows_reported_;  ///< by receiverStatus
+  boost::shared_ptr<PacketStats> stats_;  ///< of the msop packets, NULL without packet_stats
+  boost::shared_ptr<ScanDecoder> decoder_;
+  bool publish_packets_;                     ///< rslidarScan published, always without decoder_
+  rslidar_msgs::rslidarPacket first_packet_;  ///< of the scan, for time synchronization when not published
   boost::shared_ptr<Input> difop_input_;
+  boost::shared_ptr<DeviceStatus> status_;  ///< of the difop packets, of difopPoll
   ros::Publisher msop_output_;
+  ros::Publisher compressed_output_;  ///< of the scans published, encoded when subscribed
+  ScanCodec codec_;
   ros::Publisher difop_output_;
   ros::Publisher output_sync_;
   // Converter convtor_;
@@ -76,6 +135,7 @@ private:
   double diag_max_freq_;
   boost::shared_ptr<diagnostic_updater::TopicDiagnostic> diag_topic_;
   boost::shared_ptr<boost::thread> difop_thread_;
+  ros::NodeHandle private_nh_;  ///< of the scheduling/ parameters
 
   // add for time synchronization
   bool time_synchronization_;
@@ -0,0 +1,117 @@
+/*
+ *	Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  The rslidarScan of a bag compressed by ScanCodec into another one, or
+ *  decompressed back with _decompress:=true, the other topics copied as
+ *  they are. Every scan compressed is decoded again and compared, so that
+ *  a bag is not replaced by one that does not replay the same, e.g.
+ *    rosrun rslidar_driver rslidar_compress in.bag out.bag _model:=RS32
+ *    rosrun rslidar_driver rslidar_compress out.bag in.bag _decompress:=true
+ *  The compressed bags replay through cloud_node, of input_compressed_topic.
+ */
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <cstdio>
+#include "scan_codec.h"
+
+using namespace rslidar_driver;
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "rslidar_compress", ros::init_options::AnonymousName);
+  if (argc < 3)
+  {
+    fprintf(stderr, "usage: %s <input bag> <output bag> [_model:=RS16] [_packets_topic:=rslidar_packets] "
+                    "[_compressed_topic:=rslidar_packets_compressed] [_decompress:=false]\n",
+            argv[0]);
+    return 1;
+  }
+  ros::NodeHandle private_nh("~");
+  std::string model, packets_topic, compressed_topic;
+  bool decompress;
+  private_nh.param("model", model, std::string("RS16"));
+  private_nh.param("packets_topic", packets_topic, std::string("rslidar_packets"));
+  private_nh.param("compressed_topic", compressed_topic, std::string("rslidar_packets_compressed"));
+  private_nh.param("decompress", decompress, false);
+  ScanCodec codec(ScanCodec::firingsPerBlock(model));
+
+  rosbag::Bag input(argv[1], rosbag::bagmode::Read);
+  rosbag::Bag output(argv[2], rosbag::bagmode::Write);
+  rosbag::View view(input);
+  const std::string& from = decompress ? compressed_topic : packets_topic;
+  const std::string& to = decompress ? packets_topic : compressed_topic;
+
+  rslidar_msgs::rslidarScan scan, decoded;
+  rslidar_msgs::rslidarCompressedScan compressed;
+  unsigned long scans = 0, failed = 0;
+  double raw_bytes = 0, compressed_bytes = 0, decode_time = 0;
+  for (rosbag::View::iterator it = view.begin(); it != view.end(); ++it)
+  {
+    // the topics of a bag are recorded with their namespace or not
+    std::string topic = it->getTopic();
+    if (topic != from && topic != "/" + from)
+    {
+      output.write(topic, it->getTime(), *it, it->getConnectionHeader());
+      continue;
+    }
+    std::string out_topic = topic[0] == '/' ? "/" + to : to;
+    ros::WallTime start;
+    if (decompress)
+    {
+      rslidar_msgs::rslidarCompressedScan::ConstPtr msg = it->instantiate<rslidar_msgs::rslidarCompressedScan>();
+      start = ros::WallTime::now();
+      if (!msg || !codec.decode(*msg, scan))
+      {
+        ++failed;
+        continue;
+      }
+      decode_time += (ros::WallTime::now() - start).toSec();
+      compressed_bytes += msg->data.size();
+      output.write(out_topic, it->getTime(), scan);
+    }
+    else
+    {
+      rslidar_msgs::rslidarScan::ConstPtr msg = it->instantiate<rslidar_msgs::rslidarScan>();
+      if (!msg)
+      {
+        ++failed;
+        continue;
+      }
+      codec.encode(*msg, compressed);
+      start = ros::WallTime::now();
+      bool same = codec.decode(compressed, decoded);
+      decode_time += (ros::WallTime::now() - start).toSec();
+      same = same && decoded.packets.size() == msg->packets.size();
+      for (size_t i = 0; same && i < msg->packets.size(); ++i)
+        same = decoded.packets[i].stamp == msg->packets[i].stamp && decoded.packets[i].data == msg->packets[i].data;
+      if (!same)
+      {
+        ROS_FATAL("[rslidar_compress] scan %lu of %s not decoded the same, %s not written", scans, argv[1], argv[2]);
+        output.close();
+        remove(argv[2]);
+        return 1;
+      }
+      compressed_bytes += compressed.data.size();
+      output.write(out_topic, it->getTime(), compressed);
+    }
+    raw_bytes += (decompress ? scan : decoded).packets.size() * sizeof(rslidar_msgs::rslidarPacket::_data_type);
+    ++scans;
+  }
+  output.close();
+  input.close();
+
+  if (failed > 0)
+    ROS_WARN("[rslidar_compress] %lu messages of %s not %s", failed, from.c_str(),
+             decompress ? "decoded" : "rslidarScan");
+  printf("[rslidar_compress] %lu scans, %.1f MB of packets, %.1f MB compressed (%.2fx), decoded at %.1f scans/s\n",
+         scans, raw_bytes / 1048576.0, compressed_bytes / 1048576.0,
+         compressed_bytes > 0 ? raw_bytes / compressed_bytes : 0.0, decode_time > 0 ? scans / decode_time : 0.0);
+  return 0;
+}
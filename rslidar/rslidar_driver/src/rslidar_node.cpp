@@ -31,6 +31,7 @@ int main(int argc, char** argv)
 
   // start the driver
   rslidar_driver::rslidarDriver dvr(node, private_nh);
+  thread_config::configure(private_nh, "poll");
   // loop until shut down or end of file
   while (ros::ok() && dvr.poll())
   {
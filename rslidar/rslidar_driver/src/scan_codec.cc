@@ -0,0 +1,438 @@
+/*
+ *	Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Lossless codec of the msop packets of a scan
+ */
+#include "scan_codec.h"
+#include <algorithm>
+#include <cstring>
+
+namespace rslidar_driver
+{
+namespace
+{
+const int PACKET_SIZE = 1248;
+const int HEADER_SIZE = 42;
+const int BLOCKS = 12;
+const int BLOCK_SIZE = 100;
+const int RETURNS = 32;                                   ///< of a block, 3 bytes each after its header and azimuth
+const int TAIL_OFFSET = HEADER_SIZE + BLOCKS * BLOCK_SIZE;  ///< of the 6 bytes of revolution and status
+const int SIDE_SIZE = HEADER_SIZE + PACKET_SIZE - TAIL_OFFSET;
+
+/** The data of a compressed scan: a StreamHeader, then the sections, each
+ *  prefixed with its uint32 size in bytes: the stamps of the packets as
+ *  varints, a byte per packet, 1 if kept as it is, the packets kept, and
+ *  the groups of the sides, the azimuths, the distances and the
+ *  intensities of the packets coded, c.f. encodeGroups.
+ */
+struct StreamHeader
+{
+  char magic[4];
+  uint8_t version;
+  uint8_t firings;
+  uint16_t reserved;
+  uint32_t packets;
+};
+
+const char STREAM_MAGIC[4] = { 'R', 'S', 'Z', '\n' };
+const uint8_t STREAM_VERSION = 1;
+
+inline uint16_t zigzag16(uint16_t residual)
+{
+  return (uint16_t)((residual << 1) ^ (0u - (residual >> 15)));
+}
+
+inline uint16_t unzigzag16(uint16_t z)
+{
+  return (uint16_t)((z >> 1) ^ (0u - (z & 1)));
+}
+
+inline uint16_t zigzag8(uint8_t residual)
+{
+  return (uint8_t)((residual << 1) ^ (0u - (residual >> 7)));
+}
+
+inline uint8_t unzigzag8(uint16_t z)
+{
+  return (uint8_t)((z >> 1) ^ (0u - (z & 1)));
+}
+
+/// the width of a group of the code of its nibble, 16 bits for 15
+inline int groupWidth(int code)
+{
+  return code < 15 ? code : 16;
+}
+
+/// 8 values of W bits from the W bytes of in, the first in the low bits
+template <int W>
+void unpack8(const uint8_t* in, uint16_t* out)
+{
+  uint64_t word[2] = { 0, 0 };
+  memcpy(word, in, W);
+  for (int i = 0; i < 8; ++i)
+  {
+    const int bit = i * W;
+    uint64_t v = word[bit >> 6] >> (bit & 63);
+    if ((bit & 63) + W > 64)
+      v |= word[(bit >> 6) + 1] << (64 - (bit & 63));
+    out[i] = (uint16_t)(v & ((1u << W) - 1));
+  }
+}
+
+template <>
+void unpack8<0>(const uint8_t*, uint16_t* out)
+{
+  memset(out, 0, 8 * sizeof(*out));
+}
+
+typedef void (*Unpack8)(const uint8_t* in, uint16_t* out);
+const Unpack8 UNPACK8[17] = { unpack8<0>,  unpack8<1>,  unpack8<2>,  unpack8<3>,  unpack8<4>,  unpack8<5>,
+                              unpack8<6>,  unpack8<7>,  unpack8<8>,  unpack8<9>,  unpack8<10>, unpack8<11>,
+                              unpack8<12>, unpack8<13>, unpack8<14>, unpack8<15>, unpack8<16> };
+
+void pack8(const uint16_t* v, int width, uint8_t* out)
+{
+  uint64_t word[2] = { 0, 0 };
+  for (int i = 0; i < 8; ++i)
+  {
+    const int bit = i * width;
+    word[bit >> 6] |= (uint64_t)v[i] << (bit & 63);
+    if ((bit & 63) + width > 64)
+      word[(bit >> 6) + 1] |= (uint64_t)v[i] >> (64 - (bit & 63));
+  }
+  memcpy(out, word, width);
+}
+
+void putSize(std::vector<uint8_t>& out, size_t at)
+{
+  uint32_t size = out.size() - at - sizeof(size);
+  memcpy(&out[at], &size, sizeof(size));
+}
+
+size_t beginSection(std::vector<uint8_t>& out)
+{
+  out.resize(out.size() + sizeof(uint32_t));
+  return out.size() - sizeof(uint32_t);
+}
+
+/** The values in groups of 8, the last one padded with zeros: the nibbles
+ *  of the widths of the groups, two per byte, the first in the low bits,
+ *  then the values of each group packed at its width, in as many bytes.
+ */
+void encodeGroups(std::vector<uint16_t>& values, std::vector<uint8_t>& out)
+{
+  size_t groups = (values.size() + 7) / 8;
+  values.resize(groups * 8, 0);
+  size_t widths = out.size();
+  out.resize(out.size() + (groups + 1) / 2, 0);
+  uint8_t packed[16];
+  for (size_t g = 0; g < groups; ++g)
+  {
+    const uint16_t* v = &values[g * 8];
+    unsigned all = 0;
+    for (int i = 0; i < 8; ++i)
+      all |= v[i];
+    int width = 0;
+    while (all >> width)
+      ++width;
+    int code = width < 15 ? width : 15;
+    out[widths + g / 2] |= code << (4 * (g & 1));
+    pack8(v, groupWidth(code), packed);
+    out.insert(out.end(), packed, packed + groupWidth(code));
+  }
+}
+
+/// n values of a section of encodeGroups into values, false if it is cut short or longer
+bool decodeGroups(const uint8_t* in, size_t size, size_t n, std::vector<uint16_t>& values)
+{
+  size_t groups = (n + 7) / 8;
+  values.resize(groups * 8);
+  const uint8_t* end = in + size;
+  const uint8_t* packed = in + (groups + 1) / 2;
+  if (packed > end)
+    return false;
+  for (size_t g = 0; g < groups; ++g)
+  {
+    int width = groupWidth((in[g / 2] >> (4 * (g & 1))) & 15);
+    if (end - packed < width)
+      return false;
+    UNPACK8[width](packed, &values[g * 8]);
+    packed += width;
+  }
+  return packed == end;
+}
+
+void putVarint(std::vector<uint8_t>& out, uint64_t v)
+{
+  while (v >= 0x80)
+  {
+    out.push_back((uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((uint8_t)v);
+}
+
+bool getVarint(const uint8_t*& in, const uint8_t* end, uint64_t& v)
+{
+  v = 0;
+  for (int shift = 0; in < end && shift < 64; shift += 7)
+  {
+    uint8_t byte = *in++;
+    v |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+/// the blocks of a packet are all msop blocks of a header 0xffee
+bool codedPacket(const uint8_t* data)
+{
+  for (int b = 0; b < BLOCKS; ++b)
+  {
+    const uint8_t* block = data + HEADER_SIZE + b * BLOCK_SIZE;
+    if (block[0] != 0xff || block[1] != 0xee)
+      return false;
+  }
+  return true;
+}
+
+/// the sections of a stream, each checked against its end
+struct Sections
+{
+  const uint8_t* p;
+  const uint8_t* end;
+
+  bool next(const uint8_t*& section, size_t& size)
+  {
+    uint32_t bytes;
+    if ((size_t)(end - p) < sizeof(bytes))
+      return false;
+    memcpy(&bytes, p, sizeof(bytes));
+    p += sizeof(bytes);
+    if ((size_t)(end - p) < bytes)
+      return false;
+    section = p;
+    size = bytes;
+    p += bytes;
+    return true;
+  }
+};
+}
+
+ScanCodec::ScanCodec(int firings_per_block) : firings_(firings_per_block == 2 ? 2 : 1)
+{
+}
+
+int ScanCodec::firingsPerBlock(const std::string& model)
+{
+  return model == "RS16" ? 2 : 1;
+}
+
+void ScanCodec::encode(const rslidar_msgs::rslidarScan& scan, rslidar_msgs::rslidarCompressedScan& out)
+{
+  out.header = scan.header;
+  out.packets = scan.packets.size();
+  std::vector<uint8_t>& data = out.data;
+  data.clear();
+
+  StreamHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, STREAM_MAGIC, sizeof(header.magic));
+  header.version = STREAM_VERSION;
+  header.firings = firings_;
+  header.packets = scan.packets.size();
+  data.insert(data.end(), (const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+
+  // the stamps, each predicted by the two previous ones
+  size_t at = beginSection(data);
+  int64_t t1 = 0, t2 = 0;
+  for (size_t i = 0; i < scan.packets.size(); ++i)
+  {
+    int64_t t = scan.packets[i].stamp.toNSec();
+    int64_t predicted = i == 0 ? 0 : (i == 1 ? t1 : 2 * t1 - t2);
+    uint64_t residual = (uint64_t)t - (uint64_t)predicted;
+    putVarint(data, (residual << 1) ^ (0 - (residual >> 63)));
+    t2 = t1;
+    t1 = t;
+  }
+  putSize(data, at);
+
+  at = beginSection(data);
+  for (size_t i = 0; i < scan.packets.size(); ++i)
+    data.push_back(codedPacket(&scan.packets[i].data[0]) ? 0 : 1);
+  putSize(data, at);
+
+  at = beginSection(data);
+  for (size_t i = 0; i < scan.packets.size(); ++i)
+  {
+    const uint8_t* d = &scan.packets[i].data[0];
+    if (!codedPacket(d))
+      data.insert(data.end(), d, d + PACKET_SIZE);
+  }
+  putSize(data, at);
+
+  sides_.clear();
+  azimuths_.clear();
+  distances_.clear();
+  intensities_.clear();
+  uint8_t side[SIDE_SIZE] = {};
+  uint16_t azimuth1 = 0, azimuth2 = 0;
+  size_t blocks = 0;
+  const int lasers = RETURNS / firings_;
+  uint16_t distance[RETURNS] = {};
+  uint8_t intensity[RETURNS] = {};
+  for (size_t i = 0; i < scan.packets.size(); ++i)
+  {
+    const uint8_t* d = &scan.packets[i].data[0];
+    if (!codedPacket(d))
+      continue;
+    for (int k = 0; k < SIDE_SIZE; ++k)
+    {
+      uint8_t byte = k < HEADER_SIZE ? d[k] : d[TAIL_OFFSET + k - HEADER_SIZE];
+      sides_.push_back(byte ^ side[k]);
+      side[k] = byte;
+    }
+    for (int b = 0; b < BLOCKS; ++b, ++blocks)
+    {
+      const uint8_t* block = d + HEADER_SIZE + b * BLOCK_SIZE;
+      uint16_t azimuth = (block[2] << 8) | block[3];
+      uint16_t predicted = blocks == 0 ? 0 : (blocks == 1 ? azimuth1 : 2 * azimuth1 - azimuth2);
+      azimuths_.push_back(zigzag16(azimuth - predicted));
+      azimuth2 = azimuth1;
+      azimuth1 = azimuth;
+      // a return predicted by the previous firing of its laser, of this block or the previous one
+      for (int s = 0; s < RETURNS; ++s)
+      {
+        const uint8_t* r = block + 4 + 3 * s;
+        int laser = s % lasers;
+        uint16_t value = (r[0] << 8) | r[1];
+        distances_.push_back(zigzag16(value - distance[laser]));
+        intensities_.push_back(zigzag8(r[2] - intensity[laser]));
+        distance[laser] = value;
+        intensity[laser] = r[2];
+      }
+    }
+  }
+
+  std::vector<uint16_t>* streams[] = { &sides_, &azimuths_, &distances_, &intensities_ };
+  for (size_t k = 0; k < sizeof(streams) / sizeof(streams[0]); ++k)
+  {
+    at = beginSection(data);
+    encodeGroups(*streams[k], data);
+    putSize(data, at);
+  }
+}
+
+bool ScanCodec::decode(const rslidar_msgs::rslidarCompressedScan& in, rslidar_msgs::rslidarScan& scan)
+{
+  StreamHeader header;
+  if (in.data.size() < sizeof(header))
+    return false;
+  memcpy(&header, in.data.data(), sizeof(header));
+  if (memcmp(header.magic, STREAM_MAGIC, sizeof(header.magic)) != 0 || header.version != STREAM_VERSION ||
+      (header.firings != 1 && header.firings != 2))
+    return false;
+  Sections sections = { in.data.data() + sizeof(header), in.data.data() + in.data.size() };
+  const uint8_t *stamps, *kinds, *raw;
+  size_t stamps_size, kinds_size, raw_size;
+  if (!sections.next(stamps, stamps_size) || !sections.next(kinds, kinds_size) || !sections.next(raw, raw_size) ||
+      kinds_size != header.packets)
+    return false;
+  size_t coded = std::count(kinds, kinds + kinds_size, 0);
+  if (raw_size != (header.packets - coded) * PACKET_SIZE)
+    return false;
+
+  const size_t counts[] = { coded * SIDE_SIZE, coded * BLOCKS, coded * BLOCKS * RETURNS, coded * BLOCKS * RETURNS };
+  std::vector<uint16_t>* streams[] = { &sides_, &azimuths_, &distances_, &intensities_ };
+  for (size_t k = 0; k < sizeof(streams) / sizeof(streams[0]); ++k)
+  {
+    const uint8_t* section;
+    size_t size;
+    if (!sections.next(section, size) || !decodeGroups(section, size, counts[k], *streams[k]))
+      return false;
+  }
+  if (sections.p != sections.end)
+    return false;
+
+  scan.header = in.header;
+  scan.packets.resize(header.packets);
+  const uint8_t* stamps_end = stamps + stamps_size;
+  int64_t t1 = 0, t2 = 0;
+  for (size_t i = 0; i < scan.packets.size(); ++i)
+  {
+    uint64_t z;
+    if (!getVarint(stamps, stamps_end, z))
+      return false;
+    int64_t predicted = i == 0 ? 0 : (i == 1 ? t1 : 2 * t1 - t2);
+    int64_t t = (int64_t)((uint64_t)predicted + ((z >> 1) ^ (0 - (z & 1))));
+    scan.packets[i].stamp.fromNSec(t);
+    t2 = t1;
+    t1 = t;
+  }
+  if (stamps != stamps_end)
+    return false;
+
+  uint8_t side[SIDE_SIZE] = {};
+  uint16_t azimuth1 = 0, azimuth2 = 0;
+  size_t blocks = 0;
+  const int firings = header.firings;
+  const int lasers = RETURNS / firings;
+  uint16_t distance[RETURNS] = {};
+  uint8_t intensity[RETURNS] = {};
+  const uint16_t* sides = sides_.data();
+  const uint16_t* azimuths = azimuths_.data();
+  const uint16_t* distances = distances_.data();
+  const uint16_t* intensities = intensities_.data();
+  for (size_t i = 0; i < scan.packets.size(); ++i)
+  {
+    uint8_t* d = &scan.packets[i].data[0];
+    if (kinds[i] != 0)
+    {
+      memcpy(d, raw, PACKET_SIZE);
+      raw += PACKET_SIZE;
+      continue;
+    }
+    for (int k = 0; k < SIDE_SIZE; ++k)
+      side[k] ^= (uint8_t)sides[k];
+    sides += SIDE_SIZE;
+    memcpy(d, side, HEADER_SIZE);
+    memcpy(d + TAIL_OFFSET, side + HEADER_SIZE, SIDE_SIZE - HEADER_SIZE);
+    for (int b = 0; b < BLOCKS; ++b, ++blocks)
+    {
+      uint8_t* block = d + HEADER_SIZE + b * BLOCK_SIZE;
+      uint16_t predicted = blocks == 0 ? 0 : (blocks == 1 ? azimuth1 : 2 * azimuth1 - azimuth2);
+      uint16_t azimuth = predicted + unzigzag16(*azimuths++);
+      azimuth2 = azimuth1;
+      azimuth1 = azimuth;
+      block[0] = 0xff;
+      block[1] = 0xee;
+      block[2] = azimuth >> 8;
+      block[3] = azimuth & 0xff;
+      // the lasers of a firing at once, c.f. encode
+      for (int f = 0; f < firings; ++f, distances += lasers, intensities += lasers)
+      {
+        for (int l = 0; l < lasers; ++l)
+        {
+          distance[l] = distance[l] + unzigzag16(distances[l]);
+          intensity[l] = intensity[l] + unzigzag8(intensities[l]);
+        }
+        uint8_t* r = block + 4 + 3 * f * lasers;
+        for (int l = 0; l < lasers; ++l, r += 3)
+        {
+          r[0] = distance[l] >> 8;
+          r[1] = distance[l] & 0xff;
+          r[2] = intensity[l];
+        }
+      }
+    }
+  }
+  return true;
+}
+}
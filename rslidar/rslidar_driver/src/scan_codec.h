@@ -0,0 +1,74 @@
+/*
+ *	Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+ *
+ *  Lossless codec of the msop packets of a scan, for recording and replay.
+ *
+ *  The 32 returns of the blocks of the packets are the columns of a range
+ *  image of a row per channel, in the order RawData decodes them: the 16
+ *  lasers of the RS16 twice per block, one firing after the other, the 32
+ *  of the RS32 and the Bpearl once. The raw distance and intensity of a
+ *  return are predicted by those of the previous firing of its laser, the
+ *  azimuth of a block by the two previous ones, the header and the tail of
+ *  a packet by those of the previous one; the residuals are zigzag coded and
+ *  bit packed by groups of 8, at the width of the largest of the group.
+ *  Decoding is a fixed-width unpacking per group and a sum per firing of
+ *  all its lasers at once, with no branch on the data.
+ *
+ *  The packets decoded are those encoded, byte for byte, with their stamps,
+ *  so that the scans decode to the same clouds. The packets of another
+ *  layout, whose blocks are not all msop blocks, are kept as they are.
+ *  The encoding is of the byte order of the host.
+ */
+
+#ifndef __RSLIDAR_SCAN_CODEC_H_
+#define __RSLIDAR_SCAN_CODEC_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <rslidar_msgs/rslidarScan.h>
+#include <rslidar_msgs/rslidarCompressedScan.h>
+
+namespace rslidar_driver
+{
+class ScanCodec
+{
+public:
+  /** @brief constructor
+   *
+   *  @param firings_per_block firings of each laser in a block, of the
+   *         encoding, c.f. firingsPerBlock; the decoding reads its own
+   */
+  explicit ScanCodec(int firings_per_block = 1);
+
+  /// 2 for the RS16, 1 for the other models
+  static int firingsPerBlock(const std::string& model);
+
+  /// the packets of scan into the data of out, its header that of scan
+  void encode(const rslidar_msgs::rslidarScan& scan, rslidar_msgs::rslidarCompressedScan& out);
+
+  /** @brief the packets of in into scan, its packets resized
+   *
+   *  @returns false if the data is not of this codec or cut short, scan
+   *           unspecified
+   */
+  bool decode(const rslidar_msgs::rslidarCompressedScan& in, rslidar_msgs::rslidarScan& scan);
+
+private:
+  int firings_;
+
+  // reused from scan to scan
+  std::vector<uint16_t> distances_;  ///< residuals of the returns, of the coded packets
+  std::vector<uint16_t> intensities_;
+  std::vector<uint16_t> azimuths_;  ///< residuals of the blocks
+  std::vector<uint16_t> sides_;     ///< of the headers and tails
+};
+}
+
+#endif  // __RSLIDAR_SCAN_CODEC_H_
@@ -0,0 +1,328 @@
+/*
+ *  Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class decodes the raw Robosense 3D LIDAR packets in the driver,
+    as they arrive, straight into the PointCloud2 of the scan.
+
+    The data of the PointCloud2 has the layout of the points of a
+    pcl::PointCloud<pcl::PointXYZI>, so RawData unpacks into it as into a
+    PCL cloud, and the result is that of Convert without its copies into
+    the scan message, the PCL cloud and the PointCloud2.
+
+    With sector_packets set, every sector of that many packets is also
+    published as it is decoded, as a cloud of its columns, so that the
+    processing downstream starts before the revolution is over.
+
+    With compact set, RawData appends the points in the crop only to the
+    data, and the clouds are a row of them, of no range image.
+
+*/
+#include "cloud_decoder.h"
+#include <algorithm>
+#include <point_cloud_pool/point_cloud_pool.h>
+
+namespace rslidar_pointcloud
+{
+/** @brief Constructor. */
+CloudDecoder::CloudDecoder(ros::NodeHandle node, ros::NodeHandle private_nh)
+  : data_(new rslidar_rawdata::RawData())
+  , layout_(private_nh)
+  , deskew_(node, private_nh)
+  , capacity_(0)
+  , packets_(0)
+  , sector_packets_decoded_(0)
+  , sector_column_(0)
+{
+  data_->loadConfigFile(node, private_nh);  // load lidar parameters
+  std::string model;
+  private_nh.param("model", model, std::string("RS16"));
+  if (model == "RS16")
+  {
+    height_ = 16;
+    columns_per_block_ = 2;
+  }
+  else  // RS32, RSBPEARL and RSBPEARL_MINI
+  {
+    height_ = 32;
+    columns_per_block_ = 1;
+  }
+
+  std::string output_points_topic;
+  private_nh.param("output_points_topic", output_points_topic, std::string("rslidar_points"));
+  output_ = node.advertise<sensor_msgs::PointCloud2>(output_points_topic, 10);
+  std::string output_range_image_topic;
+  private_nh.param("output_range_image_topic", output_range_image_topic, std::string("rslidar_range_image"));
+  range_image_output_ = node.advertise<sensor_msgs::PointCloud2>(output_range_image_topic, 10);
+
+  private_nh.param("sector_packets", sector_packets_, 0);
+  if (sector_packets_ > 0)
+  {
+    std::string output_sectors_topic;
+    private_nh.param("output_sectors_topic", output_sectors_topic, std::string("rslidar_sectors"));
+    sector_output_ = node.advertise<sensor_msgs::PointCloud2>(output_sectors_topic, 100);
+    ROS_INFO_STREAM("[cloud][decoder] publishing sectors of " << sector_packets_ << " packets");
+  }
+
+  private_nh.param("compact", compact_, false);
+  if (compact_ && (layout_.timed() || deskew_.enabled()))
+  {
+    ROS_ERROR_STREAM("[cloud][decoder] compact clouds have no columns to time nor to deskew, publishing them "
+                     "organized");
+    compact_ = false;
+  }
+  else if (compact_)
+  {
+    ROS_INFO_STREAM("[cloud][decoder] publishing compact clouds, of the points in the crop only");
+  }
+}
+
+void CloudDecoder::beginScan(int npackets, const std::string& frame_id)
+{
+  frame_id_ = frame_id;
+  // the cloud of the last scan is reused once its subscribers are done with it
+  if (!cloud_ || !cloud_.unique())
+  {
+    cloud_.reset(new sensor_msgs::PointCloud2);
+    capacity_ = 0;
+  }
+  packets_ = 0;
+  sector_packets_decoded_ = 0;
+  sector_column_ = 0;
+  column_stamp_.clear();
+  data_->block_num = 0;
+  data_->compact_size = 0;
+  if (compact_)
+  {
+    cloud_->data.resize((size_t)npackets * rslidar_rawdata::SCANS_PER_PACKET * sizeof(pcl::PointXYZI));
+    return;
+  }
+  reserve(npackets * rslidar_rawdata::BLOCKS_PER_PACKET * columns_per_block_);
+}
+
+void CloudDecoder::decodePacket(const rslidar_msgs::rslidarPacket& pkt)
+{
+  if (compact_)
+  {
+    size_t size = (size_t)(data_->compact_size + rslidar_rawdata::SCANS_PER_PACKET) * sizeof(pcl::PointXYZI);
+    if (size > cloud_->data.size())
+    {
+      cloud_->data.resize(size + size / 8);
+    }
+    data_->unpackCompact(pkt, points());
+    ++packets_;
+    if (sector_packets_ > 0 && ++sector_packets_decoded_ == sector_packets_)
+    {
+      publishSector(pkt.stamp);
+    }
+    return;
+  }
+
+  // more packets than expected when cut at an angle
+  int columns = (packets_ + 1) * rslidar_rawdata::BLOCKS_PER_PACKET * columns_per_block_;
+  if (columns > capacity_)
+  {
+    reserve(columns + columns / 8);
+  }
+  data_->unpack(pkt, points(), capacity_);
+  if (layout_.timed() || deskew_.enabled())
+  {
+    // the columns of the packet fired one every column_duration before it was stamped
+    double column_duration = 1e-6 * (height_ == 16 ? rslidar_rawdata::RS16_FIRING_TOFFSET
+                                                   : rslidar_rawdata::RS32_BLOCK_TDURATION);
+    int begin = column_stamp_.size();
+    int end = data_->block_num * columns_per_block_;
+    column_stamp_.resize(end);
+    for (int col = begin; col < end; ++col)
+    {
+      column_stamp_[col] = pkt.stamp - ros::Duration((end - 1 - col) * column_duration);
+    }
+  }
+  ++packets_;
+  if (sector_packets_ > 0 && ++sector_packets_decoded_ == sector_packets_)
+  {
+    publishSector(pkt.stamp);
+  }
+}
+
+void CloudDecoder::endScan(const ros::Time& stamp)
+{
+  if (sector_packets_decoded_ > 0)
+  {
+    publishSector(stamp);  // the last one, short
+  }
+  if (compact_)
+  {
+    endCompactScan(stamp);
+    return;
+  }
+
+  int width = packets_ * rslidar_rawdata::BLOCKS_PER_PACKET * columns_per_block_;
+  reserve(width);
+  pcl::PointXYZI* p = points();
+
+  // the columns of the packets not unpacked as the points of a new PCL cloud,
+  // then the rows packed to the width of the scan
+  int unpacked = data_->block_num * columns_per_block_;
+  for (int row = 0; row < height_; ++row)
+  {
+    std::fill(p + row * capacity_ + unpacked, p + row * capacity_ + width, pcl::PointXYZI());
+    if (row > 0 && width < capacity_)
+    {
+      memmove(p + row * width, p + row * capacity_, width * sizeof(pcl::PointXYZI));
+    }
+  }
+  capacity_ = width;
+  cloud_->data.resize((size_t)height_ * width * sizeof(pcl::PointXYZI));
+
+  if (deskew_.enabled())
+  {
+    int deskewed = std::min((int)column_stamp_.size(), width);
+    column_time_.resize(deskewed);
+    for (int col = 0; col < deskewed; ++col)
+    {
+      column_time_[col] = (column_stamp_[col] - stamp).toSec();
+    }
+    deskew_.deskew(p, width, height_, deskewed, column_time_.data(), stamp, frame_id_);
+  }
+
+  if (range_image_output_.getNumSubscribers() > 0)
+  {
+    sensor_msgs::PointCloud2::Ptr image = point_cloud_pool::acquire(layout_.rangeImageBytes(height_, width));
+    image->header.stamp.fromNSec(stamp.toNSec() / 1000ull * 1000ull);
+    image->header.frame_id = frame_id_;
+    layout_.setRangeImage(*image, height_, width);
+    layout_.writeRangeImage(p, width, *image);
+    range_image_output_.publish(image);
+  }
+  if (scan_callback_)
+  {
+    scan_callback_(p, width, height_, width, stamp, frame_id_);
+  }
+
+  // published as a shared pointer, so nodelets in the same manager get it without serialization
+  if (layout_.format() != CloudLayout::XYZI)
+  {
+    output_.publish(convert(0, width, stamp));
+    return;
+  }
+  // the stamp in microseconds, as through the PCL header
+  cloud_->header.stamp.fromNSec(stamp.toNSec() / 1000ull * 1000ull);
+  setLayout(*cloud_, height_, width);
+  output_.publish(cloud_);
+}
+
+void CloudDecoder::endCompactScan(const ros::Time& stamp)
+{
+  int size = data_->compact_size;
+  cloud_->data.resize((size_t)size * sizeof(pcl::PointXYZI));
+  if (scan_callback_)
+  {
+    scan_callback_(points(), size, 1, size, stamp, frame_id_);
+  }
+
+  if (layout_.format() != CloudLayout::XYZI)
+  {
+    output_.publish(convert(0, size, stamp));
+    return;
+  }
+  cloud_->header.stamp.fromNSec(stamp.toNSec() / 1000ull * 1000ull);
+  setLayout(*cloud_, 1, size);
+  output_.publish(cloud_);
+}
+
+void CloudDecoder::publishSector(const ros::Time& stamp)
+{
+  // the columns unpacked, fewer than those of the packets if some were not
+  int end = compact_ ? data_->compact_size : data_->block_num * columns_per_block_;
+  int height = compact_ ? 1 : height_;
+  int width = end - sector_column_;
+  if (width > 0 && sector_output_.getNumSubscribers() > 0 && layout_.format() != CloudLayout::XYZI)
+  {
+    sector_output_.publish(convert(sector_column_, end, stamp));
+  }
+  else if (width > 0 && sector_output_.getNumSubscribers() > 0)
+  {
+    sensor_msgs::PointCloud2::Ptr sector = point_cloud_pool::acquire((size_t)height * width * sizeof(pcl::PointXYZI));
+    sector->header.stamp.fromNSec(stamp.toNSec() / 1000ull * 1000ull);
+    setLayout(*sector, height, width);
+    sector->data.resize((size_t)height * width * sizeof(pcl::PointXYZI));
+    const pcl::PointXYZI* p = points();
+    pcl::PointXYZI* q = reinterpret_cast<pcl::PointXYZI*>(&sector->data[0]);
+    for (int row = 0; row < height; ++row)
+    {
+      std::copy(p + row * capacity_ + sector_column_, p + row * capacity_ + end, q + row * width);
+    }
+    sector_output_.publish(sector);
+  }
+  sector_column_ = end;
+  sector_packets_decoded_ = 0;
+}
+
+sensor_msgs::PointCloud2::Ptr CloudDecoder::convert(int first, int last, const ros::Time& stamp)
+{
+  // the times of the columns relative to the stamp, 0 for those not decoded
+  column_time_.assign(last - first, 0.0f);
+  for (int col = first; col < last && col < (int)column_stamp_.size(); ++col)
+  {
+    column_time_[col - first] = (column_stamp_[col] - stamp).toSec();
+  }
+
+  sensor_msgs::PointCloud2::Ptr cloud = point_cloud_pool::acquire(layout_.bytes(compact_ ? 1 : height_, last - first));
+  cloud->header.stamp.fromNSec(stamp.toNSec() / 1000ull * 1000ull);
+  cloud->header.frame_id = frame_id_;
+  layout_.setLayout(*cloud, compact_ ? 1 : height_, last - first);
+  layout_.write(points() + first, capacity_, column_time_.data(), *cloud);
+  cloud->is_dense = compact_;
+  return cloud;
+}
+
+void CloudDecoder::setLayout(sensor_msgs::PointCloud2& cloud, int height, int width)
+{
+  cloud.header.frame_id = frame_id_;
+  cloud.height = height;
+  cloud.width = width;
+  if (cloud.fields.empty())
+  {
+    const char* names[] = { "x", "y", "z", "intensity" };
+    const uint32_t offsets[] = { pcl::traits::offset<pcl::PointXYZI, pcl::fields::x>::value,
+                                 pcl::traits::offset<pcl::PointXYZI, pcl::fields::y>::value,
+                                 pcl::traits::offset<pcl::PointXYZI, pcl::fields::z>::value,
+                                 pcl::traits::offset<pcl::PointXYZI, pcl::fields::intensity>::value };
+    cloud.fields.resize(4);
+    for (int i = 0; i < 4; ++i)
+    {
+      cloud.fields[i].name = names[i];
+      cloud.fields[i].offset = offsets[i];
+      cloud.fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+      cloud.fields[i].count = 1;
+    }
+  }
+  cloud.is_bigendian = false;
+  cloud.point_step = sizeof(pcl::PointXYZI);
+  cloud.row_step = cloud.point_step * width;
+  cloud.is_dense = compact_;
+}
+
+/** the rows of the cloud spaced for columns points, those unpacked moved */
+void CloudDecoder::reserve(int columns)
+{
+  if (columns <= capacity_)
+  {
+    return;
+  }
+  int unpacked = std::min(data_->block_num * columns_per_block_, capacity_);
+  cloud_->data.resize((size_t)height_ * columns * sizeof(pcl::PointXYZI));
+  pcl::PointXYZI* p = points();
+  for (int row = height_ - 1; row > 0 && unpacked > 0; --row)
+  {
+    memmove(p + row * columns, p + row * capacity_, unpacked * sizeof(pcl::PointXYZI));
+  }
+  capacity_ = columns;
+}
+}  // namespace rslidar_pointcloud
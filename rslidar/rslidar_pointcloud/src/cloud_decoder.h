@@ -0,0 +1,101 @@
+/*
+ *  Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class decodes the raw Robosense 3D LIDAR packets in the driver,
+    as they arrive, straight into the PointCloud2 of the scan, optionally
+    publishing the sectors of the scan as they are decoded.
+
+    With compact set, as Convert, the clouds of the scans and of the
+    sectors are those of the points in the crop only, unorganized.
+
+*/
+#ifndef _CLOUD_DECODER_H_
+#define _CLOUD_DECODER_H_
+
+#include <boost/function.hpp>
+#include <sensor_msgs/PointCloud2.h>
+#include <rsdriver.h>
+#include "rawdata.h"
+#include "cloud_layout.h"
+#include "deskew.h"
+
+namespace rslidar_pointcloud
+{
+class CloudDecoder : public rslidar_driver::ScanDecoder
+{
+public:
+  CloudDecoder(ros::NodeHandle node, ros::NodeHandle private_nh);
+
+  virtual void beginScan(int npackets, const std::string& frame_id);
+  virtual void decodePacket(const rslidar_msgs::rslidarPacket& pkt);
+  virtual void endScan(const ros::Time& stamp);
+
+  /// the calibration of a difop packet, for a decoder its driver does not publish them to, parsed by the
+  /// device status thread of RawData
+  void decodeDifop(const rslidar_msgs::rslidarPacket::ConstPtr& pkt)
+  {
+    data_->postDifop(pkt);
+  }
+
+  /** @brief called with the points of each scan, once decoded and deskewed
+   *
+   *  @param points the rows of the organized cloud, of PointXYZI, NaN where no return,
+   *         or the row of the points in the crop if compact
+   *  @param stride number of points from a row of points to the next
+   */
+  typedef boost::function<void(const pcl::PointXYZI* points, int stride, int height, int width,
+                               const ros::Time& stamp, const std::string& frame_id)>
+      ScanCallback;
+  void setScanCallback(const ScanCallback& callback)
+  {
+    scan_callback_ = callback;
+  }
+
+private:
+  /// the columns decoded since the last sector, as a cloud of their own
+  void publishSector(const ros::Time& stamp);
+  /// the points of the scan in the crop, as a cloud of one row
+  void endCompactScan(const ros::Time& stamp);
+  /// the header but the stamp, the fields and the sizes of a cloud of height rows of width columns
+  void setLayout(sensor_msgs::PointCloud2& cloud, int height, int width);
+  /// the cloud of the columns [first, last) of the decoded points, in the layout of output_format, of
+  /// point_cloud_pool; of the points [first, last) if compact
+  sensor_msgs::PointCloud2::Ptr convert(int first, int last, const ros::Time& stamp);
+  /// points in a row of the cloud as it is decoded, at least columns
+  void reserve(int columns);
+  pcl::PointXYZI* points(void)
+  {
+    return reinterpret_cast<pcl::PointXYZI*>(cloud_->data.data());
+  }
+
+  boost::shared_ptr<rslidar_rawdata::RawData> data_;
+  CloudLayout layout_;  ///< of the published clouds, those but xyzi converted from cloud_
+  Deskewer deskew_;     ///< of the scans, not of the sectors published before their end
+  ros::Publisher output_;
+  ros::Publisher sector_output_;
+  ros::Publisher range_image_output_;
+  int sector_packets_;  ///< packets of a sector, none published if 0
+  bool compact_;        ///< the clouds unorganized, of the points in the crop only
+  sensor_msgs::PointCloud2::Ptr cloud_;  ///< of the scan, of the last one if not taken by a subscriber
+  int height_;
+  int columns_per_block_;
+  int capacity_;  ///< points in a row of cloud_
+  int packets_;   ///< of the scan
+  int sector_packets_decoded_;
+  int sector_column_;  ///< of the sector being decoded, its first point if compact
+  std::vector<ros::Time> column_stamp_;  ///< of the firings of the decoded columns, if timed or deskewed
+  std::vector<float> column_time_;
+  std::string frame_id_;
+  ScanCallback scan_callback_;
+
+  // the messages published but cloud_ are of point_cloud_pool, reused once released
+};
+
+}  // namespace rslidar_pointcloud
+#endif
@@ -0,0 +1,255 @@
+/*
+ *  Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class writes the points decoded by RawData straight into the
+    PointCloud2 of the configured layout, without pcl::toROSMsg, and
+    into their range image.
+
+*/
+#include "cloud_layout.h"
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <cstring>
+
+namespace rslidar_pointcloud
+{
+namespace
+{
+// the points of the layouts but xyzi, copied into the data of the clouds
+struct PointXYZ
+{
+  float x, y, z;
+};
+
+struct PointXYZRT
+{
+  float x, y, z;
+  uint16_t ring;
+  uint16_t padding;
+  float time;
+};
+
+struct PointXYZ16
+{
+  int16_t x, y, z;
+};
+
+struct RangeImagePixel
+{
+  uint16_t range;
+  uint8_t intensity;
+  uint8_t padding;
+};
+
+int16_t toFixedPoint(float v, float resolution)
+{
+  if (std::isnan(v))
+  {
+    return CloudLayout::INVALID_FIXED_POINT;
+  }
+  long fixed = std::lround(v / resolution);
+  return (int16_t)std::max(std::min(fixed, 32767L), -32767L);
+}
+
+void addField(sensor_msgs::PointCloud2& cloud, const std::string& name, uint32_t offset, uint8_t datatype)
+{
+  sensor_msgs::PointField field;
+  field.name = name;
+  field.offset = offset;
+  field.datatype = datatype;
+  field.count = 1;
+  cloud.fields.push_back(field);
+}
+}
+
+CloudLayout::CloudLayout(ros::NodeHandle private_nh)
+{
+  std::string output_format;
+  private_nh.param("output_format", output_format, std::string("xyzi"));
+  private_nh.param("fixed_point_resolution", fixed_point_resolution_, 0.01f);
+  private_nh.param("range_resolution", range_resolution_, 0.005f);
+  if (!(range_resolution_ > 0.0f))
+  {
+    ROS_WARN_STREAM("[cloud][layout] range_resolution " << range_resolution_ << " ignored, 0.005 m used");
+    range_resolution_ = 0.005f;
+  }
+  if (output_format == "xyz")
+  {
+    format_ = XYZ;
+  }
+  else if (output_format == "xyzrt")
+  {
+    format_ = XYZRT;
+  }
+  else if (output_format == "xyz16")
+  {
+    format_ = XYZ16;
+    if (!(fixed_point_resolution_ > 0.0f))
+    {
+      ROS_WARN_STREAM("[cloud][layout] fixed_point_resolution " << fixed_point_resolution_ << " ignored, 0.01 m used");
+      fixed_point_resolution_ = 0.01f;
+    }
+  }
+  else
+  {
+    if (output_format != "xyzi")
+    {
+      ROS_WARN_STREAM("[cloud][layout] unknown output_format " << output_format << ", xyzi used");
+    }
+    format_ = XYZI;
+  }
+  ROS_INFO_STREAM("[cloud][layout] output format: " << output_format);
+}
+
+size_t CloudLayout::bytes(int height, int width) const
+{
+  size_t points = (size_t)std::max(height, 0) * std::max(width, 0);
+  switch (format_)
+  {
+    case XYZ:
+      return points * sizeof(PointXYZ);
+    case XYZRT:
+      return points * sizeof(PointXYZRT);
+    case XYZ16:
+      return points * sizeof(PointXYZ16);
+    default:
+      return points * sizeof(pcl::PointXYZI);
+  }
+}
+
+void CloudLayout::setLayout(sensor_msgs::PointCloud2& cloud, int height, int width) const
+{
+  cloud.height = height;
+  cloud.width = width;
+  if (cloud.fields.empty())
+  {
+    switch (format_)
+    {
+      case XYZI:
+        addField(cloud, "x", pcl::traits::offset<pcl::PointXYZI, pcl::fields::x>::value,
+                 sensor_msgs::PointField::FLOAT32);
+        addField(cloud, "y", pcl::traits::offset<pcl::PointXYZI, pcl::fields::y>::value,
+                 sensor_msgs::PointField::FLOAT32);
+        addField(cloud, "z", pcl::traits::offset<pcl::PointXYZI, pcl::fields::z>::value,
+                 sensor_msgs::PointField::FLOAT32);
+        addField(cloud, "intensity", pcl::traits::offset<pcl::PointXYZI, pcl::fields::intensity>::value,
+                 sensor_msgs::PointField::FLOAT32);
+        cloud.point_step = sizeof(pcl::PointXYZI);
+        break;
+      case XYZ:
+        addField(cloud, "x", offsetof(PointXYZ, x), sensor_msgs::PointField::FLOAT32);
+        addField(cloud, "y", offsetof(PointXYZ, y), sensor_msgs::PointField::FLOAT32);
+        addField(cloud, "z", offsetof(PointXYZ, z), sensor_msgs::PointField::FLOAT32);
+        cloud.point_step = sizeof(PointXYZ);
+        break;
+      case XYZRT:
+        addField(cloud, "x", offsetof(PointXYZRT, x), sensor_msgs::PointField::FLOAT32);
+        addField(cloud, "y", offsetof(PointXYZRT, y), sensor_msgs::PointField::FLOAT32);
+        addField(cloud, "z", offsetof(PointXYZRT, z), sensor_msgs::PointField::FLOAT32);
+        addField(cloud, "ring", offsetof(PointXYZRT, ring), sensor_msgs::PointField::UINT16);
+        addField(cloud, "time", offsetof(PointXYZRT, time), sensor_msgs::PointField::FLOAT32);
+        cloud.point_step = sizeof(PointXYZRT);
+        break;
+      case XYZ16:
+        addField(cloud, "x", offsetof(PointXYZ16, x), sensor_msgs::PointField::INT16);
+        addField(cloud, "y", offsetof(PointXYZ16, y), sensor_msgs::PointField::INT16);
+        addField(cloud, "z", offsetof(PointXYZ16, z), sensor_msgs::PointField::INT16);
+        cloud.point_step = sizeof(PointXYZ16);
+        break;
+    }
+  }
+  cloud.is_bigendian = false;
+  cloud.row_step = cloud.point_step * width;
+  cloud.is_dense = false;
+  cloud.data.resize((size_t)cloud.row_step * height);
+}
+
+void CloudLayout::write(const pcl::PointXYZI* points, int stride, const float* column_time,
+                        sensor_msgs::PointCloud2& cloud) const
+{
+  const int width = cloud.width;
+  for (uint32_t row = 0; row < cloud.height; ++row)
+  {
+    const pcl::PointXYZI* p = points + row * stride;
+    uint8_t* out = &cloud.data[row * cloud.row_step];
+    switch (format_)
+    {
+      case XYZI:
+        memcpy(out, p, cloud.row_step);
+        break;
+      case XYZ:
+        for (int col = 0; col < width; ++col)
+        {
+          PointXYZ q = { p[col].x, p[col].y, p[col].z };
+          memcpy(out + col * sizeof(q), &q, sizeof(q));
+        }
+        break;
+      case XYZRT:
+        for (int col = 0; col < width; ++col)
+        {
+          PointXYZRT q = { p[col].x, p[col].y, p[col].z, (uint16_t)row, 0, column_time[col] };
+          memcpy(out + col * sizeof(q), &q, sizeof(q));
+        }
+        break;
+      case XYZ16:
+        for (int col = 0; col < width; ++col)
+        {
+          PointXYZ16 q = { toFixedPoint(p[col].x, fixed_point_resolution_),
+                           toFixedPoint(p[col].y, fixed_point_resolution_),
+                           toFixedPoint(p[col].z, fixed_point_resolution_) };
+          memcpy(out + col * sizeof(q), &q, sizeof(q));
+        }
+        break;
+    }
+  }
+}
+size_t CloudLayout::rangeImageBytes(int height, int width) const
+{
+  return (size_t)std::max(height, 0) * std::max(width, 0) * sizeof(RangeImagePixel);
+}
+
+void CloudLayout::setRangeImage(sensor_msgs::PointCloud2& image, int height, int width) const
+{
+  image.height = height;
+  image.width = width;
+  if (image.fields.empty())
+  {
+    addField(image, "range", offsetof(RangeImagePixel, range), sensor_msgs::PointField::UINT16);
+    addField(image, "intensity", offsetof(RangeImagePixel, intensity), sensor_msgs::PointField::UINT8);
+    image.point_step = sizeof(RangeImagePixel);
+  }
+  image.is_bigendian = false;
+  image.row_step = image.point_step * width;
+  image.is_dense = false;
+  image.data.resize((size_t)image.row_step * height);
+}
+
+void CloudLayout::writeRangeImage(const pcl::PointXYZI* points, int stride, sensor_msgs::PointCloud2& image) const
+{
+  const int width = image.width;
+  const float units = 1.0f / range_resolution_;
+  for (uint32_t row = 0; row < image.height; ++row)
+  {
+    const pcl::PointXYZI* p = points + row * stride;
+    uint8_t* out = &image.data[row * image.row_step];
+    for (int col = 0; col < width; ++col)
+    {
+      RangeImagePixel q = { 0, 0, 0 };
+      if (!std::isnan(p[col].x))
+      {
+        float range = std::sqrt(p[col].x * p[col].x + p[col].y * p[col].y + p[col].z * p[col].z) * units;
+        q.range = (uint16_t)std::min(std::lround(range), 65535L);
+        q.intensity = (uint8_t)std::max(std::min(std::lround(p[col].intensity), 255L), 0L);
+      }
+      memcpy(out + col * sizeof(q), &q, sizeof(q));
+    }
+  }
+}
+}  // namespace rslidar_pointcloud
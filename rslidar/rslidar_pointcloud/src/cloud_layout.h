@@ -0,0 +1,101 @@
+/*
+ *  Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class writes the points of an organized cloud decoded by RawData
+    into a PointCloud2 of the layout of the output_format parameter:
+
+    - xyzi:  x, y, z and intensity float32, as pcl::PointXYZI, 32 bytes
+    - xyz:   x, y and z float32, packed, 12 bytes
+    - xyzrt: x, y and z float32, ring uint16 at 12 and time float32 at 16,
+             20 bytes; the ring is the row of the point, the time that of
+             its firing relative to the stamp of the cloud
+    - xyz16: x, y and z int16, in units of fixed_point_resolution meters
+             (0.01 by default), 6 bytes; the points of no return are at
+             INVALID_FIXED_POINT
+
+    The clouds stay organized, the rows of the lasers in the columns of the
+    blocks, the points of no return included.
+
+    The range image of the same rows and columns has the range uint16 in
+    units of range_resolution meters (0.005 by default) and the intensity
+    uint8 at 2, 4 bytes; the points of no return are at range 0. Its
+    columns are those of the cloud of the scan, so the cloud gives their
+    azimuths.
+
+*/
+#ifndef _CLOUD_LAYOUT_H_
+#define _CLOUD_LAYOUT_H_
+
+#include <sensor_msgs/PointCloud2.h>
+#include <pcl/point_types.h>
+#include <ros/ros.h>
+
+namespace rslidar_pointcloud
+{
+class CloudLayout
+{
+public:
+  enum Format
+  {
+    XYZI,
+    XYZ,
+    XYZRT,
+    XYZ16
+  };
+
+  /// the coordinates of the xyz16 points of no return
+  static const int16_t INVALID_FIXED_POINT = -32768;
+
+  /// the layout of the output_format, fixed_point_resolution and range_resolution private parameters
+  explicit CloudLayout(ros::NodeHandle private_nh);
+
+  Format format(void) const
+  {
+    return format_;
+  }
+
+  /// the point times are written, write needs those of the columns
+  bool timed(void) const
+  {
+    return format_ == XYZRT;
+  }
+
+  /// the data bytes of a cloud of height rows of width points
+  size_t bytes(int height, int width) const;
+
+  /// the fields and sizes of a cloud of height rows of width points, its data resized
+  void setLayout(sensor_msgs::PointCloud2& cloud, int height, int width) const;
+
+  /** @brief write points into the data of a cloud set out by setLayout
+   *
+   *  @param points the rows of the decoded cloud
+   *  @param stride number of points from a row of points to the next
+   *  @param column_time per column, the time relative to the stamp of the
+   *         cloud, used if timed()
+   */
+  void write(const pcl::PointXYZI* points, int stride, const float* column_time,
+             sensor_msgs::PointCloud2& cloud) const;
+
+  /// the data bytes of a range image of height rows of width columns
+  size_t rangeImageBytes(int height, int width) const;
+
+  /// the fields and sizes of a range image of height rows of width columns, its data resized
+  void setRangeImage(sensor_msgs::PointCloud2& image, int height, int width) const;
+
+  /// write points into the data of a range image set out by setRangeImage, as write
+  void writeRangeImage(const pcl::PointXYZI* points, int stride, sensor_msgs::PointCloud2& image) const;
+
+private:
+  Format format_;
+  float fixed_point_resolution_;
+  float range_resolution_;
+};
+
+}  // namespace rslidar_pointcloud
+#endif
@@ -12,21 +12,39 @@
 */
 #include "convert.h"
 #include <pcl_conversions/pcl_conversions.h>
+#include <perception_trace/trace.h>
+#include <point_cloud_pool/point_cloud_pool.h>
+#include <algorithm>
 
 namespace rslidar_pointcloud
 {
 std::string model;
 
 /** @brief Constructor. */
-Convert::Convert(ros::NodeHandle node, ros::NodeHandle private_nh) : data_(new rslidar_rawdata::RawData())
+Convert::Convert(ros::NodeHandle node, ros::NodeHandle private_nh)
+  : data_(new rslidar_rawdata::RawData()), layout_(private_nh), deskew_(node, private_nh)
 {
   data_->loadConfigFile(node, private_nh);  // load lidar parameters
   private_nh.param("model", model, std::string("RS16"));
+  private_nh.param("compact", compact_, false);
+  if (compact_ && (layout_.timed() || deskew_.enabled()))
+  {
+    ROS_ERROR_STREAM("[cloud][convert] compact clouds have no columns to time nor to deskew, publishing them "
+                     "organized");
+    compact_ = false;
+  }
+  else if (compact_)
+  {
+    ROS_INFO_STREAM("[cloud][convert] publishing compact clouds, of the points in the crop only");
+  }
 
   // advertise output point cloud (before subscribing to input data)
   std::string output_points_topic;
   private_nh.param("output_points_topic", output_points_topic, std::string("rslidar_points"));
   output_ = node.advertise<sensor_msgs::PointCloud2>(output_points_topic, 10);
+  std::string output_range_image_topic;
+  private_nh.param("output_range_image_topic", output_range_image_topic, std::string("rslidar_range_image"));
+  range_image_output_ = node.advertise<sensor_msgs::PointCloud2>(output_range_image_topic, 10);
 
   srv_ = boost::make_shared<dynamic_reconfigure::Server<rslidar_pointcloud::CloudNodeConfig> >(private_nh);
   dynamic_reconfigure::Server<rslidar_pointcloud::CloudNodeConfig>::CallbackType f;
@@ -38,6 +56,13 @@ Convert::Convert(ros::NodeHandle node, ros::NodeHandle private_nh) : data_(new r
   private_nh.param("input_packets_topic", input_packets_topic, std::string("rslidar_packets"));
   rslidar_scan_ = node.subscribe(input_packets_topic, 10, &Convert::processScan, (Convert*)this,
                                  ros::TransportHints().tcpNoDelay(true));
+
+  // and to those compressed, of the recordings
+  std::string input_compressed_topic;
+  private_nh.param("input_compressed_topic", input_compressed_topic, std::string("rslidar_packets_compressed"));
+  if (!input_compressed_topic.empty())
+    rslidar_compressed_scan_ = node.subscribe(input_compressed_topic, 10, &Convert::processCompressedScan,
+                                              (Convert*)this, ros::TransportHints().tcpNoDelay(true));
 }
 
 void Convert::callback(rslidar_pointcloud::CloudNodeConfig& config, uint32_t level)
@@ -46,38 +71,148 @@ void Convert::callback(rslidar_pointcloud::CloudNodeConfig& config, uint32_t lev
   // config_.time_offset = config.time_offset;
 }
 
+/** @brief Callback for compressed scan messages. */
+void Convert::processCompressedScan(const rslidar_msgs::rslidarCompressedScan::ConstPtr& compressedMsg)
+{
+  rslidar_msgs::rslidarScan::Ptr scanMsg(new rslidar_msgs::rslidarScan);
+  if (!codec_.decode(*compressedMsg, *scanMsg))
+  {
+    ROS_WARN_THROTTLE(5.0, "[cloud][convert] compressed scan of %u packets not decoded", compressedMsg->packets);
+    return;
+  }
+  processScan(scanMsg);
+}
+
 /** @brief Callback for raw scan messages. */
 void Convert::processScan(const rslidar_msgs::rslidarScan::ConstPtr& scanMsg)
 {
-  pcl::PointCloud<pcl::PointXYZI>::Ptr outPoints(new pcl::PointCloud<pcl::PointXYZI>);
-  outPoints->header.stamp = pcl_conversions::toPCL(scanMsg->header).stamp;
-  outPoints->header.frame_id = scanMsg->header.frame_id;
-  outPoints->clear();
+  perception_trace::ScopedHop hop("rslidar cloud", scanMsg->header.stamp);
+  int height = 0;
+  int width = 0;
   if (model == "RS16")
   {
-    outPoints->height = 16;
-    outPoints->width = 24 * (int)scanMsg->packets.size();
-    outPoints->is_dense = false;
-    outPoints->resize(outPoints->height * outPoints->width);
+    height = 16;
+    width = 24 * (int)scanMsg->packets.size();
   }
   else if (model == "RS32" || model == "RSBPEARL" || model == "RSBPEARL_MINI")
   {
-    outPoints->height = 32;
-    outPoints->width = 12 * (int)scanMsg->packets.size();
-    outPoints->is_dense = false;
-    outPoints->resize(outPoints->height * outPoints->width);
+    height = 32;
+    width = 12 * (int)scanMsg->packets.size();
   }
 
-  // process each packet provided by the driver
+  // published as a shared pointer, so nodelets in the same manager get it without serialization,
+  // a cloud of the pool released by the subscribers of an earlier scan, of this or another node;
+  // the points decoded in place into its data if published as xyzi, else into scan_ and written
+  // in the layout
+  size_t bytes = compact_ ? layout_.bytes(1, rslidar_rawdata::SCANS_PER_PACKET * (int)scanMsg->packets.size())
+                          : layout_.bytes(height, width);
+  sensor_msgs::PointCloud2::Ptr outMsg = point_cloud_pool::acquire(bytes);
+  outMsg->header.stamp.fromNSec(scanMsg->header.stamp.toNSec() / 1000ull * 1000ull);  // as through the PCL header
+  perception_trace::link(outMsg->header.stamp, scanMsg->header.stamp);
+  outMsg->header.frame_id = scanMsg->header.frame_id;
+  if (compact_)
+  {
+    unpackCompact(*scanMsg, *outMsg);
+    output_.publish(outMsg);
+    return;
+  }
+  layout_.setLayout(*outMsg, height, width);
+  pcl::PointXYZI* points = NULL;
+  if (layout_.format() == CloudLayout::XYZI && !outMsg->data.empty())
+  {
+    points = reinterpret_cast<pcl::PointXYZI*>(&outMsg->data[0]);
+  }
+  else if (height * width > 0)
+  {
+    scan_.resize(height * width);
+    points = &scan_[0];
+  }
 
+  // process each packet provided by the driver, the time of its columns
+  // relative to the scan kept for the layouts of the point times and the
+  // deskewing: the columns of a packet fired one every column_duration
+  // before it was stamped
+  int columns_per_block = height == 16 ? 2 : 1;
+  float column_duration =
+      1e-6f * (height == 16 ? rslidar_rawdata::RS16_FIRING_TOFFSET : rslidar_rawdata::RS32_BLOCK_TDURATION);
+  column_time_.clear();
   data_->block_num = 0;
-  for (size_t i = 0; i < scanMsg->packets.size(); ++i)
+  for (size_t i = 0; i < scanMsg->packets.size() && points != NULL; ++i)
   {
-    data_->unpack(scanMsg->packets[i], outPoints);
+    data_->unpack(scanMsg->packets[i], points, width);
+    if (layout_.timed() || deskew_.enabled())
+    {
+      int begin = column_time_.size();
+      int end = data_->block_num * columns_per_block;
+      float packet_time = (scanMsg->packets[i].stamp - scanMsg->header.stamp).toSec();
+      column_time_.resize(end);
+      for (int col = begin; col < end; ++col)
+      {
+        column_time_[col] = packet_time - (end - 1 - col) * column_duration;
+      }
+    }
+  }
+
+  // the columns of the packets not unpacked as the points of a new PCL cloud
+  int unpacked = std::min(data_->block_num * columns_per_block, width);
+  for (int row = 0; row < height && points != NULL; ++row)
+  {
+    std::fill(points + row * width + unpacked, points + (row + 1) * width, pcl::PointXYZI());
+  }
+  if (deskew_.enabled() && points != NULL)
+  {
+    deskew_.deskew(points, width, height, std::min((int)column_time_.size(), width), column_time_.data(),
+                   scanMsg->header.stamp, scanMsg->header.frame_id);
+  }
+  column_time_.resize(width, 0.0f);
+  if (layout_.format() != CloudLayout::XYZI && points != NULL)
+  {
+    layout_.write(points, width, column_time_.data(), *outMsg);
   }
-  sensor_msgs::PointCloud2 outMsg;
-  pcl::toROSMsg(*outPoints, outMsg);
 
   output_.publish(outMsg);
+
+  if (range_image_output_.getNumSubscribers() > 0 && points != NULL)
+  {
+    sensor_msgs::PointCloud2::Ptr image = point_cloud_pool::acquire(layout_.rangeImageBytes(height, width));
+    image->header = outMsg->header;
+    layout_.setRangeImage(*image, height, width);
+    layout_.writeRangeImage(points, width, *image);
+    range_image_output_.publish(image);
+  }
+}
+
+/** the points in the crop appended packet after packet, in place into the
+ *  data of outMsg if published as xyzi, else into scan_ and written in the
+ *  layout; there are no range images of them
+ */
+void Convert::unpackCompact(const rslidar_msgs::rslidarScan& scanMsg, sensor_msgs::PointCloud2& outMsg)
+{
+  int capacity = rslidar_rawdata::SCANS_PER_PACKET * (int)scanMsg.packets.size();
+  layout_.setLayout(outMsg, 1, capacity);
+  pcl::PointXYZI* points = NULL;
+  if (layout_.format() == CloudLayout::XYZI)
+  {
+    points = reinterpret_cast<pcl::PointXYZI*>(outMsg.data.data());
+  }
+  else
+  {
+    scan_.resize(capacity);
+    points = scan_.data();
+  }
+
+  data_->block_num = 0;
+  data_->compact_size = 0;
+  for (size_t i = 0; i < scanMsg.packets.size(); ++i)
+  {
+    data_->unpackCompact(scanMsg.packets[i], points);
+  }
+
+  layout_.setLayout(outMsg, 1, data_->compact_size);
+  if (layout_.format() != CloudLayout::XYZI)
+  {
+    layout_.write(points, data_->compact_size, NULL, outMsg);  // not timed
+  }
+  outMsg.is_dense = true;
 }
 }  // namespace rslidar_pointcloud
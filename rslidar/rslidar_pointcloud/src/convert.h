@@ -9,6 +9,11 @@
 
     This class converts raw Robosense 3D LIDAR packets to PointCloud2.
 
+    With compact set, the clouds are those of the returns in the crop of
+    the angle window, of the distance range and of the height band only,
+    unorganized: one row of the valid points, the others skipped by RawData
+    before they are computed.
+
 */
 #ifndef _CONVERT_H_
 #define _CONVERT_H_
@@ -17,6 +22,9 @@
 #include <dynamic_reconfigure/server.h>
 #include <rslidar_pointcloud/CloudNodeConfig.h>
 #include "rawdata.h"
+#include "cloud_layout.h"
+#include "deskew.h"
+#include <scan_codec.h>
 
 namespace rslidar_pointcloud
 {
@@ -33,13 +41,27 @@ private:
   void callback(rslidar_pointcloud::CloudNodeConfig& config, uint32_t level);
 
   void processScan(const rslidar_msgs::rslidarScan::ConstPtr& scanMsg);
+  /// the scan decoded, then processed as those of the packets topic
+  void processCompressedScan(const rslidar_msgs::rslidarCompressedScan::ConstPtr& compressedMsg);
+  /// the points of the scan in the crop into outMsg, set out but for its layout
+  void unpackCompact(const rslidar_msgs::rslidarScan& scanMsg, sensor_msgs::PointCloud2& outMsg);
 
   /// Pointer to dynamic reconfigure service srv_
   boost::shared_ptr<dynamic_reconfigure::Server<rslidar_pointcloud::CloudNodeConfig> > srv_;
 
   boost::shared_ptr<rslidar_rawdata::RawData> data_;
+  CloudLayout layout_;  ///< of the published clouds
+  Deskewer deskew_;
+  bool compact_;  ///< the clouds unorganized, of the points in the crop only
   ros::Subscriber rslidar_scan_;
+  ros::Subscriber rslidar_compressed_scan_;
+  rslidar_driver::ScanCodec codec_;
   ros::Publisher output_;
+  ros::Publisher range_image_output_;
+
+  // reused from scan to scan, the published clouds of point_cloud_pool
+  pcl::PointCloud<pcl::PointXYZI>::VectorType scan_;  ///< the points decoded, of the layouts but xyzi
+  std::vector<float> column_time_;
 };
 
 }  // namespace rslidar_pointcloud
@@ -0,0 +1,170 @@
+/*
+ *  Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class deskews the clouds decoded by RawData against the odometry.
+
+*/
+#include "deskew.h"
+#include <algorithm>
+#include <tf/transform_datatypes.h>
+
+namespace rslidar_pointcloud
+{
+namespace
+{
+bool laterThan(const ros::Time& t, const Deskewer::Pose& pose)
+{
+  return t < pose.stamp;
+}
+}
+
+Deskewer::Deskewer(ros::NodeHandle node, ros::NodeHandle private_nh) : enabled_(false)
+{
+  std::string odom_topic;
+  private_nh.param("deskew_odom_topic", odom_topic, std::string(""));
+  private_nh.param("deskew_max_extrapolation", max_extrapolation_, 0.1);
+  if (odom_topic.empty())
+  {
+    return;
+  }
+  enabled_ = true;
+  listener_.reset(new tf::TransformListener(node));
+  odom_sub_ = node.subscribe(odom_topic, 100, &Deskewer::processOdom, this, ros::TransportHints().tcpNoDelay(true));
+  ROS_INFO_STREAM("[cloud][deskew] deskewing through the odometry of " << odom_topic);
+}
+
+void Deskewer::processOdom(const nav_msgs::Odometry::ConstPtr& odom)
+{
+  Pose pose;
+  pose.stamp = odom->header.stamp;
+  tf::poseMsgToTF(odom->pose.pose, pose.pose);
+
+  boost::mutex::scoped_lock lock(mutex_);
+  if (!poses_.empty() && pose.stamp <= poses_.back().stamp)
+  {
+    // out of order, or the time jumped back on a replay
+    if (pose.stamp < poses_.back().stamp)
+    {
+      poses_.clear();
+    }
+    else
+    {
+      return;
+    }
+  }
+  child_frame_ = odom->child_frame_id;
+  poses_.push_back(pose);
+  while (pose.stamp - poses_.front().stamp > ros::Duration(1.0))
+  {
+    poses_.pop_front();
+  }
+}
+
+bool Deskewer::poseAt(const ros::Time& t, tf::Transform& pose) const
+{
+  if (poses_.size() < 2 || t < poses_.front().stamp ||
+      (t - poses_.back().stamp).toSec() > max_extrapolation_)
+  {
+    return false;
+  }
+
+  // the poses around t, the last two past the last one
+  size_t b = std::upper_bound(poses_.begin(), poses_.end(), t, laterThan) - poses_.begin();
+  b = std::min(std::max(b, (size_t)1), poses_.size() - 1);
+  const Pose& p0 = poses_[b - 1];
+  const Pose& p1 = poses_[b];
+  double s = (t - p0.stamp).toSec() / (p1.stamp - p0.stamp).toSec();
+  pose.setOrigin(p0.pose.getOrigin().lerp(p1.pose.getOrigin(), s));
+  pose.setRotation(p0.pose.getRotation().slerp(p1.pose.getRotation(), s));
+  return true;
+}
+
+bool Deskewer::deskew(pcl::PointXYZI* points, int stride, int height, int width, const float* column_time,
+                      const ros::Time& stamp, const std::string& frame_id)
+{
+  if (width <= 0)
+  {
+    return true;
+  }
+
+  std::string child_frame;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    child_frame = child_frame_;
+  }
+  if (child_frame.empty())
+  {
+    ROS_WARN_STREAM_THROTTLE(5, "[cloud][deskew] no odometry yet, clouds not deskewed");
+    return false;
+  }
+  if (mounting_frames_ != child_frame + " " + frame_id)
+  {
+    try
+    {
+      tf::StampedTransform mounting;
+      listener_->lookupTransform(child_frame, frame_id, ros::Time(0), mounting);
+      mounting_ = mounting;
+      mounting_frames_ = child_frame + " " + frame_id;
+    }
+    catch (tf::TransformException& ex)
+    {
+      ROS_WARN_STREAM_THROTTLE(5, "[cloud][deskew] clouds not deskewed: " << ex.what());
+      return false;
+    }
+  }
+
+  // the transforms of the points of each column from its time to the stamp,
+  // the poses walked once for the scan
+  column_transforms_.resize(width * 12);
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    tf::Transform target;
+    if (!poseAt(stamp, target))
+    {
+      ROS_WARN_STREAM_THROTTLE(5, "[cloud][deskew] no odometry at " << stamp << ", clouds not deskewed");
+      return false;
+    }
+    tf::Transform to_lidar = (target * mounting_).inverse();
+    for (int col = 0; col < width; ++col)
+    {
+      tf::Transform pose;
+      if (!poseAt(stamp + ros::Duration(column_time[col]), pose))
+      {
+        ROS_WARN_STREAM_THROTTLE(5, "[cloud][deskew] no odometry at " << stamp + ros::Duration(column_time[col])
+                                                                      << ", clouds not deskewed");
+        return false;
+      }
+      tf::Transform t = to_lidar * pose * mounting_;
+      float* m = &column_transforms_[col * 12];
+      for (int i = 0; i < 3; ++i)
+      {
+        m[i * 4 + 0] = t.getBasis()[i].x();
+        m[i * 4 + 1] = t.getBasis()[i].y();
+        m[i * 4 + 2] = t.getBasis()[i].z();
+        m[i * 4 + 3] = t.getOrigin()[i];
+      }
+    }
+  }
+
+  // row by row, the points of no return staying NaN
+  for (int row = 0; row < height; ++row)
+  {
+    pcl::PointXYZI* p = points + row * stride;
+    const float* m = &column_transforms_[0];
+    for (int col = 0; col < width; ++col, m += 12)
+    {
+      float x = p[col].x, y = p[col].y, z = p[col].z;
+      p[col].x = m[0] * x + m[1] * y + m[2] * z + m[3];
+      p[col].y = m[4] * x + m[5] * y + m[6] * z + m[7];
+      p[col].z = m[8] * x + m[9] * y + m[10] * z + m[11];
+    }
+  }
+  return true;
+}
+}  // namespace rslidar_pointcloud
@@ -0,0 +1,82 @@
+/*
+ *  Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class deskews the organized clouds decoded by RawData: the points
+    of each column, fired at its own time during the revolution, are moved
+    to where the lidar saw them from at the stamp of the cloud, through the
+    odometry of the deskew_odom_topic interpolated at the column times.
+
+    The mounting of the lidar on the child frame of the odometry comes from
+    tf, looked up once.
+
+*/
+#ifndef _DESKEW_H_
+#define _DESKEW_H_
+
+#include <deque>
+#include <boost/thread/mutex.hpp>
+#include <nav_msgs/Odometry.h>
+#include <pcl/point_types.h>
+#include <ros/ros.h>
+#include <tf/transform_listener.h>
+
+namespace rslidar_pointcloud
+{
+class Deskewer
+{
+public:
+  /// deskewing through the odometry of the deskew_odom_topic private parameter, none if empty
+  Deskewer(ros::NodeHandle node, ros::NodeHandle private_nh);
+
+  bool enabled(void) const
+  {
+    return enabled_;
+  }
+
+  /** @brief move the points of the first columns of a cloud to where they are seen from at its stamp
+   *
+   *  @param points the rows of the cloud
+   *  @param stride number of points from a row of points to the next
+   *  @param width the columns deskewed, the points of the others are left
+   *  @param column_time per column, the time relative to the stamp
+   *  @return whether deskewed, not if the odometry or the mounting are not
+   *          known for the times of the cloud
+   */
+  bool deskew(pcl::PointXYZI* points, int stride, int height, int width, const float* column_time,
+              const ros::Time& stamp, const std::string& frame_id);
+
+  struct Pose
+  {
+    ros::Time stamp;
+    tf::Transform pose;  ///< of the child frame of the odometry
+  };
+
+private:
+  void processOdom(const nav_msgs::Odometry::ConstPtr& odom);
+
+  /// the pose interpolated at t, extrapolated up to max_extrapolation_ past the last one
+  bool poseAt(const ros::Time& t, tf::Transform& pose) const;
+
+  bool enabled_;
+  double max_extrapolation_;  ///< seconds
+  ros::Subscriber odom_sub_;
+  boost::shared_ptr<tf::TransformListener> listener_;
+
+  mutable boost::mutex mutex_;  ///< of poses_ and child_frame_
+  std::deque<Pose> poses_;      ///< the last second of odometry
+  std::string child_frame_;
+
+  tf::Transform mounting_;  ///< of the lidar on child_frame_, once looked up
+  std::string mounting_frames_;
+
+  std::vector<float> column_transforms_;  ///< 3x4, row major, of each column
+};
+
+}  // namespace rslidar_pointcloud
+#endif
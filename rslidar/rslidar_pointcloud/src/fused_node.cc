@@ -0,0 +1,47 @@
+/*
+ *  Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+
+    This ROS node reads the Robosense 3D LIDAR and publishes PointCloud2,
+    the packets decoded in the driver as they arrive.
+
+*/
+#include <signal.h>
+#include "cloud_decoder.h"
+
+volatile sig_atomic_t flag = 1;
+
+static void my_handler(int sig)
+{
+  flag = 0;
+}
+
+/** Main node entry point. */
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "rslidar_fused_node");
+  ros::NodeHandle node;
+  ros::NodeHandle priv_nh("~");
+
+  signal(SIGINT, my_handler);
+
+  // start the driver, decoding the scans instead of publishing their packets
+  rslidar_driver::rslidarDriver dvr(node, priv_nh);
+  bool publish_packets;
+  priv_nh.param("publish_packets", publish_packets, false);
+  dvr.setDecoder(boost::shared_ptr<rslidar_driver::ScanDecoder>(new rslidar_pointcloud::CloudDecoder(node, priv_nh)),
+                 publish_packets);
+
+  // loop until shut down or end of file
+  while (ros::ok() && dvr.poll())
+  {
+    ros::spinOnce();
+  }
+
+  return 0;
+}
@@ -0,0 +1,486 @@
+/*
+ *  Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class drives several Robosense 3D LIDARs with one receive loop
+    and a pool of decode threads.
+
+    The receive loop reads every socket epoll reports until it is empty,
+    recv_batch packets per syscall, and cuts the packets into scans as the
+    driver does. A lidar is handed to the pool as the jobs of a batch: the
+    beginning of a scan, its packets or its end. One thread at a time
+    decodes the jobs of a lidar, in their order, while the other threads
+    decode the other lidars. The difop packets are handed to the device
+    status thread of the decoder of their lidar instead.
+
+*/
+#include "multi_driver.h"
+#include <point_cloud_pool/point_cloud_pool.h>
+#include <sstream>
+#include <sys/epoll.h>
+
+namespace rslidar_pointcloud
+{
+namespace
+{
+const int ANGLE_HEAD = -36001;
+const size_t MAX_SPARE_BATCHES = 64;  ///< per lidar
+const int MAX_EVENTS = 16;
+}
+
+MultiDriver::MultiDriver(ros::NodeHandle node, ros::NodeHandle private_nh)
+  : epoll_fd_(-1), running_(true), node_name_(private_nh.getNamespace())
+{
+  std::string devices;
+  private_nh.param("devices", devices, std::string(""));
+  std::istringstream names(devices);
+  std::string name;
+  while (names >> name)
+  {
+    boost::shared_ptr<Device> d(new Device);
+    ros::NodeHandle device_nh(private_nh, name);
+    d->name = name;
+    device_nh.param("model", d->model, std::string("RS16"));
+    device_nh.param("frame_id", d->frame_id, name);
+    d->frame_id = tf::resolve(tf::getPrefixParam(device_nh), d->frame_id);
+    device_nh.param("time_offset", d->time_offset, 0.0);
+
+    // a single revolution by default, as the driver
+    double packet_rate = d->model == "RS16" ? 750 : 1500;
+    double rpm;
+    device_nh.param("rpm", rpm, 600.0);
+    device_nh.param("npackets", d->npackets, (int)ceil(packet_rate / (rpm / 60.0)));
+    double cut_angle;
+    device_nh.param("cut_angle", cut_angle, -0.01);
+    d->cut_angle = cut_angle < 360 ? static_cast<int>(cut_angle * 100) : -1;
+    d->last_azimuth = ANGLE_HEAD;
+    d->in_scan = false;
+    d->scan_packets = 0;
+
+    int msop_port, difop_port, recv_batch;
+    device_nh.param("msop_port", msop_port, (int)rslidar_driver::MSOP_DATA_PORT_NUMBER);
+    device_nh.param("difop_port", difop_port, (int)rslidar_driver::DIFOP_DATA_PORT_NUMBER);
+    device_nh.param("recv_batch", recv_batch, 1);
+    d->recv_batch = std::max(recv_batch, 1);
+    d->msop_input.reset(new rslidar_driver::InputSocket(device_nh, msop_port));
+    d->difop_input.reset(new rslidar_driver::InputSocket(device_nh, difop_port));
+    d->msop_input->setNonBlocking();
+    d->difop_input->setNonBlocking();
+    d->status.reset(new rslidar_driver::DeviceStatus(d->model));
+
+    d->decoder.reset(new CloudDecoder(ros::NodeHandle(node, name), device_nh));
+    d->scheduled = false;
+    d->mounted = false;
+    ROS_INFO_STREAM("[cloud][multi] " << name << ": " << d->model << " on ports " << msop_port << " and "
+                                      << difop_port << ", frame " << d->frame_id);
+    devices_.push_back(d);
+  }
+  if (devices_.empty())
+  {
+    ROS_ERROR_STREAM("[cloud][multi] no devices, set the devices parameter to the names of the lidars");
+  }
+
+  epoll_fd_ = epoll_create1(0);
+  if (epoll_fd_ == -1)
+  {
+    ROS_ERROR_STREAM("[cloud][multi] epoll_create1() error: " << strerror(errno));
+  }
+  for (size_t i = 0; i < devices_.size() && epoll_fd_ != -1; ++i)
+  {
+    // the index of the device, doubled and plus one for its difop socket
+    int fds[2] = { devices_[i]->msop_input->fd(), devices_[i]->difop_input->fd() };
+    for (int k = 0; k < 2; ++k)
+    {
+      epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.u64 = i * 2 + k;
+      if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fds[k], &event) == -1)
+      {
+        ROS_ERROR_STREAM("[cloud][multi] " << devices_[i]->name << " not received, epoll_ctl() error: "
+                                           << strerror(errno));
+      }
+    }
+  }
+
+  private_nh.param("merged_frame", merged_frame_, std::string(""));
+  private_nh.param("merge_max_age", merge_max_age_, 0.15);
+  if (!merged_frame_.empty())
+  {
+    listener_.reset(new tf::TransformListener(node));
+    std::string output_merged_topic;
+    private_nh.param("output_merged_topic", output_merged_topic, std::string("rslidar_points_merged"));
+    merged_output_ = node.advertise<sensor_msgs::PointCloud2>(output_merged_topic, 10);
+    for (size_t i = 0; i < devices_.size(); ++i)
+    {
+      devices_[i]->decoder->setScanCallback(boost::bind(&MultiDriver::mergeScan, this, i, _1, _2, _3, _4, _5, _6));
+    }
+    ROS_INFO_STREAM("[cloud][multi] merging the clouds in " << merged_frame_);
+  }
+
+  int decode_threads;
+  private_nh.param("decode_threads", decode_threads, 2);
+  // all of them set up with scheduling/decode/
+  thread_config::Settings decode = thread_config::read(private_nh, "decode");
+  for (int i = 0; i < std::max(decode_threads, 1); ++i)
+  {
+    threads_.push_back(boost::shared_ptr<boost::thread>(
+        new boost::thread(&MultiDriver::decodeLoop, this, "decode_" + std::to_string(i), decode)));
+  }
+  ROS_INFO_STREAM("[cloud][multi] " << devices_.size() << " lidars decoded by " << threads_.size() << " threads");
+}
+
+MultiDriver::~MultiDriver()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    running_ = false;
+  }
+  ready_cond_.notify_all();
+  for (size_t i = 0; i < threads_.size(); ++i)
+  {
+    threads_[i]->join();
+  }
+  if (epoll_fd_ != -1)
+  {
+    close(epoll_fd_);
+  }
+}
+
+bool MultiDriver::poll(int timeout)
+{
+  epoll_event events[MAX_EVENTS];
+  int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout);
+  if (n < 0)
+  {
+    if (errno == EINTR)
+    {
+      return true;
+    }
+    ROS_ERROR_STREAM("[cloud][multi] epoll_wait() error: " << strerror(errno));
+    return false;
+  }
+  for (int i = 0; i < n; ++i)
+  {
+    size_t index = events[i].data.u64 / 2;
+    if (events[i].data.u64 % 2)
+    {
+      receiveDifop(*devices_[index]);
+    }
+    else
+    {
+      receiveMsop(*devices_[index]);
+    }
+    submit(index);
+  }
+  return true;
+}
+
+/** the msop packets queued, straight into the batch of the scan */
+void MultiDriver::receiveMsop(Device& d)
+{
+  while (true)
+  {
+    size_t begin = d.batch.size();
+    d.batch.resize(begin + d.recv_batch);
+    int received = 0;
+    int rc = d.msop_input->getPackets(&d.batch[begin], d.recv_batch, d.time_offset, received);
+    d.batch.resize(begin + (rc == 0 ? received : 0));
+    if (rc != 0 || received == 0)
+    {
+      break;
+    }
+
+    for (size_t k = begin; k < d.batch.size();)
+    {
+      if (!d.in_scan)
+      {
+        // the packets of a revolution at the rpm and the return mode of the difop, as the driver
+        int npackets = d.status->takeNpackets();
+        if (d.cut_angle < 0 && npackets > 0)
+        {
+          d.npackets = npackets;
+        }
+        Job job;
+        job.type = Job::BEGIN;
+        job.npackets = d.npackets;
+        d.pending.push_back(std::move(job));
+        d.in_scan = true;
+        d.scan_packets = 0;
+      }
+
+      const rslidar_msgs::rslidarPacket& pkt = d.batch[k];
+      ++d.scan_packets;
+      bool end = d.scan_packets >= d.npackets;
+      if (d.cut_angle >= 0)
+      {
+        int azimuth = 256 * pkt.data[44] + pkt.data[45];
+        if (azimuth < d.last_azimuth)  // overflow 35999->0
+        {
+          d.last_azimuth -= 36000;
+        }
+        end = d.last_azimuth != ANGLE_HEAD && d.last_azimuth < d.cut_angle && azimuth >= d.cut_angle;
+        d.last_azimuth = azimuth;
+      }
+      if (!end)
+      {
+        ++k;
+        continue;
+      }
+
+      // the packets past the end of the scan begin the next one
+      std::vector<rslidar_msgs::rslidarPacket> next(d.batch.begin() + k + 1, d.batch.end());
+      d.batch.resize(k + 1);
+      flushBatch(d, true, pkt.stamp);
+      d.batch.swap(next);
+      k = 0;
+    }
+    flushBatch(d, false, ros::Time());
+  }
+}
+
+void MultiDriver::receiveDifop(Device& d)
+{
+  rslidar_msgs::rslidarPacket pkt;
+  while (d.difop_input->getPacket(&pkt, d.time_offset) == 0)
+  {
+    if (d.status->update(pkt))
+    {
+      ROS_INFO_STREAM("[cloud][multi] " << d.name << " npackets updated: " << d.status->npackets());
+    }
+    d.decoder->decodeDifop(boost::make_shared<rslidar_msgs::rslidarPacket>(pkt));
+  }
+}
+
+void MultiDriver::flushBatch(Device& d, bool end, const ros::Time& stamp)
+{
+  if (!d.batch.empty())
+  {
+    Job job;
+    job.type = Job::PACKETS;
+    job.packets.swap(d.batch);
+    d.pending.push_back(std::move(job));
+  }
+  if (end)
+  {
+    Job job;
+    job.type = Job::END;
+    job.stamp = stamp;
+    d.pending.push_back(std::move(job));
+    d.in_scan = false;
+  }
+}
+
+void MultiDriver::submit(size_t index)
+{
+  Device& d = *devices_[index];
+  if (d.pending.empty())
+  {
+    return;
+  }
+  boost::mutex::scoped_lock lock(mutex_);
+  for (size_t i = 0; i < d.pending.size(); ++i)
+  {
+    d.jobs.push_back(std::move(d.pending[i]));
+  }
+  d.pending.clear();
+  // the next batch received into one decoded, without allocation
+  if (d.batch.capacity() == 0 && !d.spare.empty())
+  {
+    d.batch.swap(d.spare.back());
+    d.spare.pop_back();
+  }
+  if (!d.scheduled)
+  {
+    d.scheduled = true;
+    ready_.push_back(index);
+    ready_cond_.notify_one();
+  }
+}
+
+/** Decode thread main loop, the jobs of one lidar at a time */
+void MultiDriver::decodeLoop(const std::string& name, const thread_config::Settings& settings)
+{
+  thread_config::apply(node_name_, name, settings);
+  std::deque<Job> jobs;
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  while (true)
+  {
+    while (running_ && ready_.empty())
+    {
+      ready_cond_.wait(lock);
+    }
+    if (!running_)
+    {
+      return;
+    }
+    size_t index = ready_.front();
+    ready_.pop_front();
+    Device& d = *devices_[index];
+    jobs.swap(d.jobs);
+    lock.unlock();
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+      run(d, jobs[i]);
+    }
+
+    lock.lock();
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+      if (jobs[i].type == Job::PACKETS && d.spare.size() < MAX_SPARE_BATCHES)
+      {
+        jobs[i].packets.clear();
+        d.spare.push_back(std::vector<rslidar_msgs::rslidarPacket>());
+        d.spare.back().swap(jobs[i].packets);
+      }
+    }
+    jobs.clear();
+    // the jobs submitted meanwhile, after those of the other lidars
+    if (d.jobs.empty())
+    {
+      d.scheduled = false;
+    }
+    else
+    {
+      ready_.push_back(index);
+    }
+  }
+}
+
+void MultiDriver::run(Device& d, Job& job)
+{
+  switch (job.type)
+  {
+    case Job::BEGIN:
+      d.decoder->beginScan(job.npackets, d.frame_id);
+      break;
+    case Job::PACKETS:
+      for (size_t i = 0; i < job.packets.size(); ++i)
+      {
+        d.decoder->decodePacket(job.packets[i]);
+      }
+      break;
+    case Job::END:
+      d.decoder->endScan(job.stamp);
+      break;
+  }
+}
+
+/** the points of a scan, in the thread decoding its lidar, moved to the
+ *  merged frame; the merged cloud published at the scans of the first one
+ */
+void MultiDriver::mergeScan(size_t index, const pcl::PointXYZI* points, int stride, int height, int width,
+                            const ros::Time& stamp, const std::string& frame_id)
+{
+  if (merged_output_.getNumSubscribers() == 0)
+  {
+    return;
+  }
+  Device& d = *devices_[index];
+  if (!d.mounted)
+  {
+    try
+    {
+      tf::StampedTransform mounting;
+      listener_->lookupTransform(merged_frame_, frame_id, ros::Time(0), mounting);
+      d.mounting = mounting;
+      d.mounted = true;
+    }
+    catch (tf::TransformException& ex)
+    {
+      ROS_WARN_STREAM_THROTTLE(5, "[cloud][multi] " << d.name << " not merged: " << ex.what());
+      return;
+    }
+  }
+
+  // the points of a return, the NaN ones dropped
+  float m[12];
+  for (int i = 0; i < 3; ++i)
+  {
+    m[i * 4 + 0] = d.mounting.getBasis()[i].x();
+    m[i * 4 + 1] = d.mounting.getBasis()[i].y();
+    m[i * 4 + 2] = d.mounting.getBasis()[i].z();
+    m[i * 4 + 3] = d.mounting.getOrigin()[i];
+  }
+  d.scan_points.clear();
+  for (int row = 0; row < height; ++row)
+  {
+    const pcl::PointXYZI* p = points + row * stride;
+    for (int col = 0; col < width; ++col)
+    {
+      if (std::isnan(p[col].x))
+      {
+        continue;
+      }
+      pcl::PointXYZI q;
+      q.x = m[0] * p[col].x + m[1] * p[col].y + m[2] * p[col].z + m[3];
+      q.y = m[4] * p[col].x + m[5] * p[col].y + m[6] * p[col].z + m[7];
+      q.z = m[8] * p[col].x + m[9] * p[col].y + m[10] * p[col].z + m[11];
+      q.intensity = p[col].intensity;
+      d.scan_points.push_back(q);
+    }
+  }
+
+  boost::mutex::scoped_lock lock(merge_mutex_);
+  d.merge_points.swap(d.scan_points);
+  d.merge_stamp = stamp;
+  if (index != 0)
+  {
+    return;
+  }
+
+  // the last scans of the lidars, those of about the time of the first one
+  size_t size = 0;
+  for (size_t i = 0; i < devices_.size(); ++i)
+  {
+    const Device& e = *devices_[i];
+    if (std::fabs((e.merge_stamp - stamp).toSec()) <= merge_max_age_)
+    {
+      size += e.merge_points.size();
+    }
+  }
+  sensor_msgs::PointCloud2::Ptr cloud = point_cloud_pool::acquire(size * sizeof(pcl::PointXYZI));
+  cloud->header.stamp.fromNSec(stamp.toNSec() / 1000ull * 1000ull);
+  cloud->header.frame_id = merged_frame_;
+  cloud->height = 1;
+  cloud->width = size;
+  if (cloud->fields.empty())
+  {
+    const char* names[] = { "x", "y", "z", "intensity" };
+    const uint32_t offsets[] = { pcl::traits::offset<pcl::PointXYZI, pcl::fields::x>::value,
+                                 pcl::traits::offset<pcl::PointXYZI, pcl::fields::y>::value,
+                                 pcl::traits::offset<pcl::PointXYZI, pcl::fields::z>::value,
+                                 pcl::traits::offset<pcl::PointXYZI, pcl::fields::intensity>::value };
+    cloud->fields.resize(4);
+    for (int i = 0; i < 4; ++i)
+    {
+      cloud->fields[i].name = names[i];
+      cloud->fields[i].offset = offsets[i];
+      cloud->fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+      cloud->fields[i].count = 1;
+    }
+  }
+  cloud->is_bigendian = false;
+  cloud->point_step = sizeof(pcl::PointXYZI);
+  cloud->row_step = cloud->point_step * size;
+  cloud->is_dense = true;
+  cloud->data.resize(size * sizeof(pcl::PointXYZI));
+  pcl::PointXYZI* q = reinterpret_cast<pcl::PointXYZI*>(cloud->data.data());
+  for (size_t i = 0; i < devices_.size(); ++i)
+  {
+    const Device& e = *devices_[i];
+    if (std::fabs((e.merge_stamp - stamp).toSec()) <= merge_max_age_)
+    {
+      q = std::copy(e.merge_points.begin(), e.merge_points.end(), q);
+    }
+  }
+  lock.unlock();
+  merged_output_.publish(cloud);
+}
+}  // namespace rslidar_pointcloud
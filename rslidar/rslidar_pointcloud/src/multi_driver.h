@@ -0,0 +1,134 @@
+/*
+ *  Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This class drives several Robosense 3D LIDARs in one process: a single
+    epoll loop receives the msop and difop packets of all of them and cuts
+    their scans, and a pool of decode_threads threads decodes the scans with
+    a CloudDecoder per lidar, so that the threads do not grow with the
+    lidars.
+
+    The lidars are those of the devices private parameter, a list of names
+    separated by spaces. The parameters of each one, those of the driver
+    and of the cloud node, are in the private namespace of its name, and
+    its topics in the namespace of its name: ~front/msop_port, and
+    front/rslidar_points.
+
+    With merged_frame set, the points of the last scans of all the lidars
+    are also published as one unorganized xyzi cloud in that frame, through
+    their static tf mountings, on rslidar_points_merged, at every scan of
+    the first lidar.
+
+*/
+#ifndef _MULTI_DRIVER_H_
+#define _MULTI_DRIVER_H_
+
+#include <deque>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <thread_config/thread_config.h>
+#include <tf/transform_listener.h>
+#include "cloud_decoder.h"
+
+namespace rslidar_pointcloud
+{
+class MultiDriver
+{
+public:
+  MultiDriver(ros::NodeHandle node, ros::NodeHandle private_nh);
+
+  ~MultiDriver();
+
+  /** @brief read the packets of all the lidars for up to timeout msec
+   *
+   *  @returns false if the sockets can not be polled
+   */
+  bool poll(int timeout);
+
+private:
+  /// a step of decoding a lidar, in the order the packets arrived
+  struct Job
+  {
+    enum Type
+    {
+      BEGIN,
+      PACKETS,
+      END
+    };
+    Type type;
+    int npackets;  ///< of BEGIN
+    std::vector<rslidar_msgs::rslidarPacket> packets;
+    ros::Time stamp;  ///< of END
+  };
+
+  struct Device
+  {
+    std::string name;
+    std::string model;
+    std::string frame_id;
+    double time_offset;
+    int cut_angle;  ///< one-hundredth degree, negative for scans of npackets
+    int npackets;
+    int recv_batch;  ///< packets per getPackets
+
+    // of the receive loop
+    boost::shared_ptr<rslidar_driver::InputSocket> msop_input;
+    boost::shared_ptr<rslidar_driver::InputSocket> difop_input;
+    boost::shared_ptr<rslidar_driver::DeviceStatus> status;  ///< of the difop packets
+    bool in_scan;
+    int scan_packets;
+    int last_azimuth;
+    std::vector<rslidar_msgs::rslidarPacket> batch;  ///< of the scan, not submitted yet
+    std::vector<Job> pending;                        ///< not submitted yet
+
+    // of the decode threads, under mutex_
+    boost::shared_ptr<CloudDecoder> decoder;
+    std::deque<Job> jobs;
+    bool scheduled;  ///< in ready_ or being decoded, by one thread at a time
+    std::vector<std::vector<rslidar_msgs::rslidarPacket> > spare;  ///< batches decoded, to reuse
+
+    // of the merged cloud, the points under merge_mutex_
+    bool mounted;
+    tf::Transform mounting;  ///< in merged_frame_
+    pcl::PointCloud<pcl::PointXYZI>::VectorType scan_points;
+    pcl::PointCloud<pcl::PointXYZI>::VectorType merge_points;
+    ros::Time merge_stamp;
+  };
+
+  void receiveMsop(Device& d);
+  void receiveDifop(Device& d);
+  /// the packets of d.batch, then the end of the scan if end
+  void flushBatch(Device& d, bool end, const ros::Time& stamp);
+  /// hand the pending jobs of d to the decode threads
+  void submit(size_t index);
+  /// decode thread main loop, the thread named name and set up with settings
+  void decodeLoop(const std::string& name, const thread_config::Settings& settings);
+  void run(Device& d, Job& job);
+  void mergeScan(size_t index, const pcl::PointXYZI* points, int stride, int height, int width,
+                 const ros::Time& stamp, const std::string& frame_id);
+
+  std::vector<boost::shared_ptr<Device> > devices_;
+  int epoll_fd_;
+
+  boost::mutex mutex_;  ///< of the jobs of the devices and ready_
+  boost::condition_variable ready_cond_;
+  std::deque<size_t> ready_;  ///< devices with jobs and no thread decoding them
+  bool running_;
+  std::vector<boost::shared_ptr<boost::thread> > threads_;
+  std::string node_name_;  ///< the threads are recorded for, c.f. thread_config
+
+  std::string merged_frame_;  ///< none merged if empty
+  double merge_max_age_;      ///< seconds a scan is merged for
+  boost::shared_ptr<tf::TransformListener> listener_;
+  ros::Publisher merged_output_;
+  boost::mutex merge_mutex_;
+};
+
+}  // namespace rslidar_pointcloud
+#endif
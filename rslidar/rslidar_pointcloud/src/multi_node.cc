@@ -0,0 +1,44 @@
+/*
+ *  Copyright (C) 2018-2020 Robosense Authors
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** \file
+
+    This ROS node reads several Robosense 3D LIDARs and publishes their
+    PointCloud2, with one receive loop and a pool of decode threads for
+    all of them.
+
+*/
+#include <signal.h>
+#include "multi_driver.h"
+
+volatile sig_atomic_t flag = 1;
+
+static void my_handler(int sig)
+{
+  flag = 0;
+}
+
+/** Main node entry point. */
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "rslidar_multi_node");
+  ros::NodeHandle node;
+  ros::NodeHandle priv_nh("~");
+
+  signal(SIGINT, my_handler);
+
+  rslidar_pointcloud::MultiDriver dvr(node, priv_nh);
+  thread_config::configure(priv_nh, "poll");
+
+  // loop until shut down, the callbacks of ROS between the reads
+  while (ros::ok() && flag == 1 && dvr.poll(100))
+  {
+    ros::spinOnce();
+  }
+
+  return 0;
+}
@@ -15,14 +15,70 @@
  *
  */
 #include "rawdata.h"
+#include <cstring>
+#include <limits>
+#include <thread_config/thread_config.h>
 
 namespace rslidar_rawdata
 {
+namespace
+{
+/// a difop packet processed by the device status thread of a RawData
+class DifopCallback : public ros::CallbackInterface
+{
+public:
+  DifopCallback(RawData* data, const rslidar_msgs::rslidarPacket::ConstPtr& difop_msg)
+    : data_(data), difop_msg_(difop_msg)
+  {
+  }
+
+  virtual CallResult call()
+  {
+    data_->processDifop(difop_msg_);
+    return Success;
+  }
+
+private:
+  RawData* data_;
+  rslidar_msgs::rslidarPacket::ConstPtr difop_msg_;
+};
+}
+
 RawData::RawData()
+  : calibration_(NULL)
+  , adopted_generation_(0)
+  , adopted_(NULL)
+  , published_(NULL)
+  , status_running_(false)
+  , temperature_(0.0f)
+  , temperature_fresh_(false)
 {
   this->is_init_angle_ = false;
   this->is_init_curve_ = false;
   this->is_init_top_fw_ = false;
+  this->calibrate_intensity_ = true;
+  this->received_temperature_ = TEMPERATURE_MIN - 1;
+  this->reference_size_ = 0;
+  this->reference_stale_ = true;
+}
+
+RawData::~RawData()
+{
+  status_running_ = false;
+  if (status_thread_)
+  {
+    status_thread_->join();
+  }
+  difop_sub_.shutdown();
+  temperature_timer_.stop();
+  status_queue_.clear();
+  delete published_;
+  for (size_t i = 0; i < retired_.size(); i++)
+  {
+    delete retired_[i];
+  }
+  this->cos_lookup_table_.clear();
+  this->sin_lookup_table_.clear();
 }
 
 void RawData::loadConfigFile(ros::NodeHandle node, ros::NodeHandle private_nh)
@@ -68,11 +124,18 @@ void RawData::loadConfigFile(ros::NodeHandle node, ros::NodeHandle private_nh)
 
   ROS_INFO_STREAM("[cloud][rawdata] distance threshlod, max: " << max_distance_ << " m, min: " << min_distance_
                                                                << " m");
+  private_nh.param("max_z", max_z_, std::numeric_limits<float>::infinity());
+  private_nh.param("min_z", min_z_, -std::numeric_limits<float>::infinity());
+  if (max_z_ < std::numeric_limits<float>::infinity() || min_z_ > -std::numeric_limits<float>::infinity())
+  {
+    ROS_INFO_STREAM("[cloud][rawdata] height band, max: " << max_z_ << " m, min: " << min_z_ << " m");
+  }
 
   intensity_mode_ = 3;
   info_print_flag_ = false;
   private_nh.param("resolution_type", resolution_param, std::string("0.5cm"));
   private_nh.param("intensity_mode", intensity_mode_, 1);
+  private_nh.param("calibrate_intensity", calibrate_intensity_, true);
 
   if (resolution_param == "0.5cm")
   {
@@ -85,6 +148,10 @@ void RawData::loadConfigFile(ros::NodeHandle node, ros::NodeHandle private_nh)
 
   ROS_INFO_STREAM("[cloud][rawdata] initialize resolution type: " << (dis_resolution_mode_ ? "1 cm" : "0.5 cm")
                                                                   << ", intensity mode: " << intensity_mode_);
+  if (!calibrate_intensity_)
+  {
+    ROS_INFO_STREAM("[cloud][rawdata] intensity calibration skipped, the raw intensities are published");
+  }
 
   if (model == "RS16")
   {
@@ -204,6 +271,7 @@ void RawData::loadConfigFile(ros::NodeHandle node, ros::NodeHandle private_nh)
       // ROS_INFO_STREAM("new is " << a[0]);
     }
     fclose(f_inten);
+    reference_stale_ = true;
   }
   //=============================================================
   FILE* f_angle = fopen(anglePath.c_str(), "r");
@@ -310,17 +378,76 @@ void RawData::loadConfigFile(ros::NodeHandle node, ros::NodeHandle private_nh)
     }
   }
 
-  // receive difop data
+  // the calibration of the files, the first one the decoder adopts
+  Calibration* calibration = new Calibration;
+  captureCalibration(*calibration);
+  calibration->generation = 0;
+  published_ = calibration;
+  adopted_ = calibration;
+  calibration_.store(calibration, std::memory_order_release);
+
+  // receive difop data, in the device status thread
   // subscribe to difop rslidar packets, if not right correct data in difop, it will not revise the correct data in the
   // VERT_ANGLE, HORI_ANGLE etc.
-  difop_sub_ = node.subscribe("rslidar_packets_difop", 10, &RawData::processDifop, (RawData*)this);
+  ros::NodeHandle status_nh(node);
+  status_nh.setCallbackQueue(&status_queue_);
+  difop_sub_ = status_nh.subscribe("rslidar_packets_difop", 10, &RawData::processDifop, (RawData*)this);
   temperature_pub_ = node.advertise<std_msgs::Float32>("temperature", 10);
+  // about as often as the decoder reads the temperature from the packets
+  temperature_timer_ = status_nh.createWallTimer(ros::WallDuration(0.1), &RawData::publishTemperature, this);
+  status_running_ = true;
+  status_thread_.reset(new boost::thread(boost::bind(&RawData::statusLoop, this, private_nh)));
+}
+
+/** @brief the device status thread, of the difop packets and of the temperature
+ *
+ *  Named device_status for thread_config, of its CPUs and scheduling, left
+ *  as it was created by default, below those of a decoder of real-time
+ *  priority.
+ */
+void RawData::statusLoop(ros::NodeHandle private_nh)
+{
+  thread_config::configure(private_nh, "device_status");
+  while (status_running_ && ros::ok())
+  {
+    status_queue_.callAvailable(ros::WallDuration(0.1));
+  }
 }
 
+void RawData::postDifop(const rslidar_msgs::rslidarPacket::ConstPtr& difop_msg)
+{
+  status_queue_.addCallback(boost::make_shared<DifopCallback>(this, difop_msg));
+}
+
+/** @brief the last temperature the decoder read, if it read one since the last call */
+void RawData::publishTemperature(const ros::WallTimerEvent& event)
+{
+  if (temperature_fresh_.exchange(false, std::memory_order_relaxed))
+  {
+    std_msgs::Float32 temperature_msgs;
+    temperature_msgs.data = temperature_.load(std::memory_order_relaxed);
+    temperature_pub_.publish(temperature_msgs);
+  }
+}
+
+/** @brief the calibration of a difop packet, published for the decoder if it changed */
 void RawData::processDifop(const rslidar_msgs::rslidarPacket::ConstPtr& difop_msg)
+{
+  if (published_ == NULL)
+  {
+    return;  // no calibration files loaded
+  }
+  Calibration next = *published_;
+  parseDifop(&difop_msg->data[0], next);
+  if (!sameCalibration(next, *published_))
+  {
+    publishCalibration(next);
+  }
+}
+
+void RawData::parseDifop(const uint8_t* data, Calibration& next)
 {
   // std::cout << "Enter difop callback!" << std::endl;
-  const uint8_t* data = &difop_msg->data[0];
   bool is_support_dual_return = false;
 
   // check header
@@ -337,17 +464,17 @@ void RawData::processDifop(const rslidar_msgs::rslidarPacket::ConstPtr& difop_ms
     is_support_dual_return = true;
     if (data[300] == 0x01 || data[300] == 0x02)
     {
-      return_mode_ = data[300];
+      next.return_mode_ = data[300];
     }
     else
     {
-      return_mode_ = 0;
+      next.return_mode_ = 0;
     }
   }
   else
   {
     is_support_dual_return = false;
-    return_mode_ = 1;
+    next.return_mode_ = 1;
   }
   //
   if (!this->is_init_top_fw_)
@@ -357,12 +484,12 @@ void RawData::processDifop(const rslidar_msgs::rslidarPacket::ConstPtr& difop_ms
         (data[41] == 0x55 && data[42] == 0xaa && data[43] == 0x5a) ||
         (data[41] == 0xe9 && data[42] == 0x01 && data[43] == 0x00))
     {
-      dis_resolution_mode_ = 1;  // 1cm resolution
+      next.dis_resolution_mode_ = 1;  // 1cm resolution
       // std::cout << "The distance resolution is 1cm" << std::endl;
     }
     else
     {
-      dis_resolution_mode_ = 0;  // 0.5cm resolution
+      next.dis_resolution_mode_ = 0;  // 0.5cm resolution
       // std::cout << "The distance resolution is 0.5cm" << std::endl;
     }
     this->is_init_top_fw_ = true;
@@ -402,47 +529,47 @@ void RawData::processDifop(const rslidar_msgs::rslidarPacket::ConstPtr& difop_ms
         // calculate curves' parameters
         bit1 = static_cast<int>(*(data + 50 + loopn * 15));
         bit2 = static_cast<int>(*(data + 50 + loopn * 15 + 1));
-        aIntensityCal[0][loopn] = (bit1 * 256 + bit2) * 0.001;
+        next.aIntensityCal[0][loopn] = (bit1 * 256 + bit2) * 0.001;
         bit1 = static_cast<int>(*(data + 50 + loopn * 15 + 2));
         bit2 = static_cast<int>(*(data + 50 + loopn * 15 + 3));
-        aIntensityCal[1][loopn] = (bit1 * 256 + bit2) * 0.001;
+        next.aIntensityCal[1][loopn] = (bit1 * 256 + bit2) * 0.001;
         bit1 = static_cast<int>(*(data + 50 + loopn * 15 + 4));
         bit2 = static_cast<int>(*(data + 50 + loopn * 15 + 5));
-        aIntensityCal[2][loopn] = (bit1 * 256 + bit2) * 0.001;
+        next.aIntensityCal[2][loopn] = (bit1 * 256 + bit2) * 0.001;
         bit1 = static_cast<int>(*(data + 50 + loopn * 15 + 6));
         bit2 = static_cast<int>(*(data + 50 + loopn * 15 + 7));
-        aIntensityCal[3][loopn] = (bit1 * 256 + bit2) * 0.001;
+        next.aIntensityCal[3][loopn] = (bit1 * 256 + bit2) * 0.001;
         bit1 = static_cast<int>(*(data + 50 + loopn * 15 + 8));
         bit2 = static_cast<int>(*(data + 50 + loopn * 15 + 9));
-        aIntensityCal[4][loopn] = (bit1 * 256 + bit2) * 0.00001;
+        next.aIntensityCal[4][loopn] = (bit1 * 256 + bit2) * 0.00001;
         bit1 = static_cast<int>(*(data + 50 + loopn * 15 + 10));
         bit2 = static_cast<int>(*(data + 50 + loopn * 15 + 11));
-        aIntensityCal[5][loopn] = -(bit1 * 256 + bit2) * 0.0001;
+        next.aIntensityCal[5][loopn] = -(bit1 * 256 + bit2) * 0.0001;
         bit1 = static_cast<int>(*(data + 50 + loopn * 15 + 12));
         bit2 = static_cast<int>(*(data + 50 + loopn * 15 + 13));
-        aIntensityCal[6][loopn] = (bit1 * 256 + bit2) * 0.001;
+        next.aIntensityCal[6][loopn] = (bit1 * 256 + bit2) * 0.001;
       }
       this->is_init_curve_ = true;
       ROS_INFO_STREAM("[cloud][rawdata] curves data is wrote in difop packet!");
-      Curvesis_new = true;
+      next.Curvesis_new = true;
     }
 
     if ((data[290] != 0x00) && (data[290] != 0xff))
     {
-      intensityFactor = static_cast<int>(*(data + 290));  // intensity factor introduced since than 20181115
+      next.intensityFactor = static_cast<int>(*(data + 290));  // intensity factor introduced since than 20181115
     }
 
     if ((data[291] == 0x00) || (data[291] == 0xff) || (data[291] == 0xa1))
     {
-      intensity_mode_ = 1;  // mode for the top firmware lower than T6R23V8(16) or T9R23V6(32)
+      next.intensity_mode_ = 1;  // mode for the top firmware lower than T6R23V8(16) or T9R23V6(32)
     }
     else if (data[291] == 0xb1)
     {
-      intensity_mode_ = 2;  // mode for the top firmware higher than T6R23V8(16) or T9R23V6(32)
+      next.intensity_mode_ = 2;  // mode for the top firmware higher than T6R23V8(16) or T9R23V6(32)
     }
     else if (data[291] == 0xc1)
     {
-      intensity_mode_ = 3;  // mode for the top firmware higher than T6R23V9
+      next.intensity_mode_ = 3;  // mode for the top firmware higher than T6R23V9
     }
     
   }
@@ -490,10 +617,10 @@ void RawData::processDifop(const rslidar_msgs::rslidarPacket::ConstPtr& difop_ms
             bit1 = static_cast<int>(*(data + 1165 + loopn * 3));
             bit2 = static_cast<int>(*(data + 1165 + loopn * 3 + 1));
             bit3 = static_cast<int>(*(data + 1165 + loopn * 3 + 2));
-            VERT_ANGLE[loopn] = (bit1 * 256 * 256 + bit2 * 256 + bit3) * symbolbit * 0.01f;
+            next.VERT_ANGLE[loopn] = (bit1 * 256 * 256 + bit2 * 256 + bit3) * symbolbit * 0.01f;
             // std::cout << VERT_ANGLE[loopn] << std::endl;
             // TODO
-            HORI_ANGLE[loopn] = 0;
+            next.HORI_ANGLE[loopn] = 0;
           }
         }
         else if (numOfLasers == 32)
@@ -509,9 +636,9 @@ void RawData::processDifop(const rslidar_msgs::rslidarPacket::ConstPtr& difop_ms
             bit2 = static_cast<int>(*(data + 468 + loopn * 3 + 1));
             bit3 = static_cast<int>(*(data + 468 + loopn * 3 + 2));
             if (isBpearlLidar_)
-              VERT_ANGLE[loopn] = (bit2 * 256 + bit3) * symbolbit * 0.01f * 100;
+              next.VERT_ANGLE[loopn] = (bit2 * 256 + bit3) * symbolbit * 0.01f * 100;
             else
-              VERT_ANGLE[loopn] = (bit2 * 256 + bit3) * symbolbit * 0.001f * 100;
+              next.VERT_ANGLE[loopn] = (bit2 * 256 + bit3) * symbolbit * 0.001f * 100;
             // horizontal offset angle
             bit1 = static_cast<int>(*(data + 564 + loopn * 3));
             if (bit1 == 0)
@@ -521,9 +648,9 @@ void RawData::processDifop(const rslidar_msgs::rslidarPacket::ConstPtr& difop_ms
             bit2 = static_cast<int>(*(data + 564 + loopn * 3 + 1));
             bit3 = static_cast<int>(*(data + 564 + loopn * 3 + 2));
             if (isBpearlLidar_)
-              HORI_ANGLE[loopn] = (bit2 * 256 + bit3) * symbolbit * 0.01f * 100;
+              next.HORI_ANGLE[loopn] = (bit2 * 256 + bit3) * symbolbit * 0.01f * 100;
             else
-              HORI_ANGLE[loopn] = (bit2 * 256 + bit3) * symbolbit * 0.001f * 100;
+              next.HORI_ANGLE[loopn] = (bit2 * 256 + bit3) * symbolbit * 0.001f * 100;
           }
         }
 
@@ -539,7 +666,7 @@ void RawData::processDifop(const rslidar_msgs::rslidarPacket::ConstPtr& difop_ms
 
     // print info
     float prin_dis;
-    if (dis_resolution_mode_ == 0)
+    if (next.dis_resolution_mode_ == 0)
     {
       prin_dis = 0.5;
     }
@@ -548,31 +675,102 @@ void RawData::processDifop(const rslidar_msgs::rslidarPacket::ConstPtr& difop_ms
       prin_dis = 1;
     }
     ROS_INFO_STREAM("[cloud][rawdata] distance resolution is: " << prin_dis << " cm, intensity mode is: Mode "
-                                                                << intensity_mode_);
+                                                                << next.intensity_mode_);
     if (is_support_dual_return == false)
     {
       ROS_INFO_STREAM("[cloud][rawdata] lidar only support single return wave!");
     }
     else
     {
-      if (return_mode_ == 0)
+      if (next.return_mode_ == 0)
       {
         ROS_INFO_STREAM("[cloud][rawdata] lidar support dual return wave, the current mode is: dual");
       }
-      else if (return_mode_ == 1)
+      else if (next.return_mode_ == 1)
       {
         ROS_INFO_STREAM("[cloud][rawdata] lidar support dual return wave, the current mode is: strongest");
       }
-      else if (return_mode_ == 2)
+      else if (next.return_mode_ == 2)
       {
         ROS_INFO_STREAM("[cloud][rawdata] lidar support dual return wave, the current mode is: last");
       }
     }
 
-    ROS_INFO_STREAM("[cloud][rawdata] difop intensity mode: "<<intensity_mode_);
+    ROS_INFO_STREAM("[cloud][rawdata] difop intensity mode: "<<next.intensity_mode_);
   }
 }
 
+/** @brief the calibration of the members, those of the files before the first difop packet */
+void RawData::captureCalibration(Calibration& calibration) const
+{
+  memcpy(calibration.VERT_ANGLE, VERT_ANGLE, sizeof(VERT_ANGLE));
+  memcpy(calibration.HORI_ANGLE, HORI_ANGLE, sizeof(HORI_ANGLE));
+  memcpy(calibration.aIntensityCal, aIntensityCal, sizeof(aIntensityCal));
+  calibration.Curvesis_new = Curvesis_new;
+  calibration.intensity_mode_ = intensity_mode_;
+  calibration.intensityFactor = intensityFactor;
+  calibration.dis_resolution_mode_ = dis_resolution_mode_;
+  calibration.return_mode_ = return_mode_;
+}
+
+/** @brief the calibration published into the members of the decoder, at a packet
+ *
+ *  The tables of the curves are rebuilt with the next prepareTerms.
+ */
+void RawData::adoptCalibration(const Calibration& calibration)
+{
+  memcpy(VERT_ANGLE, calibration.VERT_ANGLE, sizeof(VERT_ANGLE));
+  memcpy(HORI_ANGLE, calibration.HORI_ANGLE, sizeof(HORI_ANGLE));
+  memcpy(aIntensityCal, calibration.aIntensityCal, sizeof(aIntensityCal));
+  Curvesis_new = calibration.Curvesis_new;
+  intensity_mode_ = calibration.intensity_mode_;
+  intensityFactor = calibration.intensityFactor;
+  dis_resolution_mode_ = calibration.dis_resolution_mode_;
+  return_mode_ = calibration.return_mode_;
+  reference_stale_ = true;
+  adopted_ = &calibration;
+  adopted_generation_.store(calibration.generation, std::memory_order_release);
+}
+
+bool RawData::sameCalibration(const Calibration& a, const Calibration& b)
+{
+  return memcmp(a.VERT_ANGLE, b.VERT_ANGLE, sizeof(a.VERT_ANGLE)) == 0 &&
+         memcmp(a.HORI_ANGLE, b.HORI_ANGLE, sizeof(a.HORI_ANGLE)) == 0 &&
+         memcmp(a.aIntensityCal, b.aIntensityCal, sizeof(a.aIntensityCal)) == 0 && a.Curvesis_new == b.Curvesis_new &&
+         a.intensity_mode_ == b.intensity_mode_ && a.intensityFactor == b.intensityFactor &&
+         a.dis_resolution_mode_ == b.dis_resolution_mode_ && a.return_mode_ == b.return_mode_;
+}
+
+/** @brief a calibration swapped in for the decoder, of the device status thread
+ *
+ *  The decoder adopts a calibration at a packet, after it loaded a later
+ *  one than those it adopted before, so those older than the last one it
+ *  adopted are no longer read and are freed.
+ */
+void RawData::publishCalibration(const Calibration& next)
+{
+  Calibration* calibration = new Calibration(next);
+  calibration->generation = published_->generation + 1;
+  retired_.push_back(published_);
+  published_ = calibration;
+  calibration_.store(calibration, std::memory_order_release);
+
+  uint64_t adopted = adopted_generation_.load(std::memory_order_acquire);
+  size_t kept = 0;
+  for (size_t i = 0; i < retired_.size(); i++)
+  {
+    if (retired_[i]->generation < adopted)
+    {
+      delete retired_[i];
+    }
+    else
+    {
+      retired_[kept++] = retired_[i];
+    }
+  }
+  retired_.resize(kept);
+}
+
 float RawData::pixelToDistance(int pixelValue, int passageway)
 {
   float DistanceValue;
@@ -608,6 +806,12 @@ int RawData::correctAzimuth(float azimuth_f, int passageway)
 //------------------------------------------------------------
 //校准反射强度值
 float RawData::calibrateIntensity(float intensity, int calIdx, int distance)
+{
+  prepareTerms();
+  return calibrateIntensity(intensity, calIdx, distance, laser_terms_[calIdx]);
+}
+
+float RawData::calibrateIntensity(float intensity, int calIdx, int distance, const LaserTerms& laser)
 {
   if (intensity_mode_ == 3)
   {
@@ -615,126 +819,135 @@ float RawData::calibrateIntensity(float intensity, int calIdx, int distance)
   }
   else
   {
-    int algDist;
-    int sDist;
-    float realPwr;
-    float refPwr;
-    float tempInten;
-    float distance_f;
-    float endOfSection1, endOfSection2;
-    int temp = estimateTemperature(temper);
-
-    realPwr = std::max((float)(intensity / (1 + (temp - TEMPERATURE_MIN) / 24.0f)), 1.0f);
-
-    if (intensity_mode_ == 1)
-    {
-      // transform the one byte intensity value to two byte
-      if ((int)realPwr < 126)
-        realPwr = realPwr * 4.0f;
-      else if ((int)realPwr >= 126 && (int)realPwr < 226)
-        realPwr = (realPwr - 125.0f) * 16.0f + 500.0f;
-      else
-        realPwr = (realPwr - 225.0f) * 256.0f + 2100.0f;
-    }
-    else if (intensity_mode_ == 2)
-    {
-      // the caculation for the firmware after T6R23V8(16) and T9R23V6(32)
-      if ((int)realPwr < 64)
-        realPwr = realPwr;
-      else if ((int)realPwr >= 64 && (int)realPwr < 176)
-        realPwr = (realPwr - 64.0f) * 4.0f + 64.0f;
-      else
-        realPwr = (realPwr - 176.0f) * 16.0f + 512.0f;
-    }
-    else
+    if (intensity_mode_ != 1 && intensity_mode_ != 2)
     {
       ROS_WARN("[cloud][rawdata] The intensity mode is not right");
     }
-
-    int indexTemper = estimateTemperature(temper) - TEMPERATURE_MIN;
+    float realPwr = receivedPower(intensity, intensity_mode_);
 
     // limit sDist
-    sDist = (distance > g_ChannelNum[calIdx][indexTemper]) ? distance : g_ChannelNum[calIdx][indexTemper];
+    int sDist = (distance > laser.channel) ? distance : laser.channel;
 
     // minus the static offset (this data is For the intensity cal useage only)
-    algDist = sDist - g_ChannelNum[calIdx][indexTemper];
-    if (dis_resolution_mode_ == 0)
+    int algDist = sDist - laser.channel;
+    float refPwr = referencePower(calIdx, algDist, intensity_mode_, laser);
+
+    float tempInten = (intensityFactor * refPwr) / realPwr;
+    if (numOfLasers == 32)
     {
-      distance_f = (float)algDist * DISTANCE_RESOLUTION_NEW;
+      tempInten = tempInten * CurvesRate[calIdx];
     }
+    tempInten = (int)tempInten > 255 ? 255.0f : tempInten;
+    return tempInten;
+  }
+}
+
+/** @brief the received power of a raw intensity at the temperature of the packet
+ *
+ *  @param mode the intensity mode of its transform to two bytes, 1 or 2,
+ *         untransformed for the others
+ */
+float RawData::receivedPower(float intensity, int mode)
+{
+  float realPwr = std::max((float)(intensity / temper_gain_), 1.0f);
+
+  if (mode == 1)
+  {
+    // transform the one byte intensity value to two byte
+    if ((int)realPwr < 126)
+      realPwr = realPwr * 4.0f;
+    else if ((int)realPwr >= 126 && (int)realPwr < 226)
+      realPwr = (realPwr - 125.0f) * 16.0f + 500.0f;
     else
-    {
-      distance_f = (float)algDist * DISTANCE_RESOLUTION;
-    }
-    distance_f = (distance_f > this->max_distance_) ? this->max_distance_ : distance_f;
+      realPwr = (realPwr - 225.0f) * 256.0f + 2100.0f;
+  }
+  else if (mode == 2)
+  {
+    // the caculation for the firmware after T6R23V8(16) and T9R23V6(32)
+    if ((int)realPwr < 64)
+      realPwr = realPwr;
+    else if ((int)realPwr >= 64 && (int)realPwr < 176)
+      realPwr = (realPwr - 64.0f) * 4.0f + 64.0f;
+    else
+      realPwr = (realPwr - 176.0f) * 16.0f + 512.0f;
+  }
+  return realPwr;
+}
 
-    // calculate intensity ref curves
-    float refPwr_temp = 0.0f;
-    int order = 3;
-    endOfSection1 = 5.0f;
-    endOfSection2 = 40.0;
+/** @brief the reference power of the intensity curves of a laser
+ *
+ *  @param algDist the distance less the static offset of the laser
+ *  @param mode the intensity mode of the curves, 1 or 2, 4 for the others
+ */
+float RawData::referencePower(int calIdx, int algDist, int mode, const LaserTerms& laser)
+{
+  float distance_f;
+  if (dis_resolution_mode_ == 0)
+  {
+    distance_f = (float)algDist * DISTANCE_RESOLUTION_NEW;
+  }
+  else
+  {
+    distance_f = (float)algDist * DISTANCE_RESOLUTION;
+  }
+  distance_f = (distance_f > this->max_distance_) ? this->max_distance_ : distance_f;
+
+  // calculate intensity ref curves, the polynomial of order 3 with the
+  // powers of distance_f exact in double, as those of pow
+  float refPwr_temp = 0.0f;
+  double distance_d = distance_f;
+  float endOfSection1 = 5.0f;
+  float endOfSection2 = 40.0;
 
-    if (intensity_mode_ == 1)
+  if (mode == 1)
+  {
+    if (distance_f <= endOfSection1)
     {
-      if (distance_f <= endOfSection1)
-      {
-        refPwr_temp = aIntensityCal[0][calIdx] * exp(aIntensityCal[1][calIdx] - aIntensityCal[2][calIdx] * distance_f) +
-                      aIntensityCal[3][calIdx];
-      }
-      else
-      {
-        for (int i = 0; i < order; i++)
-        {
-          refPwr_temp += aIntensityCal[i + 4][calIdx] * (pow(distance_f, order - 1 - i));
-        }
-      }
+      refPwr_temp = aIntensityCal[0][calIdx] * exp(aIntensityCal[1][calIdx] - aIntensityCal[2][calIdx] * distance_f) +
+                    aIntensityCal[3][calIdx];
     }
-    else if (intensity_mode_ == 2)
+    else
     {
-      if (distance_f <= endOfSection1)
-      {
-        refPwr_temp = aIntensityCal[0][calIdx] * exp(aIntensityCal[1][calIdx] - aIntensityCal[2][calIdx] * distance_f) +
-                      aIntensityCal[3][calIdx];
-      }
-      else if (distance_f > endOfSection1 && distance_f <= endOfSection2)
-      {
-        for (int i = 0; i < order; i++)
-        {
-          refPwr_temp += aIntensityCal[i + 4][calIdx] * (pow(distance_f, order - 1 - i));
-        }
-      }
-      else
-      {
-        float refPwr_temp0 = 0.0f;
-        float refPwr_temp1 = 0.0f;
-        for (int i = 0; i < order; i++)
-        {
-          refPwr_temp0 += aIntensityCal[i + 4][calIdx] * (pow(40.0f, order - 1 - i));
-          refPwr_temp1 += aIntensityCal[i + 4][calIdx] * (pow(39.0f, order - 1 - i));
-        }
-        refPwr_temp = 0.3f * (refPwr_temp0 - refPwr_temp1) * distance_f + refPwr_temp0;
-      }
+      refPwr_temp += aIntensityCal[4][calIdx] * (distance_d * distance_d);
+      refPwr_temp += aIntensityCal[5][calIdx] * distance_d;
+      refPwr_temp += aIntensityCal[6][calIdx] * 1.0;
     }
-    else
+  }
+  else if (mode == 2)
+  {
+    if (distance_f <= endOfSection1)
     {
-      ROS_WARN("[cloud][rawdata] The intensity mode is not right");
+      refPwr_temp = aIntensityCal[0][calIdx] * exp(aIntensityCal[1][calIdx] - aIntensityCal[2][calIdx] * distance_f) +
+                    aIntensityCal[3][calIdx];
     }
-
-    refPwr = std::max(std::min(refPwr_temp, 500.0f), 4.0f);
-
-    tempInten = (intensityFactor * refPwr) / realPwr;
-    if (numOfLasers == 32)
+    else if (distance_f > endOfSection1 && distance_f <= endOfSection2)
     {
-      tempInten = tempInten * CurvesRate[calIdx];
+      refPwr_temp += aIntensityCal[4][calIdx] * (distance_d * distance_d);
+      refPwr_temp += aIntensityCal[5][calIdx] * distance_d;
+      refPwr_temp += aIntensityCal[6][calIdx] * 1.0;
     }
-    tempInten = (int)tempInten > 255 ? 255.0f : tempInten;
-    return tempInten;
+    else
+    {
+      refPwr_temp = 0.3f * laser.far_slope * distance_f + laser.far_base;
+    }
+  }
+  else
+  {
+    ROS_WARN("[cloud][rawdata] The intensity mode is not right");
   }
+
+  return std::max(std::min(refPwr_temp, 500.0f), 4.0f);
 }
 
 //------------------------------------------------------------
 //校准反射强度值 old
 float RawData::calibrateIntensity_old(float intensity, int calIdx, int distance)
+{
+  prepareTerms();
+  return calibrateIntensity_old(intensity, calIdx, distance, laser_terms_[calIdx]);
+}
+
+float RawData::calibrateIntensity_old(float intensity, int calIdx, int distance, const LaserTerms& laser)
 {
   int algDist;
   int sDist;
@@ -743,8 +956,7 @@ float RawData::calibrateIntensity_old(float intensity, int calIdx, int distance)
   float refPwr;
   float tempInten;
 
-  int temp = estimateTemperature(temper);
-  realPwr = std::max((float)(intensity / (1 + (temp - TEMPERATURE_MIN) / 24.0f)), 1.0f);
+  realPwr = std::max((float)(intensity / temper_gain_), 1.0f);
   // realPwr = intensity;
 
   if ((int)realPwr < 126)
@@ -754,12 +966,11 @@ float RawData::calibrateIntensity_old(float intensity, int calIdx, int distance)
   else
     realPwr = (realPwr - 225.0f) * 256.0f + 2100.0f;
 
-  int indexTemper = estimateTemperature(temper) - TEMPERATURE_MIN;
-  uplimitDist = g_ChannelNum[calIdx][indexTemper] + 1400;
-  sDist = (distance > g_ChannelNum[calIdx][indexTemper]) ? distance : g_ChannelNum[calIdx][indexTemper];
+  uplimitDist = laser.channel + 1400;
+  sDist = (distance > laser.channel) ? distance : laser.channel;
   sDist = (sDist < uplimitDist) ? sDist : uplimitDist;
   // minus the static offset (this data is For the intensity cal useage only)
-  algDist = sDist - g_ChannelNum[calIdx][indexTemper];
+  algDist = sDist - laser.channel;
   // algDist = algDist < 1400? algDist : 1399;
   refPwr = aIntensityCal_old[algDist][calIdx];
 
@@ -823,12 +1034,385 @@ int RawData::estimateTemperature(float Temper)
 }
 //------------------------------------------------------------
 
+/** @brief the terms of the lasers which are the same for all the returns of a packet
+ *
+ *  Evaluated once per packet, as the temperature changes with the packets
+ *  and the calibration with the difop packets.
+ */
+void RawData::prepareTerms()
+{
+  int temp = estimateTemperature(temper);
+  int indexTemper = temp - TEMPERATURE_MIN;
+  temper_gain_ = 1 + (temp - TEMPERATURE_MIN) / 24.0f;
+  for (int dsr = 0; dsr < numOfLasers; dsr++)
+  {
+    LaserTerms& laser = laser_terms_[dsr];
+    laser.channel = g_ChannelNum[dsr][indexTemper];
+    int arg_vert = ((VERT_ANGLE[dsr]) % 36000 + 36000) % 36000;
+    laser.cos_vert = this->cos_lookup_table_[arg_vert];
+    laser.sin_vert = this->sin_lookup_table_[arg_vert];
+
+    // the reference power at 40 and 39 m, of the polynomial with the powers
+    // of pow(40.0f, 2 - i) and pow(39.0f, 2 - i)
+    float refPwr_temp0 = 0.0f;
+    float refPwr_temp1 = 0.0f;
+    refPwr_temp0 += aIntensityCal[4][dsr] * 1600.0;
+    refPwr_temp1 += aIntensityCal[4][dsr] * 1521.0;
+    refPwr_temp0 += aIntensityCal[5][dsr] * 40.0;
+    refPwr_temp1 += aIntensityCal[5][dsr] * 39.0;
+    refPwr_temp0 += aIntensityCal[6][dsr] * 1.0;
+    refPwr_temp1 += aIntensityCal[6][dsr] * 1.0;
+    laser.far_base = refPwr_temp0;
+    laser.far_slope = refPwr_temp0 - refPwr_temp1;
+  }
+  prepareIntensityTables();
+}
+
+/** @brief the intensity tables of the temperature bin and the calibration
+ *
+ *  The received power only depends on the raw intensity at the temperature
+ *  bin, and the reference power on the laser and the distance less its
+ *  static offset, so that the calibration of a return is a division of two
+ *  lookups. The received powers are rebuilt when the bin changes, and the
+ *  reference powers up to max_distance_ when the curves or the intensity
+ *  mode, resolution or factor of the difop packets do.
+ */
+void RawData::prepareIntensityTables()
+{
+  int temp = estimateTemperature(temper);
+  if (temp != received_temperature_)
+  {
+    for (int i = 0; i < 256; i++)
+    {
+      received_power_[0][i] = receivedPower(i, 1);
+      received_power_[1][i] = receivedPower(i, 2);
+    }
+    received_temperature_ = temp;
+  }
+
+  if (!calibrate_intensity_ || (intensity_mode_ != 1 && intensity_mode_ != 2) || (numOfLasers == 16 && !Curvesis_new) ||
+      (!reference_stale_ && reference_mode_ == intensity_mode_ && reference_resolution_ == dis_resolution_mode_ &&
+       reference_factor_ == intensityFactor))
+  {
+    return;
+  }
+  const float resolution = dis_resolution_mode_ == 0 ? DISTANCE_RESOLUTION_NEW : DISTANCE_RESOLUTION;
+  int last = 0;  // the first distance converted beyond max_distance_, of the same power as all the further ones
+  while (last < 65535 && (float)last * resolution <= max_distance_)
+  {
+    last++;
+  }
+  reference_size_ = last + 1;
+  reference_power_.resize(numOfLasers * reference_size_);
+  for (int dsr = 0; dsr < numOfLasers; dsr++)
+  {
+    for (int algDist = 0; algDist <= last; algDist++)
+    {
+      reference_power_[dsr * reference_size_ + algDist] =
+          intensityFactor * referencePower(dsr, algDist, intensity_mode_, laser_terms_[dsr]);
+    }
+  }
+  reference_mode_ = intensity_mode_;
+  reference_resolution_ = dis_resolution_mode_;
+  reference_factor_ = intensityFactor;
+  reference_stale_ = false;
+}
+
+/** @brief the calibrated intensity of a return of a block kernel */
+template <RawData::IntensityCalibration Intensity>
+inline float RawData::blockIntensity(uint8_t intensity, int calIdx, int distance, const LaserTerms& laser)
+{
+  if (Intensity == INTENSITY_RAW)
+  {
+    return intensity;
+  }
+  if (Intensity == INTENSITY_CURVES)
+  {
+    return calibrateIntensity(intensity, calIdx, distance, laser);
+  }
+
+  // minus the static offset, as calibrateIntensity and calibrateIntensity_old
+  int algDist = std::max(distance, laser.channel) - laser.channel;
+  float tempInten;
+  if (Intensity == INTENSITY_OLD)
+  {
+    tempInten = (51 * aIntensityCal_old[std::min(algDist, 1400)][calIdx]) / received_power_[0][intensity];
+  }
+  else
+  {
+    tempInten = reference_power_[calIdx * reference_size_ + std::min(algDist, reference_size_ - 1)] /
+                received_power_[intensity_mode_ - 1][intensity];
+  }
+  if (numOfLasers == 32)
+  {
+    tempInten = tempInten * CurvesRate[calIdx];
+  }
+  tempInten = (int)tempInten > 255 ? 255.0f : tempInten;
+  return tempInten;
+}
+
+/** @brief the block kernel of the model and of the modes of the last difop packet
+ *
+ *  The modes and the intensity calibration are template parameters of the
+ *  kernels, so that theirs are the loops over the returns without the
+ *  branches on them.
+ *
+ *  @param compact the kernel of unpackCompact
+ */
+RawData::BlockKernel RawData::selectKernel(bool compact) const
+{
+  IntensityCalibration intensity;
+  if (!calibrate_intensity_ || (intensity_mode_ == 3 && (numOfLasers == 32 || Curvesis_new)))
+  {
+    intensity = INTENSITY_RAW;
+  }
+  else if (numOfLasers == 16 && !Curvesis_new)
+  {
+    intensity = INTENSITY_OLD;
+  }
+  else if (intensity_mode_ == 1 || intensity_mode_ == 2)
+  {
+    intensity = INTENSITY_TABLES;
+  }
+  else
+  {
+    intensity = INTENSITY_CURVES;
+  }
+
+  if (numOfLasers == 32)
+  {
+    static const BlockKernel rs32[2][2][4] = {
+      {
+        { &RawData::unpackBlockRS32<false, INTENSITY_RAW, false>,
+          &RawData::unpackBlockRS32<false, INTENSITY_TABLES, false>,
+          &RawData::unpackBlockRS32<false, INTENSITY_OLD, false>,
+          &RawData::unpackBlockRS32<false, INTENSITY_CURVES, false> },
+        { &RawData::unpackBlockRS32<true, INTENSITY_RAW, false>,
+          &RawData::unpackBlockRS32<true, INTENSITY_TABLES, false>,
+          &RawData::unpackBlockRS32<true, INTENSITY_OLD, false>,
+          &RawData::unpackBlockRS32<true, INTENSITY_CURVES, false> }
+      },
+      {
+        { &RawData::unpackBlockRS32<false, INTENSITY_RAW, true>,
+          &RawData::unpackBlockRS32<false, INTENSITY_TABLES, true>,
+          &RawData::unpackBlockRS32<false, INTENSITY_OLD, true>,
+          &RawData::unpackBlockRS32<false, INTENSITY_CURVES, true> },
+        { &RawData::unpackBlockRS32<true, INTENSITY_RAW, true>,
+          &RawData::unpackBlockRS32<true, INTENSITY_TABLES, true>,
+          &RawData::unpackBlockRS32<true, INTENSITY_OLD, true>,
+          &RawData::unpackBlockRS32<true, INTENSITY_CURVES, true> }
+      }
+    };
+    return rs32[compact][dis_resolution_mode_ != 0][intensity];
+  }
+  static const BlockKernel rs16[2][2][4] = {
+    {
+      { &RawData::unpackBlockRS16<false, INTENSITY_RAW, false>,
+        &RawData::unpackBlockRS16<false, INTENSITY_TABLES, false>,
+        &RawData::unpackBlockRS16<false, INTENSITY_OLD, false>,
+        &RawData::unpackBlockRS16<false, INTENSITY_CURVES, false> },
+      { &RawData::unpackBlockRS16<true, INTENSITY_RAW, false>,
+        &RawData::unpackBlockRS16<true, INTENSITY_TABLES, false>,
+        &RawData::unpackBlockRS16<true, INTENSITY_OLD, false>,
+        &RawData::unpackBlockRS16<true, INTENSITY_CURVES, false> }
+    },
+    {
+      { &RawData::unpackBlockRS16<false, INTENSITY_RAW, true>,
+        &RawData::unpackBlockRS16<false, INTENSITY_TABLES, true>,
+        &RawData::unpackBlockRS16<false, INTENSITY_OLD, true>,
+        &RawData::unpackBlockRS16<false, INTENSITY_CURVES, true> },
+      { &RawData::unpackBlockRS16<true, INTENSITY_RAW, true>,
+        &RawData::unpackBlockRS16<true, INTENSITY_TABLES, true>,
+        &RawData::unpackBlockRS16<true, INTENSITY_OLD, true>,
+        &RawData::unpackBlockRS16<true, INTENSITY_CURVES, true> }
+    }
+  };
+  return rs16[compact][0 == return_mode_][intensity];
+}
+
+/** @brief decode the 32 returns of a RS16 block, its two firings of the 16 lasers
+ *
+ *  One pass over the returns without a branch on the modes, nor on the
+ *  validity of the returns, whose points are computed all the same and then
+ *  replaced when out of the distance range, of the height band or of the
+ *  angle window.
+ *
+ *  Compact, the returns out of them are skipped instead, before their x, y
+ *  and intensity, and the others appended at compact_size.
+ *
+ *  @tparam Dual the dual return mode, whose two firings are of the same time
+ *  @tparam Intensity the intensity calibration, c.f. selectKernel
+ *  @tparam Compact the points of the crop only, c.f. unpackCompact
+ */
+template <bool Dual, RawData::IntensityCalibration Intensity, bool Compact>
+void RawData::unpackBlockRS16(const raw_block_t& block, float azimuth, float azimuth_diff, pcl::PointXYZI* points,
+                              int width)
+{
+  const float resolution = dis_resolution_mode_ == 0 ? DISTANCE_RESOLUTION_NEW : DISTANCE_RESOLUTION;
+  const int bounds = angle_flag_ ? 2 : 1;  // of the angle window met, both or either when it wraps around
+
+  for (int i = 0; i < RS16_FIRINGS_PER_BLOCK * RS16_SCANS_PER_FIRING; i++)
+  {
+    int firing = i / RS16_SCANS_PER_FIRING;
+    int dsr = i % RS16_SCANS_PER_FIRING;
+    const uint8_t* data = &block.data[RAW_SCAN_SIZE * i];
+    const LaserTerms& laser = laser_terms_[dsr];
+
+    float azimuth_corrected_f;
+    if (Dual)
+    {
+      azimuth_corrected_f = azimuth + (azimuth_diff * (dsr * RS16_DSR_TOFFSET)) / RS16_FIRING_TOFFSET;
+    }
+    else
+    {
+      azimuth_corrected_f =
+          azimuth + (azimuth_diff * ((dsr * RS16_DSR_TOFFSET) + (firing * RS16_FIRING_TOFFSET)) / RS16_BLOCK_TDURATION);
+    }
+    // round() of the azimuth, never negative
+    int arg_horiz = (int)azimuth_corrected_f;
+    arg_horiz += (azimuth_corrected_f - arg_horiz) >= 0.5f;
+    arg_horiz %= 36000;
+
+    // pixelToDistance at the temperature of the packet
+    int distance = 256 * data[0] + data[1];  // big endian
+    float distance2 = (distance <= laser.channel ? 0.0f : (float)(distance - laser.channel)) * resolution;
+
+    float z = distance2 * laser.sin_vert + Rz_;
+    bool valid = distance2 <= max_distance_ && distance2 >= min_distance_ && z <= max_z_ && z >= min_z_ &&
+                 (arg_horiz >= start_angle_) + (arg_horiz <= end_angle_) >= bounds;
+    if (Compact && !valid)
+    {
+      continue;
+    }
+
+    const double cos_horiz = this->cos_lookup_table_[arg_horiz];
+    const double sin_horiz = this->sin_lookup_table_[arg_horiz];
+    float x = distance2 * laser.cos_vert * cos_horiz + Rx_ * cos_horiz;
+    float y = -distance2 * laser.cos_vert * sin_horiz - Rx_ * sin_horiz;
+
+    pcl::PointXYZI point;
+    point.x = valid ? x : NAN;
+    point.y = valid ? y : NAN;
+    point.z = valid ? z : NAN;
+    point.intensity = valid ? blockIntensity<Intensity>(data[2], dsr, distance, laser) : 0.0f;
+    if (Compact)
+    {
+      points[this->compact_size++] = point;
+    }
+    else
+    {
+      points[dsr * width + 2 * this->block_num + firing] = point;
+    }
+  }
+}
+
+/** @brief decode the 32 returns of a RS32 block, c.f. unpackBlockRS16
+ *
+ *  @tparam ABPackets the 1 cm resolution, of the distances flagged for the
+ *          blocks of the B packets, whose returns of the two banks of lasers
+ *          are swapped
+ *  @tparam Intensity the intensity calibration, c.f. selectKernel
+ *  @tparam Compact the points of the crop only, c.f. unpackCompact
+ */
+template <bool ABPackets, RawData::IntensityCalibration Intensity, bool Compact>
+void RawData::unpackBlockRS32(const raw_block_t& block, float azimuth, float azimuth_diff, pcl::PointXYZI* points,
+                              int width)
+{
+  const int RETURNS = RS32_SCANS_PER_FIRING * RS32_FIRINGS_PER_BLOCK;  // 32
+  const float resolution = ABPackets ? DISTANCE_RESOLUTION : DISTANCE_RESOLUTION_NEW;
+  const int bounds = angle_flag_ ? 2 : 1;  // of the angle window met, both or either when it wraps around
+
+  int swap = 0;  // the returns of a B block, of the lasers 16 to 31 first
+  if (ABPackets && isABPacket(256 * block.data[0] + block.data[1]))
+  {
+    swap = RETURNS / 2;
+  }
+
+  for (int dsr = 0; dsr < RETURNS; dsr++)
+  {
+    const uint8_t* data = &block.data[RAW_SCAN_SIZE * ((dsr + swap) % RETURNS)];
+    const LaserTerms& laser = laser_terms_[dsr];
+
+    int dsr_temp = dsr % 16;
+    float azimuth_corrected_f = azimuth + (azimuth_diff * ((dsr_temp * RS32_DSR_TOFFSET)) / RS32_BLOCK_TDURATION);
+    int arg_horiz = correctAzimuth(azimuth_corrected_f, dsr);
+    int arg_horiz_orginal = (int)azimuth_corrected_f % 36000;
+
+    int distance = 256 * data[0] + data[1];  // big endian
+    if (ABPackets)
+    {
+      distance &= 32767;  // without the AB flag
+    }
+    float distance2 = (distance <= laser.channel ? 0.0f : (float)(distance - laser.channel)) * resolution;
+
+    float z = distance2 * laser.sin_vert + Rz_;
+    bool valid = distance2 <= max_distance_ && distance2 >= min_distance_ && z <= max_z_ && z >= min_z_ &&
+                 (arg_horiz >= start_angle_) + (arg_horiz <= end_angle_) >= bounds;
+    if (Compact && !valid)
+    {
+      continue;
+    }
+
+    float x = distance2 * laser.cos_vert * this->cos_lookup_table_[arg_horiz] +
+              Rx_ * this->cos_lookup_table_[arg_horiz_orginal];
+    float y = -distance2 * laser.cos_vert * this->sin_lookup_table_[arg_horiz] -
+              Rx_ * this->sin_lookup_table_[arg_horiz_orginal];
+
+    pcl::PointXYZI point;
+    point.x = valid ? x : NAN;
+    point.y = valid ? y : NAN;
+    point.z = valid ? z : NAN;
+    point.intensity = valid ? blockIntensity<Intensity>(data[2], dsr, distance, laser) : 0.0f;
+    if (Compact)
+    {
+      points[this->compact_size++] = point;
+    }
+    else
+    {
+      points[dsr * width + this->block_num] = point;
+    }
+  }
+}
+
 /** @brief convert raw packet to point cloud
  *
  *  @param pkt raw packet to unpack
  *  @param pc shared pointer to point cloud (points are appended)
  */
 void RawData::unpack(const rslidar_msgs::rslidarPacket& pkt, pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud)
+{
+  unpack(pkt, &pointcloud->points[0], pointcloud->width);
+}
+
+/** @brief convert raw packet to the points of an organized cloud
+ *
+ *  @param pkt raw packet to unpack
+ *  @param points the points row by row, as those of a pcl::PointCloud, or
+ *         the data of a PointCloud2 of the same layout
+ *  @param width the number of points in a row, large enough for the packets
+ *         until block_num is reset
+ */
+void RawData::unpack(const rslidar_msgs::rslidarPacket& pkt, pcl::PointXYZI* points, int width)
+{
+  unpackPacket(pkt, points, width, false);
+}
+
+/** @brief convert raw packet to the points of its returns in the crop
+ *
+ *  The returns out of the angle window, of the distance range or of the
+ *  height band are skipped, the others appended in the order of the blocks
+ *  and of the lasers, unorganized.
+ *
+ *  @param pkt raw packet to unpack
+ *  @param points the points, SCANS_PER_PACKET of them free from
+ *         compact_size, which is advanced past those written
+ */
+void RawData::unpackCompact(const rslidar_msgs::rslidarPacket& pkt, pcl::PointXYZI* points)
+{
+  unpackPacket(pkt, points, 0, true);
+}
+
+void RawData::unpackPacket(const rslidar_msgs::rslidarPacket& pkt, pcl::PointXYZI* points, int width, bool compact)
 {
   // check pkt header
   if (pkt.data[0] != 0x55 || pkt.data[1] != 0xAA || pkt.data[2] != 0x05 || pkt.data[3] != 0x0A)
@@ -836,16 +1420,20 @@ void RawData::unpack(const rslidar_msgs::rslidarPacket& pkt, pcl::PointCloud<pcl
     return;
   }
 
+  // the calibration of the last difop packets, swapped in between two packets
+  const Calibration* calibration = calibration_.load(std::memory_order_acquire);
+  if (calibration != adopted_)
+  {
+    adoptCalibration(*calibration);
+  }
+
   if (numOfLasers == 32)
   {
-    unpack_RS32(pkt, pointcloud);
+    unpack_RS32(pkt, points, width, compact);
     return;
   }
   float azimuth;  // 0.01 dgree
-  float intensity;
   float azimuth_diff;
-  float azimuth_corrected_f;
-  int azimuth_corrected;
 
   const raw_packet_t* raw = (const raw_packet_t*)&pkt.data[42];
 
@@ -857,10 +1445,12 @@ void RawData::unpack(const rslidar_msgs::rslidarPacket& pkt, pcl::PointCloud<pcl
   {
     temper = computeTemperature(pkt.data[38], pkt.data[39]);
     tempPacketNum = 1;
-    std_msgs::Float32 temperature_msgs;
-    temperature_msgs.data = temper;
-    temperature_pub_.publish(temperature_msgs);
+    // published by the device status thread
+    temperature_.store(temper, std::memory_order_relaxed);
+    temperature_fresh_.store(true, std::memory_order_relaxed);
   }
+  prepareTerms();
+  BlockKernel kernel = selectKernel(compact);
 
   for (int block = 0; block < BLOCKS_PER_PACKET; block++, this->block_num++)  // 1 packet:12 data blocks
   {
@@ -894,83 +1484,14 @@ void RawData::unpack(const rslidar_msgs::rslidarPacket& pkt, pcl::PointCloud<pcl
     }
     azimuth_diff = (float)(diff);
 
-    for (int firing = 0, k = 0; firing < RS16_FIRINGS_PER_BLOCK; firing++)  // 2
-    {
-      for (int dsr = 0; dsr < RS16_SCANS_PER_FIRING; dsr++, k += RAW_SCAN_SIZE)  // 16   3
-      {
-        if (0 == return_mode_)
-        {
-          azimuth_corrected_f = azimuth + (azimuth_diff * (dsr * RS16_DSR_TOFFSET)) / RS16_FIRING_TOFFSET;
-        }
-        else
-        {
-          azimuth_corrected_f = azimuth + (azimuth_diff * ((dsr * RS16_DSR_TOFFSET) + (firing * RS16_FIRING_TOFFSET)) /
-                                           RS16_BLOCK_TDURATION);
-        }
-        azimuth_corrected = ((int)round(azimuth_corrected_f)) % 36000;  // convert to integral value...
-
-        union two_bytes tmp;
-        tmp.bytes[1] = raw->blocks[block].data[k];
-        tmp.bytes[0] = raw->blocks[block].data[k + 1];
-        int distance = tmp.uint;
-
-        // read intensity
-        intensity = raw->blocks[block].data[k + 2];
-        if (Curvesis_new)
-          intensity = calibrateIntensity(intensity, dsr, distance);
-        else
-          intensity = calibrateIntensity_old(intensity, dsr, distance);
-
-        float distance2 = pixelToDistance(distance, dsr);
-        if (dis_resolution_mode_ == 0)  // distance resolution is 0.5cm
-        {
-          distance2 = distance2 * DISTANCE_RESOLUTION_NEW;
-        }
-        else
-        {
-          distance2 = distance2 * DISTANCE_RESOLUTION;
-        }
-
-        int arg_horiz = (azimuth_corrected + 36000) % 36000;
-        int arg_horiz_orginal = arg_horiz;
-        int arg_vert = ((VERT_ANGLE[dsr]) % 36000 + 36000) % 36000;
-
-        pcl::PointXYZI point;
-
-        if (distance2 > max_distance_ || distance2 < min_distance_ ||
-            (angle_flag_ && (arg_horiz < start_angle_ || arg_horiz > end_angle_)) ||
-            (!angle_flag_ && (arg_horiz > end_angle_ && arg_horiz < start_angle_)))  // invalid distance
-        {
-          point.x = NAN;
-          point.y = NAN;
-          point.z = NAN;
-          point.intensity = 0;
-          pointcloud->at(2 * this->block_num + firing, dsr) = point;
-        }
-        else
-        {
-          // If you want to fix the rslidar X aixs to the front side of the cable, please use the two line below
-
-          point.x = distance2 * this->cos_lookup_table_[arg_vert] * this->cos_lookup_table_[arg_horiz] +
-                    Rx_ * this->cos_lookup_table_[arg_horiz_orginal];
-          point.y = -distance2 * this->cos_lookup_table_[arg_vert] * this->sin_lookup_table_[arg_horiz] -
-                    Rx_ * this->sin_lookup_table_[arg_horiz_orginal];
-          point.z = distance2 * this->sin_lookup_table_[arg_vert] + Rz_;
-          point.intensity = intensity;
-          pointcloud->at(2 * this->block_num + firing, dsr) = point;
-        }
-      }
-    }
+    (this->*kernel)(raw->blocks[block], azimuth, azimuth_diff, points, width);
   }
 }
 
-void RawData::unpack_RS32(const rslidar_msgs::rslidarPacket& pkt, pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud)
+void RawData::unpack_RS32(const rslidar_msgs::rslidarPacket& pkt, pcl::PointXYZI* points, int width, bool compact)
 {
   float azimuth;  // 0.01 dgree
-  float intensity;
   float azimuth_diff;
-  float azimuth_corrected_f;
-  int azimuth_corrected;
 
   const raw_packet_t* raw = (const raw_packet_t*)&pkt.data[42];
 
@@ -982,10 +1503,12 @@ void RawData::unpack_RS32(const rslidar_msgs::rslidarPacket& pkt, pcl::PointClou
   {
     temper = computeTemperature(pkt.data[38], pkt.data[39]);
     tempPacketNum = 1;
-    std_msgs::Float32 temperature_msgs;
-    temperature_msgs.data = temper;
-    temperature_pub_.publish(temperature_msgs);
+    // published by the device status thread
+    temperature_.store(temper, std::memory_order_relaxed);
+    temperature_fresh_.store(true, std::memory_order_relaxed);
   }
+  prepareTerms();
+  BlockKernel kernel = selectKernel(compact);
 
   for (int block = 0; block < BLOCKS_PER_PACKET; block++, this->block_num++)  // 1 packet:12 data blocks
   {
@@ -1031,142 +1554,7 @@ void RawData::unpack_RS32(const rslidar_msgs::rslidarPacket& pkt, pcl::PointClou
     }
     azimuth_diff = (float)(diff);
 
-    if (dis_resolution_mode_ == 0)  // distance resolution is 0.5cm and delete the AB packet mechanism
-    {
-      for (int dsr = 0, k = 0; dsr < RS32_SCANS_PER_FIRING * RS32_FIRINGS_PER_BLOCK; dsr++, k += RAW_SCAN_SIZE)  // 16 3
-      {
-        int dsr_temp;
-        if (dsr >= 16)
-        {
-          dsr_temp = dsr - 16;
-        }
-        else
-        {
-          dsr_temp = dsr;
-        }
-        azimuth_corrected_f = azimuth + (azimuth_diff * ((dsr_temp * RS32_DSR_TOFFSET)) / RS32_BLOCK_TDURATION);
-        azimuth_corrected = correctAzimuth(azimuth_corrected_f, dsr);
-
-        union two_bytes tmp;
-        tmp.bytes[1] = raw->blocks[block].data[k];
-        tmp.bytes[0] = raw->blocks[block].data[k + 1];
-        int distance = tmp.uint;
-
-        // read intensity
-        intensity = (float)raw->blocks[block].data[k + 2];
-        intensity = calibrateIntensity(intensity, dsr, distance);
-
-        float distance2 = pixelToDistance(distance, dsr);
-        distance2 = distance2 * DISTANCE_RESOLUTION_NEW;
-
-        int arg_horiz_orginal = (int)azimuth_corrected_f % 36000;
-        int arg_horiz = azimuth_corrected;
-        int arg_vert = ((VERT_ANGLE[dsr]) % 36000 + 36000) % 36000;
-        pcl::PointXYZI point;
-
-        if (distance2 > max_distance_ || distance2 < min_distance_ ||
-            (angle_flag_ && (arg_horiz < start_angle_ || arg_horiz > end_angle_)) ||
-            (!angle_flag_ && (arg_horiz > end_angle_ && arg_horiz < start_angle_)))  // invalid distance
-        {
-          point.x = NAN;
-          point.y = NAN;
-          point.z = NAN;
-          point.intensity = 0;
-          pointcloud->at(this->block_num, dsr) = point;
-        }
-        else
-        {
-          // If you want to fix the rslidar X aixs to the front side of the cable, please use the two line below
-          point.x = distance2 * this->cos_lookup_table_[arg_vert] * this->cos_lookup_table_[arg_horiz] +
-                    Rx_ * this->cos_lookup_table_[arg_horiz_orginal];
-          point.y = -distance2 * this->cos_lookup_table_[arg_vert] * this->sin_lookup_table_[arg_horiz] -
-                    Rx_ * this->sin_lookup_table_[arg_horiz_orginal];
-          point.z = distance2 * this->sin_lookup_table_[arg_vert] + Rz_;
-          point.intensity = intensity;
-          pointcloud->at(this->block_num, dsr) = point;
-        }
-      }
-    }
-    else
-    {
-      // Estimate the type of packet
-      union two_bytes tmp_flag;
-      tmp_flag.bytes[1] = raw->blocks[block].data[0];
-      tmp_flag.bytes[0] = raw->blocks[block].data[1];
-      int ABflag = isABPacket(tmp_flag.uint);
-
-      int k = 0;
-      int index;
-      for (int dsr = 0; dsr < RS32_SCANS_PER_FIRING * RS32_FIRINGS_PER_BLOCK; dsr++, k += RAW_SCAN_SIZE)  // 16   3
-      {
-        if (ABflag == 1 && dsr < 16)
-        {
-          index = k + 48;
-        }
-        else if (ABflag == 1 && dsr >= 16)
-        {
-          index = k - 48;
-        }
-        else
-        {
-          index = k;
-        }
-
-        int dsr_temp;
-        if (dsr >= 16)
-        {
-          dsr_temp = dsr - 16;
-        }
-        else
-        {
-          dsr_temp = dsr;
-        }
-        azimuth_corrected_f = azimuth + (azimuth_diff * ((dsr_temp * RS32_DSR_TOFFSET)) / RS32_BLOCK_TDURATION);
-        azimuth_corrected = correctAzimuth(azimuth_corrected_f, dsr);
-
-        union two_bytes tmp;
-        tmp.bytes[1] = raw->blocks[block].data[index];
-        tmp.bytes[0] = raw->blocks[block].data[index + 1];
-        int ab_flag_in_block = isABPacket(tmp.uint);
-        int distance = tmp.uint - ab_flag_in_block * 32768;
-
-        // read intensity
-        intensity = (float)raw->blocks[block].data[index + 2];
-        intensity = calibrateIntensity(intensity, dsr, distance);
-
-        float distance2 = pixelToDistance(distance, dsr);
-        distance2 = distance2 * DISTANCE_RESOLUTION;
-
-        int arg_horiz_orginal = (int)azimuth_corrected_f % 36000;
-        int arg_horiz = azimuth_corrected;
-        int arg_vert = ((VERT_ANGLE[dsr]) % 36000 + 36000) % 36000;
-
-        pcl::PointXYZI point;
-
-        if (distance2 > max_distance_ || distance2 < min_distance_ ||
-            (angle_flag_ && (arg_horiz < start_angle_ || arg_horiz > end_angle_)) ||
-            (!angle_flag_ && (arg_horiz > end_angle_ && arg_horiz < start_angle_)))  // invalid distance
-        {
-          point.x = NAN;
-          point.y = NAN;
-          point.z = NAN;
-          point.intensity = 0;
-          pointcloud->at(this->block_num, dsr) = point;
-        }
-        else
-        {
-          // If you want to fix the rslidar X aixs to the front side of the cable, please use the two line below
-          point.x = distance2 * this->cos_lookup_table_[arg_vert] * this->cos_lookup_table_[arg_horiz] +
-                    Rx_ * this->cos_lookup_table_[arg_horiz_orginal];
-          point.y = -distance2 * this->cos_lookup_table_[arg_vert] * this->sin_lookup_table_[arg_horiz] -
-                    Rx_ * this->sin_lookup_table_[arg_horiz_orginal];
-          point.z = distance2 * this->sin_lookup_table_[arg_vert] + Rz_;
-          point.intensity = intensity;
-          pointcloud->at(this->block_num, dsr) = point;
-        }
-      }
-    }
+    (this->*kernel)(raw->blocks[block], azimuth, azimuth_diff, points, width);
   }
 }
-
 }  // namespace rslidar_rawdata
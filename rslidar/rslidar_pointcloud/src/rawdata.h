@@ -14,8 +14,12 @@
 #ifndef _RAWDATA_H
 #define _RAWDATA_H
 
+#include <atomic>
+#include <vector>
+#include <boost/thread/thread.hpp>
 #include <ros/ros.h>
 #include <ros/package.h>
+#include <ros/callback_queue.h>
 #include <rslidar_msgs/rslidarPacket.h>
 #include <rslidar_msgs/rslidarScan.h>
 #include "std_msgs/String.h"
@@ -119,20 +123,22 @@ class RawData
 public:
   RawData();
 
-  ~RawData()
-  {
-    this->cos_lookup_table_.clear();
-    this->sin_lookup_table_.clear();
-  }
+  ~RawData();
 
-  /*load the cablibrated files: angle, distance, intensity*/
+  /*load the cablibrated files: angle, distance, intensity, and start the device status thread*/
   void loadConfigFile(ros::NodeHandle node, ros::NodeHandle private_nh);
 
   /*unpack the RS16 UDP packet and opuput PCL PointXYZI type*/
   void unpack(const rslidar_msgs::rslidarPacket& pkt, pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud);
 
+  /*unpack the UDP packet into the rows of width points, of a PCL cloud or a PointCloud2 alike*/
+  void unpack(const rslidar_msgs::rslidarPacket& pkt, pcl::PointXYZI* points, int width);
+
+  /*unpack the UDP packet into the points of the returns in the crop only, appended from points[compact_size]*/
+  void unpackCompact(const rslidar_msgs::rslidarPacket& pkt, pcl::PointXYZI* points);
+
   /*unpack the RS32 UDP packet and opuput PCL PointXYZI type*/
-  void unpack_RS32(const rslidar_msgs::rslidarPacket& pkt, pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud);
+  void unpack_RS32(const rslidar_msgs::rslidarPacket& pkt, pcl::PointXYZI* points, int width, bool compact = false);
 
   /*compute temperature*/
   float computeTemperature(unsigned char bit1, unsigned char bit2);
@@ -153,13 +159,17 @@ public:
   /*estimate the packet type*/
   int isABPacket(int distance);
 
+  /*the calibration of a difop packet, of the device status thread*/
   void processDifop(const rslidar_msgs::rslidarPacket::ConstPtr& difop_msg);
+  /*a difop packet handed to the device status thread, for those not of the difop topic*/
+  void postDifop(const rslidar_msgs::rslidarPacket::ConstPtr& difop_msg);
   ros::Subscriber difop_sub_;
   ros::Publisher temperature_pub_;
   bool is_init_curve_;
   bool is_init_angle_;
   bool is_init_top_fw_;
   int block_num = 0;
+  int compact_size = 0;  // points written by unpackCompact, until reset
   int intensity_mode_;
   int intensityFactor;
 
@@ -171,6 +181,8 @@ private:
   int end_angle_;
   float max_distance_;
   float min_distance_;
+  float max_z_;  // the height band of the crop, in the lidar frame
+  float min_z_;
   int dis_resolution_mode_;
   int return_mode_;
   bool info_print_flag_;
@@ -180,20 +192,118 @@ private:
   /* cos/sin lookup table */
   std::vector<double> cos_lookup_table_;
   std::vector<double> sin_lookup_table_;
-};
 
-static int VERT_ANGLE[32];
-static int HORI_ANGLE[32];
-static float aIntensityCal[7][32];
-static float aIntensityCal_old[1600][32];
-static bool Curvesis_new = true;
-static int g_ChannelNum[32][51];
-static float CurvesRate[32];
-
-static float temper = 31.0;
-static int tempPacketNum = 0;
-static int numOfLasers = 16;
-static int TEMPERATURE_RANGE = 40;
+  /* terms of a laser the same for all the returns of a packet, c.f. prepareTerms */
+  struct LaserTerms
+  {
+    int channel;       // distance offset at the temperature of the packet, of g_ChannelNum
+    double cos_vert;   // of VERT_ANGLE
+    double sin_vert;
+    float far_base;    // intensity mode 2 reference power at 40 m
+    float far_slope;   // its difference from 39 m
+  };
+  LaserTerms laser_terms_[32];
+  float temper_gain_;  // of the received power at the temperature of the packet
+
+  /*the laser terms at the current temperature and calibration, once per packet*/
+  void prepareTerms();
+  float calibrateIntensity(float inten, int calIdx, int distance, const LaserTerms& laser);
+  float calibrateIntensity_old(float inten, int calIdx, int distance, const LaserTerms& laser);
+  float receivedPower(float inten, int mode);
+  float referencePower(int calIdx, int algDist, int mode, const LaserTerms& laser);
+
+  /* the intensity curves baked into tables, rebuilt when the temperature bin or the calibration change */
+  float received_power_[2][256];        // of the raw intensities, in the intensity modes 1 and 2
+  int received_temperature_;            // the temperature bin of received_power_
+  std::vector<float> reference_power_;  // intensityFactor times the reference power, of each laser by algDist
+  int reference_size_;                  // its distances per laser, the last for all those beyond
+  int reference_mode_;                  // the intensity mode, resolution and factor of reference_power_
+  int reference_resolution_;
+  int reference_factor_;
+  bool reference_stale_;  // curves loaded since
+  void prepareIntensityTables();
+
+  /* the intensity calibration of the block kernels */
+  enum IntensityCalibration
+  {
+    INTENSITY_RAW,     // intensity mode 3, or calibrate_intensity false
+    INTENSITY_TABLES,  // the curves of the intensity modes 1 and 2, through the tables
+    INTENSITY_OLD,     // the old curves
+    INTENSITY_CURVES   // the curves evaluated for every return, of the modes warned about
+  };
+  bool calibrate_intensity_;  // else the raw intensities, for the consumers of the xyz only
+  template <IntensityCalibration Intensity>
+  float blockIntensity(uint8_t inten, int calIdx, int distance, const LaserTerms& laser);
+
+  /* the kernels decoding the returns of a block, one per model and modes, c.f. selectKernel */
+  typedef void (RawData::*BlockKernel)(const raw_block_t& block, float azimuth, float azimuth_diff,
+                                       pcl::PointXYZI* points, int width);
+  BlockKernel selectKernel(bool compact) const;
+  template <bool Dual, IntensityCalibration Intensity, bool Compact>
+  void unpackBlockRS16(const raw_block_t& block, float azimuth, float azimuth_diff, pcl::PointXYZI* points,
+                       int width);
+  template <bool ABPackets, IntensityCalibration Intensity, bool Compact>
+  void unpackBlockRS32(const raw_block_t& block, float azimuth, float azimuth_diff, pcl::PointXYZI* points,
+                       int width);
+  void unpackPacket(const rslidar_msgs::rslidarPacket& pkt, pcl::PointXYZI* points, int width, bool compact);
+
+  /* the calibration and the state of the lidar, of each RawData so that the lidars of a process may differ */
+  int VERT_ANGLE[32] = {};
+  int HORI_ANGLE[32] = {};
+  float aIntensityCal[7][32] = {};
+  float aIntensityCal_old[1600][32] = {};
+  bool Curvesis_new = true;
+  int g_ChannelNum[32][51] = {};
+  float CurvesRate[32] = {};
+
+  float temper = 31.0;
+  int tempPacketNum = 0;
+  int numOfLasers = 16;
+  int TEMPERATURE_RANGE = 40;
+
+  /* the calibration of the difop packets, swapped by read-copy-update
+   *
+   * The device status thread parses the difop packets into a copy of the
+   * last calibration published, and publishes the copy if it differs, the
+   * last one retired. The decoder loads the last one published at every
+   * packet, one acquire load, and adopts it into its members above when it
+   * changed, the retired ones freed once the decoder adopted a later one.
+   * There is one decoder per RawData, so no lock on either side.
+   */
+  struct Calibration
+  {
+    int VERT_ANGLE[32];
+    int HORI_ANGLE[32];
+    float aIntensityCal[7][32];
+    bool Curvesis_new;
+    int intensity_mode_;
+    int intensityFactor;
+    int dis_resolution_mode_;
+    int return_mode_;
+    uint64_t generation;  // of the publication, from 0 for that of the calibration files
+  };
+  void parseDifop(const uint8_t* data, Calibration& next);
+  void captureCalibration(Calibration& calibration) const;
+  void adoptCalibration(const Calibration& calibration);
+  static bool sameCalibration(const Calibration& a, const Calibration& b);
+  void publishCalibration(const Calibration& next);
+
+  std::atomic<const Calibration*> calibration_;  // the last one published
+  std::atomic<uint64_t> adopted_generation_;     // of the decoder's
+  const Calibration* adopted_;                   // of the decoder, never retired after
+  const Calibration* published_;                 // of the device status thread
+  std::vector<const Calibration*> retired_;      // of the device status thread, adopted or not
+
+  /* the device status thread: the difop packets and the temperature publication, off the decoder */
+  void statusLoop(ros::NodeHandle private_nh);
+  void publishTemperature(const ros::WallTimerEvent& event);
+  ros::CallbackQueue status_queue_;
+  ros::WallTimer temperature_timer_;
+  boost::shared_ptr<boost::thread> status_thread_;
+  std::atomic<bool> status_running_;
+  std::atomic<float> temperature_;        // of the decoder, as read from the packets
+  std::atomic<bool> temperature_fresh_;   // not published yet
+};
 }  // namespace rslidar_rawdata
 
 #endif  // __RAWDATA_H
@@ -0,0 +1,63 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#ifndef THREAD_CONFIG_THREAD_CONFIG_H
+#define THREAD_CONFIG_THREAD_CONFIG_H
+
+#include <string>
+#include <vector>
+
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <ros/node_handle.h>
+
+// The CPUs and the scheduling of the named threads of the perception nodes,
+// from the parameters of their node:
+//   scheduling/<name>/cpus      "2-3,5" (the format of the kernel),
+//                               "isolated" for the CPUs isolated from the
+//                               scheduler (isolcpus), "isolated:N" for the
+//                               Nth of them
+//   scheduling/<name>/priority  SCHED_FIFO priority, 1 to 99
+// Unset, the thread is left as it was created, i.e. as its creator.
+//
+// Every thread set up is recorded for the diagnostics of its node, with the
+// affinity and the policy it ends up with, read back from the kernel.
+namespace thread_config {
+
+struct Settings {
+  Settings() : priority(0) {}
+  Settings(const std::string &cpus, int priority) : cpus(cpus), priority(priority) {}
+  std::string cpus; // empty: unchanged
+  int priority;     // 0: unchanged
+};
+
+// The CPUs of a list in the format of the kernel ("0-2,5"), false if it is
+// malformed.
+bool parseCpus(const std::string &list, std::vector<int> &cpus);
+
+// The CPUs of settings, "isolated" ones from the isolated list; false with
+// the reason in error if they can not be.
+bool resolveCpus(const std::string &cpus, const std::string &isolated, std::vector<int> &resolved, std::string &error);
+
+// The settings of name, defaults for those not set.
+Settings read(const ros::NodeHandle &nh, const std::string &name, const Settings &defaults = Settings());
+
+// Names the calling thread name and applies settings to it, the thread
+// recorded for node. Whether all of them were applied: the other ones are
+// warned about once and reported on the diagnostics (e.g. a priority with
+// no rtprio limit for the user).
+bool apply(const std::string &node, const std::string &name, const Settings &settings);
+
+// The calling thread set up from the parameters of nh, recorded for its
+// namespace.
+bool configure(const ros::NodeHandle &nh, const std::string &name, const Settings &defaults = Settings());
+
+// The threads recorded for node, their CPUs and scheduling.
+void diagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat, const std::string &node);
+
+} // namespace thread_config
+
+#endif // THREAD_CONFIG_THREAD_CONFIG_H
@@ -0,0 +1,251 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+#include "thread_config/thread_config.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+namespace thread_config {
+
+namespace {
+
+const char *ISOLATED_CPUS = "/sys/devices/system/cpu/isolated";
+// Of the kernel, terminating null included.
+const size_t THREAD_NAME_SIZE = 16;
+
+struct Record {
+  long tid;
+  Settings settings;
+  std::string applied; // the affinity and the policy read back
+  std::string error;
+};
+
+class Registry {
+public:
+  // never destroyed, the threads of the nodelets may be set up until the exit
+  static Registry &instance() {
+    static Registry *registry = new Registry;
+    return *registry;
+  }
+
+  void record(const std::string &node, const std::string &name, const Record &record) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    nodes_[node][name] = record;
+  }
+
+  std::map<std::string, Record> records(const std::string &node) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return nodes_[node];
+  }
+
+private:
+  std::mutex mutex_;
+  std::map<std::string, std::map<std::string, Record> > nodes_;
+};
+
+bool parseCpu(const std::string &s, int &cpu) {
+  if(s.empty() || s.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+  cpu = std::atoi(s.c_str());
+  return cpu < CPU_SETSIZE;
+}
+
+std::string readIsolated() {
+  std::ifstream file(ISOLATED_CPUS);
+  std::string list;
+  std::getline(file, list);
+  return list;
+}
+
+std::string formatCpus(const cpu_set_t &set) {
+  std::ostringstream out;
+  int first = -1;
+  for(int cpu = 0; cpu <= CPU_SETSIZE; cpu++) {
+    bool in = cpu < CPU_SETSIZE && CPU_ISSET(cpu, &set);
+    if(in && first < 0) {
+      first = cpu;
+    } else if(!in && first >= 0) {
+      if(out.tellp() > 0) {
+        out << ",";
+      }
+      out << first;
+      if(cpu - 1 > first) {
+        out << "-" << cpu - 1;
+      }
+      first = -1;
+    }
+  }
+  return out.str();
+}
+
+std::string describe(pthread_t thread) {
+  std::ostringstream out;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if(pthread_getaffinity_np(thread, sizeof(set), &set) == 0) {
+    out << "cpus " << formatCpus(set);
+  }
+  int policy;
+  sched_param param;
+  if(pthread_getschedparam(thread, &policy, &param) == 0) {
+    out << (out.tellp() > 0 ? ", " : "");
+    if(policy == SCHED_FIFO) {
+      out << "SCHED_FIFO " << param.sched_priority;
+    } else if(policy == SCHED_RR) {
+      out << "SCHED_RR " << param.sched_priority;
+    } else {
+      out << "SCHED_OTHER";
+    }
+  }
+  return out.str();
+}
+
+} // namespace
+
+bool parseCpus(const std::string &list, std::vector<int> &cpus) {
+  cpus.clear();
+  std::istringstream in(list);
+  std::string range;
+  while(std::getline(in, range, ',')) {
+    size_t dash = range.find('-');
+    int first, last;
+    if(dash == std::string::npos) {
+      if(!parseCpu(range, first)) {
+        return false;
+      }
+      last = first;
+    } else if(!parseCpu(range.substr(0, dash), first) || !parseCpu(range.substr(dash + 1), last) || last < first) {
+      return false;
+    }
+    for(int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return !cpus.empty();
+}
+
+bool resolveCpus(const std::string &cpus, const std::string &isolated, std::vector<int> &resolved, std::string &error) {
+  if(cpus.compare(0, 8, "isolated") != 0) {
+    if(!parseCpus(cpus, resolved)) {
+      error = "malformed cpus \"" + cpus + "\"";
+      return false;
+    }
+    return true;
+  }
+  if(!parseCpus(isolated, resolved)) {
+    error = "no isolated cpus (isolcpus= on the kernel command line)";
+    return false;
+  }
+  if(cpus == "isolated") {
+    return true;
+  }
+  int n;
+  if(cpus[8] != ':' || !parseCpu(cpus.substr(9), n)) {
+    error = "malformed cpus \"" + cpus + "\"";
+    return false;
+  }
+  if(n >= (int)resolved.size()) {
+    std::ostringstream out;
+    out << "isolated cpu " << n << " of " << resolved.size() << " only";
+    error = out.str();
+    return false;
+  }
+  resolved = std::vector<int>(1, resolved[n]);
+  return true;
+}
+
+Settings read(const ros::NodeHandle &nh, const std::string &name, const Settings &defaults) {
+  Settings settings;
+  nh.param("scheduling/" + name + "/cpus", settings.cpus, defaults.cpus);
+  nh.param("scheduling/" + name + "/priority", settings.priority, defaults.priority);
+  return settings;
+}
+
+bool apply(const std::string &node, const std::string &name, const Settings &settings) {
+  pthread_t self = pthread_self();
+  Record record;
+  record.tid = syscall(SYS_gettid);
+  record.settings = settings;
+  std::vector<std::string> errors;
+
+  // as seen by top -H and perf, truncated
+  pthread_setname_np(self, name.substr(0, THREAD_NAME_SIZE - 1).c_str());
+
+  if(!settings.cpus.empty()) {
+    std::vector<int> cpus;
+    std::string error;
+    if(resolveCpus(settings.cpus, settings.cpus.compare(0, 8, "isolated") == 0 ? readIsolated() : "", cpus, error)) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for(size_t i = 0; i < cpus.size(); i++) {
+        CPU_SET(cpus[i], &set);
+      }
+      int err = pthread_setaffinity_np(self, sizeof(set), &set);
+      if(err != 0) {
+        errors.push_back("cpus " + settings.cpus + " not set: " + strerror(err));
+      }
+    } else {
+      errors.push_back(error);
+    }
+  }
+  if(settings.priority > 0) {
+    sched_param param;
+    param.sched_priority = settings.priority;
+    int err = pthread_setschedparam(self, SCHED_FIFO, &param);
+    if(err != 0) {
+      std::ostringstream out;
+      out << "SCHED_FIFO " << settings.priority << " not set: " << strerror(err);
+      errors.push_back(out.str());
+    }
+  }
+
+  record.applied = describe(self);
+  for(size_t i = 0; i < errors.size(); i++) {
+    record.error += (i ? "; " : "") + errors[i];
+  }
+  if(!record.error.empty()) {
+    ROS_WARN("[%s] thread %s: %s", node.c_str(), name.c_str(), record.error.c_str());
+  }
+  Registry::instance().record(node, name, record);
+  return record.error.empty();
+}
+
+bool configure(const ros::NodeHandle &nh, const std::string &name, const Settings &defaults) {
+  return apply(nh.getNamespace(), name, read(nh, name, defaults));
+}
+
+void diagnostics(diagnostic_updater::DiagnosticStatusWrapper &stat, const std::string &node) {
+  std::map<std::string, Record> records = Registry::instance().records(node);
+  int failed = 0;
+  for(std::map<std::string, Record>::const_iterator it = records.begin(); it != records.end(); ++it) {
+    std::ostringstream value;
+    value << "tid " << it->second.tid << ", " << it->second.applied;
+    if(!it->second.error.empty()) {
+      value << " (" << it->second.error << ")";
+      failed++;
+    }
+    stat.add(it->first, value.str());
+  }
+  if(failed > 0) {
+    stat.summaryf(diagnostic_msgs::DiagnosticStatus::WARN, "%d of %d threads not set up as configured", failed, (int)records.size());
+  } else {
+    stat.summaryf(diagnostic_msgs::DiagnosticStatus::OK, "%d threads", (int)records.size());
+  }
+}
+
+} // namespace thread_config
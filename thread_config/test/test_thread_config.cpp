@@ -0,0 +1,64 @@
+/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Zhi Yan
+ * All rights reserved.
+ **/
+
+// Google Test
+#include <gtest/gtest.h>
+
+// c++
+#include <thread>
+
+#include "thread_config/thread_config.h"
+
+TEST(ThreadConfig, ParsesCpuLists) {
+  std::vector<int> cpus;
+  ASSERT_TRUE(thread_config::parseCpus("0-2,5", cpus));
+  ASSERT_EQ(4u, cpus.size());
+  EXPECT_EQ(0, cpus[0]);
+  EXPECT_EQ(2, cpus[2]);
+  EXPECT_EQ(5, cpus[3]);
+  EXPECT_FALSE(thread_config::parseCpus("", cpus));
+  EXPECT_FALSE(thread_config::parseCpus("3-1", cpus));
+  EXPECT_FALSE(thread_config::parseCpus("1,a", cpus));
+}
+
+TEST(ThreadConfig, ResolvesIsolatedCpus) {
+  std::vector<int> cpus;
+  std::string error;
+  ASSERT_TRUE(thread_config::resolveCpus("isolated", "4-5", cpus, error));
+  EXPECT_EQ(2u, cpus.size());
+  ASSERT_TRUE(thread_config::resolveCpus("isolated:1", "4-5", cpus, error));
+  ASSERT_EQ(1u, cpus.size());
+  EXPECT_EQ(5, cpus[0]);
+  EXPECT_FALSE(thread_config::resolveCpus("isolated:2", "4-5", cpus, error));
+  EXPECT_FALSE(thread_config::resolveCpus("isolated", "", cpus, error));
+  EXPECT_FALSE(error.empty());
+}
+
+TEST(ThreadConfig, ReportsTheThreads) {
+  bool applied = false;
+  // a thread of its own, not to pin the test
+  std::thread thread([&applied]() {
+    applied = thread_config::apply("/test", "pinned", thread_config::Settings("0", 0));
+  });
+  thread.join();
+  EXPECT_TRUE(applied);
+  EXPECT_TRUE(thread_config::apply("/test", "unchanged", thread_config::Settings()));
+  EXPECT_FALSE(thread_config::apply("/test", "missing", thread_config::Settings("isolated:1000", 0)));
+
+  diagnostic_updater::DiagnosticStatusWrapper stat;
+  thread_config::diagnostics(stat, "/test");
+  EXPECT_EQ(diagnostic_msgs::DiagnosticStatus::WARN, stat.level);
+  ASSERT_EQ(3u, stat.values.size());
+  EXPECT_EQ("missing", stat.values[0].key);
+  EXPECT_EQ(0u, stat.values[1].value.find("tid "));
+  EXPECT_NE(std::string::npos, stat.values[1].value.find("cpus 0,"));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}